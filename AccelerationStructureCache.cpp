@@ -0,0 +1,224 @@
+#include "AccelerationStructureCache.h"
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+static const char FILE_MAGIC[4] = { 'B', 'L', 'A', 'S' };
+// Bumped whenever the file layout changes, older files then miss
+static const uint32_t FILE_VERSION = 1;
+
+struct FileHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t meshHash;
+    uint8_t driverUUID[VK_UUID_SIZE];
+    uint8_t deviceUUID[VK_UUID_SIZE];
+    double buildMilliseconds;
+    uint64_t blobSize;
+    // Catches files cut short or damaged on disk before the driver sees them
+    uint64_t blobHash;
+};
+
+// The serialized header: driver UUID, compatibility UUID, serialized size, deserialized size, handle count
+static const size_t DESERIALIZED_SIZE_OFFSET = 2 * VK_UUID_SIZE + sizeof(uint64_t);
+
+AccelerationStructureCache::AccelerationStructureCache(const std::string& directory, const uint8_t driverUUID[VK_UUID_SIZE], const uint8_t deviceUUID[VK_UUID_SIZE]) : directory(directory) {
+    memcpy(this->driverUUID, driverUUID, VK_UUID_SIZE);
+    memcpy(this->deviceUUID, deviceUUID, VK_UUID_SIZE);
+}
+
+std::string AccelerationStructureCache::pathFor(uint64_t meshHash) const {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.blas", static_cast<unsigned long long>(meshHash));
+    return directory + "/" + name;
+}
+
+bool AccelerationStructureCache::load(uint64_t meshHash, Entry& entry) const {
+    std::ifstream file(pathFor(meshHash), std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    FileHeader header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+        return false;
+    }
+    if (memcmp(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0 || header.version != FILE_VERSION || header.meshHash != meshHash) {
+        return false;
+    }
+    if (memcmp(header.driverUUID, driverUUID, VK_UUID_SIZE) != 0 || memcmp(header.deviceUUID, deviceUUID, VK_UUID_SIZE) != 0) {
+        return false;
+    }
+
+    // A size past the end of the file is caught by the read before anything that large is allocated
+    file.seekg(0, std::ios::end);
+    if (static_cast<uint64_t>(file.tellg()) != sizeof(header) + header.blobSize) {
+        return false;
+    }
+    file.seekg(sizeof(header));
+    entry.blob.resize(static_cast<size_t>(header.blobSize));
+    if (!file.read(reinterpret_cast<char*>(entry.blob.data()), entry.blob.size()) || hash(entry.blob.data(), entry.blob.size()) != header.blobHash) {
+        entry.blob.clear();
+        return false;
+    }
+    entry.buildMilliseconds = header.buildMilliseconds;
+    return true;
+}
+
+bool AccelerationStructureCache::store(uint64_t meshHash, const Entry& entry) const {
+    std::error_code ec;
+    std::filesystem::create_directories(directory, ec);
+
+    FileHeader header{};
+    memcpy(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+    header.version = FILE_VERSION;
+    header.meshHash = meshHash;
+    memcpy(header.driverUUID, driverUUID, VK_UUID_SIZE);
+    memcpy(header.deviceUUID, deviceUUID, VK_UUID_SIZE);
+    header.buildMilliseconds = entry.buildMilliseconds;
+    header.blobSize = entry.blob.size();
+    header.blobHash = hash(entry.blob.data(), entry.blob.size());
+
+    std::string path = pathFor(meshHash);
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            return false;
+        }
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(entry.blob.data()), entry.blob.size());
+        if (!file) {
+            file.close();
+            std::filesystem::remove(temporary, ec);
+            return false;
+        }
+    }
+    std::filesystem::rename(temporary, path, ec);
+    if (ec) {
+        std::filesystem::remove(temporary, ec);
+        return false;
+    }
+    return true;
+}
+
+uint64_t AccelerationStructureCache::hash(const void* data, size_t size, uint64_t seed) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    uint64_t result = seed;
+    for (size_t i = 0; i < size; i++) {
+        result ^= bytes[i];
+        result *= 1099511628211ull;
+    }
+    return result;
+}
+
+uint64_t AccelerationStructureCache::deserializedSize(const std::vector<uint8_t>& blob) {
+    if (blob.size() < DESERIALIZED_SIZE_OFFSET + sizeof(uint64_t)) {
+        return 0;
+    }
+    uint64_t size;
+    memcpy(&size, blob.data() + DESERIALIZED_SIZE_OFFSET, sizeof(size));
+    return size;
+}
+
+bool AccelerationStructureCache::runSelfTest() {
+    size_t checks = 0;
+    size_t failures = 0;
+    auto check = [&](bool ok, const std::string& what) {
+        checks++;
+        if (!ok) {
+            if (failures < 10) {
+                printf("    FAILED: %s \n", what.c_str());
+            }
+            failures++;
+        }
+    };
+
+    std::error_code ec;
+    std::string directory = (std::filesystem::temp_directory_path(ec) / "blas-cache-test").string();
+    std::filesystem::remove_all(directory, ec);
+
+    uint8_t driver[VK_UUID_SIZE];
+    uint8_t device[VK_UUID_SIZE];
+    for (uint32_t i = 0; i < VK_UUID_SIZE; i++) {
+        driver[i] = static_cast<uint8_t>(i);
+        device[i] = static_cast<uint8_t>(0x80 + i);
+    }
+    AccelerationStructureCache cache(directory, driver, device);
+
+    // A blob shaped like a serialized structure, the header followed by some payload
+    Entry stored;
+    stored.buildMilliseconds = 12.5;
+    stored.blob.resize(DESERIALIZED_SIZE_OFFSET + 3 * sizeof(uint64_t) + 1000);
+    for (size_t i = 0; i < stored.blob.size(); i++) {
+        stored.blob[i] = static_cast<uint8_t>(i * 31 + 7);
+    }
+    uint64_t size = 65536;
+    memcpy(stored.blob.data() + DESERIALIZED_SIZE_OFFSET, &size, sizeof(size));
+    check(deserializedSize(stored.blob) == size, "deserialized size read from the blob header");
+    check(deserializedSize(std::vector<uint8_t>(DESERIALIZED_SIZE_OFFSET)) == 0, "a blob without a header has no size");
+
+    uint64_t meshHash = hash("mesh", 4);
+    Entry loaded;
+    check(!cache.load(meshHash, loaded), "empty cache misses");
+    check(cache.store(meshHash, stored), "store succeeds");
+    check(cache.load(meshHash, loaded), "stored entry loads");
+    check(loaded.blob == stored.blob, "loaded blob matches");
+    check(loaded.buildMilliseconds == stored.buildMilliseconds, "loaded build time matches");
+    check(!std::filesystem::exists(cache.pathFor(meshHash) + ".tmp"), "no temporary file is left behind");
+    check(!cache.load(hash("other mesh", 10), loaded), "another mesh misses");
+
+    // Storing again replaces the entry
+    stored.buildMilliseconds = 20.0;
+    stored.blob.resize(stored.blob.size() / 2);
+    check(cache.store(meshHash, stored), "second store succeeds");
+    check(cache.load(meshHash, loaded) && loaded.blob == stored.blob && loaded.buildMilliseconds == 20.0, "second store replaces the entry");
+
+    uint8_t otherDriver[VK_UUID_SIZE];
+    memcpy(otherDriver, driver, VK_UUID_SIZE);
+    otherDriver[VK_UUID_SIZE - 1] ^= 1;
+    check(!AccelerationStructureCache(directory, otherDriver, device).load(meshHash, loaded), "another driver misses");
+    check(!AccelerationStructureCache(directory, driver, otherDriver).load(meshHash, loaded), "another device misses");
+
+    // Damage the file a few ways, every one has to miss
+    std::string path = cache.pathFor(meshHash);
+    std::vector<char> file;
+    {
+        std::ifstream in(path, std::ios::binary);
+        file.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    auto damaged = [&](const std::vector<char>& contents) {
+        {
+            std::ofstream out(path, std::ios::binary | std::ios::trunc);
+            out.write(contents.data(), contents.size());
+        }
+        return !cache.load(meshHash, loaded);
+    };
+    check(damaged(std::vector<char>(file.begin(), file.end() - 1)), "truncated file misses");
+    check(damaged(std::vector<char>(file.begin(), file.begin() + sizeof(FileHeader) / 2)), "file cut inside the header misses");
+    std::vector<char> longer = file;
+    longer.push_back(0);
+    check(damaged(longer), "file with trailing bytes misses");
+    std::vector<char> flipped = file;
+    flipped[sizeof(FileHeader) + 100] ^= 0x10;
+    check(damaged(flipped), "flipped blob byte misses");
+    std::vector<char> version = file;
+    version[offsetof(FileHeader, version)] ^= 1;
+    check(damaged(version), "other file version misses");
+    check(!damaged(file), "the undamaged file loads again");
+
+    // The mesh hash has to move with every byte and with the order of the parts
+    uint32_t a = 1;
+    uint32_t b = 2;
+    check(hash(&a, sizeof(a)) != hash(&b, sizeof(b)), "different data hashes differently");
+    check(hash(&b, sizeof(b), hash(&a, sizeof(a))) != hash(&a, sizeof(a), hash(&b, sizeof(b))), "chained hashes depend on order");
+    check(hash(nullptr, 0) == HASH_SEED, "empty data leaves the seed");
+
+    std::filesystem::remove_all(directory, ec);
+
+    printf("%zu checks, %zu failed \n", checks, failures);
+    return failures == 0;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <volk.h>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// On-disk store of serialized bottom level acceleration structures, one file per mesh named after the mesh's hash.
+// Every file records the driver and device UUIDs it was written with, so another GPU or a driver update misses instead
+// of handing the implementation data it would reject. The blob is what vkCmdCopyAccelerationStructureToMemoryKHR
+// wrote, whose own version header the caller still checks with vkGetDeviceAccelerationStructureCompatibilityKHR
+class AccelerationStructureCache {
+
+public:
+	struct Entry {
+		// The serialized acceleration structure
+		std::vector<uint8_t> blob;
+		// How long building and compacting the structure took on the run that cached it
+		double buildMilliseconds = 0.0;
+	};
+
+	AccelerationStructureCache() = default;
+	AccelerationStructureCache(const std::string& directory, const uint8_t driverUUID[VK_UUID_SIZE], const uint8_t deviceUUID[VK_UUID_SIZE]);
+
+	// False when there is no file for the mesh, or it was written by another driver or device, or it is damaged
+	bool load(uint64_t meshHash, Entry& entry) const;
+	// Written beside the old file and renamed over it, so an interrupted run never leaves half a file. False when the
+	// file could not be written, the structure just stays uncached then
+	bool store(uint64_t meshHash, const Entry& entry) const;
+	std::string pathFor(uint64_t meshHash) const;
+
+	// 64-bit FNV-1a, pass the previous result as seed to hash a mesh part by part
+	static const uint64_t HASH_SEED = 14695981039346656037ull;
+	static uint64_t hash(const void* data, size_t size, uint64_t seed = HASH_SEED);
+	// Size of the acceleration structure a blob deserializes to, read from the header the spec puts in front of every
+	// serialized structure. 0 when the blob is too short to have one
+	static uint64_t deserializedSize(const std::vector<uint8_t>& blob);
+
+	// Stores and loads entries in a temporary directory and checks that files from another driver, device or mesh and
+	// damaged files all miss. Returns false if any check failed
+	static bool runSelfTest();
+
+private:
+	std::string directory;
+	uint8_t driverUUID[VK_UUID_SIZE] = {};
+	uint8_t deviceUUID[VK_UUID_SIZE] = {};
+};
@@ -0,0 +1,242 @@
+#include "AccelerationStructurePool.h"
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <string>
+
+static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+AccelerationStructurePool::AccelerationStructurePool(VkDeviceSize blockSize) : blockSize(alignUp(blockSize, ALIGNMENT)) {
+}
+
+AccelerationStructurePool::Allocation AccelerationStructurePool::allocate(VkDeviceSize size) {
+    Allocation allocation;
+    if (size == 0) {
+        return allocation;
+    }
+    // Sizes are rounded up too, so the next structure packed after this one starts aligned
+    size = alignUp(size, ALIGNMENT);
+
+    auto fit = freeBySize.lower_bound(std::make_tuple(size, 0u, VkDeviceSize(0)));
+    if (fit == freeBySize.end()) {
+        uint32_t block = static_cast<uint32_t>(blockSizes.size());
+        blockSizes.push_back(std::max(blockSize, size));
+        freeRanges.emplace_back();
+        insertFree(block, 0, blockSizes[block]);
+        fit = freeBySize.lower_bound(std::make_tuple(size, 0u, VkDeviceSize(0)));
+    }
+
+    VkDeviceSize rangeSize = std::get<0>(*fit);
+    allocation.block = std::get<1>(*fit);
+    allocation.offset = std::get<2>(*fit);
+    allocation.size = size;
+    eraseFree(allocation.block, allocation.offset, rangeSize);
+    if (rangeSize > size) {
+        insertFree(allocation.block, allocation.offset + size, rangeSize - size);
+    }
+
+    allocationCount++;
+    usedBytes += size;
+    return allocation;
+}
+
+void AccelerationStructurePool::free(const Allocation& allocation) {
+    if (!allocation.isValid()) {
+        return;
+    }
+    VkDeviceSize offset = allocation.offset;
+    VkDeviceSize size = allocation.size;
+    std::map<VkDeviceSize, VkDeviceSize>& ranges = freeRanges[allocation.block];
+
+    // Merge with the free range ending where this one starts and the one starting where it ends
+    auto next = ranges.lower_bound(offset);
+    if (next != ranges.begin()) {
+        auto previous = std::prev(next);
+        if (previous->first + previous->second == offset) {
+            offset = previous->first;
+            size += previous->second;
+            eraseFree(allocation.block, previous->first, previous->second);
+        }
+    }
+    next = ranges.lower_bound(allocation.offset + allocation.size);
+    if (next != ranges.end() && next->first == allocation.offset + allocation.size) {
+        size += next->second;
+        eraseFree(allocation.block, next->first, next->second);
+    }
+    insertFree(allocation.block, offset, size);
+
+    allocationCount--;
+    usedBytes -= allocation.size;
+}
+
+void AccelerationStructurePool::clear() {
+    blockSizes.clear();
+    freeRanges.clear();
+    freeBySize.clear();
+    allocationCount = 0;
+    usedBytes = 0;
+}
+
+VkDeviceSize AccelerationStructurePool::getReservedBytes() const {
+    VkDeviceSize reserved = 0;
+    for (VkDeviceSize size : blockSizes) {
+        reserved += size;
+    }
+    return reserved;
+}
+
+void AccelerationStructurePool::insertFree(uint32_t block, VkDeviceSize offset, VkDeviceSize size) {
+    freeRanges[block][offset] = size;
+    freeBySize.insert(std::make_tuple(size, block, offset));
+}
+
+void AccelerationStructurePool::eraseFree(uint32_t block, VkDeviceSize offset, VkDeviceSize size) {
+    freeRanges[block].erase(offset);
+    freeBySize.erase(std::make_tuple(size, block, offset));
+}
+
+bool AccelerationStructurePool::runSelfTest() {
+    size_t checks = 0;
+    size_t failures = 0;
+    auto check = [&](bool ok, const std::string& what) {
+        checks++;
+        if (!ok) {
+            if (failures < 10) {
+                printf("    FAILED: %s \n", what.c_str());
+            }
+            failures++;
+        }
+    };
+
+    // Every live allocation aligned, inside its block and clear of the others, and the free ranges exactly the rest
+    auto validate = [&](const AccelerationStructurePool& pool, const std::vector<Allocation>& live, const std::string& when) {
+        std::vector<Allocation> sorted = live;
+        std::sort(sorted.begin(), sorted.end(), [](const Allocation& a, const Allocation& b) {
+            return a.block != b.block ? a.block < b.block : a.offset < b.offset;
+        });
+        bool aligned = true;
+        bool inside = true;
+        bool apart = true;
+        VkDeviceSize used = 0;
+        for (size_t i = 0; i < sorted.size(); i++) {
+            aligned &= sorted[i].offset % ALIGNMENT == 0 && sorted[i].size % ALIGNMENT == 0;
+            inside &= sorted[i].block < pool.getBlockCount() && sorted[i].offset + sorted[i].size <= pool.getBlockSize(sorted[i].block);
+            if (i > 0 && sorted[i - 1].block == sorted[i].block) {
+                apart &= sorted[i - 1].offset + sorted[i - 1].size <= sorted[i].offset;
+            }
+            used += sorted[i].size;
+        }
+        check(aligned, when + ": allocations are aligned");
+        check(inside, when + ": allocations lie inside their blocks");
+        check(apart, when + ": allocations do not overlap");
+        check(used == pool.getUsedBytes() && live.size() == pool.getAllocationCount(), when + ": used bytes and count match");
+
+        VkDeviceSize freeBytes = 0;
+        bool merged = true;
+        for (uint32_t block = 0; block < pool.getBlockCount(); block++) {
+            VkDeviceSize end = 0;
+            bool first = true;
+            for (const auto& range : pool.freeRanges[block]) {
+                merged &= first || range.first != end;
+                end = range.first + range.second;
+                first = false;
+                freeBytes += range.second;
+            }
+        }
+        check(merged, when + ": adjacent free ranges are merged");
+        check(freeBytes + used == pool.getReservedBytes(), when + ": free and used bytes cover the blocks");
+        check(pool.freeBySize.size() == [&]() { size_t n = 0; for (const auto& ranges : pool.freeRanges) { n += ranges.size(); } return n; }(), when + ": size index matches the ranges");
+    };
+
+    std::mt19937 random(46);
+
+    // Random sizes allocated and released in random order
+    {
+        AccelerationStructurePool pool(1024 * 1024);
+        std::vector<Allocation> live;
+        for (int step = 0; step < 20000; step++) {
+            if (live.empty() || random() % 3 != 0) {
+                VkDeviceSize size = 1 + random() % (random() % 16 == 0 ? 2 * 1024 * 1024 : 64 * 1024);
+                Allocation allocation = pool.allocate(size);
+                check(allocation.isValid() && allocation.size >= size, "allocation succeeds");
+                live.push_back(allocation);
+            }
+            else {
+                size_t index = random() % live.size();
+                pool.free(live[index]);
+                live[index] = live.back();
+                live.pop_back();
+            }
+            if (step % 2000 == 0) {
+                validate(pool, live, "random step " + std::to_string(step));
+            }
+        }
+        validate(pool, live, "random end");
+
+        uint32_t blocks = pool.getBlockCount();
+        for (const Allocation& allocation : live) {
+            pool.free(allocation);
+        }
+        live.clear();
+        validate(pool, live, "all freed");
+        bool whole = true;
+        for (uint32_t block = 0; block < pool.getBlockCount(); block++) {
+            whole &= pool.freeRanges[block].size() == 1 && pool.freeRanges[block].begin()->second == pool.getBlockSize(block);
+        }
+        check(whole, "every block is one free range once everything is freed");
+
+        // The freed space is handed out again before any block is added
+        for (int i = 0; i < 100; i++) {
+            live.push_back(pool.allocate(64 * 1024));
+        }
+        check(pool.getBlockCount() == blocks, "freed space is reused");
+        validate(pool, live, "reuse");
+    }
+
+    // Thousands of meshes built in batches, each BLAS allocated at its build size and replaced by a compacted copy
+    // about half the size, as buildBlas does. The pool stays at a few blocks where one allocation per structure
+    // would need thousands
+    {
+        AccelerationStructurePool pool;
+        const uint32_t meshCount = 10000;
+        const uint32_t batch = 256;
+        std::vector<Allocation> compacted;
+        VkDeviceSize compactedBytes = 0;
+        for (uint32_t first = 0; first < meshCount; first += batch) {
+            std::vector<Allocation> built;
+            std::vector<VkDeviceSize> sizes;
+            for (uint32_t mesh = first; mesh < std::min(first + batch, meshCount); mesh++) {
+                VkDeviceSize size = 4096 + random() % (512 * 1024);
+                built.push_back(pool.allocate(size));
+                sizes.push_back(size);
+            }
+            for (size_t i = 0; i < built.size(); i++) {
+                VkDeviceSize size = sizes[i] / 2 + random() % (sizes[i] / 4);
+                compacted.push_back(pool.allocate(size));
+                compactedBytes += compacted.back().size;
+                pool.free(built[i]);
+            }
+        }
+        validate(pool, compacted, "mesh build");
+        check(pool.getUsedBytes() == compactedBytes, "only the compacted structures stay allocated");
+        check(pool.getBlockCount() * 64ull * 1024 * 1024 < compactedBytes * 2, "blocks are mostly filled by compacted structures");
+        printf("%u meshes compacted into %u blocks, %.1f MB used of %.1f MB \n", meshCount, pool.getBlockCount(), pool.getUsedBytes() / (1024.0 * 1024.0), pool.getReservedBytes() / (1024.0 * 1024.0));
+    }
+
+    // Degenerate requests
+    {
+        AccelerationStructurePool pool(4096);
+        check(!pool.allocate(0).isValid(), "an empty request is not placed");
+        Allocation large = pool.allocate(10000);
+        check(large.isValid() && pool.getBlockSize(large.block) >= 10000, "a request larger than a block gets its own block");
+        Allocation small = pool.allocate(1);
+        check(small.size == ALIGNMENT, "sizes round up to the alignment");
+        pool.free(Allocation());
+        check(pool.getAllocationCount() == 2, "freeing an invalid allocation does nothing");
+    }
+
+    printf("%zu checks, %zu failed \n", checks, failures);
+    return failures == 0;
+}
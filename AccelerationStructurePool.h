@@ -0,0 +1,57 @@
+#pragma once
+
+#include <volk.h>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <tuple>
+#include <vector>
+
+// Places acceleration structures in a few large buffers instead of a buffer and an allocation each, which a scene of
+// thousands of meshes would run out of. Only the ranges are tracked here, the caller backs every block with one buffer.
+// Structures start on the 256 byte boundaries the spec requires and are packed back to back. Freed ranges merge with
+// their free neighbours and are handed out again, so the space of an uncompacted BLAS is reused once it is compacted
+class AccelerationStructurePool {
+
+public:
+	static const VkDeviceSize ALIGNMENT = 256;
+
+	struct Allocation {
+		uint32_t block = UINT32_MAX;
+		VkDeviceSize offset = 0;
+		VkDeviceSize size = 0;
+		bool isValid() const { return block != UINT32_MAX; }
+	};
+
+	explicit AccelerationStructurePool(VkDeviceSize blockSize = 64ull * 1024 * 1024);
+
+	// Best fit over the free ranges of every block. When none has room a block is added, blockSize bytes or as large as
+	// the request if it is larger, and the caller has to back it before placing a structure in it
+	Allocation allocate(VkDeviceSize size);
+	void free(const Allocation& allocation);
+	// Forget every block and allocation
+	void clear();
+
+	uint32_t getBlockCount() const { return static_cast<uint32_t>(blockSizes.size()); }
+	VkDeviceSize getBlockSize(uint32_t block) const { return blockSizes[block]; }
+	uint32_t getAllocationCount() const { return allocationCount; }
+	VkDeviceSize getUsedBytes() const { return usedBytes; }
+	VkDeviceSize getReservedBytes() const;
+
+	// Random allocation and release sequences checked against alignment, block bounds, overlap and merging, and a
+	// build of thousands of meshes that compacts as it goes. Returns false if any check failed
+	static bool runSelfTest();
+
+private:
+	void insertFree(uint32_t block, VkDeviceSize offset, VkDeviceSize size);
+	void eraseFree(uint32_t block, VkDeviceSize offset, VkDeviceSize size);
+
+	VkDeviceSize blockSize;
+	std::vector<VkDeviceSize> blockSizes;
+	// Free ranges of each block by offset to size, to find the neighbours a freed range merges with
+	std::vector<std::map<VkDeviceSize, VkDeviceSize>> freeRanges;
+	// The same ranges as size, block and offset, for the best fit
+	std::set<std::tuple<VkDeviceSize, uint32_t, VkDeviceSize>> freeBySize;
+	uint32_t allocationCount = 0;
+	VkDeviceSize usedBytes = 0;
+};
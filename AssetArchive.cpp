@@ -0,0 +1,644 @@
+#include "AssetArchive.h"
+#include "JobSystem.h"
+#include <stb_image.h>
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <random>
+
+// Only the deflate half is used, the image writers come along with it
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static const char FILE_MAGIC[4] = { 'P', 'A', 'C', 'K' };
+static const uint32_t FILE_VERSION = 1;
+
+static const uint32_t ENTRY_COMPRESSED = 1;
+
+struct FileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t reserved;
+    uint64_t tocOffset;
+    uint64_t namesOffset;
+    uint64_t namesSize;
+};
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+PATHS
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+std::string AssetArchive::normalizePath(const std::string& path) {
+    std::string normalized;
+    normalized.reserve(path.size());
+    for (char c : path) {
+        c = c == '\\' ? '/' : c;
+        if (c == '/' && !normalized.empty() && normalized.back() == '/') {
+            continue;
+        }
+        normalized.push_back(c);
+    }
+    while (normalized.compare(0, 2, "./") == 0) {
+        normalized.erase(0, 2);
+    }
+    return normalized;
+}
+
+// FNV-1a
+uint64_t AssetArchive::hashPath(const std::string& normalizedPath) {
+    uint64_t hash = 14695981039346656037ull;
+    for (char c : normalizedPath) {
+        hash = (hash ^ static_cast<uint8_t>(c)) * 1099511628211ull;
+    }
+    return hash;
+}
+
+std::vector<std::string> AssetArchive::listFiles(const std::vector<std::string>& directories) {
+    std::vector<std::string> files;
+    for (const std::string& directory : directories) {
+        std::error_code ec;
+        for (auto it = std::filesystem::recursive_directory_iterator(directory, ec); !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+            if (it->is_regular_file()) {
+                files.push_back(it->path().generic_string());
+            }
+        }
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+BUILDING
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static bool readLooseFile(const std::string& path, std::vector<char>& contents) {
+    std::ifstream file(path, std::ios::ate | std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+    contents.resize(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    file.read(contents.data(), contents.size());
+    return static_cast<bool>(file);
+}
+
+AssetArchive::BuildStats AssetArchive::build(const std::string& path, const std::vector<std::string>& files, bool compress) {
+    auto start = std::chrono::high_resolution_clock::now();
+    BuildStats stats;
+
+    std::vector<std::string> paths;
+    for (const std::string& file : files) {
+        paths.push_back(normalizePath(file));
+    }
+    std::sort(paths.begin(), paths.end());
+    paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+
+    // Every entry is read and compressed up front, the table of contents in front of them needs their sizes
+    std::vector<Entry> entries;
+    std::vector<std::vector<char>> stored;
+    std::string names;
+    for (const std::string& name : paths) {
+        std::vector<char> contents;
+        if (!readLooseFile(name, contents)) {
+            stats.failed++;
+            continue;
+        }
+        Entry entry{};
+        entry.pathHash = hashPath(name);
+        entry.size = contents.size();
+        entry.nameOffset = static_cast<uint32_t>(names.size());
+        entry.nameLength = static_cast<uint32_t>(name.size());
+        names += name;
+        stats.sourceBytes += contents.size();
+
+        bool cooked = name.size() >= 5 && name.compare(name.size() - 5, 5, ".ctex") == 0;
+        if (compress && !cooked && !contents.empty() && contents.size() < INT_MAX) {
+            int compressedSize = 0;
+            unsigned char* compressed = stbi_zlib_compress(reinterpret_cast<unsigned char*>(contents.data()), static_cast<int>(contents.size()), &compressedSize, 8);
+            if (compressed && static_cast<size_t>(compressedSize) <= contents.size() - contents.size() / 4) {
+                contents.assign(compressed, compressed + compressedSize);
+                entry.flags |= ENTRY_COMPRESSED;
+                stats.compressed++;
+            }
+            free(compressed);
+        }
+        entry.storedSize = contents.size();
+        entries.push_back(entry);
+        stored.push_back(std::move(contents));
+    }
+
+    // Sorted by hash for the lookup, equal hashes by name so a collision still finds its entry
+    std::vector<size_t> order(entries.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        if (entries[a].pathHash != entries[b].pathHash) {
+            return entries[a].pathHash < entries[b].pathHash;
+        }
+        return names.compare(entries[a].nameOffset, entries[a].nameLength, names, entries[b].nameOffset, entries[b].nameLength) < 0;
+    });
+
+    FileHeader header{};
+    memcpy(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+    header.version = FILE_VERSION;
+    header.entryCount = static_cast<uint32_t>(entries.size());
+    header.tocOffset = sizeof(FileHeader);
+    header.namesOffset = header.tocOffset + entries.size() * sizeof(Entry);
+    header.namesSize = names.size();
+
+    std::vector<Entry> toc;
+    uint64_t offset = header.namesOffset + header.namesSize;
+    for (size_t i : order) {
+        Entry entry = entries[i];
+        offset = (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+        entry.offset = offset;
+        offset += entry.storedSize;
+        toc.push_back(entry);
+    }
+
+    // Written beside the target and renamed over it, so a build cut short never leaves an archive that opens
+    std::error_code ec;
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream output(temporary, std::ios::binary | std::ios::trunc);
+        output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        output.write(reinterpret_cast<const char*>(toc.data()), toc.size() * sizeof(Entry));
+        output.write(names.data(), names.size());
+        uint64_t written = header.namesOffset + header.namesSize;
+        const std::vector<char> padding(ALIGNMENT, 0);
+        for (size_t i = 0; i < order.size(); i++) {
+            output.write(padding.data(), static_cast<std::streamsize>(toc[i].offset - written));
+            output.write(stored[order[i]].data(), stored[order[i]].size());
+            written = toc[i].offset + toc[i].storedSize;
+        }
+        if (!output) {
+            std::filesystem::remove(temporary, ec);
+            stats.failed += static_cast<uint32_t>(entries.size());
+            return stats;
+        }
+        stats.archiveBytes = written;
+    }
+    std::filesystem::rename(temporary, path, ec);
+    if (ec) {
+        std::filesystem::remove(temporary, ec);
+        stats.failed += static_cast<uint32_t>(entries.size());
+        return stats;
+    }
+
+    stats.entries = static_cast<uint32_t>(entries.size());
+    stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    return stats;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+READING
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool AssetArchive::open(const std::string& path) {
+    close();
+    if (!file.open(path) || file.size() < sizeof(FileHeader)) {
+        close();
+        return false;
+    }
+
+    FileHeader header;
+    memcpy(&header, file.data(), sizeof(header));
+    uint64_t size = file.size();
+    // The table is read in place, it has to be aligned for its entries and lie in the file with the names
+    if (memcmp(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0 || header.version != FILE_VERSION || header.tocOffset % alignof(Entry) != 0 ||
+        header.tocOffset > size || header.entryCount > (size - header.tocOffset) / sizeof(Entry) ||
+        header.namesOffset != header.tocOffset + header.entryCount * sizeof(Entry) || header.namesSize > size - header.namesOffset) {
+        close();
+        return false;
+    }
+
+    const Entry* table = reinterpret_cast<const Entry*>(file.data() + header.tocOffset);
+    for (uint32_t i = 0; i < header.entryCount; i++) {
+        const Entry& entry = table[i];
+        bool compressed = (entry.flags & ENTRY_COMPRESSED) != 0;
+        if (entry.offset % ALIGNMENT != 0 || entry.offset > size || entry.storedSize > size - entry.offset ||
+            static_cast<uint64_t>(entry.nameOffset) + entry.nameLength > header.namesSize || (entry.flags & ~ENTRY_COMPRESSED) != 0 ||
+            (!compressed && entry.storedSize != entry.size) || (i > 0 && table[i - 1].pathHash > entry.pathHash)) {
+            close();
+            return false;
+        }
+    }
+
+    entries = table;
+    entryCount = header.entryCount;
+    names = reinterpret_cast<const char*>(file.data() + header.namesOffset);
+    return true;
+}
+
+void AssetArchive::close() {
+    file.close();
+    entries = nullptr;
+    entryCount = 0;
+    names = nullptr;
+}
+
+const AssetArchive::Entry* AssetArchive::find(const std::string& path) const {
+    if (!entries) {
+        return nullptr;
+    }
+    std::string name = normalizePath(path);
+    uint64_t hash = hashPath(name);
+    const Entry* end = entries + entryCount;
+    const Entry* it = std::lower_bound(entries, end, hash, [](const Entry& entry, uint64_t value) { return entry.pathHash < value; });
+    for (; it != end && it->pathHash == hash; it++) {
+        if (name.compare(0, std::string::npos, names + it->nameOffset, it->nameLength) == 0) {
+            return it;
+        }
+    }
+    return nullptr;
+}
+
+size_t AssetArchive::getSize(const std::string& path) const {
+    const Entry* entry = find(path);
+    return entry ? static_cast<size_t>(entry->size) : 0;
+}
+
+AssetArchive::View AssetArchive::view(const std::string& path) const {
+    View result;
+    const Entry* entry = find(path);
+    if (entry && (entry->flags & ENTRY_COMPRESSED) == 0) {
+        result.data = file.data() + entry->offset;
+        result.size = static_cast<size_t>(entry->size);
+    }
+    return result;
+}
+
+void AssetArchive::prefetch(const std::vector<std::string>& paths) const {
+    for (const std::string& path : paths) {
+        if (const Entry* entry = find(path)) {
+            file.prefetch(static_cast<size_t>(entry->offset), static_cast<size_t>(entry->storedSize));
+        }
+    }
+}
+
+bool AssetArchive::readEntry(const Entry& entry, std::vector<char>& contents) const {
+    const char* stored = reinterpret_cast<const char*>(file.data() + entry.offset);
+    if ((entry.flags & ENTRY_COMPRESSED) == 0) {
+        contents.assign(stored, stored + entry.size);
+        return true;
+    }
+    if (entry.size > INT_MAX || entry.storedSize > INT_MAX) {
+        return false;
+    }
+    contents.resize(static_cast<size_t>(entry.size));
+    int inflated = stbi_zlib_decode_buffer(contents.data(), static_cast<int>(entry.size), stored, static_cast<int>(entry.storedSize));
+    if (inflated < 0 || static_cast<uint64_t>(inflated) != entry.size) {
+        contents.clear();
+        return false;
+    }
+    return true;
+}
+
+bool AssetArchive::read(const std::string& path, std::vector<char>& contents) const {
+    const Entry* entry = find(path);
+    return entry && readEntry(*entry, contents);
+}
+
+size_t AssetArchive::readBatch(const std::vector<std::string>& paths, std::vector<std::vector<char>>& contents, std::vector<bool>& ok, JobSystem* jobs) const {
+    // Looked up and advised up front, the disk then works ahead of the copies
+    std::vector<const Entry*> found(paths.size());
+    for (size_t i = 0; i < paths.size(); i++) {
+        found[i] = find(paths[i]);
+        if (found[i]) {
+            file.prefetch(static_cast<size_t>(found[i]->offset), static_cast<size_t>(found[i]->storedSize));
+        }
+    }
+
+    contents.resize(paths.size());
+    // A byte per path, neighbouring bits of a vector<bool> are not safe to write from different threads
+    std::vector<uint8_t> done(paths.size(), 0);
+    auto readRange = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            done[i] = found[i] && readEntry(*found[i], contents[i]);
+        }
+    };
+    if (jobs) {
+        jobs->parallelFor(paths.size(), 1, readRange);
+    }
+    else {
+        readRange(0, paths.size());
+    }
+
+    ok.assign(done.begin(), done.end());
+    return static_cast<size_t>(std::count(done.begin(), done.end(), 1));
+}
+
+AssetArchive& AssetArchive::mounted() {
+    static AssetArchive archive;
+    return archive;
+}
+
+bool AssetArchive::readAsset(const std::string& path, std::vector<char>& contents) {
+    const AssetArchive& archive = mounted();
+    if (const Entry* entry = archive.find(path)) {
+        return archive.readEntry(*entry, contents);
+    }
+    return readLooseFile(path, contents);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+TESTS
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool AssetArchive::runSelfTest() {
+    size_t checks = 0;
+    size_t failures = 0;
+    auto check = [&](bool ok, const std::string& what) {
+        checks++;
+        if (!ok) {
+            if (failures < 10) {
+                printf("    FAILED: %s \n", what.c_str());
+            }
+            failures++;
+        }
+    };
+
+    check(normalizePath(".\\shaders//vert.spv") == "shaders/vert.spv", "backslashes, doubled slashes and ./ are normalized");
+    check(hashPath("shaders/vert.spv") != hashPath("shaders/frag.spv"), "different paths hash apart");
+
+    std::error_code ec;
+    std::filesystem::path directory = std::filesystem::temp_directory_path(ec) / "asset-archive-test";
+    std::filesystem::remove_all(directory, ec);
+    std::filesystem::create_directories(directory / "many", ec);
+    std::filesystem::create_directories(directory / "deep" / "nested", ec);
+
+    // Noise that deflate cannot shrink, text that it can, a cooked texture that must stay stored, an empty file, an
+    // entry of exactly a page and many small ones
+    std::mt19937 random(7);
+    std::vector<std::pair<std::string, std::vector<char>>> files;
+    auto add = [&](const std::string& name, std::vector<char> contents) {
+        std::string path = (directory / name).generic_string();
+        std::ofstream output(path, std::ios::binary | std::ios::trunc);
+        output.write(contents.data(), contents.size());
+        files.emplace_back(path, std::move(contents));
+    };
+    std::vector<char> noise(10000);
+    for (char& c : noise) {
+        c = static_cast<char>(random());
+    }
+    add("shader.spv", noise);
+    std::string text;
+    while (text.size() < 50000) {
+        text += "v " + std::to_string(random() % 1000) + " 0.5 1.0\nf 1/1/1 2/2/2 3/3/3\n";
+    }
+    add("room.obj", std::vector<char>(text.begin(), text.end()));
+    add("texture.ctex", std::vector<char>(20000, 0));
+    add("empty.txt", {});
+    add("deep/nested/page.bin", std::vector<char>(static_cast<size_t>(ALIGNMENT), 'p'));
+    for (int i = 0; i < 200; i++) {
+        std::string small = "file " + std::to_string(i);
+        add("many/small" + std::to_string(i) + ".txt", std::vector<char>(small.begin(), small.end()));
+    }
+
+    std::vector<std::string> paths;
+    for (const auto& file : files) {
+        paths.push_back(file.first);
+    }
+    std::vector<std::string> listed = listFiles({ directory.generic_string() });
+    check(listed.size() == files.size(), "every file under the directory is listed");
+
+    std::string archivePath = (directory / "test.pack").generic_string();
+    std::vector<std::string> packed = paths;
+    packed.push_back((directory / "missing.bin").generic_string());
+    // Named twice, stored once
+    packed.push_back((directory / "room.obj").string());
+    BuildStats stats = build(archivePath, packed, true);
+    check(stats.entries == files.size() && stats.failed == 1, "every readable file is packed once");
+    check(stats.compressed >= 1 && stats.archiveBytes > 0, "some entries are compressed");
+
+    AssetArchive archive;
+    check(archive.open(archivePath) && archive.getEntryCount() == files.size(), "the archive opens with every entry");
+
+    bool sorted = true;
+    bool aligned = true;
+    for (uint32_t i = 0; i < archive.entryCount; i++) {
+        sorted &= i == 0 || archive.entries[i - 1].pathHash <= archive.entries[i].pathHash;
+        aligned &= archive.entries[i].offset % ALIGNMENT == 0;
+    }
+    check(sorted, "the table of contents is sorted by hash");
+    check(aligned, "every entry starts on a page");
+
+    bool contents = true;
+    bool sizes = true;
+    for (const auto& file : files) {
+        std::vector<char> read;
+        contents &= archive.read(file.first, read) && read == file.second;
+        sizes &= archive.getSize(file.first) == file.second.size();
+    }
+    check(contents, "every entry reads back as the file");
+    check(sizes, "sizes are the files'");
+
+    const Entry* obj = archive.find(paths[1]);
+    check(obj && (obj->flags & ENTRY_COMPRESSED) != 0 && archive.view(paths[1]).empty(), "text is compressed and has no view");
+    const Entry* spv = archive.find(paths[0]);
+    check(spv && (spv->flags & ENTRY_COMPRESSED) == 0, "noise is stored as it is");
+    View texture = archive.view(paths[2]);
+    check(!texture.empty() && texture.size == 20000 && reinterpret_cast<uintptr_t>(texture.data) % ALIGNMENT == 0 && texture.data[0] == 0,
+        "cooked textures are stored and viewed in place on a page");
+    View stored = archive.view(paths[0]);
+    check(!stored.empty() && stored.size == files[0].second.size() && memcmp(stored.data, files[0].second.data(), stored.size) == 0, "a view holds the entry's bytes");
+    std::string backslashed = paths[4];
+    std::replace(backslashed.begin(), backslashed.end(), '/', '\\');
+    check(archive.contains(backslashed) && archive.contains(paths[4]), "lookups normalize the path");
+    check(!archive.contains(packed[files.size()]) && archive.getSize(packed[files.size()]) == 0, "a file left out is not found");
+    std::vector<char> missing(3, 'x');
+    check(!archive.read(packed[files.size()], missing), "reading a missing entry fails");
+    archive.prefetch(paths);
+
+    for (uint32_t workers : { 0u, 3u }) {
+        std::unique_ptr<JobSystem> jobs = workers > 0 ? std::make_unique<JobSystem>(workers) : nullptr;
+        std::string label = std::to_string(workers) + " workers: ";
+        std::vector<std::string> batch = paths;
+        batch.push_back(packed[files.size()]);
+        std::vector<std::vector<char>> read;
+        std::vector<bool> ok;
+        size_t count = archive.readBatch(batch, read, ok, jobs.get());
+        bool same = true;
+        for (size_t i = 0; i < files.size(); i++) {
+            same &= ok[i] && read[i] == files[i].second;
+        }
+        check(count == files.size() && !ok.back(), label + "the batch reads every entry it holds");
+        check(same, label + "the batch reads the files' bytes");
+    }
+
+    // Loaders read loose files until an archive is mounted, then the archive even when the file is gone
+    std::vector<char> asset;
+    check(readAsset(paths[3], asset) && asset.empty(), "an unmounted archive reads from disk");
+    std::filesystem::remove(paths[1], ec);
+    check(!readAsset(paths[1], asset), "a removed loose file is gone");
+    check(mounted().open(archivePath), "the archive mounts");
+    check(readAsset(paths[1], asset) && asset == files[1].second, "the mounted archive serves a removed file");
+    check(readAsset(archivePath, asset) && !asset.empty(), "files it does not hold still read from disk");
+    mounted().close();
+
+    // Damaged copies: a wrong magic, a cut table of contents, and compressed data that no longer inflates
+    std::vector<char> bytes;
+    readLooseFile(archivePath, bytes);
+    auto damaged = [&](const std::vector<char>& copy) {
+        std::string damagedPath = (directory / "damaged.pack").generic_string();
+        std::ofstream output(damagedPath, std::ios::binary | std::ios::trunc);
+        output.write(copy.data(), copy.size());
+        output.close();
+        return damagedPath;
+    };
+    std::vector<char> copy = bytes;
+    copy[0] = 'X';
+    AssetArchive broken;
+    check(!broken.open(damaged(copy)) && !broken.isOpen(), "a wrong magic is refused");
+    copy = bytes;
+    copy.resize(sizeof(FileHeader) + sizeof(Entry) * 3);
+    check(!broken.open(damaged(copy)), "a cut table of contents is refused");
+    copy = bytes;
+    copy.resize(static_cast<size_t>(obj->offset + obj->storedSize - 1));
+    check(!broken.open(damaged(copy)), "an entry past the end is refused");
+    copy = bytes;
+    for (uint64_t i = obj->offset + 2; i < obj->offset + obj->storedSize; i += 7) {
+        copy[static_cast<size_t>(i)] = static_cast<char>(~copy[static_cast<size_t>(i)]);
+    }
+    std::vector<char> corrupt;
+    check(broken.open(damaged(copy)) && !broken.read(paths[1], corrupt) && broken.read(paths[0], corrupt), "corrupt compressed data fails to read");
+    broken.close();
+    archive.close();
+
+    std::filesystem::remove_all(directory, ec);
+
+    printf("%zu checks, %zu failed \n", checks, failures);
+    return failures == 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+BENCHMARK
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Evicts the file from the page cache so the next read goes to the disk, needs no privileges for clean pages
+static void dropFromCache(const std::string& path) {
+#ifdef __linux__
+    int file = ::open(path.c_str(), O_RDONLY);
+    if (file >= 0) {
+        posix_fadvise(file, 0, 0, POSIX_FADV_DONTNEED);
+        ::close(file);
+    }
+#else
+    (void)path;
+#endif
+}
+
+void AssetArchive::runBenchmark(const char* directory) {
+    std::vector<std::string> files = directory ? listFiles({ directory }) : listFiles({ "shaders", "VikingRoom", "Images", "cooked" });
+    if (files.empty()) {
+        printf("No files to pack \n");
+        return;
+    }
+    std::error_code ec;
+    std::string archivePath = (std::filesystem::temp_directory_path(ec) / "asset-archive-bench.pack").generic_string();
+
+    BuildStats stats = build(archivePath, files, true);
+    printf("Packed %u files, %u compressed, %.1f MB into %.1f MB in %.1f ms \n", stats.entries, stats.compressed,
+        stats.sourceBytes / (1024.0 * 1024.0), stats.archiveBytes / (1024.0 * 1024.0), stats.milliseconds);
+
+    JobSystem jobs;
+    auto milliseconds = [](std::chrono::high_resolution_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    };
+    bool canDrop = false;
+#ifdef __linux__
+    canDrop = true;
+#endif
+
+    printf("%-28s %12s %12s \n", "read", "warm (ms)", canDrop ? "cold (ms)" : "");
+    for (int method = 0; method < 4; method++) {
+        const char* names[] = { "loose files", "archive", "archive batch", "archive views" };
+        double times[2] = {};
+        for (int cold = 0; cold < (canDrop ? 2 : 1); cold++) {
+            // The build just read every file and wrote the archive, the warm runs find both cached
+            if (cold) {
+                for (const std::string& file : files) {
+                    dropFromCache(file);
+                }
+                dropFromCache(archivePath);
+            }
+            auto start = std::chrono::high_resolution_clock::now();
+            uint64_t bytes = 0;
+            if (method == 0) {
+                std::vector<char> contents;
+                for (const std::string& file : files) {
+                    readLooseFile(file, contents);
+                    bytes += contents.size();
+                }
+            }
+            else {
+                AssetArchive archive;
+                archive.open(archivePath);
+                if (method == 1) {
+                    std::vector<char> contents;
+                    for (const std::string& file : files) {
+                        archive.read(file, contents);
+                        bytes += contents.size();
+                    }
+                }
+                else if (method == 2) {
+                    std::vector<std::vector<char>> contents;
+                    std::vector<bool> ok;
+                    archive.readBatch(files, contents, ok, &jobs);
+                    for (const std::vector<char>& entry : contents) {
+                        bytes += entry.size();
+                    }
+                }
+                else {
+                    // Touching a byte per page is what a copy into staging would make the OS page in
+                    archive.prefetch(files);
+                    for (const std::string& file : files) {
+                        View entry = archive.view(file);
+                        std::vector<char> contents;
+                        if (entry.empty()) {
+                            archive.read(file, contents);
+                            bytes += contents.size();
+                            continue;
+                        }
+                        for (size_t offset = 0; offset < entry.size; offset += static_cast<size_t>(ALIGNMENT)) {
+                            bytes += entry.data[offset] != 0 ? 1 : 0;
+                        }
+                        bytes += entry.size;
+                    }
+                }
+            }
+            times[cold] = milliseconds(start);
+            if (bytes == 0) {
+                printf("Nothing was read \n");
+            }
+        }
+        printf("%-28s %12.2f %12.2f \n", names[method], times[0], times[1]);
+    }
+    printf("%zu files on %u threads \n", files.size(), jobs.threadCount());
+
+    std::filesystem::remove(archivePath, ec);
+}
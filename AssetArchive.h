@@ -0,0 +1,99 @@
+#pragma once
+
+#include "MappedFile.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class JobSystem;
+
+// Many asset files packed into one, opened once and mapped instead of every file being opened and read on its own. A
+// table of contents sorted by the hash of each path finds an entry with a binary search, every entry starts on an
+// ALIGNMENT boundary so uncompressed entries are page aligned in the mapping and are handed out without a copy, and
+// entries that shrink enough under deflate are stored compressed
+class AssetArchive {
+
+public:
+	// A page, uncompressed entries can be mapped, advised and uploaded straight from the archive
+	static const uint64_t ALIGNMENT = 4096;
+
+	struct BuildStats {
+		uint32_t entries = 0;
+		uint32_t compressed = 0;
+		uint32_t failed = 0;
+		uint64_t sourceBytes = 0;
+		uint64_t archiveBytes = 0;
+		double milliseconds = 0.0;
+	};
+
+	// An entry in the mapping. Empty when the entry is missing or stored compressed, read it then
+	struct View {
+		const uint8_t* data = nullptr;
+		size_t size = 0;
+
+		bool empty() const { return data == nullptr; }
+	};
+
+	// Paths as the loaders ask for them, with forward slashes and no leading ./
+	static std::string normalizePath(const std::string& path);
+	static uint64_t hashPath(const std::string& normalizedPath);
+
+	// Packs files into path under the names they were given, compressing the entries deflate makes at least a quarter
+	// smaller when compress is set. Cooked textures are always stored as they are, their levels are copied out of the
+	// mapping. Files that cannot be read are left out and counted as failed
+	static BuildStats build(const std::string& path, const std::vector<std::string>& files, bool compress);
+	// Every file under the directories, for build
+	static std::vector<std::string> listFiles(const std::vector<std::string>& directories);
+
+	// False when the file is missing or is not a valid archive, it is left closed then
+	bool open(const std::string& path);
+	void close();
+	bool isOpen() const { return file.isOpen(); }
+
+	uint32_t getEntryCount() const { return entryCount; }
+	bool contains(const std::string& path) const { return find(path) != nullptr; }
+	// Bytes of the entry once read, 0 when missing
+	size_t getSize(const std::string& path) const;
+
+	View view(const std::string& path) const;
+	// Ask the OS to start paging in the entries, so the first touch of each does not stall on the disk
+	void prefetch(const std::vector<std::string>& paths) const;
+	// Copies or inflates the entry into contents. False when it is missing or does not inflate to its size
+	bool read(const std::string& path, std::vector<char>& contents) const;
+	// Reads every path into its slot of contents, spread over the job system or inline without one. Returns how many
+	// were read, ok says which
+	size_t readBatch(const std::vector<std::string>& paths, std::vector<std::vector<char>>& contents, std::vector<bool>& ok, JobSystem* jobs) const;
+
+	// The archive every loader reads through, opened at startup. While it is closed the loaders read loose files
+	static AssetArchive& mounted();
+	// From the mounted archive when it holds path, otherwise from the file on disk. False when neither has it
+	static bool readAsset(const std::string& path, std::vector<char>& contents);
+
+	// Packs generated files, reads them back every way and checks the layout, the lookups and that damaged archives
+	// are refused. Returns false if any check failed
+	static bool runSelfTest();
+	// Reads the repo's assets, or the files in directory, as loose files against out of an archive, warm and on Linux
+	// also with the page cache dropped
+	static void runBenchmark(const char* directory);
+
+private:
+	struct Entry {
+		uint64_t pathHash;
+		uint64_t offset;
+		uint64_t storedSize;
+		uint64_t size;
+		uint32_t nameOffset;
+		uint32_t nameLength;
+		uint32_t flags;
+		uint32_t reserved;
+	};
+
+	const Entry* find(const std::string& path) const;
+	bool readEntry(const Entry& entry, std::vector<char>& contents) const;
+
+	MappedFile file;
+	const Entry* entries = nullptr;
+	uint32_t entryCount = 0;
+	const char* names = nullptr;
+};
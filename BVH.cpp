@@ -0,0 +1,166 @@
+#include "BVH.h"
+#include <algorithm>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+STATIC BVH
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static const int SAH_BINS = 12;
+
+namespace {
+    struct Bin {
+        glm::vec3 min{ FLT_MAX };
+        glm::vec3 max{ -FLT_MAX };
+        uint32_t count = 0;
+
+        void grow(const glm::vec3& boxMin, const glm::vec3& boxMax) {
+            min = glm::min(min, boxMin);
+            max = glm::max(max, boxMax);
+        }
+    };
+
+    struct BuildContext {
+        const glm::vec3* boxMins;
+        const glm::vec3* boxMaxs;
+        std::vector<glm::vec3> centroids;
+        uint32_t maxLeafSize;
+    };
+}
+
+static void updateBounds(StaticBVH& bvh, const BuildContext& context, uint32_t index) {
+    BVHNode& node = bvh.nodes[index];
+    node.min = glm::vec3(FLT_MAX);
+    node.max = glm::vec3(-FLT_MAX);
+    for (uint32_t i = 0; i < node.primitiveCount(); i++) {
+        uint32_t primitive = bvh.primitives[node.firstPrimitive() + i];
+        node.min = glm::min(node.min, context.boxMins[primitive]);
+        node.max = glm::max(node.max, context.boxMaxs[primitive]);
+    }
+}
+
+static void subdivide(StaticBVH& bvh, const BuildContext& context, uint32_t index, uint32_t depth) {
+    BVHNode& node = bvh.nodes[index];
+    uint32_t first = node.firstPrimitive();
+    uint32_t count = node.primitiveCount();
+    if (count <= context.maxLeafSize || depth + 1 >= BVH::MAX_DEPTH) {
+        return;
+    }
+
+    // Bin the centroids along each axis and sweep the bins from both sides for the cheapest split
+    glm::vec3 centroidMin(FLT_MAX);
+    glm::vec3 centroidMax(-FLT_MAX);
+    for (uint32_t i = first; i < first + count; i++) {
+        centroidMin = glm::min(centroidMin, context.centroids[bvh.primitives[i]]);
+        centroidMax = glm::max(centroidMax, context.centroids[bvh.primitives[i]]);
+    }
+
+    float bestCost = FLT_MAX;
+    int bestAxis = -1;
+    int bestSplit = 0;
+    for (int axis = 0; axis < 3; axis++) {
+        float extent = centroidMax[axis] - centroidMin[axis];
+        if (extent <= 0.0f) {
+            continue;
+        }
+        float scale = SAH_BINS / extent;
+
+        Bin bins[SAH_BINS];
+        for (uint32_t i = first; i < first + count; i++) {
+            uint32_t primitive = bvh.primitives[i];
+            int bin = std::min(SAH_BINS - 1, static_cast<int>((context.centroids[primitive][axis] - centroidMin[axis]) * scale));
+            bins[bin].count++;
+            bins[bin].grow(context.boxMins[primitive], context.boxMaxs[primitive]);
+        }
+
+        float leftArea[SAH_BINS - 1];
+        uint32_t leftCount[SAH_BINS - 1];
+        Bin left;
+        uint32_t sum = 0;
+        for (int i = 0; i < SAH_BINS - 1; i++) {
+            sum += bins[i].count;
+            if (bins[i].count > 0) {
+                left.grow(bins[i].min, bins[i].max);
+            }
+            leftCount[i] = sum;
+            leftArea[i] = sum > 0 ? BVH::area(left.min, left.max) : 0.0f;
+        }
+        Bin right;
+        sum = 0;
+        for (int i = SAH_BINS - 1; i > 0; i--) {
+            sum += bins[i].count;
+            if (bins[i].count > 0) {
+                right.grow(bins[i].min, bins[i].max);
+            }
+            float rightArea = sum > 0 ? BVH::area(right.min, right.max) : 0.0f;
+            float cost = leftCount[i - 1] * leftArea[i - 1] + sum * rightArea;
+            if (leftCount[i - 1] > 0 && sum > 0 && cost < bestCost) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = i;
+            }
+        }
+    }
+
+    // Splitting has to beat testing every primitive of the node
+    float leafCost = count * BVH::area(node.min, node.max);
+    if (bestAxis < 0 || bestCost >= leafCost) {
+        return;
+    }
+
+    float scale = SAH_BINS / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+    uint32_t* begin = bvh.primitives.data() + first;
+    uint32_t* middle = std::partition(begin, begin + count, [&](uint32_t primitive) {
+        int bin = std::min(SAH_BINS - 1, static_cast<int>((context.centroids[primitive][bestAxis] - centroidMin[bestAxis]) * scale));
+        return bin < bestSplit;
+    });
+    uint32_t leftCount = static_cast<uint32_t>(middle - begin);
+
+    uint32_t leftIndex = static_cast<uint32_t>(bvh.nodes.size());
+    bvh.nodes.resize(bvh.nodes.size() + 2);
+    bvh.nodes[leftIndex].setLeaf(first, leftCount);
+    bvh.nodes[leftIndex + 1].setLeaf(first + leftCount, count - leftCount);
+    // resize may have moved the nodes, node is not used past this point
+    bvh.nodes[index].setInterior(leftIndex, leftIndex + 1);
+
+    updateBounds(bvh, context, leftIndex);
+    updateBounds(bvh, context, leftIndex + 1);
+    subdivide(bvh, context, leftIndex, depth + 1);
+    subdivide(bvh, context, leftIndex + 1, depth + 1);
+}
+
+void StaticBVH::build(const glm::vec3* boxMins, const glm::vec3* boxMaxs, size_t count, uint32_t maxLeafSize) {
+    nodes.clear();
+    primitives.resize(count);
+    if (count == 0) {
+        return;
+    }
+
+    BuildContext context;
+    context.boxMins = boxMins;
+    context.boxMaxs = boxMaxs;
+    context.maxLeafSize = std::max(1u, maxLeafSize);
+    context.centroids.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        primitives[i] = static_cast<uint32_t>(i);
+        context.centroids[i] = (boxMins[i] + boxMaxs[i]) * 0.5f;
+    }
+
+    nodes.reserve(2 * count);
+    nodes.emplace_back();
+    nodes[0].setLeaf(0, static_cast<uint32_t>(count));
+    updateBounds(*this, context, 0);
+    subdivide(*this, context, 0, 0);
+}
+
+float StaticBVH::sahCost() const {
+    if (nodes.empty()) {
+        return 0.0f;
+    }
+    float total = 0.0f;
+    for (const BVHNode& node : nodes) {
+        total += BVH::area(node.min, node.max);
+    }
+    return total / BVH::area(nodes[0].min, nodes[0].max);
+}
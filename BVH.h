@@ -0,0 +1,319 @@
+#pragma once
+
+#include <cfloat>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include <immintrin.h>
+#include "glm-0.9.6.3/glm.hpp"
+#include "Frustum.h"
+
+// Node layout shared by the dynamic AABB tree and the static BVH, two nodes per cache line. Each corner is followed by
+// an index, so one unaligned SSE load reads a whole corner and the tests mask off the fourth lane
+struct BVHNode {
+	glm::vec3 min;
+	// Interior nodes: first child. Leaves: first primitive
+	uint32_t left = 0;
+	glm::vec3 max;
+	// Interior nodes: second child. Leaves: LEAF_BIT | primitive count
+	uint32_t right = 0;
+
+	static const uint32_t LEAF_BIT = 0x80000000u;
+
+	bool isLeaf() const { return (right & LEAF_BIT) != 0; }
+	uint32_t firstPrimitive() const { return left; }
+	uint32_t primitiveCount() const { return right & ~LEAF_BIT; }
+
+	void setLeaf(uint32_t first, uint32_t count) { left = first; right = LEAF_BIT | count; }
+	void setInterior(uint32_t first, uint32_t second) { left = first; right = second; }
+};
+
+static_assert(sizeof(BVHNode) == 32, "BVHNode is expected to be two per cache line");
+
+struct Ray {
+	glm::vec3 origin;
+	glm::vec3 direction;
+	float tMin = 0.0f;
+	float tMax = FLT_MAX;
+};
+
+// Closest hit of a ray, item is UINT32_MAX on a miss
+struct RayHit {
+	uint32_t item = UINT32_MAX;
+	float t = FLT_MAX;
+};
+
+namespace BVH {
+	static const uint32_t INVALID_NODE = UINT32_MAX;
+	// Both trees stay well below this depth, the dynamic tree through its rotations and the static build by forcing leaves
+	static const uint32_t MAX_DEPTH = 64;
+
+	// Ray with the reciprocal direction precomputed, lane 3 of every register is unused
+	struct RaySSE {
+		__m128 origin;
+		__m128 invDirection;
+		__m128 tMin;
+	};
+
+	inline RaySSE prepareRay(const Ray& ray) {
+		RaySSE prepared;
+		prepared.origin = _mm_setr_ps(ray.origin.x, ray.origin.y, ray.origin.z, 0.0f);
+		// Zero components become infinities, the slabs of that axis then span everything or nothing
+		prepared.invDirection = _mm_div_ps(_mm_set1_ps(1.0f), _mm_setr_ps(ray.direction.x, ray.direction.y, ray.direction.z, 1.0f));
+		prepared.tMin = _mm_set1_ps(ray.tMin);
+		return prepared;
+	}
+
+	// Distance at which the ray enters the box, FLT_MAX when it misses it or enters beyond tMax. Lane 3 of the corners is
+	// ignored, so they can be loaded straight from a BVHNode
+	inline float intersectRay(__m128 boxMin, __m128 boxMax, const RaySSE& ray, float tMax) {
+		// A node index in lane 3 reads as a denormal float and arithmetic on it is many times slower, so it is cleared
+		// before the subtraction rather than after
+		__m128 xyz = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+		__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_and_ps(boxMin, xyz), ray.origin), ray.invDirection);
+		__m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_and_ps(boxMax, xyz), ray.origin), ray.invDirection);
+
+		// The ray's own interval takes the place of lane 3, so the horizontal max and min clip against it
+		__m128 tNear = _mm_or_ps(_mm_and_ps(xyz, _mm_min_ps(t1, t2)), _mm_andnot_ps(xyz, ray.tMin));
+		__m128 tFar = _mm_or_ps(_mm_and_ps(xyz, _mm_max_ps(t1, t2)), _mm_andnot_ps(xyz, _mm_set1_ps(tMax)));
+		tNear = _mm_max_ps(tNear, _mm_shuffle_ps(tNear, tNear, _MM_SHUFFLE(2, 3, 0, 1)));
+		tNear = _mm_max_ps(tNear, _mm_shuffle_ps(tNear, tNear, _MM_SHUFFLE(1, 0, 3, 2)));
+		tFar = _mm_min_ps(tFar, _mm_shuffle_ps(tFar, tFar, _MM_SHUFFLE(2, 3, 0, 1)));
+		tFar = _mm_min_ps(tFar, _mm_shuffle_ps(tFar, tFar, _MM_SHUFFLE(1, 0, 3, 2)));
+
+		float enter = _mm_cvtss_f32(tNear);
+		return enter <= _mm_cvtss_f32(tFar) ? enter : FLT_MAX;
+	}
+
+	inline float intersectRay(const BVHNode& node, const RaySSE& ray, float tMax) {
+		return intersectRay(_mm_loadu_ps(&node.min.x), _mm_loadu_ps(&node.max.x), ray, tMax);
+	}
+
+	inline float intersectRay(const glm::vec3& boxMin, const glm::vec3& boxMax, const RaySSE& ray, float tMax) {
+		return intersectRay(_mm_setr_ps(boxMin.x, boxMin.y, boxMin.z, 0.0f), _mm_setr_ps(boxMax.x, boxMax.y, boxMax.z, 0.0f), ray, tMax);
+	}
+
+	inline bool overlaps(const BVHNode& node, __m128 boxMin, __m128 boxMax) {
+		__m128 apart = _mm_or_ps(_mm_cmplt_ps(_mm_loadu_ps(&node.max.x), boxMin), _mm_cmpgt_ps(_mm_loadu_ps(&node.min.x), boxMax));
+		return (_mm_movemask_ps(apart) & 7) == 0;
+	}
+
+	// Planes as a structure of arrays in two registers, the two padding lanes hold planes everything is inside of
+	struct FrustumSSE {
+		__m128 nx[2], ny[2], nz[2];
+		__m128 ax[2], ay[2], az[2];
+		__m128 d[2];
+	};
+
+	inline FrustumSSE prepareFrustum(const Frustum& frustum) {
+		float values[7][8] = {};
+		for (int p = 0; p < 8; p++) {
+			glm::vec4 plane = p < 6 ? frustum.planes[p] : glm::vec4(0.0f, 0.0f, 0.0f, FLT_MAX);
+			values[0][p] = plane.x;
+			values[1][p] = plane.y;
+			values[2][p] = plane.z;
+			values[3][p] = std::abs(plane.x);
+			values[4][p] = std::abs(plane.y);
+			values[5][p] = std::abs(plane.z);
+			values[6][p] = plane.w;
+		}
+		FrustumSSE prepared;
+		for (int half = 0; half < 2; half++) {
+			prepared.nx[half] = _mm_loadu_ps(&values[0][half * 4]);
+			prepared.ny[half] = _mm_loadu_ps(&values[1][half * 4]);
+			prepared.nz[half] = _mm_loadu_ps(&values[2][half * 4]);
+			prepared.ax[half] = _mm_loadu_ps(&values[3][half * 4]);
+			prepared.ay[half] = _mm_loadu_ps(&values[4][half * 4]);
+			prepared.az[half] = _mm_loadu_ps(&values[5][half * 4]);
+			prepared.d[half] = _mm_loadu_ps(&values[6][half * 4]);
+		}
+		return prepared;
+	}
+
+	enum class Containment {
+		Outside,
+		Intersecting,
+		Inside
+	};
+
+	// All six planes at once, four per register
+	inline Containment classify(const glm::vec3& boxMin, const glm::vec3& boxMax, const FrustumSSE& frustum) {
+		glm::vec3 center = (boxMin + boxMax) * 0.5f;
+		glm::vec3 extent = (boxMax - boxMin) * 0.5f;
+		__m128 cx = _mm_set1_ps(center.x), cy = _mm_set1_ps(center.y), cz = _mm_set1_ps(center.z);
+		__m128 ex = _mm_set1_ps(extent.x), ey = _mm_set1_ps(extent.y), ez = _mm_set1_ps(extent.z);
+
+		int outside = 0;
+		int crossing = 0;
+		for (int half = 0; half < 2; half++) {
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(frustum.nx[half], cx), _mm_mul_ps(frustum.ny[half], cy)),
+				_mm_add_ps(_mm_mul_ps(frustum.nz[half], cz), frustum.d[half]));
+			__m128 reach = _mm_add_ps(_mm_add_ps(_mm_mul_ps(frustum.ax[half], ex), _mm_mul_ps(frustum.ay[half], ey)), _mm_mul_ps(frustum.az[half], ez));
+			outside |= _mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(distance, reach), _mm_setzero_ps()));
+			crossing |= _mm_movemask_ps(_mm_cmplt_ps(_mm_sub_ps(distance, reach), _mm_setzero_ps()));
+		}
+		if (outside) {
+			return Containment::Outside;
+		}
+		return crossing ? Containment::Intersecting : Containment::Inside;
+	}
+
+	// Closest hit traversal. leaf(first, count, tMax) tests the primitives of a leaf and returns the closest distance so
+	// far, nearer children are visited first so tMax shrinks early and farther subtrees get skipped
+	template<typename LeafFn>
+	void traverseRay(const BVHNode* nodes, uint32_t root, const Ray& ray, LeafFn&& leaf) {
+		if (root == INVALID_NODE) {
+			return;
+		}
+		RaySSE prepared = prepareRay(ray);
+		float tMax = ray.tMax;
+		if (intersectRay(nodes[root], prepared, tMax) == FLT_MAX) {
+			return;
+		}
+
+		uint32_t stack[MAX_DEPTH];
+		float stackDistance[MAX_DEPTH];
+		uint32_t stackSize = 0;
+		uint32_t index = root;
+		while (true) {
+			const BVHNode& node = nodes[index];
+			if (node.isLeaf()) {
+				tMax = leaf(node.firstPrimitive(), node.primitiveCount(), tMax);
+			}
+			else {
+				uint32_t nearChild = node.left;
+				uint32_t farChild = node.right;
+				float nearDistance = intersectRay(nodes[nearChild], prepared, tMax);
+				float farDistance = intersectRay(nodes[farChild], prepared, tMax);
+				if (farDistance < nearDistance) {
+					std::swap(nearChild, farChild);
+					std::swap(nearDistance, farDistance);
+				}
+				if (nearDistance != FLT_MAX) {
+					if (farDistance != FLT_MAX) {
+						stack[stackSize] = farChild;
+						stackDistance[stackSize] = farDistance;
+						stackSize++;
+					}
+					index = nearChild;
+					continue;
+				}
+			}
+
+			// Entries that start beyond a hit found since they were pushed are dropped without touching their nodes
+			bool found = false;
+			while (stackSize > 0) {
+				stackSize--;
+				if (stackDistance[stackSize] <= tMax) {
+					index = stack[stackSize];
+					found = true;
+					break;
+				}
+			}
+			if (!found) {
+				return;
+			}
+		}
+	}
+
+	// Every leaf in the subtree, for subtrees a query found to be entirely inside
+	template<typename LeafFn>
+	void forEachLeaf(const BVHNode* nodes, uint32_t root, LeafFn&& leaf) {
+		uint32_t stack[MAX_DEPTH];
+		uint32_t stackSize = 0;
+		stack[stackSize++] = root;
+		while (stackSize > 0) {
+			const BVHNode& node = nodes[stack[--stackSize]];
+			if (node.isLeaf()) {
+				leaf(node.firstPrimitive(), node.primitiveCount());
+			}
+			else {
+				stack[stackSize++] = node.right;
+				stack[stackSize++] = node.left;
+			}
+		}
+	}
+
+	// leaf(first, count, inside) for every leaf whose bounds touch the frustum, inside is true when the whole leaf is
+	// in it. Subtrees entirely inside are walked without further plane tests
+	template<typename LeafFn>
+	void traverseFrustum(const BVHNode* nodes, uint32_t root, const Frustum& frustum, LeafFn&& leaf) {
+		if (root == INVALID_NODE) {
+			return;
+		}
+		FrustumSSE prepared = prepareFrustum(frustum);
+
+		uint32_t stack[MAX_DEPTH];
+		uint32_t stackSize = 0;
+		stack[stackSize++] = root;
+		while (stackSize > 0) {
+			uint32_t index = stack[--stackSize];
+			const BVHNode& node = nodes[index];
+			Containment containment = classify(node.min, node.max, prepared);
+			if (containment == Containment::Outside) {
+				continue;
+			}
+			if (containment == Containment::Inside) {
+				forEachLeaf(nodes, index, [&](uint32_t first, uint32_t count) { leaf(first, count, true); });
+			}
+			else if (node.isLeaf()) {
+				leaf(node.firstPrimitive(), node.primitiveCount(), false);
+			}
+			else {
+				stack[stackSize++] = node.right;
+				stack[stackSize++] = node.left;
+			}
+		}
+	}
+
+	// leaf(first, count) for every leaf whose bounds overlap the box
+	template<typename LeafFn>
+	void traverseOverlap(const BVHNode* nodes, uint32_t root, const glm::vec3& boxMin, const glm::vec3& boxMax, LeafFn&& leaf) {
+		if (root == INVALID_NODE) {
+			return;
+		}
+		__m128 low = _mm_setr_ps(boxMin.x, boxMin.y, boxMin.z, 0.0f);
+		__m128 high = _mm_setr_ps(boxMax.x, boxMax.y, boxMax.z, 0.0f);
+
+		uint32_t stack[MAX_DEPTH];
+		uint32_t stackSize = 0;
+		stack[stackSize++] = root;
+		while (stackSize > 0) {
+			const BVHNode& node = nodes[stack[--stackSize]];
+			if (!overlaps(node, low, high)) {
+				continue;
+			}
+			if (node.isLeaf()) {
+				leaf(node.firstPrimitive(), node.primitiveCount());
+			}
+			else {
+				stack[stackSize++] = node.right;
+				stack[stackSize++] = node.left;
+			}
+		}
+	}
+
+	// Surface area, the cost of a node in the SAH
+	inline float area(const glm::vec3& boxMin, const glm::vec3& boxMax) {
+		glm::vec3 size = boxMax - boxMin;
+		return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+	}
+}
+
+// BVH over a fixed set of boxes, built top down with a binned surface area heuristic. Leaves index into primitives,
+// which holds the caller's box indices reordered so every leaf is a contiguous range
+class StaticBVH {
+
+public:
+	// Rebuilds from scratch, boxMins and boxMaxs hold count boxes
+	void build(const glm::vec3* boxMins, const glm::vec3* boxMaxs, size_t count, uint32_t maxLeafSize = 4);
+
+	uint32_t getRoot() const { return nodes.empty() ? BVH::INVALID_NODE : 0; }
+	// Sum of node areas relative to the root, lower traces faster
+	float sahCost() const;
+
+	std::vector<BVHNode> nodes;
+	std::vector<uint32_t> primitives;
+};
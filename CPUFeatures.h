@@ -0,0 +1,14 @@
+#pragma once
+
+// GCC and Clang only emit AVX2 instructions inside functions marked for it, MSVC allows the intrinsics anywhere
+#if defined(__GNUC__)
+#define AVX2_FUNCTION __attribute__((target("avx2,fma")))
+#else
+#define AVX2_FUNCTION
+#endif
+
+// Instruction sets beyond the SSE2 every x64 CPU has, detected once and cached
+namespace CPUFeatures {
+	// AVX2 together with FMA and OS support for the YMM registers, every CPU with AVX2 so far has FMA as well
+	bool hasAVX2();
+}
@@ -0,0 +1,243 @@
+#include "CascadedShadows.h"
+#include "InstanceCulling.h"
+#include "JobSystem.h"
+#include "FrameAllocator.h"
+#include "SIMDMath.h"
+#include "glm-0.9.6.3/gtc/matrix_transform.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <random>
+
+CascadedShadows::CascadedShadows() : CascadedShadows(Settings()) {
+}
+
+CascadedShadows::CascadedShadows(const Settings& settings) : settings(settings) {
+    this->settings.cascadeCount = std::min(std::max(settings.cascadeCount, 1u), MAX_CASCADES);
+}
+
+void CascadedShadows::setSettings(const Settings& newSettings) {
+    settings = newSettings;
+    settings.cascadeCount = std::min(std::max(settings.cascadeCount, 1u), MAX_CASCADES);
+    invalidateStatic();
+}
+
+void CascadedShadows::invalidateStatic() {
+    for (Cascade& cascade : cascades) {
+        cascade.staticValid = false;
+    }
+}
+
+void CascadedShadows::markStaticRendered(uint32_t mask) {
+    for (uint32_t i = 0; i < settings.cascadeCount; i++) {
+        if (mask & (1u << i)) {
+            cascades[i].staticValid = true;
+            staticRenders++;
+        }
+    }
+}
+
+uint32_t CascadedShadows::update(const glm::mat4& view, const glm::mat4& proj, const glm::vec3& newLightDirection, const glm::vec3& sceneMin, const glm::vec3& sceneMax) {
+    // glm::perspective writes the [-1, 1] depth form, near and far are read back from it
+    float nearDepth = proj[3][2] / (proj[2][2] - 1.0f);
+    float farDepth = proj[3][2] / (proj[2][2] + 1.0f);
+    if (settings.shadowDistance > 0.0f) {
+        farDepth = std::min(farDepth, settings.shadowDistance);
+    }
+    // Squared half diagonal of the view frustum per unit of depth
+    float diagonal = 1.0f / (proj[0][0] * proj[0][0]) + 1.0f / (proj[1][1] * proj[1][1]);
+
+    glm::vec3 direction = glm::normalize(newLightDirection);
+    if (direction != lightDirection) {
+        lightDirection = direction;
+        glm::vec3 up = std::abs(direction.z) < 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        lightRotation = glm::lookAt(glm::vec3(0.0f), direction, up);
+        depthMin = depthMax = 0.0f;
+    }
+
+    // Casters are taken from the whole scene along the light, with room to grow so moving objects rarely widen it
+    float sceneNear = std::numeric_limits<float>::max();
+    float sceneFar = -std::numeric_limits<float>::max();
+    for (int corner = 0; corner < 8; corner++) {
+        glm::vec3 point(corner & 1 ? sceneMax.x : sceneMin.x, corner & 2 ? sceneMax.y : sceneMin.y, corner & 4 ? sceneMax.z : sceneMin.z);
+        float depth = glm::dot(point, direction);
+        sceneNear = std::min(sceneNear, depth);
+        sceneFar = std::max(sceneFar, depth);
+    }
+    if (sceneNear < depthMin || sceneFar > depthMax || depthMin == depthMax) {
+        float padding = std::max((sceneFar - sceneNear) * 0.125f, 1e-3f);
+        depthMin = sceneNear - padding;
+        depthMax = sceneFar + padding;
+    }
+
+    glm::mat4 cameraToWorld;
+    SIMDMath::affineInverse(&view, &cameraToWorld, 1);
+    glm::vec3 eye(cameraToWorld[3]);
+    glm::vec3 forward = -glm::normalize(glm::vec3(cameraToWorld[2]));
+
+    uint32_t dirty = 0;
+    float sliceNear = nearDepth;
+    for (uint32_t i = 0; i < settings.cascadeCount; i++) {
+        // Practical split scheme, blending logarithmic and even splits
+        float t = float(i + 1) / settings.cascadeCount;
+        float logSplit = nearDepth * std::pow(farDepth / nearDepth, t);
+        float evenSplit = nearDepth + (farDepth - nearDepth) * t;
+        float sliceFar = settings.splitLambda * logSplit + (1.0f - settings.splitLambda) * evenSplit;
+
+        // Smallest sphere around the slice has its center on the view axis, as far from the near corners as the far ones
+        float nearCorner = diagonal * sliceNear * sliceNear;
+        float farCorner = diagonal * sliceFar * sliceFar;
+        float center = (sliceFar * sliceFar - sliceNear * sliceNear + farCorner - nearCorner) / (2.0f * (sliceFar - sliceNear));
+        center = std::min(std::max(center, sliceNear), sliceFar);
+        float radius = std::sqrt(std::max((center - sliceNear) * (center - sliceNear) + nearCorner, (sliceFar - center) * (sliceFar - center) + farCorner));
+
+        // The grid cell is a whole number of texels and the coverage grows by it, the sphere fits wherever in the cell
+        // its center is
+        float coverage = radius * (1.0f + settings.cacheMargin);
+        float texelSize = 2.0f * coverage / settings.resolution;
+        float cell = std::max(std::floor(settings.cacheMargin * radius / texelSize), 1.0f) * texelSize;
+        glm::vec3 lightCenter(lightRotation * glm::vec4(eye + forward * center, 1.0f));
+        float originX = std::floor(lightCenter.x / cell + 0.5f) * cell;
+        float originY = std::floor(lightCenter.y / cell + 0.5f) * cell;
+
+        // Orthographic over the cell, with depth measured along the light from the scene's near side
+        glm::mat4 ortho(1.0f);
+        ortho[0][0] = 1.0f / coverage;
+        ortho[1][1] = 1.0f / coverage;
+        ortho[2][2] = -1.0f / (depthMax - depthMin);
+        ortho[3][0] = -originX / coverage;
+        ortho[3][1] = -originY / coverage;
+        ortho[3][2] = -depthMin / (depthMax - depthMin);
+        glm::mat4 viewProj = ortho * lightRotation;
+
+        Cascade& cascade = cascades[i];
+        if (viewProj != cascade.viewProj) {
+            cascade.viewProj = viewProj;
+            cascade.staticValid = false;
+        }
+        cascade.splitDepth = sliceFar;
+        cascade.texelSize = texelSize;
+        if (!cascade.staticValid) {
+            dirty |= 1u << i;
+        }
+        sliceNear = sliceFar;
+    }
+    return dirty;
+}
+
+void CascadedShadows::cullCasters(uint32_t cascade, const InstanceBounds& bounds, JobSystem* jobs, LinearArena& scratch, std::vector<uint32_t>& casters) const {
+    // The near plane sits on the light's side of the scene, so casters between the light and the cascade are kept
+    InstanceCulling::cull(bounds, Frustum(cascades[cascade].viewProj), jobs, scratch, casters);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+BENCHMARK
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void CascadedShadows::runBenchmark() {
+    const uint32_t staticCount = 20000;
+    const uint32_t dynamicCount = 500;
+    const int frames = 1200;
+    const float fieldSize = 400.0f;
+
+    // Boxes on a y up ground plane, the first staticCount never move
+    std::mt19937 random(21);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    InstanceBounds bounds;
+    bounds.resize(staticCount + dynamicCount);
+    std::vector<glm::vec3> positions(staticCount + dynamicCount);
+    std::vector<glm::vec3> extents(staticCount + dynamicCount);
+    for (size_t i = 0; i < positions.size(); i++) {
+        extents[i] = glm::vec3(0.5f + 2.0f * unit(random), 0.5f + 6.0f * unit(random), 0.5f + 2.0f * unit(random));
+        positions[i] = glm::vec3((unit(random) - 0.5f) * fieldSize, extents[i].y, (unit(random) - 0.5f) * fieldSize);
+        bounds.set(i, glm::vec3(0.0f), extents[i], glm::translate(glm::mat4(1.0f), positions[i]));
+    }
+    glm::vec3 sceneMin(-fieldSize * 0.5f, 0.0f, -fieldSize * 0.5f);
+    glm::vec3 sceneMax(fieldSize * 0.5f, 20.0f, fieldSize * 0.5f);
+    glm::vec3 lightDirection(-0.4f, -0.8f, -0.3f);
+    glm::mat4 proj = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 300.0f);
+    proj[1][1] *= -1;
+
+    // Walking about a third of a unit per frame with the view swinging side to side, as with a mouse look
+    auto cameraView = [&](int frame) {
+        glm::vec3 eye(std::sin(frame * 0.002f) * 100.0f, 2.0f, -150.0f + frame * 0.25f);
+        float yaw = std::sin(frame * 0.05f) * 0.8f;
+        return glm::lookAt(eye, eye + glm::vec3(std::sin(yaw), -0.05f, std::cos(yaw)), glm::vec3(0.0f, 1.0f, 0.0f));
+    };
+
+    JobSystem jobs;
+    Settings defaults;
+    printf("%u static and %u moving boxes, %d frames, %u cascades of %u texels, %u threads \n", staticCount, dynamicCount, frames,
+        defaults.cascadeCount, defaults.resolution, jobs.threadCount());
+
+    // Without a margin the cascades only snap to texels, the cache is as good as gone
+    for (float margin : { 0.0f, 0.125f, 0.25f }) {
+        Settings settings;
+        settings.cacheMargin = margin;
+        CascadedShadows shadows(settings);
+
+        glm::vec4 tracked(12.3f, 1.7f, -4.9f, 1.0f);
+        float firstFraction[MAX_CASCADES][2];
+        float maxDrift = 0.0f;
+        uint32_t cascadeRenders[MAX_CASCADES] = {};
+        for (int frame = 0; frame < frames; frame++) {
+            uint32_t dirty = shadows.update(cameraView(frame), proj, lightDirection, sceneMin, sceneMax);
+            shadows.markStaticRendered(dirty);
+            for (uint32_t i = 0; i < settings.cascadeCount; i++) {
+                cascadeRenders[i] += (dirty >> i) & 1;
+
+                // A world point keeps its place inside a texel however the cascade moves
+                glm::vec4 clip = shadows.getCascade(i).viewProj * tracked;
+                for (int axis = 0; axis < 2; axis++) {
+                    float texel = (clip[axis] * 0.5f + 0.5f) * settings.resolution;
+                    float fraction = texel - std::floor(texel);
+                    if (frame == 0) {
+                        firstFraction[i][axis] = fraction;
+                    }
+                    float drift = std::abs(fraction - firstFraction[i][axis]);
+                    maxDrift = std::max(maxDrift, std::min(drift, 1.0f - drift));
+                }
+            }
+        }
+        printf("    margin %.3f: %4u static cascade renders of %u, per cascade", margin, shadows.getStaticRenders(), frames * settings.cascadeCount);
+        for (uint32_t i = 0; i < settings.cascadeCount; i++) {
+            printf(" %u", cascadeRenders[i]);
+        }
+        printf(", sub-texel drift %.4f texels \n", maxDrift);
+    }
+
+    // Caster culling per cascade, with the moving boxes changing their bounds every frame
+    CascadedShadows shadows;
+    LinearArena scratch;
+    std::vector<uint32_t> casters;
+    for (JobSystem* threads : { static_cast<JobSystem*>(nullptr), &jobs }) {
+        double cullMs = 0.0;
+        uint64_t staticCasters = 0;
+        uint64_t dynamicCasters = 0;
+        for (int frame = 0; frame < frames; frame++) {
+            for (uint32_t i = staticCount; i < staticCount + dynamicCount; i++) {
+                glm::vec3 moved = positions[i] + glm::vec3(std::sin(frame * 0.03f + i) * 10.0f, 0.0f, std::cos(frame * 0.02f + i) * 10.0f);
+                bounds.set(i, glm::vec3(0.0f), extents[i], glm::translate(glm::mat4(1.0f), moved));
+            }
+            uint32_t dirty = shadows.update(cameraView(frame), proj, lightDirection, sceneMin, sceneMax);
+
+            auto start = std::chrono::high_resolution_clock::now();
+            for (uint32_t i = 0; i < shadows.cascadeCount(); i++) {
+                shadows.cullCasters(i, bounds, threads, scratch, casters);
+                // Casters are sorted, the static ones come first. Only cascades being refreshed draw them
+                size_t firstDynamic = std::lower_bound(casters.begin(), casters.end(), staticCount) - casters.begin();
+                staticCasters += (dirty >> i) & 1 ? firstDynamic : 0;
+                dynamicCasters += casters.size() - firstDynamic;
+            }
+            auto end = std::chrono::high_resolution_clock::now();
+            cullMs += std::chrono::duration<double, std::milli>(end - start).count();
+            shadows.markStaticRendered(dirty);
+        }
+        printf("    caster culling %-10s %.3f ms per frame for all cascades, %.0f static and %.0f dynamic casters drawn per frame \n",
+            threads ? "job system" : "one thread", cullMs / frames, double(staticCasters) / frames, double(dynamicCasters) / frames);
+    }
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "glm-0.9.6.3/glm.hpp"
+#include "Frustum.h"
+
+class JobSystem;
+class LinearArena;
+struct InstanceBounds;
+
+// Fits the cascades of a directional light's shadow map to the camera. Each cascade covers the bounding sphere of its
+// slice of the view frustum, whose size only depends on the projection, and its origin is snapped to a grid of whole
+// texels in a light space that only depends on the light direction. Turning the camera never resizes a cascade and any
+// move of one is by whole texels, so shadow edges do not shimmer.
+// The grid is coarser than a texel and every cascade covers that much more than its sphere, so the cascade stays put
+// while the sphere's center moves within a grid cell. The depth of the static casters is rendered into a cache once per cascade
+// and only again when the cascade moves, the light turns or static geometry changes. Dynamic casters are drawn over a
+// copy of the cache every frame
+class CascadedShadows {
+
+public:
+	static const uint32_t MAX_CASCADES = 4;
+
+	struct Settings {
+		uint32_t cascadeCount = 4;
+		// Texels along each side of a cascade
+		uint32_t resolution = 1024;
+		// Shadows end this far into the view, 0 is the camera's far plane
+		float shadowDistance = 0.0f;
+		// 0 splits the distance evenly, 1 logarithmically
+		float splitLambda = 0.75f;
+		// Snapping grid of the cascade origins and extra coverage, as a fraction of the cascade's sphere radius
+		float cacheMargin = 0.125f;
+	};
+
+	struct Cascade {
+		// World space to Vulkan clip space, depth 0 nearest the light
+		glm::mat4 viewProj{ 1.0f };
+		// View depth where the cascade ends
+		float splitDepth = 0.0f;
+		// World units covered by one texel
+		float texelSize = 0.0f;
+		// Whether the cached static depth was rendered with viewProj
+		bool staticValid = false;
+	};
+
+	CascadedShadows();
+	explicit CascadedShadows(const Settings& settings);
+
+	// Fit the cascades for a view and a glm::perspective projection. lightDirection points from the light into the
+	// scene, the scene bounds decide how far towards the light casters are taken. Returns a mask of the cascades whose
+	// static depth has to be rendered again
+	uint32_t update(const glm::mat4& view, const glm::mat4& proj, const glm::vec3& lightDirection, const glm::vec3& sceneMin, const glm::vec3& sceneMax);
+	// Static geometry moved, every cascade renders its static casters again
+	void invalidateStatic();
+	// The static depth of the cascades in mask was rendered with their current matrices
+	void markStaticRendered(uint32_t mask);
+
+	// Instances whose bounds reach the cascade's box, sorted. Receivers outside the view still cast into it, so the box
+	// reaches from the light's side of the scene to its far side
+	void cullCasters(uint32_t cascade, const InstanceBounds& bounds, JobSystem* jobs, LinearArena& scratch, std::vector<uint32_t>& casters) const;
+
+	const Cascade& getCascade(uint32_t cascade) const { return cascades[cascade]; }
+	uint32_t cascadeCount() const { return settings.cascadeCount; }
+	// Static depth renders so far, summed over the cascades
+	uint32_t getStaticRenders() const { return staticRenders; }
+
+	const Settings& getSettings() const { return settings; }
+	void setSettings(const Settings& newSettings);
+
+	// A camera walking and turning through a field of static and moving boxes. Counts the static cache renders against
+	// rendering every cascade every frame, checks that a fixed point stays on the same sub-texel position in every
+	// cascade, and times the per cascade caster culling
+	static void runBenchmark();
+
+private:
+	Settings settings;
+	Cascade cascades[MAX_CASCADES];
+	// Light space basis, only rebuilt when the light turns
+	glm::vec3 lightDirection{ 0.0f };
+	glm::mat4 lightRotation{ 1.0f };
+	// Range along the light direction the casters are taken from, only widened when the scene outgrows it
+	float depthMin = 0.0f;
+	float depthMax = 0.0f;
+	uint32_t staticRenders = 0;
+};
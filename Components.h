@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include "glm-0.9.6.3/glm.hpp"
+#include "SceneGraph.h"
+
+// Components of the renderer's entities. The instances array stays as the packed copy the draws and acceleration
+// structures read, the ECS is where the data lives and changes are found
+
+// World transform of the scene graph node and its inverse transpose for normals
+struct TransformComponent {
+	glm::mat4 world{ 1.0f };
+	glm::mat4 worldIT{ 1.0f };
+};
+
+// Index into loadedModels
+struct MeshComponent {
+	uint32_t model = 0;
+};
+
+// First texture of the model in the bindless texture array
+struct MaterialComponent {
+	uint32_t textureOffset = 0;
+};
+
+struct SceneNodeComponent {
+	SceneGraph::NodeId node = SceneGraph::INVALID_NODE;
+};
+
+// Slot of the entity in the renderer's instances array and instance bounds
+struct RenderInstanceComponent {
+	uint32_t instance = 0;
+};
@@ -0,0 +1,560 @@
+#include "CookedTexture.h"
+#include "TextureImport.h"
+#include "JobSystem.h"
+#include "AssetArchive.h"
+#include <stb_image.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+#define STB_DXT_IMPLEMENTATION
+#include <stb_dxt.h>
+
+static const char FILE_MAGIC[4] = { 'C', 'T', 'E', 'X' };
+// Bumped whenever the file layout or the cooking changes, older files then cook again
+static const uint32_t FILE_VERSION = 1;
+
+struct FileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t mipCount;
+    uint64_t sourceHash;
+};
+
+// Followed by one of these per level, finest first, then the levels
+struct MipEntry {
+    uint64_t offset;
+    uint64_t size;
+};
+
+static uint64_t hashBytes(const void* data, size_t size, uint64_t seed) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    uint64_t result = seed;
+    for (size_t i = 0; i < size; i++) {
+        result ^= bytes[i];
+        result *= 1099511628211ull;
+    }
+    return result;
+}
+
+static size_t blockBytes(VkFormat format) {
+    switch (format) {
+    case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+        return 8;
+    case VK_FORMAT_BC3_SRGB_BLOCK:
+        return 16;
+    default:
+        return 0;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+COOKING
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+std::string CookedTexture::cookedPath(const std::string& directory, const std::string& source) {
+    return (std::filesystem::path(directory) / (source + ".ctex")).generic_string();
+}
+
+uint64_t CookedTexture::sourceHash(const std::string& source, const Options& options) {
+    MappedFile file(source);
+    if (!file.isOpen()) {
+        return 0;
+    }
+    uint32_t settings[2] = { FILE_VERSION, options.compress ? 1u : 0u };
+    return hashBytes(file.data(), file.size(), hashBytes(settings, sizeof(settings), 14695981039346656037ull));
+}
+
+size_t CookedTexture::mipSize(VkFormat format, uint32_t width, uint32_t height, uint32_t level) {
+    uint32_t levelWidth = std::max(width >> level, 1u);
+    uint32_t levelHeight = std::max(height >> level, 1u);
+    if (size_t bytes = blockBytes(format)) {
+        return static_cast<size_t>((levelWidth + 3) / 4) * ((levelHeight + 3) / 4) * bytes;
+    }
+    return static_cast<size_t>(levelWidth) * levelHeight * 4;
+}
+
+// Every 4x4 block of the level through stb_dxt, texels past the edge of levels smaller than a block repeat the edge
+static void compressLevel(const uint8_t* rgba, uint32_t width, uint32_t height, bool alpha, uint8_t* destination) {
+    size_t bytes = alpha ? 16 : 8;
+    uint8_t block[16 * 4];
+    for (uint32_t by = 0; by < (height + 3) / 4; by++) {
+        for (uint32_t bx = 0; bx < (width + 3) / 4; bx++) {
+            for (uint32_t y = 0; y < 4; y++) {
+                for (uint32_t x = 0; x < 4; x++) {
+                    uint32_t sx = std::min(bx * 4 + x, width - 1);
+                    uint32_t sy = std::min(by * 4 + y, height - 1);
+                    memcpy(block + (y * 4 + x) * 4, rgba + (static_cast<size_t>(sy) * width + sx) * 4, 4);
+                }
+            }
+            stb_compress_dxt_block(destination, block, alpha ? 1 : 0, STB_DXT_HIGHQUAL);
+            destination += bytes;
+        }
+    }
+}
+
+CookedTexture::Result CookedTexture::cook(const std::string& source, const std::string& output, const Options& options) {
+    uint64_t hash = sourceHash(source, options);
+    if (hash == 0) {
+        return Result::Failed;
+    }
+    if (std::unique_ptr<CookedMipSource> existing = CookedMipSource::open(output)) {
+        if (existing->getSourceHash() == hash) {
+            return Result::UpToDate;
+        }
+    }
+
+    std::vector<TextureImporter::Image> images(1);
+    images[0].path = source;
+    std::vector<uint8_t> chain;
+    TextureImporter::import(images, true, nullptr, [&](size_t, const TextureImporter::Image& image) {
+        chain.resize(image.size);
+        return static_cast<void*>(chain.data());
+    }, [](size_t) {});
+    const TextureImporter::Image& image = images[0];
+    if (!image.ok) {
+        return Result::Failed;
+    }
+
+    VkFormat format = VK_FORMAT_R8G8B8A8_SRGB;
+    bool alpha = false;
+    if (options.compress) {
+        const uint8_t* pixels = chain.data() + image.mipOffsets[0];
+        for (size_t t = 0; t < static_cast<size_t>(image.width) * image.height && !alpha; t++) {
+            alpha = pixels[t * 4 + 3] != 255;
+        }
+        format = alpha ? VK_FORMAT_BC3_SRGB_BLOCK : VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+    }
+
+    FileHeader header{};
+    memcpy(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+    header.version = FILE_VERSION;
+    header.format = static_cast<uint32_t>(format);
+    header.width = image.width;
+    header.height = image.height;
+    header.mipCount = static_cast<uint32_t>(image.mipOffsets.size());
+    header.sourceHash = hash;
+
+    std::vector<MipEntry> entries(header.mipCount);
+    uint64_t offset = sizeof(FileHeader) + entries.size() * sizeof(MipEntry);
+    for (uint32_t level = 0; level < header.mipCount; level++) {
+        offset = (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+        entries[level] = { offset, mipSize(format, image.width, image.height, level) };
+        offset += entries[level].size;
+    }
+
+    std::vector<uint8_t> contents(static_cast<size_t>(offset), 0);
+    memcpy(contents.data(), &header, sizeof(header));
+    memcpy(contents.data() + sizeof(header), entries.data(), entries.size() * sizeof(MipEntry));
+    for (uint32_t level = 0; level < header.mipCount; level++) {
+        const uint8_t* pixels = chain.data() + image.mipOffsets[level];
+        uint8_t* destination = contents.data() + entries[level].offset;
+        if (options.compress) {
+            compressLevel(pixels, std::max(image.width >> level, 1u), std::max(image.height >> level, 1u), alpha, destination);
+        }
+        else {
+            memcpy(destination, pixels, static_cast<size_t>(entries[level].size));
+        }
+    }
+
+    // Written beside the target and renamed over it, so a cook cut short never leaves a file that loads
+    std::error_code ec;
+    std::filesystem::path target(output);
+    if (target.has_parent_path()) {
+        std::filesystem::create_directories(target.parent_path(), ec);
+    }
+    std::string temporary = output + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            return Result::Failed;
+        }
+        file.write(reinterpret_cast<const char*>(contents.data()), contents.size());
+        if (!file) {
+            file.close();
+            std::filesystem::remove(temporary, ec);
+            return Result::Failed;
+        }
+    }
+    std::filesystem::rename(temporary, output, ec);
+    if (ec) {
+        std::filesystem::remove(temporary, ec);
+        return Result::Failed;
+    }
+    return Result::Cooked;
+}
+
+CookedTexture::CookStats CookedTexture::cookDirectory(const std::string& sourceDirectory, const std::string& outputDirectory, const Options& options, JobSystem* jobs) {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    std::vector<std::string> sources;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(sourceDirectory, ec)) {
+        int width, height, channels;
+        if (entry.is_regular_file() && stbi_info(entry.path().string().c_str(), &width, &height, &channels)) {
+            sources.push_back(entry.path().generic_string());
+        }
+    }
+    std::sort(sources.begin(), sources.end());
+
+    std::atomic<uint32_t> cooked(0);
+    std::atomic<uint32_t> upToDate(0);
+    std::atomic<uint32_t> failed(0);
+    std::atomic<uint64_t> sourceBytes(0);
+    std::atomic<uint64_t> cookedBytes(0);
+    auto cookRange = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            std::string output = cookedPath(outputDirectory, sources[i]);
+            Result result = cook(sources[i], output, options);
+            if (result == Result::Failed) {
+                printf("Failed to cook %s \n", sources[i].c_str());
+                failed++;
+                continue;
+            }
+            (result == Result::Cooked ? cooked : upToDate)++;
+            std::error_code sizeError;
+            sourceBytes += std::filesystem::file_size(sources[i], sizeError);
+            cookedBytes += std::filesystem::file_size(output, sizeError);
+        }
+    };
+    if (jobs) {
+        jobs->parallelFor(sources.size(), 1, cookRange);
+    }
+    else {
+        cookRange(0, sources.size());
+    }
+
+    CookStats stats;
+    stats.cooked = cooked;
+    stats.upToDate = upToDate;
+    stats.failed = failed;
+    stats.sourceBytes = sourceBytes;
+    stats.cookedBytes = cookedBytes;
+    auto end = std::chrono::high_resolution_clock::now();
+    stats.milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+    return stats;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+LOADING
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+std::unique_ptr<CookedMipSource> CookedMipSource::open(const std::string& path) {
+    std::unique_ptr<CookedMipSource> source(new CookedMipSource());
+    const AssetArchive& archive = AssetArchive::mounted();
+    AssetArchive::View view = archive.view(path);
+    if (!view.empty()) {
+        source->bytes = view.data;
+        source->length = view.size;
+    }
+    else if (archive.read(path, source->inflated)) {
+        source->bytes = reinterpret_cast<const uint8_t*>(source->inflated.data());
+        source->length = source->inflated.size();
+    }
+    else if (source->file.open(path)) {
+        source->bytes = source->file.data();
+        source->length = source->file.size();
+    }
+    const uint8_t* bytes = source->bytes;
+    size_t length = source->length;
+    if (!bytes || length < sizeof(FileHeader)) {
+        return nullptr;
+    }
+
+    FileHeader header;
+    memcpy(&header, bytes, sizeof(header));
+    if (memcmp(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0 || header.version != FILE_VERSION || header.width == 0 || header.height == 0) {
+        return nullptr;
+    }
+    VkFormat format = static_cast<VkFormat>(header.format);
+    if (format != VK_FORMAT_R8G8B8A8_SRGB && format != VK_FORMAT_BC1_RGBA_SRGB_BLOCK && format != VK_FORMAT_BC3_SRGB_BLOCK) {
+        return nullptr;
+    }
+    uint32_t fullChain = 1;
+    while (std::max(header.width >> (fullChain - 1), header.height >> (fullChain - 1)) > 1) {
+        fullChain++;
+    }
+    if (header.mipCount == 0 || header.mipCount > fullChain || length < sizeof(FileHeader) + header.mipCount * sizeof(MipEntry)) {
+        return nullptr;
+    }
+
+    // Every level has to lie in the file at the size its format and extent give, the copy trusts both
+    source->mips.resize(header.mipCount);
+    memcpy(source->mips.data(), bytes + sizeof(FileHeader), header.mipCount * sizeof(MipEntry));
+    for (uint32_t level = 0; level < header.mipCount; level++) {
+        const Mip& mip = source->mips[level];
+        if (mip.offset % CookedTexture::ALIGNMENT != 0 || mip.offset < sizeof(FileHeader) || mip.offset > length ||
+            mip.size != CookedTexture::mipSize(format, header.width, header.height, level) || mip.size > length - mip.offset) {
+            return nullptr;
+        }
+    }
+
+    source->format = format;
+    source->width = header.width;
+    source->height = header.height;
+    source->sourceHash = header.sourceHash;
+    return source;
+}
+
+bool CookedMipSource::readMip(uint32_t level, void* destination) const {
+    if (level >= mips.size()) {
+        return false;
+    }
+    memcpy(destination, getMipData(level), static_cast<size_t>(mips[level].size));
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+TESTS
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Uncompressed 32 bit TGA, which stb_image reads with its alpha, so the tests need no encoder
+static bool writeTGA(const std::string& path, uint32_t width, uint32_t height, const std::vector<uint8_t>& rgba) {
+    uint8_t header[18] = {};
+    header[2] = 2;
+    header[12] = static_cast<uint8_t>(width);
+    header[13] = static_cast<uint8_t>(width >> 8);
+    header[14] = static_cast<uint8_t>(height);
+    header[15] = static_cast<uint8_t>(height >> 8);
+    header[16] = 32;
+    // Eight alpha bits, rows top to bottom
+    header[17] = 0x28;
+    std::vector<uint8_t> bgra(rgba.size());
+    for (size_t t = 0; t < rgba.size(); t += 4) {
+        bgra[t] = rgba[t + 2];
+        bgra[t + 1] = rgba[t + 1];
+        bgra[t + 2] = rgba[t];
+        bgra[t + 3] = rgba[t + 3];
+    }
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(bgra.data()), bgra.size());
+    return static_cast<bool>(file);
+}
+
+bool CookedTexture::runSelfTest() {
+    size_t checks = 0;
+    size_t failures = 0;
+    auto check = [&](bool ok, const std::string& what) {
+        checks++;
+        if (!ok) {
+            if (failures < 10) {
+                printf("    FAILED: %s \n", what.c_str());
+            }
+            failures++;
+        }
+    };
+
+    check(mipSize(VK_FORMAT_R8G8B8A8_SRGB, 5, 3, 1) == 8, "an RGBA8 level is its texels");
+    check(mipSize(VK_FORMAT_BC1_RGBA_SRGB_BLOCK, 5, 3, 0) == 16 && mipSize(VK_FORMAT_BC1_RGBA_SRGB_BLOCK, 5, 3, 2) == 8, "BC1 levels round up to whole blocks");
+    check(mipSize(VK_FORMAT_BC3_SRGB_BLOCK, 64, 64, 0) == 4096, "BC3 blocks are 16 bytes");
+    check(cookedPath("cooked", "VikingRoom/Material.png") == "cooked/VikingRoom/Material.png.ctex", "cooked files mirror the source path");
+
+    std::error_code ec;
+    std::filesystem::path directory = std::filesystem::temp_directory_path(ec) / "cooked-texture-test";
+    std::filesystem::remove_all(directory, ec);
+    std::filesystem::create_directories(directory / "images" / "nested", ec);
+
+    // An opaque gradient and a flat color with translucent alpha
+    auto image = [](uint32_t width, uint32_t height, bool translucent) {
+        std::vector<uint8_t> rgba(static_cast<size_t>(width) * height * 4);
+        for (uint32_t y = 0; y < height; y++) {
+            for (uint32_t x = 0; x < width; x++) {
+                uint8_t* texel = rgba.data() + (static_cast<size_t>(y) * width + x) * 4;
+                texel[0] = translucent ? 200 : static_cast<uint8_t>(x * 255 / std::max(width - 1, 1u));
+                texel[1] = translucent ? 100 : static_cast<uint8_t>(y * 255 / std::max(height - 1, 1u));
+                texel[2] = 50;
+                texel[3] = translucent ? 128 : 255;
+            }
+        }
+        return rgba;
+    };
+    std::string opaquePath = (directory / "images" / "opaque.tga").generic_string();
+    std::string translucentPath = (directory / "images" / "nested" / "translucent.tga").generic_string();
+    check(writeTGA(opaquePath, 70, 33, image(70, 33, false)), "test image written");
+    check(writeTGA(translucentPath, 16, 16, image(16, 16, true)), "test image written");
+    {
+        std::ofstream notAnImage((directory / "images" / "notes.txt").string());
+        notAnImage << "not an image";
+    }
+
+    // Uncompressed, the levels are the decoded chain byte for byte
+    std::string output = cookedPath((directory / "cooked").generic_string(), opaquePath);
+    check(cook(opaquePath, output, Options()) == Result::Cooked, "first cook writes the file");
+    check(!std::filesystem::exists(output + ".tmp"), "no temporary file is left behind");
+    {
+        ImageMipSource decoded(opaquePath);
+        std::unique_ptr<CookedMipSource> cooked = CookedMipSource::open(output);
+        check(cooked != nullptr, "the cooked file opens");
+        if (cooked) {
+            check(cooked->getFormat() == VK_FORMAT_R8G8B8A8_SRGB && cooked->getWidth() == 70 && cooked->getHeight() == 33, "format and size are kept");
+            check(cooked->getMipCount() == decoded.getMipCount(), "every level is cooked");
+            bool same = true;
+            bool aligned = true;
+            for (uint32_t level = 0; level < cooked->getMipCount(); level++) {
+                std::vector<uint8_t> expected(decoded.getMipSize(level));
+                std::vector<uint8_t> read(cooked->getMipSize(level));
+                decoded.readMip(level, expected.data());
+                same &= cooked->readMip(level, read.data()) && expected == read;
+                aligned &= reinterpret_cast<uintptr_t>(cooked->getMipData(level)) % ALIGNMENT == 0;
+            }
+            check(same, "cooked levels match the decoded chain");
+            check(aligned, "levels start aligned in the mapping");
+            uint8_t unused[4];
+            check(!cooked->readMip(cooked->getMipCount(), unused), "reading past the last level fails");
+        }
+    }
+    check(cook(opaquePath, output, Options()) == Result::UpToDate, "an unchanged source is skipped");
+
+    // Compressed, opaque images are BC1 and translucent ones BC3
+    Options compressed;
+    compressed.compress = true;
+    check(sourceHash(opaquePath, compressed) != sourceHash(opaquePath, Options()), "the options are part of the hash");
+    check(cook(opaquePath, output, compressed) == Result::Cooked, "other options cook again");
+    {
+        std::unique_ptr<CookedMipSource> cooked = CookedMipSource::open(output);
+        check(cooked && cooked->getFormat() == VK_FORMAT_BC1_RGBA_SRGB_BLOCK, "an opaque image is BC1");
+        check(cooked && cooked->getMipSize(0) == 18 * 9 * 8, "BC1 level 0 has a block per 4x4");
+    }
+    std::string translucentOutput = cookedPath((directory / "cooked").generic_string(), translucentPath);
+    check(cook(translucentPath, translucentOutput, compressed) == Result::Cooked, "the translucent image cooks");
+    {
+        std::unique_ptr<CookedMipSource> cooked = CookedMipSource::open(translucentOutput);
+        check(cooked && cooked->getFormat() == VK_FORMAT_BC3_SRGB_BLOCK, "a translucent image is BC3");
+        if (cooked) {
+            // The first texel of the first block, decoded from the alpha endpoints and the four color palette
+            const uint8_t* block = cooked->getMipData(0);
+            int endpoints[2][3];
+            for (int e = 0; e < 2; e++) {
+                int color = block[8 + 2 * e] | (block[9 + 2 * e] << 8);
+                endpoints[e][0] = ((color >> 11) & 31) * 255 / 31;
+                endpoints[e][1] = ((color >> 5) & 63) * 255 / 63;
+                endpoints[e][2] = (color & 31) * 255 / 31;
+            }
+            int index = block[12] & 3;
+            int weights[4] = { 3, 0, 2, 1 };
+            int red = (endpoints[0][0] * weights[index] + endpoints[1][0] * (3 - weights[index])) / 3;
+            int green = (endpoints[0][1] * weights[index] + endpoints[1][1] * (3 - weights[index])) / 3;
+            int blue = (endpoints[0][2] * weights[index] + endpoints[1][2] * (3 - weights[index])) / 3;
+            check(block[0] == 128 && block[1] == 128, "alpha endpoints hold the flat alpha");
+            check(std::abs(red - 200) <= 8 && std::abs(green - 100) <= 4 && std::abs(blue - 50) <= 8, "color endpoint holds the flat color");
+        }
+    }
+
+    // A changed source cooks again
+    check(writeTGA(opaquePath, 70, 33, image(70, 33, true)), "test image rewritten");
+    check(cook(opaquePath, output, compressed) == Result::Cooked, "a changed source cooks again");
+    check(cook(directory.generic_string() + "/missing.png", (directory / "missing.ctex").generic_string(), Options()) == Result::Failed, "a missing source fails");
+
+    // Damaged files are refused
+    std::vector<char> contents;
+    {
+        std::ifstream in(output, std::ios::binary);
+        contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    std::string damagedPath = (directory / "damaged.ctex").generic_string();
+    auto refused = [&](const std::vector<char>& damaged) {
+        {
+            std::ofstream out(damagedPath, std::ios::binary | std::ios::trunc);
+            out.write(damaged.data(), damaged.size());
+        }
+        return CookedMipSource::open(damagedPath) == nullptr;
+    };
+    check(refused(std::vector<char>(contents.begin(), contents.end() - 1)), "a truncated file is refused");
+    check(refused(std::vector<char>(contents.begin(), contents.begin() + sizeof(FileHeader) / 2)), "a file cut in the header is refused");
+    std::vector<char> version = contents;
+    version[offsetof(FileHeader, version)] ^= 1;
+    check(refused(version), "another version is refused");
+    std::vector<char> misaligned = contents;
+    misaligned[sizeof(FileHeader)] ^= 4;
+    check(refused(misaligned), "a misaligned level is refused");
+    check(!refused(contents), "the undamaged file opens");
+    check(CookedMipSource::open((directory / "nothing.ctex").generic_string()) == nullptr, "a missing file is refused");
+
+    // Directories cook every image once, on the job system
+    {
+        JobSystem jobs(2);
+        std::string cookedDirectory = (directory / "bulk").generic_string();
+        CookStats first = cookDirectory((directory / "images").generic_string(), cookedDirectory, Options(), &jobs);
+        check(first.cooked == 2 && first.upToDate == 0 && first.failed == 0, "a directory cooks its images and skips other files");
+        CookStats second = cookDirectory((directory / "images").generic_string(), cookedDirectory, Options(), &jobs);
+        check(second.cooked == 0 && second.upToDate == 2, "a second pass is up to date");
+        check(std::filesystem::exists(cookedPath(cookedDirectory, translucentPath)), "nested images keep their path");
+    }
+
+    std::filesystem::remove_all(directory, ec);
+
+    printf("%zu checks, %zu failed \n", checks, failures);
+    return failures == 0;
+}
+
+void CookedTexture::runBenchmark() {
+    const char* sources[] = { "Images/texture.jpg", "Images/texture2.jpg", "VikingRoom/Material.png" };
+    std::error_code ec;
+    std::string directory = (std::filesystem::temp_directory_path(ec) / "cooked-texture-bench").generic_string();
+    std::filesystem::remove_all(directory, ec);
+
+    auto milliseconds = [](std::chrono::high_resolution_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    };
+
+    printf("%-26s %10s %12s %12s %12s %12s %12s \n", "texture", "cooking", "size (MB)", "decode (ms)", "tail (ms)", "whole (ms)", "cook (ms)");
+    for (const char* source : sources) {
+        for (bool compress : { false, true }) {
+            Options options;
+            options.compress = compress;
+            std::string output = cookedPath(directory, source);
+            auto start = std::chrono::high_resolution_clock::now();
+            if (cook(source, output, options) != Result::Cooked) {
+                printf("Failed to cook %s \n", source);
+                continue;
+            }
+            double cookMs = milliseconds(start);
+
+            // Decoding is what every launch paid before, with the chain filtered as streaming needs it
+            start = std::chrono::high_resolution_clock::now();
+            ImageMipSource decoded(source);
+            double decodeMs = milliseconds(start);
+
+            // Open and read the levels a texture starts with, then every level
+            start = std::chrono::high_resolution_clock::now();
+            std::unique_ptr<CookedMipSource> cooked = CookedMipSource::open(output);
+            std::vector<uint8_t> staging(static_cast<size_t>(std::filesystem::file_size(output, ec)));
+            size_t offset = 0;
+            for (uint32_t level = cooked->getTailMip(128); level < cooked->getMipCount(); level++) {
+                cooked->readMip(level, staging.data() + offset);
+                offset += cooked->getMipSize(level);
+            }
+            double tailMs = milliseconds(start);
+
+            start = std::chrono::high_resolution_clock::now();
+            cooked = CookedMipSource::open(output);
+            offset = 0;
+            for (uint32_t level = 0; level < cooked->getMipCount(); level++) {
+                cooked->readMip(level, staging.data() + offset);
+                offset += cooked->getMipSize(level);
+            }
+            double wholeMs = milliseconds(start);
+
+            printf("%-26s %10s %12.2f %12.2f %12.3f %12.3f %12.1f \n", source, compress ? "BC" : "RGBA8", staging.size() / (1024.0 * 1024.0), decodeMs, tailMs, wholeMs, cookMs);
+            std::filesystem::remove(output, ec);
+        }
+    }
+    std::filesystem::remove_all(directory, ec);
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <volk.h>
+#include "MappedFile.h"
+#include "TextureStreaming.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class JobSystem;
+
+// Textures cooked ahead of time into a file that loads with no decode step: a header with the format and size, a table
+// of the levels and the levels themselves, finest first, each exactly as vkCmdCopyBufferToImage reads it and starting
+// on an ALIGNMENT boundary. Levels are RGBA8 or, when compressed, BC1 for opaque images and BC3 for the rest
+class CookedTexture {
+
+public:
+	// A multiple of every texel block size, so any level's offset is a valid bufferOffset
+	static const uint32_t ALIGNMENT = 16;
+
+	struct Options {
+		bool compress = false;
+	};
+
+	enum class Result { Cooked, UpToDate, Failed };
+
+	struct CookStats {
+		uint32_t cooked = 0;
+		uint32_t upToDate = 0;
+		uint32_t failed = 0;
+		uint64_t sourceBytes = 0;
+		uint64_t cookedBytes = 0;
+		double milliseconds = 0.0;
+	};
+
+	// Where the cooked file of a source image lives under directory, its path as the engine loads it plus .ctex
+	static std::string cookedPath(const std::string& directory, const std::string& source);
+	// Hash of the source file's bytes and the options, stored in the cooked file. 0 when the source cannot be read
+	static uint64_t sourceHash(const std::string& source, const Options& options);
+
+	// Decode the source, build its mips and write them to output. Skipped when output was cooked from the same bytes
+	// with the same options
+	static Result cook(const std::string& source, const std::string& output, const Options& options);
+	// Cook every image under sourceDirectory to its cookedPath under outputDirectory, spread over the job system
+	static CookStats cookDirectory(const std::string& sourceDirectory, const std::string& outputDirectory, const Options& options, JobSystem* jobs);
+
+	// Bytes of a level in the formats cooked files hold
+	static size_t mipSize(VkFormat format, uint32_t width, uint32_t height, uint32_t level);
+
+	// Cooks generated images raw and compressed, loads them back and checks the levels, the incremental skips and
+	// that damaged files are refused. Returns false if any check failed
+	static bool runSelfTest();
+	// Time to the first streamed level of the repo's textures decoded against cooked
+	static void runBenchmark();
+};
+
+// The levels of a cooked texture, read straight out of the mapped file or out of the mounted AssetArchive's mapping
+class CookedMipSource : public MipSource {
+
+public:
+	// Null when the file is missing or is not a valid cooked texture. The mounted archive is looked in first and has to
+	// stay open while the source lives
+	static std::unique_ptr<CookedMipSource> open(const std::string& path);
+
+	VkFormat getFormat() const override { return format; }
+	uint32_t getWidth() const override { return width; }
+	uint32_t getHeight() const override { return height; }
+	uint32_t getMipCount() const override { return static_cast<uint32_t>(mips.size()); }
+	size_t getMipSize(uint32_t level) const override { return static_cast<size_t>(mips[level].size); }
+	bool readMip(uint32_t level, void* destination) const override;
+
+	// The level in the mapping, valid while the source lives
+	const uint8_t* getMipData(uint32_t level) const { return bytes + mips[level].offset; }
+	uint64_t getSourceHash() const { return sourceHash; }
+
+private:
+	struct Mip {
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	// The file's bytes, in file, in the archive's mapping or in inflated when the archive stored it compressed
+	MappedFile file;
+	std::vector<char> inflated;
+	const uint8_t* bytes = nullptr;
+	size_t length = 0;
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint64_t sourceHash = 0;
+	std::vector<Mip> mips;
+};
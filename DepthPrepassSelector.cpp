@@ -0,0 +1,197 @@
+#include "DepthPrepassSelector.h"
+#include <algorithm>
+#include <cstdio>
+#include <random>
+
+DepthPrepassSelector::DepthPrepassSelector() : DepthPrepassSelector(Settings()) {
+}
+
+DepthPrepassSelector::DepthPrepassSelector(const Settings& settings) : settings(settings) {
+    samples.reserve(settings.sampleFrames);
+    timeSamples.reserve(settings.sampleFrames);
+}
+
+void DepthPrepassSelector::setSettings(const Settings& newSettings) {
+    settings = newSettings;
+    reset();
+}
+
+void DepthPrepassSelector::reset() {
+    phase = Phase::MeasureWithout;
+    samples.clear();
+    timeSamples.clear();
+    shadedPerPixel = 0.0f;
+    overdraw = 0.0f;
+    msWithout = 0.0f;
+    msWith = 0.0f;
+    keepPrepass = false;
+}
+
+bool DepthPrepassSelector::usePrepass() const {
+    return phase == Phase::MeasureWith || (phase == Phase::Decided && keepPrepass);
+}
+
+float DepthPrepassSelector::median(std::vector<float>& values) {
+    // A frame of camera motion or a hitch does not decide the scene
+    std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+    return values[values.size() / 2];
+}
+
+bool DepthPrepassSelector::addFrame(uint64_t fragments, uint64_t pixels, float gpuMs, bool prepass) {
+    if (phase == Phase::Decided || prepass != usePrepass() || pixels == 0) {
+        return false;
+    }
+    // Per pixel, so frames drawn at another render scale compare
+    samples.push_back(static_cast<float>(static_cast<double>(fragments) / pixels));
+    timeSamples.push_back(static_cast<float>(gpuMs * 1e6 / pixels));
+    if (samples.size() < settings.sampleFrames) {
+        return false;
+    }
+
+    float perPixel = median(samples);
+    float ms = median(timeSamples);
+    samples.clear();
+    timeSamples.clear();
+    if (phase == Phase::MeasureWithout) {
+        shadedPerPixel = perPixel;
+        msWithout = ms;
+        phase = Phase::MeasureWith;
+        return true;
+    }
+
+    // With the pre-pass only the visible pixels are shaded, an empty view has nothing to gain
+    overdraw = perPixel > 0.0f ? std::max(shadedPerPixel / perPixel, 1.0f) : 1.0f;
+    msWith = ms;
+    // The overdraw alone says nothing about how expensive the removed fragments were or what the second geometry pass
+    // cost, so the frame times decide whenever there are any
+    keepPrepass = msWithout > 0.0f && msWith > 0.0f ? msWith < msWithout : overdraw >= settings.enableOverdraw;
+    phase = Phase::Decided;
+    return !usePrepass();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+BENCHMARK
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void DepthPrepassSelector::runBenchmark() {
+    const int width = 480;
+    const int height = 270;
+    const uint64_t pixels = uint64_t(width) * height;
+    // Cost of a fragment relative to a shaded one, written by the depth-only pass and rejected by the depth test. Depth
+    // only fragments run at several times the shaded rate and hierarchical depth rejects most hidden ones in blocks. The
+    // vertex work of the second geometry pass is left out
+    const double depthOnlyCost = 0.05;
+    const double rejectCost = 0.02;
+    // GPU time of a shaded fragment, and how much a frame's time varies around the model
+    const double nanosecondsPerFragment = 0.5;
+    const double timeNoise = 0.05;
+
+    struct Rect {
+        int x, y, w, h;
+        float depth;
+    };
+    struct Scene {
+        const char* name;
+        int count;
+        int maxSize;
+        int order;
+    };
+    // order 0 is front to back, 1 back to front, 2 shuffled
+    const Scene scenes[] = {
+        { "front to back", 400, 160, 0 },
+        { "back to front", 400, 160, 1 },
+        { "shuffled", 400, 160, 2 },
+        { "sparse shuffled", 60, 80, 2 },
+    };
+
+    Settings settings;
+    printf("%dx%d, fragment cost 1 shaded, %.2f depth only, %.2f rejected, frame times within %.0f%% of the model \n",
+        width, height, depthOnlyCost, rejectCost, timeNoise * 100.0);
+
+    std::vector<float> depth(pixels);
+    for (const Scene& scene : scenes) {
+        std::mt19937 random(9);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        std::vector<Rect> rects(scene.count);
+        for (Rect& rect : rects) {
+            rect.w = 16 + random() % scene.maxSize;
+            rect.h = 16 + random() % scene.maxSize;
+            rect.x = static_cast<int>(random() % (width + rect.w)) - rect.w / 2;
+            rect.y = static_cast<int>(random() % (height + rect.h)) - rect.h / 2;
+            rect.depth = unit(random);
+        }
+        if (scene.order == 2) {
+            std::shuffle(rects.begin(), rects.end(), random);
+        }
+        else {
+            std::sort(rects.begin(), rects.end(), [&](const Rect& a, const Rect& b) { return (a.depth < b.depth) == (scene.order == 0); });
+        }
+
+        // Counts of a frame with the camera panned by a few pixels, both modes drawn from the same view
+        struct Counts {
+            uint64_t rasterized = 0;
+            uint64_t shadedWithout = 0;
+            uint64_t shadedWith = 0;
+        };
+        auto drawFrame = [&](int panX, int panY) {
+            Counts counts;
+            std::fill(depth.begin(), depth.end(), 1.0f);
+            auto forEachPixel = [&](const Rect& rect, auto&& visit) {
+                int x0 = std::max(rect.x + panX, 0), x1 = std::min(rect.x + panX + rect.w, width);
+                int y0 = std::max(rect.y + panY, 0), y1 = std::min(rect.y + panY + rect.h, height);
+                for (int y = y0; y < y1; y++) {
+                    for (int x = x0; x < x1; x++) {
+                        visit(depth[size_t(y) * width + x]);
+                    }
+                }
+            };
+            // Without the pre-pass a fragment is shaded whenever it is nearer than what was drawn before it
+            for (const Rect& rect : rects) {
+                forEachPixel(rect, [&](float& stored) {
+                    counts.rasterized++;
+                    if (rect.depth < stored) {
+                        stored = rect.depth;
+                        counts.shadedWithout++;
+                    }
+                });
+            }
+            // The buffer now holds what a pre-pass would leave, the equal test passes only the nearest fragment
+            for (const Rect& rect : rects) {
+                forEachPixel(rect, [&](float& stored) {
+                    counts.shadedWith += rect.depth == stored;
+                });
+            }
+            return counts;
+        };
+
+        DepthPrepassSelector selector(settings);
+        Counts total;
+        int frames = 0;
+        std::uniform_int_distribution<int> pan(-8, 8);
+        std::uniform_real_distribution<double> noise(1.0 - timeNoise, 1.0 + timeNoise);
+        while (selector.getPhase() != Phase::Decided) {
+            Counts counts = drawFrame(pan(random), pan(random));
+            bool prepass = selector.usePrepass();
+            uint64_t shaded = prepass ? counts.shadedWith : counts.shadedWithout;
+            double cost = shaded + (counts.rasterized - shaded) * rejectCost + (prepass ? counts.rasterized * depthOnlyCost : 0.0);
+            float gpuMs = static_cast<float>(cost * nanosecondsPerFragment * 1e-6 * noise(random));
+            selector.addFrame(shaded, pixels, gpuMs, prepass);
+            total.rasterized += counts.rasterized;
+            total.shadedWithout += counts.shadedWithout;
+            total.shadedWith += counts.shadedWith;
+            frames++;
+        }
+
+        double rasterized = double(total.rasterized) / frames;
+        double shadedWithout = double(total.shadedWithout) / frames;
+        double shadedWith = double(total.shadedWith) / frames;
+        double costWithout = shadedWithout + (rasterized - shadedWithout) * rejectCost;
+        double costWith = rasterized * depthOnlyCost + shadedWith + (rasterized - shadedWith) * rejectCost;
+        bool chosen = selector.usePrepass();
+        printf("    %-16s depth complexity %4.2f, overdraw %4.2f, measured %.3f ms/Mpx without %.3f with, pre-pass %-3s, cost %6.0fk without %6.0fk with, %s \n",
+            scene.name, rasterized / std::max(shadedWith, 1.0), selector.getOverdraw(), selector.getMillisecondsWithout(), selector.getMillisecondsWith(),
+            chosen ? "on" : "off", costWithout / 1000.0, costWith / 1000.0, chosen == (costWith < costWithout) ? "cheaper mode chosen" : "more expensive mode chosen");
+    }
+}
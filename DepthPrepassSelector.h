@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Decides per scene whether a depth-only pre-pass is worth its second geometry pass. The scene is first measured without
+// it, where every fragment that passes the depth test in draw order is shaded, then with it, where the equal tested
+// color pass shades each visible pixel once. The pre-pass stays on when its GPU frame time is the lower one, which
+// covers both what the removed overdraw saved and what drawing the geometry twice cost. The ratio of the fragment
+// counts is the overdraw the pre-pass removes
+class DepthPrepassSelector {
+
+public:
+	struct Settings {
+		// Frames measured in each mode, the median of them is what counts
+		uint32_t sampleFrames = 8;
+		// Shaded fragments per visible pixel from which the pre-pass is kept, only used without GPU frame times
+		float enableOverdraw = 1.5f;
+	};
+
+	enum class Phase {
+		MeasureWithout,
+		MeasureWith,
+		Decided
+	};
+
+	DepthPrepassSelector();
+	explicit DepthPrepassSelector(const Settings& settings);
+
+	// Measure again for a new scene, starting without the pre-pass
+	void reset();
+
+	// Fragment shader invocations of a frame's color pass, the pixels it covered, its GPU time, 0 without timestamps, and
+	// whether the frame had the pre-pass. Frames rendered in the other mode are ignored. Returns true when usePrepass changed
+	bool addFrame(uint64_t fragments, uint64_t pixels, float gpuMs, bool prepass);
+
+	// Mode the next frames should be rendered in
+	bool usePrepass() const;
+	Phase getPhase() const { return phase; }
+	// Shaded fragments per visible pixel without the pre-pass, 0 until both modes were measured
+	float getOverdraw() const { return overdraw; }
+	// Median GPU time per million pixels of each mode, 0 until measured or without timestamps
+	float getMillisecondsWithout() const { return msWithout; }
+	float getMillisecondsWith() const { return msWith; }
+
+	const Settings& getSettings() const { return settings; }
+	void setSettings(const Settings& newSettings);
+
+	// Rectangles at random depths drawn front to back, back to front and shuffled, rasterized on the CPU for the fragment
+	// counts of both modes, with frame times from a cost model plus noise. Reports the measured overdraw, the choice and
+	// the modeled cost of each mode
+	static void runBenchmark();
+
+private:
+	static float median(std::vector<float>& values);
+
+	Settings settings;
+	Phase phase = Phase::MeasureWithout;
+	// Fragments per pixel and GPU milliseconds per million pixels of the frames measured in the current phase
+	std::vector<float> samples;
+	std::vector<float> timeSamples;
+	float shadedPerPixel = 0.0f;
+	float overdraw = 0.0f;
+	float msWithout = 0.0f;
+	float msWith = 0.0f;
+	bool keepPrepass = false;
+};
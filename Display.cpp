@@ -31,28 +31,50 @@ SDL_Window* Display::initDisplay(const char* appName) {
     return window;
 }
 
-void Display::updateUniformBuffer(uint32_t currentImage, VulkanRenderer vkR) {
+void Display::updateUniformBuffer(uint32_t currentImage, VulkanRenderer& vkR) {
     static auto startTime = std::chrono::high_resolution_clock::now();
 
     auto currentTime = std::chrono::high_resolution_clock::now();
     float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
 
+    // Moved nodes update their instances and the TLAS before anything reads the transforms
+    vkR.updateSceneGraph();
+
     VulkanRenderer::UniformBufferObject ubo{};
+    ubo.model = vkR.getModelMatrix(vkR.instances[0]);
     //ubo.model = glm::rotate(glm::mat4(1.0f), time * glm::radians(45.0f), glm::vec3(0.0f, 0.0f, 1.0f));
     ubo.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
     ubo.proj = glm::perspective(glm::radians(45.0f), vkR.SWChainExtent.width / (float)vkR.SWChainExtent.height, 0.1f, 10.0f);
     ubo.proj[1][1] *= -1;
+    ubo.normalMatrix = VertexQuantization::normalMatrix(ubo.view * vkR.instances[0].transform);
+
+    vkR.updateIndirectCommands(currentImage, ubo.view, ubo.proj);
+    vkR.updateLightClusters(currentImage, ubo.view, ubo.proj);
+    vkR.updateShadows(currentImage, ubo.view, ubo.proj, ubo);
+    vkR.updateRayTracedShadows(currentImage, ubo.view, ubo.proj, ubo);
+    vkR.updateTextureStreaming(currentImage, ubo.view, ubo.proj);
 
     void* data;
     vkMapMemory(vkR.device, vkR.uniformBuffersMemory[currentImage], 0, sizeof(ubo), 0, &data);
     memcpy(data, &ubo, sizeof(ubo));
     vkUnmapMemory(vkR.device, vkR.uniformBuffersMemory[currentImage]);
+
+    // Stale cascades render their static casters with the matrices just written
+    vkR.renderStaticShadows(currentImage);
 }
 
-void Display::drawNewFrame(VulkanRenderer v, int maxFramesInFlight, std::vector<VkFence> inFlightFences, std::vector<VkFence> imagesInFlight) {
+void Display::drawNewFrame(VulkanRenderer& v, int maxFramesInFlight) {
+    // Work directly on the renderer's fences, copies would lose the image to fence tracking between frames
+    std::vector<VkFence>& inFlightFences = v.inFlightFences;
+    std::vector<VkFence>& imagesInFlight = v.imagesInFlight;
+
     // Wait for the frame to be finished, with the fences
     vkWaitForFences(v.device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
 
+    // The frame that last used this arena has finished, so its transient allocations can be dropped
+    v.frameArenas.beginFrame(currentFrame);
+    v.frameInFlight = static_cast<uint32_t>(currentFrame);
+
     // Acquire an image from the swap chain, execute the command buffer with the image attached in the framebuffer, and return to swap chain as ready to present
     uint32_t imageIndex;
     // Disable the timeout with UINT64_MAX
@@ -66,8 +88,6 @@ void Display::drawNewFrame(VulkanRenderer v, int maxFramesInFlight, std::vector<
         std::_Xruntime_error("Failed to acquire a swap chain image!");
     }
 
-    updateUniformBuffer(imageIndex, v);
-
     // Check to make sure previous frame isnt using the image
     if (imagesInFlight[imageIndex] != VK_NULL_HANDLE) {
         vkWaitForFences(v.device, 1, &imagesInFlight[imageIndex], VK_TRUE, UINT64_MAX);
@@ -76,19 +96,40 @@ void Display::drawNewFrame(VulkanRenderer v, int maxFramesInFlight, std::vector<
     // Now mark the new image as being used by the frame
     imagesInFlight[imageIndex] = inFlightFences[currentFrame];
 
+    // The image's previous frame is done, its GPU time can pick the render scale before the command buffer is checked
+    v.updateDynamicResolution(imageIndex);
+    // Its fragment count likewise, which may switch the depth pre-pass and mark the command buffers stale
+    v.updateDepthPrepass(imageIndex);
+
+    // Written only once the image's previous frame is done, the uniform and indirect buffers are per image
+    updateUniformBuffer(imageIndex, v);
+
+    // The image is no longer in use, so its command buffer can be re-recorded if a pipeline swap made it stale
+    if (v.commandBufferStale[imageIndex]) {
+        v.recordCommandBuffer(imageIndex);
+    }
+
     // Submit the command buffer with the semaphore
     VkSubmitInfo queueSubmitInfo{};
     queueSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
     VkSemaphore waitSemaphores[] = { v.imageAcquiredSema[currentFrame] };
-    VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+    // The swap chain image is first written by the blit from the render target
+    VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_TRANSFER_BIT };
     queueSubmitInfo.waitSemaphoreCount = 1;
     queueSubmitInfo.pWaitSemaphores = waitSemaphores;
     queueSubmitInfo.pWaitDstStageMask = waitStages;
 
-    // Specify the command buffers to actually submit for execution
-    queueSubmitInfo.commandBufferCount = 1;
-    queueSubmitInfo.pCommandBuffers = &v.commandBuffers[imageIndex];
+    // Specify the command buffers to actually submit for execution, a TLAS refit recorded this frame goes first
+    VkCommandBuffer submitBuffers[2];
+    uint32_t submitCount = 0;
+    if (v.tlasUpdatePending) {
+        submitBuffers[submitCount++] = v.tlasUpdateCommandBuffers[currentFrame];
+        v.tlasUpdatePending = false;
+    }
+    submitBuffers[submitCount++] = v.commandBuffers[imageIndex];
+    queueSubmitInfo.commandBufferCount = submitCount;
+    queueSubmitInfo.pCommandBuffers = submitBuffers;
 
     // Specify which semaphores to signal once command buffers have finished execution
     VkSemaphore signaledSemaphores[] = { v.renderedSema[currentFrame] };
@@ -105,6 +146,8 @@ void Display::drawNewFrame(VulkanRenderer v, int maxFramesInFlight, std::vector<
     if (vkQueueSubmit(v.graphicsQueue, 1, &queueSubmitInfo, inFlightFences[currentFrame]) != VK_SUCCESS) {
         std::_Xruntime_error("Failed to submit the draw command buffer to the graphics queue!");
     }
+    v.timestampsPending[imageIndex] = true;
+    v.statisticsPending[imageIndex] = true;
 
     // Present the frame from the queue
     VkPresentInfoKHR presentInfo{};
@@ -132,4 +175,8 @@ void Display::drawNewFrame(VulkanRenderer v, int maxFramesInFlight, std::vector<
     }
 
     currentFrame = (currentFrame + 1) % maxFramesInFlight;
+
+    v.frameCount++;
+    v.destroyRetiredPipelines();
+    v.destroyRetiredImages();
 }
\ No newline at end of file
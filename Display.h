@@ -10,6 +10,6 @@ public:
 	size_t currentFrame = 0;
 
 	SDL_Window* initDisplay(const char* appName);
-	void drawNewFrame(VulkanRenderer v, int maxFramesInFlight, std::vector<VkFence> inFlightFences, std::vector<VkFence> imagesInFlight);
-	void updateUniformBuffer(uint32_t currentImageIndex, VulkanRenderer vkR);
+	void drawNewFrame(VulkanRenderer& v, int maxFramesInFlight);
+	void updateUniformBuffer(uint32_t currentImageIndex, VulkanRenderer& vkR);
 };
\ No newline at end of file
@@ -0,0 +1,642 @@
+#include "DynamicAABBTree.h"
+#include "JobSystem.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <stdexcept>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+TREE STRUCTURE
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// How far ahead of the motion the fat box reaches, in updates
+static const float DISPLACEMENT_MULTIPLIER = 4.0f;
+
+DynamicAABBTree::DynamicAABBTree(float margin) : margin(margin) {}
+
+uint32_t DynamicAABBTree::allocateNode() {
+    uint32_t index = freeList;
+    if (index == BVH::INVALID_NODE) {
+        index = static_cast<uint32_t>(nodes.size());
+        nodes.emplace_back();
+        parents.push_back(BVH::INVALID_NODE);
+        heights.push_back(0);
+        tightMin.emplace_back(0.0f);
+        tightMax.emplace_back(0.0f);
+        items.push_back(0);
+    }
+    else {
+        freeList = parents[index];
+    }
+    parents[index] = BVH::INVALID_NODE;
+    heights[index] = 0;
+    return index;
+}
+
+void DynamicAABBTree::freeNode(uint32_t index) {
+    parents[index] = freeList;
+    heights[index] = -1;
+    freeList = index;
+}
+
+static void combine(BVHNode& node, const BVHNode& a, const BVHNode& b) {
+    node.min = glm::min(a.min, b.min);
+    node.max = glm::max(a.max, b.max);
+}
+
+void DynamicAABBTree::refit(uint32_t index) {
+    BVHNode& node = nodes[index];
+    combine(node, nodes[node.left], nodes[node.right]);
+    heights[index] = 1 + std::max(heights[node.left], heights[node.right]);
+}
+
+void DynamicAABBTree::insertLeaf(uint32_t leaf) {
+    if (root == BVH::INVALID_NODE) {
+        root = leaf;
+        parents[leaf] = BVH::INVALID_NODE;
+        return;
+    }
+
+    // Walk down towards the cheapest sibling. Pairing with a node costs the area of the new parent, and every ancestor
+    // on the way grows by what the leaf adds to it
+    const BVHNode& leafNode = nodes[leaf];
+    uint32_t index = root;
+    while (!nodes[index].isLeaf()) {
+        const BVHNode& node = nodes[index];
+        float area = BVH::area(node.min, node.max);
+        float combinedArea = BVH::area(glm::min(node.min, leafNode.min), glm::max(node.max, leafNode.max));
+        float cost = 2.0f * combinedArea;
+        float inheritanceCost = 2.0f * (combinedArea - area);
+
+        auto descendCost = [&](uint32_t child) {
+            const BVHNode& childNode = nodes[child];
+            float grown = BVH::area(glm::min(childNode.min, leafNode.min), glm::max(childNode.max, leafNode.max));
+            return childNode.isLeaf() ? grown + inheritanceCost : grown - BVH::area(childNode.min, childNode.max) + inheritanceCost;
+        };
+        float leftCost = descendCost(node.left);
+        float rightCost = descendCost(node.right);
+
+        if (cost < leftCost && cost < rightCost) {
+            break;
+        }
+        index = leftCost < rightCost ? node.left : node.right;
+    }
+
+    uint32_t sibling = index;
+    uint32_t oldParent = parents[sibling];
+    uint32_t newParent = allocateNode();
+    parents[newParent] = oldParent;
+    nodes[newParent].setInterior(sibling, leaf);
+    combine(nodes[newParent], nodes[sibling], nodes[leaf]);
+    heights[newParent] = heights[sibling] + 1;
+
+    if (oldParent != BVH::INVALID_NODE) {
+        if (nodes[oldParent].left == sibling) {
+            nodes[oldParent].left = newParent;
+        }
+        else {
+            nodes[oldParent].right = newParent;
+        }
+    }
+    else {
+        root = newParent;
+    }
+    parents[sibling] = newParent;
+    parents[leaf] = newParent;
+
+    for (index = parents[leaf]; index != BVH::INVALID_NODE; index = parents[index]) {
+        index = balance(index);
+        refit(index);
+        rotate(index);
+    }
+}
+
+void DynamicAABBTree::removeLeaf(uint32_t leaf) {
+    if (leaf == root) {
+        root = BVH::INVALID_NODE;
+        return;
+    }
+
+    uint32_t parent = parents[leaf];
+    uint32_t grandParent = parents[parent];
+    uint32_t sibling = nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+
+    // The sibling takes the place of the parent
+    if (grandParent != BVH::INVALID_NODE) {
+        if (nodes[grandParent].left == parent) {
+            nodes[grandParent].left = sibling;
+        }
+        else {
+            nodes[grandParent].right = sibling;
+        }
+        parents[sibling] = grandParent;
+        freeNode(parent);
+
+        for (uint32_t index = grandParent; index != BVH::INVALID_NODE; index = parents[index]) {
+            index = balance(index);
+            refit(index);
+            rotate(index);
+        }
+    }
+    else {
+        root = sibling;
+        parents[sibling] = BVH::INVALID_NODE;
+        freeNode(parent);
+    }
+}
+
+uint32_t DynamicAABBTree::balance(uint32_t indexA) {
+    if (nodes[indexA].isLeaf() || heights[indexA] < 2) {
+        return indexA;
+    }
+
+    uint32_t indexB = nodes[indexA].left;
+    uint32_t indexC = nodes[indexA].right;
+    int32_t difference = heights[indexC] - heights[indexB];
+
+    // upper is the taller child, it becomes the parent of A. Of its children the taller stays with it and the other
+    // moves over to A, in the place upper left
+    auto rotateUp = [&](uint32_t upper, bool upperIsRight) {
+        uint32_t indexF = nodes[upper].left;
+        uint32_t indexG = nodes[upper].right;
+
+        nodes[upper].left = indexA;
+        parents[upper] = parents[indexA];
+        parents[indexA] = upper;
+
+        uint32_t oldParent = parents[upper];
+        if (oldParent != BVH::INVALID_NODE) {
+            if (nodes[oldParent].left == indexA) {
+                nodes[oldParent].left = upper;
+            }
+            else {
+                nodes[oldParent].right = upper;
+            }
+        }
+        else {
+            root = upper;
+        }
+
+        uint32_t keep = heights[indexF] > heights[indexG] ? indexF : indexG;
+        uint32_t give = keep == indexF ? indexG : indexF;
+        nodes[upper].right = keep;
+        if (upperIsRight) {
+            nodes[indexA].right = give;
+        }
+        else {
+            nodes[indexA].left = give;
+        }
+        parents[give] = indexA;
+
+        refit(indexA);
+        refit(upper);
+        return upper;
+    };
+
+    if (difference > 1) {
+        return rotateUp(indexC, true);
+    }
+    if (difference < -1) {
+        return rotateUp(indexB, false);
+    }
+    return indexA;
+}
+
+void DynamicAABBTree::rotate(uint32_t indexA) {
+    if (heights[indexA] < 2) {
+        return;
+    }
+
+    // Swapping a child of A with a grandchild under the other child keeps the bounds of A and changes only the other
+    // child, so the best swap is the one that shrinks that child the most
+    uint32_t children[2] = { nodes[indexA].left, nodes[indexA].right };
+    float bestGain = 0.0f;
+    uint32_t bestChild = BVH::INVALID_NODE;
+    uint32_t bestGrandchild = BVH::INVALID_NODE;
+    for (int side = 0; side < 2; side++) {
+        uint32_t moved = children[side];
+        uint32_t other = children[1 - side];
+        if (nodes[other].isLeaf()) {
+            continue;
+        }
+        float otherArea = BVH::area(nodes[other].min, nodes[other].max);
+        uint32_t grandchildren[2] = { nodes[other].left, nodes[other].right };
+        for (int g = 0; g < 2; g++) {
+            uint32_t swapped = grandchildren[g];
+            uint32_t kept = grandchildren[1 - g];
+
+            // Only swaps that keep both subtrees within one level of each other, the balance the rotations above keep
+            int32_t otherHeight = 1 + std::max(heights[kept], heights[moved]);
+            if (std::abs(heights[kept] - heights[moved]) > 1 || std::abs(otherHeight - heights[swapped]) > 1) {
+                continue;
+            }
+            float gain = otherArea - BVH::area(glm::min(nodes[kept].min, nodes[moved].min), glm::max(nodes[kept].max, nodes[moved].max));
+            if (gain > bestGain) {
+                bestGain = gain;
+                bestChild = moved;
+                bestGrandchild = swapped;
+            }
+        }
+    }
+    if (bestChild == BVH::INVALID_NODE) {
+        return;
+    }
+
+    uint32_t other = parents[bestGrandchild];
+    if (nodes[indexA].left == bestChild) {
+        nodes[indexA].left = bestGrandchild;
+    }
+    else {
+        nodes[indexA].right = bestGrandchild;
+    }
+    if (nodes[other].left == bestGrandchild) {
+        nodes[other].left = bestChild;
+    }
+    else {
+        nodes[other].right = bestChild;
+    }
+    parents[bestGrandchild] = indexA;
+    parents[bestChild] = other;
+
+    refit(other);
+    refit(indexA);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+PROXIES
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+DynamicAABBTree::ProxyId DynamicAABBTree::insert(const glm::vec3& boxMin, const glm::vec3& boxMax, uint32_t item) {
+    uint32_t leaf = allocateNode();
+    nodes[leaf].setLeaf(leaf, 1);
+    items[leaf] = item;
+    nodes[leaf].min = boxMin - glm::vec3(margin);
+    nodes[leaf].max = boxMax + glm::vec3(margin);
+    tightMin[leaf] = boxMin;
+    tightMax[leaf] = boxMax;
+    insertLeaf(leaf);
+    proxyCount++;
+    return leaf;
+}
+
+void DynamicAABBTree::remove(ProxyId proxy) {
+    if (proxy >= nodes.size() || heights[proxy] != 0) {
+        throw std::runtime_error("removing a proxy that is not in the tree");
+    }
+    removeLeaf(proxy);
+    freeNode(proxy);
+    proxyCount--;
+}
+
+bool DynamicAABBTree::move(ProxyId proxy, const glm::vec3& boxMin, const glm::vec3& boxMax, const glm::vec3& displacement) {
+    tightMin[proxy] = boxMin;
+    tightMax[proxy] = boxMax;
+
+    // Still inside the fat box, and the fat box not grown far past the object by an earlier fast move
+    BVHNode& leaf = nodes[proxy];
+    bool contained = glm::all(glm::lessThanEqual(leaf.min, boxMin)) && glm::all(glm::greaterThanEqual(leaf.max, boxMax));
+    if (contained) {
+        glm::vec3 hugeMin = boxMin - glm::vec3(4.0f * margin) - glm::abs(displacement) * DISPLACEMENT_MULTIPLIER;
+        glm::vec3 hugeMax = boxMax + glm::vec3(4.0f * margin) + glm::abs(displacement) * DISPLACEMENT_MULTIPLIER;
+        if (glm::all(glm::lessThanEqual(hugeMin, leaf.min)) && glm::all(glm::greaterThanEqual(hugeMax, leaf.max))) {
+            return false;
+        }
+    }
+
+    removeLeaf(proxy);
+
+    glm::vec3 fatMin = boxMin - glm::vec3(margin);
+    glm::vec3 fatMax = boxMax + glm::vec3(margin);
+    glm::vec3 predicted = displacement * DISPLACEMENT_MULTIPLIER;
+    for (int axis = 0; axis < 3; axis++) {
+        if (predicted[axis] < 0.0f) {
+            fatMin[axis] += predicted[axis];
+        }
+        else {
+            fatMax[axis] += predicted[axis];
+        }
+    }
+    nodes[proxy].min = fatMin;
+    nodes[proxy].max = fatMax;
+
+    insertLeaf(proxy);
+    return true;
+}
+
+float DynamicAABBTree::sahCost() const {
+    if (root == BVH::INVALID_NODE) {
+        return 0.0f;
+    }
+    float total = 0.0f;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (heights[i] >= 0) {
+            total += BVH::area(nodes[i].min, nodes[i].max);
+        }
+    }
+    return total / BVH::area(nodes[root].min, nodes[root].max);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+QUERIES
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Batched queries go over the job system in runs of this many
+static const size_t QUERY_BATCH = 64;
+
+static void forEachQuery(size_t count, JobSystem* jobs, const std::function<void(size_t begin, size_t end)>& fn) {
+    if (jobs && count > QUERY_BATCH) {
+        jobs->parallelFor(count, QUERY_BATCH, fn);
+    }
+    else {
+        fn(0, count);
+    }
+}
+
+RayHit DynamicAABBTree::raycast(const Ray& ray, const RayItemTest& test) const {
+    RayHit hit;
+    BVH::RaySSE prepared = BVH::prepareRay(ray);
+    BVH::traverseRay(nodes.data(), root, ray, [&](uint32_t leaf, uint32_t, float tMax) {
+        float t = BVH::intersectRay(tightMin[leaf], tightMax[leaf], prepared, tMax);
+        if (t != FLT_MAX && test) {
+            t = test(items[leaf], ray, tMax);
+        }
+        if (t < tMax) {
+            hit.item = items[leaf];
+            hit.t = t;
+            return t;
+        }
+        return tMax;
+    });
+    return hit;
+}
+
+void DynamicAABBTree::raycast(const Ray* rays, size_t count, RayHit* hits, JobSystem* jobs, const RayItemTest& test) const {
+    forEachQuery(count, jobs, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            hits[i] = raycast(rays[i], test);
+        }
+    });
+}
+
+void DynamicAABBTree::queryFrustum(const Frustum* frustums, size_t count, std::vector<uint32_t>* results, JobSystem* jobs) const {
+    forEachQuery(count, jobs, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const Frustum& frustum = frustums[i];
+            std::vector<uint32_t>& result = results[i];
+            result.clear();
+            BVH::traverseFrustum(nodes.data(), root, frustum, [&](uint32_t leaf, uint32_t, bool inside) {
+                // A fat box inside the frustum has the tight one inside as well, otherwise the tight box decides
+                if (inside || frustum.intersectsBox((tightMin[leaf] + tightMax[leaf]) * 0.5f, (tightMax[leaf] - tightMin[leaf]) * 0.5f)) {
+                    result.push_back(items[leaf]);
+                }
+            });
+        }
+    });
+}
+
+void DynamicAABBTree::queryOverlap(const glm::vec3* boxMins, const glm::vec3* boxMaxs, size_t count, std::vector<uint32_t>* results, JobSystem* jobs) const {
+    forEachQuery(count, jobs, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const glm::vec3& boxMin = boxMins[i];
+            const glm::vec3& boxMax = boxMaxs[i];
+            std::vector<uint32_t>& result = results[i];
+            result.clear();
+            BVH::traverseOverlap(nodes.data(), root, boxMin, boxMax, [&](uint32_t leaf, uint32_t) {
+                if (glm::all(glm::lessThanEqual(tightMin[leaf], boxMax)) && glm::all(glm::greaterThanEqual(tightMax[leaf], boxMin))) {
+                    result.push_back(items[leaf]);
+                }
+            });
+        }
+    });
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+BENCHMARK
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void DynamicAABBTree::runBenchmark() {
+    const size_t boxCount = 100000;
+    const size_t rayCount = 100000;
+    const size_t frustumCount = 64;
+    const size_t overlapCount = 10000;
+    const size_t checkedQueries = 200;
+    const int frames = 21;
+    const float worldSize = 1000.0f;
+
+    auto now = []() { return std::chrono::high_resolution_clock::now(); };
+    auto elapsedMs = [](std::chrono::high_resolution_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    };
+    auto median = [](std::vector<double>& times) {
+        std::sort(times.begin(), times.end());
+        return times[times.size() / 2];
+    };
+
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> position(0.0f, worldSize);
+    std::uniform_real_distribution<float> size(0.5f, 4.0f);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+    std::vector<glm::vec3> boxMins(boxCount), boxMaxs(boxCount), velocities(boxCount);
+    for (size_t i = 0; i < boxCount; i++) {
+        boxMins[i] = glm::vec3(position(random), position(random), position(random));
+        boxMaxs[i] = boxMins[i] + glm::vec3(size(random), size(random), size(random));
+        velocities[i] = glm::vec3(unit(random), unit(random), unit(random)) * 0.05f;
+    }
+
+    JobSystem jobs;
+    DynamicAABBTree tree(0.1f);
+    std::vector<ProxyId> proxies(boxCount);
+    auto start = now();
+    for (size_t i = 0; i < boxCount; i++) {
+        proxies[i] = tree.insert(boxMins[i], boxMaxs[i], static_cast<uint32_t>(i));
+    }
+    double insertMs = elapsedMs(start);
+
+    StaticBVH bvh;
+    start = now();
+    bvh.build(boxMins.data(), boxMaxs.data(), boxCount, 1);
+    double buildMs = elapsedMs(start);
+
+    printf("%zu boxes, %u threads \n", boxCount, jobs.threadCount());
+    printf("    insert      %8.1f ns/box, height %u, SAH cost %.1f \n", insertMs * 1e6 / boxCount, tree.getHeight(), tree.sahCost());
+    printf("    static BVH  %8.1f ns/box to build, SAH cost %.1f \n", buildMs * 1e6 / boxCount, bvh.sahCost());
+
+    // Every box drifts a little each frame, most stay inside their fat box
+    std::vector<double> moveTimes;
+    size_t reinserted = 0;
+    for (int frame = 0; frame < frames; frame++) {
+        start = now();
+        for (size_t i = 0; i < boxCount; i++) {
+            boxMins[i] += velocities[i];
+            boxMaxs[i] += velocities[i];
+            reinserted += tree.move(proxies[i], boxMins[i], boxMaxs[i], velocities[i]) ? 1 : 0;
+        }
+        moveTimes.push_back(elapsedMs(start));
+    }
+    printf("    move        %8.1f ns/box, %.1f%% reinserted, height %u, SAH cost %.1f \n", median(moveTimes) * 1e6 / boxCount,
+        100.0 * reinserted / (double(boxCount) * frames), tree.getHeight(), tree.sahCost());
+
+    // Churn a tenth of the boxes
+    std::uniform_int_distribution<size_t> pick(0, boxCount - 1);
+    std::vector<size_t> churned;
+    for (size_t i = 0; i < boxCount / 10; i++) {
+        churned.push_back(pick(random));
+    }
+    std::sort(churned.begin(), churned.end());
+    churned.erase(std::unique(churned.begin(), churned.end()), churned.end());
+    start = now();
+    for (size_t i : churned) {
+        tree.remove(proxies[i]);
+    }
+    double removeMs = elapsedMs(start);
+    start = now();
+    for (size_t i : churned) {
+        proxies[i] = tree.insert(boxMins[i], boxMaxs[i], static_cast<uint32_t>(i));
+    }
+    double reinsertMs = elapsedMs(start);
+    printf("    remove      %8.1f ns/box, reinsert %.1f ns/box \n", removeMs * 1e6 / churned.size(), reinsertMs * 1e6 / churned.size());
+    bvh.build(boxMins.data(), boxMaxs.data(), boxCount, 1);
+
+    bool correct = true;
+
+    // Rays from anywhere in the world in any direction, up to 200 units long
+    std::vector<Ray> rays(rayCount);
+    for (Ray& ray : rays) {
+        ray.origin = glm::vec3(position(random), position(random), position(random));
+        ray.direction = glm::normalize(glm::vec3(unit(random), unit(random), unit(random)) + glm::vec3(0.0f, 0.0f, 1e-4f));
+        ray.tMax = 200.0f;
+    }
+    std::vector<RayHit> hits(rayCount);
+    for (size_t r = 0; r < checkedQueries; r++) {
+        RayHit reference;
+        BVH::RaySSE prepared = BVH::prepareRay(rays[r]);
+        for (size_t i = 0; i < boxCount; i++) {
+            float t = BVH::intersectRay(boxMins[i], boxMaxs[i], prepared, reference.t < rays[r].tMax ? reference.t : rays[r].tMax);
+            if (t < reference.t) {
+                reference.t = t;
+                reference.item = static_cast<uint32_t>(i);
+            }
+        }
+        RayHit hit = tree.raycast(rays[r]);
+        if (hit.t != reference.t) {
+            correct = false;
+        }
+    }
+
+    for (JobSystem* jobSystem : { static_cast<JobSystem*>(nullptr), &jobs }) {
+        start = now();
+        tree.raycast(rays.data(), rayCount, hits.data(), jobSystem);
+        double rayMs = elapsedMs(start);
+        size_t hitCount = std::count_if(hits.begin(), hits.end(), [](const RayHit& hit) { return hit.item != UINT32_MAX; });
+        printf("    rays        %8.1f ns/ray, %s, %zu of %zu hit \n", rayMs * 1e6 / rayCount, jobSystem ? "parallel" : "1 thread", hitCount, rayCount);
+    }
+
+    start = now();
+    size_t staticHits = 0;
+    for (const Ray& ray : rays) {
+        BVH::RaySSE prepared = BVH::prepareRay(ray);
+        RayHit hit;
+        BVH::traverseRay(bvh.nodes.data(), bvh.getRoot(), ray, [&](uint32_t first, uint32_t count, float tMax) {
+            for (uint32_t i = first; i < first + count; i++) {
+                uint32_t primitive = bvh.primitives[i];
+                float t = BVH::intersectRay(boxMins[primitive], boxMaxs[primitive], prepared, tMax);
+                if (t < tMax) {
+                    tMax = t;
+                    hit.item = primitive;
+                    hit.t = t;
+                }
+            }
+            return tMax;
+        });
+        staticHits += hit.item != UINT32_MAX ? 1 : 0;
+    }
+    printf("    rays        %8.1f ns/ray, static BVH, 1 thread, %zu hit \n", elapsedMs(start) * 1e6 / rayCount, staticHits);
+
+    // 90 degree frustums looking 200 units ahead from random points
+    std::vector<Frustum> frustums(frustumCount);
+    glm::mat4 projection(0.0f);
+    float nearPlane = 0.1f;
+    float farPlane = 200.0f;
+    projection[0][0] = 1.0f;
+    projection[1][1] = 1.0f;
+    projection[2][2] = farPlane / (nearPlane - farPlane);
+    projection[2][3] = -1.0f;
+    projection[3][2] = -(farPlane * nearPlane) / (farPlane - nearPlane);
+    for (Frustum& frustum : frustums) {
+        glm::vec3 eye(position(random), position(random), position(random));
+        glm::vec3 forward = glm::normalize(glm::vec3(unit(random), unit(random), unit(random)) + glm::vec3(0.0f, 0.0f, 1e-4f));
+        glm::vec3 side = glm::normalize(glm::cross(forward, glm::vec3(0.0f, 1.0f, 0.0f)));
+        glm::vec3 up = glm::cross(side, forward);
+        glm::mat4 view(1.0f);
+        view[0] = glm::vec4(side.x, up.x, -forward.x, 0.0f);
+        view[1] = glm::vec4(side.y, up.y, -forward.y, 0.0f);
+        view[2] = glm::vec4(side.z, up.z, -forward.z, 0.0f);
+        view[3] = glm::vec4(-glm::dot(side, eye), -glm::dot(up, eye), glm::dot(forward, eye), 1.0f);
+        frustum = Frustum(projection * view);
+    }
+
+    std::vector<std::vector<uint32_t>> frustumResults(frustumCount);
+    start = now();
+    tree.queryFrustum(frustums.data(), frustumCount, frustumResults.data());
+    double frustumMs = elapsedMs(start);
+
+    start = now();
+    size_t frustumItems = 0;
+    for (size_t f = 0; f < frustumCount; f++) {
+        std::vector<uint32_t> reference;
+        for (size_t i = 0; i < boxCount; i++) {
+            if (frustums[f].intersectsBox((boxMins[i] + boxMaxs[i]) * 0.5f, (boxMaxs[i] - boxMins[i]) * 0.5f)) {
+                reference.push_back(static_cast<uint32_t>(i));
+            }
+        }
+        std::vector<uint32_t> result = frustumResults[f];
+        std::sort(result.begin(), result.end());
+        correct = correct && result == reference;
+        frustumItems += reference.size();
+    }
+    double bruteFrustumMs = elapsedMs(start);
+    printf("    frustum     %8.1f us/query, %zu items each, brute force %.1f us/query \n", frustumMs * 1e3 / frustumCount,
+        frustumItems / frustumCount, bruteFrustumMs * 1e3 / frustumCount);
+
+    // Boxes of 10 units, the size of a gameplay range query
+    std::vector<glm::vec3> queryMins(overlapCount), queryMaxs(overlapCount);
+    for (size_t i = 0; i < overlapCount; i++) {
+        queryMins[i] = glm::vec3(position(random), position(random), position(random));
+        queryMaxs[i] = queryMins[i] + glm::vec3(10.0f);
+    }
+    std::vector<std::vector<uint32_t>> overlapResults(overlapCount);
+    for (JobSystem* jobSystem : { static_cast<JobSystem*>(nullptr), &jobs }) {
+        start = now();
+        tree.queryOverlap(queryMins.data(), queryMaxs.data(), overlapCount, overlapResults.data(), jobSystem);
+        double overlapMs = elapsedMs(start);
+        size_t overlapItems = 0;
+        for (const std::vector<uint32_t>& result : overlapResults) {
+            overlapItems += result.size();
+        }
+        printf("    overlap     %8.1f ns/query, %s, %.2f items each \n", overlapMs * 1e6 / overlapCount, jobSystem ? "parallel" : "1 thread",
+            double(overlapItems) / overlapCount);
+    }
+    for (size_t q = 0; q < checkedQueries; q++) {
+        std::vector<uint32_t> reference;
+        for (size_t i = 0; i < boxCount; i++) {
+            if (glm::all(glm::lessThanEqual(boxMins[i], queryMaxs[q])) && glm::all(glm::greaterThanEqual(boxMaxs[i], queryMins[q]))) {
+                reference.push_back(static_cast<uint32_t>(i));
+            }
+        }
+        std::vector<uint32_t> result = overlapResults[q];
+        std::sort(result.begin(), result.end());
+        correct = correct && result == reference;
+    }
+
+    printf("    %s \n", correct ? "queries match brute force" : "queries DIFFER from brute force");
+}
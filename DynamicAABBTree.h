@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "glm-0.9.6.3/glm.hpp"
+#include "BVH.h"
+#include "Frustum.h"
+
+class JobSystem;
+
+// Incrementally updated bounding volume tree over moving boxes. Leaves hold the box grown by a margin, so small moves
+// stay inside it and cost nothing, and inserts pick the sibling with the least added surface area. Rotations on the
+// way back up keep it balanced and tight. Nodes use the BVHNode layout and the BVH traversal, a leaf's one primitive is its own
+// index, which the item and the tight bounds are looked up by
+class DynamicAABBTree {
+
+public:
+	using ProxyId = uint32_t;
+	static const ProxyId INVALID_PROXY = BVH::INVALID_NODE;
+
+	// Exact test of an item the ray reached the box of, returns the hit distance or FLT_MAX
+	using RayItemTest = std::function<float(uint32_t item, const Ray& ray, float tMax)>;
+
+	explicit DynamicAABBTree(float margin = 0.1f);
+
+	// Add a box for item, the returned proxy stays valid until it is removed
+	ProxyId insert(const glm::vec3& boxMin, const glm::vec3& boxMax, uint32_t item);
+	void remove(ProxyId proxy);
+	// New bounds for a proxy, displacement is how far it moved this update and stretches the fat box along the motion.
+	// Returns true when it left its fat box and was reinserted
+	bool move(ProxyId proxy, const glm::vec3& boxMin, const glm::vec3& boxMax, const glm::vec3& displacement = glm::vec3(0.0f));
+
+	uint32_t getItem(ProxyId proxy) const { return items[proxy]; }
+	const BVHNode& getFatBounds(ProxyId proxy) const { return nodes[proxy]; }
+
+	// Closest item hit by each ray, items are hit where the ray enters their box unless test says otherwise.
+	// Rays are spread over the job system when one is given
+	void raycast(const Ray* rays, size_t count, RayHit* hits, JobSystem* jobs = nullptr, const RayItemTest& test = nullptr) const;
+	RayHit raycast(const Ray& ray, const RayItemTest& test = nullptr) const;
+
+	// Items whose box touches each frustum, results has one list per frustum
+	void queryFrustum(const Frustum* frustums, size_t count, std::vector<uint32_t>* results, JobSystem* jobs = nullptr) const;
+	void queryFrustum(const Frustum& frustum, std::vector<uint32_t>& result) const { queryFrustum(&frustum, 1, &result); }
+
+	// Items whose box overlaps each query box, results has one list per box
+	void queryOverlap(const glm::vec3* boxMins, const glm::vec3* boxMaxs, size_t count, std::vector<uint32_t>* results, JobSystem* jobs = nullptr) const;
+	void queryOverlap(const glm::vec3& boxMin, const glm::vec3& boxMax, std::vector<uint32_t>& result) const { queryOverlap(&boxMin, &boxMax, 1, &result); }
+
+	size_t size() const { return proxyCount; }
+	uint32_t getHeight() const { return root == BVH::INVALID_NODE ? 0 : static_cast<uint32_t>(heights[root]); }
+	// Sum of node areas relative to the root, the same measure as StaticBVH::sahCost
+	float sahCost() const;
+
+	// Insert, move and remove throughput and ray, frustum and overlap query latency at 100k boxes, against brute force
+	// and a StaticBVH built over the same boxes
+	static void runBenchmark();
+
+private:
+	uint32_t allocateNode();
+	void freeNode(uint32_t index);
+	void insertLeaf(uint32_t leaf);
+	void removeLeaf(uint32_t leaf);
+	// Rotate the taller grandchild up when the children heights differ by more than one, returns the new subtree root
+	uint32_t balance(uint32_t index);
+	// Swap a child with a grandchild on the other side when that shrinks the other child, keeps the tree tight as
+	// boxes come and go in any order
+	void rotate(uint32_t index);
+	void refit(uint32_t index);
+
+	float margin;
+
+	// Indexed by node, leaves never move so their index doubles as the proxy id
+	std::vector<BVHNode> nodes;
+	// Parent of every node, the next free node for nodes on the free list
+	std::vector<uint32_t> parents;
+	// 0 for leaves, -1 for free nodes
+	std::vector<int32_t> heights;
+	// Bounds of leaves before the margin, what queries report against
+	std::vector<glm::vec3> tightMin;
+	std::vector<glm::vec3> tightMax;
+	std::vector<uint32_t> items;
+
+	uint32_t root = BVH::INVALID_NODE;
+	uint32_t freeList = BVH::INVALID_NODE;
+	size_t proxyCount = 0;
+};
@@ -0,0 +1,151 @@
+#include "DynamicResolution.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <deque>
+#include <random>
+#include <utility>
+
+DynamicResolution::DynamicResolution() : DynamicResolution(Settings()) {
+}
+
+DynamicResolution::DynamicResolution(const Settings& settings) : settings(settings), scale(settings.maxScale) {
+    samples.reserve(settings.settleFrames);
+    sorted.reserve(settings.settleFrames);
+}
+
+void DynamicResolution::setSettings(const Settings& newSettings) {
+    settings = newSettings;
+    setScale(scale);
+}
+
+void DynamicResolution::setScale(float newScale) {
+    scale = snap(newScale);
+    samples.clear();
+    nextSample = 0;
+    framesUnderBudget = 0;
+}
+
+float DynamicResolution::snap(float value) const {
+    // Rounded down, a predicted scale is only ever met or undershot
+    float snapped = std::floor(value / settings.scaleStep + 1e-4f) * settings.scaleStep;
+    return std::min(settings.maxScale, std::max(settings.minScale, snapped));
+}
+
+uint32_t DynamicResolution::scaledSize(uint32_t fullSize) const {
+    return std::max(1u, static_cast<uint32_t>(std::lround(fullSize * scale)));
+}
+
+bool DynamicResolution::addFrameTime(float gpuMs, float frameScale) {
+    if (frameScale != scale) {
+        return false;
+    }
+    if (samples.size() < settings.settleFrames) {
+        samples.push_back(gpuMs);
+    }
+    else {
+        samples[nextSample] = gpuMs;
+    }
+    nextSample = (nextSample + 1) % settings.settleFrames;
+    if (samples.size() < settings.settleFrames) {
+        return false;
+    }
+
+    // The median ignores a single slow or fast frame
+    sorted.assign(samples.begin(), samples.end());
+    std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+    float estimate = std::max(sorted[sorted.size() / 2], 1e-3f);
+
+    // Scale that would bring the estimate down to the lowered budget
+    float budget = settings.targetMs * settings.headroom;
+    float predicted = scale * std::sqrt(budget / estimate);
+
+    float newScale = scale;
+    if (estimate > settings.targetMs) {
+        newScale = snap(predicted);
+        framesUnderBudget = 0;
+    }
+    else if (snap(std::min(predicted, scale + settings.maxRaise)) > scale) {
+        // Only a run of frames with room for a whole step raises it, between the two budgets it holds
+        if (++framesUnderBudget >= settings.raiseFrames) {
+            newScale = snap(std::min(predicted, scale + settings.maxRaise));
+        }
+    }
+    else {
+        framesUnderBudget = 0;
+    }
+
+    if (newScale == scale) {
+        return false;
+    }
+    setScale(newScale);
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+BENCHMARK
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void DynamicResolution::runBenchmark() {
+    const int frames = 6000;
+    // Timestamps are read back once the image is reused, a few frames after it was rendered
+    const size_t readbackLatency = 2;
+    const float fixedMs = 1.5f;
+    const float fullResolutionMs = 22.0f;
+
+    Settings settings;
+    printf("Target %.1f ms, %d frames, timestamps %zu frames late, GPU time %.1f ms + up to %.1f ms at full resolution \n",
+        settings.targetMs, frames, readbackLatency, fixedMs, fullResolutionMs * 1.4f);
+
+    // Slow swings in scene cost, occasional heavy stretches and per frame noise, the same sequence for every run
+    std::vector<float> load(frames);
+    std::mt19937 random(77);
+    std::normal_distribution<float> noise(1.0f, 0.04f);
+    std::uniform_int_distribution<int> spikeStart(0, 400);
+    int spikeEnd = -1;
+    for (int frame = 0; frame < frames; frame++) {
+        if (spikeStart(random) == 0) {
+            spikeEnd = frame + 40;
+        }
+        float swing = 0.65f + 0.3f * std::sin(frame * 6.2831853f / 1500.0f);
+        load[frame] = (swing + (frame < spikeEnd ? 0.45f : 0.0f)) * noise(random);
+    }
+
+    for (bool dynamic : { false, true }) {
+        DynamicResolution controller(settings);
+        std::deque<std::pair<float, float>> pending;
+        std::vector<float> times(frames);
+        double scaleSum = 0.0;
+        float lowestScale = 1.0f;
+        int overBudget = 0;
+        int changes = 0;
+        for (int frame = 0; frame < frames; frame++) {
+            float frameScale = controller.getScale();
+            float gpuMs = fixedMs + fullResolutionMs * load[frame] * frameScale * frameScale;
+            times[frame] = gpuMs;
+            scaleSum += frameScale;
+            lowestScale = std::min(lowestScale, frameScale);
+            overBudget += gpuMs > settings.targetMs;
+
+            pending.push_back({ gpuMs, frameScale });
+            if (pending.size() > readbackLatency) {
+                if (dynamic && controller.addFrameTime(pending.front().first, pending.front().second)) {
+                    changes++;
+                }
+                pending.pop_front();
+            }
+        }
+
+        std::sort(times.begin(), times.end());
+        double averageMs = 0.0;
+        for (float time : times) {
+            averageMs += time;
+        }
+        averageMs /= frames;
+        printf("    %-8s over budget %5.1f %%, average %5.2f ms, p99 %5.2f ms, scale average %.2f lowest %.2f, %d scale changes \n",
+            dynamic ? "dynamic" : "fixed", 100.0 * overBudget / frames, averageMs, times[frames * 99 / 100],
+            scaleSum / frames, lowestScale, changes);
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Picks the fraction of the output resolution to render at from measured GPU frame times, so a frame stays inside
+// its budget. GPU time is taken to grow with the pixel count, the square of the scale, so one measurement is enough
+// to predict the scale that meets the budget. Scales are snapped to steps, dropping happens as soon as a frame is
+// over budget and raising waits for a run of frames comfortably under it, so the scale does not flicker
+class DynamicResolution {
+
+public:
+	struct Settings {
+		// Frame budget of the GPU work
+		float targetMs = 16.6f;
+		// Fraction of the budget aimed for, the rest absorbs frame to frame noise
+		float headroom = 0.9f;
+		float minScale = 0.5f;
+		float maxScale = 1.0f;
+		// Scales are multiples of this, each change re-records the command buffers
+		float scaleStep = 1.0f / 32.0f;
+		// Largest raise in one change, drops are not limited
+		float maxRaise = 0.1f;
+		// Frames measured at a new scale before it is judged, the median of them is what counts
+		uint32_t settleFrames = 4;
+		// Frames under the lowered budget it takes before the scale is raised
+		uint32_t raiseFrames = 30;
+	};
+
+	DynamicResolution();
+	explicit DynamicResolution(const Settings& settings);
+
+	// GPU time of a frame and the scale it was rendered at, frames still in flight from before a change are ignored.
+	// Returns true when the scale changed
+	bool addFrameTime(float gpuMs, float frameScale);
+
+	float getScale() const { return scale; }
+	void setScale(float newScale);
+	// Size of a full resolution side at the current scale, never 0
+	uint32_t scaledSize(uint32_t fullSize) const;
+
+	const Settings& getSettings() const { return settings; }
+	void setSettings(const Settings& newSettings);
+
+	// Simulated GPU load with slow swings and spikes, the frames over budget and the average scale against rendering
+	// at full resolution
+	static void runBenchmark();
+
+private:
+	float snap(float value) const;
+
+	Settings settings;
+	float scale;
+	// Times measured since the scale last changed, the last settleFrames of them
+	std::vector<float> samples;
+	std::vector<float> sorted;
+	size_t nextSample = 0;
+	uint32_t framesUnderBudget = 0;
+};
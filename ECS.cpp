@@ -0,0 +1,584 @@
+#include "ECS.h"
+#include "JobSystem.h"
+#include "glm-0.9.6.3/glm.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <new>
+#include <random>
+#include <stdexcept>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+COMPONENT REGISTRY
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static std::mutex registryMutex;
+
+// Reserved up front so it never reallocates, reads need no lock once an id has been handed out
+static std::vector<ECS::ComponentInfo>& componentRegistry() {
+    static std::vector<ECS::ComponentInfo> registry = []() {
+        std::vector<ECS::ComponentInfo> infos;
+        infos.reserve(ECS::MAX_COMPONENTS);
+        return infos;
+    }();
+    return registry;
+}
+
+ECS::ComponentId ECS::registerComponent(uint32_t size, uint32_t alignment, const char* name) {
+    std::lock_guard<std::mutex> lock(registryMutex);
+    std::vector<ComponentInfo>& registry = componentRegistry();
+    if (registry.size() == MAX_COMPONENTS) {
+        throw std::runtime_error("too many component types");
+    }
+    if (alignment > CACHE_LINE) {
+        throw std::runtime_error("component alignment above a cache line");
+    }
+    registry.push_back({ size, alignment, name });
+    return static_cast<ComponentId>(registry.size() - 1);
+}
+
+const ECS::ComponentInfo& ECS::getComponentInfo(ComponentId id) {
+    return componentRegistry()[id];
+}
+
+static uint32_t alignUp(uint32_t value, uint32_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+COMMAND BUFFER
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+Entity EntityCommandBuffer::createEntity() {
+    Entity placeholder{ createdCount++, PENDING_GENERATION };
+    commands.push_back({ Op::Create, placeholder, 0, 0 });
+    return placeholder;
+}
+
+void EntityCommandBuffer::destroyEntity(Entity entity) {
+    commands.push_back({ Op::Destroy, entity, 0, 0 });
+}
+
+void EntityCommandBuffer::record(Op op, Entity entity, ECS::ComponentId component, const void* value, size_t size) {
+    // Values are kept on cache line boundaries, so any component can be read back in place
+    uint32_t offset = alignUp(static_cast<uint32_t>(payload.size()), ECS::CACHE_LINE);
+    if (size > 0) {
+        payload.resize(offset + size);
+        std::memcpy(payload.data() + offset, value, size);
+    }
+    commands.push_back({ op, entity, component, offset });
+}
+
+void EntityCommandBuffer::clear() {
+    commands.clear();
+    payload.clear();
+    createdCount = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+WORLD
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+EntityWorld::EntityWorld() {}
+
+EntityWorld::~EntityWorld() {
+    for (auto& entry : archetypes) {
+        for (ECS::Chunk* chunk : entry.second->chunks) {
+            freeBlocks.push_back(chunk->data);
+            delete chunk;
+        }
+    }
+    for (uint8_t* block : freeBlocks) {
+        operator delete(block, std::align_val_t(ECS::CACHE_LINE));
+    }
+}
+
+void EntityWorld::checkNotIterating() const {
+    if (iterating) {
+        throw std::runtime_error("structural entity change during a query, record it in a command buffer");
+    }
+}
+
+size_t EntityWorld::chunkCount() const {
+    size_t count = 0;
+    for (const auto& entry : archetypes) {
+        count += entry.second->chunks.size();
+    }
+    return count;
+}
+
+ECS::Archetype* EntityWorld::getArchetype(const ECS::ComponentMask& mask) {
+    auto found = archetypes.find(mask);
+    if (found != archetypes.end()) {
+        return found->second.get();
+    }
+
+    std::unique_ptr<ECS::Archetype> archetype(new ECS::Archetype());
+    archetype->mask = mask;
+    std::fill(std::begin(archetype->slots), std::end(archetype->slots), int8_t(-1));
+
+    uint32_t bytesPerEntity = sizeof(Entity);
+    for (ECS::ComponentId id = 0; id < ECS::MAX_COMPONENTS; id++) {
+        if (mask.test(id)) {
+            archetype->slots[id] = static_cast<int8_t>(archetype->components.size());
+            archetype->components.push_back(id);
+            archetype->sizes.push_back(ECS::getComponentInfo(id).size);
+            bytesPerEntity += ECS::getComponentInfo(id).size;
+        }
+    }
+
+    // Start from the unpadded fit and shrink until the arrays still fit once each is rounded up to a cache line
+    auto layoutSize = [&](uint32_t capacity) {
+        uint32_t offset = capacity * static_cast<uint32_t>(sizeof(Entity));
+        for (ECS::ComponentId id : archetype->components) {
+            offset = alignUp(offset, ECS::CACHE_LINE) + capacity * ECS::getComponentInfo(id).size;
+        }
+        return offset;
+    };
+    uint32_t capacity = static_cast<uint32_t>(ECS::CHUNK_SIZE) / bytesPerEntity;
+    while (capacity > 0 && layoutSize(capacity) > ECS::CHUNK_SIZE) {
+        capacity--;
+    }
+    if (capacity == 0) {
+        throw std::runtime_error("components of one entity do not fit in a chunk");
+    }
+    archetype->capacity = capacity;
+
+    uint32_t offset = capacity * static_cast<uint32_t>(sizeof(Entity));
+    for (ECS::ComponentId id : archetype->components) {
+        offset = alignUp(offset, ECS::CACHE_LINE);
+        archetype->offsets.push_back(offset);
+        offset += capacity * ECS::getComponentInfo(id).size;
+    }
+
+    ECS::Archetype* result = archetype.get();
+    archetypes.emplace(mask, std::move(archetype));
+    return result;
+}
+
+void EntityWorld::stampChunk(ECS::Chunk* chunk) {
+    std::fill(chunk->versions.begin(), chunk->versions.end(), version);
+}
+
+ECS::Chunk* EntityWorld::allocateRow(ECS::Archetype* archetype, Entity entity, uint32_t& row) {
+    if (archetype->chunks.empty() || archetype->chunks.back()->count == archetype->capacity) {
+        ECS::Chunk* chunk = new ECS::Chunk();
+        chunk->archetype = archetype;
+        chunk->versions.resize(archetype->components.size(), version);
+        if (!freeBlocks.empty()) {
+            chunk->data = freeBlocks.back();
+            freeBlocks.pop_back();
+        }
+        else {
+            chunk->data = static_cast<uint8_t*>(operator new(ECS::CHUNK_SIZE, std::align_val_t(ECS::CACHE_LINE)));
+        }
+        archetype->chunks.push_back(chunk);
+    }
+
+    ECS::Chunk* chunk = archetype->chunks.back();
+    row = chunk->count++;
+    reinterpret_cast<Entity*>(chunk->data)[row] = entity;
+    stampChunk(chunk);
+    return chunk;
+}
+
+void EntityWorld::removeRow(ECS::Chunk* chunk, uint32_t row) {
+    ECS::Archetype* archetype = chunk->archetype;
+    ECS::Chunk* last = archetype->chunks.back();
+    uint32_t lastRow = last->count - 1;
+
+    if (chunk != last || row != lastRow) {
+        Entity moved = reinterpret_cast<Entity*>(last->data)[lastRow];
+        reinterpret_cast<Entity*>(chunk->data)[row] = moved;
+        for (size_t slot = 0; slot < archetype->components.size(); slot++) {
+            uint32_t size = archetype->sizes[slot];
+            std::memcpy(chunk->data + archetype->offsets[slot] + size_t(row) * size, last->data + archetype->offsets[slot] + size_t(lastRow) * size, size);
+        }
+        records[moved.index].chunk = chunk;
+        records[moved.index].row = row;
+        stampChunk(chunk);
+    }
+
+    if (--last->count == 0) {
+        freeBlocks.push_back(last->data);
+        archetype->chunks.pop_back();
+        delete last;
+    }
+}
+
+Entity EntityWorld::createInArchetype(ECS::Archetype* archetype) {
+    checkNotIterating();
+
+    Entity entity;
+    if (!freeIndices.empty()) {
+        entity.index = freeIndices.back();
+        freeIndices.pop_back();
+    }
+    else {
+        entity.index = static_cast<uint32_t>(records.size());
+        records.emplace_back();
+    }
+    entity.generation = records[entity.index].generation;
+
+    EntityRecord& record = records[entity.index];
+    record.chunk = allocateRow(archetype, entity, record.row);
+
+    // Components start zeroed until the caller writes them
+    for (size_t slot = 0; slot < archetype->components.size(); slot++) {
+        uint32_t size = archetype->sizes[slot];
+        std::memset(record.chunk->data + archetype->offsets[slot] + size_t(record.row) * size, 0, size);
+    }
+    return entity;
+}
+
+bool EntityWorld::isAlive(Entity entity) const {
+    return entity.index < records.size() && records[entity.index].chunk != nullptr && records[entity.index].generation == entity.generation;
+}
+
+void EntityWorld::destroyEntity(Entity entity) {
+    checkNotIterating();
+    if (!isAlive(entity)) {
+        return;
+    }
+
+    EntityRecord& record = records[entity.index];
+    removeRow(record.chunk, record.row);
+    record.chunk = nullptr;
+    record.generation++;
+    freeIndices.push_back(entity.index);
+}
+
+void* EntityWorld::componentData(Entity entity, ECS::ComponentId id) const {
+    if (!isAlive(entity)) {
+        return nullptr;
+    }
+    const EntityRecord& record = records[entity.index];
+    const ECS::Archetype* archetype = record.chunk->archetype;
+    int slot = archetype->slotOf(id);
+    if (slot < 0) {
+        return nullptr;
+    }
+    return record.chunk->data + archetype->offsets[slot] + size_t(record.row) * archetype->sizes[slot];
+}
+
+void* EntityWorld::writeComponentData(Entity entity, ECS::ComponentId id) {
+    void* data = componentData(entity, id);
+    if (data) {
+        const EntityRecord& record = records[entity.index];
+        record.chunk->versions[record.chunk->archetype->slotOf(id)] = version;
+    }
+    return data;
+}
+
+void EntityWorld::moveEntity(Entity entity, ECS::Archetype* target) {
+    EntityRecord& record = records[entity.index];
+    ECS::Chunk* source = record.chunk;
+    uint32_t sourceRow = record.row;
+    const ECS::Archetype* sourceArchetype = source->archetype;
+
+    uint32_t row;
+    ECS::Chunk* chunk = allocateRow(target, entity, row);
+
+    // Shared components are copied over, new ones start zeroed
+    for (size_t slot = 0; slot < target->components.size(); slot++) {
+        ECS::ComponentId id = target->components[slot];
+        uint32_t size = target->sizes[slot];
+        uint8_t* destination = chunk->data + target->offsets[slot] + size_t(row) * size;
+        int sourceSlot = sourceArchetype->slotOf(id);
+        if (sourceSlot >= 0) {
+            std::memcpy(destination, source->data + sourceArchetype->offsets[sourceSlot] + size_t(sourceRow) * size, size);
+        }
+        else {
+            std::memset(destination, 0, size);
+        }
+    }
+
+    removeRow(source, sourceRow);
+    record.chunk = chunk;
+    record.row = row;
+}
+
+void EntityWorld::addComponentData(Entity entity, ECS::ComponentId id, const void* value) {
+    checkNotIterating();
+    if (!isAlive(entity)) {
+        return;
+    }
+
+    const ECS::Archetype* archetype = records[entity.index].chunk->archetype;
+    if (!archetype->mask.test(id)) {
+        moveEntity(entity, getArchetype(ECS::ComponentMask(archetype->mask).set(id)));
+    }
+    std::memcpy(writeComponentData(entity, id), value, ECS::getComponentInfo(id).size);
+}
+
+void EntityWorld::removeComponentData(Entity entity, ECS::ComponentId id) {
+    checkNotIterating();
+    if (!isAlive(entity)) {
+        return;
+    }
+
+    const ECS::Archetype* archetype = records[entity.index].chunk->archetype;
+    if (archetype->mask.test(id)) {
+        moveEntity(entity, getArchetype(ECS::ComponentMask(archetype->mask).reset(id)));
+    }
+}
+
+void EntityWorld::forEachChunk(const EntityQuery& query, JobSystem* jobs, const std::function<void(ChunkView& chunk)>& fn) {
+    queryChunks.clear();
+    for (const auto& entry : archetypes) {
+        const ECS::Archetype* archetype = entry.second.get();
+        if ((archetype->mask & query.all) != query.all || (archetype->mask & query.none).any()) {
+            continue;
+        }
+
+        for (ECS::Chunk* chunk : archetype->chunks) {
+            // Chunks nobody wrote since the system last looked are skipped without touching their entities
+            if (query.changed.any()) {
+                bool changed = false;
+                for (size_t slot = 0; slot < archetype->components.size() && !changed; slot++) {
+                    changed = query.changed.test(archetype->components[slot]) && chunk->versions[slot] > query.changedSince;
+                }
+                if (!changed) {
+                    continue;
+                }
+            }
+            queryChunks.push_back(chunk);
+        }
+    }
+
+    iterating = true;
+    auto visit = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            ChunkView view(queryChunks[i], version);
+            fn(view);
+        }
+    };
+    try {
+        if (jobs) {
+            jobs->parallelFor(queryChunks.size(), 4, visit);
+        }
+        else {
+            visit(0, queryChunks.size());
+        }
+    }
+    catch (...) {
+        iterating = false;
+        throw;
+    }
+    iterating = false;
+}
+
+void EntityWorld::playback(EntityCommandBuffer& buffer) {
+    std::vector<Entity> created(buffer.createdCount);
+    auto resolve = [&](Entity entity) {
+        return entity.generation == EntityCommandBuffer::PENDING_GENERATION ? created[entity.index] : entity;
+    };
+
+    const std::vector<EntityCommandBuffer::Command>& commands = buffer.commands;
+    for (size_t i = 0; i < commands.size(); i++) {
+        const EntityCommandBuffer::Command& command = commands[i];
+        switch (command.op) {
+        case EntityCommandBuffer::Op::Create: {
+            // The adds right after a create go straight into the final archetype instead of moving it once per component
+            ECS::ComponentMask mask;
+            size_t end = i + 1;
+            while (end < commands.size() && commands[end].op == EntityCommandBuffer::Op::Add && commands[end].entity == command.entity) {
+                mask.set(commands[end].component);
+                end++;
+            }
+
+            Entity entity = createInArchetype(getArchetype(mask));
+            created[command.entity.index] = entity;
+            for (size_t add = i + 1; add < end; add++) {
+                std::memcpy(componentData(entity, commands[add].component), buffer.payload.data() + commands[add].payloadOffset,
+                    ECS::getComponentInfo(commands[add].component).size);
+            }
+            i = end - 1;
+            break;
+        }
+        case EntityCommandBuffer::Op::Destroy:
+            destroyEntity(resolve(command.entity));
+            break;
+        case EntityCommandBuffer::Op::Add:
+            addComponentData(resolve(command.entity), command.component, buffer.payload.data() + command.payloadOffset);
+            break;
+        case EntityCommandBuffer::Op::Remove:
+            removeComponentData(resolve(command.entity), command.component);
+            break;
+        }
+    }
+    buffer.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+BENCHMARK
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+    struct Position {
+        glm::vec3 value;
+    };
+
+    struct Velocity {
+        glm::vec3 value;
+    };
+
+    struct WorldMatrix {
+        glm::mat4 value;
+    };
+
+    struct MeshReference {
+        uint32_t model;
+    };
+
+    struct Dynamic {
+        uint8_t unused;
+    };
+
+    // What a flat object array would hold for each entity
+    struct ObjectStruct {
+        glm::vec3 position;
+        glm::vec3 velocity;
+        glm::mat4 world;
+        uint32_t model;
+        bool dynamic;
+    };
+}
+
+void EntityWorld::runBenchmark() {
+    const size_t entityCount = 1000000;
+    const int runs = 21;
+    const float dt = 1.0f / 60.0f;
+
+    auto median = [](std::vector<double>& times) {
+        std::sort(times.begin(), times.end());
+        return times[times.size() / 2];
+    };
+    auto since = [](std::chrono::high_resolution_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    };
+
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> value(-100.0f, 100.0f);
+
+    // Every entity has a position, mesh and matrix, every other one moves
+    EntityWorld world;
+    EntityCommandBuffer commands;
+    std::vector<ObjectStruct> objects(entityCount);
+    for (size_t i = 0; i < entityCount; i++) {
+        ObjectStruct& object = objects[i];
+        object.position = glm::vec3(value(random), value(random), value(random));
+        object.velocity = glm::vec3(value(random), value(random), value(random));
+        object.world = glm::mat4(1.0f);
+        object.model = static_cast<uint32_t>(i % 16);
+        object.dynamic = i % 2 == 0;
+
+        Entity entity = commands.createEntity();
+        commands.addComponent(entity, Position{ object.position });
+        commands.addComponent(entity, MeshReference{ object.model });
+        commands.addComponent(entity, WorldMatrix{ object.world });
+        if (object.dynamic) {
+            commands.addComponent(entity, Velocity{ object.velocity });
+            commands.addComponent(entity, Dynamic{});
+        }
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    world.playback(commands);
+    double spawnMs = since(start);
+
+    JobSystem jobs;
+    printf("%zu entities in %zu chunks of %zu KB, %zu archetypes, spawned from a command buffer in %.1f ms, %u threads \n", world.entityCount(),
+        world.chunkCount(), ECS::CHUNK_SIZE / 1024, world.archetypeCount(), spawnMs, jobs.threadCount());
+
+    // Integrate the moving entities: reads velocity, writes position, touches nothing else
+    EntityQuery moving = EntityQuery().with<Position, Velocity>();
+    size_t movingCount = entityCount / 2;
+    double bytesPerMoving = sizeof(Position) * 2 + sizeof(Velocity);
+
+    int steps = 0;
+    for (JobSystem* jobSystem : { static_cast<JobSystem*>(nullptr), &jobs }) {
+        std::vector<double> times;
+        for (int run = 0; run < runs; run++, steps++) {
+            world.advanceVersion();
+            start = std::chrono::high_resolution_clock::now();
+            world.forEachChunk(moving, jobSystem, [dt](ChunkView& chunk) {
+                Position* positions = chunk.write<Position>();
+                const Velocity* velocities = chunk.read<Velocity>();
+                for (uint32_t i = 0; i < chunk.size(); i++) {
+                    positions[i].value += velocities[i].value * dt;
+                }
+            });
+            times.push_back(since(start));
+        }
+        double ms = median(times);
+        printf("    ECS query    %-8s %7.3f ms  %5.2f ns/entity  %6.2f GB/s \n", jobSystem ? "parallel" : "1 thread", ms, ms * 1e6 / movingCount,
+            bytesPerMoving * movingCount / (ms * 1e6));
+    }
+
+    // The same update over an array of structs drags the matrix and the rest through the cache as well
+    {
+        std::vector<double> times;
+        for (int run = 0; run < steps; run++) {
+            start = std::chrono::high_resolution_clock::now();
+            for (ObjectStruct& object : objects) {
+                if (object.dynamic) {
+                    object.position += object.velocity * dt;
+                }
+            }
+            times.push_back(since(start));
+        }
+        double ms = median(times);
+        printf("    struct array 1 thread %7.3f ms  %5.2f ns/entity \n", ms, ms * 1e6 / movingCount);
+    }
+
+    // Both layouts ran the same steps, so the positions have to agree
+    double ecsSum = 0.0, structSum = 0.0;
+    world.forEachChunk(EntityQuery().with<Position>(), nullptr, [&](ChunkView& chunk) {
+        const Position* positions = chunk.read<Position>();
+        for (uint32_t i = 0; i < chunk.size(); i++) {
+            ecsSum += positions[i].value.x + positions[i].value.y + positions[i].value.z;
+        }
+    });
+    for (const ObjectStruct& object : objects) {
+        structSum += object.position.x + object.position.y + object.position.z;
+    }
+    printf("    checksum %s \n", std::abs(ecsSum - structSum) <= 1e-6 * std::abs(structSum) + 1.0 ? "matches" : "MISMATCH");
+
+    // A system that only cares about moved entities: after a few writes it only visits their chunks
+    std::vector<Entity> entities;
+    world.forEachChunk(EntityQuery().with<Velocity>(), nullptr, [&](ChunkView& chunk) {
+        entities.insert(entities.end(), chunk.entities(), chunk.entities() + chunk.size());
+    });
+
+    const size_t writes[] = { 100, 1000, 10000 };
+    for (size_t writeCount : writes) {
+        uint32_t lastRun = world.getVersion();
+        world.advanceVersion();
+        std::uniform_int_distribution<size_t> pick(0, entities.size() - 1);
+        for (size_t w = 0; w < writeCount; w++) {
+            world.getComponentForWrite<Velocity>(entities[pick(random)])->value *= 0.5f;
+        }
+
+        std::vector<double> times;
+        size_t visitedChunks = 0;
+        for (int run = 0; run < runs; run++) {
+            visitedChunks = 0;
+            start = std::chrono::high_resolution_clock::now();
+            world.forEachChunk(EntityQuery().with<Velocity>().changedAfter<Velocity>(lastRun), nullptr, [&](ChunkView&) {
+                visitedChunks++;
+            });
+            times.push_back(since(start));
+        }
+        printf("    %5zu velocity writes: changed query visits %zu of %zu chunks in %.3f ms \n", writeCount, visitedChunks, world.chunkCount(), median(times));
+    }
+}
@@ -0,0 +1,280 @@
+#pragma once
+
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+
+class JobSystem;
+
+// Handle to an entity, the generation tells a reused index apart from the entity that had it before
+struct Entity {
+	uint32_t index = UINT32_MAX;
+	uint32_t generation = 0;
+
+	bool isValid() const { return index != UINT32_MAX; }
+	bool operator==(const Entity& other) const { return index == other.index && generation == other.generation; }
+	bool operator!=(const Entity& other) const { return !(*this == other); }
+};
+
+namespace ECS {
+	static const size_t CHUNK_SIZE = 16 * 1024;
+	static const size_t CACHE_LINE = 64;
+	static const uint32_t MAX_COMPONENTS = 64;
+
+	using ComponentId = uint32_t;
+	using ComponentMask = std::bitset<MAX_COMPONENTS>;
+
+	struct ComponentInfo {
+		uint32_t size;
+		uint32_t alignment;
+		const char* name;
+	};
+
+	ComponentId registerComponent(uint32_t size, uint32_t alignment, const char* name);
+	const ComponentInfo& getComponentInfo(ComponentId id);
+
+	// Ids are handed out on first use of each type. Components are plain data, chunks move them around with memcpy and
+	// never run constructors or destructors. glm types declare empty ones, so the check can only ask for a plain layout
+	template<typename T>
+	ComponentId componentId() {
+		static_assert(std::is_standard_layout<T>::value, "components must be plain data");
+		static const ComponentId id = registerComponent(sizeof(T), alignof(T), typeid(T).name());
+		return id;
+	}
+
+	template<typename... Ts>
+	ComponentMask maskOf() {
+		ComponentMask mask;
+		(mask.set(componentId<Ts>()), ...);
+		return mask;
+	}
+
+	struct Archetype;
+
+	// 16 KB of cache line aligned storage holding the entities of one archetype as a structure of arrays: the entity
+	// handles first, then one array per component, each starting on its own cache line
+	struct Chunk {
+		Archetype* archetype = nullptr;
+		uint8_t* data = nullptr;
+		uint32_t count = 0;
+		// World version of the last write to each component array, indexed like Archetype::components
+		std::vector<uint32_t> versions;
+	};
+
+	// Every entity with exactly the same set of components lives in the chunks of one archetype
+	struct Archetype {
+		ComponentMask mask;
+		std::vector<ComponentId> components;
+		std::vector<uint32_t> sizes;
+		std::vector<uint32_t> offsets;
+		// Position of each component id in components, -1 when absent
+		int8_t slots[MAX_COMPONENTS];
+		uint32_t capacity = 0;
+		std::vector<Chunk*> chunks;
+
+		int slotOf(ComponentId id) const { return slots[id]; }
+	};
+}
+
+// The entities and components of one chunk, as handed to query callbacks
+class ChunkView {
+
+public:
+	ChunkView(ECS::Chunk* chunk, uint32_t version) : chunk(chunk), version(version) {}
+
+	uint32_t size() const { return chunk->count; }
+	const Entity* entities() const { return reinterpret_cast<const Entity*>(chunk->data); }
+
+	template<typename T>
+	bool has() const { return chunk->archetype->slotOf(ECS::componentId<T>()) >= 0; }
+
+	// nullptr when the chunk does not have the component
+	template<typename T>
+	const T* read() const {
+		int slot = chunk->archetype->slotOf(ECS::componentId<T>());
+		return slot < 0 ? nullptr : reinterpret_cast<const T*>(chunk->data + chunk->archetype->offsets[slot]);
+	}
+
+	// Like read, but stamps the array with the current world version so change queries see it
+	template<typename T>
+	T* write() {
+		int slot = chunk->archetype->slotOf(ECS::componentId<T>());
+		if (slot < 0) {
+			return nullptr;
+		}
+		chunk->versions[slot] = version;
+		return reinterpret_cast<T*>(chunk->data + chunk->archetype->offsets[slot]);
+	}
+
+	template<typename T>
+	bool changedAfter(uint32_t since) const {
+		int slot = chunk->archetype->slotOf(ECS::componentId<T>());
+		return slot >= 0 && chunk->versions[slot] > since;
+	}
+
+private:
+	ECS::Chunk* chunk;
+	uint32_t version;
+};
+
+// Chunks with all of one set of components and none of another, optionally only those where one of a third set was
+// written after a given version
+struct EntityQuery {
+	ECS::ComponentMask all;
+	ECS::ComponentMask none;
+	ECS::ComponentMask changed;
+	uint32_t changedSince = 0;
+
+	template<typename... Ts>
+	EntityQuery& with() { all |= ECS::maskOf<Ts...>(); return *this; }
+
+	template<typename... Ts>
+	EntityQuery& without() { none |= ECS::maskOf<Ts...>(); return *this; }
+
+	template<typename... Ts>
+	EntityQuery& changedAfter(uint32_t version) { changed |= ECS::maskOf<Ts...>(); changedSince = version; return *this; }
+};
+
+// Structural changes recorded while chunks are being iterated and applied later with EntityWorld::playback.
+// Not thread safe, give every job its own buffer and play them back in order
+class EntityCommandBuffer {
+
+public:
+	// Placeholder handle that becomes a real entity on playback, later commands in this buffer may use it
+	Entity createEntity();
+	void destroyEntity(Entity entity);
+
+	template<typename T>
+	void addComponent(Entity entity, const T& value) { record(Op::Add, entity, ECS::componentId<T>(), &value, sizeof(T)); }
+
+	template<typename T>
+	void removeComponent(Entity entity) { record(Op::Remove, entity, ECS::componentId<T>(), nullptr, 0); }
+
+	bool empty() const { return commands.empty(); }
+	void clear();
+
+private:
+	friend class EntityWorld;
+
+	enum class Op : uint8_t {
+		Create,
+		Destroy,
+		Add,
+		Remove
+	};
+
+	struct Command {
+		Op op;
+		Entity entity;
+		ECS::ComponentId component;
+		uint32_t payloadOffset;
+	};
+
+	static const uint32_t PENDING_GENERATION = UINT32_MAX;
+
+	void record(Op op, Entity entity, ECS::ComponentId component, const void* value, size_t size);
+
+	std::vector<Command> commands;
+	std::vector<uint8_t> payload;
+	uint32_t createdCount = 0;
+};
+
+// Entities and their components grouped into archetypes. Structural changes move an entity between archetypes and are
+// not allowed while a query runs, use a command buffer there
+class EntityWorld {
+
+public:
+	EntityWorld();
+	~EntityWorld();
+
+	EntityWorld(const EntityWorld&) = delete;
+	EntityWorld& operator=(const EntityWorld&) = delete;
+
+	Entity createEntity() { return createInArchetype(getArchetype(ECS::ComponentMask())); }
+
+	// Created straight in its final archetype, cheaper than adding the components one by one
+	template<typename... Ts>
+	Entity createEntity(const Ts&... values) {
+		Entity entity = createInArchetype(getArchetype(ECS::maskOf<Ts...>()));
+		(std::memcpy(componentData(entity, ECS::componentId<Ts>()), &values, sizeof(Ts)), ...);
+		return entity;
+	}
+
+	void destroyEntity(Entity entity);
+	bool isAlive(Entity entity) const;
+
+	// Replaces the value when the entity already has the component
+	template<typename T>
+	void addComponent(Entity entity, const T& value) { addComponentData(entity, ECS::componentId<T>(), &value); }
+
+	template<typename T>
+	void removeComponent(Entity entity) { removeComponentData(entity, ECS::componentId<T>()); }
+
+	template<typename T>
+	bool hasComponent(Entity entity) const { return isAlive(entity) && records[entity.index].chunk->archetype->slotOf(ECS::componentId<T>()) >= 0; }
+
+	// nullptr when the entity is dead or does not have the component
+	template<typename T>
+	const T* getComponent(Entity entity) const { return static_cast<const T*>(componentData(entity, ECS::componentId<T>())); }
+
+	// Stamps the chunk array with the current version
+	template<typename T>
+	T* getComponentForWrite(Entity entity) { return static_cast<T*>(writeComponentData(entity, ECS::componentId<T>())); }
+
+	// Writes stamp their chunk with this version. A system remembers the version it last ran at and asks for chunks
+	// changed after it
+	uint32_t getVersion() const { return version; }
+	// Start a new version, so later writes compare newer than everything up to now
+	uint32_t advanceVersion() { return ++version; }
+
+	// Call fn on every matching chunk, spread over the job system when one is given
+	void forEachChunk(const EntityQuery& query, JobSystem* jobs, const std::function<void(ChunkView& chunk)>& fn);
+
+	// Apply the commands in recording order and clear the buffer
+	void playback(EntityCommandBuffer& commands);
+
+	size_t entityCount() const { return records.size() - freeIndices.size(); }
+	size_t chunkCount() const;
+	size_t archetypeCount() const { return archetypes.size(); }
+
+	// Spawn 1M entities through a command buffer, then time parallel and single threaded queries against an array of structs
+	static void runBenchmark();
+
+private:
+	struct EntityRecord {
+		ECS::Chunk* chunk = nullptr;
+		uint32_t row = 0;
+		uint32_t generation = 0;
+	};
+
+	ECS::Archetype* getArchetype(const ECS::ComponentMask& mask);
+	Entity createInArchetype(ECS::Archetype* archetype);
+	void* componentData(Entity entity, ECS::ComponentId id) const;
+	void* writeComponentData(Entity entity, ECS::ComponentId id);
+	void addComponentData(Entity entity, ECS::ComponentId id, const void* value);
+	void removeComponentData(Entity entity, ECS::ComponentId id);
+
+	// Place an entity in the last chunk of the archetype with room, returns the chunk and writes the row
+	ECS::Chunk* allocateRow(ECS::Archetype* archetype, Entity entity, uint32_t& row);
+	// Fill the hole with the last entity of the archetype, so only its last chunk is ever partly empty
+	void removeRow(ECS::Chunk* chunk, uint32_t row);
+	void moveEntity(Entity entity, ECS::Archetype* target);
+	void stampChunk(ECS::Chunk* chunk);
+	void checkNotIterating() const;
+
+	std::vector<EntityRecord> records;
+	std::vector<uint32_t> freeIndices;
+	std::unordered_map<ECS::ComponentMask, std::unique_ptr<ECS::Archetype>> archetypes;
+	// Chunk blocks of emptied chunks, reused before allocating new ones
+	std::vector<uint8_t*> freeBlocks;
+	std::vector<ECS::Chunk*> queryChunks;
+	uint32_t version = 1;
+	bool iterating = false;
+};
@@ -0,0 +1,185 @@
+#include "FrameAllocator.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+LINEAR ARENA
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static size_t alignUp(size_t value, size_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+LinearArena::LinearArena(size_t initialCapacity) {
+    blockSize = initialCapacity;
+    block = static_cast<char*>(std::malloc(blockSize));
+    if (block == nullptr) {
+        throw std::bad_alloc();
+    }
+}
+
+LinearArena::~LinearArena() {
+    for (void* overflow : overflowBlocks) {
+        std::free(overflow);
+    }
+    std::free(block);
+}
+
+void* LinearArena::allocate(size_t size, size_t alignment) {
+    size_t start = alignUp(offset, alignment);
+    if (start + size <= blockSize) {
+        offset = start + size;
+        highWater = std::max(highWater, offset + overflowBytes);
+        return block + start;
+    }
+
+    // Out of space for this frame, spill to the heap and remember how much to grow by at the next reset
+    void* overflow = std::malloc(alignUp(size, alignment) + alignment);
+    if (overflow == nullptr) {
+        throw std::bad_alloc();
+    }
+    overflowBlocks.push_back(overflow);
+    overflowBytes += size + alignment;
+    highWater = std::max(highWater, offset + overflowBytes);
+
+    return reinterpret_cast<void*>(alignUp(reinterpret_cast<uintptr_t>(overflow), alignment));
+}
+
+void LinearArena::reset() {
+    for (void* overflow : overflowBlocks) {
+        std::free(overflow);
+    }
+    overflowBlocks.clear();
+    offset = 0;
+    overflowBytes = 0;
+
+    // The old block stays in place when the larger one can't be had
+    if (highWater > blockSize) {
+        size_t grownSize = alignUp(highWater + highWater / 2, 4096);
+        char* grown = static_cast<char*>(std::malloc(grownSize));
+        if (grown == nullptr) {
+            throw std::bad_alloc();
+        }
+        std::free(block);
+        block = grown;
+        blockSize = grownSize;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+ALLOCATION TRACKING
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+std::atomic<uint64_t> AllocationTracker::allocationCount{ 0 };
+std::atomic<uint64_t> AllocationTracker::allocatedBytes{ 0 };
+bool AllocationTracker::enabled = false;
+uint64_t AllocationTracker::lastCount = 0;
+uint64_t AllocationTracker::lastBytes = 0;
+uint64_t AllocationTracker::maxPerFrame = 0;
+uint32_t AllocationTracker::framesSinceReport = 0;
+
+void AllocationTracker::frameBoundary(uint32_t reportInterval) {
+    if (!enabled) {
+        return;
+    }
+
+    static uint64_t frameStartCount = allocationCount.load(std::memory_order_relaxed);
+    uint64_t count = allocationCount.load(std::memory_order_relaxed);
+    maxPerFrame = std::max(maxPerFrame, count - frameStartCount);
+    frameStartCount = count;
+
+    if (++framesSinceReport < reportInterval) {
+        return;
+    }
+
+    uint64_t bytes = allocatedBytes.load(std::memory_order_relaxed);
+    printf("Allocations: %.2f mallocs/frame (max %llu), %.1f bytes/frame over %u frames \n",
+        (double)(count - lastCount) / framesSinceReport, (unsigned long long)maxPerFrame,
+        (double)(bytes - lastBytes) / framesSinceReport, framesSinceReport);
+
+    lastCount = count;
+    lastBytes = bytes;
+    maxPerFrame = 0;
+    framesSinceReport = 0;
+}
+
+// Replacing the global allocation functions counts every new/delete in the program, including the STL containers
+void* operator new(size_t size) {
+    AllocationTracker::allocationCount.fetch_add(1, std::memory_order_relaxed);
+    AllocationTracker::allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+// Over-aligned types, glm's SIMD ones and alignas job structures, come through these instead and would go uncounted
+void* operator new(size_t size, std::align_val_t alignment) {
+    AllocationTracker::allocationCount.fetch_add(1, std::memory_order_relaxed);
+    AllocationTracker::allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    size_t align = static_cast<size_t>(alignment);
+#ifdef _WIN32
+    void* ptr = _aligned_malloc(size ? size : 1, align);
+#else
+    // aligned_alloc takes only whole multiples of the alignment
+    void* ptr = std::aligned_alloc(align, alignUp(size ? size : 1, align));
+#endif
+    if (ptr) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+    return operator new(size, alignment);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept {
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    std::free(ptr);
+#endif
+}
+
+void operator delete[](void* ptr, std::align_val_t alignment) noexcept {
+    operator delete(ptr, alignment);
+}
+
+void operator delete(void* ptr, size_t, std::align_val_t alignment) noexcept {
+    operator delete(ptr, alignment);
+}
+
+void operator delete[](void* ptr, size_t, std::align_val_t alignment) noexcept {
+    operator delete(ptr, alignment);
+}
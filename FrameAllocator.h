@@ -0,0 +1,116 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Bump allocator over one block of memory, everything allocated from it is released at once by reset()
+class LinearArena {
+
+public:
+	explicit LinearArena(size_t initialCapacity = 64 * 1024);
+	~LinearArena();
+
+	LinearArena(const LinearArena&) = delete;
+	LinearArena& operator=(const LinearArena&) = delete;
+
+	void* allocate(size_t size, size_t alignment);
+	// O(1), also grows the main block to the high water mark so a steady state frame never spills
+	void reset();
+
+	// Position in the main block, used to release nested scratch allocations early
+	size_t mark() const { return offset; }
+	void rewind(size_t position) { offset = position; }
+
+	size_t used() const { return offset; }
+	size_t capacity() const { return blockSize; }
+	size_t highWaterMark() const { return highWater; }
+
+private:
+	char* block = nullptr;
+	size_t blockSize = 0;
+	size_t offset = 0;
+	size_t highWater = 0;
+
+	// Allocations that did not fit in the main block, freed on the next reset
+	std::vector<void*> overflowBlocks;
+	size_t overflowBytes = 0;
+};
+
+// Releases everything allocated from the arena inside the scope when it ends
+class ArenaScope {
+
+public:
+	explicit ArenaScope(LinearArena& arena) : arena(arena), position(arena.mark()) {}
+	~ArenaScope() { arena.rewind(position); }
+
+private:
+	LinearArena& arena;
+	size_t position;
+};
+
+// One arena per frame in flight, reset only once the fence for that frame has been waited on
+template <size_t N>
+class FrameArenas {
+
+public:
+	void beginFrame(size_t frameIndex) {
+		currentIndex = frameIndex % N;
+		arenas[currentIndex].reset();
+	}
+
+	LinearArena& current() { return arenas[currentIndex]; }
+
+private:
+	std::array<LinearArena, N> arenas;
+	size_t currentIndex = 0;
+};
+
+// STL allocator adaptor so standard containers can live in an arena, deallocation is a no-op
+template <typename T>
+class FrameAllocator {
+
+public:
+	using value_type = T;
+
+	LinearArena* arena;
+
+	explicit FrameAllocator(LinearArena& arena) noexcept : arena(&arena) {}
+	template <typename U>
+	FrameAllocator(const FrameAllocator<U>& other) noexcept : arena(other.arena) {}
+
+	T* allocate(size_t n) {
+		return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T)));
+	}
+
+	void deallocate(T*, size_t) noexcept {}
+
+	template <typename U>
+	bool operator==(const FrameAllocator<U>& other) const noexcept { return arena == other.arena; }
+	template <typename U>
+	bool operator!=(const FrameAllocator<U>& other) const noexcept { return arena != other.arena; }
+};
+
+template <typename T>
+using FrameVector = std::vector<T, FrameAllocator<T>>;
+
+// Counts heap allocations made through the global operator new so they can be reported per frame
+class AllocationTracker {
+
+public:
+	static std::atomic<uint64_t> allocationCount;
+	static std::atomic<uint64_t> allocatedBytes;
+
+	static bool enabled;
+
+	// Called once per frame from the render loop, prints the averages every reportInterval frames
+	static void frameBoundary(uint32_t reportInterval = 600);
+
+private:
+	static uint64_t lastCount;
+	static uint64_t lastBytes;
+	static uint64_t maxPerFrame;
+	static uint32_t framesSinceReport;
+};
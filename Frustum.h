@@ -0,0 +1,51 @@
+#pragma once
+
+#include "glm-0.9.6.3/glm.hpp"
+
+// Six normalized clip planes, pointing inwards, in whatever space the matrix they were extracted from starts in
+struct Frustum {
+	// Left, right, bottom, top, near, far
+	glm::vec4 planes[6];
+
+	Frustum() = default;
+
+	// Gribb and Hartmann plane extraction from a matrix that ends in clip space
+	explicit Frustum(const glm::mat4& toClip) {
+		glm::vec4 row0{ toClip[0][0], toClip[1][0], toClip[2][0], toClip[3][0] };
+		glm::vec4 row1{ toClip[0][1], toClip[1][1], toClip[2][1], toClip[3][1] };
+		glm::vec4 row2{ toClip[0][2], toClip[1][2], toClip[2][2], toClip[3][2] };
+		glm::vec4 row3{ toClip[0][3], toClip[1][3], toClip[2][3], toClip[3][3] };
+
+		// Vulkan clips depth to [0, w], so the near plane is the z row on its own
+		planes[0] = row3 + row0;
+		planes[1] = row3 - row0;
+		planes[2] = row3 + row1;
+		planes[3] = row3 - row1;
+		planes[4] = row2;
+		planes[5] = row3 - row2;
+
+		for (glm::vec4& plane : planes) {
+			plane /= glm::length(glm::vec3(plane));
+		}
+	}
+
+	bool intersectsSphere(const glm::vec3& center, float radius) const {
+		for (const glm::vec4& plane : planes) {
+			if (glm::dot(glm::vec3(plane), center) + plane.w < -radius) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Box given by its center and half size, tested against the corner furthest along each plane normal
+	bool intersectsBox(const glm::vec3& center, const glm::vec3& extent) const {
+		for (const glm::vec4& plane : planes) {
+			glm::vec3 normal{ plane };
+			if (glm::dot(normal, center) + glm::dot(glm::abs(normal), extent) + plane.w < 0.0f) {
+				return false;
+			}
+		}
+		return true;
+	}
+};
@@ -0,0 +1,276 @@
+#include "InstanceCulling.h"
+#include "JobSystem.h"
+#include "FrameAllocator.h"
+#include "CPUFeatures.h"
+#include "SIMDMath.h"
+#include "glm-0.9.6.3/gtc/matrix_transform.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <immintrin.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+INSTANCE BOUNDS
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void InstanceBounds::resize(size_t instanceCount) {
+    count = instanceCount;
+    size_t padded = (instanceCount + 7) & ~size_t(7);
+
+    for (std::vector<float>* field : { &centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ, &radius }) {
+        field->resize(padded, 0.0f);
+    }
+}
+
+void InstanceBounds::set(size_t index, const glm::vec3& localCenter, const glm::vec3& localExtent, const glm::mat4& transform) {
+    glm::vec3 center, extent;
+    SIMDMath::transformBoxes(&transform, &localCenter, &localExtent, &center, &extent, 1);
+
+    centerX[index] = center.x;
+    centerY[index] = center.y;
+    centerZ[index] = center.z;
+    extentX[index] = extent.x;
+    extentY[index] = extent.y;
+    extentZ[index] = extent.z;
+    radius[index] = glm::length(extent);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+CULLING KERNELS
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t lowestBit(uint32_t mask) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return static_cast<uint32_t>(__builtin_ctz(mask));
+#endif
+}
+
+static size_t cullScalar(const InstanceBounds& bounds, const Frustum& frustum, size_t begin, size_t end, uint32_t* visible) {
+    size_t written = 0;
+    for (size_t i = begin; i < end; i++) {
+        glm::vec3 center{ bounds.centerX[i], bounds.centerY[i], bounds.centerZ[i] };
+        glm::vec3 extent{ bounds.extentX[i], bounds.extentY[i], bounds.extentZ[i] };
+        if (frustum.intersectsBox(center, extent)) {
+            visible[written++] = static_cast<uint32_t>(i);
+        }
+    }
+    return written;
+}
+
+static size_t cullSSE(const InstanceBounds& bounds, const Frustum& frustum, size_t begin, size_t end, uint32_t* visible) {
+    // Plane components broadcast once, the absolute normal picks the furthest box corner without a branch
+    __m128 nx[6], ny[6], nz[6], ax[6], ay[6], az[6], d[6];
+    for (int p = 0; p < 6; p++) {
+        const glm::vec4& plane = frustum.planes[p];
+        nx[p] = _mm_set1_ps(plane.x);
+        ny[p] = _mm_set1_ps(plane.y);
+        nz[p] = _mm_set1_ps(plane.z);
+        ax[p] = _mm_set1_ps(std::abs(plane.x));
+        ay[p] = _mm_set1_ps(std::abs(plane.y));
+        az[p] = _mm_set1_ps(std::abs(plane.z));
+        d[p] = _mm_set1_ps(plane.w);
+    }
+    __m128 zero = _mm_setzero_ps();
+
+    size_t written = 0;
+    for (size_t i = begin; i < end; i += 4) {
+        __m128 cx = _mm_loadu_ps(&bounds.centerX[i]);
+        __m128 cy = _mm_loadu_ps(&bounds.centerY[i]);
+        __m128 cz = _mm_loadu_ps(&bounds.centerZ[i]);
+        __m128 ex = _mm_loadu_ps(&bounds.extentX[i]);
+        __m128 ey = _mm_loadu_ps(&bounds.extentY[i]);
+        __m128 ez = _mm_loadu_ps(&bounds.extentZ[i]);
+
+        __m128 inside = _mm_cmpeq_ps(zero, zero);
+        for (int p = 0; p < 6; p++) {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx[p], cx), _mm_mul_ps(ny[p], cy)), _mm_add_ps(_mm_mul_ps(nz[p], cz), d[p]));
+            __m128 reach = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax[p], ex), _mm_mul_ps(ay[p], ey)), _mm_mul_ps(az[p], ez));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, reach), zero));
+        }
+
+        uint32_t mask = static_cast<uint32_t>(_mm_movemask_ps(inside));
+        if (i + 4 > end) {
+            mask &= (1u << (end - i)) - 1;
+        }
+        while (mask) {
+            visible[written++] = static_cast<uint32_t>(i + lowestBit(mask));
+            mask &= mask - 1;
+        }
+    }
+    return written;
+}
+
+AVX2_FUNCTION static size_t cullAVX2(const InstanceBounds& bounds, const Frustum& frustum, size_t begin, size_t end, uint32_t* visible) {
+    __m256 nx[6], ny[6], nz[6], ax[6], ay[6], az[6], d[6];
+    for (int p = 0; p < 6; p++) {
+        const glm::vec4& plane = frustum.planes[p];
+        nx[p] = _mm256_set1_ps(plane.x);
+        ny[p] = _mm256_set1_ps(plane.y);
+        nz[p] = _mm256_set1_ps(plane.z);
+        ax[p] = _mm256_set1_ps(std::abs(plane.x));
+        ay[p] = _mm256_set1_ps(std::abs(plane.y));
+        az[p] = _mm256_set1_ps(std::abs(plane.z));
+        d[p] = _mm256_set1_ps(plane.w);
+    }
+    __m256 zero = _mm256_setzero_ps();
+
+    size_t written = 0;
+    for (size_t i = begin; i < end; i += 8) {
+        __m256 cx = _mm256_loadu_ps(&bounds.centerX[i]);
+        __m256 cy = _mm256_loadu_ps(&bounds.centerY[i]);
+        __m256 cz = _mm256_loadu_ps(&bounds.centerZ[i]);
+        __m256 ex = _mm256_loadu_ps(&bounds.extentX[i]);
+        __m256 ey = _mm256_loadu_ps(&bounds.extentY[i]);
+        __m256 ez = _mm256_loadu_ps(&bounds.extentZ[i]);
+
+        __m256 inside = _mm256_cmp_ps(zero, zero, _CMP_EQ_OQ);
+        for (int p = 0; p < 6; p++) {
+            __m256 distance = _mm256_fmadd_ps(nx[p], cx, _mm256_fmadd_ps(ny[p], cy, _mm256_fmadd_ps(nz[p], cz, d[p])));
+            __m256 reach = _mm256_fmadd_ps(ax[p], ex, _mm256_fmadd_ps(ay[p], ey, _mm256_mul_ps(az[p], ez)));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(distance, reach), zero, _CMP_GE_OQ));
+        }
+
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_ps(inside));
+        if (i + 8 > end) {
+            mask &= (1u << (end - i)) - 1;
+        }
+        while (mask) {
+            visible[written++] = static_cast<uint32_t>(i + lowestBit(mask));
+            mask &= mask - 1;
+        }
+    }
+    return written;
+}
+
+InstanceCulling::Kernel InstanceCulling::bestKernel() {
+    static const Kernel best = CPUFeatures::hasAVX2() ? Kernel::AVX2 : Kernel::SSE;
+    return best;
+}
+
+const char* InstanceCulling::kernelName(Kernel kernel) {
+    switch (kernel) {
+    case Kernel::Scalar:
+        return "scalar";
+    case Kernel::SSE:
+        return "SSE";
+    default:
+        return "AVX2";
+    }
+}
+
+size_t InstanceCulling::cullRange(Kernel kernel, const InstanceBounds& bounds, const Frustum& frustum, size_t begin, size_t end, uint32_t* visible) {
+    switch (kernel) {
+    case Kernel::Scalar:
+        return cullScalar(bounds, frustum, begin, end, visible);
+    case Kernel::SSE:
+        return cullSSE(bounds, frustum, begin, end, visible);
+    default:
+        return cullAVX2(bounds, frustum, begin, end, visible);
+    }
+}
+
+void InstanceCulling::cull(const InstanceBounds& bounds, const Frustum& frustum, JobSystem* jobs, LinearArena& scratch, std::vector<uint32_t>& visible, Kernel kernel) {
+    visible.resize(bounds.count);
+
+    // Every batch writes its survivors at the start of its own range, then the ranges are packed together in order
+    const size_t batchSize = 16384;
+    size_t batchCount = (bounds.count + batchSize - 1) / batchSize;
+    ArenaScope scope(scratch);
+    FrameVector<size_t> batchVisible(batchCount, 0, FrameAllocator<size_t>(scratch));
+
+    auto cullBatches = [&](size_t begin, size_t end) {
+        batchVisible[begin / batchSize] = cullRange(kernel, bounds, frustum, begin, end, visible.data() + begin);
+    };
+
+    if (jobs) {
+        jobs->parallelFor(bounds.count, batchSize, cullBatches);
+    }
+    else {
+        for (size_t begin = 0; begin < bounds.count; begin += batchSize) {
+            cullBatches(begin, std::min(begin + batchSize, bounds.count));
+        }
+    }
+
+    size_t written = batchCount > 0 ? batchVisible[0] : 0;
+    for (size_t batch = 1; batch < batchCount; batch++) {
+        std::memmove(visible.data() + written, visible.data() + batch * batchSize, batchVisible[batch] * sizeof(uint32_t));
+        written += batchVisible[batch];
+    }
+    visible.resize(written);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+BENCHMARK
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void InstanceCulling::runBenchmark() {
+    const size_t instanceCounts[] = { 100000, 1000000 };
+    const int runs = 21;
+
+    // Instances scattered through a 1 km cube around a camera looking down +X
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+    glm::mat4 proj = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 1000.0f);
+    Frustum frustum(proj * view);
+
+    JobSystem jobs;
+    std::vector<Kernel> kernels = { Kernel::Scalar, Kernel::SSE };
+    if (bestKernel() == Kernel::AVX2) {
+        kernels.push_back(Kernel::AVX2);
+    }
+
+    for (size_t instanceCount : instanceCounts) {
+        std::mt19937 random(1234);
+        std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+        std::uniform_real_distribution<float> size(0.5f, 2.0f);
+        std::uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+
+        InstanceBounds bounds;
+        bounds.resize(instanceCount);
+        for (size_t i = 0; i < instanceCount; i++) {
+            glm::mat4 transform = glm::translate(glm::mat4(1.0f), glm::vec3(position(random), position(random), position(random)));
+            transform = glm::rotate(transform, angle(random), glm::vec3(0.0f, 0.0f, 1.0f));
+            bounds.set(i, glm::vec3(0.0f), glm::vec3(size(random), size(random), size(random)), transform);
+        }
+
+        printf("%zu instances, %u threads \n", instanceCount, jobs.threadCount());
+
+        LinearArena scratch;
+        std::vector<uint32_t> reference;
+        cull(bounds, frustum, nullptr, scratch, reference, Kernel::Scalar);
+
+        for (Kernel kernel : kernels) {
+            for (JobSystem* jobSystem : { static_cast<JobSystem*>(nullptr), &jobs }) {
+                std::vector<uint32_t> visible;
+                std::vector<double> times;
+                for (int run = 0; run < runs; run++) {
+                    auto start = std::chrono::high_resolution_clock::now();
+                    cull(bounds, frustum, jobSystem, scratch, visible, kernel);
+                    auto end = std::chrono::high_resolution_clock::now();
+                    times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+                }
+                std::sort(times.begin(), times.end());
+                double median = times[runs / 2];
+
+                printf("    %-6s %-8s %8.3f ms  %6.2f ns/instance  %zu visible%s \n", kernelName(kernel), jobSystem ? "parallel" : "1 thread",
+                    median, median * 1e6 / instanceCount, visible.size(), visible == reference ? "" : "  MISMATCH");
+            }
+        }
+    }
+}
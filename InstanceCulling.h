@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "glm-0.9.6.3/glm.hpp"
+#include "Frustum.h"
+
+class JobSystem;
+class LinearArena;
+
+// World space bounds of every instance as a structure of arrays, so one SIMD load reads the same field of 4 or 8 instances.
+// The arrays are padded to a multiple of 8 so the kernels can always load full registers, lanes past count are masked off
+struct InstanceBounds {
+	std::vector<float> centerX, centerY, centerZ;
+	std::vector<float> extentX, extentY, extentZ;
+	std::vector<float> radius;
+	size_t count = 0;
+
+	void resize(size_t instanceCount);
+	// Box around a model space box after the instance transform, also sets the bounding sphere of that box
+	void set(size_t index, const glm::vec3& localCenter, const glm::vec3& localExtent, const glm::mat4& transform);
+};
+
+namespace InstanceCulling {
+	enum class Kernel {
+		Scalar,
+		// 4 instances per iteration
+		SSE,
+		// 8 instances per iteration
+		AVX2
+	};
+
+	// Widest kernel this CPU can run
+	Kernel bestKernel();
+	const char* kernelName(Kernel kernel);
+
+	// Test the instances in [begin, end) against the frustum and write the indices of the visible ones to visible,
+	// begin must be a multiple of 8. Returns how many were written
+	size_t cullRange(Kernel kernel, const InstanceBounds& bounds, const Frustum& frustum, size_t begin, size_t end, uint32_t* visible);
+
+	// Cull every instance, spread over the job system when one is given. visible ends up as a compact, sorted list, the
+	// per batch counts live in scratch until the call returns
+	void cull(const InstanceBounds& bounds, const Frustum& frustum, JobSystem* jobs, LinearArena& scratch, std::vector<uint32_t>& visible, Kernel kernel = bestKernel());
+
+	// Time every kernel on one thread and across the job system at 100k and 1M random instances
+	void runBenchmark();
+}
@@ -0,0 +1,124 @@
+#include "JobSystem.h"
+#include <algorithm>
+#include <atomic>
+
+JobSystem::JobSystem(uint32_t workerCount) {
+    if (workerCount == 0) {
+        uint32_t hardwareThreads = std::thread::hardware_concurrency();
+        workerCount = hardwareThreads > 1 ? hardwareThreads - 1 : 0;
+    }
+
+    workers.reserve(workerCount);
+    for (uint32_t i = 0; i < workerCount; i++) {
+        workers.emplace_back(&JobSystem::workerLoop, this);
+    }
+}
+
+JobSystem::~JobSystem() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+void JobSystem::submit(std::function<void()> job) {
+    // Without workers there is nobody to hand the job to
+    if (workers.empty()) {
+        job();
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(std::move(job));
+    }
+    wake.notify_one();
+}
+
+void JobSystem::workerLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wake.wait(lock, [this]() { return stopping || !jobs.empty(); });
+        if (stopping && jobs.empty()) {
+            return;
+        }
+
+        std::function<void()> job = std::move(jobs.front());
+        jobs.pop_front();
+        busyWorkers++;
+
+        lock.unlock();
+        job();
+        lock.lock();
+
+        busyWorkers--;
+        if (jobs.empty() && busyWorkers == 0) {
+            idle.notify_all();
+        }
+    }
+}
+
+bool JobSystem::runPendingJob() {
+    std::function<void()> job;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (jobs.empty()) {
+            return false;
+        }
+        job = std::move(jobs.front());
+        jobs.pop_front();
+    }
+    job();
+    return true;
+}
+
+void JobSystem::waitIdle() {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this]() { return jobs.empty() && busyWorkers == 0; });
+}
+
+void JobSystem::parallelFor(size_t count, size_t batchSize, const std::function<void(size_t begin, size_t end)>& fn) {
+    if (count == 0) {
+        return;
+    }
+    batchSize = std::max<size_t>(batchSize, 1);
+    size_t batchCount = (count + batchSize - 1) / batchSize;
+
+    if (batchCount == 1 || workers.empty()) {
+        fn(0, count);
+        return;
+    }
+
+    std::atomic<size_t> nextBatch{ 0 };
+    std::atomic<size_t> finishedHelpers{ 0 };
+
+    auto runBatches = [&]() {
+        for (size_t batch = nextBatch.fetch_add(1); batch < batchCount; batch = nextBatch.fetch_add(1)) {
+            size_t begin = batch * batchSize;
+            fn(begin, std::min(begin + batchSize, count));
+        }
+    };
+
+    // Helpers reference this stack frame, so it only returns once every helper has checked out
+    size_t helperCount = std::min(workers.size(), batchCount - 1);
+    for (size_t i = 0; i < helperCount; i++) {
+        submit([&]() {
+            runBatches();
+            finishedHelpers.fetch_add(1, std::memory_order_release);
+        });
+    }
+
+    runBatches();
+
+    // Nested calls from a worker keep draining the queue instead of blocking it
+    while (finishedHelpers.load(std::memory_order_acquire) < helperCount) {
+        if (!runPendingJob()) {
+            std::this_thread::yield();
+        }
+    }
+}
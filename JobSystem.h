@@ -0,0 +1,48 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed pool of worker threads fed from one job queue, the thread calling parallelFor works alongside them
+class JobSystem {
+
+public:
+	// 0 uses one worker per hardware thread, minus the calling thread
+	explicit JobSystem(uint32_t workerCount = 0);
+	~JobSystem();
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	// Run a job on any worker, fire and forget
+	void submit(std::function<void()> job);
+
+	// Call fn(begin, end) over [0, count) in chunks of batchSize and return once every chunk has run.
+	// Chunks are handed out in order from a shared counter, so uneven chunks balance themselves
+	void parallelFor(size_t count, size_t batchSize, const std::function<void(size_t begin, size_t end)>& fn);
+
+	// Block until the queue is empty and no worker is busy
+	void waitIdle();
+
+	// Workers plus the calling thread
+	uint32_t threadCount() const { return static_cast<uint32_t>(workers.size()) + 1; }
+
+private:
+	void workerLoop();
+	// Pop and run one queued job on the calling thread, false when the queue was empty
+	bool runPendingJob();
+
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> jobs;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable idle;
+	uint32_t busyWorkers = 0;
+	bool stopping = false;
+};
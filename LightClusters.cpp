@@ -0,0 +1,344 @@
+#include "LightClusters.h"
+#include "JobSystem.h"
+#include "FrameAllocator.h"
+#include "SIMDMath.h"
+#include "glm-0.9.6.3/gtc/matrix_transform.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+LightClusters::LightClusters() : LightClusters(Settings()) {
+}
+
+LightClusters::LightClusters(const Settings& settings) : settings(settings) {
+}
+
+void LightClusters::setSettings(const Settings& newSettings) {
+    settings = newSettings;
+    // Boxes are rebuilt by the next build
+    nearDepth = 0.0f;
+}
+
+void LightClusters::buildClusterBoxes(float newXScale, float newYScale, float newNear, float newFar) {
+    xScale = newXScale;
+    yScale = newYScale;
+    nearDepth = newNear;
+    farDepth = newFar;
+
+    sliceDepths.resize(settings.slices + 1);
+    for (uint32_t slice = 0; slice <= settings.slices; slice++) {
+        sliceDepths[slice] = nearDepth * std::pow(farDepth / nearDepth, float(slice) / settings.slices);
+    }
+    sliceDepths[settings.slices] = farDepth;
+
+    boxMin.resize(clusterCount());
+    boxMax.resize(clusterCount());
+    for (uint32_t slice = 0; slice < settings.slices; slice++) {
+        float d0 = sliceDepths[slice];
+        float d1 = sliceDepths[slice + 1];
+        for (uint32_t tileY = 0; tileY < settings.tilesY; tileY++) {
+            // Position over depth at the tile's edges, x = ndc * depth / xScale
+            float y0 = (-1.0f + 2.0f * tileY / settings.tilesY) / yScale;
+            float y1 = (-1.0f + 2.0f * (tileY + 1) / settings.tilesY) / yScale;
+            for (uint32_t tileX = 0; tileX < settings.tilesX; tileX++) {
+                float x0 = (-1.0f + 2.0f * tileX / settings.tilesX) / xScale;
+                float x1 = (-1.0f + 2.0f * (tileX + 1) / settings.tilesX) / xScale;
+                uint32_t cluster = (slice * settings.tilesY + tileY) * settings.tilesX + tileX;
+                boxMin[cluster] = glm::vec3(std::min(std::min(x0 * d0, x0 * d1), std::min(x1 * d0, x1 * d1)),
+                    std::min(std::min(y0 * d0, y0 * d1), std::min(y1 * d0, y1 * d1)), d0);
+                boxMax[cluster] = glm::vec3(std::max(std::max(x0 * d0, x0 * d1), std::max(x1 * d0, x1 * d1)),
+                    std::max(std::max(y0 * d0, y0 * d1), std::max(y1 * d0, y1 * d1)), d1);
+            }
+        }
+    }
+}
+
+void LightClusters::build(const std::vector<PointLight>& lights, const glm::mat4& view, const glm::mat4& proj, JobSystem* jobs, LinearArena& scratch) {
+    // glm::perspective writes the [-1, 1] depth form. Vulkan clips at depth 0 instead, a little past this near plane,
+    // so the first slice only starts early
+    float newNear = proj[3][2] / (proj[2][2] - 1.0f);
+    float newFar = proj[3][2] / (proj[2][2] + 1.0f);
+    if (proj[0][0] != xScale || proj[1][1] != yScale || newNear != nearDepth || newFar != farDepth) {
+        buildClusterBoxes(proj[0][0], proj[1][1], newNear, newFar);
+    }
+
+    ArenaScope scope(scratch);
+    size_t lightCount = lights.size();
+    FrameVector<glm::vec3> worldPositions(lightCount, glm::vec3(0.0f), FrameAllocator<glm::vec3>(scratch));
+    FrameVector<glm::vec3> viewPositions(lightCount, glm::vec3(0.0f), FrameAllocator<glm::vec3>(scratch));
+    for (size_t i = 0; i < lightCount; i++) {
+        worldPositions[i] = lights[i].position;
+    }
+    SIMDMath::transformPoints(view, worldPositions.data(), viewPositions.data(), lightCount);
+
+    stats = Stats();
+    sliceLights.resize(settings.slices);
+    for (std::vector<uint32_t>& slice : sliceLights) {
+        slice.clear();
+    }
+
+    // Distance to a side plane through the eye is (scale * x - depth) / length, both signs of x and y
+    float xLength = std::sqrt(xScale * xScale + 1.0f);
+    float yLength = std::sqrt(yScale * yScale + 1.0f);
+    float absYScale = std::abs(yScale);
+    auto sliceAt = [&](float depth) {
+        auto next = std::upper_bound(sliceDepths.begin() + 1, sliceDepths.end() - 1, depth);
+        return static_cast<uint32_t>(next - sliceDepths.begin() - 1);
+    };
+
+    gpuLights.resize(lightCount);
+    for (size_t i = 0; i < lightCount; i++) {
+        const glm::vec3& position = viewPositions[i];
+        float radius = lights[i].radius;
+        gpuLights[i].positionRadius = glm::vec4(position, radius);
+        gpuLights[i].color = glm::vec4(lights[i].color * lights[i].intensity, 0.0f);
+
+        float depth = -position.z;
+        if (depth + radius < nearDepth || depth - radius > farDepth ||
+            (xScale * std::abs(position.x) - depth) / xLength > radius || (absYScale * std::abs(position.y) - depth) / yLength > radius) {
+            continue;
+        }
+        stats.visibleLights++;
+
+        // Searched rather than computed with a log per light, which costs more than the rest of the loop
+        uint32_t firstSlice = sliceAt(depth - radius);
+        uint32_t lastSlice = sliceAt(depth + radius);
+        for (uint32_t slice = firstSlice; slice <= lastSlice; slice++) {
+            sliceLights[slice].push_back(static_cast<uint32_t>(i));
+        }
+    }
+
+    sliceHits.resize(settings.slices);
+    sliceIndices.resize(settings.slices);
+    clusterCounts.resize(clusterCount());
+    clusterStarts.resize(clusterCount());
+    auto fillSlices = [&](size_t begin, size_t end) {
+        for (size_t slice = begin; slice < end; slice++) {
+            fillSlice(static_cast<uint32_t>(slice));
+        }
+    };
+    if (jobs) {
+        jobs->parallelFor(settings.slices, 1, fillSlices);
+    }
+    else {
+        fillSlices(0, settings.slices);
+    }
+
+    // Pack the slices into one list, every slice copies into its own range
+    FrameVector<uint32_t> sliceOffsets(settings.slices, 0, FrameAllocator<uint32_t>(scratch));
+    uint32_t total = 0;
+    for (uint32_t slice = 0; slice < settings.slices; slice++) {
+        sliceOffsets[slice] = total;
+        total += static_cast<uint32_t>(sliceIndices[slice].size());
+    }
+    indices.resize(total);
+    clusters.resize(clusterCount());
+    uint32_t tileCount = settings.tilesX * settings.tilesY;
+    auto packSlices = [&](size_t begin, size_t end) {
+        for (size_t slice = begin; slice < end; slice++) {
+            uint32_t offset = sliceOffsets[slice];
+            for (uint32_t cluster = static_cast<uint32_t>(slice) * tileCount; cluster < (slice + 1) * tileCount; cluster++) {
+                clusters[cluster] = glm::uvec2(offset + clusterStarts[cluster], clusterCounts[cluster]);
+            }
+            std::memcpy(indices.data() + offset, sliceIndices[slice].data(), sliceIndices[slice].size() * sizeof(uint32_t));
+        }
+    };
+    if (jobs) {
+        jobs->parallelFor(settings.slices, 1, packSlices);
+    }
+    else {
+        packSlices(0, settings.slices);
+    }
+
+    stats.assignments = total;
+    for (uint32_t count : clusterCounts) {
+        stats.occupiedClusters += count > 0;
+        stats.maxClusterLights = std::max(stats.maxClusterLights, count);
+    }
+}
+
+void LightClusters::fillSlice(uint32_t slice) {
+    uint32_t tileCount = settings.tilesX * settings.tilesY;
+    uint32_t base = slice * tileCount;
+    std::fill(clusterCounts.begin() + base, clusterCounts.begin() + base + tileCount, 0u);
+    float d0 = sliceDepths[slice];
+    float d1 = sliceDepths[slice + 1];
+
+    // Tiles covered by the box around the sphere's part of the slice, x / depth is largest at one of its corners
+    auto tileRange = [](float low, float high, float nearest, float furthest, float scale, uint32_t tiles, uint32_t& first, uint32_t& last) {
+        float a = scale * std::min(low / nearest, low / furthest);
+        float b = scale * std::max(high / nearest, high / furthest);
+        float ndcMin = std::min(a, b);
+        float ndcMax = std::max(a, b);
+        first = static_cast<uint32_t>(std::min(std::max((ndcMin + 1.0f) * 0.5f * tiles, 0.0f), tiles - 1.0f));
+        last = static_cast<uint32_t>(std::min(std::max((ndcMax + 1.0f) * 0.5f * tiles, 0.0f), tiles - 1.0f));
+    };
+
+    std::vector<glm::uvec2>& hits = sliceHits[slice];
+    hits.clear();
+    for (uint32_t light : sliceLights[slice]) {
+        const glm::vec4& positionRadius = gpuLights[light].positionRadius;
+        glm::vec3 center(positionRadius.x, positionRadius.y, -positionRadius.z);
+        float radius = positionRadius.w;
+        float nearest = std::max(d0, center.z - radius);
+        float furthest = std::min(d1, center.z + radius);
+
+        uint32_t firstX, lastX, firstY, lastY;
+        tileRange(center.x - radius, center.x + radius, nearest, furthest, xScale, settings.tilesX, firstX, lastX);
+        tileRange(center.y - radius, center.y + radius, nearest, furthest, yScale, settings.tilesY, firstY, lastY);
+        for (uint32_t tileY = firstY; tileY <= lastY; tileY++) {
+            for (uint32_t tileX = firstX; tileX <= lastX; tileX++) {
+                uint32_t cluster = base + tileY * settings.tilesX + tileX;
+                glm::vec3 offset = glm::clamp(center, boxMin[cluster], boxMax[cluster]) - center;
+                if (glm::dot(offset, offset) > radius * radius) {
+                    continue;
+                }
+                hits.push_back(glm::uvec2(cluster, light));
+                clusterCounts[cluster]++;
+            }
+        }
+    }
+
+    // Grouped by cluster with a counting sort, each cluster keeps its lights in index order
+    uint32_t start = 0;
+    for (uint32_t cluster = base; cluster < base + tileCount; cluster++) {
+        clusterStarts[cluster] = start;
+        start += clusterCounts[cluster];
+    }
+    std::vector<uint32_t>& lights = sliceIndices[slice];
+    lights.resize(hits.size());
+    for (const glm::uvec2& hit : hits) {
+        lights[clusterStarts[hit.x]++] = hit.y;
+    }
+    for (uint32_t cluster = base; cluster < base + tileCount; cluster++) {
+        clusterStarts[cluster] -= clusterCounts[cluster];
+    }
+}
+
+LightClusters::GPUGrid LightClusters::getGrid(uint32_t width, uint32_t height, const glm::vec3& ambient) const {
+    GPUGrid grid{};
+    grid.tilesX = settings.tilesX;
+    grid.tilesY = settings.tilesY;
+    grid.slices = settings.slices;
+    grid.lightCount = static_cast<uint32_t>(gpuLights.size());
+    grid.sliceScale = settings.slices / std::log(farDepth / nearDepth);
+    grid.sliceBias = -std::log(nearDepth) * grid.sliceScale;
+    grid.tileWidth = float(width) / settings.tilesX;
+    grid.tileHeight = float(height) / settings.tilesY;
+    grid.ambient = glm::vec4(ambient, 0.0f);
+    return grid;
+}
+
+uint32_t LightClusters::findCluster(const glm::vec3& viewPosition) const {
+    float depth = -viewPosition.z;
+    if (depth < nearDepth || depth >= farDepth) {
+        return UINT32_MAX;
+    }
+    float sliceScale = settings.slices / std::log(farDepth / nearDepth);
+    uint32_t slice = std::min(static_cast<uint32_t>(std::log(depth / nearDepth) * sliceScale), settings.slices - 1);
+    float tileX = (xScale * viewPosition.x / depth + 1.0f) * 0.5f * settings.tilesX;
+    float tileY = (yScale * viewPosition.y / depth + 1.0f) * 0.5f * settings.tilesY;
+    if (tileX < 0.0f || tileX >= settings.tilesX || tileY < 0.0f || tileY >= settings.tilesY) {
+        return UINT32_MAX;
+    }
+    return (slice * settings.tilesY + static_cast<uint32_t>(tileY)) * settings.tilesX + static_cast<uint32_t>(tileX);
+}
+
+std::vector<PointLight> LightClusters::scatterLights(uint32_t count, const glm::vec3& minimum, const glm::vec3& maximum, float averageOverlap, uint32_t seed) {
+    // count * 4/3 pi r^3 = averageOverlap * volume, with 1.25 the mean of the cubed radius scale drawn below
+    glm::vec3 size = maximum - minimum;
+    float volume = size.x * size.y * size.z;
+    float radius = std::cbrt(3.0f * averageOverlap * volume / (4.0f * 3.14159265f * std::max(count, 1u) * 1.25f));
+
+    std::mt19937 random(seed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::vector<PointLight> lights(count);
+    for (PointLight& light : lights) {
+        light.position = minimum + size * glm::vec3(unit(random), unit(random), unit(random));
+        light.radius = radius * (0.5f + unit(random));
+        light.color = glm::vec3(0.2f + 0.8f * unit(random), 0.2f + 0.8f * unit(random), 0.2f + 0.8f * unit(random));
+        light.intensity = 1.0f;
+    }
+    return lights;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+BENCHMARK
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void LightClusters::runBenchmark() {
+    const uint32_t lightCount = 10000;
+    const uint32_t width = 1920;
+    const uint32_t height = 1080;
+    const int builds = 50;
+    const int samplePoints = 200000;
+
+    // A street level camera looking down a city block full of small lights
+    glm::vec3 minimum(-100.0f, 0.0f, -100.0f);
+    glm::vec3 maximum(100.0f, 30.0f, 100.0f);
+    std::vector<PointLight> lights = scatterLights(lightCount, minimum, maximum, 8.0f, 5);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 2.0f, -95.0f), glm::vec3(0.0f, 8.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 proj = glm::perspective(glm::radians(60.0f), width / float(height), 0.1f, 250.0f);
+    proj[1][1] *= -1;
+
+    LightClusters clusterer;
+    const Settings& settings = clusterer.getSettings();
+    JobSystem jobs;
+    LinearArena scratch;
+    printf("%u point lights, %ux%ux%u clusters, SIMD %s, %u threads \n", lightCount, settings.tilesX, settings.tilesY, settings.slices,
+        SIMDMath::kernelName(SIMDMath::bestKernel()), jobs.threadCount());
+
+    for (JobSystem* threads : { static_cast<JobSystem*>(nullptr), &jobs }) {
+        std::vector<double> times;
+        for (int run = 0; run < builds; run++) {
+            auto start = std::chrono::high_resolution_clock::now();
+            clusterer.build(lights, view, proj, threads, scratch);
+            auto end = std::chrono::high_resolution_clock::now();
+            times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+        }
+        std::nth_element(times.begin(), times.begin() + times.size() / 2, times.end());
+        printf("    build %-12s %6.3f ms median \n", threads ? "job system" : "one thread", times[times.size() / 2]);
+    }
+
+    const Stats& stats = clusterer.getStats();
+    printf("    %u lights in view, %u assignments, %u of %u clusters lit, %.1f lights per lit cluster, %u at most \n",
+        stats.visibleLights, stats.assignments, stats.occupiedClusters, clusterer.clusterCount(),
+        stats.occupiedClusters ? double(stats.assignments) / stats.occupiedClusters : 0.0, stats.maxClusterLights);
+
+    // Points inside the view, as a fragment would see them. Every light that reaches one must be in its cluster
+    std::mt19937 random(11);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    uint64_t iterations = 0;
+    uint64_t reaching = 0;
+    uint64_t missed = 0;
+    int tested = 0;
+    while (tested < samplePoints) {
+        glm::vec3 world = minimum + (maximum - minimum) * glm::vec3(unit(random), unit(random), unit(random));
+        glm::vec3 viewPosition(view * glm::vec4(world, 1.0f));
+        uint32_t cluster = clusterer.findCluster(viewPosition);
+        if (cluster == UINT32_MAX) {
+            continue;
+        }
+        tested++;
+        glm::uvec2 range = clusterer.getClusters()[cluster];
+        iterations += range.y;
+        for (uint32_t light = 0; light < lightCount; light++) {
+            glm::vec3 offset = lights[light].position - world;
+            if (glm::dot(offset, offset) >= lights[light].radius * lights[light].radius) {
+                continue;
+            }
+            reaching++;
+            const uint32_t* first = clusterer.getIndices().data() + range.x;
+            if (std::find(first, first + range.y, light) == first + range.y) {
+                missed++;
+            }
+        }
+    }
+    printf("    %d points in view: %.1f lights looped over per point against %u unclustered, %.1f of them reach it, %llu missed \n",
+        tested, double(iterations) / tested, lightCount, double(reaching) / tested, (unsigned long long)missed);
+}
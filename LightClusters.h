@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "glm-0.9.6.3/glm.hpp"
+
+class JobSystem;
+class LinearArena;
+
+// Point light in world space, it reaches nothing past its radius
+struct PointLight {
+	glm::vec3 position{ 0.0f };
+	float radius = 1.0f;
+	glm::vec3 color{ 1.0f };
+	float intensity = 1.0f;
+};
+
+// Splits the view frustum into screen tiles and exponentially spaced depth slices and lists the point lights that reach
+// each of those clusters, so a fragment only loops over the lights of its own cluster instead of all of them.
+// Built on the CPU every frame: the light positions go to view space with the SIMD kernels, then every depth slice is
+// filled on its own job, testing each light's sphere against the boxes of the clusters it projects onto
+class LightClusters {
+
+public:
+	struct Settings {
+		uint32_t tilesX = 16;
+		uint32_t tilesY = 9;
+		uint32_t slices = 24;
+	};
+
+	// Layouts read by shader.frag as std430 storage buffers
+	struct GPULight {
+		// View space position and radius
+		glm::vec4 positionRadius;
+		// Color times intensity
+		glm::vec4 color;
+	};
+
+	// Start of the cluster buffer, followed by an offset into the index list and a light count for every cluster.
+	// Clusters are ordered by tile x, then tile y counted from the top of the screen, then slice
+	struct GPUGrid {
+		uint32_t tilesX;
+		uint32_t tilesY;
+		uint32_t slices;
+		uint32_t lightCount;
+		// slice = log(view depth) * sliceScale + sliceBias
+		float sliceScale;
+		float sliceBias;
+		// Render target pixels per tile, gl_FragCoord divided by these is the tile
+		float tileWidth;
+		float tileHeight;
+		// Light every surface gets, rgb
+		glm::vec4 ambient;
+	};
+
+	struct Stats {
+		// Lights whose sphere touches the frustum
+		uint32_t visibleLights = 0;
+		// Entries in the index list over all clusters
+		uint32_t assignments = 0;
+		uint32_t occupiedClusters = 0;
+		uint32_t maxClusterLights = 0;
+	};
+
+	LightClusters();
+	explicit LightClusters(const Settings& settings);
+
+	// Assign the lights for a view and a glm::perspective projection, near and far are read back from the matrix.
+	// The slices are spread over the job system when one is given, the light positions and slice offsets live in scratch
+	// until the call returns
+	void build(const std::vector<PointLight>& lights, const glm::mat4& view, const glm::mat4& proj, JobSystem* jobs, LinearArena& scratch);
+
+	// Grid header for a render target of this size, the clusters cover it whatever resolution it is drawn at
+	GPUGrid getGrid(uint32_t width, uint32_t height, const glm::vec3& ambient) const;
+	// Written by build, in the layouts the shader reads
+	const std::vector<GPULight>& getLights() const { return gpuLights; }
+	// Offset and count of every cluster
+	const std::vector<glm::uvec2>& getClusters() const { return clusters; }
+	// Sized by what the clusters hold this frame, no cluster has a cap
+	const std::vector<uint32_t>& getIndices() const { return indices; }
+	const Stats& getStats() const { return stats; }
+
+	uint32_t clusterCount() const { return settings.tilesX * settings.tilesY * settings.slices; }
+	// Cluster a view space position falls in, found the same way shader.frag finds it, or UINT32_MAX outside the grid
+	uint32_t findCluster(const glm::vec3& viewPosition) const;
+
+	const Settings& getSettings() const { return settings; }
+	void setSettings(const Settings& newSettings);
+
+	// Lights at random in a box, with radii picked so that a point in it is reached by about averageOverlap of them
+	static std::vector<PointLight> scatterLights(uint32_t count, const glm::vec3& minimum, const glm::vec3& maximum, float averageOverlap, uint32_t seed);
+
+	// 10k point lights through a city sized box, built on one thread and across the job system. Every light reaching
+	// random points in the view is checked to be in the point's cluster
+	static void runBenchmark();
+
+private:
+	// View space cluster boxes, only rebuilt when the projection or the grid changes
+	void buildClusterBoxes(float xScale, float yScale, float nearDepth, float farDepth);
+	void fillSlice(uint32_t slice);
+
+	Settings settings;
+
+	// Box of every cluster with depth counted positive into the screen
+	std::vector<glm::vec3> boxMin;
+	std::vector<glm::vec3> boxMax;
+	// Depth where each slice starts, slices + 1 entries
+	std::vector<float> sliceDepths;
+	float xScale = 0.0f;
+	float yScale = 0.0f;
+	float nearDepth = 0.0f;
+	float farDepth = 0.0f;
+
+	// Per frame scratch filled by the slice jobs, kept here rather than in the caller's arena which only one thread may
+	// allocate from
+	std::vector<std::vector<uint32_t>> sliceLights;
+	// Cluster and light of every assignment in a slice, then the slice's lights grouped by cluster
+	std::vector<std::vector<glm::uvec2>> sliceHits;
+	std::vector<std::vector<uint32_t>> sliceIndices;
+	std::vector<uint32_t> clusterCounts;
+	// Where each cluster's lights start in its slice's list
+	std::vector<uint32_t> clusterStarts;
+
+	std::vector<GPULight> gpuLights;
+	std::vector<glm::uvec2> clusters;
+	std::vector<uint32_t> indices;
+	Stats stats;
+};
@@ -0,0 +1,147 @@
+#include "MappedFile.h"
+#include <algorithm>
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(const std::string& path) {
+    open(path);
+}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept {
+    *this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    if (this != &other) {
+        close();
+        std::swap(bytes, other.bytes);
+        std::swap(length, other.length);
+#ifdef _WIN32
+        std::swap(fileHandle, other.fileHandle);
+        std::swap(mappingHandle, other.mappingHandle);
+#endif
+    }
+    return *this;
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::string& path) {
+    close();
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+        CloseHandle(file);
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) {
+        CloseHandle(file);
+        return false;
+    }
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!view) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+    fileHandle = file;
+    mappingHandle = mapping;
+    bytes = static_cast<const uint8_t*>(view);
+    length = static_cast<size_t>(fileSize.QuadPart);
+    return true;
+}
+
+void MappedFile::close() {
+    if (bytes) {
+        UnmapViewOfFile(bytes);
+        CloseHandle(mappingHandle);
+        CloseHandle(fileHandle);
+    }
+    bytes = nullptr;
+    length = 0;
+    fileHandle = nullptr;
+    mappingHandle = nullptr;
+}
+
+void MappedFile::prefetch(size_t offset, size_t size) const {
+    if (!bytes || offset >= length) {
+        return;
+    }
+    WIN32_MEMORY_RANGE_ENTRY range;
+    range.VirtualAddress = const_cast<uint8_t*>(bytes) + offset;
+    range.NumberOfBytes = std::min(size, length - offset);
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+}
+
+void MappedFile::adviseSequential() const {
+    prefetch(0, length);
+}
+
+#else
+
+bool MappedFile::open(const std::string& path) {
+    close();
+    int file = ::open(path.c_str(), O_RDONLY);
+    if (file < 0) {
+        return false;
+    }
+    struct stat status;
+    if (fstat(file, &status) != 0 || status.st_size == 0) {
+        ::close(file);
+        return false;
+    }
+    void* view = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+    // The mapping keeps the file referenced, the descriptor is not needed past this
+    ::close(file);
+    if (view == MAP_FAILED) {
+        return false;
+    }
+    bytes = static_cast<const uint8_t*>(view);
+    length = static_cast<size_t>(status.st_size);
+    return true;
+}
+
+void MappedFile::close() {
+    if (bytes) {
+        munmap(const_cast<uint8_t*>(bytes), length);
+    }
+    bytes = nullptr;
+    length = 0;
+}
+
+void MappedFile::prefetch(size_t offset, size_t size) const {
+    if (!bytes || offset >= length) {
+        return;
+    }
+    // madvise wants a page aligned start
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t start = offset / page * page;
+    size_t end = std::min(offset + size, length);
+    madvise(const_cast<uint8_t*>(bytes) + start, end - start, MADV_WILLNEED);
+}
+
+void MappedFile::adviseSequential() const {
+    if (bytes) {
+        madvise(const_cast<uint8_t*>(bytes), length, MADV_SEQUENTIAL);
+    }
+}
+
+#endif
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// A file mapped read only into memory, its bytes are paged in by the OS as they are touched instead of being read
+// into a buffer. Closed when destroyed, pointers into it are only valid while it is open
+class MappedFile {
+
+public:
+	MappedFile() = default;
+	// Check isOpen, a missing or empty file leaves it closed
+	explicit MappedFile(const std::string& path);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	MappedFile(MappedFile&& other) noexcept;
+	MappedFile& operator=(MappedFile&& other) noexcept;
+
+	bool open(const std::string& path);
+	void close();
+
+	bool isOpen() const { return bytes != nullptr; }
+	const uint8_t* data() const { return bytes; }
+	size_t size() const { return length; }
+
+	// Ask the OS to start reading a range about to be touched, so the first access does not stall on the disk
+	void prefetch(size_t offset, size_t size) const;
+	// The whole mapping will be read front to back, read ahead aggressively
+	void adviseSequential() const;
+
+private:
+	const uint8_t* bytes = nullptr;
+	size_t length = 0;
+#ifdef _WIN32
+	void* fileHandle = nullptr;
+	void* mappingHandle = nullptr;
+#endif
+};
@@ -0,0 +1,526 @@
+#include "MeshOptimizer.h"
+#include "Meshlet.h"
+#include <tiny_obj_loader.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <tuple>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+ANALYSIS
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+MeshOptimizer::VertexCacheStats MeshOptimizer::analyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize) {
+    VertexCacheStats stats;
+    if (indexCount == 0) {
+        return stats;
+    }
+
+    // A vertex is in the FIFO while fewer than cacheSize misses have happened since it was inserted
+    std::vector<uint32_t> insertedAt(vertexCount, 0);
+    std::vector<bool> referenced(vertexCount, false);
+    uint32_t misses = 0;
+    size_t uniqueVertices = 0;
+
+    for (size_t i = 0; i < indexCount; i++) {
+        uint32_t v = indices[i];
+        if (!referenced[v]) {
+            referenced[v] = true;
+            uniqueVertices++;
+        }
+
+        if (insertedAt[v] == 0 || misses + 1 - insertedAt[v] > cacheSize) {
+            misses++;
+            insertedAt[v] = misses;
+        }
+    }
+
+    stats.transformedVertices = misses;
+    stats.acmr = static_cast<float>(misses) / static_cast<float>(indexCount / 3);
+    stats.atvr = static_cast<float>(misses) / static_cast<float>(uniqueVertices);
+    return stats;
+}
+
+MeshOptimizer::VertexFetchStats MeshOptimizer::analyzeVertexFetch(const uint32_t* indices, size_t indexCount, size_t vertexCount, size_t vertexSize) {
+    VertexFetchStats stats;
+    if (indexCount == 0) {
+        return stats;
+    }
+
+    // Direct mapped 16 KB cache of 64 byte lines, roughly what sits in front of the vertex fetch units
+    const size_t lineSize = 64;
+    const size_t lineCount = 256;
+    std::vector<size_t> lines(lineCount, SIZE_MAX);
+    std::vector<bool> referenced(vertexCount, false);
+    size_t uniqueVertices = 0;
+
+    for (size_t i = 0; i < indexCount; i++) {
+        uint32_t v = indices[i];
+        if (!referenced[v]) {
+            referenced[v] = true;
+            uniqueVertices++;
+        }
+
+        size_t firstLine = (v * vertexSize) / lineSize;
+        size_t lastLine = (v * vertexSize + vertexSize - 1) / lineSize;
+        for (size_t line = firstLine; line <= lastLine; line++) {
+            size_t slot = line % lineCount;
+            if (lines[slot] != line) {
+                lines[slot] = line;
+                stats.bytesFetched += lineSize;
+            }
+        }
+    }
+
+    stats.overfetch = static_cast<float>(stats.bytesFetched) / static_cast<float>(uniqueVertices * vertexSize);
+    return stats;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+VERTEX CACHE OPTIMIZATION
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+    // Scoring constants from Forsyth's "Linear-Speed Vertex Cache Optimisation"
+    const uint32_t FORSYTH_CACHE_SIZE = 32;
+    const float FORSYTH_LAST_TRIANGLE_SCORE = 0.75f;
+    const float FORSYTH_CACHE_DECAY_POWER = 1.5f;
+    const float FORSYTH_VALENCE_BOOST_SCALE = 2.0f;
+    const float FORSYTH_VALENCE_BOOST_POWER = 0.5f;
+
+    float forsythVertexScore(int cachePosition, uint32_t liveTriangles) {
+        // Nothing left to draw with this vertex
+        if (liveTriangles == 0) {
+            return -1.0f;
+        }
+
+        float score = 0.0f;
+        if (cachePosition >= 0) {
+            // The vertices of the last triangle get a fixed score so the next triangle does not just reuse an edge
+            if (cachePosition < 3) {
+                score = FORSYTH_LAST_TRIANGLE_SCORE;
+            }
+            else {
+                float scaler = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+                score = std::pow(1.0f - (cachePosition - 3) * scaler, FORSYTH_CACHE_DECAY_POWER);
+            }
+        }
+
+        // Favour vertices with few triangles left so they are finished and leave the cache
+        score += FORSYTH_VALENCE_BOOST_SCALE * std::pow(static_cast<float>(liveTriangles), -FORSYTH_VALENCE_BOOST_POWER);
+        return score;
+    }
+}
+
+void MeshOptimizer::optimizeVertexCache(uint32_t* dst, const uint32_t* indices, size_t indexCount, size_t vertexCount) {
+    size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0) {
+        return;
+    }
+
+    // Copy the source so dst can alias it
+    std::vector<uint32_t> source(indices, indices + indexCount);
+
+    // Triangle adjacency for each vertex, the live triangles of vertex v are the first liveTriangles[v] entries
+    std::vector<uint32_t> liveTriangles(vertexCount, 0);
+    for (uint32_t index : source) {
+        liveTriangles[index]++;
+    }
+
+    std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; v++) {
+        adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveTriangles[v];
+    }
+
+    std::vector<uint32_t> adjacency(indexCount);
+    std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+    for (size_t t = 0; t < triangleCount; t++) {
+        for (size_t k = 0; k < 3; k++) {
+            adjacency[fill[source[t * 3 + k]]++] = static_cast<uint32_t>(t);
+        }
+    }
+
+    std::vector<int> cachePosition(vertexCount, -1);
+    std::vector<float> vertexScore(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++) {
+        vertexScore[v] = forsythVertexScore(-1, liveTriangles[v]);
+    }
+
+    std::vector<bool> emitted(triangleCount, false);
+
+    // Room for the three vertices of the new triangle ahead of the existing entries
+    uint32_t cache[FORSYTH_CACHE_SIZE + 3];
+    uint32_t newCache[FORSYTH_CACHE_SIZE + 3];
+    size_t cacheCount = 0;
+
+    size_t inputCursor = 0;
+    uint32_t bestTriangle = 0;
+    bool haveBest = true;
+
+    for (size_t output = 0; output < triangleCount; output++) {
+        // Nothing in the cache has triangles left, restart from the first triangle not yet drawn
+        if (!haveBest) {
+            while (emitted[inputCursor]) {
+                inputCursor++;
+            }
+            bestTriangle = static_cast<uint32_t>(inputCursor);
+        }
+
+        const uint32_t* tri = &source[bestTriangle * 3];
+        dst[output * 3 + 0] = tri[0];
+        dst[output * 3 + 1] = tri[1];
+        dst[output * 3 + 2] = tri[2];
+        emitted[bestTriangle] = true;
+
+        // Drop the triangle from the adjacency of its vertices
+        for (size_t k = 0; k < 3; k++) {
+            uint32_t v = tri[k];
+            uint32_t* begin = &adjacency[adjacencyOffsets[v]];
+            uint32_t* end = begin + liveTriangles[v];
+            uint32_t* found = std::find(begin, end, bestTriangle);
+            std::swap(*found, *(end - 1));
+            liveTriangles[v]--;
+        }
+
+        // The drawn triangle moves to the front of the LRU cache
+        size_t newCount = 0;
+        newCache[newCount++] = tri[0];
+        newCache[newCount++] = tri[1];
+        newCache[newCount++] = tri[2];
+        for (size_t i = 0; i < cacheCount; i++) {
+            uint32_t v = cache[i];
+            if (v != tri[0] && v != tri[1] && v != tri[2]) {
+                newCache[newCount++] = v;
+            }
+        }
+
+        // Anything past the cache size has been evicted
+        for (size_t i = FORSYTH_CACHE_SIZE; i < newCount; i++) {
+            uint32_t v = newCache[i];
+            cachePosition[v] = -1;
+            vertexScore[v] = forsythVertexScore(-1, liveTriangles[v]);
+        }
+        cacheCount = std::min(newCount, static_cast<size_t>(FORSYTH_CACHE_SIZE));
+        std::copy(newCache, newCache + cacheCount, cache);
+
+        for (size_t i = 0; i < cacheCount; i++) {
+            uint32_t v = cache[i];
+            cachePosition[v] = static_cast<int>(i);
+            vertexScore[v] = forsythVertexScore(static_cast<int>(i), liveTriangles[v]);
+        }
+
+        // Only triangles touching the cache changed score, the best next triangle is one of them
+        haveBest = false;
+        float bestScore = -1.0f;
+        for (size_t i = 0; i < cacheCount; i++) {
+            uint32_t v = cache[i];
+            for (uint32_t a = 0; a < liveTriangles[v]; a++) {
+                uint32_t t = adjacency[adjacencyOffsets[v] + a];
+                const uint32_t* candidate = &source[t * 3];
+                float score = vertexScore[candidate[0]] + vertexScore[candidate[1]] + vertexScore[candidate[2]];
+                if (score > bestScore) {
+                    bestScore = score;
+                    bestTriangle = t;
+                    haveBest = true;
+                }
+            }
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+OVERDRAW OPTIMIZATION
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+    // Count the misses one triangle causes in a FIFO cache, timestamps are relative to the start of the cluster
+    uint32_t simulateTriangle(const uint32_t* tri, std::vector<uint32_t>& insertedAt, uint32_t& time, uint32_t cacheSize) {
+        uint32_t misses = 0;
+        for (size_t k = 0; k < 3; k++) {
+            uint32_t v = tri[k];
+            if (insertedAt[v] == 0 || time + 1 - insertedAt[v] > cacheSize) {
+                time++;
+                insertedAt[v] = time;
+                misses++;
+            }
+        }
+        return misses;
+    }
+
+    struct Cluster {
+        size_t firstTriangle;
+        size_t triangleCount;
+        float sortKey;
+    };
+}
+
+void MeshOptimizer::optimizeOverdraw(uint32_t* dst, const uint32_t* indices, size_t indexCount, const float* positions, size_t positionStride, size_t vertexCount, float threshold) {
+    const uint32_t cacheSize = 16;
+    size_t triangleCount = indexCount / 3;
+    if (triangleCount == 0) {
+        return;
+    }
+
+    std::vector<uint32_t> source(indices, indices + indexCount);
+    size_t floatStride = positionStride / sizeof(float);
+
+    // Hard boundaries sit where the cache optimizer jumped to an unconnected triangle, splitting there costs nothing
+    std::vector<size_t> hardBoundaries;
+    {
+        std::vector<uint32_t> insertedAt(vertexCount, 0);
+        uint32_t time = 0;
+        for (size_t t = 0; t < triangleCount; t++) {
+            if (simulateTriangle(&source[t * 3], insertedAt, time, cacheSize) == 3) {
+                hardBoundaries.push_back(t);
+            }
+        }
+        hardBoundaries.push_back(triangleCount);
+    }
+
+    // Soft boundaries split a hard cluster further once the cache miss ratio with a cold cache is within the threshold
+    std::vector<Cluster> clusters;
+    std::vector<uint32_t> insertedAt(vertexCount, 0);
+    for (size_t h = 0; h + 1 < hardBoundaries.size(); h++) {
+        size_t hardStart = hardBoundaries[h];
+        size_t hardEnd = hardBoundaries[h + 1];
+
+        std::fill(insertedAt.begin(), insertedAt.end(), 0);
+        uint32_t time = 0;
+        uint32_t hardMisses = 0;
+        for (size_t t = hardStart; t < hardEnd; t++) {
+            hardMisses += simulateTriangle(&source[t * 3], insertedAt, time, cacheSize);
+        }
+        float target = threshold * static_cast<float>(hardMisses) / static_cast<float>(hardEnd - hardStart);
+
+        std::fill(insertedAt.begin(), insertedAt.end(), 0);
+        time = 0;
+        uint32_t misses = 0;
+        size_t start = hardStart;
+        for (size_t t = hardStart; t < hardEnd; t++) {
+            misses += simulateTriangle(&source[t * 3], insertedAt, time, cacheSize);
+            size_t count = t + 1 - start;
+            if (t + 1 < hardEnd && static_cast<float>(misses) / static_cast<float>(count) <= target) {
+                clusters.push_back({ start, count, 0.0f });
+                start = t + 1;
+                misses = 0;
+                time = 0;
+                std::fill(insertedAt.begin(), insertedAt.end(), 0);
+            }
+        }
+        clusters.push_back({ start, hardEnd - start, 0.0f });
+    }
+
+    auto position = [&](uint32_t v, size_t axis) {
+        return positions[v * floatStride + axis];
+    };
+
+    // Area weighted centroid of the whole mesh
+    float meshCentroid[3] = { 0.0f, 0.0f, 0.0f };
+    float meshArea = 0.0f;
+    std::vector<float> clusterData(clusters.size() * 7, 0.0f);
+    for (size_t c = 0; c < clusters.size(); c++) {
+        float* data = &clusterData[c * 7];
+        for (size_t t = clusters[c].firstTriangle; t < clusters[c].firstTriangle + clusters[c].triangleCount; t++) {
+            const uint32_t* tri = &source[t * 3];
+            float e1[3], e2[3];
+            for (size_t a = 0; a < 3; a++) {
+                e1[a] = position(tri[1], a) - position(tri[0], a);
+                e2[a] = position(tri[2], a) - position(tri[0], a);
+            }
+            float normal[3] = {
+                e1[1] * e2[2] - e1[2] * e2[1],
+                e1[2] * e2[0] - e1[0] * e2[2],
+                e1[0] * e2[1] - e1[1] * e2[0]
+            };
+            float area = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+
+            for (size_t a = 0; a < 3; a++) {
+                float centroid = (position(tri[0], a) + position(tri[1], a) + position(tri[2], a)) / 3.0f;
+                // Cluster centroid, summed area weighted normal and total area
+                data[a] += centroid * area;
+                data[3 + a] += normal[a];
+                meshCentroid[a] += centroid * area;
+            }
+            data[6] += area;
+            meshArea += area;
+        }
+    }
+
+    if (meshArea > 0.0f) {
+        for (size_t a = 0; a < 3; a++) {
+            meshCentroid[a] /= meshArea;
+        }
+    }
+
+    // Clusters far from the centre and facing away from it are likely to occlude the rest, so they are drawn first
+    for (size_t c = 0; c < clusters.size(); c++) {
+        const float* data = &clusterData[c * 7];
+        float normalLength = std::sqrt(data[3] * data[3] + data[4] * data[4] + data[5] * data[5]);
+        if (data[6] <= 0.0f || normalLength <= 0.0f) {
+            continue;
+        }
+
+        float key = 0.0f;
+        for (size_t a = 0; a < 3; a++) {
+            key += (data[a] / data[6] - meshCentroid[a]) * (data[3 + a] / normalLength);
+        }
+        clusters[c].sortKey = key;
+    }
+
+    std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& a, const Cluster& b) {
+        return a.sortKey > b.sortKey;
+    });
+
+    size_t output = 0;
+    for (const Cluster& cluster : clusters) {
+        std::copy(source.begin() + cluster.firstTriangle * 3, source.begin() + (cluster.firstTriangle + cluster.triangleCount) * 3, dst + output);
+        output += cluster.triangleCount * 3;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+VERTEX FETCH OPTIMIZATION
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+size_t MeshOptimizer::optimizeVertexFetchRemap(std::vector<uint32_t>& remap, uint32_t* indices, size_t indexCount, size_t vertexCount) {
+    remap.assign(vertexCount, UINT32_MAX);
+
+    // Vertices that are never referenced are dropped
+    uint32_t next = 0;
+    for (size_t i = 0; i < indexCount; i++) {
+        uint32_t& newIndex = remap[indices[i]];
+        if (newIndex == UINT32_MAX) {
+            newIndex = next++;
+        }
+        indices[i] = newIndex;
+    }
+
+    return next;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+BENCHMARK
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+    struct BenchmarkMesh {
+        std::vector<float> positions;
+        std::vector<uint32_t> indices;
+    };
+
+    // Weld OBJ corners that share position, normal and texture coordinate indices into one vertex
+    bool loadBenchmarkMesh(const std::filesystem::path& path, BenchmarkMesh& mesh) {
+        tinyobj::attrib_t attrib;
+        std::vector<tinyobj::shape_t> shapes;
+        std::vector<tinyobj::material_t> materials;
+        std::string warn, err;
+
+        std::string baseDir = path.parent_path().string() + "/";
+        if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, path.string().c_str(), baseDir.c_str())) {
+            std::cerr << path.string() << ": " << warn << err << std::endl;
+            return false;
+        }
+
+        std::map<std::tuple<int, int, int>, uint32_t> unique;
+        for (const auto& shape : shapes) {
+            for (const auto& index : shape.mesh.indices) {
+                auto key = std::make_tuple(index.vertex_index, index.normal_index, index.texcoord_index);
+                auto found = unique.find(key);
+                if (found == unique.end()) {
+                    uint32_t vertex = static_cast<uint32_t>(mesh.positions.size() / 3);
+                    found = unique.emplace(key, vertex).first;
+                    mesh.positions.push_back(attrib.vertices[3 * index.vertex_index + 0]);
+                    mesh.positions.push_back(attrib.vertices[3 * index.vertex_index + 1]);
+                    mesh.positions.push_back(attrib.vertices[3 * index.vertex_index + 2]);
+                }
+                mesh.indices.push_back(found->second);
+            }
+        }
+
+        return !mesh.indices.empty();
+    }
+
+    void printStats(const char* stage, const std::vector<uint32_t>& indices, size_t vertexCount) {
+        // Fetch statistics use the 16 byte split quantized vertex, what the renderer actually reads
+        MeshOptimizer::VertexCacheStats cache = MeshOptimizer::analyzeVertexCache(indices.data(), indices.size(), vertexCount);
+        MeshOptimizer::VertexFetchStats fetch = MeshOptimizer::analyzeVertexFetch(indices.data(), indices.size(), vertexCount, 16);
+        printf("    %-10s ACMR %.3f  ATVR %.3f  overfetch %.3f \n", stage, cache.acmr, cache.atvr, fetch.overfetch);
+    }
+}
+
+void MeshOptimizer::runBenchmark(const std::string& directory) {
+    std::vector<std::filesystem::path> files;
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(directory, error)) {
+        if (entry.is_regular_file() && entry.path().extension() == ".obj") {
+            files.push_back(entry.path());
+        }
+    }
+    std::sort(files.begin(), files.end());
+
+    if (error || files.empty()) {
+        printf("No OBJ models found in %s \n", directory.c_str());
+        return;
+    }
+
+    for (const auto& file : files) {
+        BenchmarkMesh mesh;
+        if (!loadBenchmarkMesh(file, mesh)) {
+            continue;
+        }
+        size_t vertexCount = mesh.positions.size() / 3;
+
+        printf("%s: %zu triangles, %zu vertices \n", file.filename().string().c_str(), mesh.indices.size() / 3, vertexCount);
+        printStats("original", mesh.indices, vertexCount);
+
+        auto start = std::chrono::high_resolution_clock::now();
+        optimizeVertexCache(mesh.indices.data(), mesh.indices.data(), mesh.indices.size(), vertexCount);
+        auto cacheDone = std::chrono::high_resolution_clock::now();
+        printStats("cache", mesh.indices, vertexCount);
+
+        optimizeOverdraw(mesh.indices.data(), mesh.indices.data(), mesh.indices.size(), mesh.positions.data(), sizeof(float) * 3, vertexCount);
+        auto overdrawDone = std::chrono::high_resolution_clock::now();
+        printStats("overdraw", mesh.indices, vertexCount);
+
+        std::vector<uint32_t> remap;
+        size_t usedVertices = optimizeVertexFetchRemap(remap, mesh.indices.data(), mesh.indices.size(), vertexCount);
+        auto fetchDone = std::chrono::high_resolution_clock::now();
+        printStats("fetch", mesh.indices, usedVertices);
+
+        std::vector<float> positions(usedVertices * 3);
+        for (size_t v = 0; v < vertexCount; v++) {
+            if (remap[v] != UINT32_MAX) {
+                std::copy(&mesh.positions[v * 3], &mesh.positions[v * 3 + 3], &positions[remap[v] * 3]);
+            }
+        }
+
+        std::vector<Meshlet> meshlets = MeshletBuilder::build(mesh.indices.data(), mesh.indices.size(), 0, positions.data(), sizeof(float) * 3, usedVertices);
+        size_t meshletVertices = 0;
+        size_t coneCullable = 0;
+        for (const Meshlet& meshlet : meshlets) {
+            meshletVertices += meshlet.vertexCount;
+            coneCullable += meshlet.coneCutoff < 1.0f ? 1 : 0;
+        }
+        printf("    meshlets: %zu, %.1f triangles and %.1f vertices each, %zu with a usable normal cone \n", meshlets.size(),
+            (double)mesh.indices.size() / 3 / meshlets.size(), (double)meshletVertices / meshlets.size(), coneCullable);
+
+        auto ms = [](auto from, auto to) {
+            return std::chrono::duration<double, std::milli>(to - from).count();
+        };
+        printf("    time: cache %.2f ms, overdraw %.2f ms, fetch %.2f ms \n", ms(start, cacheDone), ms(cacheDone, overdrawDone), ms(overdrawDone, fetchDone));
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Index and vertex reordering run on imported meshes so the GPU transforms and fetches fewer vertices
+namespace MeshOptimizer {
+
+	// Post-transform cache statistics for an index buffer
+	struct VertexCacheStats {
+		// Average cache miss ratio, transformed vertices per triangle (0.5 is ideal, 3.0 is the worst case)
+		float acmr = 0.0f;
+		// Average transform to vertex ratio, transformed vertices per referenced vertex (1.0 is ideal)
+		float atvr = 0.0f;
+		uint32_t transformedVertices = 0;
+	};
+
+	// Pre-transform vertex fetch statistics, how many bytes are pulled through a small line cache per vertex byte used
+	struct VertexFetchStats {
+		float overfetch = 0.0f;
+		uint64_t bytesFetched = 0;
+	};
+
+	// Simulate a FIFO post-transform cache, the model most hardware is closest to
+	VertexCacheStats analyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize = 16);
+	VertexFetchStats analyzeVertexFetch(const uint32_t* indices, size_t indexCount, size_t vertexCount, size_t vertexSize);
+
+	// Tom Forsyth's linear-speed vertex cache optimization, dst may alias indices
+	void optimizeVertexCache(uint32_t* dst, const uint32_t* indices, size_t indexCount, size_t vertexCount);
+
+	// Split cache optimized triangles into clusters and sort them so outward facing clusters draw first,
+	// threshold bounds how much the cache miss ratio may grow (1.05 allows 5%)
+	void optimizeOverdraw(uint32_t* dst, const uint32_t* indices, size_t indexCount, const float* positions, size_t positionStride, size_t vertexCount, float threshold = 1.05f);
+
+	// Order vertices by first use, fills remap with the new position of every old vertex and rewrites the indices in place
+	size_t optimizeVertexFetchRemap(std::vector<uint32_t>& remap, uint32_t* indices, size_t indexCount, size_t vertexCount);
+
+	template <typename T>
+	void optimizeVertexFetch(std::vector<T>& vertices, std::vector<uint32_t>& indices) {
+		std::vector<uint32_t> remap;
+		size_t usedVertices = optimizeVertexFetchRemap(remap, indices.data(), indices.size(), vertices.size());
+
+		std::vector<T> reordered(usedVertices);
+		for (size_t i = 0; i < vertices.size(); i++) {
+			if (remap[i] != UINT32_MAX) {
+				reordered[remap[i]] = vertices[i];
+			}
+		}
+		vertices.swap(reordered);
+	}
+
+	// Load every OBJ in a directory and print cache and fetch statistics before and after optimization
+	void runBenchmark(const std::string& directory);
+}
@@ -0,0 +1,457 @@
+#include "MeshSimplifier.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+QUADRICS
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+    struct Vec3 {
+        float x, y, z;
+    };
+
+    Vec3 sub(const Vec3& a, const Vec3& b) {
+        return { a.x - b.x, a.y - b.y, a.z - b.z };
+    }
+
+    Vec3 cross(const Vec3& a, const Vec3& b) {
+        return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x };
+    }
+
+    float dot(const Vec3& a, const Vec3& b) {
+        return a.x * b.x + a.y * b.y + a.z * b.z;
+    }
+
+    float length(const Vec3& a) {
+        return std::sqrt(dot(a, a));
+    }
+
+    // Sum of weighted squared distances to a set of planes, stored as the symmetric 4x4 matrix of Garland and Heckbert
+    struct Quadric {
+        double a00 = 0, a11 = 0, a22 = 0, a01 = 0, a02 = 0, a12 = 0;
+        double b0 = 0, b1 = 0, b2 = 0;
+        double c = 0;
+        double weight = 0;
+
+        static Quadric fromPlane(const Vec3& n, float d, float w) {
+            Quadric q;
+            q.a00 = w * n.x * n.x;
+            q.a11 = w * n.y * n.y;
+            q.a22 = w * n.z * n.z;
+            q.a01 = w * n.x * n.y;
+            q.a02 = w * n.x * n.z;
+            q.a12 = w * n.y * n.z;
+            q.b0 = w * n.x * d;
+            q.b1 = w * n.y * d;
+            q.b2 = w * n.z * d;
+            q.c = w * d * d;
+            q.weight = w;
+            return q;
+        }
+
+        void add(const Quadric& q) {
+            a00 += q.a00; a11 += q.a11; a22 += q.a22;
+            a01 += q.a01; a02 += q.a02; a12 += q.a12;
+            b0 += q.b0; b1 += q.b1; b2 += q.b2;
+            c += q.c;
+            weight += q.weight;
+        }
+
+        // Weighted mean squared distance from p to the planes
+        float error(const Vec3& p) const {
+            double rx = a00 * p.x + a01 * p.y + a02 * p.z + 2.0 * b0;
+            double ry = a01 * p.x + a11 * p.y + a12 * p.z + 2.0 * b1;
+            double rz = a02 * p.x + a12 * p.y + a22 * p.z + 2.0 * b2;
+            double e = rx * p.x + ry * p.y + rz * p.z + c;
+            return weight > 0.0 ? static_cast<float>(std::abs(e) / weight) : 0.0f;
+        }
+    };
+
+    // Boundary planes count more than surface planes, collapses that pull a border or seam inwards are expensive
+    const float BOUNDARY_WEIGHT = 10.0f;
+
+    enum class VertexKind {
+        // Interior vertex, may collapse onto any neighbour
+        Manifold,
+        // On an open edge, may only collapse along that edge
+        Border,
+        // One of two vertices sharing a position across a UV or normal seam, collapses together with its twin
+        Seam,
+        // Corners and vertices shared by more than two seams are never removed
+        Locked
+    };
+
+    uint64_t edgeKey(uint32_t a, uint32_t b) {
+        return (static_cast<uint64_t>(a) << 32) | b;
+    }
+
+    struct Collapse {
+        uint32_t from;
+        uint32_t to;
+        float error;
+    };
+}
+
+float MeshSimplifier::errorScale(const float* positions, size_t positionStride, size_t vertexCount) {
+    if (vertexCount == 0) {
+        return 0.0f;
+    }
+
+    size_t floatStride = positionStride / sizeof(float);
+    float minimum[3] = { positions[0], positions[1], positions[2] };
+    float maximum[3] = { positions[0], positions[1], positions[2] };
+    for (size_t v = 0; v < vertexCount; v++) {
+        for (size_t a = 0; a < 3; a++) {
+            minimum[a] = std::min(minimum[a], positions[v * floatStride + a]);
+            maximum[a] = std::max(maximum[a], positions[v * floatStride + a]);
+        }
+    }
+
+    return std::max(maximum[0] - minimum[0], std::max(maximum[1] - minimum[1], maximum[2] - minimum[2]));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+SIMPLIFICATION
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+size_t MeshSimplifier::simplify(uint32_t* dst, const uint32_t* indices, size_t indexCount, const float* positions, size_t positionStride, size_t vertexCount,
+    size_t targetIndexCount, float targetError, float* resultError) {
+    std::vector<uint32_t> current(indices, indices + indexCount);
+    if (resultError) {
+        *resultError = 0.0f;
+    }
+
+    // Work in a unit cube so the errors are relative to the size of the mesh
+    float extent = errorScale(positions, positionStride, vertexCount);
+    float invExtent = extent > 0.0f ? 1.0f / extent : 0.0f;
+    size_t floatStride = positionStride / sizeof(float);
+    std::vector<Vec3> position(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++) {
+        const float* p = &positions[v * floatStride];
+        position[v] = { p[0] * invExtent, p[1] * invExtent, p[2] * invExtent };
+    }
+
+    // Vertices with bitwise equal positions are copies split by an attribute seam, linked in a ring through wedge
+    std::vector<uint32_t> remap(vertexCount);
+    std::vector<uint32_t> wedge(vertexCount);
+    {
+        struct PositionHash {
+            size_t operator()(const Vec3& p) const {
+                uint32_t bits[3];
+                std::memcpy(bits, &p, sizeof(bits));
+                return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+            }
+        };
+        struct PositionEqual {
+            bool operator()(const Vec3& a, const Vec3& b) const {
+                return std::memcmp(&a, &b, sizeof(Vec3)) == 0;
+            }
+        };
+
+        std::unordered_map<Vec3, uint32_t, PositionHash, PositionEqual> firstWithPosition;
+        firstWithPosition.reserve(vertexCount);
+        for (uint32_t v = 0; v < vertexCount; v++) {
+            uint32_t first = firstWithPosition.emplace(position[v], v).first->second;
+            remap[v] = first;
+            if (first == v) {
+                wedge[v] = v;
+            }
+            else {
+                wedge[v] = wedge[first];
+                wedge[first] = v;
+            }
+        }
+    }
+
+    std::unordered_set<uint64_t> edges;
+    auto buildEdges = [&]() {
+        edges.clear();
+        edges.reserve(current.size());
+        for (size_t i = 0; i < current.size(); i += 3) {
+            for (size_t k = 0; k < 3; k++) {
+                edges.insert(edgeKey(current[i + k], current[i + (k + 1) % 3]));
+            }
+        }
+    };
+    // An edge is open when only one of its two triangles exists, true for borders and for both sides of a seam
+    auto isOpen = [&](uint32_t a, uint32_t b) {
+        bool forward = edges.count(edgeKey(a, b)) != 0;
+        bool backward = edges.count(edgeKey(b, a)) != 0;
+        return forward != backward;
+    };
+
+    buildEdges();
+
+    // Classify every vertex from the open edges around it, once for the input topology
+    std::vector<VertexKind> kind(vertexCount, VertexKind::Manifold);
+    {
+        std::vector<uint32_t> openOut(vertexCount, 0), openIn(vertexCount, 0);
+        std::vector<uint32_t> positionOpen(vertexCount, 0);
+        std::unordered_set<uint64_t> positionEdges;
+        for (size_t i = 0; i < current.size(); i += 3) {
+            for (size_t k = 0; k < 3; k++) {
+                positionEdges.insert(edgeKey(remap[current[i + k]], remap[current[i + (k + 1) % 3]]));
+            }
+        }
+
+        for (uint64_t edge : edges) {
+            uint32_t a = static_cast<uint32_t>(edge >> 32);
+            uint32_t b = static_cast<uint32_t>(edge & 0xFFFFFFFF);
+            if (edges.count(edgeKey(b, a)) == 0) {
+                openOut[a]++;
+                openIn[b]++;
+            }
+            if (positionEdges.count(edgeKey(remap[b], remap[a])) == 0) {
+                positionOpen[remap[a]]++;
+            }
+        }
+
+        for (uint32_t v = 0; v < vertexCount; v++) {
+            uint32_t copies = 1;
+            for (uint32_t w = wedge[v]; w != v; w = wedge[w]) {
+                copies++;
+            }
+
+            bool simpleBoundary = openOut[v] == 1 && openIn[v] == 1;
+            bool closed = openOut[v] == 0 && openIn[v] == 0;
+            if (copies == 1) {
+                kind[v] = closed ? VertexKind::Manifold : (simpleBoundary ? VertexKind::Border : VertexKind::Locked);
+            }
+            else if (copies == 2 && simpleBoundary && positionOpen[remap[v]] == 0) {
+                kind[v] = VertexKind::Seam;
+            }
+            else {
+                kind[v] = VertexKind::Locked;
+            }
+        }
+    }
+
+    // Plane quadrics of every triangle plus perpendicular planes along open edges, gathered per position
+    std::vector<Quadric> quadrics(vertexCount);
+    for (size_t i = 0; i < current.size(); i += 3) {
+        const Vec3& p0 = position[current[i]];
+        const Vec3& p1 = position[current[i + 1]];
+        const Vec3& p2 = position[current[i + 2]];
+        Vec3 normal = cross(sub(p1, p0), sub(p2, p0));
+        float area = length(normal);
+        if (area <= 0.0f) {
+            continue;
+        }
+        Vec3 n = { normal.x / area, normal.y / area, normal.z / area };
+
+        Quadric q = Quadric::fromPlane(n, -dot(n, p0), area);
+        for (size_t k = 0; k < 3; k++) {
+            quadrics[remap[current[i + k]]].add(q);
+        }
+
+        for (size_t k = 0; k < 3; k++) {
+            uint32_t a = current[i + k];
+            uint32_t b = current[i + (k + 1) % 3];
+            if (!isOpen(a, b)) {
+                continue;
+            }
+
+            Vec3 edge = sub(position[b], position[a]);
+            float edgeLength = length(edge);
+            Vec3 perpendicular = cross(edge, n);
+            float perpendicularLength = length(perpendicular);
+            if (perpendicularLength <= 0.0f) {
+                continue;
+            }
+            perpendicular = { perpendicular.x / perpendicularLength, perpendicular.y / perpendicularLength, perpendicular.z / perpendicularLength };
+
+            Quadric boundary = Quadric::fromPlane(perpendicular, -dot(perpendicular, position[a]), edgeLength * edgeLength * BOUNDARY_WEIGHT);
+            quadrics[remap[a]].add(boundary);
+            quadrics[remap[b]].add(boundary);
+        }
+    }
+
+    // Seam copies collapse onto the copy of the target that shares an open edge with them
+    auto seamTarget = [&](uint32_t from, uint32_t to) -> uint32_t {
+        uint32_t twin = wedge[from];
+        uint32_t candidate = to;
+        do {
+            if (isOpen(twin, candidate)) {
+                return candidate;
+            }
+            candidate = wedge[candidate];
+        } while (candidate != to);
+        return UINT32_MAX;
+    };
+
+    auto canCollapse = [&](uint32_t from, uint32_t to) {
+        if (remap[from] == remap[to]) {
+            return false;
+        }
+        switch (kind[from]) {
+        case VertexKind::Manifold:
+            return true;
+        case VertexKind::Border:
+            return isOpen(from, to);
+        case VertexKind::Seam:
+            return isOpen(from, to) && seamTarget(from, to) != UINT32_MAX;
+        default:
+            return false;
+        }
+    };
+
+    float errorLimit = targetError * targetError;
+    float maxError = 0.0f;
+
+    std::vector<uint32_t> collapseTo(vertexCount);
+    std::vector<bool> touched(vertexCount);
+    std::vector<uint32_t> triangleOffsets(vertexCount + 1);
+    std::vector<uint32_t> vertexTriangles;
+    std::vector<Collapse> candidates;
+
+    while (current.size() > targetIndexCount) {
+        // Triangles around each vertex, for the flip test
+        std::fill(triangleOffsets.begin(), triangleOffsets.end(), 0);
+        for (uint32_t index : current) {
+            triangleOffsets[index + 1]++;
+        }
+        for (size_t v = 0; v < vertexCount; v++) {
+            triangleOffsets[v + 1] += triangleOffsets[v];
+        }
+        vertexTriangles.resize(current.size());
+        std::vector<uint32_t> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+        for (size_t i = 0; i < current.size(); i++) {
+            vertexTriangles[fill[current[i]]++] = static_cast<uint32_t>(i / 3);
+        }
+
+        // Cheapest direction of every edge that is allowed to collapse
+        candidates.clear();
+        for (size_t i = 0; i < current.size(); i += 3) {
+            for (size_t k = 0; k < 3; k++) {
+                uint32_t a = current[i + k];
+                uint32_t b = current[i + (k + 1) % 3];
+                // Interior edges appear in two triangles, take each once
+                if (a > b && !isOpen(a, b)) {
+                    continue;
+                }
+
+                bool ab = canCollapse(a, b);
+                bool ba = canCollapse(b, a);
+                float errorAB = ab ? quadrics[remap[a]].error(position[b]) : 0.0f;
+                float errorBA = ba ? quadrics[remap[b]].error(position[a]) : 0.0f;
+
+                if (ab && (!ba || errorAB <= errorBA)) {
+                    candidates.push_back({ a, b, errorAB });
+                }
+                else if (ba) {
+                    candidates.push_back({ b, a, errorBA });
+                }
+            }
+        }
+
+        std::sort(candidates.begin(), candidates.end(), [](const Collapse& x, const Collapse& y) {
+            return x.error < y.error;
+        });
+
+        // Triangle normals around from must not flip or fold when it moves onto to
+        auto keepsOrientation = [&](uint32_t from, uint32_t to) {
+            for (uint32_t t = triangleOffsets[from]; t < triangleOffsets[from + 1]; t++) {
+                const uint32_t* tri = &current[vertexTriangles[t] * 3];
+                if (tri[0] == to || tri[1] == to || tri[2] == to || remap[tri[0]] == remap[to] || remap[tri[1]] == remap[to] || remap[tri[2]] == remap[to]) {
+                    continue;
+                }
+
+                Vec3 p[3] = { position[tri[0]], position[tri[1]], position[tri[2]] };
+                Vec3 before = cross(sub(p[1], p[0]), sub(p[2], p[0]));
+                for (size_t k = 0; k < 3; k++) {
+                    if (tri[k] == from) {
+                        p[k] = position[to];
+                    }
+                }
+                Vec3 after = cross(sub(p[1], p[0]), sub(p[2], p[0]));
+                if (dot(before, after) < 0.25f * length(before) * length(after)) {
+                    return false;
+                }
+            }
+            return true;
+        };
+
+        for (uint32_t v = 0; v < vertexCount; v++) {
+            collapseTo[v] = v;
+        }
+        std::fill(touched.begin(), touched.end(), false);
+
+        // Interior collapses remove two triangles, boundary ones one, stop once the target should be reached
+        size_t triangleGoal = (current.size() - targetIndexCount) / 3;
+        size_t removed = 0;
+        size_t accepted = 0;
+
+        for (const Collapse& collapse : candidates) {
+            if (removed >= triangleGoal || collapse.error > errorLimit) {
+                break;
+            }
+
+            uint32_t from = collapse.from;
+            uint32_t to = collapse.to;
+            if (touched[remap[from]] || touched[remap[to]]) {
+                continue;
+            }
+
+            uint32_t twin = UINT32_MAX;
+            uint32_t twinTarget = UINT32_MAX;
+            if (kind[from] == VertexKind::Seam) {
+                twin = wedge[from];
+                twinTarget = seamTarget(from, to);
+                if (!keepsOrientation(twin, twinTarget)) {
+                    continue;
+                }
+            }
+            if (!keepsOrientation(from, to)) {
+                continue;
+            }
+
+            collapseTo[from] = to;
+            if (twin != UINT32_MAX) {
+                collapseTo[twin] = twinTarget;
+            }
+            quadrics[remap[to]].add(quadrics[remap[from]]);
+            touched[remap[from]] = true;
+            touched[remap[to]] = true;
+
+            maxError = std::max(maxError, collapse.error);
+            removed += kind[from] == VertexKind::Manifold ? 2 : 1;
+            accepted++;
+        }
+
+        if (accepted == 0) {
+            break;
+        }
+
+        // Apply the collapses and drop the triangles that became degenerate
+        size_t write = 0;
+        for (size_t i = 0; i < current.size(); i += 3) {
+            uint32_t a = collapseTo[current[i]];
+            uint32_t b = collapseTo[current[i + 1]];
+            uint32_t c = collapseTo[current[i + 2]];
+            if (a == b || b == c || a == c) {
+                continue;
+            }
+            current[write++] = a;
+            current[write++] = b;
+            current[write++] = c;
+        }
+        current.resize(write);
+
+        buildEdges();
+    }
+
+    std::copy(current.begin(), current.end(), dst);
+    if (resultError) {
+        *resultError = std::sqrt(maxError);
+    }
+    return current.size();
+}
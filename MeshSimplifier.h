@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Quadric error metric edge collapse over an index buffer, vertices are never moved so every LOD shares one vertex buffer
+namespace MeshSimplifier {
+
+	// Collapse edges until at most targetIndexCount indices remain or the next collapse would move the surface further
+	// than targetError, both errors are relative to the largest extent of the mesh. Writes the result to dst, which may
+	// alias indices, and returns its index count.
+	// Borders and UV or normal seams (vertices sharing a position) only collapse along themselves so they keep their shape
+	size_t simplify(uint32_t* dst, const uint32_t* indices, size_t indexCount, const float* positions, size_t positionStride, size_t vertexCount,
+		size_t targetIndexCount, float targetError, float* resultError = nullptr);
+
+	// Converts the relative errors of simplify to model space units
+	float errorScale(const float* positions, size_t positionStride, size_t vertexCount);
+}
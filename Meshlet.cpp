@@ -0,0 +1,160 @@
+#include "Meshlet.h"
+#include <algorithm>
+#include <cmath>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+MESHLET BUILDING
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static glm::vec3 loadPosition(const float* positions, size_t floatStride, uint32_t v) {
+    const float* p = &positions[v * floatStride];
+    return glm::vec3(p[0], p[1], p[2]);
+}
+
+// Ritter's bounding sphere: start from the two most distant points along a sweep, then grow over the stragglers
+static void computeSphere(Meshlet& meshlet, const std::vector<glm::vec3>& points) {
+    glm::vec3 a = points[0];
+    glm::vec3 b = a;
+    for (const glm::vec3& p : points) {
+        if (glm::dot(p - a, p - a) > glm::dot(b - a, b - a)) {
+            b = p;
+        }
+    }
+    glm::vec3 c = b;
+    for (const glm::vec3& p : points) {
+        if (glm::dot(p - b, p - b) > glm::dot(c - b, c - b)) {
+            c = p;
+        }
+    }
+
+    glm::vec3 center = (b + c) * 0.5f;
+    float radius = glm::length(c - b) * 0.5f;
+    for (const glm::vec3& p : points) {
+        float distance = glm::length(p - center);
+        if (distance > radius) {
+            float grownRadius = (radius + distance) * 0.5f;
+            center += (p - center) * ((grownRadius - radius) / distance);
+            radius = grownRadius;
+        }
+    }
+
+    meshlet.center = center;
+    meshlet.radius = radius;
+}
+
+static void computeCone(Meshlet& meshlet, const uint32_t* indices, const float* positions, size_t floatStride) {
+    std::vector<glm::vec3> normals;
+    normals.reserve(meshlet.indexCount / 3);
+
+    glm::vec3 axis{ 0.0f };
+    for (uint32_t i = 0; i < meshlet.indexCount; i += 3) {
+        glm::vec3 p0 = loadPosition(positions, floatStride, indices[i]);
+        glm::vec3 p1 = loadPosition(positions, floatStride, indices[i + 1]);
+        glm::vec3 p2 = loadPosition(positions, floatStride, indices[i + 2]);
+        glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+        float area = glm::length(normal);
+        if (area <= 0.0f) {
+            continue;
+        }
+        normals.push_back(normal / area);
+        axis += normal / area;
+    }
+
+    meshlet.coneCutoff = 1.0f;
+    float axisLength = glm::length(axis);
+    if (normals.empty() || axisLength <= 0.0f) {
+        return;
+    }
+    axis /= axisLength;
+
+    float minimumDot = 1.0f;
+    for (const glm::vec3& normal : normals) {
+        minimumDot = std::min(minimumDot, glm::dot(axis, normal));
+    }
+
+    // Normals spread over more than a hemisphere, some triangle always faces the camera
+    if (minimumDot <= 0.1f) {
+        return;
+    }
+
+    meshlet.coneAxis = axis;
+    meshlet.coneCutoff = std::sqrt(1.0f - minimumDot * minimumDot);
+}
+
+std::vector<Meshlet> MeshletBuilder::build(const uint32_t* indices, size_t indexCount, uint32_t firstIndex, const float* positions, size_t positionStride, size_t vertexCount) {
+    std::vector<Meshlet> meshlets;
+    if (indexCount == 0) {
+        return meshlets;
+    }
+
+    size_t floatStride = positionStride / sizeof(float);
+
+    // Which meshlet last used each vertex, so a vertex is counted once per meshlet
+    std::vector<uint32_t> owner(vertexCount, UINT32_MAX);
+    uint32_t meshletIndex = 0;
+
+    Meshlet current;
+    current.firstIndex = firstIndex;
+
+    for (size_t i = 0; i < indexCount; i += 3) {
+        const uint32_t* tri = &indices[i];
+        uint32_t newVertices = 0;
+        for (size_t k = 0; k < 3; k++) {
+            bool repeated = (k > 0 && tri[k] == tri[0]) || (k > 1 && tri[k] == tri[1]);
+            if (owner[tri[k]] != meshletIndex && !repeated) {
+                newVertices++;
+            }
+        }
+
+        // Full, close it and start the next one at this triangle
+        if (current.vertexCount + newVertices > MAX_VERTICES || current.indexCount / 3 + 1 > MAX_TRIANGLES) {
+            meshlets.push_back(current);
+            meshletIndex++;
+
+            current = Meshlet{};
+            current.firstIndex = firstIndex + static_cast<uint32_t>(i);
+            newVertices = 3 - ((tri[1] == tri[0]) + (tri[2] == tri[0] || tri[2] == tri[1]));
+        }
+
+        for (size_t k = 0; k < 3; k++) {
+            owner[tri[k]] = meshletIndex;
+        }
+        current.vertexCount += newVertices;
+        current.indexCount += 3;
+    }
+    meshlets.push_back(current);
+
+    std::vector<glm::vec3> points;
+    for (Meshlet& meshlet : meshlets) {
+        const uint32_t* meshletIndices = &indices[meshlet.firstIndex - firstIndex];
+
+        points.clear();
+        for (uint32_t i = 0; i < meshlet.indexCount; i++) {
+            points.push_back(loadPosition(positions, floatStride, meshletIndices[i]));
+        }
+        computeSphere(meshlet, points);
+        computeCone(meshlet, meshletIndices, positions, floatStride);
+    }
+
+    return meshlets;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+MESHLET CULLING
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+MeshletCuller::MeshletCuller(const glm::mat4& modelViewProj, const glm::vec3& cameraPosition) : frustum(modelViewProj), cameraPosition(cameraPosition) {}
+
+bool MeshletCuller::inFrustum(const Meshlet& meshlet) const {
+    return frustum.intersectsSphere(meshlet.center, meshlet.radius);
+}
+
+bool MeshletCuller::frontFacing(const Meshlet& meshlet) const {
+    // Back facing when the camera sees every point of the sphere from behind every normal in the cone
+    glm::vec3 toCenter = meshlet.center - cameraPosition;
+    return glm::dot(toCenter, meshlet.coneAxis) < meshlet.coneCutoff * glm::length(toCenter) + meshlet.radius;
+}
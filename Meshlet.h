@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "glm-0.9.6.3/glm.hpp"
+#include "Frustum.h"
+
+// A small cluster of triangles, drawn as a contiguous range of the index buffer so it can be culled on its own
+struct Meshlet {
+	uint32_t firstIndex = 0;
+	uint32_t indexCount = 0;
+	uint32_t vertexCount = 0;
+
+	// Model space bounding sphere
+	glm::vec3 center{ 0.0f };
+	float radius = 0.0f;
+
+	// Every triangle normal lies within the cone around coneAxis, coneCutoff is the sine of its half angle widened
+	// so the test holds for any point in the sphere, a cutoff of 1 or more means the cluster can never be backface culled
+	glm::vec3 coneAxis{ 0.0f, 0.0f, 1.0f };
+	float coneCutoff = 1.0f;
+};
+
+namespace MeshletBuilder {
+	// Sizes that fit the mesh shader limits of current GPUs, also a good granularity for indirect draws
+	const uint32_t MAX_VERTICES = 64;
+	const uint32_t MAX_TRIANGLES = 124;
+
+	// Split a range of an index buffer into meshlets in triangle order, a cache optimized order keeps them compact.
+	// firstIndex is where the range starts in the full index buffer
+	std::vector<Meshlet> build(const uint32_t* indices, size_t indexCount, uint32_t firstIndex, const float* positions, size_t positionStride, size_t vertexCount);
+}
+
+// Frustum and backface test for the meshlets of one instance, set up in the model space of that instance
+struct MeshletCuller {
+	Frustum frustum;
+	glm::vec3 cameraPosition{ 0.0f };
+
+	// modelViewProj maps model space to clip space, cameraPosition is the camera in model space
+	MeshletCuller(const glm::mat4& modelViewProj, const glm::vec3& cameraPosition);
+
+	bool inFrustum(const Meshlet& meshlet) const;
+	bool frontFacing(const Meshlet& meshlet) const;
+};
@@ -0,0 +1,488 @@
+#include "OcclusionCulling.h"
+#include "InstanceCulling.h"
+#include "JobSystem.h"
+#include "FrameAllocator.h"
+#include "glm-0.9.6.3/gtc/matrix_transform.hpp"
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <stdexcept>
+#include <emmintrin.h>
+
+// Triangles per setup job, occluders are coarse LODs so most of them fit in one
+static const size_t CHUNK_TRIANGLES = 1024;
+
+// Runs on the job system when there is one, inline otherwise
+static void forEachBatch(JobSystem* jobs, size_t count, size_t batchSize, const std::function<void(size_t begin, size_t end)>& fn) {
+    if (jobs) {
+        jobs->parallelFor(count, batchSize, fn);
+        return;
+    }
+    if (count > 0) {
+        fn(0, count);
+    }
+}
+
+static double millisecondsSince(std::chrono::high_resolution_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+OcclusionCuller::OcclusionCuller(uint32_t width, uint32_t height) : width(width), height(height) {
+    if (width == 0 || height == 0 || width % TILE_WIDTH != 0 || height % TILE_HEIGHT != 0) {
+        throw std::runtime_error("occlusion buffer size must be a multiple of the tile size");
+    }
+    tilesX = width / TILE_WIDTH;
+    tilesY = height / TILE_HEIGHT;
+
+    // Halve down to a single texel, odd sizes round up so the edge texels are still covered
+    glm::uvec2 size(width, height);
+    while (true) {
+        levelSizes.push_back(size);
+        depth.emplace_back(size_t(size.x) * size.y, FLT_MAX);
+        if (size.x == 1 && size.y == 1) {
+            break;
+        }
+        size = glm::uvec2(std::max(1u, (size.x + 1) / 2), std::max(1u, (size.y + 1) / 2));
+    }
+}
+
+void OcclusionCuller::beginFrame(const glm::mat4& viewProj) {
+    this->viewProj = viewProj;
+    occluders.clear();
+    stats = Stats();
+}
+
+void OcclusionCuller::addOccluder(const float* positions, size_t positionStride, const uint32_t* indices, size_t indexCount, const glm::mat4& modelMatrix) {
+    occluders.push_back({ positions, positionStride, indices, indexCount - indexCount % 3, modelMatrix });
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+RASTERIZATION
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void OcclusionCuller::rasterize(JobSystem* jobs) {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    chunks.clear();
+    for (uint32_t o = 0; o < occluders.size(); o++) {
+        for (size_t first = 0; first < occluders[o].indexCount; first += CHUNK_TRIANGLES * 3) {
+            chunks.push_back({ o, first, std::min(CHUNK_TRIANGLES * 3, occluders[o].indexCount - first) });
+        }
+        stats.occluderTriangles += static_cast<uint32_t>(occluders[o].indexCount / 3);
+    }
+
+    // The lists keep their capacity from frame to frame
+    if (chunkTriangles.size() < chunks.size()) {
+        chunkTriangles.resize(chunks.size());
+        chunkBins.resize(chunks.size());
+    }
+
+    forEachBatch(jobs, chunks.size(), 1, [this](size_t begin, size_t end) {
+        for (size_t c = begin; c < end; c++) {
+            setupChunk(c);
+        }
+    });
+
+    forEachBatch(jobs, size_t(tilesX) * tilesY, 1, [this](size_t begin, size_t end) {
+        for (size_t tile = begin; tile < end; tile++) {
+            rasterizeTile(static_cast<uint32_t>(tile % tilesX), static_cast<uint32_t>(tile / tilesX));
+        }
+    });
+
+    buildPyramid();
+
+    for (size_t c = 0; c < chunks.size(); c++) {
+        stats.rasterizedTriangles += static_cast<uint32_t>(chunkTriangles[c].size());
+    }
+    stats.rasterizeMs = millisecondsSince(start);
+}
+
+void OcclusionCuller::setupChunk(size_t chunkIndex) {
+    const Chunk& chunk = chunks[chunkIndex];
+    const Occluder& occluder = occluders[chunk.occluder];
+    glm::mat4 toClip = viewProj * occluder.modelMatrix;
+
+    std::vector<ScreenTriangle>& triangles = chunkTriangles[chunkIndex];
+    std::vector<std::vector<uint32_t>>& bins = chunkBins[chunkIndex];
+    triangles.clear();
+    bins.resize(size_t(tilesX) * tilesY);
+    for (std::vector<uint32_t>& bin : bins) {
+        bin.clear();
+    }
+
+    const char* positionBytes = reinterpret_cast<const char*>(occluder.positions);
+    for (size_t i = chunk.firstIndex; i < chunk.firstIndex + chunk.indexCount; i += 3) {
+        glm::vec4 clip[3];
+        for (int v = 0; v < 3; v++) {
+            const float* p = reinterpret_cast<const float*>(positionBytes + occluder.indices[i + v] * occluder.positionStride);
+            clip[v] = toClip * glm::vec4(p[0], p[1], p[2], 1.0f);
+        }
+
+        // Triangles crossing the near plane are left out, an occluder may only ever hide less than it really does
+        if (clip[0].z < -clip[0].w || clip[1].z < -clip[1].w || clip[2].z < -clip[2].w) {
+            continue;
+        }
+        bool outside = false;
+        for (int axis = 0; axis < 2 && !outside; axis++) {
+            outside = (clip[0][axis] > clip[0].w && clip[1][axis] > clip[1].w && clip[2][axis] > clip[2].w) ||
+                (clip[0][axis] < -clip[0].w && clip[1][axis] < -clip[1].w && clip[2][axis] < -clip[2].w);
+        }
+        if (outside) {
+            continue;
+        }
+
+        glm::vec3 screen[3];
+        for (int v = 0; v < 3; v++) {
+            float invW = 1.0f / clip[v].w;
+            screen[v] = glm::vec3((clip[v].x * invW * 0.5f + 0.5f) * width, (clip[v].y * invW * 0.5f + 0.5f) * height, clip[v].z * invW);
+        }
+
+        // Both windings occlude, flip the clockwise ones so the inside is always where the edges are positive
+        float area = (screen[1].x - screen[0].x) * (screen[2].y - screen[0].y) - (screen[1].y - screen[0].y) * (screen[2].x - screen[0].x);
+        if (area < 0.0f) {
+            std::swap(screen[1], screen[2]);
+            area = -area;
+        }
+        if (area < 1e-6f) {
+            continue;
+        }
+
+        ScreenTriangle triangle;
+        triangle.minX = std::max(0, static_cast<int>(std::floor(std::min({ screen[0].x, screen[1].x, screen[2].x }))));
+        triangle.minY = std::max(0, static_cast<int>(std::floor(std::min({ screen[0].y, screen[1].y, screen[2].y }))));
+        triangle.maxX = std::min(static_cast<int>(width) - 1, static_cast<int>(std::ceil(std::max({ screen[0].x, screen[1].x, screen[2].x }))));
+        triangle.maxY = std::min(static_cast<int>(height) - 1, static_cast<int>(std::ceil(std::max({ screen[0].y, screen[1].y, screen[2].y }))));
+        if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY) {
+            continue;
+        }
+
+        // Edge k lies opposite vertex k
+        for (int e = 0; e < 3; e++) {
+            const glm::vec3& a = screen[(e + 1) % 3];
+            const glm::vec3& b = screen[(e + 2) % 3];
+            triangle.edgeA[e] = a.y - b.y;
+            triangle.edgeB[e] = b.x - a.x;
+            triangle.edgeC[e] = -(triangle.edgeA[e] * a.x + triangle.edgeB[e] * a.y);
+        }
+
+        // The edge functions of vertex 1 and 2 are its barycentrics scaled by the area, depth follows as a plane
+        float dz1 = (screen[1].z - screen[0].z) / area;
+        float dz2 = (screen[2].z - screen[0].z) / area;
+        triangle.depthA = triangle.edgeA[1] * dz1 + triangle.edgeA[2] * dz2;
+        triangle.depthB = triangle.edgeB[1] * dz1 + triangle.edgeB[2] * dz2;
+        triangle.depthC = screen[0].z + triangle.edgeC[1] * dz1 + triangle.edgeC[2] * dz2;
+
+        // Sampled at pixel centers, but only pixels the triangle covers completely pass and they store the farthest
+        // depth inside the pixel, so the buffer never claims more occlusion than the real triangle gives
+        for (int e = 0; e < 3; e++) {
+            triangle.edgeC[e] -= 0.5f * (std::abs(triangle.edgeA[e]) + std::abs(triangle.edgeB[e]));
+        }
+        triangle.depthC += 0.5f * (std::abs(triangle.depthA) + std::abs(triangle.depthB));
+
+        uint32_t index = static_cast<uint32_t>(triangles.size());
+        triangles.push_back(triangle);
+
+        for (int tileY = triangle.minY / int(TILE_HEIGHT); tileY <= triangle.maxY / int(TILE_HEIGHT); tileY++) {
+            for (int tileX = triangle.minX / int(TILE_WIDTH); tileX <= triangle.maxX / int(TILE_WIDTH); tileX++) {
+                bins[size_t(tileY) * tilesX + tileX].push_back(index);
+            }
+        }
+    }
+}
+
+void OcclusionCuller::rasterizeTile(uint32_t tileX, uint32_t tileY) {
+    int tileMinX = static_cast<int>(tileX * TILE_WIDTH);
+    int tileMinY = static_cast<int>(tileY * TILE_HEIGHT);
+    int tileMaxX = tileMinX + static_cast<int>(TILE_WIDTH) - 1;
+    int tileMaxY = tileMinY + static_cast<int>(TILE_HEIGHT) - 1;
+    size_t tile = size_t(tileY) * tilesX + tileX;
+
+    std::vector<float>& target = depth[0];
+    for (int y = tileMinY; y <= tileMaxY; y++) {
+        std::fill(target.begin() + size_t(y) * width + tileMinX, target.begin() + size_t(y) * width + tileMaxX + 1, FLT_MAX);
+    }
+
+    // Pixel centers of 4 neighbouring pixels, every row of a tile is a whole number of these groups
+    const __m128 pixelOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+    const __m128 zero = _mm_setzero_ps();
+
+    for (size_t c = 0; c < chunks.size(); c++) {
+        const std::vector<ScreenTriangle>& triangles = chunkTriangles[c];
+        for (uint32_t index : chunkBins[c][tile]) {
+            const ScreenTriangle& triangle = triangles[index];
+            int minX = std::max(triangle.minX, tileMinX) & ~3;
+            int maxX = std::min(triangle.maxX, tileMaxX);
+            int minY = std::max(triangle.minY, tileMinY);
+            int maxY = std::min(triangle.maxY, tileMaxY);
+
+            __m128 a0 = _mm_set1_ps(triangle.edgeA[0]), a1 = _mm_set1_ps(triangle.edgeA[1]), a2 = _mm_set1_ps(triangle.edgeA[2]);
+            __m128 depthA = _mm_set1_ps(triangle.depthA);
+
+            for (int y = minY; y <= maxY; y++) {
+                float centerY = y + 0.5f;
+                __m128 row0 = _mm_set1_ps(triangle.edgeB[0] * centerY + triangle.edgeC[0]);
+                __m128 row1 = _mm_set1_ps(triangle.edgeB[1] * centerY + triangle.edgeC[1]);
+                __m128 row2 = _mm_set1_ps(triangle.edgeB[2] * centerY + triangle.edgeC[2]);
+                __m128 rowDepth = _mm_set1_ps(triangle.depthB * centerY + triangle.depthC);
+                float* pixels = target.data() + size_t(y) * width;
+
+                for (int x = minX; x <= maxX; x += 4) {
+                    __m128 centerX = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), pixelOffsets);
+                    __m128 e0 = _mm_add_ps(_mm_mul_ps(a0, centerX), row0);
+                    __m128 e1 = _mm_add_ps(_mm_mul_ps(a1, centerX), row1);
+                    __m128 e2 = _mm_add_ps(_mm_mul_ps(a2, centerX), row2);
+                    __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+                    if (_mm_movemask_ps(inside) == 0) {
+                        continue;
+                    }
+
+                    __m128 z = _mm_add_ps(_mm_mul_ps(depthA, centerX), rowDepth);
+                    __m128 current = _mm_loadu_ps(pixels + x);
+                    __m128 nearest = _mm_min_ps(current, z);
+                    _mm_storeu_ps(pixels + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, current)));
+                }
+            }
+        }
+    }
+}
+
+void OcclusionCuller::buildPyramid() {
+    for (size_t level = 1; level < depth.size(); level++) {
+        const std::vector<float>& below = depth[level - 1];
+        std::vector<float>& current = depth[level];
+        glm::uvec2 belowSize = levelSizes[level - 1];
+        glm::uvec2 size = levelSizes[level];
+
+        for (uint32_t y = 0; y < size.y; y++) {
+            uint32_t y0 = std::min(y * 2, belowSize.y - 1);
+            uint32_t y1 = std::min(y * 2 + 1, belowSize.y - 1);
+            for (uint32_t x = 0; x < size.x; x++) {
+                uint32_t x0 = std::min(x * 2, belowSize.x - 1);
+                uint32_t x1 = std::min(x * 2 + 1, belowSize.x - 1);
+                current[size_t(y) * size.x + x] = std::max(std::max(below[size_t(y0) * belowSize.x + x0], below[size_t(y0) * belowSize.x + x1]),
+                    std::max(below[size_t(y1) * belowSize.x + x0], below[size_t(y1) * belowSize.x + x1]));
+            }
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+OCCLUSION TESTS
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static float horizontalMin(__m128 v) {
+    v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtss_f32(v);
+}
+
+static float horizontalMax(__m128 v) {
+    v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtss_f32(v);
+}
+
+bool OcclusionCuller::isVisible(const glm::vec3& center, const glm::vec3& extent) const {
+    // Corners are the transformed center plus or minus the transformed half axes. Each register holds one clip
+    // component of 4 corners, the low half of the box in one register and the high half in the other
+    glm::vec4 clipCenter = viewProj * glm::vec4(center, 1.0f);
+    glm::vec4 clipAxes[3] = { viewProj[0] * extent.x, viewProj[1] * extent.y, viewProj[2] * extent.z };
+
+    const __m128 signX = _mm_setr_ps(-1.0f, 1.0f, -1.0f, 1.0f);
+    const __m128 signY = _mm_setr_ps(-1.0f, -1.0f, 1.0f, 1.0f);
+    __m128 low[4], high[4];
+    for (int component = 0; component < 4; component++) {
+        __m128 side = _mm_add_ps(_mm_set1_ps(clipCenter[component]),
+            _mm_add_ps(_mm_mul_ps(signX, _mm_set1_ps(clipAxes[0][component])), _mm_mul_ps(signY, _mm_set1_ps(clipAxes[1][component]))));
+        __m128 axisZ = _mm_set1_ps(clipAxes[2][component]);
+        low[component] = _mm_sub_ps(side, axisZ);
+        high[component] = _mm_add_ps(side, axisZ);
+    }
+
+    // Boxes reaching past the near plane cover the camera, there is nothing in front of them to test
+    __m128 behindNear = _mm_or_ps(_mm_cmplt_ps(_mm_add_ps(low[2], low[3]), _mm_setzero_ps()), _mm_cmplt_ps(_mm_add_ps(high[2], high[3]), _mm_setzero_ps()));
+    if (_mm_movemask_ps(behindNear) != 0) {
+        return true;
+    }
+
+    __m128 invWLow = _mm_div_ps(_mm_set1_ps(1.0f), low[3]);
+    __m128 invWHigh = _mm_div_ps(_mm_set1_ps(1.0f), high[3]);
+    __m128 xLow = _mm_mul_ps(low[0], invWLow), xHigh = _mm_mul_ps(high[0], invWHigh);
+    __m128 yLow = _mm_mul_ps(low[1], invWLow), yHigh = _mm_mul_ps(high[1], invWHigh);
+    __m128 zLow = _mm_mul_ps(low[2], invWLow), zHigh = _mm_mul_ps(high[2], invWHigh);
+
+    float nearestDepth = horizontalMin(_mm_min_ps(zLow, zHigh));
+    glm::vec2 minScreen(horizontalMin(_mm_min_ps(xLow, xHigh)), horizontalMin(_mm_min_ps(yLow, yHigh)));
+    glm::vec2 maxScreen(horizontalMax(_mm_max_ps(xLow, xHigh)), horizontalMax(_mm_max_ps(yLow, yHigh)));
+    glm::vec2 size(static_cast<float>(width), static_cast<float>(height));
+    minScreen = glm::clamp((minScreen * 0.5f + 0.5f) * size, glm::vec2(-1.0f), size);
+    maxScreen = glm::clamp((maxScreen * 0.5f + 0.5f) * size, glm::vec2(-1.0f), size);
+
+    // Every pixel the box touches at all, partially covered ones included
+    int minX = std::max(0, static_cast<int>(std::floor(minScreen.x)));
+    int minY = std::max(0, static_cast<int>(std::floor(minScreen.y)));
+    int maxX = std::min(static_cast<int>(width) - 1, static_cast<int>(std::floor(maxScreen.x)));
+    int maxY = std::min(static_cast<int>(height) - 1, static_cast<int>(std::floor(maxScreen.y)));
+    if (minX > maxX || minY > maxY) {
+        return true;
+    }
+
+    // Lowest level where the rectangle spans at most 2x2 texels
+    size_t level = 0;
+    while (level + 1 < depth.size() && ((maxX >> level) - (minX >> level) > 1 || (maxY >> level) - (minY >> level) > 1)) {
+        level++;
+    }
+
+    const std::vector<float>& texels = depth[level];
+    uint32_t levelWidth = levelSizes[level].x;
+    float farthest = -FLT_MAX;
+    for (int y = minY >> level; y <= (maxY >> level); y++) {
+        for (int x = minX >> level; x <= (maxX >> level); x++) {
+            farthest = std::max(farthest, texels[size_t(y) * levelWidth + x]);
+        }
+    }
+    // Texels without occluders stay at FLT_MAX and keep everything behind them visible
+    return nearestDepth <= farthest;
+}
+
+void OcclusionCuller::cullInstances(const InstanceBounds& bounds, std::vector<uint32_t>& instances, JobSystem* jobs, LinearArena& scratch) {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    ArenaScope scope(scratch);
+    FrameVector<uint8_t> visible(instances.size(), 0, FrameAllocator<uint8_t>(scratch));
+    forEachBatch(jobs, instances.size(), 1024, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            uint32_t instance = instances[i];
+            glm::vec3 center(bounds.centerX[instance], bounds.centerY[instance], bounds.centerZ[instance]);
+            glm::vec3 extent(bounds.extentX[instance], bounds.extentY[instance], bounds.extentZ[instance]);
+            visible[i] = isVisible(center, extent) ? 1 : 0;
+        }
+    });
+
+    size_t written = 0;
+    for (size_t i = 0; i < instances.size(); i++) {
+        if (visible[i]) {
+            instances[written++] = instances[i];
+        }
+    }
+
+    stats.testedInstances += static_cast<uint32_t>(instances.size());
+    stats.culledInstances += static_cast<uint32_t>(instances.size() - written);
+    instances.resize(written);
+    stats.testMs += millisecondsSince(start);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+BENCHMARK
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void OcclusionCuller::runBenchmark() {
+    const size_t instanceCount = 200000;
+    const int frames = 61;
+    const float frontWallX = 30.0f;
+
+    // Unit cube, every occluder and occludee is this scaled and moved
+    const float cubePositions[] = {
+        -1, -1, -1,  1, -1, -1,  1, 1, -1,  -1, 1, -1,
+        -1, -1,  1,  1, -1,  1,  1, 1,  1,  -1, 1,  1
+    };
+    const uint32_t cubeIndices[] = {
+        0, 2, 1, 0, 3, 2,  4, 5, 6, 4, 6, 7,  0, 1, 5, 0, 5, 4,
+        1, 2, 6, 1, 6, 5,  2, 3, 7, 2, 7, 6,  3, 0, 4, 3, 4, 7
+    };
+
+    // Two walls across the view, each with doorways, and a few pillars between them
+    std::vector<glm::mat4> walls;
+    auto addWall = [&](glm::vec3 center, glm::vec3 extent) {
+        walls.push_back(glm::scale(glm::translate(glm::mat4(1.0f), center), extent));
+    };
+    addWall(glm::vec3(frontWallX, -32.0f, 5.0f), glm::vec3(0.5f, 29.0f, 5.0f));
+    addWall(glm::vec3(frontWallX, 32.0f, 5.0f), glm::vec3(0.5f, 29.0f, 5.0f));
+    addWall(glm::vec3(frontWallX, 0.0f, 8.0f), glm::vec3(0.5f, 3.0f, 2.0f));
+    addWall(glm::vec3(80.0f, -40.0f, 5.0f), glm::vec3(0.5f, 30.0f, 5.0f));
+    addWall(glm::vec3(80.0f, 25.0f, 5.0f), glm::vec3(0.5f, 30.0f, 5.0f));
+    for (int pillar = 0; pillar < 8; pillar++) {
+        addWall(glm::vec3(55.0f, -35.0f + pillar * 10.0f, 5.0f), glm::vec3(1.0f, 1.0f, 5.0f));
+    }
+
+    // Small props scattered through the level, in front of and behind the walls
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> positionX(2.0f, 150.0f);
+    std::uniform_real_distribution<float> positionY(-80.0f, 80.0f);
+    std::uniform_real_distribution<float> positionZ(0.0f, 3.0f);
+    std::uniform_real_distribution<float> size(0.1f, 0.6f);
+
+    InstanceBounds bounds;
+    bounds.resize(instanceCount);
+    for (size_t i = 0; i < instanceCount; i++) {
+        glm::mat4 transform = glm::translate(glm::mat4(1.0f), glm::vec3(positionX(random), positionY(random), positionZ(random)));
+        bounds.set(i, glm::vec3(0.0f), glm::vec3(size(random), size(random), size(random)), transform);
+    }
+
+    glm::mat4 proj = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 1000.0f);
+    JobSystem jobs;
+    LinearArena scratch;
+    OcclusionCuller culler;
+
+    printf("%zu instances, %zu occluder boxes, %ux%u depth buffer \n", instanceCount, walls.size(), culler.width, culler.height);
+
+    for (JobSystem* jobSystem : { static_cast<JobSystem*>(nullptr), &jobs }) {
+        std::vector<double> rasterizeTimes, testTimes, totalTimes;
+        size_t frustumVisible = 0, occlusionVisible = 0, wronglyCulled = 0;
+
+        for (int frame = 0; frame < frames; frame++) {
+            // Standing in front of the first wall and looking around
+            float yaw = glm::radians(-30.0f + 60.0f * frame / (frames - 1));
+            glm::vec3 eye(0.0f, 0.0f, 1.7f);
+            glm::mat4 view = glm::lookAt(eye, eye + glm::vec3(std::cos(yaw), std::sin(yaw), 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+            glm::mat4 viewProj = proj * view;
+
+            std::vector<uint32_t> visible;
+            InstanceCulling::cull(bounds, Frustum(viewProj), jobSystem, scratch, visible);
+            std::vector<uint32_t> candidates = visible;
+
+            auto start = std::chrono::high_resolution_clock::now();
+            culler.beginFrame(viewProj);
+            for (const glm::mat4& wall : walls) {
+                culler.addOccluder(cubePositions, sizeof(float) * 3, cubeIndices, 36, wall);
+            }
+            culler.rasterize(jobSystem);
+            culler.cullInstances(bounds, visible, jobSystem, scratch);
+            totalTimes.push_back(millisecondsSince(start));
+            rasterizeTimes.push_back(culler.stats.rasterizeMs);
+            testTimes.push_back(culler.stats.testMs);
+
+            frustumVisible += candidates.size();
+            occlusionVisible += visible.size();
+
+            // Nothing in front of the first wall has an occluder before it
+            size_t next = 0;
+            for (uint32_t instance : candidates) {
+                if (next < visible.size() && visible[next] == instance) {
+                    next++;
+                }
+                else if (bounds.centerX[instance] + bounds.extentX[instance] < frontWallX - 0.5f) {
+                    wronglyCulled++;
+                }
+            }
+        }
+
+        std::sort(rasterizeTimes.begin(), rasterizeTimes.end());
+        std::sort(testTimes.begin(), testTimes.end());
+        std::sort(totalTimes.begin(), totalTimes.end());
+        printf("    %-8s rasterize %6.3f ms  test %6.3f ms  total %6.3f ms per frame, %.1f%% of %zu frustum visible culled%s \n",
+            jobSystem ? "parallel" : "1 thread", rasterizeTimes[frames / 2], testTimes[frames / 2], totalTimes[frames / 2],
+            100.0 * (frustumVisible - occlusionVisible) / std::max<size_t>(frustumVisible, 1), frustumVisible / frames,
+            wronglyCulled ? "  WRONGLY CULLED" : "");
+    }
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "glm-0.9.6.3/glm.hpp"
+
+class JobSystem;
+class LinearArena;
+struct InstanceBounds;
+
+// Low resolution software depth buffer of the occluders in view, with a max-depth pyramid to test boxes against.
+// Runs entirely on the CPU, a frame's occlusion results are known before any draw is submitted
+class OcclusionCuller {
+
+public:
+	// Width must be a multiple of TILE_WIDTH and height of TILE_HEIGHT
+	static const uint32_t TILE_WIDTH = 64;
+	static const uint32_t TILE_HEIGHT = 32;
+
+	struct Stats {
+		uint32_t occluderTriangles = 0;
+		uint32_t rasterizedTriangles = 0;
+		uint32_t testedInstances = 0;
+		uint32_t culledInstances = 0;
+		double rasterizeMs = 0.0;
+		double testMs = 0.0;
+	};
+
+	explicit OcclusionCuller(uint32_t width = 256, uint32_t height = 128);
+
+	// Clears the occluders and depth, viewProj maps world space to clip space
+	void beginFrame(const glm::mat4& viewProj);
+
+	// Queue an occluder mesh, the data must stay alive until rasterize. Both sides of every triangle occlude
+	void addOccluder(const float* positions, size_t positionStride, const uint32_t* indices, size_t indexCount, const glm::mat4& modelMatrix);
+
+	// Transform and bin the queued triangles into screen tiles, rasterize the tiles in parallel and build the pyramid
+	void rasterize(JobSystem* jobs);
+
+	// World space box given by center and half size, false only when it is certainly hidden behind the occluders
+	bool isVisible(const glm::vec3& center, const glm::vec3& extent) const;
+
+	// Drop the hidden instances from a list of instance indices, keeping the order of the rest
+	void cullInstances(const InstanceBounds& bounds, std::vector<uint32_t>& instances, JobSystem* jobs, LinearArena& scratch);
+
+	const Stats& lastStats() const { return stats; }
+	uint32_t getWidth() const { return width; }
+	uint32_t getHeight() const { return height; }
+	const std::vector<float>& depthBuffer() const { return depth[0]; }
+
+	// Synthetic interior scene: walls and pillars in front of many small boxes, reports cull rate and cost per frame
+	static void runBenchmark();
+
+private:
+	struct Occluder {
+		const float* positions;
+		size_t positionStride;
+		const uint32_t* indices;
+		size_t indexCount;
+		glm::mat4 modelMatrix;
+	};
+
+	// A run of occluder triangles transformed by one job, with its own bins so jobs never share a list
+	struct Chunk {
+		uint32_t occluder;
+		size_t firstIndex;
+		size_t indexCount;
+	};
+
+	// Edge functions and depth plane in pixel space, inside where all three edges are >= 0
+	struct ScreenTriangle {
+		float edgeA[3], edgeB[3], edgeC[3];
+		float depthA, depthB, depthC;
+		int minX, minY, maxX, maxY;
+	};
+
+	void setupChunk(size_t chunkIndex);
+	void rasterizeTile(uint32_t tileX, uint32_t tileY);
+	void buildPyramid();
+
+	uint32_t width;
+	uint32_t height;
+	uint32_t tilesX;
+	uint32_t tilesY;
+
+	glm::mat4 viewProj{ 1.0f };
+	std::vector<Occluder> occluders;
+	std::vector<Chunk> chunks;
+
+	// Per chunk: its triangles and, for every tile, which of them overlap it
+	std::vector<std::vector<ScreenTriangle>> chunkTriangles;
+	std::vector<std::vector<std::vector<uint32_t>>> chunkBins;
+
+	// Level 0 holds the nearest occluder depth per pixel, each level above the farthest of the 2x2 texels below it
+	std::vector<std::vector<float>> depth;
+	std::vector<glm::uvec2> levelSizes;
+
+	Stats stats;
+};
@@ -0,0 +1,602 @@
+#include "RayTracedShadows.h"
+#include "JobSystem.h"
+#include "SoftwareRayTracer.h"
+#include "glm-0.9.6.3/gtc/matrix_transform.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <string>
+
+static const float PI = 3.14159265f;
+// Shadow rays reach the sun from anywhere in the scene
+static const float SHADOW_RAY_LENGTH = 10000.0f;
+// Ray origins are lifted off the surface by this fraction of their view depth
+static const float SURFACE_OFFSET = 0.002f;
+// Texel rows per job
+static const size_t ROW_BATCH = 4;
+// Render target of the self test and benchmark camera, and the rays per texel of the reference they measure against
+static const uint32_t FIELD_RENDER_WIDTH = 384;
+static const uint32_t FIELD_RENDER_HEIGHT = 216;
+static const uint32_t FIELD_REFERENCE_SAMPLES = 256;
+
+RayTracedShadows::RayTracedShadows() : RayTracedShadows(Settings()) {
+}
+
+RayTracedShadows::RayTracedShadows(const Settings& settings) : settings(settings) {
+}
+
+void RayTracedShadows::setSettings(const Settings& newSettings) {
+    settings = newSettings;
+    resetHistory();
+}
+
+uint32_t RayTracedShadows::traceSize(uint32_t renderSize) const {
+    return std::max(static_cast<uint32_t>(std::ceil(renderSize * settings.resolutionScale)), 1u);
+}
+
+RayTracedShadows::GPUParams RayTracedShadows::beginFrame(const glm::mat4& view, const glm::mat4& proj, const glm::vec3& sunDirection, uint32_t renderWidth, uint32_t renderHeight) {
+    glm::mat4 viewProj = proj * view;
+    uint32_t traceWidth = traceSize(renderWidth);
+    uint32_t traceHeight = traceSize(renderHeight);
+
+    GPUParams params;
+    params.invViewProj = glm::inverse(viewProj);
+    params.prevViewProj = previousViewProj;
+    params.toSun = glm::vec4(-glm::normalize(sunDirection), std::tan(settings.sunAngularRadius));
+    params.camera = glm::vec4(glm::vec3(glm::inverse(view)[3]), settings.aoRadius);
+    params.extent = glm::vec4(traceWidth, traceHeight, renderWidth, renderHeight);
+    params.history = glm::vec4(previousWidth, previousHeight, historyValid ? 1.0f : 0.0f, static_cast<float>(frameIndex));
+    params.projection = glm::vec4(1.0f / proj[0][0], 1.0f / proj[1][1], proj[2][2], proj[3][2]);
+    params.filtering = glm::vec4(settings.depthRejection, static_cast<float>(settings.maxHistory), settings.planeSigma, settings.valueSigma);
+    params.sunFiltering = glm::vec4(static_cast<float>(settings.maxSunHistory), settings.sunValueSigma, 0.0f, 0.0f);
+
+    previousViewProj = viewProj;
+    previousWidth = traceWidth;
+    previousHeight = traceHeight;
+    historyValid = true;
+    // Kept below 2^24 so the float in the uniform buffer stays exact
+    frameIndex = (frameIndex + 1) & 0xFFFFFF;
+    return params;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+PASSES
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Everything below matches the compute shaders line for line, so the CPU images are what the GPU would produce
+
+namespace {
+    uint32_t pcgHash(uint32_t value) {
+        uint32_t state = value * 747796405u + 2891336453u;
+        uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+        return (word >> 22u) ^ word;
+    }
+
+    struct Random {
+        uint32_t state;
+
+        Random(uint32_t x, uint32_t y, uint32_t frame) : state(pcgHash(x + pcgHash(y + pcgHash(frame)))) {
+        }
+
+        float next() {
+            state = pcgHash(state);
+            return (state >> 8) * (1.0f / 16777216.0f);
+        }
+    };
+
+    // Render pixel under the center of a trace texel
+    glm::ivec2 renderPixel(const RayTracedShadows::GPUParams& params, uint32_t x, uint32_t y) {
+        glm::vec2 scale(params.extent.z / params.extent.x, params.extent.w / params.extent.y);
+        return glm::min(glm::ivec2(glm::vec2(x + 0.5f, y + 0.5f) * scale), glm::ivec2(params.extent.z, params.extent.w) - 1);
+    }
+
+    glm::vec2 pixelNDC(const RayTracedShadows::GPUParams& params, glm::ivec2 pixel) {
+        return (glm::vec2(pixel) + 0.5f) / glm::vec2(params.extent.z, params.extent.w) * 2.0f - 1.0f;
+    }
+
+    glm::vec3 worldPosition(const RayTracedShadows::GPUParams& params, glm::ivec2 pixel, float depth) {
+        glm::vec4 world = params.invViewProj * glm::vec4(pixelNDC(params, pixel), depth, 1.0f);
+        return glm::vec3(world) / world.w;
+    }
+
+    // Depth buffer value to distance along the view axis, and back
+    float viewDepth(const RayTracedShadows::GPUParams& params, float depth) {
+        return params.projection.w / (depth + params.projection.z);
+    }
+
+    float bufferDepth(const RayTracedShadows::GPUParams& params, float linearDepth) {
+        return params.projection.w / linearDepth - params.projection.z;
+    }
+
+    // View space position of a trace texel from its view depth
+    glm::vec3 viewPosition(const RayTracedShadows::GPUParams& params, uint32_t x, uint32_t y, float linearDepth) {
+        glm::vec2 ndc = pixelNDC(params, renderPixel(params, x, y));
+        return glm::vec3(ndc.x * linearDepth * params.projection.x, ndc.y * linearDepth * params.projection.y, -linearDepth);
+    }
+
+    // Two vectors perpendicular to a unit direction
+    void tangentBasis(const glm::vec3& direction, glm::vec3& tangent, glm::vec3& bitangent) {
+        glm::vec3 up = std::abs(direction.z) < 0.999f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+        tangent = glm::normalize(glm::cross(up, direction));
+        bitangent = glm::cross(direction, tangent);
+    }
+
+    // Surface normal from the position differences to the neighbours on the side whose depth continues the surface,
+    // so normals do not bend over depth edges. depthAt(x, y) reads a neighbour, positionAt(x, y) turns it into a position
+    template<typename DepthFn, typename PositionFn>
+    glm::vec3 reconstructNormal(int x, int y, int width, int height, float center, const glm::vec3& position, DepthFn&& depthAt, PositionFn&& positionAt) {
+        bool right = x + 1 < width && (x == 0 || std::abs(depthAt(x + 1, y) - center) <= std::abs(depthAt(x - 1, y) - center));
+        bool down = y + 1 < height && (y == 0 || std::abs(depthAt(x, y + 1) - center) <= std::abs(depthAt(x, y - 1) - center));
+        glm::vec3 dx = right ? positionAt(x + 1, y) - position : position - positionAt(x - 1, y);
+        glm::vec3 dy = down ? positionAt(x, y + 1) - position : position - positionAt(x, y - 1);
+        glm::vec3 normal = glm::cross(dx, dy);
+        float length = glm::length(normal);
+        return length > 0.0f ? normal / length : glm::vec3(0.0f, 0.0f, 1.0f);
+    }
+}
+
+glm::vec4 RayTracedShadows::traceTexel(const GPUParams& params, const float* depth, const SoftwareRayTracer& scene, uint32_t x, uint32_t y, uint32_t frame) {
+    int renderWidth = static_cast<int>(params.extent.z);
+    int renderHeight = static_cast<int>(params.extent.w);
+    glm::ivec2 pixel = renderPixel(params, x, y);
+    float center = depth[pixel.y * renderWidth + pixel.x];
+    if (center >= 1.0f) {
+        return glm::vec4(1.0f, 1.0f, 0.0f, 0.0f);
+    }
+
+    glm::vec3 position = worldPosition(params, pixel, center);
+    glm::vec3 normal = reconstructNormal(pixel.x, pixel.y, renderWidth, renderHeight, center, position,
+        [&](int nx, int ny) { return depth[ny * renderWidth + nx]; },
+        [&](int nx, int ny) { return worldPosition(params, glm::ivec2(nx, ny), depth[ny * renderWidth + nx]); });
+    if (glm::dot(normal, glm::vec3(params.camera) - position) < 0.0f) {
+        normal = -normal;
+    }
+    float linearDepth = viewDepth(params, center);
+    Random random(x, y, frame);
+
+    Ray ray;
+    ray.origin = position + normal * (SURFACE_OFFSET * linearDepth);
+
+    // Towards a point on the sun's disc
+    float sun = 0.0f;
+    glm::vec3 toSun(params.toSun);
+    float discRadius = std::sqrt(random.next()) * params.toSun.w;
+    float discAngle = 2.0f * PI * random.next();
+    if (glm::dot(normal, toSun) > 0.0f) {
+        glm::vec3 tangent, bitangent;
+        tangentBasis(toSun, tangent, bitangent);
+        ray.direction = glm::normalize(toSun + (tangent * std::cos(discAngle) + bitangent * std::sin(discAngle)) * discRadius);
+        ray.tMax = SHADOW_RAY_LENGTH;
+        sun = scene.occluded(ray) ? 0.0f : 1.0f;
+    }
+
+    // Cosine weighted over the hemisphere, so the unoccluded fraction is the ambient light that arrives
+    float u = random.next();
+    float angle = 2.0f * PI * random.next();
+    glm::vec3 tangent, bitangent;
+    tangentBasis(normal, tangent, bitangent);
+    float radius = std::sqrt(u);
+    ray.direction = tangent * (radius * std::cos(angle)) + bitangent * (radius * std::sin(angle)) + normal * std::sqrt(1.0f - u);
+    ray.tMax = params.camera.w;
+    float ambient = scene.occluded(ray) ? 0.0f : 1.0f;
+
+    return glm::vec4(sun, ambient, linearDepth, 1.0f);
+}
+
+void RayTracedShadows::trace(const GPUParams& params, const float* depth, const SoftwareRayTracer& scene, JobSystem* jobs) {
+    width = static_cast<uint32_t>(params.extent.x);
+    height = static_cast<uint32_t>(params.extent.y);
+    traced.resize(size_t(width) * height);
+    uint32_t frame = static_cast<uint32_t>(params.history.w);
+    auto traceRows = [&](size_t begin, size_t end) {
+        for (size_t y = begin; y < end; y++) {
+            for (uint32_t x = 0; x < width; x++) {
+                traced[y * width + x] = traceTexel(params, depth, scene, x, static_cast<uint32_t>(y), frame);
+            }
+        }
+    };
+    if (jobs) {
+        jobs->parallelFor(height, ROW_BATCH, traceRows);
+    }
+    else {
+        traceRows(0, height);
+    }
+}
+
+void RayTracedShadows::accumulate(const GPUParams& params, JobSystem* jobs) {
+    accumulated.resize(traced.size());
+    int historyWidth = static_cast<int>(params.history.x);
+    int historyHeight = static_cast<int>(params.history.y);
+    bool valid = params.history.z > 0.0f && history.size() == size_t(historyWidth) * historyHeight;
+
+    auto accumulateRows = [&](size_t begin, size_t end) {
+        for (size_t y = begin; y < end; y++) {
+            for (uint32_t x = 0; x < width; x++) {
+                glm::vec4 current = traced[y * width + x];
+                glm::vec4& result = accumulated[y * width + x];
+                result = current;
+                if (current.z == 0.0f || !valid) {
+                    continue;
+                }
+
+                // Where the surface was in the previous frame, bilinear over the history texels whose depth agrees
+                glm::ivec2 pixel = renderPixel(params, x, static_cast<uint32_t>(y));
+                glm::vec4 previous = params.prevViewProj * glm::vec4(worldPosition(params, pixel, bufferDepth(params, current.z)), 1.0f);
+                if (previous.w <= 0.0f) {
+                    continue;
+                }
+                // The surface point is off the texel center by however the render pixel is, taking that offset out
+                // keeps a still camera from resampling the history a fraction of a texel aside every frame
+                glm::vec2 offset = (pixelNDC(params, pixel) * 0.5f + 0.5f) * glm::vec2(width, height) - glm::vec2(x + 0.5f, y + 0.5f);
+                glm::vec2 coordinate = (glm::vec2(previous) / previous.w * 0.5f + 0.5f) * glm::vec2(historyWidth, historyHeight) - 0.5f - offset;
+                glm::vec2 base = glm::floor(coordinate);
+                glm::vec2 fraction = coordinate - base;
+                glm::vec4 sum(0.0f);
+                float weights = 0.0f;
+                for (int tap = 0; tap < 4; tap++) {
+                    glm::ivec2 offset(tap & 1, tap >> 1);
+                    glm::ivec2 texel = glm::ivec2(base) + offset;
+                    if (texel.x < 0 || texel.y < 0 || texel.x >= historyWidth || texel.y >= historyHeight) {
+                        continue;
+                    }
+                    glm::vec4 old = history[texel.y * historyWidth + texel.x];
+                    if (old.z == 0.0f || std::abs(old.z - previous.w) > params.filtering.x * previous.w) {
+                        continue;
+                    }
+                    float weight = (offset.x ? fraction.x : 1.0f - fraction.x) * (offset.y ? fraction.y : 1.0f - fraction.y);
+                    sum += old * weight;
+                    weights += weight;
+                }
+                if (weights < 0.001f) {
+                    continue;
+                }
+                sum /= weights;
+                float count = std::min(sum.w + 1.0f, params.filtering.y);
+                float sunCount = std::min(count, params.sunFiltering.x);
+                result = glm::vec4(glm::mix(sum.x, current.x, 1.0f / sunCount), glm::mix(sum.y, current.y, 1.0f / count), current.z, count);
+            }
+        }
+    };
+    if (jobs) {
+        jobs->parallelFor(height, ROW_BATCH, accumulateRows);
+    }
+    else {
+        accumulateRows(0, height);
+    }
+    // The copy pass on the GPU
+    history = accumulated;
+}
+
+void RayTracedShadows::filterPass(const GPUParams& params, const std::vector<glm::vec4>& source, std::vector<glm::vec4>& target, int step, JobSystem* jobs) const {
+    static const float kernel[5] = { 1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+    int w = static_cast<int>(width);
+    int h = static_cast<int>(height);
+    target.resize(source.size());
+
+    auto filterRows = [&](size_t begin, size_t end) {
+        for (int y = static_cast<int>(begin); y < static_cast<int>(end); y++) {
+            for (int x = 0; x < w; x++) {
+                glm::vec4 center = source[y * w + x];
+                glm::vec4& result = target[y * w + x];
+                result = center;
+                if (center.z == 0.0f) {
+                    continue;
+                }
+
+                // Taps are weighted by how far they lie from the center's tangent plane, which keeps the filter on one
+                // surface, and by how far their values are from the center's, allowing less the longer its history
+                glm::vec3 position = viewPosition(params, x, y, center.z);
+                glm::vec3 normal = reconstructNormal(x, y, w, h, center.z, position,
+                    [&](int nx, int ny) { return source[ny * w + nx].z; },
+                    [&](int nx, int ny) { return viewPosition(params, nx, ny, source[ny * w + nx].z); });
+                float planeScale = 1.0f / (params.filtering.z * center.z);
+                // Sun visibility keeps a shorter history, so its noise is judged by that
+                glm::vec2 frames(std::min(center.w, params.sunFiltering.x), center.w);
+                glm::vec2 valueScale = 1.0f / (glm::vec2(params.sunFiltering.y, params.filtering.w) * 0.5f / glm::sqrt(glm::max(frames, 1.0f)));
+
+                glm::vec2 sum(0.0f);
+                glm::vec2 weights(0.0f);
+                for (int dy = -2; dy <= 2; dy++) {
+                    for (int dx = -2; dx <= 2; dx++) {
+                        int tx = x + dx * step;
+                        int ty = y + dy * step;
+                        if (tx < 0 || ty < 0 || tx >= w || ty >= h) {
+                            continue;
+                        }
+                        glm::vec4 tap = source[ty * w + tx];
+                        if (tap.z == 0.0f) {
+                            continue;
+                        }
+                        float plane = std::abs(glm::dot(normal, viewPosition(params, tx, ty, tap.z) - position));
+                        float weight = kernel[dx + 2] * kernel[dy + 2] * std::exp(-plane * planeScale);
+                        glm::vec2 difference = glm::abs(glm::vec2(tap) - glm::vec2(center));
+                        glm::vec2 tapWeight = weight * glm::vec2(std::exp(-difference.x * valueScale.x), std::exp(-difference.y * valueScale.y));
+                        sum += tapWeight * glm::vec2(tap);
+                        weights += tapWeight;
+                    }
+                }
+                result = glm::vec4(sum / weights, center.z, center.w);
+            }
+        }
+    };
+    if (jobs) {
+        jobs->parallelFor(height, ROW_BATCH, filterRows);
+    }
+    else {
+        filterRows(0, height);
+    }
+}
+
+void RayTracedShadows::denoise(const GPUParams& params, JobSystem* jobs) {
+    const std::vector<glm::vec4>* source = &accumulated;
+    for (uint32_t i = 0; i < settings.denoiseIterations; i++) {
+        filterPass(params, *source, filtered[i % 2], 1 << i, jobs);
+        source = &filtered[i % 2];
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+BENCHMARK
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Ground quad, boxes and spheres on a y up field. Every instance's triangles are also kept in world space, as a corner
+// and two edges, for testing rays against all of them
+static void buildPillarField(SoftwareRayTracer& scene, std::vector<glm::vec3>& worldTriangles) {
+    std::vector<std::vector<glm::vec3>> meshCorners;
+    auto addMesh = [&](const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices) {
+        std::vector<glm::vec3> corners;
+        for (uint32_t index : indices) {
+            corners.push_back(positions[index]);
+        }
+        meshCorners.push_back(corners);
+        return scene.addMesh(positions.data(), positions.size(), indices.data(), indices.size());
+    };
+    auto addInstance = [&](uint32_t mesh, const glm::mat4& transform) {
+        const std::vector<glm::vec3>& corners = meshCorners[mesh];
+        for (size_t i = 0; i < corners.size(); i += 3) {
+            glm::vec3 a = glm::vec3(transform * glm::vec4(corners[i], 1.0f));
+            glm::vec3 b = glm::vec3(transform * glm::vec4(corners[i + 1], 1.0f));
+            glm::vec3 c = glm::vec3(transform * glm::vec4(corners[i + 2], 1.0f));
+            worldTriangles.insert(worldTriangles.end(), { a, b - a, c - a });
+        }
+        scene.addInstance(mesh, transform);
+    };
+
+    uint32_t ground = addMesh({ { -1, 0, -1 }, { 1, 0, -1 }, { 1, 0, 1 }, { -1, 0, 1 } }, { 0, 2, 1, 0, 3, 2 });
+    std::vector<glm::vec3> positions;
+    for (int corner = 0; corner < 8; corner++) {
+        positions.push_back(glm::vec3((corner & 1) ? 1 : -1, (corner & 2) ? 1 : -1, (corner & 4) ? 1 : -1));
+    }
+    uint32_t box = addMesh(positions, { 0, 1, 3, 0, 3, 2, 4, 6, 7, 4, 7, 5, 0, 4, 5, 0, 5, 1, 2, 3, 7, 2, 7, 6, 0, 2, 6, 0, 6, 4, 1, 5, 7, 1, 7, 3 });
+
+    const uint32_t rings = 16;
+    const uint32_t segments = 32;
+    positions.clear();
+    std::vector<uint32_t> indices;
+    for (uint32_t ring = 0; ring <= rings; ring++) {
+        float polar = PI * ring / rings;
+        for (uint32_t segment = 0; segment <= segments; segment++) {
+            float azimuth = 2.0f * PI * segment / segments;
+            positions.push_back(glm::vec3(std::sin(polar) * std::cos(azimuth), std::cos(polar), std::sin(polar) * std::sin(azimuth)));
+        }
+    }
+    for (uint32_t ring = 0; ring < rings; ring++) {
+        for (uint32_t segment = 0; segment < segments; segment++) {
+            uint32_t a = ring * (segments + 1) + segment;
+            uint32_t b = a + segments + 1;
+            indices.insert(indices.end(), { a, b, a + 1, a + 1, b, b + 1 });
+        }
+    }
+    uint32_t sphere = addMesh(positions, indices);
+
+    std::mt19937 random(43);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    addInstance(ground, glm::scale(glm::mat4(1.0f), glm::vec3(100.0f, 1.0f, 100.0f)));
+    for (int i = 0; i < 400; i++) {
+        glm::vec3 position((unit(random) - 0.5f) * 80.0f, 0.0f, (unit(random) - 0.5f) * 80.0f);
+        if (i % 4 == 0) {
+            float radius = 0.5f + unit(random) * 1.5f;
+            position.y = radius;
+            addInstance(sphere, glm::scale(glm::translate(glm::mat4(1.0f), position), glm::vec3(radius)));
+        }
+        else {
+            glm::vec3 extent(0.3f + unit(random), 0.5f + unit(random) * 4.0f, 0.3f + unit(random));
+            position.y = extent.y;
+            glm::mat4 transform = glm::rotate(glm::translate(glm::mat4(1.0f), position), unit(random) * PI, glm::vec3(0.0f, 1.0f, 0.0f));
+            addInstance(box, glm::scale(transform, extent));
+        }
+    }
+    scene.build();
+}
+
+std::vector<RayTracedShadows::StageErrors> RayTracedShadows::flyCamera(const SoftwareRayTracer& scene, int frames, JobSystem& jobs, double passMs[3]) {
+    const uint32_t renderWidth = FIELD_RENDER_WIDTH;
+    const uint32_t renderHeight = FIELD_RENDER_HEIGHT;
+    const uint32_t referenceSamples = FIELD_REFERENCE_SAMPLES;
+    // Reference texels are every fourth one along each axis
+    const uint32_t referenceSpacing = 4;
+
+    glm::mat4 proj = glm::perspective(glm::radians(60.0f), float(renderWidth) / renderHeight, 0.1f, 200.0f);
+    proj[1][1] *= -1;
+    glm::vec3 sunDirection = glm::normalize(glm::vec3(-0.4f, -0.8f, -0.3f));
+    // Drifting sideways and turning slowly, a tenth of a unit per frame
+    auto cameraView = [&](int frame) {
+        glm::vec3 eye(-10.0f + frame * 0.1f, 3.0f, -30.0f);
+        float yaw = 0.3f + frame * 0.004f;
+        return glm::lookAt(eye, eye + glm::vec3(std::sin(yaw), -0.2f, std::cos(yaw)), glm::vec3(0.0f, 1.0f, 0.0f));
+    };
+
+    RayTracedShadows shadows;
+    std::vector<StageErrors> errors;
+    std::vector<float> depth(size_t(renderWidth) * renderHeight);
+    // Error of each stage against the mean of many rays per texel, measured a few frames after the start and at the end
+    auto measure = [&](int frame, const GPUParams& params) {
+        double squared[3][2] = {};
+        uint32_t measured = 0;
+        for (uint32_t y = referenceSpacing / 2; y < shadows.height; y += referenceSpacing) {
+            for (uint32_t x = referenceSpacing / 2; x < shadows.width; x += referenceSpacing) {
+                size_t index = size_t(y) * shadows.width + x;
+                if (shadows.traced[index].z == 0.0f) {
+                    continue;
+                }
+                glm::vec2 reference(0.0f);
+                for (uint32_t sample = 0; sample < referenceSamples; sample++) {
+                    reference += glm::vec2(traceTexel(params, depth.data(), scene, x, y, 0x800000 + sample));
+                }
+                reference /= static_cast<float>(referenceSamples);
+                const glm::vec4* stages[3] = { &shadows.getTraced()[index], &shadows.getAccumulated()[index], &shadows.getDenoised()[index] };
+                for (int stage = 0; stage < 3; stage++) {
+                    glm::vec2 error = glm::vec2(*stages[stage]) - reference;
+                    squared[stage][0] += error.x * error.x;
+                    squared[stage][1] += error.y * error.y;
+                }
+                measured++;
+            }
+        }
+        float count = static_cast<float>(std::max(measured, 1u));
+        errors.push_back({ frame + 1, glm::sqrt(glm::vec2(squared[0][0], squared[0][1]) / count),
+            glm::sqrt(glm::vec2(squared[1][0], squared[1][1]) / count), glm::sqrt(glm::vec2(squared[2][0], squared[2][1]) / count) });
+    };
+
+    for (int frame = 0; frame < frames; frame++) {
+        glm::mat4 view = cameraView(frame);
+        glm::mat4 viewProj = proj * view;
+        glm::mat4 invViewProj = glm::inverse(viewProj);
+        glm::vec3 eye = glm::vec3(glm::inverse(view)[3]);
+        // Primary visibility stands in for the depth pre-pass
+        jobs.parallelFor(renderHeight, ROW_BATCH, [&](size_t begin, size_t end) {
+            for (size_t y = begin; y < end; y++) {
+                for (uint32_t x = 0; x < renderWidth; x++) {
+                    glm::vec2 ndc = (glm::vec2(x, y) + 0.5f) / glm::vec2(renderWidth, renderHeight) * 2.0f - 1.0f;
+                    glm::vec4 target = invViewProj * glm::vec4(ndc, 0.5f, 1.0f);
+                    Ray ray;
+                    ray.origin = eye;
+                    ray.direction = glm::normalize(glm::vec3(target) / target.w - eye);
+                    SoftwareRayTracer::Hit hit = scene.intersect(ray);
+                    float value = 1.0f;
+                    if (hit.instance != UINT32_MAX) {
+                        glm::vec4 clip = viewProj * glm::vec4(ray.origin + ray.direction * hit.t, 1.0f);
+                        value = clip.z / clip.w;
+                    }
+                    depth[y * renderWidth + x] = value;
+                }
+            }
+        });
+
+        GPUParams params = shadows.beginFrame(view, proj, sunDirection, renderWidth, renderHeight);
+        auto start = std::chrono::high_resolution_clock::now();
+        shadows.trace(params, depth.data(), scene, &jobs);
+        auto traced = std::chrono::high_resolution_clock::now();
+        shadows.accumulate(params, &jobs);
+        auto accumulated = std::chrono::high_resolution_clock::now();
+        shadows.denoise(params, &jobs);
+        auto denoised = std::chrono::high_resolution_clock::now();
+        passMs[0] += std::chrono::duration<double, std::milli>(traced - start).count();
+        passMs[1] += std::chrono::duration<double, std::milli>(accumulated - traced).count();
+        passMs[2] += std::chrono::duration<double, std::milli>(denoised - accumulated).count();
+
+        if (frame == 3 || frame == frames - 1) {
+            measure(frame, params);
+        }
+    }
+
+    return errors;
+}
+
+bool RayTracedShadows::runSelfTest() {
+    size_t checks = 0;
+    size_t failures = 0;
+    auto check = [&](bool ok, const std::string& what) {
+        checks++;
+        if (!ok) {
+            if (failures < 10) {
+                printf("    FAILED: %s \n", what.c_str());
+            }
+            failures++;
+        }
+    };
+
+    SoftwareRayTracer scene;
+    std::vector<glm::vec3> worldTriangles;
+    buildPillarField(scene, worldTriangles);
+    JobSystem jobs;
+    double passMs[3] = {};
+    for (const StageErrors& errors : flyCamera(scene, 32, jobs, passMs)) {
+        printf("    frame %2d RMSE sun / ambient: 1 ray %.3f / %.3f, temporal + spatial %.3f / %.3f \n", errors.frame,
+            errors.traced.x, errors.traced.y, errors.denoised.x, errors.denoised.y);
+        std::string frame = "frame " + std::to_string(errors.frame) + ": ";
+        check(errors.accumulated.x < errors.traced.x, frame + "accumulating brings sun visibility closer than one ray");
+        check(errors.denoised.x < errors.traced.x, frame + "filtering brings sun visibility closer than one ray");
+        check(errors.accumulated.y < errors.traced.y, frame + "accumulating brings ambient visibility closer than one ray");
+        check(errors.denoised.y < errors.traced.y, frame + "filtering brings ambient visibility closer than one ray");
+    }
+
+    printf("%zu checks, %zu failed \n", checks, failures);
+    return failures == 0;
+}
+
+void RayTracedShadows::runBenchmark() {
+    const int frames = 32;
+
+    SoftwareRayTracer scene;
+    std::vector<glm::vec3> worldTriangles;
+    buildPillarField(scene, worldTriangles);
+
+    std::mt19937 random(44);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    // The two levels against testing every triangle
+    const int checkRays = 2000;
+    int closestMismatches = 0;
+    int anyMismatches = 0;
+    for (int i = 0; i < checkRays; i++) {
+        Ray ray;
+        ray.origin = glm::vec3((unit(random) - 0.5f) * 90.0f, unit(random) * 6.0f, (unit(random) - 0.5f) * 90.0f);
+        ray.direction = glm::normalize(glm::vec3(unit(random) - 0.5f, unit(random) - 0.5f, unit(random) - 0.5f));
+        ray.tMax = unit(random) * 40.0f;
+        float nearest = ray.tMax;
+        bool hit = false;
+        for (size_t j = 0; j < worldTriangles.size(); j += 3) {
+            glm::vec3 p = glm::cross(ray.direction, worldTriangles[j + 2]);
+            float determinant = glm::dot(worldTriangles[j + 1], p);
+            if (determinant == 0.0f) {
+                continue;
+            }
+            glm::vec3 toOrigin = ray.origin - worldTriangles[j];
+            float u = glm::dot(toOrigin, p) / determinant;
+            glm::vec3 q = glm::cross(toOrigin, worldTriangles[j + 1]);
+            float v = glm::dot(ray.direction, q) / determinant;
+            float t = glm::dot(worldTriangles[j + 2], q) / determinant;
+            if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t >= ray.tMin && t <= nearest) {
+                nearest = t;
+                hit = true;
+            }
+        }
+        SoftwareRayTracer::Hit found = scene.intersect(ray);
+        bool foundHit = found.instance != UINT32_MAX;
+        closestMismatches += foundHit != hit || (hit && std::abs(found.t - nearest) > 1e-3f * std::max(nearest, 1.0f));
+        anyMismatches += scene.occluded(ray) != hit;
+    }
+    printf("%zu triangles in %zu instances, %d random rays against every triangle: %d closest hit and %d any hit mismatches \n",
+        scene.triangleCount(), scene.instanceCount(), checkRays, closestMismatches, anyMismatches);
+
+    JobSystem jobs;
+    RayTracedShadows shadows;
+    printf("%ux%u render, %ux%u traced, %d frames, %u threads, errors against %u rays per texel \n", FIELD_RENDER_WIDTH, FIELD_RENDER_HEIGHT,
+        shadows.traceSize(FIELD_RENDER_WIDTH), shadows.traceSize(FIELD_RENDER_HEIGHT), frames, jobs.threadCount(), FIELD_REFERENCE_SAMPLES);
+    double passMs[3] = {};
+    for (const StageErrors& errors : flyCamera(scene, frames, jobs, passMs)) {
+        printf("    frame %2d RMSE sun / ambient: 1 ray %.3f / %.3f, temporal %.3f / %.3f, temporal + spatial %.3f / %.3f \n", errors.frame,
+            errors.traced.x, errors.traced.y, errors.accumulated.x, errors.accumulated.y, errors.denoised.x, errors.denoised.y);
+    }
+
+    double raysPerFrame = 2.0 * shadows.traceSize(FIELD_RENDER_WIDTH) * shadows.traceSize(FIELD_RENDER_HEIGHT);
+    printf("    trace %.2f ms (%.2f Mrays/s), accumulate %.2f ms, %u filter passes %.2f ms per frame \n", passMs[0] / frames,
+        raysPerFrame * frames / (passMs[0] * 1000.0), passMs[1] / frames, shadows.settings.denoiseIterations, passMs[2] / frames);
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "glm-0.9.6.3/glm.hpp"
+
+class JobSystem;
+class SoftwareRayTracer;
+
+// Sun shadows and ambient occlusion from one ray of each per texel, traced from the depth buffer's surfaces at a
+// fraction of the render resolution. The noisy result is blended into a history reprojected from the previous frame,
+// where the history's depth still matches, and the blend is then smoothed by an edge stopping à-trous filter.
+// The GPU runs this as three compute passes with ray queries against the TLAS. The same math is here on the CPU
+// against a SoftwareRayTracer, which the benchmark uses to measure how close each stage gets to the converged image
+class RayTracedShadows {
+
+public:
+	struct Settings {
+		// Trace texels per render pixel along each axis
+		float resolutionScale = 0.5f;
+		// Occluders further than this from a surface do not darken its ambient light, world units
+		float aoRadius = 1.0f;
+		// Angular radius of the sun in radians, shadow rays spread over its disc so penumbrae widen away from the caster
+		float sunAngularRadius = 0.02f;
+		// History is dropped where its depth differs from the reprojected one by more than this fraction of it
+		float depthRejection = 0.05f;
+		// Frames of history at most, a new sample always gets at least 1 / maxHistory of the blend
+		uint32_t maxHistory = 32;
+		// The same for sun visibility. The sun is small, so most texels see all of it or none with every ray, and a long
+		// history only smears the shadow edges as the view moves
+		uint32_t maxSunHistory = 4;
+		// Filter passes, each spreading its 5x5 taps twice as far apart as the one before
+		uint32_t denoiseIterations = 3;
+		// Distance of a tap from the center's tangent plane at which its weight falls to 1/e, as a fraction of depth
+		float planeSigma = 0.02f;
+		// Value difference at which a tap's weight falls to 1/e, in noise deviations of the center's history
+		float valueSigma = 1.0f;
+		// The same for sun visibility, tighter so the filter does not widen shadow edges
+		float sunValueSigma = 0.5f;
+	};
+
+	// Uniform buffer of the compute passes, std140
+	struct GPUParams {
+		// Render pixel position in [-1, 1] and depth buffer value to world space
+		glm::mat4 invViewProj;
+		// World space to the previous frame's clip space
+		glm::mat4 prevViewProj;
+		// World space direction towards the sun, w is the tangent of its angular radius
+		glm::vec4 toSun;
+		// xyz camera position, w AO ray length
+		glm::vec4 camera;
+		// xy trace texels, zw render pixels
+		glm::vec4 extent;
+		// xy previous frame's trace texels, z 1 when the history holds the previous frame, w frame index
+		glm::vec4 history;
+		// x 1 / proj[0][0], y 1 / proj[1][1], z proj[2][2], w proj[3][2]
+		glm::vec4 projection;
+		// x depthRejection, y maxHistory, z planeSigma, w valueSigma
+		glm::vec4 filtering;
+		// x maxSunHistory, y sunValueSigma
+		glm::vec4 sunFiltering;
+	};
+
+	RayTracedShadows();
+	explicit RayTracedShadows(const Settings& settings);
+
+	// Constants of the next frame for a glm::perspective projection, flipped in y or not, drawing renderWidth x
+	// renderHeight pixels. sunDirection points from the sun into the scene
+	GPUParams beginFrame(const glm::mat4& view, const glm::mat4& proj, const glm::vec3& sunDirection, uint32_t renderWidth, uint32_t renderHeight);
+	// The next frame starts without history, after a cut or when the history image was recreated
+	void resetHistory() { historyValid = false; }
+	// Trace texels along an axis of renderSize pixels
+	uint32_t traceSize(uint32_t renderSize) const;
+
+	// The passes on the CPU, with the math of rtshadows.comp, rtaccumulate.comp and rtdenoise.comp. depth holds the
+	// depth buffer value of every render pixel
+	void trace(const GPUParams& params, const float* depth, const SoftwareRayTracer& scene, JobSystem* jobs);
+	void accumulate(const GPUParams& params, JobSystem* jobs);
+	void denoise(const GPUParams& params, JobSystem* jobs);
+	// Texels written by each pass, x sun visibility, y ambient visibility, z view depth or 0 for the sky, w frames
+	// accumulated
+	const std::vector<glm::vec4>& getTraced() const { return traced; }
+	const std::vector<glm::vec4>& getAccumulated() const { return accumulated; }
+	const std::vector<glm::vec4>& getDenoised() const { return settings.denoiseIterations > 0 ? filtered[(settings.denoiseIterations - 1) % 2] : accumulated; }
+
+	const Settings& getSettings() const { return settings; }
+	void setSettings(const Settings& newSettings);
+
+	// Flies the benchmark's camera and checks that accumulating and filtering bring both channels closer to the many
+	// sample reference than one ray. Returns false if any check failed
+	static bool runSelfTest();
+	// A camera drifting over a field of pillars, traced on the CPU. Checks the two level BVH against testing every
+	// triangle, times the passes, and compares the traced, accumulated and filtered images with a many sample reference
+	static void runBenchmark();
+
+private:
+	// RMSE of each stage against the reference, x sun and y ambient visibility
+	struct StageErrors {
+		int frame;
+		glm::vec2 traced;
+		glm::vec2 accumulated;
+		glm::vec2 denoised;
+	};
+
+	// The benchmark's camera over scene, with the errors measured on the fourth and the last frame. Adds the time of
+	// each pass to passMs
+	static std::vector<StageErrors> flyCamera(const SoftwareRayTracer& scene, int frames, JobSystem& jobs, double passMs[3]);
+
+	// One shadow and one AO ray from the surface under a trace texel, seeded by frame
+	static glm::vec4 traceTexel(const GPUParams& params, const float* depth, const SoftwareRayTracer& scene, uint32_t x, uint32_t y, uint32_t frame);
+	void filterPass(const GPUParams& params, const std::vector<glm::vec4>& source, std::vector<glm::vec4>& target, int step, JobSystem* jobs) const;
+
+	Settings settings;
+	glm::mat4 previousViewProj{ 1.0f };
+	uint32_t previousWidth = 0;
+	uint32_t previousHeight = 0;
+	uint32_t frameIndex = 0;
+	bool historyValid = false;
+
+	// Images of the last frame at its trace size, the history is the previous frame's accumulation
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<glm::vec4> traced;
+	std::vector<glm::vec4> accumulated;
+	std::vector<glm::vec4> history;
+	std::vector<glm::vec4> filtered[2];
+};
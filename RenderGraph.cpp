@@ -0,0 +1,1109 @@
+#include "RenderGraph.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <stdexcept>
+
+namespace {
+    struct AccessInfo {
+        VkPipelineStageFlags stages;
+        VkAccessFlags access;
+        VkImageLayout layout;
+        VkImageUsageFlags usage;
+        bool write;
+    };
+
+    const VkAccessFlags WRITE_ACCESS = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+        VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+
+    const VkPipelineStageFlags DEPTH_TEST_STAGES = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+
+    AccessInfo accessInfo(RenderGraph::Access access) {
+        switch (access) {
+        case RenderGraph::Access::ColorAttachment:
+            return { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+                VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, true };
+        case RenderGraph::Access::DepthAttachment:
+            return { DEPTH_TEST_STAGES, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, true };
+        case RenderGraph::Access::DepthAttachmentRead:
+            return { DEPTH_TEST_STAGES, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT,
+                VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, false };
+        case RenderGraph::Access::FragmentSampled:
+            return { VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT, false };
+        case RenderGraph::Access::ComputeSampled:
+            return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT, false };
+        case RenderGraph::Access::ComputeStorage:
+            return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+                VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_USAGE_STORAGE_BIT, true };
+        case RenderGraph::Access::TransferRead:
+            return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+                VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT, false };
+        case RenderGraph::Access::TransferWrite:
+        default:
+            return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT, true };
+        }
+    }
+
+    bool isAttachment(RenderGraph::Access access) {
+        return access == RenderGraph::Access::ColorAttachment || access == RenderGraph::Access::DepthAttachment ||
+            access == RenderGraph::Access::DepthAttachmentRead;
+    }
+
+    bool isDepthFormat(VkFormat format) {
+        return format == VK_FORMAT_D16_UNORM || format == VK_FORMAT_D32_SFLOAT || format == VK_FORMAT_D32_SFLOAT_S8_UINT ||
+            format == VK_FORMAT_D24_UNORM_S8_UINT || format == VK_FORMAT_X8_D24_UNORM_PACK32;
+    }
+
+    VkImageAspectFlags aspectOf(VkFormat format) {
+        if (format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT) {
+            return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+        }
+        return isDepthFormat(format) ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+    }
+
+    // Only for the memory estimate of a CPU compile
+    uint32_t bytesPerPixel(VkFormat format) {
+        switch (format) {
+        case VK_FORMAT_R8_UNORM:
+            return 1;
+        case VK_FORMAT_D16_UNORM:
+        case VK_FORMAT_R16_SFLOAT:
+            return 2;
+        case VK_FORMAT_R16G16B16A16_SFLOAT:
+        case VK_FORMAT_D32_SFLOAT_S8_UINT:
+            return 8;
+        case VK_FORMAT_R32G32B32A32_SFLOAT:
+            return 16;
+        default:
+            return 4;
+        }
+    }
+
+    // Pipeline state of one image while the barriers are built
+    struct Tracked {
+        VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        // Stages and accesses of the last write, a layout transition counts as one
+        VkPipelineStageFlags writeStages = 0;
+        VkAccessFlags writeAccess = 0;
+        // Stages that read since then, a later write or transition has to wait for them
+        VkPipelineStageFlags readStages = 0;
+        // Where the last write has already been made visible
+        VkPipelineStageFlags visibleStages = 0;
+        VkAccessFlags visibleAccess = 0;
+    };
+
+    // Move an image into the state a use needs, returns false when no barrier is needed
+    bool transition(Tracked& state, const AccessInfo& info, RenderGraph::Barrier& barrier) {
+        barrier.oldLayout = state.layout;
+        barrier.newLayout = info.layout;
+        barrier.dstStages = info.stages;
+        barrier.dstAccess = info.access;
+
+        bool needed;
+        if (state.layout != info.layout || info.write) {
+            // Writes and transitions wait for everything before them, reads only need an execution dependency
+            needed = state.layout != info.layout || state.writeStages != 0 || state.readStages != 0;
+            barrier.srcStages = state.writeStages | state.readStages;
+            barrier.srcAccess = state.writeAccess;
+
+            state.layout = info.layout;
+            state.writeStages = info.stages;
+            state.writeAccess = info.write ? info.access & WRITE_ACCESS : 0;
+            state.readStages = info.write ? 0 : info.stages;
+            state.visibleStages = info.stages;
+            state.visibleAccess = info.access;
+        }
+        else {
+            needed = state.writeStages != 0 && ((info.stages & ~state.visibleStages) != 0 || (info.access & ~state.visibleAccess) != 0);
+            barrier.srcStages = state.writeStages;
+            barrier.srcAccess = state.writeAccess;
+            if (needed) {
+                state.visibleStages |= info.stages;
+                state.visibleAccess |= info.access;
+            }
+            state.readStages |= info.stages;
+        }
+
+        if (barrier.srcStages == 0) {
+            barrier.srcStages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+        }
+        return needed;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+DECLARING THE GRAPH
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void RenderGraph::PassBuilder::use(ResourceId resource, Access access, const VkClearValue* clear) {
+    if (resource >= graph.resources.size()) {
+        throw std::runtime_error("render graph pass uses an unknown resource");
+    }
+    Pass& target = graph.passes[pass];
+    for (const Use& existing : target.uses) {
+        if (existing.resource == resource) {
+            throw std::runtime_error("render graph pass uses the same image twice");
+        }
+    }
+    if (isAttachment(access) && target.type != PassType::Graphics) {
+        throw std::runtime_error("attachments can only be used by graphics passes");
+    }
+    if (isAttachment(access) && (access != Access::ColorAttachment) != isDepthFormat(graph.resources[resource].desc.format)) {
+        throw std::runtime_error("attachment access does not match the image format");
+    }
+
+    Use entry{};
+    entry.resource = resource;
+    entry.access = access;
+    entry.clear = clear != nullptr;
+    if (clear) {
+        entry.clearValue = *clear;
+    }
+    target.uses.push_back(entry);
+    graph.resources[resource].usage |= accessInfo(access).usage;
+}
+
+void RenderGraph::PassBuilder::colorAttachment(ResourceId resource, const VkClearColorValue* clear) {
+    VkClearValue value{};
+    if (clear) {
+        value.color = *clear;
+    }
+    use(resource, Access::ColorAttachment, clear ? &value : nullptr);
+}
+
+void RenderGraph::PassBuilder::depthAttachment(ResourceId resource, const VkClearDepthStencilValue* clear) {
+    VkClearValue value{};
+    if (clear) {
+        value.depthStencil = *clear;
+    }
+    use(resource, Access::DepthAttachment, clear ? &value : nullptr);
+}
+
+void RenderGraph::PassBuilder::depthReadOnly(ResourceId resource) {
+    use(resource, Access::DepthAttachmentRead, nullptr);
+}
+
+void RenderGraph::PassBuilder::read(ResourceId resource, Access access) {
+    if (accessInfo(access).write) {
+        throw std::runtime_error("read declared with a writing access");
+    }
+    use(resource, access, nullptr);
+}
+
+void RenderGraph::PassBuilder::write(ResourceId resource, Access access) {
+    if (!accessInfo(access).write) {
+        throw std::runtime_error("write declared with a reading access");
+    }
+    use(resource, access, nullptr);
+}
+
+void RenderGraph::PassBuilder::sideEffect() {
+    graph.passes[pass].sideEffect = true;
+}
+
+RenderGraph::ResourceId RenderGraph::createImage(const std::string& name, const ImageDesc& desc) {
+    Resource resource;
+    resource.name = name;
+    resource.desc = desc;
+    resources.push_back(resource);
+    return static_cast<ResourceId>(resources.size() - 1);
+}
+
+RenderGraph::ResourceId RenderGraph::importImage(const std::string& name, const ImageDesc& desc, const ExternalState& initial, const ExternalState& final) {
+    Resource resource;
+    resource.name = name;
+    resource.desc = desc;
+    resource.imported = true;
+    resource.initial = initial;
+    resource.final = final;
+    resources.push_back(resource);
+    return static_cast<ResourceId>(resources.size() - 1);
+}
+
+void RenderGraph::markOutput(ResourceId resource) {
+    resources[resource].output = true;
+}
+
+RenderGraph::PassId RenderGraph::addPass(const std::string& name, PassType type, const std::function<void(PassBuilder&)>& setup, ExecuteFunction execute) {
+    Pass pass;
+    pass.name = name;
+    pass.type = type;
+    pass.execute = std::move(execute);
+    passes.push_back(std::move(pass));
+
+    PassId id = static_cast<PassId>(passes.size() - 1);
+    PassBuilder builder(*this, id);
+    setup(builder);
+    return id;
+}
+
+void RenderGraph::setImportedImage(ResourceId resource, VkImage image, VkImageView view) {
+    resources[resource].image = image;
+    resources[resource].view = view;
+}
+
+void RenderGraph::setRenderArea(PassId pass, VkExtent2D extent) {
+    passes[pass].renderArea = extent;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+COMPILING
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// A write that keeps what was there before, so whatever wrote it earlier is still needed
+static bool preservesContents(RenderGraph::Access access, bool clear) {
+    if (access == RenderGraph::Access::ColorAttachment || access == RenderGraph::Access::DepthAttachment) {
+        return !clear;
+    }
+    return true;
+}
+
+void RenderGraph::cullPasses() {
+    // Walk back from the outputs, a pass lives when it writes an image that is still needed at that point
+    std::vector<bool> needed(resources.size());
+    for (size_t i = 0; i < resources.size(); i++) {
+        needed[i] = resources[i].imported || resources[i].output;
+    }
+
+    for (size_t p = passes.size(); p-- > 0;) {
+        Pass& pass = passes[p];
+        pass.alive = pass.sideEffect;
+        for (const Use& use : pass.uses) {
+            if (accessInfo(use.access).write && needed[use.resource]) {
+                pass.alive = true;
+            }
+        }
+        if (!pass.alive) {
+            continue;
+        }
+
+        // Cleared attachments make whatever was drawn into them before dead, everything else this pass touches is needed
+        for (const Use& use : pass.uses) {
+            AccessInfo info = accessInfo(use.access);
+            needed[use.resource] = !info.write || preservesContents(use.access, use.clear);
+        }
+    }
+
+    livePasses.clear();
+    for (size_t p = 0; p < passes.size(); p++) {
+        if (passes[p].alive) {
+            livePasses.push_back(static_cast<uint32_t>(p));
+        }
+    }
+}
+
+void RenderGraph::computeLifetimes() {
+    for (Resource& resource : resources) {
+        resource.firstUse = INVALID;
+        resource.lastUse = INVALID;
+    }
+    for (uint32_t order = 0; order < livePasses.size(); order++) {
+        for (const Use& use : passes[livePasses[order]].uses) {
+            Resource& resource = resources[use.resource];
+            if (resource.firstUse == INVALID) {
+                resource.firstUse = order;
+            }
+            resource.lastUse = order;
+        }
+    }
+}
+
+void RenderGraph::placeTransients() {
+    std::vector<ResourceId> order;
+    for (ResourceId id = 0; id < resources.size(); id++) {
+        Resource& resource = resources[id];
+        resource.placement = Placement();
+        if (!resource.imported && resource.firstUse != INVALID) {
+            resource.placement.size = resource.requirements.size;
+            order.push_back(id);
+        }
+    }
+    // Largest first, the small ones fill the gaps between them
+    std::sort(order.begin(), order.end(), [&](ResourceId a, ResourceId b) {
+        if (resources[a].requirements.size != resources[b].requirements.size) {
+            return resources[a].requirements.size > resources[b].requirements.size;
+        }
+        return resources[a].firstUse < resources[b].firstUse;
+    });
+
+    blockSizes.clear();
+    blockTypeBits.clear();
+    std::vector<std::vector<ResourceId>> blockResources;
+    for (ResourceId id : order) {
+        Resource& resource = resources[id];
+        VkDeviceSize alignment = std::max<VkDeviceSize>(resource.requirements.alignment, 1);
+        VkDeviceSize size = resource.requirements.size;
+
+        uint32_t bestBlock = INVALID;
+        VkDeviceSize bestOffset = 0;
+        for (uint32_t block = 0; block < blockSizes.size() && bestBlock == INVALID; block++) {
+            if ((blockTypeBits[block] & resource.requirements.memoryTypeBits) == 0) {
+                continue;
+            }
+            // Images alive at the same time as this one are in the way, the lowest offset clear of all of them wins
+            std::vector<std::pair<VkDeviceSize, VkDeviceSize>> taken;
+            for (ResourceId other : blockResources[block]) {
+                const Resource& placed = resources[other];
+                if (placed.firstUse <= resource.lastUse && resource.firstUse <= placed.lastUse) {
+                    taken.push_back({ placed.placement.offset, placed.placement.offset + placed.placement.size });
+                }
+            }
+            std::sort(taken.begin(), taken.end());
+            VkDeviceSize offset = 0;
+            for (const auto& range : taken) {
+                if (offset + size <= range.first) {
+                    break;
+                }
+                offset = std::max(offset, (range.second + alignment - 1) / alignment * alignment);
+            }
+            // Past the end only grows the block, which costs no more than a block of its own
+            bestBlock = block;
+            bestOffset = offset;
+        }
+
+        if (bestBlock == INVALID) {
+            bestBlock = static_cast<uint32_t>(blockSizes.size());
+            blockSizes.push_back(0);
+            blockTypeBits.push_back(resource.requirements.memoryTypeBits);
+            blockResources.emplace_back();
+        }
+        resource.placement.block = bestBlock;
+        resource.placement.offset = bestOffset;
+        blockSizes[bestBlock] = std::max(blockSizes[bestBlock], bestOffset + size);
+        blockTypeBits[bestBlock] &= resource.requirements.memoryTypeBits;
+        blockResources[bestBlock].push_back(id);
+    }
+}
+
+bool RenderGraph::aliases(const Resource& a, const Resource& b) const {
+    return a.placement.block != INVALID && a.placement.block == b.placement.block &&
+        a.placement.offset < b.placement.offset + b.placement.size && b.placement.offset < a.placement.offset + a.placement.size;
+}
+
+void RenderGraph::buildBarriers() {
+    // First run without barriers for the state every image is left in at the end of a frame
+    std::vector<Tracked> states(resources.size());
+    for (uint32_t passIndex : livePasses) {
+        for (const Use& use : passes[passIndex].uses) {
+            Barrier unused{};
+            transition(states[use.resource], accessInfo(use.access), unused);
+        }
+    }
+    for (size_t i = 0; i < resources.size(); i++) {
+        resources[i].endStages = states[i].writeStages | states[i].readStages;
+        resources[i].endAccess = states[i].writeAccess;
+    }
+
+    // A transient starts undefined. Its first use waits for the last use of every image in the same memory, in this
+    // frame when that image came earlier and in the previous frame otherwise, itself included
+    for (size_t i = 0; i < resources.size(); i++) {
+        Resource& resource = resources[i];
+        Tracked state;
+        if (resource.imported) {
+            state.layout = resource.initial.layout;
+            state.writeStages = resource.initial.stages;
+            state.writeAccess = resource.initial.access;
+        }
+        else if (resource.firstUse != INVALID) {
+            for (const Resource& other : resources) {
+                if (&other == &resource || aliases(resource, other)) {
+                    state.writeStages |= other.endStages;
+                    state.writeAccess |= other.endAccess;
+                }
+            }
+        }
+        states[i] = state;
+    }
+
+    for (uint32_t passIndex : livePasses) {
+        Pass& pass = passes[passIndex];
+        pass.barriers.clear();
+        for (const Use& use : pass.uses) {
+            Barrier barrier{};
+            barrier.resource = use.resource;
+            if (transition(states[use.resource], accessInfo(use.access), barrier)) {
+                pass.barriers.push_back(barrier);
+            }
+        }
+    }
+
+    // Imported images are handed back the way the outside expects them
+    finalBarriers.clear();
+    for (size_t i = 0; i < resources.size(); i++) {
+        const Resource& resource = resources[i];
+        if (!resource.imported || resource.firstUse == INVALID) {
+            continue;
+        }
+        AccessInfo info{ resource.final.stages, resource.final.access, resource.final.layout, 0, false };
+        Barrier barrier{};
+        barrier.resource = static_cast<ResourceId>(i);
+        if (transition(states[i], info, barrier)) {
+            finalBarriers.push_back(barrier);
+        }
+    }
+}
+
+void RenderGraph::compile(VkDevice device, VkPhysicalDevice gpu) {
+    this->device = device;
+    this->gpu = gpu;
+
+    cullPasses();
+    computeLifetimes();
+
+    if (device) {
+        createImages();
+    }
+    else {
+        // Optimal tiling sizes are not known without a device, linear size in 64 KB pages is close enough to plan with
+        for (Resource& resource : resources) {
+            const VkDeviceSize page = 64 * 1024;
+            VkDeviceSize bytes = VkDeviceSize(resource.desc.width) * resource.desc.height * bytesPerPixel(resource.desc.format);
+            resource.requirements.size = (bytes + page - 1) / page * page;
+            resource.requirements.alignment = page;
+            resource.requirements.memoryTypeBits = UINT32_MAX;
+        }
+    }
+    placeTransients();
+
+    if (device) {
+        // Every block is allocated from the first device local type all of its images accept
+        VkPhysicalDeviceMemoryProperties memoryProperties;
+        vkGetPhysicalDeviceMemoryProperties(gpu, &memoryProperties);
+        blockMemory.assign(blockSizes.size(), VK_NULL_HANDLE);
+        for (size_t block = 0; block < blockSizes.size(); block++) {
+            uint32_t typeIndex = INVALID;
+            for (uint32_t type = 0; type < memoryProperties.memoryTypeCount && typeIndex == INVALID; type++) {
+                if ((blockTypeBits[block] & (1u << type)) && (memoryProperties.memoryTypes[type].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)) {
+                    typeIndex = type;
+                }
+            }
+            if (typeIndex == INVALID) {
+                throw std::runtime_error("no device local memory type for render graph images");
+            }
+
+            VkMemoryAllocateInfo allocateInfo{};
+            allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+            allocateInfo.allocationSize = blockSizes[block];
+            allocateInfo.memoryTypeIndex = typeIndex;
+            if (vkAllocateMemory(device, &allocateInfo, nullptr, &blockMemory[block]) != VK_SUCCESS) {
+                throw std::runtime_error("failed to allocate render graph memory");
+            }
+        }
+
+        for (Resource& resource : resources) {
+            if (resource.imported || resource.image == VK_NULL_HANDLE) {
+                continue;
+            }
+            vkBindImageMemory(device, resource.image, blockMemory[resource.placement.block], resource.placement.offset);
+
+            VkImageViewCreateInfo viewCInfo{};
+            viewCInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+            viewCInfo.image = resource.image;
+            viewCInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+            viewCInfo.format = resource.desc.format;
+            viewCInfo.subresourceRange = { aspectOf(resource.desc.format), 0, 1, 0, 1 };
+            if (vkCreateImageView(device, &viewCInfo, nullptr, &resource.view) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create a render graph image view");
+            }
+        }
+    }
+
+    buildBarriers();
+
+    if (device) {
+        createRenderPasses();
+    }
+}
+
+void RenderGraph::createImages() {
+    for (Resource& resource : resources) {
+        if (resource.imported || resource.firstUse == INVALID) {
+            continue;
+        }
+        VkImageCreateInfo imageCInfo{};
+        imageCInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageCInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageCInfo.extent = { resource.desc.width, resource.desc.height, 1 };
+        imageCInfo.mipLevels = 1;
+        imageCInfo.arrayLayers = 1;
+        imageCInfo.format = resource.desc.format;
+        imageCInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageCInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        imageCInfo.usage = resource.usage;
+        imageCInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        imageCInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        if (vkCreateImage(device, &imageCInfo, nullptr, &resource.image) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create a render graph image");
+        }
+        vkGetImageMemoryRequirements(device, resource.image, &resource.requirements);
+    }
+}
+
+void RenderGraph::createRenderPasses() {
+    for (uint32_t order = 0; order < livePasses.size(); order++) {
+        Pass& pass = passes[livePasses[order]];
+        if (pass.type != PassType::Graphics) {
+            continue;
+        }
+
+        // Barriers already put the attachments in their layouts, the render pass keeps them there
+        std::vector<VkAttachmentDescription> attachments;
+        std::vector<VkAttachmentReference> colorReferences;
+        VkAttachmentReference depthReference{ VK_ATTACHMENT_UNUSED, VK_IMAGE_LAYOUT_UNDEFINED };
+        for (const Use& use : pass.uses) {
+            if (!isAttachment(use.access)) {
+                continue;
+            }
+            const Resource& resource = resources[use.resource];
+            AccessInfo info = accessInfo(use.access);
+            bool firstUse = resource.imported ? (resource.firstUse == order && resource.initial.layout == VK_IMAGE_LAYOUT_UNDEFINED) : resource.firstUse == order;
+            bool usedLater = resource.imported || resource.output || resource.lastUse > order;
+
+            VkAttachmentDescription attachment{};
+            attachment.format = resource.desc.format;
+            attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+            attachment.loadOp = use.clear ? VK_ATTACHMENT_LOAD_OP_CLEAR : firstUse ? VK_ATTACHMENT_LOAD_OP_DONT_CARE : VK_ATTACHMENT_LOAD_OP_LOAD;
+            attachment.storeOp = usedLater ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+            attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+            attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+            attachment.initialLayout = info.layout;
+            attachment.finalLayout = info.layout;
+
+            VkAttachmentReference reference{ static_cast<uint32_t>(attachments.size()), info.layout };
+            if (use.access == Access::ColorAttachment) {
+                colorReferences.push_back(reference);
+            }
+            else {
+                depthReference = reference;
+            }
+            attachments.push_back(attachment);
+        }
+
+        VkSubpassDescription subpass{};
+        subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpass.colorAttachmentCount = static_cast<uint32_t>(colorReferences.size());
+        subpass.pColorAttachments = colorReferences.data();
+        subpass.pDepthStencilAttachment = depthReference.attachment == VK_ATTACHMENT_UNUSED ? nullptr : &depthReference;
+
+        VkRenderPassCreateInfo renderPassCInfo{};
+        renderPassCInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+        renderPassCInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+        renderPassCInfo.pAttachments = attachments.data();
+        renderPassCInfo.subpassCount = 1;
+        renderPassCInfo.pSubpasses = &subpass;
+        if (vkCreateRenderPass(device, &renderPassCInfo, nullptr, &pass.renderPass) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create a render pass for " + pass.name);
+        }
+    }
+}
+
+void RenderGraph::destroy(std::vector<VkRenderPass>* keptRenderPasses) {
+    if (device) {
+        for (Pass& pass : passes) {
+            for (auto& framebuffer : pass.framebuffers) {
+                vkDestroyFramebuffer(device, framebuffer.second, nullptr);
+            }
+            if (keptRenderPasses && pass.renderPass != VK_NULL_HANDLE) {
+                keptRenderPasses->push_back(pass.renderPass);
+            }
+            else {
+                vkDestroyRenderPass(device, pass.renderPass, nullptr);
+            }
+        }
+        for (Resource& resource : resources) {
+            if (!resource.imported) {
+                vkDestroyImageView(device, resource.view, nullptr);
+                vkDestroyImage(device, resource.image, nullptr);
+            }
+        }
+        for (VkDeviceMemory memory : blockMemory) {
+            vkFreeMemory(device, memory, nullptr);
+        }
+    }
+    passes.clear();
+    resources.clear();
+    livePasses.clear();
+    finalBarriers.clear();
+    blockSizes.clear();
+    blockTypeBits.clear();
+    blockMemory.clear();
+    device = VK_NULL_HANDLE;
+    gpu = VK_NULL_HANDLE;
+}
+
+VkDeviceSize RenderGraph::getAliasedSize() const {
+    VkDeviceSize total = 0;
+    for (VkDeviceSize size : blockSizes) {
+        total += size;
+    }
+    return total;
+}
+
+VkDeviceSize RenderGraph::getUnaliasedSize() const {
+    VkDeviceSize total = 0;
+    for (const Resource& resource : resources) {
+        if (resource.placement.block != INVALID) {
+            total += resource.placement.size;
+        }
+    }
+    return total;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+EXECUTING
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+VkFramebuffer RenderGraph::getFramebuffer(Pass& pass) {
+    std::vector<VkImageView> views;
+    VkExtent2D extent{ 0, 0 };
+    for (const Use& use : pass.uses) {
+        if (isAttachment(use.access)) {
+            const Resource& resource = resources[use.resource];
+            if (resource.view == VK_NULL_HANDLE) {
+                throw std::runtime_error("render graph attachment " + resource.name + " has no image view");
+            }
+            views.push_back(resource.view);
+            extent = { resource.desc.width, resource.desc.height };
+        }
+    }
+    for (const auto& framebuffer : pass.framebuffers) {
+        if (framebuffer.first == views) {
+            return framebuffer.second;
+        }
+    }
+
+    VkFramebufferCreateInfo frameBufferCInfo{};
+    frameBufferCInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    frameBufferCInfo.renderPass = pass.renderPass;
+    frameBufferCInfo.attachmentCount = static_cast<uint32_t>(views.size());
+    frameBufferCInfo.pAttachments = views.data();
+    frameBufferCInfo.width = extent.width;
+    frameBufferCInfo.height = extent.height;
+    frameBufferCInfo.layers = 1;
+
+    VkFramebuffer framebuffer;
+    if (vkCreateFramebuffer(device, &frameBufferCInfo, nullptr, &framebuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create a framebuffer for " + pass.name);
+    }
+    pass.framebuffers.push_back({ views, framebuffer });
+    return framebuffer;
+}
+
+static void recordBarriers(VkCommandBuffer commandBuffer, const std::vector<RenderGraph::Barrier>& barriers, const RenderGraph& graph) {
+    if (barriers.empty()) {
+        return;
+    }
+    VkPipelineStageFlags srcStages = 0;
+    VkPipelineStageFlags dstStages = 0;
+    std::vector<VkImageMemoryBarrier> imageBarriers(barriers.size());
+    for (size_t i = 0; i < barriers.size(); i++) {
+        const RenderGraph::Barrier& barrier = barriers[i];
+        VkImageMemoryBarrier& imageBarrier = imageBarriers[i];
+        imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        imageBarrier.oldLayout = barrier.oldLayout;
+        imageBarrier.newLayout = barrier.newLayout;
+        imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        imageBarrier.image = graph.getImage(barrier.resource);
+        imageBarrier.subresourceRange = { aspectOf(graph.getDesc(barrier.resource).format), 0, 1, 0, 1 };
+        imageBarrier.srcAccessMask = barrier.srcAccess;
+        imageBarrier.dstAccessMask = barrier.dstAccess;
+        srcStages |= barrier.srcStages;
+        dstStages |= barrier.dstStages;
+    }
+    vkCmdPipelineBarrier(commandBuffer, srcStages, dstStages, 0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+}
+
+void RenderGraph::execute(VkCommandBuffer commandBuffer, uint32_t frame) {
+    for (uint32_t passIndex : livePasses) {
+        Pass& pass = passes[passIndex];
+        for (const Barrier& barrier : pass.barriers) {
+            if (resources[barrier.resource].image == VK_NULL_HANDLE) {
+                throw std::runtime_error("render graph image " + resources[barrier.resource].name + " was not set");
+            }
+        }
+        recordBarriers(commandBuffer, pass.barriers, *this);
+
+        if (pass.type == PassType::Graphics) {
+            std::vector<VkClearValue> clearValues;
+            VkExtent2D extent{ 0, 0 };
+            for (const Use& use : pass.uses) {
+                if (isAttachment(use.access)) {
+                    clearValues.push_back(use.clearValue);
+                    extent = { resources[use.resource].desc.width, resources[use.resource].desc.height };
+                }
+            }
+
+            VkRenderPassBeginInfo RPBeginInfo{};
+            RPBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+            RPBeginInfo.renderPass = pass.renderPass;
+            RPBeginInfo.framebuffer = getFramebuffer(pass);
+            RPBeginInfo.renderArea.offset = { 0, 0 };
+            RPBeginInfo.renderArea.extent = pass.renderArea.width > 0 ? pass.renderArea : extent;
+            RPBeginInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+            RPBeginInfo.pClearValues = clearValues.data();
+            vkCmdBeginRenderPass(commandBuffer, &RPBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+        }
+
+        if (pass.execute) {
+            pass.execute(commandBuffer, frame);
+        }
+
+        if (pass.type == PassType::Graphics) {
+            vkCmdEndRenderPass(commandBuffer);
+        }
+    }
+    recordBarriers(commandBuffer, finalBarriers, *this);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+SELF TEST
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool RenderGraph::runSelfTest() {
+    size_t checks = 0;
+    size_t failures = 0;
+    auto check = [&](bool ok, const std::string& what) {
+        checks++;
+        if (!ok) {
+            if (failures < 10) {
+                printf("    FAILED: %s \n", what.c_str());
+            }
+            failures++;
+        }
+    };
+
+    // Replays the compiled graph with its own model of what each barrier orders and makes visible, and checks every use
+    // against it. Shares nothing with the compiler but the access table
+    auto validate = [&](const RenderGraph& graph, const std::string& label) {
+        // Culling: a pass is needed when something after it sees one of its writes
+        auto observed = [&](size_t passIndex, ResourceId resourceId) {
+            for (size_t next = passIndex + 1; next < graph.passes.size(); next++) {
+                if (!graph.passes[next].alive) {
+                    continue;
+                }
+                for (const Use& use : graph.passes[next].uses) {
+                    if (use.resource == resourceId) {
+                        return !accessInfo(use.access).write || preservesContents(use.access, use.clear);
+                    }
+                }
+            }
+            return graph.resources[resourceId].imported || graph.resources[resourceId].output;
+        };
+        for (size_t p = 0; p < graph.passes.size(); p++) {
+            const Pass& pass = graph.passes[p];
+            bool needed = pass.sideEffect;
+            for (const Use& use : pass.uses) {
+                needed = needed || (accessInfo(use.access).write && observed(p, use.resource));
+            }
+            check(needed == pass.alive, label + ": pass " + pass.name + (pass.alive ? " kept but not needed" : " culled but needed"));
+        }
+
+        struct Reader {
+            VkPipelineStageFlags stages;
+            VkPipelineStageFlags ordered;
+        };
+        for (ResourceId id = 0; id < graph.resources.size(); id++) {
+            const Resource& resource = graph.resources[id];
+            if (resource.firstUse == INVALID) {
+                continue;
+            }
+            std::string name = label + ": " + resource.name;
+
+            VkImageLayout layout = resource.imported ? resource.initial.layout : VK_IMAGE_LAYOUT_UNDEFINED;
+            bool hasWrite = resource.imported;
+            VkPipelineStageFlags writeStages = resource.imported ? resource.initial.stages : 0;
+            VkAccessFlags writeAccess = resource.imported ? resource.initial.access : 0;
+            // Stages ordered after the last write and the accesses it is visible to
+            VkPipelineStageFlags ordered = 0;
+            VkAccessFlags visible = 0;
+            bool available = writeAccess == 0;
+            std::vector<Reader> readers;
+
+            auto applyBarrier = [&](const Barrier& barrier, uint32_t order) {
+                bool afterWrite = !hasWrite || (barrier.srcStages & writeStages) == writeStages || (barrier.srcStages & ordered) != 0;
+                bool madeAvailable = !hasWrite || available || (afterWrite && (barrier.srcAccess & writeAccess) == writeAccess);
+                if (barrier.oldLayout != barrier.newLayout) {
+                    bool discard = barrier.oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && !resource.imported && order == resource.firstUse;
+                    check(barrier.oldLayout == layout || discard, name + " transition from the wrong layout");
+                    check(discard || (afterWrite && madeAvailable), name + " transition not ordered after the last write");
+                    for (const Reader& reader : readers) {
+                        check((barrier.srcStages & reader.stages) == reader.stages || (barrier.srcStages & reader.ordered) != 0,
+                            name + " transition not ordered after a read");
+                    }
+                    // The transition is a write of its own, already ordered before and visible to the barrier's destination
+                    layout = barrier.newLayout;
+                    hasWrite = true;
+                    writeStages = barrier.dstStages;
+                    writeAccess = 0;
+                    ordered = barrier.dstStages;
+                    visible = barrier.dstAccess;
+                    available = true;
+                    readers.clear();
+                    return;
+                }
+                if (afterWrite) {
+                    ordered |= barrier.dstStages;
+                }
+                if (madeAvailable && afterWrite) {
+                    available = true;
+                    visible |= barrier.dstAccess;
+                }
+                for (Reader& reader : readers) {
+                    if ((barrier.srcStages & reader.stages) == reader.stages || (barrier.srcStages & reader.ordered) != 0) {
+                        reader.ordered |= barrier.dstStages;
+                    }
+                }
+            };
+
+            auto applyUse = [&](const AccessInfo& info) {
+                check(layout == info.layout, name + " used in the wrong layout");
+                if (hasWrite) {
+                    check((info.stages & ~ordered) == 0, name + " used before the last write finished");
+                    check(available && (info.access & ~visible) == 0, name + " used before the last write was visible");
+                }
+                if (info.write) {
+                    for (const Reader& reader : readers) {
+                        check((info.stages & ~reader.ordered) == 0, name + " written before an earlier read finished");
+                    }
+                    hasWrite = true;
+                    writeStages = info.stages;
+                    writeAccess = info.access & WRITE_ACCESS;
+                    ordered = 0;
+                    visible = 0;
+                    available = false;
+                    readers.clear();
+                }
+                else {
+                    readers.push_back({ info.stages, 0 });
+                }
+            };
+
+            for (uint32_t order = 0; order < graph.livePasses.size(); order++) {
+                const Pass& pass = graph.passes[graph.livePasses[order]];
+                for (const Barrier& barrier : pass.barriers) {
+                    if (barrier.resource == id) {
+                        applyBarrier(barrier, order);
+                    }
+                }
+                for (const Use& use : pass.uses) {
+                    if (use.resource == id) {
+                        applyUse(accessInfo(use.access));
+                    }
+                }
+            }
+            if (resource.imported) {
+                for (const Barrier& barrier : graph.finalBarriers) {
+                    if (barrier.resource == id) {
+                        applyBarrier(barrier, INVALID);
+                    }
+                }
+                applyUse({ resource.final.stages, resource.final.access, resource.final.layout, 0, false });
+                continue;
+            }
+
+            // Transients: what has to finish before the memory is reused, by an alias or by the next frame
+            VkPipelineStageFlags lastStages = 0;
+            VkAccessFlags lastWrites = 0;
+            layout = VK_IMAGE_LAYOUT_UNDEFINED;
+            for (uint32_t order = 0; order < graph.livePasses.size(); order++) {
+                for (const Use& use : graph.passes[graph.livePasses[order]].uses) {
+                    if (use.resource == id) {
+                        AccessInfo info = accessInfo(use.access);
+                        lastStages = info.write || info.layout != layout ? info.stages : lastStages | info.stages;
+                        // A transition already made the writes before it available
+                        lastWrites = info.write ? info.access & WRITE_ACCESS : info.layout != layout ? 0 : lastWrites;
+                        layout = info.layout;
+                    }
+                }
+            }
+            check(resource.placement.offset % resource.requirements.alignment == 0, name + " misaligned");
+            check(resource.placement.offset + resource.placement.size <= graph.blockSizes[resource.placement.block], name + " outside its block");
+
+            for (ResourceId otherId = 0; otherId < graph.resources.size(); otherId++) {
+                const Resource& other = graph.resources[otherId];
+                if (other.imported || other.firstUse == INVALID || !(otherId == id || graph.aliases(resource, other))) {
+                    continue;
+                }
+                if (otherId != id) {
+                    check(resource.lastUse < other.firstUse || other.lastUse < resource.firstUse, name + " shares memory with " + other.name + " while both are alive");
+                }
+                // The first barrier of whatever comes next in the memory has to wait for this one's last use
+                const Pass& firstPass = graph.passes[graph.livePasses[other.firstUse]];
+                bool waited = false;
+                for (const Barrier& barrier : firstPass.barriers) {
+                    if (barrier.resource == otherId) {
+                        waited = barrier.oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && (barrier.srcStages & lastStages) == lastStages &&
+                            (barrier.srcAccess & lastWrites) == lastWrites;
+                    }
+                }
+                check(waited, label + ": " + other.name + " does not wait for " + resource.name + " before reusing its memory");
+            }
+        }
+    };
+
+    // A deferred frame: the debug view and the swap chain clear are dead, the bloom targets fit in the G-buffer's memory
+    {
+        RenderGraph graph;
+        VkClearColorValue black{};
+        VkClearDepthStencilValue far{ 1.0f, 0 };
+        ResourceId shadowMap = graph.createImage("ShadowMap", { 2048, 2048, VK_FORMAT_D32_SFLOAT });
+        ResourceId albedo = graph.createImage("GBufferAlbedo", { 1920, 1080, VK_FORMAT_R8G8B8A8_UNORM });
+        ResourceId normals = graph.createImage("GBufferNormals", { 1920, 1080, VK_FORMAT_R16G16B16A16_SFLOAT });
+        ResourceId depth = graph.createImage("Depth", { 1920, 1080, VK_FORMAT_D32_SFLOAT });
+        ResourceId hdr = graph.createImage("HDR", { 1920, 1080, VK_FORMAT_R16G16B16A16_SFLOAT });
+        ResourceId bloomDown = graph.createImage("BloomDown", { 960, 540, VK_FORMAT_R16G16B16A16_SFLOAT });
+        ResourceId bloomBlur = graph.createImage("BloomBlur", { 960, 540, VK_FORMAT_R16G16B16A16_SFLOAT });
+        ResourceId debugView = graph.createImage("DebugView", { 1920, 1080, VK_FORMAT_R8G8B8A8_UNORM });
+        ExternalState acquired{ VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0 };
+        ExternalState present{ VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0 };
+        ResourceId swapChain = graph.importImage("SwapChain", { 1920, 1080, VK_FORMAT_B8G8R8A8_SRGB }, acquired, present);
+
+        PassId shadowPass = graph.addPass("Shadows", PassType::Graphics, [&](PassBuilder& pass) { pass.depthAttachment(shadowMap, &far); }, nullptr);
+        graph.addPass("GBuffer", PassType::Graphics, [&](PassBuilder& pass) {
+            pass.colorAttachment(albedo, &black);
+            pass.colorAttachment(normals, &black);
+            pass.depthAttachment(depth, &far);
+        }, nullptr);
+        PassId debugPass = graph.addPass("Debug", PassType::Graphics, [&](PassBuilder& pass) {
+            pass.colorAttachment(debugView, &black);
+            pass.depthReadOnly(depth);
+        }, nullptr);
+        graph.addPass("Lighting", PassType::Compute, [&](PassBuilder& pass) {
+            pass.read(albedo, Access::ComputeSampled);
+            pass.read(normals, Access::ComputeSampled);
+            pass.read(depth, Access::ComputeSampled);
+            pass.read(shadowMap, Access::ComputeSampled);
+            pass.write(hdr, Access::ComputeStorage);
+        }, nullptr);
+        graph.addPass("BloomDownsample", PassType::Compute, [&](PassBuilder& pass) {
+            pass.read(hdr, Access::ComputeSampled);
+            pass.write(bloomDown, Access::ComputeStorage);
+        }, nullptr);
+        graph.addPass("BloomBlur", PassType::Compute, [&](PassBuilder& pass) {
+            pass.read(bloomDown, Access::ComputeSampled);
+            pass.write(bloomBlur, Access::ComputeStorage);
+        }, nullptr);
+        PassId clearPass = graph.addPass("ClearSwapChain", PassType::Graphics, [&](PassBuilder& pass) { pass.colorAttachment(swapChain, &black); }, nullptr);
+        graph.addPass("Tonemap", PassType::Graphics, [&](PassBuilder& pass) {
+            pass.read(hdr, Access::FragmentSampled);
+            pass.read(bloomBlur, Access::FragmentSampled);
+            pass.colorAttachment(swapChain, &black);
+        }, nullptr);
+
+        auto start = std::chrono::high_resolution_clock::now();
+        const int compiles = 1000;
+        for (int i = 0; i < compiles; i++) {
+            graph.compile();
+        }
+        double compileUs = std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - start).count() / compiles;
+
+        validate(graph, "deferred");
+        check(graph.isCulled(debugPass) && graph.isCulled(clearPass) && !graph.isCulled(shadowPass) && graph.livePasses.size() == 6, "deferred: culled passes");
+        check(graph.getAliasedSize() < graph.getUnaliasedSize(), "deferred: nothing aliased");
+        size_t barrierCount = graph.finalBarriers.size();
+        for (uint32_t passIndex : graph.livePasses) {
+            barrierCount += graph.passes[passIndex].barriers.size();
+        }
+        printf("Deferred frame: %zu of %zu passes live, %zu barriers, transient memory %.1f MB aliased from %.1f MB, compiled in %.1f us \n",
+            graph.livePasses.size(), graph.passes.size(), barrierCount, graph.getAliasedSize() / 1048576.0, graph.getUnaliasedSize() / 1048576.0, compileUs);
+    }
+
+    // Random graphs, every pass touching a few images in whatever way its type allows
+    std::mt19937 random(2024);
+    const int graphCount = 5000;
+    VkDeviceSize aliasedTotal = 0;
+    VkDeviceSize unaliasedTotal = 0;
+    size_t culledTotal = 0;
+    size_t passTotal = 0;
+    for (int g = 0; g < graphCount; g++) {
+        RenderGraph graph;
+        std::string label = "random graph " + std::to_string(g);
+        const VkFormat formats[] = { VK_FORMAT_R8G8B8A8_UNORM, VK_FORMAT_R16G16B16A16_SFLOAT, VK_FORMAT_R32_SFLOAT, VK_FORMAT_D32_SFLOAT };
+        const uint32_t sizes[] = { 256, 512, 1024, 2048 };
+
+        uint32_t transientCount = 2 + random() % 10;
+        for (uint32_t i = 0; i < transientCount; i++) {
+            ResourceId id = graph.createImage("T" + std::to_string(i), { sizes[random() % 4], sizes[random() % 4], formats[random() % 4] });
+            if (random() % 10 == 0) {
+                graph.markOutput(id);
+            }
+        }
+        ExternalState initial{ random() % 2 ? VK_IMAGE_LAYOUT_UNDEFINED : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0 };
+        ExternalState final{ VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0 };
+        graph.importImage("Output", { 1024, 1024, VK_FORMAT_B8G8R8A8_SRGB }, initial, final);
+
+        uint32_t passCount = 3 + random() % 14;
+        for (uint32_t p = 0; p < passCount; p++) {
+            PassType type = static_cast<PassType>(random() % 3);
+            graph.addPass("P" + std::to_string(p), type, [&](PassBuilder& pass) {
+                std::vector<ResourceId> candidates(graph.resources.size());
+                for (ResourceId id = 0; id < candidates.size(); id++) {
+                    candidates[id] = id;
+                }
+                std::shuffle(candidates.begin(), candidates.end(), random);
+                uint32_t useCount = 1 + random() % 4;
+                bool hasDepth = false;
+                for (uint32_t u = 0; u < useCount && u < candidates.size(); u++) {
+                    ResourceId id = candidates[u];
+                    bool depthFormat = isDepthFormat(graph.resources[id].desc.format);
+                    VkClearValue clear{};
+                    bool clears = random() % 3 == 0;
+                    uint32_t pick = random() % 2;
+                    if (type == PassType::Graphics) {
+                        if (depthFormat && !hasDepth && pick == 0) {
+                            pass.use(id, random() % 2 ? Access::DepthAttachment : Access::DepthAttachmentRead, clears ? &clear : nullptr);
+                            hasDepth = true;
+                        }
+                        else if (!depthFormat && pick == 0) {
+                            pass.use(id, Access::ColorAttachment, clears ? &clear : nullptr);
+                        }
+                        else {
+                            pass.read(id, Access::FragmentSampled);
+                        }
+                    }
+                    else if (type == PassType::Compute) {
+                        if (!depthFormat && pick == 0) {
+                            pass.write(id, Access::ComputeStorage);
+                        }
+                        else {
+                            pass.read(id, Access::ComputeSampled);
+                        }
+                    }
+                    else {
+                        pick == 0 ? pass.write(id, Access::TransferWrite) : pass.read(id, Access::TransferRead);
+                    }
+                }
+                if (random() % 10 == 0) {
+                    pass.sideEffect();
+                }
+            }, nullptr);
+        }
+
+        graph.compile();
+        validate(graph, label);
+        aliasedTotal += graph.getAliasedSize();
+        unaliasedTotal += graph.getUnaliasedSize();
+        culledTotal += graph.passes.size() - graph.livePasses.size();
+        passTotal += graph.passes.size();
+    }
+    printf("%d random graphs: %zu of %zu passes culled, transient memory %.0f%% of unaliased \n",
+        graphCount, culledTotal, passTotal, 100.0 * aliasedTotal / std::max<VkDeviceSize>(unaliasedTotal, 1));
+
+    printf("%zu checks, %zu failed \n", checks, failures);
+    return failures == 0;
+}
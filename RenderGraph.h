@@ -0,0 +1,197 @@
+#pragma once
+
+#include <volk.h>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Frame described as passes that declare which images they read and write. Compiling it culls the passes nothing
+// depends on, works out every layout transition and barrier between the passes that are left, and places the transient
+// images whose lifetimes do not overlap in the same memory. Passes run in the order they were added.
+// Without a device it compiles on the CPU alone, with memory sizes estimated from the formats, so the decisions can
+// be checked without a GPU
+class RenderGraph {
+
+public:
+	using ResourceId = uint32_t;
+	using PassId = uint32_t;
+	static const uint32_t INVALID = UINT32_MAX;
+
+	enum class PassType {
+		// Runs inside a render pass the graph creates from its attachments
+		Graphics,
+		Compute,
+		Transfer
+	};
+
+	// How a pass uses an image, each maps to the stages, access flags and layout the barriers are built from
+	enum class Access {
+		ColorAttachment,
+		DepthAttachment,
+		// Depth tested but not written
+		DepthAttachmentRead,
+		FragmentSampled,
+		ComputeSampled,
+		ComputeStorage,
+		TransferRead,
+		TransferWrite
+	};
+
+	struct ImageDesc {
+		uint32_t width = 1;
+		uint32_t height = 1;
+		VkFormat format = VK_FORMAT_UNDEFINED;
+	};
+
+	// What an imported image looks like outside the graph, before the first pass and after the last
+	struct ExternalState {
+		VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VkPipelineStageFlags stages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+		VkAccessFlags access = 0;
+	};
+
+	struct Barrier {
+		ResourceId resource;
+		VkImageLayout oldLayout;
+		VkImageLayout newLayout;
+		VkPipelineStageFlags srcStages;
+		VkPipelineStageFlags dstStages;
+		VkAccessFlags srcAccess;
+		VkAccessFlags dstAccess;
+	};
+
+	// Where a transient image ended up, images in the same block with overlapping ranges are never alive together
+	struct Placement {
+		uint32_t block = INVALID;
+		VkDeviceSize offset = 0;
+		VkDeviceSize size = 0;
+	};
+
+	using ExecuteFunction = std::function<void(VkCommandBuffer commandBuffer, uint32_t frame)>;
+
+	class PassBuilder {
+	public:
+		// Without a clear value the attachment keeps what earlier passes drew, or starts undefined when none did
+		void colorAttachment(ResourceId resource, const VkClearColorValue* clear = nullptr);
+		void depthAttachment(ResourceId resource, const VkClearDepthStencilValue* clear = nullptr);
+		void depthReadOnly(ResourceId resource);
+		void read(ResourceId resource, Access access);
+		void write(ResourceId resource, Access access);
+		// Keep the pass even when nothing reads what it writes
+		void sideEffect();
+
+	private:
+		friend class RenderGraph;
+		PassBuilder(RenderGraph& graph, PassId pass) : graph(graph), pass(pass) {}
+		void use(ResourceId resource, Access access, const VkClearValue* clear);
+
+		RenderGraph& graph;
+		PassId pass;
+	};
+
+	ResourceId createImage(const std::string& name, const ImageDesc& desc);
+	// An image owned outside the graph, such as a swap chain image. Set the handles with setImportedImage before executing
+	ResourceId importImage(const std::string& name, const ImageDesc& desc, const ExternalState& initial, const ExternalState& final);
+	// Keep the passes writing a transient image that nothing else reads, written imports always count as outputs
+	void markOutput(ResourceId resource);
+	PassId addPass(const std::string& name, PassType type, const std::function<void(PassBuilder&)>& setup, ExecuteFunction execute);
+
+	// Cull, place the transients and build the barriers. With a device the render passes, transient images, their
+	// memory and the framebuffers are created too
+	void compile(VkDevice device = VK_NULL_HANDLE, VkPhysicalDevice gpu = VK_NULL_HANDLE);
+	// Destroy everything compile created and forget the passes and resources. The render passes are handed to
+	// keptRenderPasses instead when given, for a pipeline build still using them
+	void destroy(std::vector<VkRenderPass>* keptRenderPasses = nullptr);
+
+	void setImportedImage(ResourceId resource, VkImage image, VkImageView view);
+	// Area the pass's render pass covers, the whole attachment by default
+	void setRenderArea(PassId pass, VkExtent2D extent);
+	// Record the live passes with their barriers, frame is handed to every pass
+	void execute(VkCommandBuffer commandBuffer, uint32_t frame);
+
+	VkRenderPass getRenderPass(PassId pass) const { return passes[pass].renderPass; }
+	VkImage getImage(ResourceId resource) const { return resources[resource].image; }
+	VkImageView getImageView(ResourceId resource) const { return resources[resource].view; }
+	const ImageDesc& getDesc(ResourceId resource) const { return resources[resource].desc; }
+	bool isCulled(PassId pass) const { return !passes[pass].alive; }
+	const std::vector<Barrier>& getBarriers(PassId pass) const { return passes[pass].barriers; }
+	const std::vector<Barrier>& getFinalBarriers() const { return finalBarriers; }
+	const Placement& getPlacement(ResourceId resource) const { return resources[resource].placement; }
+	// Memory of the transients as placed and what it would take without aliasing
+	VkDeviceSize getAliasedSize() const;
+	VkDeviceSize getUnaliasedSize() const;
+	size_t passCount() const { return passes.size(); }
+	size_t resourceCount() const { return resources.size(); }
+
+	// Compile a frame like a deferred renderer's and thousands of random graphs on the CPU, and check every culling,
+	// barrier and aliasing decision against the declared uses. Returns false if any check failed
+	static bool runSelfTest();
+
+private:
+	struct Use {
+		ResourceId resource;
+		Access access;
+		bool clear;
+		VkClearValue clearValue;
+	};
+
+	struct Pass {
+		std::string name;
+		PassType type;
+		ExecuteFunction execute;
+		std::vector<Use> uses;
+		bool sideEffect = false;
+
+		bool alive = false;
+		std::vector<Barrier> barriers;
+		VkRenderPass renderPass = VK_NULL_HANDLE;
+		VkExtent2D renderArea{ 0, 0 };
+		// Framebuffers by the views of their attachments, imported views change from frame to frame
+		std::vector<std::pair<std::vector<VkImageView>, VkFramebuffer>> framebuffers;
+	};
+
+	struct Resource {
+		std::string name;
+		ImageDesc desc;
+		bool imported = false;
+		bool output = false;
+		ExternalState initial;
+		ExternalState final;
+		VkImageUsageFlags usage = 0;
+
+		// Live pass indices of the first and last use, INVALID when no live pass uses it
+		uint32_t firstUse = INVALID;
+		uint32_t lastUse = INVALID;
+		// Stages and writes of its last use in a frame, what the next frame or an alias has to wait for
+		VkPipelineStageFlags endStages = 0;
+		VkAccessFlags endAccess = 0;
+		Placement placement;
+		VkMemoryRequirements requirements{};
+
+		VkImage image = VK_NULL_HANDLE;
+		VkImageView view = VK_NULL_HANDLE;
+	};
+
+	void cullPasses();
+	void computeLifetimes();
+	void placeTransients();
+	void buildBarriers();
+	void createRenderPasses();
+	void createImages();
+	VkFramebuffer getFramebuffer(Pass& pass);
+	bool aliases(const Resource& a, const Resource& b) const;
+
+	std::vector<Pass> passes;
+	std::vector<Resource> resources;
+	std::vector<uint32_t> livePasses;
+	std::vector<Barrier> finalBarriers;
+	// Memory blocks the transients are placed in
+	std::vector<VkDeviceSize> blockSizes;
+	std::vector<uint32_t> blockTypeBits;
+	std::vector<VkDeviceMemory> blockMemory;
+
+	VkDevice device = VK_NULL_HANDLE;
+	VkPhysicalDevice gpu = VK_NULL_HANDLE;
+};
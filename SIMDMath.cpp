@@ -0,0 +1,617 @@
+#include "SIMDMath.h"
+#include "CPUFeatures.h"
+#include "glm-0.9.6.3/gtc/matrix_transform.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <utility>
+#include <vector>
+#include <immintrin.h>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+SCALAR KERNELS
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void multiplyScalar(const glm::mat4* a, const glm::mat4* b, glm::mat4* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        out[i] = a[i] * b[i];
+    }
+}
+
+static void affineInverseScalar(const glm::mat4* in, glm::mat4* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        glm::mat3 inverse = glm::inverse(glm::mat3(in[i]));
+        glm::vec3 translation = -(inverse * glm::vec3(in[i][3]));
+        out[i] = glm::mat4(inverse);
+        out[i][3] = glm::vec4(translation, 1.0f);
+    }
+}
+
+static void inverseTransposeScalar(const glm::mat4* in, glm::mat4* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        out[i] = glm::mat4(glm::transpose(glm::inverse(glm::mat3(in[i]))));
+    }
+}
+
+static void transformPointsScalar(const glm::mat4& transform, const glm::vec3* in, glm::vec3* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        out[i] = glm::vec3(transform * glm::vec4(in[i], 1.0f));
+    }
+}
+
+static void transformBoxesScalar(const glm::mat4* transforms, const glm::vec3* centers, const glm::vec3* extents,
+    glm::vec3* outCenters, glm::vec3* outExtents, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const glm::mat4& transform = transforms[i];
+        glm::vec3 extent = extents[i];
+        outCenters[i] = glm::vec3(transform * glm::vec4(centers[i], 1.0f));
+
+        // Each world axis gathers the extent of every local axis that projects onto it
+        for (int axis = 0; axis < 3; axis++) {
+            outExtents[i][axis] = std::abs(transform[0][axis]) * extent.x + std::abs(transform[1][axis]) * extent.y + std::abs(transform[2][axis]) * extent.z;
+        }
+    }
+}
+
+static void packTransformsScalar(const glm::mat4* in, void* out, size_t outStride, size_t count) {
+    uint8_t* bytes = static_cast<uint8_t*>(out);
+    for (size_t i = 0; i < count; i++) {
+        // Row major 3x4, the transpose of glm's column major matrix without the last row
+        glm::mat4 transposed = glm::transpose(in[i]);
+        std::memcpy(bytes + i * outStride, &transposed[0][0], 12 * sizeof(float));
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+SSE KERNELS
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// glm matrices are 16 column major floats, every column is one register
+
+static __m128 crossSSE(__m128 a, __m128 b) {
+    __m128 aYZX = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 bYZX = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 result = _mm_sub_ps(_mm_mul_ps(a, bYZX), _mm_mul_ps(aYZX, b));
+    return _mm_shuffle_ps(result, result, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+// Columns of the cofactor matrix over the determinant, which is the inverse transpose of the upper 3x3. The w of the
+// columns is dropped first, which keeps the w lane of every cross product at 0
+static void cofactorsSSE(const float* m, __m128& x0, __m128& x1, __m128& x2) {
+    const __m128 xyzMask = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+    __m128 c0 = _mm_and_ps(_mm_loadu_ps(m), xyzMask);
+    __m128 c1 = _mm_and_ps(_mm_loadu_ps(m + 4), xyzMask);
+    __m128 c2 = _mm_and_ps(_mm_loadu_ps(m + 8), xyzMask);
+
+    x0 = crossSSE(c1, c2);
+    x1 = crossSSE(c2, c0);
+    x2 = crossSSE(c0, c1);
+
+    __m128 product = _mm_mul_ps(c0, x0);
+    float determinant = _mm_cvtss_f32(_mm_add_ss(_mm_add_ss(product, _mm_shuffle_ps(product, product, 1)), _mm_movehl_ps(product, product)));
+    __m128 invDeterminant = _mm_set1_ps(determinant != 0.0f ? 1.0f / determinant : 0.0f);
+    x0 = _mm_mul_ps(x0, invDeterminant);
+    x1 = _mm_mul_ps(x1, invDeterminant);
+    x2 = _mm_mul_ps(x2, invDeterminant);
+}
+
+// Four packed vec3 in three registers to one register per component and back. Every shuffle stays within 128 bits,
+// so the AVX2 kernels run the same sequence on two groups of four at once
+#define VEC3_AOS_TO_SOA(SHUFFLE, a, b, c, x, y, z)                                                  \
+    {                                                                                               \
+        auto bc = SHUFFLE(b, c, _MM_SHUFFLE(1, 0, 3, 2));                                           \
+        x = SHUFFLE(a, bc, _MM_SHUFFLE(3, 0, 3, 0));                                                \
+        y = SHUFFLE(SHUFFLE(a, b, _MM_SHUFFLE(0, 0, 1, 1)), SHUFFLE(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0)); \
+        z = SHUFFLE(SHUFFLE(a, b, _MM_SHUFFLE(1, 1, 2, 2)), SHUFFLE(c, c, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0)); \
+    }
+
+#define VEC3_SOA_TO_AOS(SHUFFLE, UNPACKLO, UNPACKHI, x, y, z, a, b, c)                              \
+    {                                                                                               \
+        auto xy01 = UNPACKLO(x, y);                                                                 \
+        auto xy23 = UNPACKHI(x, y);                                                                 \
+        a = SHUFFLE(xy01, SHUFFLE(z, x, _MM_SHUFFLE(1, 1, 0, 0)), _MM_SHUFFLE(2, 0, 1, 0));         \
+        b = SHUFFLE(SHUFFLE(y, z, _MM_SHUFFLE(1, 1, 1, 1)), xy23, _MM_SHUFFLE(1, 0, 2, 0));         \
+        c = SHUFFLE(SHUFFLE(z, x, _MM_SHUFFLE(3, 3, 2, 2)), SHUFFLE(y, z, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0)); \
+    }
+
+// a0 * c.x + a1 * c.y + a2 * c.z + a3 * c.w, one column of a matrix product
+static __m128 combineColumnsSSE(__m128 a0, __m128 a1, __m128 a2, __m128 a3, __m128 c) {
+    return _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(a0, _mm_shuffle_ps(c, c, _MM_SHUFFLE(0, 0, 0, 0))), _mm_mul_ps(a1, _mm_shuffle_ps(c, c, _MM_SHUFFLE(1, 1, 1, 1)))),
+        _mm_add_ps(_mm_mul_ps(a2, _mm_shuffle_ps(c, c, _MM_SHUFFLE(2, 2, 2, 2))), _mm_mul_ps(a3, _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 3, 3)))));
+}
+
+static void multiplySSE(const glm::mat4* a, const glm::mat4* b, glm::mat4* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const float* pa = &a[i][0][0];
+        const float* pb = &b[i][0][0];
+        __m128 a0 = _mm_loadu_ps(pa);
+        __m128 a1 = _mm_loadu_ps(pa + 4);
+        __m128 a2 = _mm_loadu_ps(pa + 8);
+        __m128 a3 = _mm_loadu_ps(pa + 12);
+        __m128 b0 = _mm_loadu_ps(pb);
+        __m128 b1 = _mm_loadu_ps(pb + 4);
+        __m128 b2 = _mm_loadu_ps(pb + 8);
+        __m128 b3 = _mm_loadu_ps(pb + 12);
+
+        float* po = &out[i][0][0];
+        _mm_storeu_ps(po, combineColumnsSSE(a0, a1, a2, a3, b0));
+        _mm_storeu_ps(po + 4, combineColumnsSSE(a0, a1, a2, a3, b1));
+        _mm_storeu_ps(po + 8, combineColumnsSSE(a0, a1, a2, a3, b2));
+        _mm_storeu_ps(po + 12, combineColumnsSSE(a0, a1, a2, a3, b3));
+    }
+}
+
+static void affineInverseSSE(const glm::mat4* in, glm::mat4* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const float* pm = &in[i][0][0];
+        __m128 translation = _mm_loadu_ps(pm + 12);
+
+        // The cofactor columns over the determinant are the rows of the inverse
+        __m128 r0, r1, r2;
+        cofactorsSSE(pm, r0, r1, r2);
+        __m128 r3 = _mm_setzero_ps();
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+
+        __m128 t = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r0, _mm_shuffle_ps(translation, translation, _MM_SHUFFLE(0, 0, 0, 0))),
+            _mm_mul_ps(r1, _mm_shuffle_ps(translation, translation, _MM_SHUFFLE(1, 1, 1, 1)))),
+            _mm_mul_ps(r2, _mm_shuffle_ps(translation, translation, _MM_SHUFFLE(2, 2, 2, 2))));
+        t = _mm_sub_ps(_mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f), t);
+
+        float* po = &out[i][0][0];
+        _mm_storeu_ps(po, r0);
+        _mm_storeu_ps(po + 4, r1);
+        _mm_storeu_ps(po + 8, r2);
+        _mm_storeu_ps(po + 12, t);
+    }
+}
+
+static void inverseTransposeSSE(const glm::mat4* in, glm::mat4* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        __m128 x0, x1, x2;
+        cofactorsSSE(&in[i][0][0], x0, x1, x2);
+        float* po = &out[i][0][0];
+        _mm_storeu_ps(po, x0);
+        _mm_storeu_ps(po + 4, x1);
+        _mm_storeu_ps(po + 8, x2);
+        _mm_storeu_ps(po + 12, _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f));
+    }
+}
+
+static void transformPointsSSE(const glm::mat4& transform, const glm::vec3* in, glm::vec3* out, size_t count) {
+    __m128 m[4][3];
+    for (int column = 0; column < 4; column++) {
+        for (int row = 0; row < 3; row++) {
+            m[column][row] = _mm_set1_ps(transform[column][row]);
+        }
+    }
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const float* source = &in[i].x;
+        __m128 a = _mm_loadu_ps(source);
+        __m128 b = _mm_loadu_ps(source + 4);
+        __m128 c = _mm_loadu_ps(source + 8);
+        __m128 x, y, z;
+        VEC3_AOS_TO_SOA(_mm_shuffle_ps, a, b, c, x, y, z);
+
+        __m128 result[3];
+        for (int row = 0; row < 3; row++) {
+            result[row] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[0][row], x), _mm_mul_ps(m[1][row], y)), _mm_add_ps(_mm_mul_ps(m[2][row], z), m[3][row]));
+        }
+
+        VEC3_SOA_TO_AOS(_mm_shuffle_ps, _mm_unpacklo_ps, _mm_unpackhi_ps, result[0], result[1], result[2], a, b, c);
+        float* destination = &out[i].x;
+        _mm_storeu_ps(destination, a);
+        _mm_storeu_ps(destination + 4, b);
+        _mm_storeu_ps(destination + 8, c);
+    }
+    transformPointsScalar(transform, in + i, out + i, count - i);
+}
+
+static void transformBoxesSSE(const glm::mat4* transforms, const glm::vec3* centers, const glm::vec3* extents,
+    glm::vec3* outCenters, glm::vec3* outExtents, size_t count) {
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+    // Every box has its own matrix, so boxes are done one per register and four results are packed before storing
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 center[4], extent[4];
+        for (int box = 0; box < 4; box++) {
+            const float* pm = &transforms[i + box][0][0];
+            __m128 c0 = _mm_loadu_ps(pm);
+            __m128 c1 = _mm_loadu_ps(pm + 4);
+            __m128 c2 = _mm_loadu_ps(pm + 8);
+            __m128 c3 = _mm_loadu_ps(pm + 12);
+            const glm::vec3& localCenter = centers[i + box];
+            const glm::vec3& localExtent = extents[i + box];
+            center[box] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(localCenter.x)), _mm_mul_ps(c1, _mm_set1_ps(localCenter.y))),
+                _mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(localCenter.z)), c3));
+            extent[box] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_and_ps(c0, absMask), _mm_set1_ps(localExtent.x)),
+                _mm_mul_ps(_mm_and_ps(c1, absMask), _mm_set1_ps(localExtent.y))), _mm_mul_ps(_mm_and_ps(c2, absMask), _mm_set1_ps(localExtent.z)));
+        }
+
+        for (auto results : { std::make_pair(center, &outCenters[i].x), std::make_pair(extent, &outExtents[i].x) }) {
+            __m128* r = results.first;
+            _MM_TRANSPOSE4_PS(r[0], r[1], r[2], r[3]);
+            __m128 a, b, c;
+            VEC3_SOA_TO_AOS(_mm_shuffle_ps, _mm_unpacklo_ps, _mm_unpackhi_ps, r[0], r[1], r[2], a, b, c);
+            _mm_storeu_ps(results.second, a);
+            _mm_storeu_ps(results.second + 4, b);
+            _mm_storeu_ps(results.second + 8, c);
+        }
+    }
+    transformBoxesScalar(transforms + i, centers + i, extents + i, outCenters + i, outExtents + i, count - i);
+}
+
+static void packTransformsSSE(const glm::mat4* in, void* out, size_t outStride, size_t count) {
+    uint8_t* bytes = static_cast<uint8_t*>(out);
+    for (size_t i = 0; i < count; i++) {
+        const float* pm = &in[i][0][0];
+        __m128 r0 = _mm_loadu_ps(pm);
+        __m128 r1 = _mm_loadu_ps(pm + 4);
+        __m128 r2 = _mm_loadu_ps(pm + 8);
+        __m128 r3 = _mm_loadu_ps(pm + 12);
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+        float* destination = reinterpret_cast<float*>(bytes + i * outStride);
+        _mm_storeu_ps(destination, r0);
+        _mm_storeu_ps(destination + 4, r1);
+        _mm_storeu_ps(destination + 8, r2);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+AVX2 KERNELS
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// The low 128 bits hold one matrix or group and the high 128 bits the next, every shuffle works within its half
+
+AVX2_FUNCTION static __m256 loadPair(const float* low, const float* high) {
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(low)), _mm_loadu_ps(high), 1);
+}
+
+AVX2_FUNCTION static void storePair(float* low, float* high, __m256 value) {
+    _mm_storeu_ps(low, _mm256_castps256_ps128(value));
+    _mm_storeu_ps(high, _mm256_extractf128_ps(value, 1));
+}
+
+AVX2_FUNCTION static __m256 broadcastPair(float low, float high) {
+    return _mm256_setr_ps(low, low, low, low, high, high, high, high);
+}
+
+AVX2_FUNCTION static __m256 crossAVX2(__m256 a, __m256 b) {
+    __m256 aYZX = _mm256_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+    __m256 bYZX = _mm256_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+    __m256 result = _mm256_fmsub_ps(a, bYZX, _mm256_mul_ps(aYZX, b));
+    return _mm256_shuffle_ps(result, result, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+// cofactorsSSE for two matrices, the determinant is summed within each half so both get their own
+AVX2_FUNCTION static void cofactorsAVX2(const float* m0, const float* m1, __m256& x0, __m256& x1, __m256& x2) {
+    const __m256 xyzMask = _mm256_castsi256_ps(_mm256_setr_epi32(-1, -1, -1, 0, -1, -1, -1, 0));
+    __m256 c0 = _mm256_and_ps(loadPair(m0, m1), xyzMask);
+    __m256 c1 = _mm256_and_ps(loadPair(m0 + 4, m1 + 4), xyzMask);
+    __m256 c2 = _mm256_and_ps(loadPair(m0 + 8, m1 + 8), xyzMask);
+
+    x0 = crossAVX2(c1, c2);
+    x1 = crossAVX2(c2, c0);
+    x2 = crossAVX2(c0, c1);
+
+    __m256 determinant = _mm256_mul_ps(c0, x0);
+    determinant = _mm256_add_ps(determinant, _mm256_shuffle_ps(determinant, determinant, _MM_SHUFFLE(2, 3, 0, 1)));
+    determinant = _mm256_add_ps(determinant, _mm256_shuffle_ps(determinant, determinant, _MM_SHUFFLE(1, 0, 3, 2)));
+    __m256 nonZero = _mm256_cmp_ps(determinant, _mm256_setzero_ps(), _CMP_NEQ_OQ);
+    __m256 invDeterminant = _mm256_and_ps(_mm256_div_ps(_mm256_set1_ps(1.0f), determinant), nonZero);
+    x0 = _mm256_mul_ps(x0, invDeterminant);
+    x1 = _mm256_mul_ps(x1, invDeterminant);
+    x2 = _mm256_mul_ps(x2, invDeterminant);
+}
+
+// combineColumnsSSE on two columns at once
+AVX2_FUNCTION static __m256 combineColumnsAVX2(__m256 a0, __m256 a1, __m256 a2, __m256 a3, __m256 c) {
+    __m256 result = _mm256_mul_ps(a0, _mm256_shuffle_ps(c, c, _MM_SHUFFLE(0, 0, 0, 0)));
+    result = _mm256_fmadd_ps(a1, _mm256_shuffle_ps(c, c, _MM_SHUFFLE(1, 1, 1, 1)), result);
+    result = _mm256_fmadd_ps(a2, _mm256_shuffle_ps(c, c, _MM_SHUFFLE(2, 2, 2, 2)), result);
+    return _mm256_fmadd_ps(a3, _mm256_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 3, 3)), result);
+}
+
+AVX2_FUNCTION static void multiplyAVX2(const glm::mat4* a, const glm::mat4* b, glm::mat4* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        // Both halves hold the same column of a, so two output columns come out of every pass
+        const float* pa = &a[i][0][0];
+        __m256 a0 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(pa));
+        __m256 a1 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(pa + 4));
+        __m256 a2 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(pa + 8));
+        __m256 a3 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(pa + 12));
+        const float* pb = &b[i][0][0];
+        __m256 b01 = _mm256_loadu_ps(pb);
+        __m256 b23 = _mm256_loadu_ps(pb + 8);
+
+        float* po = &out[i][0][0];
+        _mm256_storeu_ps(po, combineColumnsAVX2(a0, a1, a2, a3, b01));
+        _mm256_storeu_ps(po + 8, combineColumnsAVX2(a0, a1, a2, a3, b23));
+    }
+}
+
+AVX2_FUNCTION static void affineInverseAVX2(const glm::mat4* in, glm::mat4* out, size_t count) {
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        const float* m0 = &in[i][0][0];
+        const float* m1 = &in[i + 1][0][0];
+        __m256 translation = loadPair(m0 + 12, m1 + 12);
+
+        __m256 r0, r1, r2;
+        cofactorsAVX2(m0, m1, r0, r1, r2);
+
+        // _MM_TRANSPOSE4_PS with a zero fourth row, within each half
+        __m256 zero = _mm256_setzero_ps();
+        __m256 t0 = _mm256_unpacklo_ps(r0, r1);
+        __m256 t1 = _mm256_unpacklo_ps(r2, zero);
+        __m256 t2 = _mm256_unpackhi_ps(r0, r1);
+        __m256 t3 = _mm256_unpackhi_ps(r2, zero);
+        __m256 c0 = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0));
+        __m256 c1 = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2));
+        __m256 c2 = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0));
+
+        __m256 t = _mm256_mul_ps(c0, _mm256_shuffle_ps(translation, translation, _MM_SHUFFLE(0, 0, 0, 0)));
+        t = _mm256_fmadd_ps(c1, _mm256_shuffle_ps(translation, translation, _MM_SHUFFLE(1, 1, 1, 1)), t);
+        t = _mm256_fmadd_ps(c2, _mm256_shuffle_ps(translation, translation, _MM_SHUFFLE(2, 2, 2, 2)), t);
+        t = _mm256_sub_ps(_mm256_setr_ps(0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f), t);
+
+        float* o0 = &out[i][0][0];
+        float* o1 = &out[i + 1][0][0];
+        storePair(o0, o1, c0);
+        storePair(o0 + 4, o1 + 4, c1);
+        storePair(o0 + 8, o1 + 8, c2);
+        storePair(o0 + 12, o1 + 12, t);
+    }
+    affineInverseSSE(in + i, out + i, count - i);
+}
+
+AVX2_FUNCTION static void inverseTransposeAVX2(const glm::mat4* in, glm::mat4* out, size_t count) {
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        __m256 x0, x1, x2;
+        cofactorsAVX2(&in[i][0][0], &in[i + 1][0][0], x0, x1, x2);
+        float* o0 = &out[i][0][0];
+        float* o1 = &out[i + 1][0][0];
+        storePair(o0, o1, x0);
+        storePair(o0 + 4, o1 + 4, x1);
+        storePair(o0 + 8, o1 + 8, x2);
+        storePair(o0 + 12, o1 + 12, _mm256_setr_ps(0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f));
+    }
+    inverseTransposeSSE(in + i, out + i, count - i);
+}
+
+AVX2_FUNCTION static void transformPointsAVX2(const glm::mat4& transform, const glm::vec3* in, glm::vec3* out, size_t count) {
+    __m256 m[4][3];
+    for (int column = 0; column < 4; column++) {
+        for (int row = 0; row < 3; row++) {
+            m[column][row] = _mm256_set1_ps(transform[column][row]);
+        }
+    }
+
+    // Points 0 to 3 in the low halves and 4 to 7 in the high halves
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const float* source = &in[i].x;
+        __m256 a = loadPair(source, source + 12);
+        __m256 b = loadPair(source + 4, source + 16);
+        __m256 c = loadPair(source + 8, source + 20);
+        __m256 x, y, z;
+        VEC3_AOS_TO_SOA(_mm256_shuffle_ps, a, b, c, x, y, z);
+
+        __m256 result[3];
+        for (int row = 0; row < 3; row++) {
+            result[row] = _mm256_fmadd_ps(m[0][row], x, _mm256_fmadd_ps(m[1][row], y, _mm256_fmadd_ps(m[2][row], z, m[3][row])));
+        }
+
+        VEC3_SOA_TO_AOS(_mm256_shuffle_ps, _mm256_unpacklo_ps, _mm256_unpackhi_ps, result[0], result[1], result[2], a, b, c);
+        float* destination = &out[i].x;
+        storePair(destination, destination + 12, a);
+        storePair(destination + 4, destination + 16, b);
+        storePair(destination + 8, destination + 20, c);
+    }
+    transformPointsSSE(transform, in + i, out + i, count - i);
+}
+
+AVX2_FUNCTION static void transformBoxesAVX2(const glm::mat4* transforms, const glm::vec3* centers, const glm::vec3* extents,
+    glm::vec3* outCenters, glm::vec3* outExtents, size_t count) {
+    const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+
+    // Boxes i and i + 4 share a register, so after the per half transpose every register holds one component of
+    // boxes i to i + 3 low and i + 4 to i + 7 high, the layout VEC3_SOA_TO_AOS expects
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 center[4], extent[4];
+        for (int box = 0; box < 4; box++) {
+            const float* low = &transforms[i + box][0][0];
+            const float* high = &transforms[i + box + 4][0][0];
+            __m256 c0 = loadPair(low, high);
+            __m256 c1 = loadPair(low + 4, high + 4);
+            __m256 c2 = loadPair(low + 8, high + 8);
+            __m256 c3 = loadPair(low + 12, high + 12);
+            const glm::vec3& lowCenter = centers[i + box];
+            const glm::vec3& highCenter = centers[i + box + 4];
+            const glm::vec3& lowExtent = extents[i + box];
+            const glm::vec3& highExtent = extents[i + box + 4];
+
+            center[box] = _mm256_fmadd_ps(c0, broadcastPair(lowCenter.x, highCenter.x),
+                _mm256_fmadd_ps(c1, broadcastPair(lowCenter.y, highCenter.y), _mm256_fmadd_ps(c2, broadcastPair(lowCenter.z, highCenter.z), c3)));
+            extent[box] = _mm256_fmadd_ps(_mm256_and_ps(c0, absMask), broadcastPair(lowExtent.x, highExtent.x),
+                _mm256_fmadd_ps(_mm256_and_ps(c1, absMask), broadcastPair(lowExtent.y, highExtent.y),
+                    _mm256_mul_ps(_mm256_and_ps(c2, absMask), broadcastPair(lowExtent.z, highExtent.z))));
+        }
+
+        for (auto results : { std::make_pair(center, &outCenters[i].x), std::make_pair(extent, &outExtents[i].x) }) {
+            __m256* r = results.first;
+            __m256 t0 = _mm256_unpacklo_ps(r[0], r[1]);
+            __m256 t1 = _mm256_unpacklo_ps(r[2], r[3]);
+            __m256 t2 = _mm256_unpackhi_ps(r[0], r[1]);
+            __m256 t3 = _mm256_unpackhi_ps(r[2], r[3]);
+            __m256 x = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0));
+            __m256 y = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2));
+            __m256 z = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0));
+            __m256 a, b, c;
+            VEC3_SOA_TO_AOS(_mm256_shuffle_ps, _mm256_unpacklo_ps, _mm256_unpackhi_ps, x, y, z, a, b, c);
+            float* destination = results.second;
+            storePair(destination, destination + 12, a);
+            storePair(destination + 4, destination + 16, b);
+            storePair(destination + 8, destination + 20, c);
+        }
+    }
+    transformBoxesSSE(transforms + i, centers + i, extents + i, outCenters + i, outExtents + i, count - i);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+DISPATCH
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static const SIMDMath::KernelTable scalarKernels = {
+    multiplyScalar, affineInverseScalar, inverseTransposeScalar, transformPointsScalar, transformBoxesScalar, packTransformsScalar
+};
+
+static const SIMDMath::KernelTable sseKernels = {
+    multiplySSE, affineInverseSSE, inverseTransposeSSE, transformPointsSSE, transformBoxesSSE, packTransformsSSE
+};
+
+// Packing is a transpose and three stores per matrix and already waits on memory with SSE
+static const SIMDMath::KernelTable avx2Kernels = {
+    multiplyAVX2, affineInverseAVX2, inverseTransposeAVX2, transformPointsAVX2, transformBoxesAVX2, packTransformsSSE
+};
+
+SIMDMath::Kernel SIMDMath::bestKernel() {
+    static const Kernel best = CPUFeatures::hasAVX2() ? Kernel::AVX2 : Kernel::SSE;
+    return best;
+}
+
+const char* SIMDMath::kernelName(Kernel kernel) {
+    switch (kernel) {
+    case Kernel::Scalar:
+        return "scalar";
+    case Kernel::SSE:
+        return "SSE";
+    default:
+        return "AVX2";
+    }
+}
+
+const SIMDMath::KernelTable& SIMDMath::kernels(Kernel kernel) {
+    switch (kernel) {
+    case Kernel::Scalar:
+        return scalarKernels;
+    case Kernel::SSE:
+        return sseKernels;
+    default:
+        return avx2Kernels;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+BENCHMARK
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SIMDMath::runBenchmark() {
+    const size_t count = 100000;
+    // Small enough for both inputs and the output to stay in L2, as the scene graph's batches do. At count the matrix
+    // kernels are bound by memory bandwidth instead
+    const size_t cachedCount = 1024;
+    const int runs = 21;
+
+    // Rotation, non uniform scale and translation, like scene graph nodes
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> offset(-100.0f, 100.0f);
+    std::uniform_real_distribution<float> scale(0.5f, 2.0f);
+    std::uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+    std::vector<glm::mat4> a(count), b(count);
+    std::vector<glm::vec3> centers(count), extents(count);
+    for (size_t i = 0; i < count; i++) {
+        for (glm::mat4* m : { &a[i], &b[i] }) {
+            glm::mat4 transform = glm::translate(glm::mat4(1.0f), glm::vec3(offset(random), offset(random), offset(random)));
+            transform = glm::rotate(transform, angle(random), glm::normalize(glm::vec3(offset(random), offset(random), offset(random)) + glm::vec3(0.0f, 0.0f, 0.01f)));
+            *m = glm::scale(transform, glm::vec3(scale(random), scale(random), scale(random)));
+        }
+        centers[i] = glm::vec3(offset(random), offset(random), offset(random));
+        extents[i] = glm::vec3(scale(random), scale(random), scale(random));
+    }
+
+    std::vector<Kernel> available = { Kernel::Scalar, Kernel::SSE };
+    if (CPUFeatures::hasAVX2()) {
+        available.push_back(Kernel::AVX2);
+    }
+    printf("Best kernel %s \n", kernelName(bestKernel()));
+
+    // Results are floats, one output element counts as 16 for matrices, 3 for vectors and 12 for packed transforms
+    std::vector<glm::mat4> matrixOut(count);
+    std::vector<glm::vec3> vectorOut(count), vectorOut2(count);
+    std::vector<float> packedOut(count * 12);
+    struct Operation {
+        const char* name;
+        std::function<void(const KernelTable& table, size_t n)> run;
+        std::function<std::vector<float>(size_t n)> result;
+    };
+    auto matrixResult = [&](size_t n) { return std::vector<float>(&matrixOut[0][0][0], &matrixOut[0][0][0] + n * 16); };
+    auto vectorResult = [&](size_t n) {
+        std::vector<float> result(&vectorOut[0].x, &vectorOut[0].x + n * 3);
+        result.insert(result.end(), &vectorOut2[0].x, &vectorOut2[0].x + n * 3);
+        return result;
+    };
+    std::vector<Operation> operations = {
+        { "multiply", [&](const KernelTable& table, size_t n) { table.multiply(a.data(), b.data(), matrixOut.data(), n); }, matrixResult },
+        { "affine inverse", [&](const KernelTable& table, size_t n) { table.affineInverse(a.data(), matrixOut.data(), n); }, matrixResult },
+        { "inverse transpose", [&](const KernelTable& table, size_t n) { table.inverseTranspose(a.data(), matrixOut.data(), n); }, matrixResult },
+        { "transform points", [&](const KernelTable& table, size_t n) { table.transformPoints(a[0], centers.data(), vectorOut.data(), n); }, vectorResult },
+        { "transform boxes", [&](const KernelTable& table, size_t n) {
+            table.transformBoxes(a.data(), centers.data(), extents.data(), vectorOut.data(), vectorOut2.data(), n); }, vectorResult },
+        { "pack 3x4", [&](const KernelTable& table, size_t n) { table.packTransforms(a.data(), packedOut.data(), 12 * sizeof(float), n); },
+            [&](size_t n) { return std::vector<float>(packedOut.begin(), packedOut.begin() + n * 12); } },
+    };
+
+    // Every timed run covers count elements, the cached size by going over the same elements again
+    for (size_t n : { cachedCount, count }) {
+        printf("%zu elements per call \n", n);
+        for (const Operation& operation : operations) {
+            double scalarTime = 0.0;
+            std::vector<float> reference;
+            for (Kernel kernel : available) {
+                std::vector<double> times;
+                for (int run = 0; run < runs; run++) {
+                    auto start = std::chrono::high_resolution_clock::now();
+                    for (size_t done = 0; done < count; done += n) {
+                        operation.run(kernels(kernel), n);
+                    }
+                    times.push_back(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+                }
+                std::sort(times.begin(), times.end());
+                double time = times[runs / 2];
+
+                // Scalar results are the reference, the error is relative to the magnitude of each value
+                std::vector<float> result = operation.result(n);
+                float maxError = 0.0f;
+                if (kernel == Kernel::Scalar) {
+                    reference = result;
+                    scalarTime = time;
+                }
+                for (size_t i = 0; i < result.size(); i++) {
+                    maxError = std::max(maxError, std::abs(result[i] - reference[i]) / std::max(1.0f, std::abs(reference[i])));
+                }
+                printf("    %-18s %-6s %7.2f ns/element  %5.2fx  max error %.1e \n", operation.name, kernelName(kernel),
+                    time * 1e6 / count, scalarTime / time, maxError);
+            }
+        }
+    }
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "glm-0.9.6.3/glm.hpp"
+
+// Batched matrix and vector kernels for the places that process many transforms at once. Every operation has a scalar
+// glm, an SSE and an AVX2 version behind one table, and the widest the CPU runs is picked the first time it is asked for.
+// Outputs may alias the matching input array, every element is fully read before it is written
+namespace SIMDMath {
+	enum class Kernel {
+		Scalar,
+		// One matrix or point per register
+		SSE,
+		// Two matrices or points per register, with FMA
+		AVX2
+	};
+
+	struct KernelTable {
+		// out[i] = a[i] * b[i]
+		void (*multiply)(const glm::mat4* a, const glm::mat4* b, glm::mat4* out, size_t count);
+		// Inverse of rotation, scale and translation matrices, the last row is taken to be 0 0 0 1
+		void (*affineInverse)(const glm::mat4* in, glm::mat4* out, size_t count);
+		// Inverse transpose of the upper 3x3 for normals, the rest of out is identity
+		void (*inverseTranspose)(const glm::mat4* in, glm::mat4* out, size_t count);
+		// out[i] = transform * (in[i], 1)
+		void (*transformPoints)(const glm::mat4& transform, const glm::vec3* in, glm::vec3* out, size_t count);
+		// Box around each center and half size box after transforms[i]
+		void (*transformBoxes)(const glm::mat4* transforms, const glm::vec3* centers, const glm::vec3* extents,
+			glm::vec3* outCenters, glm::vec3* outExtents, size_t count);
+		// The top three rows as 12 row major floats, the layout of VkTransformMatrixKHR. Consecutive outputs are
+		// outStride bytes apart so they can be written straight into instance structs
+		void (*packTransforms)(const glm::mat4* in, void* out, size_t outStride, size_t count);
+	};
+
+	// Widest kernel this CPU can run
+	Kernel bestKernel();
+	const char* kernelName(Kernel kernel);
+	const KernelTable& kernels(Kernel kernel = bestKernel());
+
+	inline void multiply(const glm::mat4* a, const glm::mat4* b, glm::mat4* out, size_t count) { kernels().multiply(a, b, out, count); }
+	inline void affineInverse(const glm::mat4* in, glm::mat4* out, size_t count) { kernels().affineInverse(in, out, count); }
+	inline void inverseTranspose(const glm::mat4* in, glm::mat4* out, size_t count) { kernels().inverseTranspose(in, out, count); }
+	inline void transformPoints(const glm::mat4& transform, const glm::vec3* in, glm::vec3* out, size_t count) { kernels().transformPoints(transform, in, out, count); }
+	inline void transformBoxes(const glm::mat4* transforms, const glm::vec3* centers, const glm::vec3* extents, glm::vec3* outCenters, glm::vec3* outExtents, size_t count) {
+		kernels().transformBoxes(transforms, centers, extents, outCenters, outExtents, count);
+	}
+	inline void packTransforms(const glm::mat4* in, void* out, size_t outStride, size_t count) { kernels().packTransforms(in, out, outStride, count); }
+
+	// Time every kernel of every instruction set over 100k elements, in batches that stay in cache and in one pass that
+	// streams from memory, and check them against the scalar results
+	void runBenchmark();
+}
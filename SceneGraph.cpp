@@ -0,0 +1,219 @@
+#include "SceneGraph.h"
+#include "JobSystem.h"
+#include "SIMDMath.h"
+#include "glm-0.9.6.3/gtc/matrix_transform.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <stdexcept>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+HIERARCHY
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+SceneGraph::NodeId SceneGraph::addNode(const glm::mat4& localTransform, NodeId parent) {
+    if (parent != INVALID_NODE && parent >= indexOfId.size()) {
+        throw std::runtime_error("scene graph parent does not exist");
+    }
+
+    // New roots go to the end, children right after the last node of their parent's subtree
+    uint32_t parentPosition = parent == INVALID_NODE ? UINT32_MAX : indexOfId[parent];
+    uint32_t position = parent == INVALID_NODE ? static_cast<uint32_t>(ids.size()) : parentPosition + subtreeSize[parentPosition];
+
+    NodeId id = static_cast<NodeId>(indexOfId.size());
+    indexOfId.push_back(position);
+
+    parentIndex.insert(parentIndex.begin() + position, parentPosition);
+    subtreeSize.insert(subtreeSize.begin() + position, 1);
+    local.insert(local.begin() + position, localTransform);
+    world.insert(world.begin() + position, localTransform);
+    worldIT.insert(worldIT.begin() + position, glm::mat4(1.0f));
+    dirty.insert(dirty.begin() + position, 1);
+    ids.insert(ids.begin() + position, id);
+
+    // Everything after the insertion point moved down by one
+    for (uint32_t i = position + 1; i < ids.size(); i++) {
+        indexOfId[ids[i]] = i;
+        if (parentIndex[i] != UINT32_MAX && parentIndex[i] >= position) {
+            parentIndex[i]++;
+        }
+    }
+    for (uint32_t ancestor = parentPosition; ancestor != UINT32_MAX; ancestor = parentIndex[ancestor]) {
+        subtreeSize[ancestor]++;
+    }
+
+    dirtyNodes.push_back(id);
+    return id;
+}
+
+void SceneGraph::setLocalTransform(NodeId node, const glm::mat4& localTransform) {
+    uint32_t index = indexOfId[node];
+    local[index] = localTransform;
+    if (!dirty[index]) {
+        dirty[index] = 1;
+        dirtyNodes.push_back(node);
+    }
+}
+
+SceneGraph::NodeId SceneGraph::getParent(NodeId node) const {
+    uint32_t parent = parentIndex[indexOfId[node]];
+    return parent == UINT32_MAX ? INVALID_NODE : ids[parent];
+}
+
+void SceneGraph::updateRange(uint32_t begin, uint32_t end) {
+    // The parent of the first node lies outside the range and is already current, every other parent is updated before
+    // its children since the range is in depth first order
+    const SIMDMath::KernelTable& math = SIMDMath::kernels();
+    for (uint32_t i = begin; i < end; i++) {
+        if (parentIndex[i] == UINT32_MAX) {
+            world[i] = local[i];
+        }
+        else {
+            math.multiply(&world[parentIndex[i]], &local[i], &world[i], 1);
+        }
+        dirty[i] = 0;
+    }
+    math.inverseTranspose(&world[begin], &worldIT[begin], end - begin);
+}
+
+const std::vector<SceneGraph::NodeId>& SceneGraph::update(JobSystem* jobs) {
+    changed.clear();
+    if (dirtyNodes.empty()) {
+        return changed;
+    }
+
+    // Positions of the dirty nodes in order, a node inside the subtree of an earlier one is covered by it
+    std::vector<uint32_t> roots;
+    roots.reserve(dirtyNodes.size());
+    for (NodeId node : dirtyNodes) {
+        roots.push_back(indexOfId[node]);
+    }
+    std::sort(roots.begin(), roots.end());
+
+    std::vector<std::pair<uint32_t, uint32_t>> ranges;
+    for (uint32_t root : roots) {
+        if (!ranges.empty() && root < ranges.back().second) {
+            continue;
+        }
+        ranges.emplace_back(root, root + subtreeSize[root]);
+    }
+    dirtyNodes.clear();
+
+    auto updateRanges = [&](size_t begin, size_t end) {
+        for (size_t r = begin; r < end; r++) {
+            updateRange(ranges[r].first, ranges[r].second);
+        }
+    };
+    if (jobs) {
+        jobs->parallelFor(ranges.size(), 16, updateRanges);
+    }
+    else {
+        updateRanges(0, ranges.size());
+    }
+
+    for (const std::pair<uint32_t, uint32_t>& range : ranges) {
+        changed.insert(changed.end(), ids.begin() + range.first, ids.begin() + range.second);
+    }
+    return changed;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+BENCHMARK
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void SceneGraph::runBenchmark() {
+    const uint32_t rootCount = 1000;
+    const uint32_t childrenPerRoot = 10;
+    const uint32_t grandchildrenPerChild = 9;
+    const int frames = 21;
+    const float movedFractions[] = { 0.001f, 0.01f, 0.1f };
+
+    // Roots like vehicles or characters, children like their parts, grandchildren like attached props
+    SceneGraph graph;
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> offset(-10.0f, 10.0f);
+    std::uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+    auto randomTransform = [&]() {
+        glm::mat4 transform = glm::translate(glm::mat4(1.0f), glm::vec3(offset(random), offset(random), offset(random)));
+        return glm::rotate(transform, angle(random), glm::normalize(glm::vec3(offset(random), offset(random), offset(random)) + glm::vec3(0.0f, 0.0f, 0.01f)));
+    };
+
+    std::vector<NodeId> roots;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (uint32_t r = 0; r < rootCount; r++) {
+        NodeId root = graph.addNode(randomTransform());
+        roots.push_back(root);
+        for (uint32_t c = 0; c < childrenPerRoot; c++) {
+            NodeId child = graph.addNode(randomTransform(), root);
+            for (uint32_t g = 0; g < grandchildrenPerChild; g++) {
+                graph.addNode(randomTransform(), child);
+            }
+        }
+    }
+    graph.update();
+    double buildMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+    JobSystem jobs;
+    printf("%zu nodes in %u hierarchies, built in %.1f ms, %u threads \n", graph.size(), rootCount, buildMs, jobs.threadCount());
+
+    // Reference: every world matrix and inverse transpose from scratch with plain glm, walking the parents
+    auto fullUpdate = [&](std::vector<glm::mat4>& worldOut, std::vector<glm::mat4>& worldITOut) {
+        worldOut.resize(graph.size());
+        worldITOut.resize(graph.size());
+        for (uint32_t i = 0; i < graph.size(); i++) {
+            worldOut[i] = graph.parentIndex[i] == UINT32_MAX ? graph.local[i] : worldOut[graph.parentIndex[i]] * graph.local[i];
+            worldITOut[i] = glm::mat4(glm::transpose(glm::inverse(glm::mat3(worldOut[i]))));
+        }
+    };
+
+    std::vector<glm::mat4> referenceWorld, referenceWorldIT;
+    std::vector<double> fullTimes;
+    for (int frame = 0; frame < frames; frame++) {
+        auto frameStart = std::chrono::high_resolution_clock::now();
+        fullUpdate(referenceWorld, referenceWorldIT);
+        fullTimes.push_back(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - frameStart).count());
+    }
+    std::sort(fullTimes.begin(), fullTimes.end());
+    printf("    full update, scalar  %8.3f ms \n", fullTimes[frames / 2]);
+
+    std::uniform_int_distribution<size_t> pickNode(0, graph.size() - 1);
+    for (float fraction : movedFractions) {
+        for (JobSystem* jobSystem : { static_cast<JobSystem*>(nullptr), &jobs }) {
+            std::vector<double> times;
+            size_t changedNodes = 0;
+            for (int frame = 0; frame < frames; frame++) {
+                size_t moved = static_cast<size_t>(graph.size() * fraction);
+                for (size_t m = 0; m < moved; m++) {
+                    NodeId node = static_cast<NodeId>(pickNode(random));
+                    graph.setLocalTransform(node, randomTransform());
+                }
+
+                auto frameStart = std::chrono::high_resolution_clock::now();
+                changedNodes += graph.update(jobSystem).size();
+                times.push_back(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - frameStart).count());
+            }
+            std::sort(times.begin(), times.end());
+
+            // The incremental result has to match a full recompute of the final local transforms
+            fullUpdate(referenceWorld, referenceWorldIT);
+            float maxError = 0.0f;
+            for (uint32_t i = 0; i < graph.size(); i++) {
+                for (int column = 0; column < 4; column++) {
+                    for (int row = 0; row < 4; row++) {
+                        maxError = std::max(maxError, std::abs(graph.world[i][column][row] - referenceWorld[i][column][row]));
+                        maxError = std::max(maxError, std::abs(graph.worldIT[i][column][row] - referenceWorldIT[i][column][row]));
+                    }
+                }
+            }
+
+            printf("    %4.1f%% moved, %-8s %8.3f ms  %7zu nodes changed per frame  max error %g%s \n", fraction * 100.0f, jobSystem ? "parallel" : "1 thread",
+                times[frames / 2], changedNodes / frames, maxError, maxError < 1e-3f ? "" : "  MISMATCH");
+        }
+    }
+}
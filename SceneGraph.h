@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "glm-0.9.6.3/glm.hpp"
+
+class JobSystem;
+
+// Transform hierarchy kept depth first in flat arrays, so every subtree is the contiguous range after its root and a
+// parent always comes before its children. Nodes are referred to by stable ids, their array position moves on insertion
+class SceneGraph {
+
+public:
+	using NodeId = uint32_t;
+	static const NodeId INVALID_NODE = UINT32_MAX;
+
+	// Add a node as the last child of parent, or as a new root
+	NodeId addNode(const glm::mat4& localTransform, NodeId parent = INVALID_NODE);
+
+	// Marks the node dirty, its subtree gets new world transforms on the next update
+	void setLocalTransform(NodeId node, const glm::mat4& localTransform);
+
+	const glm::mat4& getLocalTransform(NodeId node) const { return local[indexOfId[node]]; }
+	const glm::mat4& getWorldTransform(NodeId node) const { return world[indexOfId[node]]; }
+	// Inverse transpose of the upper 3x3 of the world transform for normals, the rest is identity
+	const glm::mat4& getWorldInverseTranspose(NodeId node) const { return worldIT[indexOfId[node]]; }
+	NodeId getParent(NodeId node) const;
+
+	size_t size() const { return ids.size(); }
+
+	// Recompute the world transforms of every subtree whose root changed since the last update, disjoint subtrees are
+	// spread over the job system when one is given. Returns the ids of all nodes that got new transforms, depth first
+	const std::vector<NodeId>& update(JobSystem* jobs = nullptr);
+
+	// Animates a few percent of a 100k node hierarchy per frame, incremental against full updates
+	static void runBenchmark();
+
+private:
+	void updateRange(uint32_t begin, uint32_t end);
+
+	// Indexed by array position
+	std::vector<uint32_t> parentIndex;
+	std::vector<uint32_t> subtreeSize;
+	std::vector<glm::mat4> local;
+	std::vector<glm::mat4> world;
+	std::vector<glm::mat4> worldIT;
+	std::vector<uint8_t> dirty;
+	std::vector<NodeId> ids;
+
+	// Indexed by id
+	std::vector<uint32_t> indexOfId;
+
+	// Nodes set since the last update, at most once each thanks to the dirty flags
+	std::vector<NodeId> dirtyNodes;
+	std::vector<NodeId> changed;
+};
@@ -0,0 +1,323 @@
+#include "ShaderBindingTable.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+// Room for this many hit records at least once the first one is written
+static const uint32_t MIN_HIT_CAPACITY = 16;
+
+void ShaderBindingTable::configure(const VkPhysicalDeviceRayTracingPipelinePropertiesKHR& properties, uint32_t raygenCount, uint32_t missCount, uint32_t hitGroupCount, uint32_t hitDataSize) {
+    handleSize = properties.shaderGroupHandleSize;
+    handleAlignment = std::max(properties.shaderGroupHandleAlignment, 1u);
+    baseAlignment = std::max(properties.shaderGroupBaseAlignment, handleAlignment);
+    this->raygenCount = raygenCount;
+    this->missCount = missCount;
+    this->hitGroupCount = hitGroupCount;
+    this->hitDataSize = hitDataSize;
+
+    // A ray generation region holds a single record whose stride equals its size, so each one starts on the base
+    // alignment. Miss and hit records only need the handle alignment within a region that starts on the base alignment
+    raygenStride = alignUp(handleSize, baseAlignment);
+    missOffset = raygenStride * raygenCount;
+    missStride = alignUp(handleSize, handleAlignment);
+    hitOffset = missOffset + alignUp(missStride * missCount, baseAlignment);
+    hitStride = alignUp(handleSize + hitDataSize, handleAlignment);
+    if (hitStride > properties.maxShaderGroupStride) {
+        throw std::runtime_error("Hit records of " + std::to_string(hitStride) + " bytes exceed the largest shader group stride!");
+    }
+
+    hitCount = 0;
+    hitCapacity = 0;
+    hitGroups.clear();
+    handles.clear();
+    data.assign(static_cast<size_t>(hitOffset), 0);
+    dirty = { 0, data.size() };
+    reallocated = true;
+}
+
+void ShaderBindingTable::setGroupHandles(const std::vector<uint8_t>& groupHandles) {
+    if (groupHandles.size() < size_t(raygenCount + missCount + hitGroupCount) * handleSize) {
+        throw std::runtime_error("Too few shader group handles for the shader binding table!");
+    }
+    handles = groupHandles;
+
+    for (uint32_t i = 0; i < raygenCount; i++) {
+        writeHandle(static_cast<size_t>(raygenStride * i), i);
+    }
+    for (uint32_t i = 0; i < missCount; i++) {
+        writeHandle(static_cast<size_t>(missOffset + missStride * i), raygenCount + i);
+    }
+    for (uint32_t i = 0; i < hitCount; i++) {
+        writeHandle(static_cast<size_t>(hitOffset + hitStride * i), raygenCount + missCount + hitGroups[i]);
+    }
+}
+
+bool ShaderBindingTable::setHitRecord(uint32_t record, uint32_t hitGroup, const void* recordData) {
+    if (record >= hitCapacity) {
+        // Grown records start zeroed in both copies, the new buffer is filled whole
+        hitCapacity = std::max(std::max(record + 1, hitCapacity * 2), MIN_HIT_CAPACITY);
+        data.resize(static_cast<size_t>(hitOffset + hitStride * hitCapacity), 0);
+        dirty = { 0, data.size() };
+        reallocated = true;
+    }
+    if (record >= hitCount) {
+        hitCount = record + 1;
+        hitGroups.resize(hitCount, 0);
+    }
+    hitGroups[record] = hitGroup;
+
+    // Compared against what the GPU copy holds, since every byte outside the dirty range has been uploaded
+    size_t offset = static_cast<size_t>(hitOffset + hitStride * record);
+    bool changed = false;
+    if (!handles.empty()) {
+        const uint8_t* handle = handles.data() + size_t(raygenCount + missCount + hitGroup) * handleSize;
+        changed = std::memcmp(data.data() + offset, handle, handleSize) != 0;
+    }
+    changed = changed || (hitDataSize > 0 && std::memcmp(data.data() + offset + handleSize, recordData, hitDataSize) != 0);
+    if (!changed) {
+        return false;
+    }
+
+    writeHandle(offset, raygenCount + missCount + hitGroup);
+    std::memcpy(data.data() + offset + handleSize, recordData, hitDataSize);
+    markDirty(offset, offset + handleSize + hitDataSize);
+    return true;
+}
+
+void ShaderBindingTable::truncateHitRecords(uint32_t count) {
+    if (count >= hitCount) {
+        return;
+    }
+    // Zeroed so a record written there again is seen as changed
+    size_t begin = static_cast<size_t>(hitOffset + hitStride * count);
+    size_t end = static_cast<size_t>(hitOffset + hitStride * hitCount);
+    std::fill(data.begin() + begin, data.begin() + end, 0);
+    markDirty(begin, end);
+    hitCount = count;
+    hitGroups.resize(count);
+}
+
+void ShaderBindingTable::markUploaded() {
+    dirty = {};
+    reallocated = false;
+}
+
+std::array<VkStridedDeviceAddressRegionKHR, 4> ShaderBindingTable::getRegions(VkDeviceAddress address, uint32_t raygen) const {
+    std::array<VkStridedDeviceAddressRegionKHR, 4> regions{};
+    regions[0] = { address + raygenStride * raygen, raygenStride, raygenStride };
+    if (missCount > 0) {
+        regions[1] = { address + missOffset, missStride, missStride * missCount };
+    }
+    if (hitCount > 0) {
+        regions[2] = { address + hitOffset, hitStride, hitStride * hitCount };
+    }
+    return regions;
+}
+
+void ShaderBindingTable::markDirty(size_t begin, size_t end) {
+    if (dirty.empty()) {
+        dirty = { begin, end };
+    }
+    else {
+        dirty.begin = std::min(dirty.begin, begin);
+        dirty.end = std::max(dirty.end, end);
+    }
+}
+
+void ShaderBindingTable::writeHandle(size_t offset, uint32_t group) {
+    if (handles.empty()) {
+        return;
+    }
+    const uint8_t* handle = handles.data() + size_t(group) * handleSize;
+    if (std::memcmp(data.data() + offset, handle, handleSize) != 0) {
+        std::memcpy(data.data() + offset, handle, handleSize);
+        markDirty(offset, offset + handleSize);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+SELF TEST
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool ShaderBindingTable::runSelfTest() {
+    size_t checks = 0;
+    size_t failures = 0;
+    auto check = [&](bool ok, const std::string& what) {
+        checks++;
+        if (!ok) {
+            if (failures < 10) {
+                printf("    FAILED: %s \n", what.c_str());
+            }
+            failures++;
+        }
+    };
+
+    // Handle size, handle alignment, base alignment and largest stride of a few real devices, and an odd one with a
+    // handle that is not a multiple of its alignment
+    struct Device {
+        const char* name;
+        uint32_t handleSize;
+        uint32_t handleAlignment;
+        uint32_t baseAlignment;
+        uint32_t maxStride;
+    };
+    const Device devices[] = {
+        { "NVIDIA", 32, 32, 64, 4096 },
+        { "AMD", 32, 32, 64, 4096 },
+        { "Intel", 32, 32, 64, 4096 },
+        { "mobile", 32, 16, 256, 4096 },
+        { "odd", 24, 16, 128, 4096 }
+    };
+
+    struct HitData {
+        uint32_t modelIndex;
+        uint32_t textureOffset;
+        uint32_t firstIndex;
+        uint32_t indexCount;
+        uint32_t extra[3];
+    };
+
+    std::mt19937 rng(7);
+    for (const Device& device : devices) {
+        VkPhysicalDeviceRayTracingPipelinePropertiesKHR properties{};
+        properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR;
+        properties.shaderGroupHandleSize = device.handleSize;
+        properties.shaderGroupHandleAlignment = device.handleAlignment;
+        properties.shaderGroupBaseAlignment = device.baseAlignment;
+        properties.maxShaderGroupStride = device.maxStride;
+
+        for (uint32_t raygenCount = 1; raygenCount <= 2; raygenCount++) {
+            uint32_t missCount = raygenCount + 1;
+            uint32_t hitGroupCount = 3;
+            std::string label = std::string(device.name) + " " + std::to_string(raygenCount) + " raygen";
+
+            ShaderBindingTable table;
+            table.configure(properties, raygenCount, missCount, hitGroupCount, sizeof(HitData));
+            uint32_t groupCount = raygenCount + missCount + hitGroupCount;
+            std::vector<uint8_t> handles(size_t(groupCount) * device.handleSize);
+            for (uint8_t& byte : handles) {
+                byte = static_cast<uint8_t>(rng() | 1);
+            }
+            table.setGroupHandles(handles);
+
+            // The instances of a scene, then one more added after the upload
+            const uint32_t recordCount = 100;
+            std::vector<HitData> records(recordCount + 1);
+            for (uint32_t i = 0; i <= recordCount; i++) {
+                records[i] = { i % 7, i * 3, i * 100, 300, { i, i + 1, i + 2 } };
+            }
+            for (uint32_t i = 0; i < recordCount; i++) {
+                table.setHitRecord(i, i % hitGroupCount, &records[i]);
+            }
+
+            // Alignment rules of vkCmdTraceRaysKHR for a table at a base aligned address
+            VkDeviceAddress address = VkDeviceAddress(device.baseAlignment) * 1000;
+            for (uint32_t raygen = 0; raygen < raygenCount; raygen++) {
+                std::array<VkStridedDeviceAddressRegionKHR, 4> regions = table.getRegions(address, raygen);
+                check(regions[0].deviceAddress % device.baseAlignment == 0, label + ": raygen region address");
+                check(regions[0].size == regions[0].stride, label + ": raygen size equals stride");
+                check(regions[0].stride >= device.handleSize, label + ": raygen stride holds a handle");
+                for (int r = 1; r < 3; r++) {
+                    check(regions[r].deviceAddress % device.baseAlignment == 0, label + ": region " + std::to_string(r) + " address");
+                    check(regions[r].stride % device.handleAlignment == 0, label + ": region " + std::to_string(r) + " stride alignment");
+                    check(regions[r].stride <= device.maxStride, label + ": region " + std::to_string(r) + " stride limit");
+                }
+                check(regions[1].stride >= device.handleSize, label + ": miss stride holds a handle");
+                check(regions[2].stride >= device.handleSize + sizeof(HitData), label + ": hit stride holds a handle and its data");
+                check(regions[2].size == regions[2].stride * recordCount, label + ": hit region covers the records");
+                check(regions[3].size == 0, label + ": no callables");
+
+                // Regions in order without overlap, inside the table
+                check(regions[0].deviceAddress + regions[0].size <= regions[1].deviceAddress || raygen + 1 < raygenCount, label + ": raygen before miss");
+                check(regions[1].deviceAddress + regions[1].size <= regions[2].deviceAddress, label + ": miss before hit");
+                check(regions[2].deviceAddress + regions[2].size <= address + table.getSize(), label + ": hit records inside the table");
+            }
+
+            // Every record starts with its group's handle, hit records follow it with their data
+            const std::vector<uint8_t>& bytes = table.getData();
+            std::array<VkStridedDeviceAddressRegionKHR, 4> regions = table.getRegions(0);
+            for (uint32_t i = 0; i < raygenCount; i++) {
+                size_t offset = static_cast<size_t>(table.getRegions(0, i)[0].deviceAddress);
+                check(std::memcmp(&bytes[offset], &handles[size_t(i) * device.handleSize], device.handleSize) == 0, label + ": raygen handle");
+            }
+            for (uint32_t i = 0; i < missCount; i++) {
+                size_t offset = static_cast<size_t>(regions[1].deviceAddress + regions[1].stride * i);
+                check(std::memcmp(&bytes[offset], &handles[size_t(raygenCount + i) * device.handleSize], device.handleSize) == 0, label + ": miss handle");
+            }
+            bool recordsMatch = true;
+            for (uint32_t i = 0; i < recordCount; i++) {
+                size_t offset = static_cast<size_t>(regions[2].deviceAddress + regions[2].stride * i);
+                uint32_t group = raygenCount + missCount + i % hitGroupCount;
+                recordsMatch = recordsMatch && std::memcmp(&bytes[offset], &handles[size_t(group) * device.handleSize], device.handleSize) == 0;
+                recordsMatch = recordsMatch && std::memcmp(&bytes[offset + device.handleSize], &records[i], sizeof(HitData)) == 0;
+            }
+            check(recordsMatch, label + ": hit records hold their handle and data");
+
+            // Rewriting the same records changes nothing, a changed or added record dirties only its own bytes
+            table.markUploaded();
+            bool anyChanged = false;
+            for (uint32_t i = 0; i < recordCount; i++) {
+                anyChanged = table.setHitRecord(i, i % hitGroupCount, &records[i]) || anyChanged;
+            }
+            check(!anyChanged && table.getDirtyRange().empty(), label + ": unchanged records stay clean");
+
+            records[40].textureOffset++;
+            check(table.setHitRecord(40, 40 % hitGroupCount, &records[40]), label + ": changed record reported");
+            ShaderBindingTable::DirtyRange range = table.getDirtyRange();
+            size_t recordBegin = static_cast<size_t>(table.getHitOffset() + table.getHitStride() * 40);
+            check(range.begin >= recordBegin && range.end <= recordBegin + table.getHitStride(), label + ": changed record dirties only itself");
+            check(!table.needsReallocation(), label + ": changed record keeps the buffer");
+
+            table.markUploaded();
+            size_t sizeBefore = table.getSize();
+            table.setHitRecord(recordCount, recordCount % hitGroupCount, &records[recordCount]);
+            range = table.getDirtyRange();
+            recordBegin = static_cast<size_t>(table.getHitOffset() + table.getHitStride() * recordCount);
+            check(table.getSize() == sizeBefore && !table.needsReallocation(), label + ": added record fits the capacity");
+            check(range.begin >= recordBegin && range.end <= recordBegin + table.getHitStride(), label + ": added record dirties only itself");
+            check(table.getHitRecordCount() == recordCount + 1, label + ": record count");
+
+            // Past the capacity the table doubles and has to be uploaded whole
+            table.markUploaded();
+            uint32_t farRecord = static_cast<uint32_t>((table.getSize() - table.getHitOffset()) / table.getHitStride());
+            table.setHitRecord(farRecord, 0, &records[0]);
+            check(table.needsReallocation() && table.getDirtyRange().begin == 0 && table.getDirtyRange().end == table.getSize(), label + ": growth reallocates");
+            check(table.getSize() >= table.getHitOffset() + table.getHitStride() * (farRecord + 1), label + ": grown table holds the record");
+
+            // A new pipeline's handles reach every record
+            table.markUploaded();
+            for (uint8_t& byte : handles) {
+                byte = static_cast<uint8_t>(byte + 2);
+            }
+            table.setGroupHandles(handles);
+            check(!table.getDirtyRange().empty() && table.getDirtyRange().begin == 0, label + ": new handles dirty the table");
+            size_t lastOffset = static_cast<size_t>(table.getHitOffset() + table.getHitStride() * farRecord);
+            check(std::memcmp(&table.getData()[lastOffset], &handles[size_t(raygenCount + missCount) * device.handleSize], device.handleSize) == 0, label + ": new handle in the last record");
+        }
+    }
+
+    // The alignment helper itself and the stride limit
+    check(alignUp(0, 64) == 0 && alignUp(1, 64) == 64 && alignUp(64, 64) == 64 && alignUp(65, 64) == 128 && alignUp(24, 16) == 32, "alignUp");
+    VkPhysicalDeviceRayTracingPipelinePropertiesKHR tight{};
+    tight.shaderGroupHandleSize = 32;
+    tight.shaderGroupHandleAlignment = 32;
+    tight.shaderGroupBaseAlignment = 64;
+    tight.maxShaderGroupStride = 64;
+    bool threw = false;
+    try {
+        ShaderBindingTable table;
+        table.configure(tight, 1, 1, 1, 64);
+    }
+    catch (const std::runtime_error&) {
+        threw = true;
+    }
+    check(threw, "hit record past the stride limit rejected");
+
+    printf("%zu checks, %zu failed \n", checks, failures);
+    return failures == 0;
+}
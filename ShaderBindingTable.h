@@ -0,0 +1,86 @@
+#pragma once
+
+#include <volk.h>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Host copy of a ray tracing pipeline's shader binding table: the ray generation records, the miss records and one hit
+// record per instance, each a shader group handle followed by its data. Records are sized and placed by the device's
+// handle size, handle alignment and base alignment. Rewriting a record that did not change leaves it clean, so after
+// instances are added only their records and the bytes that moved have to reach the GPU copy
+class ShaderBindingTable {
+
+public:
+	// Byte range of the table that changed since the last markUploaded
+	struct DirtyRange {
+		size_t begin = 0;
+		size_t end = 0;
+		bool empty() const { return begin >= end; }
+	};
+
+	// Lay out the table for a pipeline whose groups are the ray generation ones, then the miss ones, then the hit ones.
+	// Every hit record carries hitDataSize bytes after its handle. Throws when a hit record exceeds the largest stride
+	void configure(const VkPhysicalDeviceRayTracingPipelinePropertiesKHR& properties, uint32_t raygenCount, uint32_t missCount, uint32_t hitGroupCount, uint32_t hitDataSize);
+	bool isConfigured() const { return handleSize != 0; }
+	// Group handles as vkGetRayTracingShaderGroupHandlesKHR writes them, handleSize bytes per group in pipeline order.
+	// Rewrites the ray generation and miss records and the handle of every hit record
+	void setGroupHandles(const std::vector<uint8_t>& handles);
+	// Point a hit record at a hit group with hitDataSize bytes of data, growing the table to reach it. Returns whether
+	// any byte of the record changed
+	bool setHitRecord(uint32_t record, uint32_t hitGroup, const void* data);
+	// Drop the records from count on, the capacity is kept
+	void truncateHitRecords(uint32_t count);
+
+	// The table, getSize() bytes, to be copied to a buffer whose address is a multiple of the base alignment
+	const std::vector<uint8_t>& getData() const { return data; }
+	size_t getSize() const { return data.size(); }
+	DirtyRange getDirtyRange() const { return dirty; }
+	// Set when the table outgrew its last upload, the buffer has to be recreated and filled whole
+	bool needsReallocation() const { return reallocated; }
+	void markUploaded();
+
+	// Regions for vkCmdTraceRaysKHR of the table at address: the ray generation record raygen, the miss records, the
+	// hit records and no callables
+	std::array<VkStridedDeviceAddressRegionKHR, 4> getRegions(VkDeviceAddress address, uint32_t raygen = 0) const;
+	VkDeviceSize getHitStride() const { return hitStride; }
+	VkDeviceSize getHitOffset() const { return hitOffset; }
+	uint32_t getHitRecordCount() const { return hitCount; }
+	uint32_t getBaseAlignment() const { return baseAlignment; }
+
+	static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) { return (value + alignment - 1) / alignment * alignment; }
+
+	// Lays out tables against the properties of several devices and checks every alignment rule of the spec, that no
+	// record overlaps another, and that incremental updates mark exactly the records that changed. Returns false if any
+	// check failed
+	static bool runSelfTest();
+
+private:
+	void markDirty(size_t begin, size_t end);
+	void writeHandle(size_t offset, uint32_t group);
+
+	uint32_t handleSize = 0;
+	uint32_t handleAlignment = 0;
+	uint32_t baseAlignment = 0;
+	uint32_t raygenCount = 0;
+	uint32_t missCount = 0;
+	uint32_t hitGroupCount = 0;
+	uint32_t hitDataSize = 0;
+
+	VkDeviceSize raygenStride = 0;
+	VkDeviceSize missOffset = 0;
+	VkDeviceSize missStride = 0;
+	VkDeviceSize hitOffset = 0;
+	VkDeviceSize hitStride = 0;
+	// Records in use and records the table has room for, it grows by doubling so adding instances rarely reallocates
+	uint32_t hitCount = 0;
+	uint32_t hitCapacity = 0;
+	// Hit group of every record in use
+	std::vector<uint32_t> hitGroups;
+
+	std::vector<uint8_t> handles;
+	std::vector<uint8_t> data;
+	DirtyRange dirty;
+	bool reallocated = false;
+};
@@ -0,0 +1,363 @@
+#include "ShaderHotReload.h"
+#include "VulkanRenderer.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <unordered_map>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+SHADER COMPILATION
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static std::filesystem::file_time_type lastWriteTime(const std::string& path) {
+    std::error_code ec;
+    std::filesystem::file_time_type time = std::filesystem::last_write_time(path, ec);
+    return ec ? std::filesystem::file_time_type::min() : time;
+}
+
+// Prefer the compiler shipped with the SDK, otherwise expect glslc on the path
+static std::string compilerPath() {
+    if (const char* sdk = std::getenv("VULKAN_SDK")) {
+        return std::string(sdk) + "/bin/glslc";
+    }
+    return "glslc";
+}
+
+static bool compilerAvailable() {
+#ifdef _WIN32
+    std::string command = "\"\"" + compilerPath() + "\" --version >nul 2>&1\"";
+#else
+    std::string command = "\"" + compilerPath() + "\" --version >/dev/null 2>&1";
+#endif
+    return std::system(command.c_str()) == 0;
+}
+
+bool ShaderHotReload::compileShader(const ShaderSource& source) {
+    std::string compiler = compilerPath();
+    std::string glslPath = shaderDir + source.glslName;
+    std::string spvPath = shaderDir + source.spvName;
+    std::string tmpPath = spvPath + ".tmp";
+
+    std::string command = "\"" + compiler + "\" " + (source.options.empty() ? "" : source.options + " ") + "\"" + glslPath + "\" -o \"" + tmpPath + "\"";
+#ifdef _WIN32
+    // cmd.exe strips the outer pair of quotes
+    command = "\"" + command + "\"";
+#endif
+
+    if (std::system(command.c_str()) != 0) {
+        std::cerr << "Failed to compile " << glslPath << ", keeping the previous binary" << std::endl;
+        std::filesystem::remove(tmpPath);
+        return false;
+    }
+
+    // Write to a temporary file and rename it into place so the pipeline build never reads a half written binary
+    std::error_code ec;
+    std::filesystem::rename(tmpPath, spvPath, ec);
+    if (ec) {
+        std::cerr << "Failed to replace " << spvPath << ": " << ec.message() << std::endl;
+        return false;
+    }
+
+    printf("Compiled %s \n", glslPath.c_str());
+    return true;
+}
+
+void ShaderHotReload::compileOutdated() {
+    // A checkout can leave a binary that is newer than its source but built from an older one, so modification times
+    // can't be trusted here and every source is compiled whenever there is a compiler to do it
+    bool compile = compilerAvailable();
+    if (!compile) {
+        std::cerr << "No glslc found, using the shader binaries already in " << shaderDir << std::endl;
+    }
+
+    for (const ShaderSource& source : sources) {
+        if (compile && lastWriteTime(shaderDir + source.glslName) != std::filesystem::file_time_type::min()) {
+            compileShader(source);
+        }
+        else if (lastWriteTime(shaderDir + source.spvName) == std::filesystem::file_time_type::min()) {
+            std::cerr << "Missing " << shaderDir << source.spvName << ", run compile.bat or compile.sh" << std::endl;
+        }
+    }
+
+    recordWriteTimes();
+}
+
+void ShaderHotReload::recordWriteTimes() {
+    glslWriteTimes.resize(sources.size());
+    spvWriteTimes.resize(sources.size());
+    includeWriteTimes.resize(includes.size());
+
+    for (size_t i = 0; i < sources.size(); i++) {
+        glslWriteTimes[i] = lastWriteTime(shaderDir + sources[i].glslName);
+        spvWriteTimes[i] = lastWriteTime(shaderDir + sources[i].spvName);
+    }
+    for (size_t i = 0; i < includes.size(); i++) {
+        includeWriteTimes[i] = lastWriteTime(shaderDir + includes[i].name);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+FILE WATCHER
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// Each slot of ReloadedPipelines, so a set can be merged and destroyed as a whole
+static constexpr VkPipeline ReloadedPipelines::* RELOADED_SLOTS[] = {
+    &ReloadedPipelines::graphics,
+    &ReloadedPipelines::depthPrepass,
+    &ReloadedPipelines::shadow,
+    &ReloadedPipelines::rayTrace,
+    &ReloadedPipelines::rayAccumulate,
+    &ReloadedPipelines::rayDenoise
+};
+
+static void destroyPipelines(VkDevice device, ReloadedPipelines& pipelines) {
+    for (VkPipeline ReloadedPipelines::* slot : RELOADED_SLOTS) {
+        if (pipelines.*slot != VK_NULL_HANDLE) {
+            vkDestroyPipeline(device, pipelines.*slot, nullptr);
+            pipelines.*slot = VK_NULL_HANDLE;
+        }
+    }
+}
+
+void ShaderHotReload::start(VulkanRenderer* renderer) {
+    vkR = renderer;
+
+    if (glslWriteTimes.size() != sources.size()) {
+        recordWriteTimes();
+    }
+
+#ifdef __linux__
+    inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotifyFd >= 0) {
+        // Editors and the compiler both replace files by renaming, so watch for moves as well as writes
+        watchFd = inotify_add_watch(inotifyFd, shaderDir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+    }
+#endif
+
+    running = true;
+    worker = std::thread(&ShaderHotReload::watchLoop, this);
+}
+
+void ShaderHotReload::stop() {
+    running = false;
+    if (worker.joinable()) {
+        worker.join();
+    }
+
+#ifdef __linux__
+    if (inotifyFd >= 0) {
+        close(inotifyFd);
+        inotifyFd = -1;
+        watchFd = -1;
+    }
+#endif
+
+    std::lock_guard<std::mutex> lock(pendingMutex);
+    if (vkR) {
+        destroyPipelines(vkR->device, pending);
+    }
+}
+
+std::vector<std::string> ShaderHotReload::pollChanges(std::chrono::milliseconds timeout) {
+    std::vector<std::string> changed;
+
+#ifdef __linux__
+    if (watchFd >= 0) {
+        pollfd pfd{};
+        pfd.fd = inotifyFd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, static_cast<int>(timeout.count())) <= 0) {
+            return changed;
+        }
+
+        alignas(inotify_event) char buffer[4096];
+        ssize_t length;
+        while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0) {
+            for (char* ptr = buffer; ptr < buffer + length;) {
+                const inotify_event* event = reinterpret_cast<const inotify_event*>(ptr);
+                if (event->len > 0) {
+                    changed.emplace_back(event->name);
+                }
+                ptr += sizeof(inotify_event) + event->len;
+            }
+        }
+        return changed;
+    }
+#endif
+
+    // No native notifications, fall back to comparing modification times
+    static std::unordered_map<std::string, std::filesystem::file_time_type> polledTimes;
+    std::this_thread::sleep_for(timeout);
+    std::vector<std::string> names;
+    for (const ShaderSource& source : sources) {
+        names.push_back(source.glslName);
+        names.push_back(source.spvName);
+    }
+    for (const ShaderInclude& include : includes) {
+        names.push_back(include.name);
+    }
+    for (const std::string& name : names) {
+        std::filesystem::file_time_type time = lastWriteTime(shaderDir + name);
+        auto it = polledTimes.find(name);
+        if (it == polledTimes.end()) {
+            polledTimes[name] = time;
+        }
+        else if (it->second != time) {
+            it->second = time;
+            changed.push_back(name);
+        }
+    }
+    return changed;
+}
+
+void ShaderHotReload::watchLoop() {
+    while (running) {
+        if (pollChanges(std::chrono::milliseconds(250)).empty()) {
+            continue;
+        }
+
+        // Editors save in several steps, so wait for the directory to settle before compiling
+        while (running && !pollChanges(std::chrono::milliseconds(100)).empty()) {}
+
+        // An edited include recompiles every source that includes it
+        std::vector<std::string> dependents;
+        for (size_t i = 0; i < includes.size(); i++) {
+            std::filesystem::file_time_type includeTime = lastWriteTime(shaderDir + includes[i].name);
+            if (includeTime != includeWriteTimes[i]) {
+                includeWriteTimes[i] = includeTime;
+                dependents.insert(dependents.end(), includes[i].includedBy.begin(), includes[i].includedBy.end());
+            }
+        }
+
+        // Modification times decide what actually changed, which also ignores the events from our own compiler output
+        std::vector<std::string> changedSpv;
+        for (size_t i = 0; i < sources.size(); i++) {
+            std::filesystem::file_time_type glslTime = lastWriteTime(shaderDir + sources[i].glslName);
+            bool included = std::find(dependents.begin(), dependents.end(), sources[i].glslName) != dependents.end();
+            if (glslTime != glslWriteTimes[i] || included) {
+                glslWriteTimes[i] = glslTime;
+                compileShader(sources[i]);
+            }
+
+            std::filesystem::file_time_type spvTime = lastWriteTime(shaderDir + sources[i].spvName);
+            if (spvTime != spvWriteTimes[i]) {
+                spvWriteTimes[i] = spvTime;
+                changedSpv.push_back(sources[i].spvName);
+            }
+        }
+
+        if (!changedSpv.empty()) {
+            buildPipelines(changedSpv);
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+PIPELINE REBUILD AND SWAP
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void ShaderHotReload::buildPipelines(const std::vector<std::string>& changedSpv) {
+    auto changed = [&](const char* spvName) {
+        return std::find(changedSpv.begin(), changedSpv.end(), spvName) != changedSpv.end();
+    };
+    auto read = [&](const char* spvName) {
+        return VulkanRenderer::readFile(shaderDir + spvName, false);
+    };
+
+    // Only the copy is taken under the lock. The lease keeps the render passes and layouts it names alive while the
+    // build runs, and a swap chain recreation or pre-pass switch in the meantime bumps the generation so the result
+    // is dropped instead of swapped in
+    VulkanRenderer::GraphicsPipelineState state = vkR->acquireGraphicsPipelineState();
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+    ReloadedPipelines built;
+    try {
+        if (changed("vert.spv") || changed("frag.spv")) {
+            built.graphics = vkR->buildGraphicsPipeline(state, read("vert.spv"), read("frag.spv"));
+        }
+        if (state.depthPrepass && changed("depth.spv")) {
+            built.depthPrepass = vkR->buildGraphicsPipeline(state, read("depth.spv"), {}, true);
+        }
+        if (state.shadows && changed("shadow.spv")) {
+            built.shadow = vkR->buildGraphicsPipeline(state, read("shadow.spv"), {}, true, true);
+        }
+        if (state.rayTracedShadows) {
+            if (changed("rtshadows.spv")) {
+                built.rayTrace = vkR->buildComputePipeline(state.rayTracedPipelineLayout, read("rtshadows.spv"), "rtshadows");
+            }
+            if (changed("rtaccumulate.spv")) {
+                built.rayAccumulate = vkR->buildComputePipeline(state.rayTracedPipelineLayout, read("rtaccumulate.spv"), "rtaccumulate");
+            }
+            if (changed("rtdenoise.spv")) {
+                built.rayDenoise = vkR->buildComputePipeline(state.rayTracedPipelineLayout, read("rtdenoise.spv"), "rtdenoise");
+            }
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Shader reload failed: " << e.what() << std::endl;
+        destroyPipelines(vkR->device, built);
+        vkR->releaseGraphicsPipelineState();
+        return;
+    }
+    vkR->releaseGraphicsPipelineState();
+
+    uint32_t count = 0;
+    for (VkPipeline ReloadedPipelines::* slot : RELOADED_SLOTS) {
+        count += built.*slot != VK_NULL_HANDLE ? 1 : 0;
+    }
+    if (count == 0) {
+        return;
+    }
+    float ms = std::chrono::duration<float, std::chrono::milliseconds::period>(std::chrono::high_resolution_clock::now() - startTime).count();
+    printf("Rebuilt %u pipelines in %.2f ms \n", count, ms);
+
+    // Pipelines waiting from an older state are dropped, otherwise a newer build only replaces the ones it rebuilt
+    std::lock_guard<std::mutex> lock(pendingMutex);
+    if (pendingGeneration != state.generation) {
+        destroyPipelines(vkR->device, pending);
+    }
+    for (VkPipeline ReloadedPipelines::* slot : RELOADED_SLOTS) {
+        if (built.*slot != VK_NULL_HANDLE) {
+            if (pending.*slot != VK_NULL_HANDLE) {
+                vkDestroyPipeline(vkR->device, pending.*slot, nullptr);
+            }
+            pending.*slot = built.*slot;
+        }
+    }
+    pendingGeneration = state.generation;
+}
+
+bool ShaderHotReload::applyPendingPipeline() {
+    std::lock_guard<std::mutex> lock(pendingMutex);
+    bool any = false;
+    for (VkPipeline ReloadedPipelines::* slot : RELOADED_SLOTS) {
+        any = any || pending.*slot != VK_NULL_HANDLE;
+    }
+    if (!any) {
+        return false;
+    }
+
+    // The swap chain was recreated or the pre-pass switched since the worker built them, so the pipelines target
+    // destroyed render passes
+    if (pendingGeneration != vkR->pipelineStateGeneration) {
+        destroyPipelines(vkR->device, pending);
+        return false;
+    }
+
+    vkR->swapPipelines(pending);
+    pending = ReloadedPipelines{};
+    return true;
+}
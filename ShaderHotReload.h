@@ -0,0 +1,94 @@
+#pragma once
+
+#include <volk.h>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class VulkanRenderer;
+
+// Pipelines rebuilt by the shader reload thread, null where the shaders did not change
+struct ReloadedPipelines {
+	VkPipeline graphics = VK_NULL_HANDLE;
+	VkPipeline depthPrepass = VK_NULL_HANDLE;
+	VkPipeline shadow = VK_NULL_HANDLE;
+	VkPipeline rayTrace = VK_NULL_HANDLE;
+	VkPipeline rayAccumulate = VK_NULL_HANDLE;
+	VkPipeline rayDenoise = VK_NULL_HANDLE;
+};
+
+// Watches the shader directory, recompiles edited GLSL and builds the replacement pipelines on a worker thread
+class ShaderHotReload {
+
+public:
+	// A GLSL source and the SPIR-V binary it compiles to, both relative to the shader directory, and any extra
+	// compiler options
+	struct ShaderSource {
+		std::string glslName;
+		std::string spvName;
+		std::string options;
+	};
+
+	std::string shaderDir = "shaders/";
+	std::vector<ShaderSource> sources = {
+		{ "shader.vert", "vert.spv" },
+		{ "shader.frag", "frag.spv" },
+		{ "depth.vert", "depth.spv" },
+		{ "shadow.vert", "shadow.spv" },
+		// Ray queries need SPIR-V 1.4
+		{ "rtshadows.comp", "rtshadows.spv", "--target-env=vulkan1.2" },
+		{ "rtaccumulate.comp", "rtaccumulate.spv" },
+		{ "rtdenoise.comp", "rtdenoise.spv" }
+	};
+
+	// A file the sources include and the sources that include it, which are recompiled when it changes
+	struct ShaderInclude {
+		std::string name;
+		std::vector<std::string> includedBy;
+	};
+
+	std::vector<ShaderInclude> includes = {
+		{ "raytraced.glsl", { "rtshadows.comp", "rtaccumulate.comp", "rtdenoise.comp" } }
+	};
+
+	// Compile every GLSL source when glslc is available, called once before the first pipeline is built. The binaries
+	// are not committed, without a compiler they come from compile.bat or compile.sh
+	void compileOutdated();
+
+	// Start and stop the watcher thread
+	void start(VulkanRenderer* renderer);
+	void stop();
+
+	// Swap in the pipelines finished by the worker, only called from the render loop between frames
+	bool applyPendingPipeline();
+
+private:
+	VulkanRenderer* vkR = nullptr;
+
+	std::thread worker;
+	std::atomic<bool> running{ false };
+
+	// Pipelines built by the worker and the generation of the pipeline state they were built against
+	std::mutex pendingMutex;
+	ReloadedPipelines pending;
+	uint64_t pendingGeneration = 0;
+
+	// inotify handles on Linux, modification times everywhere else
+	int inotifyFd = -1;
+	int watchFd = -1;
+	std::vector<std::filesystem::file_time_type> glslWriteTimes;
+	std::vector<std::filesystem::file_time_type> spvWriteTimes;
+	std::vector<std::filesystem::file_time_type> includeWriteTimes;
+
+	void watchLoop();
+	// Wait up to timeout for changes, returning the names of the files that changed
+	std::vector<std::string> pollChanges(std::chrono::milliseconds timeout);
+	bool compileShader(const ShaderSource& source);
+	void recordWriteTimes();
+	// Build the pipelines that use the changed binaries, without holding the renderer's pipeline state lock
+	void buildPipelines(const std::vector<std::string>& changedSpv);
+};
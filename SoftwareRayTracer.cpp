@@ -0,0 +1,159 @@
+#include "SoftwareRayTracer.h"
+#include <algorithm>
+
+uint32_t SoftwareRayTracer::addMesh(const glm::vec3* positions, size_t positionCount, const uint32_t* indices, size_t indexCount) {
+    size_t triangleCount = indexCount / 3;
+    std::vector<glm::vec3> boxMins(triangleCount);
+    std::vector<glm::vec3> boxMaxs(triangleCount);
+    for (size_t i = 0; i < triangleCount; i++) {
+        const glm::vec3& a = positions[std::min<size_t>(indices[i * 3], positionCount - 1)];
+        const glm::vec3& b = positions[std::min<size_t>(indices[i * 3 + 1], positionCount - 1)];
+        const glm::vec3& c = positions[std::min<size_t>(indices[i * 3 + 2], positionCount - 1)];
+        boxMins[i] = glm::min(a, glm::min(b, c));
+        boxMaxs[i] = glm::max(a, glm::max(b, c));
+    }
+
+    Mesh mesh;
+    mesh.bvh.build(boxMins.data(), boxMaxs.data(), triangleCount);
+    // Stored in leaf order, so a leaf's triangles are read from consecutive memory and the BVH's primitive list can
+    // index straight into them
+    mesh.corners.resize(triangleCount);
+    mesh.edges1.resize(triangleCount);
+    mesh.edges2.resize(triangleCount);
+    mesh.triangles.resize(triangleCount);
+    for (size_t i = 0; i < triangleCount; i++) {
+        uint32_t triangle = mesh.bvh.primitives[i];
+        const glm::vec3& a = positions[std::min<size_t>(indices[triangle * 3], positionCount - 1)];
+        const glm::vec3& b = positions[std::min<size_t>(indices[triangle * 3 + 1], positionCount - 1)];
+        const glm::vec3& c = positions[std::min<size_t>(indices[triangle * 3 + 2], positionCount - 1)];
+        mesh.corners[i] = a;
+        mesh.edges1[i] = b - a;
+        mesh.edges2[i] = c - a;
+        mesh.triangles[i] = triangle;
+    }
+    meshes.push_back(std::move(mesh));
+    return static_cast<uint32_t>(meshes.size() - 1);
+}
+
+uint32_t SoftwareRayTracer::addInstance(uint32_t mesh, const glm::mat4& transform) {
+    Instance instance;
+    instance.mesh = mesh;
+    instances.push_back(instance);
+    setTransform(static_cast<uint32_t>(instances.size() - 1), transform);
+    return static_cast<uint32_t>(instances.size() - 1);
+}
+
+void SoftwareRayTracer::setTransform(uint32_t index, const glm::mat4& transform) {
+    Instance& instance = instances[index];
+    instance.transform = transform;
+    instance.inverse = glm::inverse(transform);
+
+    // World box of the mesh's root box, from its eight corners
+    instance.worldMin = glm::vec3(FLT_MAX);
+    instance.worldMax = glm::vec3(-FLT_MAX);
+    const StaticBVH& bvh = meshes[instance.mesh].bvh;
+    if (bvh.nodes.empty()) {
+        instance.worldMin = instance.worldMax = glm::vec3(transform[3]);
+        return;
+    }
+    const BVHNode& root = bvh.nodes[bvh.getRoot()];
+    for (int corner = 0; corner < 8; corner++) {
+        glm::vec3 local((corner & 1) ? root.max.x : root.min.x, (corner & 2) ? root.max.y : root.min.y, (corner & 4) ? root.max.z : root.min.z);
+        glm::vec3 world = glm::vec3(transform * glm::vec4(local, 1.0f));
+        instance.worldMin = glm::min(instance.worldMin, world);
+        instance.worldMax = glm::max(instance.worldMax, world);
+    }
+}
+
+void SoftwareRayTracer::build() {
+    std::vector<glm::vec3> boxMins(instances.size());
+    std::vector<glm::vec3> boxMaxs(instances.size());
+    for (size_t i = 0; i < instances.size(); i++) {
+        boxMins[i] = instances[i].worldMin;
+        boxMaxs[i] = instances[i].worldMax;
+    }
+    // One instance per leaf, testing an instance means walking a whole mesh BVH
+    instanceBVH.build(boxMins.data(), boxMaxs.data(), instances.size(), 1);
+}
+
+size_t SoftwareRayTracer::triangleCount() const {
+    size_t count = 0;
+    for (const Instance& instance : instances) {
+        count += meshes[instance.mesh].triangles.size();
+    }
+    return count;
+}
+
+template<bool anyHit>
+SoftwareRayTracer::Hit SoftwareRayTracer::trace(const Ray& ray) const {
+    Hit hit;
+    hit.t = ray.tMax;
+    bool found = false;
+    BVH::traverseRay(instanceBVH.nodes.data(), instanceBVH.getRoot(), ray, [&](uint32_t first, uint32_t count, float tMax) {
+        for (uint32_t i = first; i < first + count; i++) {
+            uint32_t index = instanceBVH.primitives[i];
+            const Instance& instance = instances[index];
+            const Mesh& mesh = meshes[instance.mesh];
+            Ray local;
+            local.origin = glm::vec3(instance.inverse * glm::vec4(ray.origin, 1.0f));
+            local.direction = glm::vec3(instance.inverse * glm::vec4(ray.direction, 0.0f));
+            local.tMin = ray.tMin;
+            local.tMax = tMax;
+
+            BVH::traverseRay(mesh.bvh.nodes.data(), mesh.bvh.getRoot(), local, [&](uint32_t leafFirst, uint32_t leafCount, float leafMax) {
+                // Möller-Trumbore, against the triangles of the leaf in storage order
+                for (uint32_t j = leafFirst; j < leafFirst + leafCount; j++) {
+                    glm::vec3 p = glm::cross(local.direction, mesh.edges2[j]);
+                    float determinant = glm::dot(mesh.edges1[j], p);
+                    if (determinant == 0.0f) {
+                        continue;
+                    }
+                    float inverse = 1.0f / determinant;
+                    glm::vec3 toOrigin = local.origin - mesh.corners[j];
+                    float u = glm::dot(toOrigin, p) * inverse;
+                    if (u < 0.0f || u > 1.0f) {
+                        continue;
+                    }
+                    glm::vec3 q = glm::cross(toOrigin, mesh.edges1[j]);
+                    float v = glm::dot(local.direction, q) * inverse;
+                    if (v < 0.0f || u + v > 1.0f) {
+                        continue;
+                    }
+                    float t = glm::dot(mesh.edges2[j], q) * inverse;
+                    if (t < local.tMin || t > leafMax) {
+                        continue;
+                    }
+                    found = true;
+                    hit.instance = index;
+                    hit.triangle = mesh.triangles[j];
+                    hit.t = t;
+                    if (anyHit) {
+                        // Below every stacked distance, the traversal ends here
+                        return -1.0f;
+                    }
+                    leafMax = t;
+                }
+                return leafMax;
+            });
+
+            if (anyHit && found) {
+                return -1.0f;
+            }
+            tMax = hit.t;
+        }
+        return tMax;
+    });
+
+    if (!found) {
+        hit = Hit();
+    }
+    return hit;
+}
+
+SoftwareRayTracer::Hit SoftwareRayTracer::intersect(const Ray& ray) const {
+    return trace<false>(ray);
+}
+
+bool SoftwareRayTracer::occluded(const Ray& ray) const {
+    return trace<true>(ray).instance != UINT32_MAX;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "glm-0.9.6.3/glm.hpp"
+#include "BVH.h"
+
+// Two level BVH that answers the same queries as the bottom and top level acceleration structures, for running the ray
+// traced passes on the CPU. Every mesh gets a static BVH over its triangles once, and the instances placing the meshes
+// in the world are put in a BVH of their own that is rebuilt whenever instances move
+class SoftwareRayTracer {
+
+public:
+	// Closest hit, with the instance and the triangle of its mesh that was hit
+	struct Hit {
+		uint32_t instance = UINT32_MAX;
+		uint32_t triangle = UINT32_MAX;
+		float t = FLT_MAX;
+	};
+
+	// Builds the mesh's BVH, indexCount / 3 triangles indexing into positions. Returns the mesh's id
+	uint32_t addMesh(const glm::vec3* positions, size_t positionCount, const uint32_t* indices, size_t indexCount);
+	// Places a mesh in the world, the instance level is out of date until the next build. Returns the instance's id
+	uint32_t addInstance(uint32_t mesh, const glm::mat4& transform);
+	void setTransform(uint32_t instance, const glm::mat4& transform);
+	// Rebuilds the instance level
+	void build();
+
+	// Nearest triangle between tMin and tMax, t is in units of the ray's direction
+	Hit intersect(const Ray& ray) const;
+	// Whether any triangle lies between tMin and tMax, which stops at the first one found, as shadow and occlusion rays do
+	bool occluded(const Ray& ray) const;
+
+	size_t instanceCount() const { return instances.size(); }
+	// Triangles over all instances
+	size_t triangleCount() const;
+
+private:
+	struct Mesh {
+		StaticBVH bvh;
+		// A corner and two edges of every triangle, in the order of the BVH's leaves
+		std::vector<glm::vec3> corners;
+		std::vector<glm::vec3> edges1;
+		std::vector<glm::vec3> edges2;
+		// Triangle index in the mesh's index buffer of every entry above
+		std::vector<uint32_t> triangles;
+	};
+
+	struct Instance {
+		uint32_t mesh;
+		glm::mat4 transform;
+		glm::mat4 inverse;
+		glm::vec3 worldMin;
+		glm::vec3 worldMax;
+	};
+
+	// Nearest hit, or any hit when anyHit is set. Rays are taken into the space of each instance they reach without
+	// normalizing the direction, so t means the same on both levels
+	template<bool anyHit>
+	Hit trace(const Ray& ray) const;
+
+	std::vector<Mesh> meshes;
+	std::vector<Instance> instances;
+	StaticBVH instanceBVH;
+};
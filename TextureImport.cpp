@@ -0,0 +1,337 @@
+#include "TextureImport.h"
+#include "TextureStreaming.h"
+#include "JobSystem.h"
+#include "AssetArchive.h"
+#include <stb_image.h>
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+size_t TextureImporter::layoutChain(uint32_t width, uint32_t height, bool mips, std::vector<size_t>& offsets) {
+    offsets.clear();
+    size_t size = 0;
+    for (uint32_t level = 0; level == 0 || (mips && std::max(width >> (level - 1), height >> (level - 1)) > 1); level++) {
+        size_t offset = (size + 15) / 16 * 16;
+        offsets.push_back(offset);
+        size = offset + static_cast<size_t>(std::max(width >> level, 1u)) * std::max(height >> level, 1u) * 4;
+    }
+    return size;
+}
+
+// The bytes of a file the mounted archive holds, out of its mapping or, when stored compressed, inflated into copy.
+// False for files it does not hold, stb_image reads those from disk
+static bool archivedFile(const std::string& path, AssetArchive::View& bytes, std::vector<char>& copy) {
+    const AssetArchive& archive = AssetArchive::mounted();
+    bytes = archive.view(path);
+    if (bytes.empty() && archive.read(path, copy)) {
+        bytes.data = reinterpret_cast<const uint8_t*>(copy.data());
+        bytes.size = copy.size();
+    }
+    return !bytes.empty() && bytes.size <= INT_MAX;
+}
+
+// Decode the file and write its levels where the offsets say. stb_image only decodes into memory it allocates, so
+// level 0 is copied out once and every finer level is filtered in local memory, staging memory is often write
+// combined and slow to read back
+static bool decodeInto(const TextureImporter::Image& image, uint8_t* destination) {
+    int width, height, channels;
+    AssetArchive::View bytes;
+    std::vector<char> copy;
+    stbi_uc* pixels = archivedFile(image.path, bytes, copy) ?
+        stbi_load_from_memory(bytes.data, static_cast<int>(bytes.size), &width, &height, &channels, STBI_rgb_alpha) :
+        stbi_load(image.path.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+    if (!pixels) {
+        return false;
+    }
+    if (static_cast<uint32_t>(width) != image.width || static_cast<uint32_t>(height) != image.height) {
+        stbi_image_free(pixels);
+        return false;
+    }
+    memcpy(destination + image.mipOffsets[0], pixels, static_cast<size_t>(width) * height * 4);
+
+    std::vector<uint8_t> previous;
+    std::vector<uint8_t> next;
+    const uint8_t* source = pixels;
+    for (uint32_t level = 1; level < image.mipOffsets.size(); level++) {
+        uint32_t sourceWidth = std::max(image.width >> (level - 1), 1u);
+        uint32_t sourceHeight = std::max(image.height >> (level - 1), 1u);
+        next.resize(static_cast<size_t>(std::max(image.width >> level, 1u)) * std::max(image.height >> level, 1u) * 4);
+        ImageMipSource::downsample(source, sourceWidth, sourceHeight, next.data());
+        memcpy(destination + image.mipOffsets[level], next.data(), next.size());
+        std::swap(previous, next);
+        source = previous.data();
+    }
+    stbi_image_free(pixels);
+    return true;
+}
+
+TextureImporter::Stats TextureImporter::import(std::vector<Image>& images, bool mips, JobSystem* jobs,
+    const std::function<void*(size_t index, const Image& image)>& destination, const std::function<void(size_t index)>& ready) {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    Stats stats;
+    stats.threads = jobs ? jobs->threadCount() - 1 : 1;
+    stats.images = images.size();
+
+    // Headers are a few bytes into the file, reading them first lets every destination be made before decoding starts
+    std::vector<uint8_t*> targets(images.size(), nullptr);
+    for (size_t i = 0; i < images.size(); i++) {
+        Image& image = images[i];
+        int width, height, channels;
+        AssetArchive::View bytes;
+        std::vector<char> copy;
+        bool archived = archivedFile(image.path, bytes, copy);
+        image.ok = (archived ? stbi_info_from_memory(bytes.data, static_cast<int>(bytes.size), &width, &height, &channels) :
+            stbi_info(image.path.c_str(), &width, &height, &channels)) != 0 && width > 0 && height > 0;
+        if (image.ok) {
+            image.width = static_cast<uint32_t>(width);
+            image.height = static_cast<uint32_t>(height);
+            image.size = layoutChain(image.width, image.height, mips, image.mipOffsets);
+            targets[i] = static_cast<uint8_t*>(destination(i, image));
+            std::error_code ec;
+            stats.fileBytes += archived ? bytes.size : std::filesystem::file_size(image.path, ec);
+        }
+    }
+
+    if (!jobs) {
+        for (size_t i = 0; i < images.size(); i++) {
+            images[i].ok = targets[i] && decodeInto(images[i], targets[i]);
+            ready(i);
+        }
+    }
+    else {
+        // Workers report finished images here, the calling thread hands them on while the rest decode
+        std::mutex mutex;
+        std::condition_variable finishedImage;
+        std::vector<size_t> finished;
+        for (size_t i = 0; i < images.size(); i++) {
+            jobs->submit([&, i]() {
+                bool ok = targets[i] && decodeInto(images[i], targets[i]);
+                std::lock_guard<std::mutex> lock(mutex);
+                images[i].ok = ok;
+                finished.push_back(i);
+                finishedImage.notify_one();
+            });
+        }
+
+        std::vector<size_t> batch;
+        for (size_t handed = 0; handed < images.size();) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                finishedImage.wait(lock, [&]() { return !finished.empty(); });
+                batch.swap(finished);
+            }
+            for (size_t index : batch) {
+                ready(index);
+            }
+            handed += batch.size();
+            batch.clear();
+        }
+    }
+
+    for (const Image& image : images) {
+        stats.decodedBytes += image.ok ? image.size : 0;
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    stats.milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+    return stats;
+}
+
+// Binary PPM, which stb_image reads, so the tests need no encoder
+static bool writePPM(const std::string& path, uint32_t width, uint32_t height, const std::vector<uint8_t>& rgb) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file << "P6\n" << width << " " << height << "\n255\n";
+    file.write(reinterpret_cast<const char*>(rgb.data()), rgb.size());
+    return static_cast<bool>(file);
+}
+
+bool TextureImporter::runSelfTest() {
+    size_t checks = 0;
+    size_t failures = 0;
+    auto check = [&](bool ok, const std::string& what) {
+        checks++;
+        if (!ok) {
+            if (failures < 10) {
+                printf("    FAILED: %s \n", what.c_str());
+            }
+            failures++;
+        }
+    };
+
+    std::vector<size_t> offsets;
+    check(layoutChain(4, 4, false, offsets) == 64 && offsets.size() == 1, "one level without mips");
+    check(layoutChain(5, 3, true, offsets) == 84 && offsets.size() == 3 && offsets[1] == 64 && offsets[2] == 80, "levels start on 16 bytes");
+    check(layoutChain(1, 1, true, offsets) == 4 && offsets.size() == 1, "a single texel has one level");
+
+    std::error_code ec;
+    std::filesystem::path directory = std::filesystem::temp_directory_path(ec) / "texture-import-test";
+    std::filesystem::remove_all(directory, ec);
+    std::filesystem::create_directories(directory, ec);
+
+    // Odd and even sizes, a broken file and a missing one
+    const uint32_t sizes[][2] = { { 64, 64 }, { 37, 21 }, { 1, 1 }, { 256, 8 }, { 100, 100 }, { 3, 250 } };
+    std::vector<std::vector<uint8_t>> rgbs;
+    std::vector<Image> images;
+    for (uint32_t i = 0; i < 6; i++) {
+        std::vector<uint8_t> rgb(static_cast<size_t>(sizes[i][0]) * sizes[i][1] * 3);
+        for (size_t t = 0; t < rgb.size(); t++) {
+            rgb[t] = static_cast<uint8_t>(t * 7 + i * 31);
+        }
+        Image image;
+        image.path = (directory / ("image" + std::to_string(i) + ".ppm")).string();
+        check(writePPM(image.path, sizes[i][0], sizes[i][1], rgb), "test image written");
+        rgbs.push_back(std::move(rgb));
+        images.push_back(image);
+    }
+    // A PNG with a header and no pixel data, its size reads but it does not decode
+    {
+        const uint8_t png[] = {
+            0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n',
+            0, 0, 0, 13, 'I', 'H', 'D', 'R', 0, 0, 0, 16, 0, 0, 0, 16, 8, 2, 0, 0, 0, 0, 0, 0, 0,
+            0, 0, 0, 0, 'I', 'E', 'N', 'D', 0, 0, 0, 0
+        };
+        std::ofstream broken((directory / "broken.png").string(), std::ios::binary | std::ios::trunc);
+        broken.write(reinterpret_cast<const char*>(png), sizeof(png));
+    }
+    images.push_back(Image());
+    images.back().path = (directory / "broken.png").string();
+    images.push_back(Image());
+    images.back().path = (directory / "missing.png").string();
+
+    for (uint32_t workers : { 0u, 1u, 2u, 4u }) {
+        std::unique_ptr<JobSystem> jobs = workers > 0 ? std::make_unique<JobSystem>(workers) : nullptr;
+        std::string label = std::to_string(workers) + " workers: ";
+        std::vector<Image> batch = images;
+        std::vector<std::vector<uint8_t>> memory(batch.size());
+        std::vector<int> readyCount(batch.size(), 0);
+        std::thread::id caller = std::this_thread::get_id();
+        bool onCaller = true;
+        Stats stats = import(batch, true, jobs.get(), [&](size_t index, const Image& image) {
+            onCaller &= std::this_thread::get_id() == caller;
+            memory[index].assign(image.size, 0xCD);
+            return static_cast<void*>(memory[index].data());
+        }, [&](size_t index) {
+            onCaller &= std::this_thread::get_id() == caller;
+            readyCount[index]++;
+        });
+
+        check(onCaller, label + "callbacks run on the calling thread");
+        check(std::all_of(readyCount.begin(), readyCount.end(), [](int count) { return count == 1; }), label + "every image is ready once");
+        check(!batch[6].ok && !batch[7].ok, label + "broken and missing files fail");
+        check(!memory[6].empty() && memory[7].empty(), label + "only a file with a header gets a destination");
+        check(stats.images == batch.size() && stats.threads == std::max(workers, 1u), label + "stats count the images and threads");
+
+        bool pixels = true;
+        bool chains = true;
+        uint64_t decoded = 0;
+        for (uint32_t i = 0; i < 6; i++) {
+            const Image& image = batch[i];
+            check(image.ok && image.width == sizes[i][0] && image.height == sizes[i][1], label + "image decodes at its size");
+            for (size_t t = 0; t < static_cast<size_t>(image.width) * image.height; t++) {
+                const uint8_t* texel = memory[i].data() + image.mipOffsets[0] + t * 4;
+                pixels &= texel[0] == rgbs[i][t * 3] && texel[1] == rgbs[i][t * 3 + 1] && texel[2] == rgbs[i][t * 3 + 2] && texel[3] == 255;
+            }
+            // Each level matches a filter of the level before it as written
+            for (uint32_t level = 1; level < image.mipOffsets.size(); level++) {
+                uint32_t w = std::max(image.width >> level, 1u);
+                uint32_t h = std::max(image.height >> level, 1u);
+                std::vector<uint8_t> expected(static_cast<size_t>(w) * h * 4);
+                ImageMipSource::downsample(memory[i].data() + image.mipOffsets[level - 1], std::max(image.width >> (level - 1), 1u), std::max(image.height >> (level - 1), 1u), expected.data());
+                chains &= memcmp(expected.data(), memory[i].data() + image.mipOffsets[level], expected.size()) == 0;
+            }
+            chains &= std::max(image.width >> (image.mipOffsets.size() - 1), 1u) == 1 && std::max(image.height >> (image.mipOffsets.size() - 1), 1u) == 1;
+            decoded += image.size;
+        }
+        check(pixels, label + "level 0 holds the file's pixels with opaque alpha");
+        check(chains, label + "the mip chains are filtered down to one texel");
+        check(stats.decodedBytes == decoded, label + "decoded bytes count the chains");
+    }
+
+    std::filesystem::remove_all(directory, ec);
+
+    printf("%zu checks, %zu failed \n", checks, failures);
+    return failures == 0;
+}
+
+void TextureImporter::runBenchmark(const char* directory) {
+    std::vector<std::string> files;
+    if (directory) {
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator(directory, ec)) {
+            int width, height, channels;
+            if (entry.is_regular_file() && stbi_info(entry.path().string().c_str(), &width, &height, &channels)) {
+                files.push_back(entry.path().string());
+            }
+        }
+    }
+    else {
+        // The repo's images over and over, a scene's worth of textures
+        for (int i = 0; i < 16; i++) {
+            files.push_back("Images/texture.jpg");
+            files.push_back("Images/texture2.jpg");
+            files.push_back("VikingRoom/Material.png");
+        }
+    }
+    if (files.empty()) {
+        printf("No images found \n");
+        return;
+    }
+
+    std::vector<Image> images(files.size());
+    for (size_t i = 0; i < files.size(); i++) {
+        images[i].path = files[i];
+    }
+    // One allocation per image as it would be one staging buffer, reused across the runs
+    std::vector<std::vector<uint8_t>> memory(images.size());
+    auto destination = [&](size_t index, const Image& image) {
+        memory[index].resize(image.size);
+        return static_cast<void*>(memory[index].data());
+    };
+
+    // Loaded one by one on this thread and copied into the staging memory, as createTextureImage did
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        uint64_t bytes = 0;
+        for (size_t i = 0; i < files.size(); i++) {
+            int width, height, channels;
+            stbi_uc* pixels = stbi_load(files[i].c_str(), &width, &height, &channels, STBI_rgb_alpha);
+            if (pixels) {
+                size_t size = static_cast<size_t>(width) * height * 4;
+                memory[i].resize(size);
+                memcpy(memory[i].data(), pixels, size);
+                stbi_image_free(pixels);
+                bytes += size;
+            }
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        double ms = std::chrono::duration<double, std::milli>(end - start).count();
+        printf("%zu images, %.1f MB decoded \n", files.size(), bytes / (1024.0 * 1024.0));
+        printf("%8s %12s %14s %14s %10s \n", "threads", "time (ms)", "decoded MB/s", "file MB/s", "speedup");
+        printf("%8s %12.1f %14.1f %14s %10s \n", "serial", ms, bytes / (1024.0 * 1024.0) / (ms / 1000.0), "-", "1.00");
+
+        auto report = [&](const Stats& stats, const char* label) {
+            printf("%8s %12.1f %14.1f %14.1f %10.2f \n", label, stats.milliseconds, stats.decodedBytes / (1024.0 * 1024.0) / (stats.milliseconds / 1000.0),
+                stats.fileBytes / (1024.0 * 1024.0) / (stats.milliseconds / 1000.0), ms / stats.milliseconds);
+        };
+        uint32_t hardware = std::max(std::thread::hardware_concurrency(), 1u);
+        for (uint32_t threads = 1; ; threads = std::min(threads * 2, hardware)) {
+            JobSystem jobs(threads);
+            report(import(images, false, &jobs, destination, [](size_t) {}), std::to_string(threads).c_str());
+            if (threads == hardware) {
+                break;
+            }
+        }
+        // The chains the streamed textures keep, on every thread
+        JobSystem jobs(hardware);
+        printf("With mip chains: \n");
+        report(import(images, true, &jobs, destination, [](size_t) {}), std::to_string(hardware).c_str());
+    }
+}
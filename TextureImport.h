@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+class JobSystem;
+
+// Decodes batches of image files with stb_image on the job system. Every image is written as RGBA8, optionally with its
+// box filtered mip chain, straight into memory the caller hands out per image, which may be mapped staging memory. The
+// caller is told as each image finishes, so uploads of decoded images overlap the decoding of the rest. Images the
+// mounted AssetArchive holds are decoded out of it
+class TextureImporter {
+
+public:
+	struct Image {
+		std::string path;
+		uint32_t width = 0;
+		uint32_t height = 0;
+		// Where each level starts in the destination, level 0 first, and the bytes of the whole chain
+		std::vector<size_t> mipOffsets;
+		size_t size = 0;
+		// False when the header or the pixels could not be decoded, nothing was written then
+		bool ok = false;
+	};
+
+	struct Stats {
+		uint32_t threads = 0;
+		size_t images = 0;
+		uint64_t fileBytes = 0;
+		uint64_t decodedBytes = 0;
+		double milliseconds = 0.0;
+	};
+
+	// Offsets of the levels of an RGBA8 image, each on a 16 byte boundary, and the bytes they span. One level unless mips
+	static size_t layoutChain(uint32_t width, uint32_t height, bool mips, std::vector<size_t>& offsets);
+
+	// Reads every header on the calling thread and asks destination for the memory of each image that has one, also
+	// on the calling thread so it may create buffers. The pixels are then decoded on the workers, or inline without a
+	// job system, and ready runs on the calling thread for every image in the order they finish
+	static Stats import(std::vector<Image>& images, bool mips, JobSystem* jobs,
+		const std::function<void*(size_t index, const Image& image)>& destination, const std::function<void(size_t index)>& ready);
+
+	// Imports generated files on one to four workers and checks the pixels, the chains and the failures
+	static bool runSelfTest();
+	// Decode throughput of the files in directory, or of the repo's images, on every thread count up to the hardware's
+	// against loading them one by one and copying them as createTextureImage did
+	static void runBenchmark(const char* directory);
+};
@@ -0,0 +1,434 @@
+#include "TextureStreaming.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+MIP SOURCES
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+uint32_t MipSource::getTailMip(uint32_t tailSize) const {
+    for (uint32_t level = 0; level < getMipCount(); level++) {
+        if (std::max(getMipWidth(level), getMipHeight(level)) <= tailSize) {
+            return level;
+        }
+    }
+    return getMipCount() - 1;
+}
+
+ImageMipSource::ImageMipSource(const std::string& path) {
+    std::vector<TextureImporter::Image> images(1);
+    images[0].path = path;
+    TextureImporter::import(images, true, nullptr, [&](size_t, const TextureImporter::Image& image) {
+        chain.resize(image.size);
+        return static_cast<void*>(chain.data());
+    }, [](size_t) {});
+    if (!images[0].ok) {
+        throw std::runtime_error("Failed to load the texture image " + path);
+    }
+    width = images[0].width;
+    height = images[0].height;
+    offsets = images[0].mipOffsets;
+}
+
+ImageMipSource::ImageMipSource(const TextureImporter::Image& image, std::vector<uint8_t> chain)
+    : width(image.width), height(image.height), chain(std::move(chain)), offsets(image.mipOffsets) {
+}
+
+bool ImageMipSource::readMip(uint32_t level, void* destination) const {
+    if (level >= offsets.size()) {
+        return false;
+    }
+    memcpy(destination, chain.data() + offsets[level], getMipSize(level));
+    return true;
+}
+
+void ImageMipSource::downsample(const uint8_t* source, uint32_t width, uint32_t height, uint8_t* destination) {
+    uint32_t halfWidth = std::max(width / 2, 1u);
+    uint32_t halfHeight = std::max(height / 2, 1u);
+    for (uint32_t y = 0; y < halfHeight; y++) {
+        const uint8_t* row0 = source + static_cast<size_t>(std::min(2 * y, height - 1)) * width * 4;
+        const uint8_t* row1 = source + static_cast<size_t>(std::min(2 * y + 1, height - 1)) * width * 4;
+        for (uint32_t x = 0; x < halfWidth; x++) {
+            uint32_t x0 = std::min(2 * x, width - 1) * 4;
+            uint32_t x1 = std::min(2 * x + 1, width - 1) * 4;
+            uint8_t* texel = destination + (static_cast<size_t>(y) * halfWidth + x) * 4;
+            for (uint32_t c = 0; c < 4; c++) {
+                texel[c] = static_cast<uint8_t>((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) / 4);
+            }
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+RESIDENCY
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TextureResidency::TextureResidency(VkDeviceSize budget, uint32_t maxLoadsInFlight) : budget(budget), maxLoadsInFlight(std::max(maxLoadsInFlight, 1u)) {
+}
+
+uint32_t TextureResidency::addTexture(const std::vector<VkDeviceSize>& mipSizes, uint32_t tailMip) {
+    Texture texture;
+    texture.mipSizes = mipSizes;
+    texture.tailMip = std::min(tailMip, static_cast<uint32_t>(mipSizes.size()) - 1);
+    texture.residentMip = texture.tailMip;
+    texture.requestedMip = texture.tailMip;
+    for (uint32_t level = texture.tailMip; level < mipSizes.size(); level++) {
+        residentBytes += mipSizes[level];
+    }
+    textures.push_back(std::move(texture));
+    return static_cast<uint32_t>(textures.size()) - 1;
+}
+
+void TextureResidency::request(uint32_t texture, uint32_t mip, uint64_t frame) {
+    Texture& t = textures[texture];
+    mip = std::min(mip, t.tailMip);
+    t.requestedMip = t.lastUsedFrame == frame ? std::min(t.requestedMip, mip) : mip;
+    t.lastUsedFrame = frame;
+}
+
+bool TextureResidency::makeRoom(VkDeviceSize bytes, uint64_t frame, FrameVector<Change>& changes) {
+    while (residentBytes + bytes > budget) {
+        // Levels a texture holds beyond what it wants now, all but the tail once it is out of sight
+        Texture* victim = nullptr;
+        uint32_t victimIndex = 0;
+        for (uint32_t i = 0; i < textures.size(); i++) {
+            Texture& t = textures[i];
+            uint32_t wanted = t.lastUsedFrame == frame ? t.requestedMip : t.tailMip;
+            if (t.loading || t.residentMip >= wanted) {
+                continue;
+            }
+            if (!victim || t.lastUsedFrame < victim->lastUsedFrame || (t.lastUsedFrame == victim->lastUsedFrame && t.mipSizes[t.residentMip] > victim->mipSizes[victim->residentMip])) {
+                victim = &t;
+                victimIndex = i;
+            }
+        }
+        if (!victim) {
+            return false;
+        }
+
+        residentBytes -= victim->mipSizes[victim->residentMip];
+        victim->residentMip++;
+        auto existing = std::find_if(changes.begin(), changes.end(), [&](const Change& change) { return change.texture == victimIndex; });
+        if (existing != changes.end()) {
+            existing->residentMip = victim->residentMip;
+        }
+        else {
+            changes.push_back({ Change::Kind::Evict, victimIndex, victim->residentMip });
+        }
+    }
+    return true;
+}
+
+FrameVector<TextureResidency::Change> TextureResidency::update(uint64_t frame, LinearArena& scratch) {
+    FrameVector<Change> changes{ FrameAllocator<Change>(scratch) };
+    // A lowered budget is met as far as evictions allow
+    makeRoom(0, frame, changes);
+
+    // Textures seen this frame that want finer levels, those furthest from their request first
+    FrameVector<uint32_t> candidates{ FrameAllocator<uint32_t>(scratch) };
+    for (uint32_t i = 0; i < textures.size(); i++) {
+        const Texture& t = textures[i];
+        if (t.lastUsedFrame == frame && !t.loading && t.requestedMip < t.residentMip) {
+            candidates.push_back(i);
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(), [&](uint32_t a, uint32_t b) {
+        uint32_t deficitA = textures[a].residentMip - textures[a].requestedMip;
+        uint32_t deficitB = textures[b].residentMip - textures[b].requestedMip;
+        return deficitA != deficitB ? deficitA > deficitB : a < b;
+    });
+
+    for (uint32_t index : candidates) {
+        if (loadsInFlight >= maxLoadsInFlight) {
+            break;
+        }
+        Texture& t = textures[index];
+        VkDeviceSize bytes = t.mipSizes[t.residentMip - 1];
+        if (!makeRoom(bytes, frame, changes)) {
+            continue;
+        }
+        t.loading = true;
+        residentBytes += bytes;
+        loadsInFlight++;
+        changes.push_back({ Change::Kind::Load, index, t.residentMip - 1 });
+    }
+    return changes;
+}
+
+void TextureResidency::completeLoad(uint32_t texture) {
+    Texture& t = textures[texture];
+    if (!t.loading) {
+        return;
+    }
+    t.loading = false;
+    t.residentMip--;
+    loadsInFlight--;
+}
+
+uint32_t TextureResidency::mipForScreenSize(uint32_t width, uint32_t height, float screenPixels, uint32_t mipCount) {
+    float texels = static_cast<float>(std::max(width, height));
+    if (screenPixels <= 0.0f || mipCount == 0) {
+        return mipCount > 0 ? mipCount - 1 : 0;
+    }
+    float level = std::floor(std::log2(std::max(texels / screenPixels, 1.0f)));
+    return std::min(static_cast<uint32_t>(level), mipCount - 1);
+}
+
+static std::vector<VkDeviceSize> rgbaMipSizes(uint32_t size) {
+    std::vector<VkDeviceSize> sizes;
+    for (uint32_t level = 0; (size >> level) > 0; level++) {
+        VkDeviceSize side = size >> level;
+        sizes.push_back(side * side * 4);
+    }
+    return sizes;
+}
+
+bool TextureResidency::runSelfTest() {
+    size_t checks = 0;
+    size_t failures = 0;
+    auto check = [&](bool ok, const std::string& what) {
+        checks++;
+        if (!ok) {
+            if (failures < 10) {
+                printf("    FAILED: %s \n", what.c_str());
+            }
+            failures++;
+        }
+    };
+    LinearArena scratch;
+
+    check(mipForScreenSize(1024, 1024, 1024.0f, 11) == 0, "one texel per pixel is level 0");
+    check(mipForScreenSize(1024, 1024, 4096.0f, 11) == 0, "magnified textures want level 0");
+    check(mipForScreenSize(1024, 512, 256.0f, 11) == 2, "a quarter of the size is level 2");
+    check(mipForScreenSize(1024, 1024, 0.25f, 11) == 10, "tiny textures clamp to the last level");
+    check(mipForScreenSize(1024, 1024, 0.0f, 11) == 10, "off screen textures want the last level");
+
+    {
+        const uint8_t source[3 * 3 * 4] = {
+            0, 0, 0, 0,  4, 8, 12, 16,  100, 100, 100, 100,
+            8, 16, 24, 32,  12, 24, 36, 48,  100, 100, 100, 100,
+            100, 100, 100, 100,  100, 100, 100, 100,  100, 100, 100, 100
+        };
+        uint8_t half[4] = {};
+        ImageMipSource::downsample(source, 3, 3, half);
+        check(half[0] == 6 && half[1] == 12 && half[2] == 18 && half[3] == 24, "downsampling averages the covered 2x2");
+        std::vector<uint8_t> flat(5 * 1 * 4, 77);
+        uint8_t flatHalf[2 * 4] = {};
+        ImageMipSource::downsample(flat.data(), 5, 1, flatHalf);
+        check(std::all_of(flatHalf, flatHalf + 8, [](uint8_t value) { return value == 77; }), "a flat image stays flat on odd sizes");
+    }
+
+    // A requested level arrives one level per load when the budget is ample
+    {
+        TextureResidency residency(1ull << 30, 1);
+        uint32_t texture = residency.addTexture(rgbaMipSizes(1024), 4);
+        check(residency.getResidentMip(texture) == 4, "textures start with their tail");
+        uint64_t frame = 1;
+        for (; frame < 20 && residency.getResidentMip(texture) > 0; frame++) {
+            residency.request(texture, 0, frame);
+            for (const Change& change : residency.update(frame, scratch)) {
+                check(change.kind == Change::Kind::Load && change.residentMip + 1 == residency.getResidentMip(texture), "loads add the next finer level");
+                residency.completeLoad(change.texture);
+            }
+        }
+        check(residency.getResidentMip(texture) == 0 && frame == 5, "level 0 arrives after a load per level");
+        residency.request(texture, 0, frame);
+        check(residency.update(frame, scratch).empty(), "nothing changes once the request is met");
+    }
+
+    // The texture unused for longest gives up its levels first
+    {
+        std::vector<VkDeviceSize> sizes = rgbaMipSizes(256);
+        VkDeviceSize full = 0;
+        VkDeviceSize tail = 0;
+        for (size_t level = 0; level < sizes.size(); level++) {
+            full += sizes[level];
+            tail += level >= 3 ? sizes[level] : 0;
+        }
+        TextureResidency residency(2 * full + tail, 4);
+        uint32_t a = residency.addTexture(sizes, 3);
+        uint32_t b = residency.addTexture(sizes, 3);
+        uint32_t c = residency.addTexture(sizes, 3);
+        auto stream = [&](uint32_t texture, uint64_t& frame) {
+            for (int i = 0; i < 8; i++, frame++) {
+                residency.request(texture, 0, frame);
+                for (const Change& change : residency.update(frame, scratch)) {
+                    if (change.kind == Change::Kind::Load) {
+                        residency.completeLoad(change.texture);
+                    }
+                }
+            }
+        };
+        uint64_t frame = 1;
+        stream(a, frame);
+        stream(b, frame);
+        check(residency.getResidentMip(a) == 0 && residency.getResidentMip(b) == 0, "two textures fit whole");
+        stream(c, frame);
+        check(residency.getResidentMip(c) == 0, "the third texture streams in");
+        check(residency.getResidentMip(a) == 3 && residency.getResidentMip(b) == 0, "the least recently used texture is evicted");
+        check(residency.getResidentBytes() <= residency.getBudget(), "the budget holds");
+    }
+
+    // Random requests, load completion and budget changes, with the bookkeeping recomputed every frame
+    {
+        std::mt19937 random(47);
+        TextureResidency residency(64ull * 1024 * 1024, 4);
+        std::vector<uint32_t> tails;
+        std::vector<std::vector<VkDeviceSize>> sizes;
+        for (int i = 0; i < 200; i++) {
+            sizes.push_back(rgbaMipSizes(64u << (random() % 7)));
+            tails.push_back(std::min(static_cast<uint32_t>(sizes.back().size()) - 1, 3u + static_cast<uint32_t>(random() % 3)));
+            residency.addTexture(sizes.back(), tails.back());
+        }
+        std::vector<std::pair<uint32_t, uint64_t>> pending;
+        bool budgetHeld = true;
+        bool loadsWithinBudget = true;
+        bool tailsKept = true;
+        bool bytesMatch = true;
+        bool loadsBounded = true;
+        for (uint64_t frame = 1; frame <= 3000; frame++) {
+            scratch.reset();
+            if (frame % 1000 == 0) {
+                residency.setBudget(residency.getBudget() / 2);
+            }
+            uint32_t visible = 10 + random() % 40;
+            for (uint32_t i = 0; i < visible; i++) {
+                uint32_t texture = random() % 200;
+                residency.request(texture, random() % static_cast<uint32_t>(sizes[texture].size()), frame);
+            }
+            bool loaded = false;
+            for (const Change& change : residency.update(frame, scratch)) {
+                if (change.kind == Change::Kind::Load) {
+                    pending.push_back({ change.texture, frame + random() % 4 });
+                    loaded = true;
+                }
+            }
+            for (size_t i = 0; i < pending.size();) {
+                if (pending[i].second <= frame) {
+                    residency.completeLoad(pending[i].first);
+                    pending[i] = pending.back();
+                    pending.pop_back();
+                }
+                else {
+                    i++;
+                }
+            }
+
+            VkDeviceSize bytes = 0;
+            for (uint32_t texture = 0; texture < 200; texture++) {
+                uint32_t resident = residency.getResidentMip(texture);
+                tailsKept &= resident <= tails[texture];
+                for (uint32_t level = resident; level < sizes[texture].size(); level++) {
+                    bytes += sizes[texture][level];
+                }
+                if (residency.isLoading(texture)) {
+                    bytes += sizes[texture][resident - 1];
+                }
+            }
+            bytesMatch &= bytes == residency.getResidentBytes();
+            // Levels on screen are only dropped once they leave it, so a lowered budget may take a while to be met,
+            // but no load ever starts over it
+            if (frame < 1000) {
+                budgetHeld &= bytes <= residency.getBudget();
+            }
+            loadsWithinBudget &= !loaded || bytes <= residency.getBudget();
+            loadsBounded &= pending.size() <= 4;
+        }
+        check(budgetHeld, "random: the budget holds every frame");
+        check(loadsWithinBudget, "random: loads never exceed a lowered budget");
+        check(tailsKept, "random: tails stay resident");
+        check(bytesMatch, "random: resident bytes match the levels held");
+        check(loadsBounded, "random: loads in flight stay bounded");
+    }
+
+    printf("%zu checks, %zu failed \n", checks, failures);
+    return failures == 0;
+}
+
+void TextureResidency::runBenchmark() {
+    const VkDeviceSize budget = 256ull * 1024 * 1024;
+    const uint32_t textureSize = 1024;
+    const uint32_t tailMip = 5;
+    const float fieldSize = 1000.0f;
+    const int frames = 2000;
+    // Vertical resolution and field of view of the simulated camera
+    const float screenHeight = 1080.0f;
+    const float tanHalfFov = std::tan(0.5f * 1.0472f);
+
+    std::vector<VkDeviceSize> sizes = rgbaMipSizes(textureSize);
+    VkDeviceSize full = 0;
+    VkDeviceSize tail = 0;
+    for (size_t level = 0; level < sizes.size(); level++) {
+        full += sizes[level];
+        tail += level >= tailMip ? sizes[level] : 0;
+    }
+    printf("%u texel textures, %.0f MB budget, %d frames of a camera flying over the scene \n", textureSize, budget / (1024.0 * 1024.0), frames);
+    printf("%8s %14s %14s %14s %12s %12s %10s \n", "textures", "whole (MB)", "first (MB)", "peak (MB)", "loads", "evictions", "ms/frame");
+
+    for (uint32_t count : { 1000u, 4000u, 16000u }) {
+        std::mt19937 random(48);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        // Each texture covers one object of a few units
+        std::vector<float> x(count), z(count), extent(count);
+        TextureResidency residency(budget, 8);
+        for (uint32_t i = 0; i < count; i++) {
+            x[i] = (unit(random) - 0.5f) * fieldSize;
+            z[i] = (unit(random) - 0.5f) * fieldSize;
+            extent[i] = 1.0f + 4.0f * unit(random);
+            residency.addTexture(sizes, tailMip);
+        }
+        VkDeviceSize first = residency.getResidentBytes();
+        VkDeviceSize peak = first;
+        size_t loads = 0;
+        size_t evictions = 0;
+        std::vector<uint32_t> pending;
+        LinearArena scratch;
+
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int frame = 1; frame <= frames; frame++) {
+            scratch.reset();
+            // Loads take a frame
+            for (uint32_t texture : pending) {
+                residency.completeLoad(texture);
+            }
+            pending.clear();
+
+            float cameraX = std::sin(frame * 0.003f) * fieldSize * 0.4f;
+            float cameraZ = -fieldSize * 0.4f + frame * (fieldSize * 0.8f / frames);
+            for (uint32_t i = 0; i < count; i++) {
+                float dx = x[i] - cameraX;
+                float dz = z[i] - cameraZ;
+                float distance = std::sqrt(dx * dx + dz * dz);
+                // Only what lies ahead within 300 units is drawn
+                if (dz < 0.0f || distance > 300.0f) {
+                    continue;
+                }
+                float pixels = extent[i] * screenHeight / (2.0f * tanHalfFov * std::max(distance, 0.1f));
+                residency.request(i, mipForScreenSize(textureSize, textureSize, pixels, static_cast<uint32_t>(sizes.size())), frame);
+            }
+            for (const Change& change : residency.update(frame, scratch)) {
+                if (change.kind == Change::Kind::Load) {
+                    pending.push_back(change.texture);
+                    loads++;
+                }
+                else {
+                    evictions++;
+                }
+            }
+            peak = std::max(peak, residency.getResidentBytes());
+        }
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / frames;
+
+        printf("%8u %14.1f %14.1f %14.1f %12zu %12zu %10.3f \n", count, count * full / (1024.0 * 1024.0), first / (1024.0 * 1024.0), peak / (1024.0 * 1024.0), loads, evictions, ms);
+    }
+    printf("(tails of %u texels per texture are always resident) \n", textureSize >> tailMip);
+}
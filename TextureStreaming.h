@@ -0,0 +1,123 @@
+#pragma once
+
+#include <volk.h>
+#include "TextureImport.h"
+#include "FrameAllocator.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Where a streamed texture's mip levels come from. Level 0 is the finest, every level is tightly packed rows of texels
+// in getFormat(). Reads may run on any thread
+class MipSource {
+
+public:
+	virtual ~MipSource() = default;
+
+	virtual VkFormat getFormat() const = 0;
+	virtual uint32_t getWidth() const = 0;
+	virtual uint32_t getHeight() const = 0;
+	virtual uint32_t getMipCount() const = 0;
+	virtual size_t getMipSize(uint32_t level) const = 0;
+	// Write level's getMipSize(level) bytes to destination, which may be mapped staging memory. False on a read error
+	virtual bool readMip(uint32_t level, void* destination) const = 0;
+
+	uint32_t getMipWidth(uint32_t level) const { return std::max(getWidth() >> level, 1u); }
+	uint32_t getMipHeight(uint32_t level) const { return std::max(getHeight() >> level, 1u); }
+	// Coarsest levels whose larger side is at most tailSize texels, they are always resident
+	uint32_t getTailMip(uint32_t tailSize) const;
+};
+
+// An RGBA8 sRGB image file decoded whole, with its mip chain box filtered from level 0. Decoding is the slow part of
+// loading it, a cooked source of the same levels skips it
+class ImageMipSource : public MipSource {
+
+public:
+	// Throws when the file cannot be decoded
+	explicit ImageMipSource(const std::string& path);
+	// Takes a chain TextureImporter decoded with mips, laid out as image says
+	ImageMipSource(const TextureImporter::Image& image, std::vector<uint8_t> chain);
+
+	VkFormat getFormat() const override { return VK_FORMAT_R8G8B8A8_SRGB; }
+	uint32_t getWidth() const override { return width; }
+	uint32_t getHeight() const override { return height; }
+	uint32_t getMipCount() const override { return static_cast<uint32_t>(offsets.size()); }
+	size_t getMipSize(uint32_t level) const override { return static_cast<size_t>(getMipWidth(level)) * getMipHeight(level) * 4; }
+	bool readMip(uint32_t level, void* destination) const override;
+
+	// Half the size of an RGBA8 level, each texel the average of the 2x2 it covers, edge texels repeated on odd sides
+	static void downsample(const uint8_t* source, uint32_t width, uint32_t height, uint8_t* destination);
+
+private:
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<uint8_t> chain;
+	std::vector<size_t> offsets;
+};
+
+// Decides which mip levels of every streamed texture are resident under a memory budget. A texture always keeps its
+// tail, the coarsest levels, and grows one finer level at a time towards what its on-screen size asks for. When a load
+// would not fit, textures unused for longest give up their finest levels first. Loads run asynchronously, their memory
+// is counted from the moment they start
+class TextureResidency {
+
+public:
+	struct Change {
+		enum class Kind { Load, Evict };
+		Kind kind;
+		uint32_t texture;
+		// Finest resident level the texture moves to, a load reaches it once completeLoad is called
+		uint32_t residentMip;
+	};
+
+	explicit TextureResidency(VkDeviceSize budget = 256ull * 1024 * 1024, uint32_t maxLoadsInFlight = 4);
+
+	// Bytes of every level, finest first. The texture starts with the levels from tailMip on resident
+	uint32_t addTexture(const std::vector<VkDeviceSize>& mipSizes, uint32_t tailMip);
+	// The texture is seen this frame and wants level mip, the finest of a frame's requests counts
+	void request(uint32_t texture, uint32_t mip, uint64_t frame);
+	// Evictions and loads to start this frame, allocated from scratch. Evictions take effect at once, loads when
+	// completeLoad is called
+	FrameVector<Change> update(uint64_t frame, LinearArena& scratch);
+	void completeLoad(uint32_t texture);
+
+	void setBudget(VkDeviceSize bytes) { budget = bytes; }
+	VkDeviceSize getBudget() const { return budget; }
+	// Resident levels plus the levels being loaded
+	VkDeviceSize getResidentBytes() const { return residentBytes; }
+	uint32_t getResidentMip(uint32_t texture) const { return textures[texture].residentMip; }
+	bool isLoading(uint32_t texture) const { return textures[texture].loading; }
+	uint32_t getTextureCount() const { return static_cast<uint32_t>(textures.size()); }
+
+	// Level whose texels are closest to one per pixel for a texture spanning screenPixels pixels
+	static uint32_t mipForScreenSize(uint32_t width, uint32_t height, float screenPixels, uint32_t mipCount);
+
+	// Drives random requests through the manager and checks the budget, the tails, the order of evictions and that
+	// requested levels arrive. Returns false if any check failed
+	static bool runSelfTest();
+	// Flies a camera over scenes of growing texture counts and reports the resident memory and the upload of the first
+	// frame against loading every texture whole
+	static void runBenchmark();
+
+private:
+	struct Texture {
+		std::vector<VkDeviceSize> mipSizes;
+		uint32_t tailMip = 0;
+		uint32_t residentMip = 0;
+		uint32_t requestedMip = 0;
+		uint64_t lastUsedFrame = 0;
+		bool loading = false;
+	};
+
+	// Drop the finest levels textures hold beyond what they want, least recently used first, until bytes more fit the
+	// budget. False when nothing is left to drop
+	bool makeRoom(VkDeviceSize bytes, uint64_t frame, FrameVector<Change>& changes);
+
+	std::vector<Texture> textures;
+	VkDeviceSize budget;
+	uint32_t maxLoadsInFlight;
+	uint32_t loadsInFlight = 0;
+	VkDeviceSize residentBytes = 0;
+};
@@ -0,0 +1,275 @@
+#include "VertexLayout.h"
+#include "VulkanRenderer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <string>
+#include "glm-0.9.6.3/gtc/matrix_transform.hpp"
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+QUANTIZATION HELPERS
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+glm::mat4 QuantizationTransform::toMatrix() const {
+    glm::mat4 matrix{ 1.0f };
+    matrix[0][0] = scale.x;
+    matrix[1][1] = scale.y;
+    matrix[2][2] = scale.z;
+    matrix[3] = glm::vec4(offset, 1.0f);
+    return matrix;
+}
+
+static float signNotZero(float v) {
+    return v >= 0.0f ? 1.0f : -1.0f;
+}
+
+glm::vec2 VertexQuantization::octEncode(glm::vec3 n) {
+    // Project onto the octahedron, then fold the lower hemisphere over the diagonals
+    n /= (std::abs(n.x) + std::abs(n.y) + std::abs(n.z));
+    glm::vec2 e{ n.x, n.y };
+    if (n.z < 0.0f) {
+        e = glm::vec2((1.0f - std::abs(e.y)) * signNotZero(e.x), (1.0f - std::abs(e.x)) * signNotZero(e.y));
+    }
+    return e;
+}
+
+glm::vec3 VertexQuantization::octDecode(glm::vec2 e) {
+    glm::vec3 n{ e.x, e.y, 1.0f - std::abs(e.x) - std::abs(e.y) };
+    if (n.z < 0.0f) {
+        n.x = (1.0f - std::abs(e.y)) * signNotZero(e.x);
+        n.y = (1.0f - std::abs(e.x)) * signNotZero(e.y);
+    }
+    return glm::normalize(n);
+}
+
+QuantizationTransform VertexQuantization::fitPositions(const std::vector<glm::vec3>& positions) {
+    QuantizationTransform transform;
+    if (positions.empty()) {
+        return transform;
+    }
+
+    glm::vec3 minimum = positions[0];
+    glm::vec3 maximum = positions[0];
+    for (const glm::vec3& p : positions) {
+        minimum = glm::min(minimum, p);
+        maximum = glm::max(maximum, p);
+    }
+
+    transform.offset = (minimum + maximum) * 0.5f;
+    transform.scale = (maximum - minimum) * 0.5f;
+
+    // A flat axis would divide by zero, any scale decodes it exactly
+    for (int i = 0; i < 3; i++) {
+        if (transform.scale[i] <= 0.0f) {
+            transform.scale[i] = 1.0f;
+        }
+    }
+
+    return transform;
+}
+
+static int16_t toSnorm16(float v) {
+    return static_cast<int16_t>(std::round(std::clamp(v, -1.0f, 1.0f) * 32767.0f));
+}
+
+PackedPosition VertexQuantization::packPosition(const glm::vec3& position, const QuantizationTransform& transform) {
+    glm::vec3 normalized = (position - transform.offset) / transform.scale;
+
+    PackedPosition packed;
+    packed.x = toSnorm16(normalized.x);
+    packed.y = toSnorm16(normalized.y);
+    packed.z = toSnorm16(normalized.z);
+    packed.w = 0;
+    return packed;
+}
+
+PackedAttributes VertexQuantization::packAttributes(const glm::vec2& texCoord, const glm::vec3& normal) {
+    uint32_t halfTexCoord = glm::packHalf2x16(texCoord);
+
+    // Meshes without normals leave them zeroed, which has no direction to encode
+    glm::vec2 octNormal{ 0.0f };
+    if (glm::dot(normal, normal) > 0.0f) {
+        octNormal = octEncode(glm::normalize(normal));
+    }
+
+    PackedAttributes packed;
+    packed.u = static_cast<uint16_t>(halfTexCoord & 0xFFFF);
+    packed.v = static_cast<uint16_t>(halfTexCoord >> 16);
+    packed.normalX = toSnorm16(octNormal.x);
+    packed.normalY = toSnorm16(octNormal.y);
+    return packed;
+}
+
+glm::mat4 VertexQuantization::normalMatrix(const glm::mat4& modelView) {
+    return glm::mat4(glm::transpose(glm::inverse(glm::mat3(modelView))));
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+LAYOUT DESCRIPTIONS
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static VkVertexInputAttributeDescription makeAttribute(uint32_t location, uint32_t binding, VkFormat format, uint32_t offset) {
+    VkVertexInputAttributeDescription attribute{};
+    attribute.location = location;
+    attribute.binding = binding;
+    attribute.format = format;
+    attribute.offset = offset;
+    return attribute;
+}
+
+VertexLayout VertexLayout::create(VertexLayoutType type) {
+    VertexLayout layout;
+    layout.type = type;
+
+    // Shader locations are the same for every layout: 0 position, 1 texture coordinate, 2 normal
+    if (type == VertexLayoutType::Interleaved) {
+        layout.bindings.push_back(VulkanRenderer::Vertex::getBindingDescription());
+        auto attributes = VulkanRenderer::Vertex::getAttributeDescriptions();
+        layout.attributes.assign(attributes.begin(), attributes.end());
+
+        layout.positionOnlyBinding = layout.bindings[0];
+        layout.positionOnlyAttribute = layout.attributes[0];
+
+        layout.positionFormat = VK_FORMAT_R32G32B32_SFLOAT;
+        layout.positionStride = sizeof(VulkanRenderer::Vertex);
+        layout.bytesPerVertex = sizeof(VulkanRenderer::Vertex);
+        layout.positionBytesPerVertex = sizeof(VulkanRenderer::Vertex);
+    }
+    else {
+        VkVertexInputBindingDescription positionBinding{};
+        positionBinding.binding = 0;
+        positionBinding.stride = sizeof(PackedPosition);
+        positionBinding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+        VkVertexInputBindingDescription attributeBinding{};
+        attributeBinding.binding = 1;
+        attributeBinding.stride = sizeof(PackedAttributes);
+        attributeBinding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+        layout.bindings = { positionBinding, attributeBinding };
+        layout.attributes = {
+            makeAttribute(0, 0, VK_FORMAT_R16G16B16A16_SNORM, offsetof(PackedPosition, x)),
+            makeAttribute(1, 1, VK_FORMAT_R16G16_SFLOAT, offsetof(PackedAttributes, u)),
+            makeAttribute(2, 1, VK_FORMAT_R16G16_SNORM, offsetof(PackedAttributes, normalX))
+        };
+
+        layout.positionOnlyBinding = positionBinding;
+        layout.positionOnlyAttribute = layout.attributes[0];
+
+        // R16G16B16A16_SNORM is one of the formats every implementation must accept as acceleration structure input
+        layout.positionFormat = VK_FORMAT_R16G16B16A16_SNORM;
+        layout.positionStride = sizeof(PackedPosition);
+        layout.bytesPerVertex = sizeof(PackedPosition) + sizeof(PackedAttributes);
+        layout.positionBytesPerVertex = sizeof(PackedPosition);
+    }
+
+    return layout;
+}
+
+VkPipelineVertexInputStateCreateInfo VertexLayout::inputState() const {
+    VkPipelineVertexInputStateCreateInfo vertexInputCInfo{};
+    vertexInputCInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    vertexInputCInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(bindings.size());
+    vertexInputCInfo.pVertexBindingDescriptions = bindings.data();
+    vertexInputCInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributes.size());
+    vertexInputCInfo.pVertexAttributeDescriptions = attributes.data();
+    return vertexInputCInfo;
+}
+
+VkPipelineVertexInputStateCreateInfo VertexLayout::positionOnlyInputState() const {
+    VkPipelineVertexInputStateCreateInfo vertexInputCInfo{};
+    vertexInputCInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    vertexInputCInfo.vertexBindingDescriptionCount = 1;
+    vertexInputCInfo.pVertexBindingDescriptions = &positionOnlyBinding;
+    vertexInputCInfo.vertexAttributeDescriptionCount = 1;
+    vertexInputCInfo.pVertexAttributeDescriptions = &positionOnlyAttribute;
+    return vertexInputCInfo;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+TESTS
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// What the R16_SNORM vertex fetch hands the shader
+static float fromSnorm16(int16_t v) {
+    return std::max(v / 32767.0f, -1.0f);
+}
+
+static float angleDegrees(const glm::vec3& a, const glm::vec3& b) {
+    return glm::degrees(std::acos(std::clamp(glm::dot(glm::normalize(a), glm::normalize(b)), -1.0f, 1.0f)));
+}
+
+bool VertexLayout::runSelfTest() {
+    size_t checks = 0;
+    size_t failures = 0;
+    auto check = [&](bool ok, const std::string& what) {
+        checks++;
+        if (!ok) {
+            if (failures < 10) {
+                printf("    FAILED: %s \n", what.c_str());
+            }
+            failures++;
+        }
+    };
+
+    check(glm::length(VertexQuantization::octDecode(VertexQuantization::octEncode(glm::vec3(0.0f, 0.0f, -1.0f))) - glm::vec3(0.0f, 0.0f, -1.0f)) < 1e-5f,
+        "the lower pole survives the fold");
+
+    // A long flat box, so each axis gets a different dequantization scale
+    std::mt19937 random(41);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    std::vector<glm::vec3> positions(512);
+    std::vector<glm::vec3> normals(positions.size());
+    for (size_t i = 0; i < positions.size(); i++) {
+        positions[i] = glm::vec3(unit(random) * 8.0f, unit(random) * 0.5f, unit(random) * 2.0f + 1.0f);
+        glm::vec3 n{ unit(random), unit(random), unit(random) };
+        normals[i] = glm::dot(n, n) > 1e-4f ? glm::normalize(n) : glm::vec3(0.0f, 0.0f, 1.0f);
+    }
+    QuantizationTransform dequantization = VertexQuantization::fitPositions(positions);
+    check(dequantization.scale.x > 4.0f * dequantization.scale.z && dequantization.scale.z > 2.0f * dequantization.scale.y, "the test mesh is not cubic");
+
+    // The same camera as Display::updateUniformBuffer and a rotated, uniformly scaled instance
+    glm::mat4 view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+    glm::mat4 transform = glm::translate(glm::mat4(1.0f), glm::vec3(0.5f, -1.0f, 0.25f));
+    transform = glm::rotate(transform, glm::radians(30.0f), glm::normalize(glm::vec3(1.0f, 2.0f, 0.5f)));
+    transform = glm::scale(transform, glm::vec3(0.75f));
+
+    // The interleaved layout shades with full precision normals, the split one with decoded octahedral normals,
+    // and both go through the same normal matrix
+    glm::mat3 normalMatrix = glm::mat3(VertexQuantization::normalMatrix(view * transform));
+    glm::mat3 scaledNormalMatrix = glm::mat3(VertexQuantization::normalMatrix(view * transform * dequantization.toMatrix()));
+    glm::mat4 splitModelView = view * transform * dequantization.toMatrix();
+    glm::mat4 interleavedModelView = view * transform;
+
+    float normalError = 0.0f;
+    float scaledNormalError = 0.0f;
+    float positionError = 0.0f;
+    for (size_t i = 0; i < positions.size(); i++) {
+        PackedAttributes attributes = VertexQuantization::packAttributes(glm::vec2(0.0f), normals[i]);
+        glm::vec3 decoded = VertexQuantization::octDecode(glm::vec2(fromSnorm16(attributes.normalX), fromSnorm16(attributes.normalY)));
+        glm::vec3 interleaved = normalMatrix * normals[i];
+        normalError = std::max(normalError, angleDegrees(normalMatrix * decoded, interleaved));
+        scaledNormalError = std::max(scaledNormalError, angleDegrees(scaledNormalMatrix * decoded, interleaved));
+
+        PackedPosition packed = VertexQuantization::packPosition(positions[i], dequantization);
+        glm::vec3 quantized{ fromSnorm16(packed.x), fromSnorm16(packed.y), fromSnorm16(packed.z) };
+        glm::vec3 split = glm::vec3(splitModelView * glm::vec4(quantized, 1.0f));
+        positionError = std::max(positionError, glm::length(split - glm::vec3(interleavedModelView * glm::vec4(positions[i], 1.0f))));
+    }
+
+    printf("Split against interleaved: normals within %.4f degrees, %.1f with the dequantization scale, positions within %.6f \n",
+        normalError, scaledNormalError, positionError);
+    check(normalError < 0.1f, "split layout normals shade like the interleaved ones");
+    check(scaledNormalError > 1.0f, "the dequantization scale would skew the normals, so the comparison can see it");
+    check(positionError < 1e-3f, "split layout positions land where the interleaved ones do");
+
+    printf("%zu checks, %zu failed \n", checks, failures);
+    return failures == 0;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <volk.h>
+#include <cstdint>
+#include <vector>
+#include "glm-0.9.6.3/glm.hpp"
+
+// How vertex data is laid out in GPU memory
+enum class VertexLayoutType {
+	// One 32 byte stream of full precision floats, the original VulkanRenderer::Vertex
+	Interleaved,
+	// A tightly packed 8 byte position stream plus an 8 byte stream of quantized attributes
+	SplitQuantized
+};
+
+// 16-bit normalized position, w is padding so each position stays 8 byte aligned
+struct PackedPosition {
+	int16_t x, y, z, w;
+};
+
+// Half-float texture coordinates and an octahedral encoded normal in two 16-bit normalized values
+struct PackedAttributes {
+	uint16_t u, v;
+	int16_t normalX, normalY;
+};
+
+// Maps the [-1, 1] quantized positions of a mesh back to model space
+struct QuantizationTransform {
+	glm::vec3 offset{ 0.0f };
+	glm::vec3 scale{ 1.0f };
+
+	glm::mat4 toMatrix() const;
+};
+
+namespace VertexQuantization {
+	// Octahedral mapping of a unit vector onto [-1, 1]^2
+	glm::vec2 octEncode(glm::vec3 n);
+	glm::vec3 octDecode(glm::vec2 e);
+
+	// Fit the transform to the bounds of the positions so the full 16-bit range is used on every axis
+	QuantizationTransform fitPositions(const std::vector<glm::vec3>& positions);
+	PackedPosition packPosition(const glm::vec3& position, const QuantizationTransform& transform);
+	PackedAttributes packAttributes(const glm::vec2& texCoord, const glm::vec3& normal);
+
+	// Inverse transpose of the model view matrix, which must not include QuantizationTransform::toMatrix
+	glm::mat4 normalMatrix(const glm::mat4& modelView);
+}
+
+// Vertex input and acceleration structure descriptions generated for one layout
+struct VertexLayout {
+	VertexLayoutType type = VertexLayoutType::Interleaved;
+
+	std::vector<VkVertexInputBindingDescription> bindings;
+	std::vector<VkVertexInputAttributeDescription> attributes;
+
+	// Binding and attribute for the positions alone, a stream of its own when the layout is split
+	VkVertexInputBindingDescription positionOnlyBinding{};
+	VkVertexInputAttributeDescription positionOnlyAttribute{};
+
+	// What the acceleration structure build reads from the position stream
+	VkFormat positionFormat = VK_FORMAT_R32G32B32_SFLOAT;
+	VkDeviceSize positionStride = 0;
+
+	// Bytes per vertex fetched by a full shading pass and by a depth only pass
+	VkDeviceSize bytesPerVertex = 0;
+	VkDeviceSize positionBytesPerVertex = 0;
+
+	static VertexLayout create(VertexLayoutType type);
+
+	VkPipelineVertexInputStateCreateInfo inputState() const;
+	// Only the position attribute, for depth and shadow passes
+	VkPipelineVertexInputStateCreateInfo positionOnlyInputState() const;
+
+	// Value for the octahedral normal specialization constant of the vertex shader
+	VkBool32 octahedralNormals() const { return type == VertexLayoutType::SplitQuantized; }
+
+	// Shades a non-cubic mesh through both layouts and compares the normals and positions
+	static bool runSelfTest();
+};
@@ -1,4 +1,10 @@
 #include "VulkanRenderer.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "SIMDMath.h"
+#include "JobSystem.h"
+#include "TextureImport.h"
+#include "AssetArchive.h"
 #include <volk.h>
 #include "SDL.h"
 #include "SDL_vulkan.h"
@@ -10,9 +16,14 @@
 #include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <array>
 #include <glm.hpp>
 #include <unordered_map>
+#include <map>
+#include <tuple>
+#include <chrono>
+#include <limits>
 
 #define TINYOBJLOADER_IMPLEMENTATION
 #include <tiny_obj_loader.h>
@@ -330,7 +341,7 @@ void VulkanRenderer::createSWChain(SDL_Window* window) {
     swapchainCreateInfo.imageExtent = extent;
     // Unless developing a stereoscopic 3D image, this is always 1
     swapchainCreateInfo.imageArrayLayers = 1;
-    swapchainCreateInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    swapchainCreateInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
 
     // Specify how images from swap chain are handled
     // If graphics queue family is different from the present queue family, draw on the images in swap chain from graphics and submit them on present
@@ -449,6 +460,17 @@ void VulkanRenderer::createLogicalDevice() {
     VkPhysicalDeviceFeatures gpuFeatures{};
     gpuFeatures.samplerAnisotropy = VK_TRUE;
 
+    // Without multi draw indirect every instance is issued as its own indirect draw
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(GPU, &supportedFeatures);
+    multiDrawIndirectSupported = supportedFeatures.multiDrawIndirect == VK_TRUE;
+    gpuFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+    // Fragment counts of the scene pass choose whether the depth pre-pass pays off
+    pipelineStatisticsSupported = supportedFeatures.pipelineStatisticsQuery == VK_TRUE;
+    gpuFeatures.pipelineStatisticsQuery = supportedFeatures.pipelineStatisticsQuery;
+    textureCompressionBCSupported = supportedFeatures.textureCompressionBC == VK_TRUE;
+    gpuFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+
     VkPhysicalDeviceAccelerationStructureFeaturesKHR accelFeature{};
     accelFeature.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR;
     accelFeature.accelerationStructure = VK_TRUE;
@@ -463,10 +485,45 @@ void VulkanRenderer::createLogicalDevice() {
     BDAfeature.bufferDeviceAddress = VK_TRUE;
     BDAfeature.pNext = &rtPipelineFeature;
 
+    // Ray traced shadows trace from compute with ray queries, without them the cascades stay on
+    std::vector<const char*> enabledExts = deviceExts;
+    uint32_t extensionCount = 0;
+    vkEnumerateDeviceExtensionProperties(GPU, nullptr, &extensionCount, nullptr);
+    std::vector<VkExtensionProperties> availableExts(extensionCount);
+    vkEnumerateDeviceExtensionProperties(GPU, nullptr, &extensionCount, availableExts.data());
+    VkPhysicalDeviceRayQueryFeaturesKHR supportedRayQuery{};
+    supportedRayQuery.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_QUERY_FEATURES_KHR;
+    for (const VkExtensionProperties& extension : availableExts) {
+        if (strcmp(extension.extensionName, VK_KHR_RAY_QUERY_EXTENSION_NAME) == 0) {
+            VkPhysicalDeviceFeatures2 features2{};
+            features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+            features2.pNext = &supportedRayQuery;
+            vkGetPhysicalDeviceFeatures2(GPU, &features2);
+        }
+    }
+    rayQuerySupported = supportedRayQuery.rayQuery == VK_TRUE;
+    if (rayTracedShadowsEnabled && !rayQuerySupported) {
+        printf("Ray traced shadows need VK_KHR_ray_query, using shadow maps \n");
+        rayTracedShadowsEnabled = false;
+    }
+
+    VkPhysicalDeviceRayQueryFeaturesKHR rayQueryFeature{};
+    rayQueryFeature.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_QUERY_FEATURES_KHR;
+    rayQueryFeature.rayQuery = VK_TRUE;
+    rayQueryFeature.pNext = &BDAfeature;
+
     VkPhysicalDeviceHostQueryResetFeaturesEXT resetHQfeature{};
     resetHQfeature.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_HOST_QUERY_RESET_FEATURES_EXT;
     resetHQfeature.hostQueryReset = VK_TRUE;
     resetHQfeature.pNext = &BDAfeature;
+    if (rayTracedShadowsEnabled) {
+        // The rays start from the depth of the pre-pass and replace the cascades
+        enabledExts.push_back(VK_KHR_RAY_QUERY_EXTENSION_NAME);
+        resetHQfeature.pNext = &rayQueryFeature;
+        shadowsEnabled = false;
+        depthPrepassAuto = false;
+        depthPrepassEnabled = true;
+    }
 
     // Create the logical device, filling in with the create info structs
     VkDeviceCreateInfo deviceCInfo{};
@@ -478,8 +535,8 @@ void VulkanRenderer::createLogicalDevice() {
     deviceCInfo.pEnabledFeatures = &gpuFeatures;
 
     // Set enabledLayerCount and ppEnabledLayerNames fields to be compatible with older implementations of Vulkan
-    deviceCInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExts.size());
-    deviceCInfo.ppEnabledExtensionNames = deviceExts.data();
+    deviceCInfo.enabledExtensionCount = static_cast<uint32_t>(enabledExts.size());
+    deviceCInfo.ppEnabledExtensionNames = enabledExts.data();
 
     // If validation layers are enabled, then fill create info struct with size and name information
     if (enableValLayers) {
@@ -515,87 +572,598 @@ void VulkanRenderer::createImageViews() {
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /*
-CREATING THE RENDER PASS
+CREATING THE FRAME GRAPH
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void VulkanRenderer::createFrameGraph() {
+    // Scaling needs a filtered blit into the swap chain image, HDR when the device can blit from it and the swap chain
+    // format otherwise. Without any blit the scene is drawn in the swap chain format and copied over at full size
+    VkFormatProperties swapChainProperties;
+    vkGetPhysicalDeviceFormatProperties(GPU, SWChainImageFormat, &swapChainProperties);
+    auto canBlitFrom = [&](VkFormat format) {
+        VkFormatProperties properties;
+        vkGetPhysicalDeviceFormatProperties(GPU, format, &properties);
+        VkFormatFeatureFlags srcFeatures = VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT | VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+        return (properties.optimalTilingFeatures & srcFeatures) == srcFeatures && (swapChainProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_DST_BIT);
+    };
+    VkFormat sceneColorFormat = VK_FORMAT_R16G16B16A16_SFLOAT;
+    renderTargetBlit = canBlitFrom(sceneColorFormat);
+    if (!renderTargetBlit) {
+        sceneColorFormat = SWChainImageFormat;
+        renderTargetBlit = canBlitFrom(sceneColorFormat);
+    }
+    if (!renderTargetBlit) {
+        dynamicResolution.setScale(1.0f);
+    }
+    renderExtent = { dynamicResolution.scaledSize(SWChainExtent.width), dynamicResolution.scaledSize(SWChainExtent.height) };
+
+    // The targets are allocated at the swap chain size, a lower render scale only draws the top left of them
+    sceneColor = frameGraph.createImage("SceneColor", { SWChainExtent.width, SWChainExtent.height, sceneColorFormat });
+    // The ray traced passes sample the depth, which needs a format without stencil
+    sceneDepth = frameGraph.createImage("SceneDepth", { SWChainExtent.width, SWChainExtent.height, rayTracedShadowsEnabled ? VK_FORMAT_D32_SFLOAT : findDepthFormat() });
+    // The submit waits for the image to be acquired at the transfer stage, so the scene can be drawn before then
+    RenderGraph::ExternalState acquired{ VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_TRANSFER_BIT, 0 };
+    RenderGraph::ExternalState present{ VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0 };
+    swapChainTarget = frameGraph.importImage("SwapChain", { SWChainExtent.width, SWChainExtent.height, SWChainImageFormat }, acquired, present);
+
+    VkClearColorValue clearColor = { {0.0f, 0.0f, 0.0f, 1.0f} };
+    VkClearDepthStencilValue clearDepth = { 1.0f, 0 };
+
+    // The atlas starts each frame as a copy of the static depth and the dynamic casters are drawn over it. The previous
+    // frame's scene pass sampled it, the cache is only ever written outside the frame
+    if (shadowsEnabled) {
+        uint32_t resolution = cascadedShadows.getSettings().resolution;
+        RenderGraph::ImageDesc atlasDesc{ resolution * cascadedShadows.cascadeCount(), resolution, shadowFormat };
+        RenderGraph::ExternalState sampled{ VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0 };
+        RenderGraph::ExternalState sampledAfter{ VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0 };
+        RenderGraph::ExternalState cached{ VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT, 0 };
+        shadowMap = frameGraph.importImage("ShadowMap", atlasDesc, sampled, sampledAfter);
+        shadowCache = frameGraph.importImage("ShadowCache", atlasDesc, cached, cached);
+
+        frameGraph.addPass("ShadowCompose", RenderGraph::PassType::Transfer, [&](RenderGraph::PassBuilder& pass) {
+            pass.read(shadowCache, RenderGraph::Access::TransferRead);
+            pass.write(shadowMap, RenderGraph::Access::TransferWrite);
+        }, [this](VkCommandBuffer commandBuffer, uint32_t image) {
+            const RenderGraph::ImageDesc& desc = frameGraph.getDesc(shadowMap);
+            VkImageCopy copyRegion{};
+            copyRegion.srcSubresource = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 0, 1 };
+            copyRegion.dstSubresource = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 0, 1 };
+            copyRegion.extent = { desc.width, desc.height, 1 };
+            vkCmdCopyImage(commandBuffer, frameGraph.getImage(shadowCache), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, frameGraph.getImage(shadowMap), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+        });
+        shadowPass = frameGraph.addPass("Shadows", RenderGraph::PassType::Graphics, [&](RenderGraph::PassBuilder& pass) {
+            pass.depthAttachment(shadowMap);
+        }, [this](VkCommandBuffer commandBuffer, uint32_t image) {
+            recordShadowDraws(commandBuffer, image, shadowIndirectBuffers[image], (1u << cascadedShadows.cascadeCount()) - 1);
+        });
+    }
+
+    depthPrepassPass = frameGraph.addPass("DepthPrepass", RenderGraph::PassType::Graphics, [&](RenderGraph::PassBuilder& pass) {
+        pass.depthAttachment(sceneDepth, &clearDepth);
+    }, [this](VkCommandBuffer commandBuffer, uint32_t image) {
+        recordDepthPrepass(commandBuffer, image);
+    });
+
+    // Rays from the pre-pass depth into a noisy image, blended with the reprojected history and filtered. The history
+    // is the one image that outlives the frame, the accumulation is copied into it for the next frame to read
+    if (rayTracedShadowsEnabled) {
+        RenderGraph::ImageDesc traceDesc{ rayTracedShadows.traceSize(SWChainExtent.width), rayTracedShadows.traceSize(SWChainExtent.height), VK_FORMAT_R16G16B16A16_SFLOAT };
+        if (rayTracedHistoryImage == VK_NULL_HANDLE) {
+            createImage(traceDesc.width, traceDesc.height, traceDesc.format, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, rayTracedHistoryImage, rayTracedHistoryImageMemory);
+            rayTracedHistoryImageView = createImageView(rayTracedHistoryImage, traceDesc.format, VK_IMAGE_ASPECT_COLOR_BIT);
+            transitionImageLayout(rayTracedHistoryImage, traceDesc.format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+            rayTracedShadows.resetHistory();
+        }
+        RenderGraph::ExternalState historyState{ VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0 };
+        rayTracedHistory = frameGraph.importImage("RayTracedHistory", traceDesc, historyState, historyState);
+        rayTracedNoisy = frameGraph.createImage("RayTracedNoisy", traceDesc);
+        rayTracedAccumulated = frameGraph.createImage("RayTracedAccumulated", traceDesc);
+        rayTracedFiltered[0] = frameGraph.createImage("RayTracedFiltered0", traceDesc);
+        rayTracedFiltered[1] = frameGraph.createImage("RayTracedFiltered1", traceDesc);
+
+        frameGraph.addPass("RayTrace", RenderGraph::PassType::Compute, [&](RenderGraph::PassBuilder& pass) {
+            pass.read(sceneDepth, RenderGraph::Access::ComputeSampled);
+            pass.write(rayTracedNoisy, RenderGraph::Access::ComputeStorage);
+        }, [this](VkCommandBuffer commandBuffer, uint32_t image) {
+            recordRayTracedPass(commandBuffer, image, rayTracePipeline, 0, 0);
+        });
+        frameGraph.addPass("RayAccumulate", RenderGraph::PassType::Compute, [&](RenderGraph::PassBuilder& pass) {
+            pass.read(rayTracedNoisy, RenderGraph::Access::ComputeStorage);
+            pass.read(rayTracedHistory, RenderGraph::Access::ComputeSampled);
+            pass.write(rayTracedAccumulated, RenderGraph::Access::ComputeStorage);
+        }, [this](VkCommandBuffer commandBuffer, uint32_t image) {
+            recordRayTracedPass(commandBuffer, image, rayAccumulatePipeline, 1, 0);
+        });
+        frameGraph.addPass("RayHistory", RenderGraph::PassType::Transfer, [&](RenderGraph::PassBuilder& pass) {
+            pass.read(rayTracedAccumulated, RenderGraph::Access::TransferRead);
+            pass.write(rayTracedHistory, RenderGraph::Access::TransferWrite);
+        }, [this](VkCommandBuffer commandBuffer, uint32_t image) {
+            const RenderGraph::ImageDesc& desc = frameGraph.getDesc(rayTracedHistory);
+            VkImageCopy copyRegion{};
+            copyRegion.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+            copyRegion.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+            copyRegion.extent = { desc.width, desc.height, 1 };
+            vkCmdCopyImage(commandBuffer, frameGraph.getImage(rayTracedAccumulated), VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, frameGraph.getImage(rayTracedHistory), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+        });
+        // Each filter pass reads what the one before wrote, ping ponging between two images
+        rayTracedOutput = rayTracedAccumulated;
+        uint32_t iterations = rayTracedShadows.getSettings().denoiseIterations;
+        for (uint32_t i = 0; i < iterations; i++) {
+            RenderGraph::ResourceId source = rayTracedOutput;
+            RenderGraph::ResourceId target = rayTracedFiltered[i % 2];
+            frameGraph.addPass("RayDenoise" + std::to_string(i), RenderGraph::PassType::Compute, [&](RenderGraph::PassBuilder& pass) {
+                pass.read(source, RenderGraph::Access::ComputeStorage);
+                pass.write(target, RenderGraph::Access::ComputeStorage);
+            }, [this, i](VkCommandBuffer commandBuffer, uint32_t image) {
+                recordRayTracedPass(commandBuffer, image, rayDenoisePipeline, 2 + i, 1 << i);
+            });
+            rayTracedOutput = target;
+        }
+    }
+
+    // Without the pre-pass the scene clears depth itself, nothing is left reading the pre-pass and the graph culls it
+    scenePass = frameGraph.addPass("Scene", RenderGraph::PassType::Graphics, [&](RenderGraph::PassBuilder& pass) {
+        pass.colorAttachment(sceneColor, &clearColor);
+        if (shadowsEnabled) {
+            pass.read(shadowMap, RenderGraph::Access::FragmentSampled);
+        }
+        if (rayTracedShadowsEnabled) {
+            pass.read(rayTracedOutput, RenderGraph::Access::FragmentSampled);
+        }
+        if (depthPrepassEnabled) {
+            pass.depthReadOnly(sceneDepth);
+        }
+        else {
+            pass.depthAttachment(sceneDepth, &clearDepth);
+        }
+    }, [this](VkCommandBuffer commandBuffer, uint32_t image) {
+        recordScenePass(commandBuffer, image);
+    });
+
+    // Scale the drawn part of the scene up to the whole swap chain image
+    frameGraph.addPass("Upscale", RenderGraph::PassType::Transfer, [&](RenderGraph::PassBuilder& pass) {
+        pass.read(sceneColor, RenderGraph::Access::TransferRead);
+        pass.write(swapChainTarget, RenderGraph::Access::TransferWrite);
+    }, [this](VkCommandBuffer commandBuffer, uint32_t image) {
+        VkImageSubresourceLayers colorLayers{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+        VkImage source = frameGraph.getImage(sceneColor);
+        VkImage destination = frameGraph.getImage(swapChainTarget);
+        if (renderTargetBlit) {
+            VkImageBlit blitRegion{};
+            blitRegion.srcSubresource = colorLayers;
+            blitRegion.srcOffsets[1] = { static_cast<int32_t>(renderExtent.width), static_cast<int32_t>(renderExtent.height), 1 };
+            blitRegion.dstSubresource = colorLayers;
+            blitRegion.dstOffsets[1] = { static_cast<int32_t>(SWChainExtent.width), static_cast<int32_t>(SWChainExtent.height), 1 };
+            vkCmdBlitImage(commandBuffer, source, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, destination, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blitRegion, VK_FILTER_LINEAR);
+        }
+        else {
+            VkImageCopy copyRegion{};
+            copyRegion.srcSubresource = colorLayers;
+            copyRegion.dstSubresource = colorLayers;
+            copyRegion.extent = { SWChainExtent.width, SWChainExtent.height, 1 };
+            vkCmdCopyImage(commandBuffer, source, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, destination, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+        }
+    });
+
+    frameGraph.compile(device, GPU);
+    // Pipelines are built against the scene pass, shader reloads compare against it to spot a recreated swap chain
+    renderPass = frameGraph.getRenderPass(scenePass);
+    depthPrepassRenderPass = frameGraph.getRenderPass(depthPrepassPass);
+    if (shadowsEnabled) {
+        frameGraph.setImportedImage(shadowMap, shadowMapImage, shadowMapImageView);
+        frameGraph.setImportedImage(shadowCache, shadowCacheImage, shadowCacheImageView);
+    }
+    if (rayTracedShadowsEnabled) {
+        frameGraph.setImportedImage(rayTracedHistory, rayTracedHistoryImage, rayTracedHistoryImageView);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+SHADOW MAPS
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void VulkanRenderer::createShadowResources() {
+    // Sampled with a depth comparison, filtered when the format allows
+    shadowFormat = findSupportedFormat({ VK_FORMAT_D32_SFLOAT, VK_FORMAT_D16_UNORM }, VK_IMAGE_TILING_OPTIMAL,
+        VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT);
+    VkFormatProperties properties;
+    vkGetPhysicalDeviceFormatProperties(GPU, shadowFormat, &properties);
+    VkFilter filter = (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) ? VK_FILTER_LINEAR : VK_FILTER_NEAREST;
+
+    // Without shadows the atlas is still bound to the scene's descriptors, a texel left in the layout it is read in
+    uint32_t resolution = shadowsEnabled ? cascadedShadows.getSettings().resolution : 1;
+    uint32_t width = shadowsEnabled ? resolution * cascadedShadows.cascadeCount() : 1;
+    createImage(width, resolution, shadowFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, shadowMapImage, shadowMapImageMemory);
+    shadowMapImageView = createImageView(shadowMapImage, shadowFormat, VK_IMAGE_ASPECT_DEPTH_BIT);
+
+    VkSamplerCreateInfo samplerCInfo{};
+    samplerCInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerCInfo.magFilter = filter;
+    samplerCInfo.minFilter = filter;
+    samplerCInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    // Reads past the edge of the atlas count as lit
+    samplerCInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+    samplerCInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+    samplerCInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+    samplerCInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+    samplerCInfo.compareEnable = VK_TRUE;
+    samplerCInfo.compareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+    samplerCInfo.minLod = 0.0f;
+    samplerCInfo.maxLod = 0.0f;
+    if (vkCreateSampler(device, &samplerCInfo, nullptr, &shadowSampler) != VK_SUCCESS) {
+        std::_Xruntime_error("Failed to create the shadow sampler!");
+    }
+
+    if (!shadowsEnabled) {
+        transitionImageLayout(shadowMapImage, shadowFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        return;
+    }
+
+    // The cache rests in the layout the frame copies it from. Every cascade starts stale, so the first frame fills it
+    createImage(width, resolution, shadowFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, shadowCacheImage, shadowCacheImageMemory);
+    shadowCacheImageView = createImageView(shadowCacheImage, shadowFormat, VK_IMAGE_ASPECT_DEPTH_BIT);
+    transitionImageLayout(shadowCacheImage, shadowFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+    cascadedShadows.invalidateStatic();
+
+    // Its render pass is compatible with the frame's shadow pass, one depth attachment of the same format, so the same
+    // pipeline draws into both. The depth outside the stale cascades is kept
+    RenderGraph::ExternalState cached{ VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT, 0 };
+    RenderGraph::ExternalState copied{ VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT };
+    shadowCacheTarget = shadowCacheGraph.importImage("ShadowCache", { width, resolution, shadowFormat }, cached, copied);
+    shadowCachePass = shadowCacheGraph.addPass("StaticShadows", RenderGraph::PassType::Graphics, [&](RenderGraph::PassBuilder& pass) {
+        pass.depthAttachment(shadowCacheTarget);
+    }, [this](VkCommandBuffer commandBuffer, uint32_t image) {
+        uint32_t resolution = cascadedShadows.getSettings().resolution;
+        FrameVector<VkClearRect> clearRects{ FrameAllocator<VkClearRect>(frameArenas.current()) };
+        for (uint32_t i = 0; i < cascadedShadows.cascadeCount(); i++) {
+            if (staticShadowMask & (1u << i)) {
+                clearRects.push_back({ { { static_cast<int32_t>(i * resolution), 0 }, { resolution, resolution } }, 0, 1 });
+            }
+        }
+        VkClearAttachment clear{};
+        clear.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+        clear.clearValue.depthStencil = { 1.0f, 0 };
+        vkCmdClearAttachments(commandBuffer, 1, &clear, static_cast<uint32_t>(clearRects.size()), clearRects.data());
+        recordShadowDraws(commandBuffer, image, staticShadowIndirectBuffer, staticShadowMask);
+    });
+    shadowCacheGraph.compile(device, GPU);
+    shadowCacheGraph.setImportedImage(shadowCacheTarget, shadowCacheImage, shadowCacheImageView);
+}
+
+void VulkanRenderer::destroyShadowResources() {
+    shadowCacheGraph.destroy();
+    vkDestroySampler(device, shadowSampler, nullptr);
+    vkDestroyImageView(device, shadowMapImageView, nullptr);
+    vkDestroyImage(device, shadowMapImage, nullptr);
+    vkFreeMemory(device, shadowMapImageMemory, nullptr);
+    vkDestroyImageView(device, shadowCacheImageView, nullptr);
+    vkDestroyImage(device, shadowCacheImage, nullptr);
+    vkFreeMemory(device, shadowCacheImageMemory, nullptr);
+}
+
+void VulkanRenderer::updateShadows(uint32_t imageIndex, const glm::mat4& view, const glm::mat4& proj, UniformBufferObject& ubo) {
+    ubo.sunDirection = glm::vec4(glm::mat3(view) * sunDirection, shadowsEnabled || rayTracedShadowsEnabled ? sunIntensity : 0.0f);
+    ubo.shadowParams = glm::vec4(0.0f);
+    if (!shadowsEnabled) {
+        return;
+    }
+
+    glm::vec3 sceneMin(std::numeric_limits<float>::max());
+    glm::vec3 sceneMax(-std::numeric_limits<float>::max());
+    for (size_t i = 0; i < instances.size(); i++) {
+        glm::vec3 center(instanceBounds.centerX[i], instanceBounds.centerY[i], instanceBounds.centerZ[i]);
+        glm::vec3 extent(instanceBounds.extentX[i], instanceBounds.extentY[i], instanceBounds.extentZ[i]);
+        sceneMin = glm::min(sceneMin, center - extent);
+        sceneMax = glm::max(sceneMax, center + extent);
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    // A static instance that moved since the last frame has already made every cascade stale
+    staticShadowMask = cascadedShadows.update(view, proj, sunDirection, sceneMin, sceneMax);
+
+    uint32_t cascadeCount = cascadedShadows.cascadeCount();
+    size_t instanceCount = instances.size();
+    VkDrawIndexedIndirectCommand* dynamicCommands = static_cast<VkDrawIndexedIndirectCommand*>(shadowIndirectBuffersMapped[imageIndex]);
+    VkDrawIndexedIndirectCommand* staticCommands = static_cast<VkDrawIndexedIndirectCommand*>(staticShadowIndirectBufferMapped);
+    std::memset(dynamicCommands, 0, sizeof(VkDrawIndexedIndirectCommand) * cascadeCount * instanceCount);
+    if (staticShadowMask) {
+        std::memset(staticCommands, 0, sizeof(VkDrawIndexedIndirectCommand) * cascadeCount * instanceCount);
+    }
+
+    uint32_t dynamicCasters = 0;
+    for (uint32_t c = 0; c < cascadeCount; c++) {
+        const CascadedShadows::Cascade& cascade = cascadedShadows.getCascade(c);
+        ubo.cascadeViewProj[c] = cascade.viewProj;
+        ubo.cascadeSplits[c] = cascade.splitDepth;
+        ubo.cascadeTexelSizes[c] = cascade.texelSize;
+
+        // Static casters are only written for the cascades whose cache is rendered this frame
+        bool stale = (staticShadowMask >> c) & 1;
+        cascadedShadows.cullCasters(c, instanceBounds, jobSystem, frameArenas.current(), shadowCasters);
+        for (uint32_t i : shadowCasters) {
+            const OBJInstance& instance = instances[i];
+            const Model& model = loadedModels[instance.index];
+            if ((!instance.dynamic && !stale) || model.lods.empty()) {
+                continue;
+            }
+
+            // Coarsest LOD whose error stays within a texel of the cascade
+            float scale = std::max(glm::length(glm::vec3(instance.transform[0])),
+                std::max(glm::length(glm::vec3(instance.transform[1])), glm::length(glm::vec3(instance.transform[2]))));
+            size_t lod = model.lods.size() - 1;
+            while (lod > 0 && model.lods[lod].error * scale > cascade.texelSize) {
+                lod--;
+            }
+
+            VkDrawIndexedIndirectCommand& command = (instance.dynamic ? dynamicCommands : staticCommands)[c * instanceCount + i];
+            command.indexCount = model.lods[lod].indexCount;
+            command.instanceCount = 1;
+            command.firstIndex = model.lods[lod].firstIndex;
+            command.vertexOffset = 0;
+            command.firstInstance = i;
+            dynamicCasters += instance.dynamic;
+        }
+    }
+    ubo.shadowParams.x = static_cast<float>(cascadeCount);
+
+    shadowCullMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    shadowDynamicCasters += dynamicCasters;
+    if (++shadowReportFrames == 300) {
+        printf("Shadows: %u static cascade renders so far, %.1f dynamic casters per frame, %.3f ms per frame fitting and culling \n",
+            cascadedShadows.getStaticRenders(), double(shadowDynamicCasters) / shadowReportFrames, shadowCullMs / shadowReportFrames);
+        shadowReportFrames = 0;
+        shadowDynamicCasters = 0;
+        shadowCullMs = 0.0;
+    }
+}
+
+void VulkanRenderer::renderStaticShadows(uint32_t imageIndex) {
+    if (!shadowsEnabled || staticShadowMask == 0) {
+        return;
+    }
+
+    // Drawn with the image's uniforms, which hold the cascades the mask was taken for. Frames still in flight copy the
+    // cache at the transfer stage, the graph's first barrier waits for them
+    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+    shadowCacheGraph.execute(commandBuffer, imageIndex);
+    endSingleTimeCommands(commandBuffer);
+
+    cascadedShadows.markStaticRendered(staticShadowMask);
+    staticShadowMask = 0;
+}
+
+// Viewport and cascade index of each cascade in mask, then its slots of the draw buffer
+void VulkanRenderer::recordShadowDraws(VkCommandBuffer commandBuffer, uint32_t image, VkBuffer drawBuffer, uint32_t mask) {
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadowPipeline);
+    VkBuffer positions = vertexLayoutType == VertexLayoutType::SplitQuantized ? positionBuffer : vertexBuffer;
+    VkDeviceSize offset = 0;
+    vkCmdBindVertexBuffers(commandBuffer, 0, 1, &positions, &offset);
+    vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadowPipelineLayout, 0, 1, &descriptorSets[image], 0, nullptr);
+
+    uint32_t resolution = cascadedShadows.getSettings().resolution;
+    uint32_t drawCount = static_cast<uint32_t>(instances.size());
+    for (uint32_t c = 0; c < cascadedShadows.cascadeCount(); c++) {
+        if (!(mask & (1u << c))) {
+            continue;
+        }
+        VkViewport viewPort{};
+        viewPort.x = static_cast<float>(c * resolution);
+        viewPort.width = static_cast<float>(resolution);
+        viewPort.height = static_cast<float>(resolution);
+        viewPort.minDepth = 0.0f;
+        viewPort.maxDepth = 1.0f;
+        vkCmdSetViewport(commandBuffer, 0, 1, &viewPort);
+        VkRect2D scissorRect{ { static_cast<int32_t>(c * resolution), 0 }, { resolution, resolution } };
+        vkCmdSetScissor(commandBuffer, 0, 1, &scissorRect);
+        vkCmdPushConstants(commandBuffer, shadowPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(uint32_t), &c);
+
+        VkDeviceSize firstDraw = VkDeviceSize(c) * drawCount * sizeof(VkDrawIndexedIndirectCommand);
+        if (multiDrawIndirectSupported) {
+            vkCmdDrawIndexedIndirect(commandBuffer, drawBuffer, firstDraw, drawCount, sizeof(VkDrawIndexedIndirectCommand));
+        }
+        else {
+            for (uint32_t draw = 0; draw < drawCount; draw++) {
+                vkCmdDrawIndexedIndirect(commandBuffer, drawBuffer, firstDraw + draw * sizeof(VkDrawIndexedIndirectCommand), 1, sizeof(VkDrawIndexedIndirectCommand));
+            }
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+RAY TRACED SHADOWS
 */
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void VulkanRenderer::createRenderPass() {
-    VkAttachmentDescription colorAttachmentDescription{};
-    colorAttachmentDescription.format = SWChainImageFormat;
-    colorAttachmentDescription.samples = VK_SAMPLE_COUNT_1_BIT;
-
-    // Determine what to do with the data in the attachment before and after the rendering
-    colorAttachmentDescription.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    colorAttachmentDescription.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-
-    // Apply to stencil data
-    colorAttachmentDescription.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    colorAttachmentDescription.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-
-    // Specify the layout of pixels in memory for the images
-    colorAttachmentDescription.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorAttachmentDescription.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-
-    // One render pass consists of multiple render subpasses, but we are only going to use 1 for the triangle
-    VkAttachmentReference colorAttachmentReference{};
-    colorAttachmentReference.attachment = 0;
-    colorAttachmentReference.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-    VkAttachmentDescription depthAttachmentDescription{};
-    depthAttachmentDescription.format = findDepthFormat();
-    depthAttachmentDescription.samples = VK_SAMPLE_COUNT_1_BIT;
-    depthAttachmentDescription.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    depthAttachmentDescription.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    depthAttachmentDescription.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    depthAttachmentDescription.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    depthAttachmentDescription.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    depthAttachmentDescription.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-    VkAttachmentReference depthAttachmentReference{};
-    depthAttachmentReference.attachment = 1;
-    depthAttachmentReference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-
-    // Create the subpass
-    VkSubpassDescription subpass{};
-    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-    // Have to be explicit about this subpass being a graphics subpass
-    subpass.colorAttachmentCount = 1;
-    subpass.pColorAttachments = &colorAttachmentReference;
-    subpass.pDepthStencilAttachment = &depthAttachmentReference;
-
-    VkSubpassDependency dependency{};
-    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-
-    // Create information struct for the render pass
-    std::array<VkAttachmentDescription, 2> attachments = { colorAttachmentDescription, depthAttachmentDescription };
-    VkRenderPassCreateInfo renderPassCInfo{};
-    renderPassCInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-    renderPassCInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
-    renderPassCInfo.pAttachments = attachments.data();
-    renderPassCInfo.subpassCount = 1;
-    renderPassCInfo.pSubpasses = &subpass;
-    renderPassCInfo.dependencyCount = 1;
-    renderPassCInfo.pDependencies = &dependency;
-
-    // Specify the indices and the dependent subpass
-    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-    dependency.dstSubpass = 0;
-
-    // Specify operations to wait on and the stages in which they occur
-    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.srcAccessMask = 0;
-    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-
-    // Add this information to the render pass create informatiton
-    renderPassCInfo.dependencyCount = 1;
-    renderPassCInfo.pDependencies = &dependency;
-
-    if (vkCreateRenderPass(device, &renderPassCInfo, nullptr, &renderPass) != VK_SUCCESS) {
-        std::_Xruntime_error("Failed to create render pass!");
+void VulkanRenderer::createRayTracedResources() {
+    if (!rayTracedShadowsEnabled) {
+        return;
+    }
+
+    // The pre-pass depth is sampled by the trace, a stencil aspect would keep it from being bound
+    VkFormatProperties depthProperties;
+    vkGetPhysicalDeviceFormatProperties(GPU, VK_FORMAT_D32_SFLOAT, &depthProperties);
+    VkFormatFeatureFlags depthFeatures = VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+    if ((depthProperties.optimalTilingFeatures & depthFeatures) != depthFeatures) {
+        printf("Ray traced shadows need a sampled 32-bit depth buffer, using shadow maps \n");
+        rayTracedShadowsEnabled = false;
+        shadowsEnabled = true;
+        return;
+    }
+
+    VkSamplerCreateInfo samplerCInfo{};
+    samplerCInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerCInfo.magFilter = VK_FILTER_NEAREST;
+    samplerCInfo.minFilter = VK_FILTER_NEAREST;
+    samplerCInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerCInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerCInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerCInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerCInfo.minLod = 0.0f;
+    samplerCInfo.maxLod = 0.0f;
+    if (vkCreateSampler(device, &samplerCInfo, nullptr, &rayTracedSampler) != VK_SUCCESS) {
+        std::_Xruntime_error("Failed to create the ray traced sampler!");
+    }
+
+    // Parameters, TLAS, depth, the image a pass reads, the history and the image it writes. Each pass binds what it uses
+    std::array<VkDescriptorSetLayoutBinding, 6> bindings{};
+    VkDescriptorType types[] = { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE };
+    for (uint32_t binding = 0; binding < bindings.size(); binding++) {
+        bindings[binding].binding = binding;
+        bindings[binding].descriptorType = types[binding];
+        bindings[binding].descriptorCount = 1;
+        bindings[binding].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+    VkDescriptorSetLayoutCreateInfo layoutCInfo{};
+    layoutCInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutCInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+    layoutCInfo.pBindings = bindings.data();
+    if (vkCreateDescriptorSetLayout(device, &layoutCInfo, nullptr, &rayTracedSetLayout) != VK_SUCCESS) {
+        std::_Xruntime_error("Failed to create the ray traced descriptor set layout!");
+    }
+
+    // The filter step is pushed
+    VkPushConstantRange stepRange{ VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(int32_t) };
+    VkPipelineLayoutCreateInfo pipelineLayoutCInfo{};
+    pipelineLayoutCInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutCInfo.setLayoutCount = 1;
+    pipelineLayoutCInfo.pSetLayouts = &rayTracedSetLayout;
+    pipelineLayoutCInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCInfo.pPushConstantRanges = &stepRange;
+    if (vkCreatePipelineLayout(device, &pipelineLayoutCInfo, nullptr, &rayTracedPipelineLayout) != VK_SUCCESS) {
+        std::_Xruntime_error("Failed to create the ray traced pipeline layout!");
+    }
+}
+
+void VulkanRenderer::destroyRayTracedResources() {
+    vkDestroyPipelineLayout(device, rayTracedPipelineLayout, nullptr);
+    vkDestroyDescriptorSetLayout(device, rayTracedSetLayout, nullptr);
+    vkDestroySampler(device, rayTracedSampler, nullptr);
+}
+
+void VulkanRenderer::createRayTracedPipelines() {
+    if (!rayTracedShadowsEnabled) {
+        return;
+    }
+
+    rayTracePipeline = buildComputePipeline(rayTracedPipelineLayout, readFile("shaders/rtshadows.spv"), "rtshadows");
+    rayAccumulatePipeline = buildComputePipeline(rayTracedPipelineLayout, readFile("shaders/rtaccumulate.spv"), "rtaccumulate");
+    rayDenoisePipeline = buildComputePipeline(rayTracedPipelineLayout, readFile("shaders/rtdenoise.spv"), "rtdenoise");
+}
+
+// Also called from the shader reload thread, with the layout from its copy of the pipeline state
+VkPipeline VulkanRenderer::buildComputePipeline(VkPipelineLayout layout, const std::vector<char>& computeShader, const std::string& name) {
+    VkShaderModule shaderModule = createShaderModule(computeShader);
+    VkComputePipelineCreateInfo pipelineCInfo{};
+    pipelineCInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineCInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineCInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineCInfo.stage.module = shaderModule;
+    pipelineCInfo.stage.pName = "main";
+    pipelineCInfo.layout = layout;
+
+    VkPipeline pipeline;
+    VkResult res = vkCreateComputePipelines(device, pipelineCache, 1, &pipelineCInfo, nullptr, &pipeline);
+    vkDestroyShaderModule(device, shaderModule, nullptr);
+    if (res != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create the compute pipeline " + name + "!");
+    }
+    return pipeline;
+}
+
+// The transient images move whenever the graph is compiled, so this follows every createFrameGraph once the sets exist
+void VulkanRenderer::writeRayTracedDescriptors() {
+    if (!rayTracedShadowsEnabled || rayTracedDescriptorSets.empty()) {
+        return;
+    }
+
+    uint32_t iterations = rayTracedShadows.getSettings().denoiseIterations;
+    uint32_t passes = 2 + iterations;
+    // What each pass reads and writes, in the order of the sets
+    std::vector<RenderGraph::ResourceId> sources = { RenderGraph::INVALID, rayTracedNoisy };
+    std::vector<RenderGraph::ResourceId> targets = { rayTracedNoisy, rayTracedAccumulated };
+    for (uint32_t i = 0; i < iterations; i++) {
+        sources.push_back(i == 0 ? rayTracedAccumulated : rayTracedFiltered[(i - 1) % 2]);
+        targets.push_back(rayTracedFiltered[i % 2]);
+    }
+
+    VkDescriptorImageInfo depthInfo{ rayTracedSampler, frameGraph.getImageView(sceneDepth), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+    VkDescriptorImageInfo historyInfo{ rayTracedSampler, rayTracedHistoryImageView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+    VkDescriptorImageInfo outputInfo{ rayTracedSampler, frameGraph.getImageView(rayTracedOutput), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+    std::vector<VkDescriptorImageInfo> storageInfos(2 * passes);
+    for (uint32_t pass = 0; pass < passes; pass++) {
+        if (sources[pass] != RenderGraph::INVALID) {
+            storageInfos[2 * pass] = { VK_NULL_HANDLE, frameGraph.getImageView(sources[pass]), VK_IMAGE_LAYOUT_GENERAL };
+        }
+        storageInfos[2 * pass + 1] = { VK_NULL_HANDLE, frameGraph.getImageView(targets[pass]), VK_IMAGE_LAYOUT_GENERAL };
+    }
+    // Left unwritten until the TLAS is built, createTopLevelAS writes the sets again
+    VkWriteDescriptorSetAccelerationStructureKHR accelerationStructureInfo{};
+    accelerationStructureInfo.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET_ACCELERATION_STRUCTURE_KHR;
+    accelerationStructureInfo.accelerationStructureCount = 1;
+    accelerationStructureInfo.pAccelerationStructures = &topLevelAccelStructure;
+
+    for (size_t i = 0; i < SWChainImages.size(); i++) {
+        VkDescriptorBufferInfo paramsInfo{ rayTracedUniformBuffers[i], 0, sizeof(RayTracedShadows::GPUParams) };
+        std::vector<VkWriteDescriptorSet> writes;
+        auto addWrite = [&](VkDescriptorSet set, uint32_t binding, VkDescriptorType type) -> VkWriteDescriptorSet& {
+            VkWriteDescriptorSet write{};
+            write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            write.dstSet = set;
+            write.dstBinding = binding;
+            write.descriptorType = type;
+            write.descriptorCount = 1;
+            writes.push_back(write);
+            return writes.back();
+        };
+
+        for (uint32_t pass = 0; pass < passes; pass++) {
+            VkDescriptorSet set = rayTracedDescriptorSets[i][pass];
+            addWrite(set, 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER).pBufferInfo = &paramsInfo;
+            if (sources[pass] != RenderGraph::INVALID) {
+                addWrite(set, 3, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE).pImageInfo = &storageInfos[2 * pass];
+            }
+            addWrite(set, 5, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE).pImageInfo = &storageInfos[2 * pass + 1];
+        }
+        if (topLevelAccelStructure != VK_NULL_HANDLE) {
+            addWrite(rayTracedDescriptorSets[i][0], 1, VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR).pNext = &accelerationStructureInfo;
+        }
+        addWrite(rayTracedDescriptorSets[i][0], 2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER).pImageInfo = &depthInfo;
+        addWrite(rayTracedDescriptorSets[i][1], 4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER).pImageInfo = &historyInfo;
+        addWrite(descriptorSets[i], 6, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER).pImageInfo = &outputInfo;
+
+        vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+    }
+}
+
+void VulkanRenderer::updateRayTracedShadows(uint32_t imageIndex, const glm::mat4& view, const glm::mat4& proj, UniformBufferObject& ubo) {
+    ubo.rayTracingParams = glm::vec4(0.0f);
+    if (!rayTracedShadowsEnabled) {
+        return;
     }
+
+    // Traced over the part of the targets this frame renders to
+    RayTracedShadows::GPUParams params = rayTracedShadows.beginFrame(view, proj, sunDirection, renderExtent.width, renderExtent.height);
+    std::memcpy(rayTracedUniformBuffersMapped[imageIndex], &params, sizeof(params));
+    ubo.rayTracingParams = glm::vec4(params.extent.x / params.extent.z, params.extent.y / params.extent.w, params.extent.x, params.extent.y);
+}
+
+void VulkanRenderer::recordRayTracedPass(VkCommandBuffer commandBuffer, uint32_t image, VkPipeline pipeline, uint32_t set, int32_t step) {
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, rayTracedPipelineLayout, 0, 1, &rayTracedDescriptorSets[image][set], 0, nullptr);
+    vkCmdPushConstants(commandBuffer, rayTracedPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(int32_t), &step);
+    // 8x8 groups over the texels of the render extent, a new extent re-records the command buffers
+    uint32_t width = rayTracedShadows.traceSize(renderExtent.width);
+    uint32_t height = rayTracedShadows.traceSize(renderExtent.height);
+    vkCmdDispatch(commandBuffer, (width + 7) / 8, (height + 7) / 8, 1);
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -609,7 +1177,8 @@ void VulkanRenderer::createDescriptorSetLayout() {
     UBOLayoutBinding.binding = 0;
     UBOLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
     UBOLayoutBinding.descriptorCount = 1;
-    UBOLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    // The fragment shader reads the cascades and the sun from it
+    UBOLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
     UBOLayoutBinding.pImmutableSamplers = nullptr;
 
     VkDescriptorSetLayoutBinding samplerLayoutBinding{};
@@ -619,7 +1188,21 @@ void VulkanRenderer::createDescriptorSetLayout() {
     samplerLayoutBinding.pImmutableSamplers = nullptr;
     samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
-    std::array<VkDescriptorSetLayoutBinding, 2> bindings = { UBOLayoutBinding, samplerLayoutBinding };
+    // Point lights, the cluster grid and the light index list, read by the fragment shader
+    std::array<VkDescriptorSetLayoutBinding, 7> bindings = { UBOLayoutBinding, samplerLayoutBinding };
+    for (uint32_t binding = 2; binding < 5; binding++) {
+        bindings[binding].binding = binding;
+        bindings[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[binding].descriptorCount = 1;
+        bindings[binding].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+        bindings[binding].pImmutableSamplers = nullptr;
+    }
+    // Shadow atlas
+    bindings[5] = samplerLayoutBinding;
+    bindings[5].binding = 5;
+    // Ray traced shadows and AO, the texture stands in while they are off
+    bindings[6] = samplerLayoutBinding;
+    bindings[6].binding = 6;
     VkDescriptorSetLayoutCreateInfo layoutCInfo{};
     layoutCInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
     layoutCInfo.bindingCount = static_cast<uint32_t>(bindings.size());
@@ -637,13 +1220,120 @@ GRAPHICS PIPELINE
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 void VulkanRenderer::createGraphicsPipeline() {
+    createPipelineCache();
+
+    // We can use uniform values to make changes to the shaders without having to create them again, similar to global variables
+    // Initialize the pipeline layout with another create info struct
+    VkPipelineLayoutCreateInfo pipeLineLayoutCInfo{};
+    pipeLineLayoutCInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipeLineLayoutCInfo.setLayoutCount = 1;
+    pipeLineLayoutCInfo.pSetLayouts = &descriptorSetLayout;
+    pipeLineLayoutCInfo.pushConstantRangeCount = 0;
+    pipeLineLayoutCInfo.pPushConstantRanges = nullptr;
+
+    if (vkCreatePipelineLayout(device, &pipeLineLayoutCInfo, nullptr, &pipeLineLayout) != VK_SUCCESS) {
+        std::_Xruntime_error("Failed to create pipeline layout!");
+    }
+
+    // The shadow casters also get the cascade they are drawn into
+    VkPushConstantRange cascadeRange{ VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(uint32_t) };
+    pipeLineLayoutCInfo.pushConstantRangeCount = 1;
+    pipeLineLayoutCInfo.pPushConstantRanges = &cascadeRange;
+    if (vkCreatePipelineLayout(device, &pipeLineLayoutCInfo, nullptr, &shadowPipelineLayout) != VK_SUCCESS) {
+        std::_Xruntime_error("Failed to create the shadow pipeline layout!");
+    }
+
+    vertexLayout = VertexLayout::create(vertexLayoutType);
+
+    createScenePipelines();
+    createRayTracedPipelines();
+}
+
+void VulkanRenderer::createScenePipelines() {
     // Read the file for the bytecodfe of the shaders
     std::vector<char> vertexShader = readFile("shaders/vert.spv");
     std::vector<char> fragmentShader = readFile("shaders/frag.spv");
 
+    graphicsPipeline = buildGraphicsPipeline(vertexShader, fragmentShader);
+    depthPrepassPipeline = depthPrepassEnabled ? buildGraphicsPipeline(readFile("shaders/depth.spv"), {}, true) : VK_NULL_HANDLE;
+    shadowPipeline = shadowsEnabled ? buildGraphicsPipeline(readFile("shaders/shadow.spv"), {}, true, true) : VK_NULL_HANDLE;
+}
+
+VulkanRenderer::GraphicsPipelineState VulkanRenderer::getGraphicsPipelineState() const {
+    GraphicsPipelineState state;
+    state.renderPass = renderPass;
+    state.depthPrepassRenderPass = depthPrepassRenderPass;
+    state.shadowRenderPass = frameGraph.getRenderPass(shadowPass);
+    state.pipelineLayout = pipeLineLayout;
+    state.shadowPipelineLayout = shadowPipelineLayout;
+    state.rayTracedPipelineLayout = rayTracedPipelineLayout;
+    state.extent = SWChainExtent;
+    state.depthPrepass = depthPrepassEnabled;
+    state.shadows = shadowsEnabled;
+    state.rayTracedShadows = rayTracedShadowsEnabled;
+    state.colorBlend = colorBlendEnable;
+    state.vertexLayout = vertexLayout;
+    state.generation = pipelineStateGeneration;
+    return state;
+}
+
+VulkanRenderer::GraphicsPipelineState VulkanRenderer::acquireGraphicsPipelineState() {
+    std::lock_guard<std::mutex> lock(pipelineStateMutex);
+    pipelineStateLeases++;
+    return getGraphicsPipelineState();
+}
+
+void VulkanRenderer::releaseGraphicsPipelineState() {
+    std::lock_guard<std::mutex> lock(pipelineStateMutex);
+    if (--pipelineStateLeases > 0) {
+        return;
+    }
+
+    // Nothing builds against the parked handles any more, and no frame uses them since they were replaced
+    for (VkRenderPass pass : leasedRenderPasses) {
+        vkDestroyRenderPass(device, pass, nullptr);
+    }
+    for (VkPipelineLayout layout : leasedPipelineLayouts) {
+        vkDestroyPipelineLayout(device, layout, nullptr);
+    }
+    leasedRenderPasses.clear();
+    leasedPipelineLayouts.clear();
+}
+
+void VulkanRenderer::retirePipelineLayout(VkPipelineLayout layout) {
+    if (pipelineStateLeases > 0 && layout != VK_NULL_HANDLE) {
+        leasedPipelineLayouts.push_back(layout);
+    }
+    else {
+        vkDestroyPipelineLayout(device, layout, nullptr);
+    }
+}
+
+// Builds against the current layout and render pass, only on the render thread
+VkPipeline VulkanRenderer::buildGraphicsPipeline(const std::vector<char>& vertexShader, const std::vector<char>& fragmentShader, bool depthOnly, bool shadowCaster) {
+    return buildGraphicsPipeline(getGraphicsPipelineState(), vertexShader, fragmentShader, depthOnly, shadowCaster);
+}
+
+// Builds the pipeline from SPIR-V binaries against the layout and render pass of a state, the shader reload thread
+// passes the copy it took under pipelineStateMutex
+VkPipeline VulkanRenderer::buildGraphicsPipeline(const GraphicsPipelineState& state, const std::vector<char>& vertexShader, const std::vector<char>& fragmentShader,
+    bool depthOnly, bool shadowCaster) {
     // Wrap the bytecode with VkShaderModule objects
     VkShaderModule vertexShaderModule = createShaderModule(vertexShader);
-    VkShaderModule fragmentShaderModule = createShaderModule(fragmentShader);
+    VkShaderModule fragmentShaderModule = depthOnly ? VK_NULL_HANDLE : createShaderModule(fragmentShader);
+
+    // The vertex shader decodes octahedral normals only when the layout stores them that way
+    VkBool32 octahedralNormals = state.vertexLayout.octahedralNormals();
+    VkSpecializationMapEntry specializationEntry{};
+    specializationEntry.constantID = 0;
+    specializationEntry.offset = 0;
+    specializationEntry.size = sizeof(VkBool32);
+
+    VkSpecializationInfo specializationInfo{};
+    specializationInfo.mapEntryCount = 1;
+    specializationInfo.pMapEntries = &specializationEntry;
+    specializationInfo.dataSize = sizeof(VkBool32);
+    specializationInfo.pData = &octahedralNormals;
 
     //Create the shader information struct to begin actuall using the shader
     VkPipelineShaderStageCreateInfo vertextStageCInfo{};
@@ -651,6 +1341,7 @@ void VulkanRenderer::createGraphicsPipeline() {
     vertextStageCInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
     vertextStageCInfo.module = vertexShaderModule;
     vertextStageCInfo.pName = "main";
+    vertextStageCInfo.pSpecializationInfo = &specializationInfo;
 
     VkPipelineShaderStageCreateInfo fragmentStageCInfo{};
     fragmentStageCInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -661,17 +1352,9 @@ void VulkanRenderer::createGraphicsPipeline() {
     // Define array to contain the shader create information structs
     VkPipelineShaderStageCreateInfo stages[] = { vertextStageCInfo, fragmentStageCInfo };
 
-    // Describing the format of the vertex data to be passed to the vertex shader
-    VkPipelineVertexInputStateCreateInfo vertexInputCInfo{};
-    vertexInputCInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-
-    auto bindingDescription = Vertex::getBindingDescription();
-    auto attributeDescriptions = Vertex::getAttributeDescriptions();
-
-    vertexInputCInfo.vertexBindingDescriptionCount = 1;
-    vertexInputCInfo.pVertexBindingDescriptions = &bindingDescription;
-    vertexInputCInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());;
-    vertexInputCInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+    // Describing the format of the vertex data to be passed to the vertex shader, generated from the vertex layout. The
+    // depth only pass fetches the positions alone
+    VkPipelineVertexInputStateCreateInfo vertexInputCInfo = depthOnly ? state.vertexLayout.positionOnlyInputState() : state.vertexLayout.inputState();
 
     // Next struct describes what kind of geometry will be drawn from the verts and if primitive restart should be enabled
     VkPipelineInputAssemblyStateCreateInfo inputAssemblyCInfo{};
@@ -679,19 +1362,19 @@ void VulkanRenderer::createGraphicsPipeline() {
     inputAssemblyCInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
     inputAssemblyCInfo.primitiveRestartEnable = false;
 
-    // Initialize the viewport information struct, a lot of the size information will come from the swap chain extent factor
+    // Initialize the viewport information struct, the viewport and scissor are dynamic and set to the render extent when recording
     VkViewport viewPort{};
     viewPort.x = 0.0f;
     viewPort.y = 0.0f;
-    viewPort.width = (float)SWChainExtent.width;
-    viewPort.height = (float)SWChainExtent.height;
+    viewPort.width = (float)state.extent.width;
+    viewPort.height = (float)state.extent.height;
     viewPort.minDepth = 0.0f;
     viewPort.maxDepth = 1.0f;
 
     // Create scissor rectangle to cover the entireity of the viewport
     VkRect2D scissorRect{};
     scissorRect.offset = { 0, 0 };
-    scissorRect.extent = SWChainExtent;
+    scissorRect.extent = state.extent;
 
     // Combine the viewport information struct and the scissor rectangle into a single viewport state
     VkPipelineViewportStateCreateInfo viewportStateCInfo{};
@@ -714,7 +1397,7 @@ void VulkanRenderer::createGraphicsPipeline() {
     // Linewidth describes thickness of lines in terms of number of fragments 
     rasterizerCInfo.lineWidth = 1.0f;
     // Specify type of culling and and the vertex order for the faces to be considered
-    rasterizerCInfo.cullMode = VK_CULL_MODE_NONE;
+    rasterizerCInfo.cullMode = backfaceCulling ? VK_CULL_MODE_BACK_BIT : VK_CULL_MODE_NONE;
     rasterizerCInfo.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
 
     // Alter depth values by adding constant or biasing them based on a fragment's slope
@@ -722,6 +1405,14 @@ void VulkanRenderer::createGraphicsPipeline() {
     rasterizerCInfo.depthBiasConstantFactor = 0.0f;
     rasterizerCInfo.depthBiasClamp = 0.0f;
     rasterizerCInfo.depthBiasSlopeFactor = 0.0f;
+    if (shadowCaster) {
+        // Open meshes such as the room cast from both sides, the bias and the normal offset in shader.frag keep the
+        // lit surfaces from shadowing themselves
+        rasterizerCInfo.cullMode = VK_CULL_MODE_NONE;
+        rasterizerCInfo.depthBiasEnable = VK_TRUE;
+        rasterizerCInfo.depthBiasConstantFactor = 1.25f;
+        rasterizerCInfo.depthBiasSlopeFactor = 1.75f;
+    }
 
     // Multisampling information struct
     VkPipelineMultisampleStateCreateInfo multiSamplingCInfo{};
@@ -744,7 +1435,7 @@ void VulkanRenderer::createGraphicsPipeline() {
     // Array of structures for all of the framebuffers to set blend constants as blend factors
     VkPipelineColorBlendStateCreateInfo colorBlendingCInfo{};
 
-    if (colorBlendEnable) {
+    if (state.colorBlend) {
         colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
         colorBlendAttachment.blendEnable = VK_FALSE;
         colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
@@ -769,7 +1460,7 @@ void VulkanRenderer::createGraphicsPipeline() {
     }
     colorBlendingCInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
     colorBlendingCInfo.logicOp = VK_LOGIC_OP_COPY;
-    colorBlendingCInfo.attachmentCount = 1;
+    colorBlendingCInfo.attachmentCount = depthOnly ? 0 : 1;
     colorBlendingCInfo.pAttachments = &colorBlendAttachment;
     colorBlendingCInfo.blendConstants[0] = 0.0f;
     colorBlendingCInfo.blendConstants[1] = 0.0f;
@@ -779,7 +1470,7 @@ void VulkanRenderer::createGraphicsPipeline() {
     // Not much can be changed without completely recreating the rendering pipeline, so we fill in a struct with the information
     VkDynamicState dynaStates[] = {
         VK_DYNAMIC_STATE_VIEWPORT,
-        VK_DYNAMIC_STATE_LINE_WIDTH
+        VK_DYNAMIC_STATE_SCISSOR
     };
 
     VkPipelineDynamicStateCreateInfo dynamicStateCInfo{};
@@ -787,24 +1478,16 @@ void VulkanRenderer::createGraphicsPipeline() {
     dynamicStateCInfo.dynamicStateCount = 2;
     dynamicStateCInfo.pDynamicStates = dynaStates;
 
-    // We can use uniform values to make changes to the shaders without having to create them again, similar to global variables
-    // Initialize the pipeline layout with another create info struct
-    VkPipelineLayoutCreateInfo pipeLineLayoutCInfo{};
-    pipeLineLayoutCInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipeLineLayoutCInfo.setLayoutCount = 1;
-    pipeLineLayoutCInfo.pSetLayouts = &descriptorSetLayout;
-    pipeLineLayoutCInfo.pushConstantRangeCount = 0;
-    pipeLineLayoutCInfo.pPushConstantRanges = nullptr;
-
-    if (vkCreatePipelineLayout(device, &pipeLineLayoutCInfo, nullptr, &pipeLineLayout) != VK_SUCCESS) {
-        std::_Xruntime_error("Failed to create pipeline layout!");
-    }
-
     VkPipelineDepthStencilStateCreateInfo depthStencilCInfo{};
     depthStencilCInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
     depthStencilCInfo.depthTestEnable = VK_TRUE;
     depthStencilCInfo.depthWriteEnable = VK_TRUE;
     depthStencilCInfo.depthCompareOp = VK_COMPARE_OP_LESS;
+    if (state.depthPrepass && !depthOnly) {
+        // Depth is final after the pre-pass, only the nearest fragment of each pixel passes and is shaded
+        depthStencilCInfo.depthWriteEnable = VK_FALSE;
+        depthStencilCInfo.depthCompareOp = VK_COMPARE_OP_EQUAL;
+    }
     depthStencilCInfo.depthBoundsTestEnable = VK_FALSE;
     depthStencilCInfo.minDepthBounds = 0.0f;
     depthStencilCInfo.maxDepthBounds = 1.0f;
@@ -813,7 +1496,7 @@ void VulkanRenderer::createGraphicsPipeline() {
     // First - populate struct with the information
     VkGraphicsPipelineCreateInfo graphicsPipelineCInfo{};
     graphicsPipelineCInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-    graphicsPipelineCInfo.stageCount = 2;
+    graphicsPipelineCInfo.stageCount = depthOnly ? 1 : 2;
     graphicsPipelineCInfo.pStages = stages;
 
     graphicsPipelineCInfo.pVertexInputState = &vertexInputCInfo;
@@ -823,11 +1506,11 @@ void VulkanRenderer::createGraphicsPipeline() {
     graphicsPipelineCInfo.pMultisampleState = &multiSamplingCInfo;
     graphicsPipelineCInfo.pDepthStencilState = nullptr;
     graphicsPipelineCInfo.pColorBlendState = &colorBlendingCInfo;
-    graphicsPipelineCInfo.pDynamicState = nullptr;
+    graphicsPipelineCInfo.pDynamicState = &dynamicStateCInfo;
 
-    graphicsPipelineCInfo.layout = pipeLineLayout;
+    graphicsPipelineCInfo.layout = shadowCaster ? state.shadowPipelineLayout : state.pipelineLayout;
 
-    graphicsPipelineCInfo.renderPass = renderPass;
+    graphicsPipelineCInfo.renderPass = shadowCaster ? state.shadowRenderPass : depthOnly ? state.depthPrepassRenderPass : state.renderPass;
     graphicsPipelineCInfo.subpass = 0;
 
     graphicsPipelineCInfo.basePipelineHandle = VK_NULL_HANDLE;
@@ -835,14 +1518,110 @@ void VulkanRenderer::createGraphicsPipeline() {
 
     graphicsPipelineCInfo.pDepthStencilState = &depthStencilCInfo;
 
-    // Create the object
-    if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &graphicsPipelineCInfo, nullptr, &graphicsPipeline) != VK_SUCCESS) {
-        std::_Xruntime_error("Failed to create the graphics pipeline!");
-    }
+    // Create the object, going through the pipeline cache so rebuilds after a shader edit are cheap
+    VkPipeline pipeline;
+    VkResult res = vkCreateGraphicsPipelines(device, pipelineCache, 1, &graphicsPipelineCInfo, nullptr, &pipeline);
 
     // After all the processing with the modules is over, destroy them
     vkDestroyShaderModule(device, vertexShaderModule, nullptr);
-    vkDestroyShaderModule(device, fragmentShaderModule, nullptr);
+    if (fragmentShaderModule) {
+        vkDestroyShaderModule(device, fragmentShaderModule, nullptr);
+    }
+
+    if (res != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create the graphics pipeline!");
+    }
+
+    return pipeline;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+PIPELINE CACHE AND PIPELINE SWAPPING
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void VulkanRenderer::createPipelineCache() {
+    if (pipelineCache != VK_NULL_HANDLE) {
+        return;
+    }
+
+    // Seed the cache with the data saved by the previous run, if there is any
+    std::vector<char> cacheData;
+    std::ifstream file(PIPELINE_CACHE_PATH, std::ios::ate | std::ios::binary);
+    if (file.is_open()) {
+        cacheData.resize((size_t)file.tellg());
+        file.seekg(0);
+        file.read(cacheData.data(), cacheData.size());
+        file.close();
+    }
+
+    VkPipelineCacheCreateInfo cacheCInfo{};
+    cacheCInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    cacheCInfo.initialDataSize = cacheData.size();
+    cacheCInfo.pInitialData = cacheData.empty() ? nullptr : cacheData.data();
+
+    // A cache from another driver is rejected by the implementation, so fall back to an empty one
+    if (vkCreatePipelineCache(device, &cacheCInfo, nullptr, &pipelineCache) != VK_SUCCESS) {
+        cacheCInfo.initialDataSize = 0;
+        cacheCInfo.pInitialData = nullptr;
+        if (vkCreatePipelineCache(device, &cacheCInfo, nullptr, &pipelineCache) != VK_SUCCESS) {
+            std::_Xruntime_error("Failed to create the pipeline cache!");
+        }
+    }
+}
+
+void VulkanRenderer::savePipelineCache() {
+    size_t dataSize = 0;
+    vkGetPipelineCacheData(device, pipelineCache, &dataSize, nullptr);
+
+    std::vector<char> cacheData(dataSize);
+    vkGetPipelineCacheData(device, pipelineCache, &dataSize, cacheData.data());
+
+    std::ofstream file(PIPELINE_CACHE_PATH, std::ios::binary | std::ios::trunc);
+    if (file.is_open()) {
+        file.write(cacheData.data(), dataSize);
+    }
+}
+
+// Replace the reloaded pipelines at a frame boundary, the old ones are kept alive until every frame that may use them has finished
+void VulkanRenderer::swapPipelines(const ReloadedPipelines& reloaded) {
+    std::pair<VkPipeline*, VkPipeline> swaps[] = {
+        { &graphicsPipeline, reloaded.graphics },
+        { &depthPrepassPipeline, reloaded.depthPrepass },
+        { &shadowPipeline, reloaded.shadow },
+        { &rayTracePipeline, reloaded.rayTrace },
+        { &rayAccumulatePipeline, reloaded.rayAccumulate },
+        { &rayDenoisePipeline, reloaded.rayDenoise }
+    };
+    for (auto& swap : swaps) {
+        if (swap.second == VK_NULL_HANDLE) {
+            continue;
+        }
+        if (*swap.first != VK_NULL_HANDLE) {
+            RetiredPipeline retired;
+            retired.pipeline = *swap.first;
+            retired.retireFrame = frameCount + SWChainImages.size() + MAX_FRAMES_IN_FLIGHT;
+            retiredPipelines.push_back(retired);
+        }
+        *swap.first = swap.second;
+    }
+
+    // Each command buffer is re-recorded lazily, the next time its swap chain image comes up
+    std::fill(commandBufferStale.begin(), commandBufferStale.end(), true);
+}
+
+void VulkanRenderer::destroyRetiredPipelines() {
+    for (size_t i = 0; i < retiredPipelines.size();) {
+        if (retiredPipelines[i].retireFrame <= frameCount) {
+            vkDestroyPipeline(device, retiredPipelines[i].pipeline, nullptr);
+            retiredPipelines[i] = retiredPipelines.back();
+            retiredPipelines.pop_back();
+        }
+        else {
+            i++;
+        }
+    }
 }
 
 
@@ -852,7 +1631,12 @@ HELPER METHODS FOR THE GRAPHICS PIPELINE
 */
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-std::vector<char> VulkanRenderer::readFile(const std::string& filename) {
+std::vector<char> VulkanRenderer::readFile(const std::string& filename, bool archived) {
+    std::vector<char> archivedFile;
+    if (archived && AssetArchive::mounted().read(filename, archivedFile)) {
+        return archivedFile;
+    }
+
     // Start reading at end of the file and read as binary
     std::ifstream file(filename, std::ios::ate | std::ios::binary);
     if (!file.is_open()) {
@@ -887,58 +1671,69 @@ VkShaderModule VulkanRenderer::createShaderModule(const std::vector<char>& binar
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /*
-CREATING THE FRAME BUFFER
+MODEL LOADER
 */
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void VulkanRenderer::createFrameBuffer() {
-    SWChainFrameBuffers.resize(SWChainImageViews.size());
-
-    // Iterate through the image views and create framebuffers from them
-    for (size_t i = 0; i < SWChainImageViews.size(); i++) {
-        std::array<VkImageView, 2> attachments = { SWChainImageViews[i], depthImageView };
-
-        VkFramebufferCreateInfo frameBufferCInfo{};
-        frameBufferCInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-        frameBufferCInfo.renderPass = renderPass;
-        frameBufferCInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
-        frameBufferCInfo.pAttachments = attachments.data();
-        frameBufferCInfo.width = SWChainExtent.width;
-        frameBufferCInfo.height = SWChainExtent.height;
-        frameBufferCInfo.layers = 1;
+// Material libraries through the mounted asset archive like the OBJ itself, named as tinyobj's own reader names them
+class AssetMaterialReader : public tinyobj::MaterialReader {
 
-        if (vkCreateFramebuffer(device, &frameBufferCInfo, nullptr, &SWChainFrameBuffers[i]) != VK_SUCCESS) {
-            std::_Xruntime_error("Failed to create a framebuffer for an image view!");
+public:
+    bool operator()(const std::string& matId, std::vector<tinyobj::material_t>* materials, std::map<std::string, int>* matMap,
+        std::string* warn, std::string* err) override {
+        std::vector<char> contents;
+        if (!AssetArchive::readAsset(matId, contents)) {
+            if (warn) {
+                *warn += "Material file [ " + matId + " ] not found.\n";
+            }
+            return false;
         }
+        std::istringstream stream(std::string(contents.begin(), contents.end()));
+        tinyobj::LoadMtl(matMap, materials, &stream, warn, err);
+        return true;
     }
-}
-
-///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-/*
-MODEL LOADER
-*/
-///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+};
 
-void VulkanRenderer::loadModel(glm::mat4 transform) {
+void VulkanRenderer::loadModel(glm::mat4 transform, SceneGraph::NodeId parent) {
     tinyobj::attrib_t attrib;
     std::vector<tinyobj::shape_t> shapes;
     std::vector<tinyobj::material_t> materials;
     std::string warn, err;
 
+    // The scene's overdraw changes with it, so whether the pre-pass pays off is measured again
+    depthPrepassSelector.reset();
+
     OBJInstance instance;
     instance.index = static_cast<uint32_t>(loadedModels.size());
-    instance.transform = transform;
-    instance.transformIT = glm::transpose(glm::inverse(transform));
+    instance.node = sceneGraph.addNode(transform, parent);
     instance.textureOffset = static_cast<uint32_t>(materials.size());
 
     loadedModels.resize(static_cast<uint32_t>(loadedModels.size()) + 1);
 
-    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, MODEL_PATH.c_str())) {
+    std::vector<char> obj;
+    if (!AssetArchive::readAsset(MODEL_PATH, obj)) {
+        throw std::runtime_error("Failed to open " + MODEL_PATH);
+    }
+    std::istringstream objStream(std::string(obj.begin(), obj.end()));
+    AssetMaterialReader materialReader;
+    if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, &objStream, &materialReader)) {
         throw std::runtime_error(warn + err);
     }
 
+    Model& model = loadedModels[instance.index];
+
+    // OBJ corners that share position, normal and texture coordinate indices are welded into one vertex
+    std::map<std::tuple<int, int, int>, uint32_t> uniqueVertices;
+
     for (const auto& shape : shapes) {
         for (const auto& index : shape.mesh.indices) {
+            auto key = std::make_tuple(index.vertex_index, index.normal_index, index.texcoord_index);
+            auto found = uniqueVertices.find(key);
+            if (found != uniqueVertices.end()) {
+                model.indices.push_back(found->second);
+                continue;
+            }
+
             VulkanRenderer::Vertex vertex{};
 
             vertex.pos = {
@@ -952,18 +1747,161 @@ void VulkanRenderer::loadModel(glm::mat4 transform) {
                 1.0f - attrib.texcoords[2 * index.texcoord_index + 1]
             };
 
-            vertex.color = { 1.0f, 1.0f, 1.0f };
+            // Not every OBJ has normals, those without are left zeroed
+            if (index.normal_index >= 0) {
+                vertex.normal = {
+                    attrib.normals[3 * index.normal_index + 0],
+                    attrib.normals[3 * index.normal_index + 1],
+                    attrib.normals[3 * index.normal_index + 2]
+                };
+            }
 
-            loadedModels[0].vertices.push_back(vertex);
-            loadedModels[0].indices.push_back(static_cast<uint32_t>(loadedModels[0].indices.size()));
+            uint32_t vertexIndex = static_cast<uint32_t>(model.vertices.size());
+            uniqueVertices.emplace(key, vertexIndex);
+            model.vertices.push_back(vertex);
+            model.indices.push_back(vertexIndex);
         }
     }
 
+    buildLodChain(model);
+    optimizeModel(model);
+
+    if (!model.lods.empty()) {
+        const MeshLod& finest = model.lods[0];
+        model.meshlets = MeshletBuilder::build(model.indices.data() + finest.firstIndex, finest.indexCount, finest.firstIndex,
+            &model.vertices[0].pos.x, sizeof(Vertex), model.vertices.size());
+        printf("Meshlets: %zu for %u triangles \n", model.meshlets.size(), finest.indexCount / 3);
+    }
+
+    model.totalVertices = static_cast<uint32_t>(model.vertices.size());
+    model.totalIndices = static_cast<uint32_t>(model.indices.size());
+
+    if (vertexLayoutType == VertexLayoutType::SplitQuantized) {
+        quantizeModel(model);
+    }
+
+    RenderInstanceComponent renderInstance{ static_cast<uint32_t>(instances.size()) };
+    instance.entity = world.createEntity(TransformComponent{}, MeshComponent{ instance.index },
+        MaterialComponent{ instance.textureOffset }, SceneNodeComponent{ instance.node }, renderInstance);
     instances.emplace_back(instance);
+    entityOfNode.resize(std::max<size_t>(entityOfNode.size(), instance.node + 1));
+    entityOfNode[instance.node] = instance.entity;
+
+    // The new node is dirty, the update fills in the world transform and bounds of the instance
+    instanceBounds.resize(instances.size());
+    updateSceneGraph();
 
     numModels += 1;
 }
 
+void VulkanRenderer::buildLodChain(Model& model) {
+    model.lods.clear();
+    if (model.indices.empty()) {
+        return;
+    }
+
+    // Bounding sphere around the box centre, used to project the LOD errors to the screen
+    glm::vec3 minimum = model.vertices[0].pos;
+    glm::vec3 maximum = model.vertices[0].pos;
+    for (const Vertex& vertex : model.vertices) {
+        minimum = glm::min(minimum, vertex.pos);
+        maximum = glm::max(maximum, vertex.pos);
+    }
+    model.boundsCenter = (minimum + maximum) * 0.5f;
+    model.boundsExtent = (maximum - minimum) * 0.5f;
+    model.boundsRadius = 0.0f;
+    for (const Vertex& vertex : model.vertices) {
+        model.boundsRadius = std::max(model.boundsRadius, glm::length(vertex.pos - model.boundsCenter));
+    }
+
+    const float* positions = &model.vertices[0].pos.x;
+    size_t vertexCount = model.vertices.size();
+    float errorScale = MeshSimplifier::errorScale(positions, sizeof(Vertex), vertexCount);
+
+    MeshLod finest;
+    finest.indexCount = static_cast<uint32_t>(model.indices.size());
+    model.lods.push_back(finest);
+
+    // Each level is simplified from the previous one, so its error is at most the sum of the steps
+    std::vector<uint32_t> previous = model.indices;
+    float error = 0.0f;
+    while (model.lods.size() < MAX_MESH_LODS) {
+        size_t targetIndexCount = (previous.size() / 2) / 3 * 3;
+        std::vector<uint32_t> simplified(previous.size());
+        float stepError = 0.0f;
+        size_t indexCount = MeshSimplifier::simplify(simplified.data(), previous.data(), previous.size(), positions, sizeof(Vertex), vertexCount,
+            targetIndexCount, 0.2f, &stepError);
+
+        // Locked borders and seams stop the simplifier early, a level that barely shrinks is not worth the memory
+        if (indexCount == 0 || indexCount > previous.size() * 85 / 100) {
+            break;
+        }
+        simplified.resize(indexCount);
+        error += stepError * errorScale;
+
+        MeshLod lod;
+        lod.firstIndex = static_cast<uint32_t>(model.indices.size());
+        lod.indexCount = static_cast<uint32_t>(indexCount);
+        lod.error = error;
+        model.lods.push_back(lod);
+
+        model.indices.insert(model.indices.end(), simplified.begin(), simplified.end());
+        previous.swap(simplified);
+    }
+
+    printf("Mesh LODs:");
+    for (const MeshLod& lod : model.lods) {
+        printf(" %u (%.4f)", lod.indexCount / 3, lod.error);
+    }
+    printf(" triangles (error) \n");
+}
+
+void VulkanRenderer::optimizeModel(Model& model) {
+    if (model.lods.empty()) {
+        return;
+    }
+
+    size_t vertexCount = model.vertices.size();
+    const MeshLod& finest = model.lods[0];
+    MeshOptimizer::VertexCacheStats before = MeshOptimizer::analyzeVertexCache(model.indices.data() + finest.firstIndex, finest.indexCount, vertexCount);
+
+    // Overdraw ordering works on the cache optimized order so it can only split where the cache cost stays low
+    for (const MeshLod& lod : model.lods) {
+        uint32_t* lodIndices = model.indices.data() + lod.firstIndex;
+        MeshOptimizer::optimizeVertexCache(lodIndices, lodIndices, lod.indexCount, vertexCount);
+        MeshOptimizer::optimizeOverdraw(lodIndices, lodIndices, lod.indexCount, &model.vertices[0].pos.x, sizeof(Vertex), vertexCount);
+    }
+
+    // Vertices end up in the order the finest LOD first uses them, the coarser levels reuse a subset
+    MeshOptimizer::optimizeVertexFetch(model.vertices, model.indices);
+
+    MeshOptimizer::VertexCacheStats after = MeshOptimizer::analyzeVertexCache(model.indices.data() + finest.firstIndex, finest.indexCount, model.vertices.size());
+    printf("Mesh optimization: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f \n", before.acmr, after.acmr, before.atvr, after.atvr);
+}
+
+// Build the packed position and attribute streams from the full precision vertices
+void VulkanRenderer::quantizeModel(Model& model) {
+    std::vector<glm::vec3> positions(model.vertices.size());
+    for (size_t i = 0; i < model.vertices.size(); i++) {
+        positions[i] = model.vertices[i].pos;
+    }
+    model.dequantization = VertexQuantization::fitPositions(positions);
+
+    model.positions.resize(model.vertices.size());
+    model.attributes.resize(model.vertices.size());
+    for (size_t i = 0; i < model.vertices.size(); i++) {
+        model.positions[i] = VertexQuantization::packPosition(model.vertices[i].pos, model.dequantization);
+        model.attributes[i] = VertexQuantization::packAttributes(model.vertices[i].texCoord, model.vertices[i].normal);
+    }
+}
+
+glm::mat4 VulkanRenderer::getModelMatrix(const OBJInstance& instance) {
+    if (vertexLayoutType == VertexLayoutType::SplitQuantized) {
+        return instance.transform * loadedModels[instance.index].dequantization.toMatrix();
+    }
+    return instance.transform;
+}
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /*
 CREATE THE VERTEX, INDEX, AND UNIFORM BUFFERS AND OTHER HELPER METHODS
@@ -1064,25 +2002,59 @@ void VulkanRenderer::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDevice
     endSingleTimeCommands(commandBuffer);
 }
 
-void VulkanRenderer::createVertexBuffer() {
-    VkDeviceSize bufferSize = sizeof(loadedModels[0].vertices[0]) * loadedModels[0].vertices.size();
-
+void VulkanRenderer::createDeviceLocalBuffer(const void* srcData, VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
     VkBuffer stagingBuffer;
     VkDeviceMemory stagingBufferMemory;
-    createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+    createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
 
     void* data;
-    vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, loadedModels[0].vertices.data(), (size_t)bufferSize);
+    vkMapMemory(device, stagingBufferMemory, 0, size, 0, &data);
+    memcpy(data, srcData, (size_t)size);
     vkUnmapMemory(device, stagingBufferMemory);
 
-    createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexBufferMemory);
-    copyBuffer(stagingBuffer, vertexBuffer, bufferSize);
+    createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, bufferMemory);
+    copyBuffer(stagingBuffer, buffer, size);
 
     vkDestroyBuffer(device, stagingBuffer, nullptr);
     vkFreeMemory(device, stagingBufferMemory, nullptr);
 }
 
+void VulkanRenderer::createVertexBuffer() {
+    VkBufferUsageFlags usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR;
+
+    if (vertexLayoutType == VertexLayoutType::SplitQuantized) {
+        // Positions get their own tightly packed buffer, the attribute stream goes in the vertex buffer
+        const Model& model = loadedModels[0];
+        createDeviceLocalBuffer(model.positions.data(), sizeof(PackedPosition) * model.positions.size(), usage, positionBuffer, positionBufferMemory);
+        createDeviceLocalBuffer(model.attributes.data(), sizeof(PackedAttributes) * model.attributes.size(), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, vertexBuffer, vertexBufferMemory);
+    }
+    else {
+        VkDeviceSize bufferSize = sizeof(loadedModels[0].vertices[0]) * loadedModels[0].vertices.size();
+        createDeviceLocalBuffer(loadedModels[0].vertices.data(), bufferSize, usage, vertexBuffer, vertexBufferMemory);
+    }
+
+    reportVertexStreamSavings();
+}
+
+// Print the memory used by the vertex streams and the bytes each pass fetches per vertex, against the interleaved layout
+void VulkanRenderer::reportVertexStreamSavings() {
+    VertexLayout interleaved = VertexLayout::create(VertexLayoutType::Interleaved);
+
+    uint64_t numVertices = 0;
+    for (const Model& model : loadedModels) {
+        numVertices += model.vertices.size();
+    }
+
+    uint64_t interleavedBytes = numVertices * interleaved.bytesPerVertex;
+    uint64_t currentBytes = numVertices * vertexLayout.bytesPerVertex;
+
+    printf("Vertex streams: %llu vertices, %llu KB (interleaved %llu KB, %.0f%% saved) \n", (unsigned long long)numVertices,
+        (unsigned long long)(currentBytes / 1024), (unsigned long long)(interleavedBytes / 1024), 100.0 * (1.0 - (double)currentBytes / (double)std::max<uint64_t>(interleavedBytes, 1)));
+    printf("Bytes fetched per vertex: shading %llu (was %llu), depth only and AS build %llu (was %llu) \n",
+        (unsigned long long)vertexLayout.bytesPerVertex, (unsigned long long)interleaved.bytesPerVertex,
+        (unsigned long long)vertexLayout.positionBytesPerVertex, (unsigned long long)interleaved.positionBytesPerVertex);
+}
+
 void VulkanRenderer::createIndexBuffer() {
     VkDeviceSize bufferSize = sizeof(loadedModels[0].indices[0]) * loadedModels[0].indices.size();
 
@@ -1112,20 +2084,390 @@ void VulkanRenderer::createUniformBuffers() {
     for (size_t i = 0; i < SWChainImages.size(); i++) {
         createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformBuffers[i], uniformBuffersMemory[i]);
     }
+
+    // Parameters of the ray traced passes, persistently mapped
+    if (!rayTracedShadowsEnabled) {
+        return;
+    }
+    rayTracedUniformBuffers.resize(SWChainImages.size());
+    rayTracedUniformBuffersMemory.resize(SWChainImages.size());
+    rayTracedUniformBuffersMapped.resize(SWChainImages.size());
+    for (size_t i = 0; i < SWChainImages.size(); i++) {
+        createBuffer(sizeof(RayTracedShadows::GPUParams), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            rayTracedUniformBuffers[i], rayTracedUniformBuffersMemory[i]);
+        vkMapMemory(device, rayTracedUniformBuffersMemory[i], 0, sizeof(RayTracedShadows::GPUParams), 0, &rayTracedUniformBuffersMapped[i]);
+    }
+}
+
+void VulkanRenderer::createIndirectBuffers() {
+    indirectDrawCount = 0;
+    for (const OBJInstance& instance : instances) {
+        indirectDrawCount += 1 + static_cast<uint32_t>(loadedModels[instance.index].meshlets.size());
+    }
+    VkDeviceSize bufferSize = sizeof(VkDrawIndexedIndirectCommand) * std::max<uint32_t>(indirectDrawCount, 1);
+
+    indirectBuffers.resize(SWChainImages.size());
+    indirectBuffersMemory.resize(SWChainImages.size());
+    indirectBuffersMapped.resize(SWChainImages.size());
+
+    // Host visible and persistently mapped, the draws change every frame with the camera
+    for (size_t i = 0; i < SWChainImages.size(); i++) {
+        createBuffer(bufferSize, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, indirectBuffers[i], indirectBuffersMemory[i]);
+        vkMapMemory(device, indirectBuffersMemory[i], 0, bufferSize, 0, &indirectBuffersMapped[i]);
+    }
+
+    // A whole LOD per instance in every cascade, the static draws are only read while the cache is rendered
+    VkDeviceSize shadowBufferSize = sizeof(VkDrawIndexedIndirectCommand) * std::max<size_t>(cascadedShadows.cascadeCount() * instances.size(), 1);
+    shadowIndirectBuffers.resize(SWChainImages.size());
+    shadowIndirectBuffersMemory.resize(SWChainImages.size());
+    shadowIndirectBuffersMapped.resize(SWChainImages.size());
+    for (size_t i = 0; i < SWChainImages.size(); i++) {
+        createBuffer(shadowBufferSize, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, shadowIndirectBuffers[i], shadowIndirectBuffersMemory[i]);
+        vkMapMemory(device, shadowIndirectBuffersMemory[i], 0, shadowBufferSize, 0, &shadowIndirectBuffersMapped[i]);
+    }
+    createBuffer(shadowBufferSize, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, staticShadowIndirectBuffer, staticShadowIndirectBufferMemory);
+    vkMapMemory(device, staticShadowIndirectBufferMemory, 0, shadowBufferSize, 0, &staticShadowIndirectBufferMapped);
+}
+
+void VulkanRenderer::createLightBuffers() {
+    // Storage buffers cannot be empty, a scene without lights still gets one slot
+    VkDeviceSize lightSize = sizeof(LightClusters::GPULight) * std::max<size_t>(pointLights.size(), 1);
+    VkDeviceSize clusterSize = sizeof(LightClusters::GPUGrid) + sizeof(glm::uvec2) * lightClusters.clusterCount();
+    // Room for a few dozen lights per cluster to start with, updateLightClusters grows it when the lights bunch up
+    size_t indexCapacity = size_t(lightClusters.clusterCount()) * 32;
+    VkDeviceSize indexSize = sizeof(uint32_t) * indexCapacity;
+
+    lightBuffers.resize(SWChainImages.size());
+    lightBuffersMemory.resize(SWChainImages.size());
+    lightBuffersMapped.resize(SWChainImages.size());
+    clusterBuffers.resize(SWChainImages.size());
+    clusterBuffersMemory.resize(SWChainImages.size());
+    clusterBuffersMapped.resize(SWChainImages.size());
+    lightIndexBuffers.resize(SWChainImages.size());
+    lightIndexBuffersMemory.resize(SWChainImages.size());
+    lightIndexBuffersMapped.resize(SWChainImages.size());
+    lightIndexCapacity.assign(SWChainImages.size(), indexCapacity);
+
+    VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    for (size_t i = 0; i < SWChainImages.size(); i++) {
+        createBuffer(lightSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, properties, lightBuffers[i], lightBuffersMemory[i]);
+        vkMapMemory(device, lightBuffersMemory[i], 0, lightSize, 0, &lightBuffersMapped[i]);
+        createBuffer(clusterSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, properties, clusterBuffers[i], clusterBuffersMemory[i]);
+        vkMapMemory(device, clusterBuffersMemory[i], 0, clusterSize, 0, &clusterBuffersMapped[i]);
+        createBuffer(indexSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, properties, lightIndexBuffers[i], lightIndexBuffersMemory[i]);
+        vkMapMemory(device, lightIndexBuffersMemory[i], 0, indexSize, 0, &lightIndexBuffersMapped[i]);
+    }
+}
+
+void VulkanRenderer::scatterPointLights(uint32_t count) {
+    glm::vec3 minimum(std::numeric_limits<float>::max());
+    glm::vec3 maximum(-std::numeric_limits<float>::max());
+    for (const OBJInstance& instance : instances) {
+        // Walked up from the local transforms, the scene graph has not been updated before the first frame
+        glm::mat4 world = sceneGraph.getLocalTransform(instance.node);
+        for (SceneGraph::NodeId parent = sceneGraph.getParent(instance.node); parent != SceneGraph::INVALID_NODE; parent = sceneGraph.getParent(parent)) {
+            world = sceneGraph.getLocalTransform(parent) * world;
+        }
+        const Model& model = loadedModels[instance.index];
+        for (int corner = 0; corner < 8; corner++) {
+            glm::vec3 sign(corner & 1 ? 1.0f : -1.0f, corner & 2 ? 1.0f : -1.0f, corner & 4 ? 1.0f : -1.0f);
+            glm::vec3 point(world * glm::vec4(model.boundsCenter + sign * model.boundsExtent, 1.0f));
+            minimum = glm::min(minimum, point);
+            maximum = glm::max(maximum, point);
+        }
+    }
+    pointLights = LightClusters::scatterLights(count, minimum, maximum, 8.0f, 1);
+}
+
+void VulkanRenderer::updateSceneGraph() {
+    for (SceneGraph::NodeId node : sceneGraph.update(jobSystem)) {
+        Entity entity = node < entityOfNode.size() ? entityOfNode[node] : Entity();
+        TransformComponent* transform = entity.isValid() ? world.getComponentForWrite<TransformComponent>(entity) : nullptr;
+        if (transform) {
+            transform->world = sceneGraph.getWorldTransform(node);
+            transform->worldIT = sceneGraph.getWorldInverseTranspose(node);
+        }
+    }
+
+    // Copy the chunks with transforms written since the last sync into the instances. Single threaded, it pushes to
+    // changedInstances and only touches the chunks that moved
+    changedInstances.clear();
+    bool staticMoved = false;
+    EntityQuery query;
+    query.with<TransformComponent, MeshComponent, RenderInstanceComponent>().changedAfter<TransformComponent>(instanceSyncVersion);
+    world.forEachChunk(query, nullptr, [&](ChunkView& chunk) {
+        const TransformComponent* transforms = chunk.read<TransformComponent>();
+        const MeshComponent* meshes = chunk.read<MeshComponent>();
+        const RenderInstanceComponent* renderInstances = chunk.read<RenderInstanceComponent>();
+        for (uint32_t i = 0; i < chunk.size(); i++) {
+            uint32_t instanceIndex = renderInstances[i].instance;
+            OBJInstance& instance = instances[instanceIndex];
+            instance.transform = transforms[i].world;
+            instance.transformIT = transforms[i].worldIT;
+
+            const Model& model = loadedModels[meshes[i].model];
+            instanceBounds.set(instanceIndex, model.boundsCenter, model.boundsExtent, instance.transform);
+            changedInstances.push_back(instanceIndex);
+            staticMoved |= !instance.dynamic;
+
+            glm::vec3 center(instanceBounds.centerX[instanceIndex], instanceBounds.centerY[instanceIndex], instanceBounds.centerZ[instanceIndex]);
+            glm::vec3 extent(instanceBounds.extentX[instanceIndex], instanceBounds.extentY[instanceIndex], instanceBounds.extentZ[instanceIndex]);
+            if (instance.proxy == DynamicAABBTree::INVALID_PROXY) {
+                instance.proxy = instanceTree.insert(center - extent, center + extent, instanceIndex);
+            }
+            else {
+                instanceTree.move(instance.proxy, center - extent, center + extent);
+            }
+        }
+    });
+    instanceSyncVersion = world.getVersion();
+    world.advanceVersion();
+
+    // The cached shadow depth of static casters no longer matches the scene
+    if (staticMoved) {
+        cascadedShadows.invalidateStatic();
+    }
+
+    // Before createTopLevelAS there is nothing to refit, it reads the transforms when it runs
+    if (!changedInstances.empty() && !tlasInstances.empty()) {
+        updateTopLevelAS(changedInstances);
+    }
+}
+
+uint32_t VulkanRenderer::pickInstance(const glm::vec3& origin, const glm::vec3& direction) const {
+    Ray ray;
+    ray.origin = origin;
+    ray.direction = direction;
+    return instanceTree.raycast(ray).item;
+}
+
+void VulkanRenderer::updateIndirectCommands(uint32_t imageIndex, const glm::mat4& view, const glm::mat4& proj) {
+    VkDrawIndexedIndirectCommand* commands = static_cast<VkDrawIndexedIndirectCommand*>(indirectBuffersMapped[imageIndex]);
+
+    // Rendered pixels covered by one model space unit at distance 1, proj[1][1] is negative after the Y flip. A lower
+    // render scale lets coarser LODs through
+    float pixelsPerUnit = std::abs(proj[1][1]) * 0.5f * static_cast<float>(renderExtent.height);
+
+    drawnTriangles = 0;
+    fullDetailTriangles = 0;
+    visibleMeshlets = 0;
+    totalMeshlets = 0;
+
+    // Largest axis scale of the instance, so the error and radius are never underestimated
+    auto instanceScale = [](const OBJInstance& instance) {
+        return std::max(glm::length(glm::vec3(instance.transform[0])),
+            std::max(glm::length(glm::vec3(instance.transform[1])), glm::length(glm::vec3(instance.transform[2]))));
+    };
+
+    // Distance from the camera to the bounding sphere of the instance
+    auto instanceDistance = [&](const OBJInstance& instance, const Model& model, float scale) {
+        glm::vec4 center = view * instance.transform * glm::vec4(model.boundsCenter, 1.0f);
+        return std::max(glm::length(glm::vec3(center)) - model.boundsRadius * scale, 1e-3f);
+    };
+
+    // Coarsest level whose error still projects below the pixel threshold
+    auto selectLod = [](const Model& model, float scale, float distance, float pixelsPerUnit, float pixelError) {
+        for (size_t lod = model.lods.size(); lod-- > 0;) {
+            if (model.lods[lod].error * scale * pixelsPerUnit / distance <= pixelError) {
+                return lod;
+            }
+        }
+        return size_t(0);
+    };
+
+    Frustum frustum(proj * view);
+    InstanceCulling::cull(instanceBounds, frustum, jobSystem, frameArenas.current(), visibleInstances);
+
+    if (occlusionCulling) {
+        // Occluders are drawn at the coarsest LOD that is still accurate to a pixel of the occlusion buffer. Their vertices
+        // are a subset of the full mesh, so an instance never hides itself
+        float occlusionPixelsPerUnit = std::abs(proj[1][1]) * 0.5f * static_cast<float>(occlusionCuller.getHeight());
+        occlusionCuller.beginFrame(proj * view);
+
+        for (uint32_t i : visibleInstances) {
+            const OBJInstance& instance = instances[i];
+            const Model& model = loadedModels[instance.index];
+            if (model.lods.empty()) {
+                continue;
+            }
+
+            float scale = instanceScale(instance);
+            float distance = instanceDistance(instance, model, scale);
+            if (model.boundsRadius * scale * occlusionPixelsPerUnit / distance < occluderMinPixels) {
+                continue;
+            }
+
+            const MeshLod& lod = model.lods[selectLod(model, scale, distance, occlusionPixelsPerUnit, 1.0f)];
+            occlusionCuller.addOccluder(&model.vertices[0].pos.x, sizeof(Vertex), model.indices.data() + lod.firstIndex, lod.indexCount, instance.transform);
+        }
+
+        occlusionCuller.rasterize(jobSystem);
+        occlusionCuller.cullInstances(instanceBounds, visibleInstances, jobSystem, frameArenas.current());
+
+        const OcclusionCuller::Stats& stats = occlusionCuller.lastStats();
+        occlusionTested += stats.testedInstances;
+        occlusionCulled += stats.culledInstances;
+        occlusionRasterizeMs += stats.rasterizeMs;
+        occlusionTestMs += stats.testMs;
+
+        if (++occlusionReportFrames == 300) {
+            printf("Occlusion culling: %.1f%% of frustum visible instances hidden, %.3f ms per frame (rasterize %.3f ms, test %.3f ms), %u occluder triangles \n",
+                occlusionTested ? 100.0 * occlusionCulled / occlusionTested : 0.0, (occlusionRasterizeMs + occlusionTestMs) / occlusionReportFrames,
+                occlusionRasterizeMs / occlusionReportFrames, occlusionTestMs / occlusionReportFrames, stats.occluderTriangles);
+            occlusionReportFrames = 0;
+            occlusionTested = 0;
+            occlusionCulled = 0;
+            occlusionRasterizeMs = 0.0;
+            occlusionTestMs = 0.0;
+        }
+    }
+
+    size_t nextVisible = 0;
+
+    uint32_t slot = 0;
+    for (size_t i = 0; i < instances.size(); i++) {
+        const OBJInstance& instance = instances[i];
+        const Model& model = loadedModels[instance.index];
+
+        fullDetailTriangles += model.lods.empty() ? 0 : model.lods[0].indexCount / 3;
+        totalMeshlets += model.meshlets.size();
+
+        // Outside the frustum or hidden, every slot of the instance draws nothing
+        if (nextVisible == visibleInstances.size() || visibleInstances[nextVisible] != i) {
+            for (size_t draw = 0; draw <= model.meshlets.size(); draw++) {
+                commands[slot++] = VkDrawIndexedIndirectCommand{};
+            }
+            continue;
+        }
+        nextVisible++;
+
+        float scale = instanceScale(instance);
+        float distance = instanceDistance(instance, model, scale);
+        size_t selected = selectLod(model, scale, distance, pixelsPerUnit, lodPixelError);
+
+        bool drawMeshlets = selected == 0 && !model.meshlets.empty();
+
+        VkDrawIndexedIndirectCommand& command = commands[slot++];
+        command.indexCount = model.lods.empty() ? 0 : model.lods[selected].indexCount;
+        command.instanceCount = drawMeshlets ? 0 : 1;
+        command.firstIndex = model.lods.empty() ? 0 : model.lods[selected].firstIndex;
+        command.vertexOffset = 0;
+        command.firstInstance = static_cast<uint32_t>(i);
+
+        if (!drawMeshlets) {
+            drawnTriangles += command.indexCount / 3;
+        }
+
+        // Meshlet bounds are in the space of the unquantized vertices, which the instance transform maps to the world
+        glm::mat4 modelView = view * instance.transform;
+        glm::mat4 viewToModel;
+        SIMDMath::affineInverse(&modelView, &viewToModel, 1);
+        MeshletCuller culler(proj * modelView, glm::vec3(viewToModel[3]));
+
+        for (const Meshlet& meshlet : model.meshlets) {
+            bool visible = drawMeshlets && culler.inFrustum(meshlet) && (!backfaceCulling || culler.frontFacing(meshlet));
+
+            VkDrawIndexedIndirectCommand& meshletCommand = commands[slot++];
+            meshletCommand.indexCount = meshlet.indexCount;
+            meshletCommand.instanceCount = visible ? 1 : 0;
+            meshletCommand.firstIndex = meshlet.firstIndex;
+            meshletCommand.vertexOffset = 0;
+            meshletCommand.firstInstance = static_cast<uint32_t>(i);
+
+            if (visible) {
+                drawnTriangles += meshlet.indexCount / 3;
+                visibleMeshlets++;
+            }
+        }
+    }
+
+    // On the same schedule as the other stats, the count changes almost every frame under dynamic resolution
+    if (++lodReportFrames == 300) {
+        printf("LOD selection: drawing %llu of %llu triangles, %llu of %llu meshlets visible \n", (unsigned long long)drawnTriangles, (unsigned long long)fullDetailTriangles,
+            (unsigned long long)visibleMeshlets, (unsigned long long)totalMeshlets);
+        lodReportFrames = 0;
+    }
+}
+
+void VulkanRenderer::updateLightClusters(uint32_t imageIndex, const glm::mat4& view, const glm::mat4& proj) {
+    auto start = std::chrono::high_resolution_clock::now();
+    lightClusters.build(pointLights, view, proj, jobSystem, frameArenas.current());
+    auto end = std::chrono::high_resolution_clock::now();
+
+    const std::vector<LightClusters::GPULight>& lights = lightClusters.getLights();
+    const std::vector<glm::uvec2>& clusters = lightClusters.getClusters();
+    const std::vector<uint32_t>& lightIndices = lightClusters.getIndices();
+    // The clusters are laid over the part of the target this frame renders to
+    LightClusters::GPUGrid grid = lightClusters.getGrid(renderExtent.width, renderExtent.height, glm::vec3(pointLights.empty() && !shadowsEnabled && !rayTracedShadowsEnabled ? 1.0f : litAmbient));
+
+    std::memcpy(lightBuffersMapped[imageIndex], lights.data(), lights.size() * sizeof(LightClusters::GPULight));
+    char* clusterData = static_cast<char*>(clusterBuffersMapped[imageIndex]);
+    std::memcpy(clusterData, &grid, sizeof(grid));
+    std::memcpy(clusterData + sizeof(grid), clusters.data(), clusters.size() * sizeof(glm::uvec2));
+    // Clusters have no cap, a list longer than the buffer gets a larger one. The image's last frame has finished, so
+    // its buffer and set can change, the recorded draws bound the old set and are recorded again
+    if (lightIndices.size() > lightIndexCapacity[imageIndex]) {
+        vkDestroyBuffer(device, lightIndexBuffers[imageIndex], nullptr);
+        vkFreeMemory(device, lightIndexBuffersMemory[imageIndex], nullptr);
+        lightIndexCapacity[imageIndex] = lightIndices.size() + lightIndices.size() / 2;
+        VkDeviceSize indexSize = sizeof(uint32_t) * lightIndexCapacity[imageIndex];
+        createBuffer(indexSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            lightIndexBuffers[imageIndex], lightIndexBuffersMemory[imageIndex]);
+        vkMapMemory(device, lightIndexBuffersMemory[imageIndex], 0, indexSize, 0, &lightIndexBuffersMapped[imageIndex]);
+
+        VkDescriptorBufferInfo indexInfo{ lightIndexBuffers[imageIndex], 0, VK_WHOLE_SIZE };
+        VkWriteDescriptorSet write{};
+        write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write.dstSet = descriptorSets[imageIndex];
+        write.dstBinding = 4;
+        write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        write.descriptorCount = 1;
+        write.pBufferInfo = &indexInfo;
+        vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+        commandBufferStale[imageIndex] = true;
+    }
+    std::memcpy(lightIndexBuffersMapped[imageIndex], lightIndices.data(), lightIndices.size() * sizeof(uint32_t));
+
+    if (pointLights.empty()) {
+        return;
+    }
+    lightAssignMs += std::chrono::duration<double, std::milli>(end - start).count();
+    if (++lightReportFrames == 300) {
+        const LightClusters::Stats& stats = lightClusters.getStats();
+        printf("Clustered lighting: %u of %zu point lights in view, %u cluster assignments, %u at most in a cluster, %.3f ms per frame \n",
+            stats.visibleLights, pointLights.size(), stats.assignments, stats.maxClusterLights, lightAssignMs / lightReportFrames);
+        lightReportFrames = 0;
+        lightAssignMs = 0.0;
+    }
 }
 
 void VulkanRenderer::createDescriptorPool() {
-    std::array<VkDescriptorPoolSize, 2> poolSizes{};
+    uint32_t imageCount = static_cast<uint32_t>(SWChainImages.size());
+    std::vector<VkDescriptorPoolSize> poolSizes(3);
     poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    poolSizes[0].descriptorCount = static_cast<uint32_t>(SWChainImages.size());
+    poolSizes[0].descriptorCount = imageCount;
     poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    poolSizes[1].descriptorCount = static_cast<uint32_t>(SWChainImages.size());
+    poolSizes[1].descriptorCount = imageCount * 3;
+    poolSizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[2].descriptorCount = imageCount * 3;
+    uint32_t maxSets = imageCount;
+
+    // Per image, a set for the trace, the accumulation and every filter pass. Each has the parameters, the trace reads
+    // the TLAS and the depth, the accumulation the history, and every pass reads a storage image and writes one
+    if (rayTracedShadowsEnabled) {
+        uint32_t passes = 2 + rayTracedShadows.getSettings().denoiseIterations;
+        poolSizes[0].descriptorCount += imageCount * passes;
+        poolSizes[1].descriptorCount += imageCount * 2;
+        poolSizes.push_back({ VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR, imageCount });
+        poolSizes.push_back({ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, imageCount * (2 * passes - 1) });
+        maxSets += imageCount * passes;
+    }
 
     VkDescriptorPoolCreateInfo poolCInfo{};
     poolCInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
     poolCInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
     poolCInfo.pPoolSizes = poolSizes.data();
-    poolCInfo.maxSets = static_cast<uint32_t>(SWChainImages.size());
+    poolCInfo.maxSets = maxSets;
 
     if (vkCreateDescriptorPool(device, &poolCInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
         std::_Xruntime_error("Failed to create the descriptor pool!");
@@ -1144,6 +2486,8 @@ void VulkanRenderer::createDescriptorSets() {
     if (vkAllocateDescriptorSets(device, &allocateInfo, descriptorSets.data()) != VK_SUCCESS) {
         std::_Xruntime_error("Failed to allocate descriptor sets!");
     }
+    // Written with the texture's current view below
+    textureDescriptorStale.assign(SWChainImages.size(), false);
 
     for (size_t i = 0; i < SWChainImages.size(); i++) {
         VkDescriptorBufferInfo descriptorBufferInfo{};
@@ -1153,10 +2497,20 @@ void VulkanRenderer::createDescriptorSets() {
 
         VkDescriptorImageInfo imageInfo{};
         imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-        imageInfo.imageView = textureImageView;
+        imageInfo.imageView = streamedTextures[0].view;
         imageInfo.sampler = textureSampler;
 
-        std::array<VkWriteDescriptorSet, 2> descriptorWriteSets{};
+        VkDescriptorImageInfo shadowImageInfo{};
+        shadowImageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        shadowImageInfo.imageView = shadowMapImageView;
+        shadowImageInfo.sampler = shadowSampler;
+
+        std::array<VkDescriptorBufferInfo, 3> lightBufferInfos{};
+        lightBufferInfos[0] = { lightBuffers[i], 0, VK_WHOLE_SIZE };
+        lightBufferInfos[1] = { clusterBuffers[i], 0, VK_WHOLE_SIZE };
+        lightBufferInfos[2] = { lightIndexBuffers[i], 0, VK_WHOLE_SIZE };
+
+        std::array<VkWriteDescriptorSet, 7> descriptorWriteSets{};
 
         descriptorWriteSets[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
         descriptorWriteSets[0].dstSet = descriptorSets[i];
@@ -1174,8 +2528,45 @@ void VulkanRenderer::createDescriptorSets() {
         descriptorWriteSets[1].descriptorCount = 1;
         descriptorWriteSets[1].pImageInfo = &imageInfo;
 
+        for (uint32_t binding = 2; binding < 5; binding++) {
+            descriptorWriteSets[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWriteSets[binding].dstSet = descriptorSets[i];
+            descriptorWriteSets[binding].dstBinding = binding;
+            descriptorWriteSets[binding].dstArrayElement = 0;
+            descriptorWriteSets[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            descriptorWriteSets[binding].descriptorCount = 1;
+            descriptorWriteSets[binding].pBufferInfo = &lightBufferInfos[binding - 2];
+        }
+
+        descriptorWriteSets[5].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWriteSets[5].dstSet = descriptorSets[i];
+        descriptorWriteSets[5].dstBinding = 5;
+        descriptorWriteSets[5].dstArrayElement = 0;
+        descriptorWriteSets[5].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        descriptorWriteSets[5].descriptorCount = 1;
+        descriptorWriteSets[5].pImageInfo = &shadowImageInfo;
+
+        descriptorWriteSets[6] = descriptorWriteSets[1];
+        descriptorWriteSets[6].dstBinding = 6;
+
         vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWriteSets.size()), descriptorWriteSets.data(), 0, nullptr);
     }
+
+    if (!rayTracedShadowsEnabled) {
+        return;
+    }
+    uint32_t passes = 2 + rayTracedShadows.getSettings().denoiseIterations;
+    std::vector<VkDescriptorSetLayout> rayTracedLayouts(passes, rayTracedSetLayout);
+    allocateInfo.descriptorSetCount = passes;
+    allocateInfo.pSetLayouts = rayTracedLayouts.data();
+    rayTracedDescriptorSets.resize(SWChainImages.size());
+    for (size_t i = 0; i < SWChainImages.size(); i++) {
+        rayTracedDescriptorSets[i].resize(passes);
+        if (vkAllocateDescriptorSets(device, &allocateInfo, rayTracedDescriptorSets[i].data()) != VK_SUCCESS) {
+            std::_Xruntime_error("Failed to allocate the ray traced descriptor sets!");
+        }
+    }
+    writeRayTracedDescriptors();
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -1208,14 +2599,6 @@ VkFormat VulkanRenderer::findSupportedFormat(const std::vector<VkFormat>& potent
     std::_Xruntime_error("Failed to find a supported format!");
 }
 
-void VulkanRenderer::createDepthResources() {
-    VkFormat depthFormat = findDepthFormat();
-    createImage(SWChainExtent.width, SWChainExtent.height, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depthImage, depthImageMemory);
-    depthImageView = createImageView(depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT);
-
-    transitionImageLayout(depthImage, depthFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
-}
-
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /*
 CREATING THE COMMAND POOL AND BUFFER
@@ -1229,7 +2612,8 @@ void VulkanRenderer::createCommandPool() {
     VkCommandPoolCreateInfo commandPoolCInfo{};
     commandPoolCInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
     commandPoolCInfo.queueFamilyIndex = QFIndices.graphicsFamily.value();
-    commandPoolCInfo.flags = 0;
+    // Command buffers are re-recorded individually when the pipeline is swapped
+    commandPoolCInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 
     // Actual creation of the command buffer
     if (vkCreateCommandPool(device, &commandPoolCInfo, nullptr, &commandPool) != VK_SUCCESS) {
@@ -1238,7 +2622,7 @@ void VulkanRenderer::createCommandPool() {
 }
 
 void VulkanRenderer::createCommandBuffers() {
-    commandBuffers.resize(SWChainFrameBuffers.size());
+    commandBuffers.resize(SWChainImages.size());
 
     // Information to allocate the frame buffer
     VkCommandBufferAllocateInfo CBAllocateInfo{};
@@ -1251,56 +2635,151 @@ void VulkanRenderer::createCommandBuffers() {
         std::_Xruntime_error("Failed to allocate a command buffer!");
     }
 
+    // Every command buffer writes a timestamp when it starts and one when it ends, read back once its image is reused
+    VkPhysicalDeviceProperties properties{};
+    vkGetPhysicalDeviceProperties(GPU, &properties);
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(GPU, &queueFamilyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(GPU, &queueFamilyCount, queueFamilies.data());
+    uint32_t timestampBits = queueFamilies[findQueueFamilies(GPU).graphicsFamily.value()].timestampValidBits;
+
+    timestampQueryPool = VK_NULL_HANDLE;
+    if (timestampBits > 0) {
+        timestampPeriod = properties.limits.timestampPeriod;
+        timestampMask = timestampBits >= 64 ? UINT64_MAX : (uint64_t(1) << timestampBits) - 1;
+
+        VkQueryPoolCreateInfo queryPoolCInfo{};
+        queryPoolCInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        queryPoolCInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        queryPoolCInfo.queryCount = 2 * static_cast<uint32_t>(commandBuffers.size());
+        if (vkCreateQueryPool(device, &queryPoolCInfo, nullptr, &timestampQueryPool) != VK_SUCCESS) {
+            std::_Xruntime_error("Failed to create the timestamp query pool!");
+        }
+    }
+    timestampsPending.assign(commandBuffers.size(), false);
+    recordedScales.assign(commandBuffers.size(), 1.0f);
+
+    overdrawQueryPool = VK_NULL_HANDLE;
+    if (pipelineStatisticsSupported) {
+        VkQueryPoolCreateInfo queryPoolCInfo{};
+        queryPoolCInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        queryPoolCInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+        queryPoolCInfo.queryCount = static_cast<uint32_t>(commandBuffers.size());
+        queryPoolCInfo.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+        if (vkCreateQueryPool(device, &queryPoolCInfo, nullptr, &overdrawQueryPool) != VK_SUCCESS) {
+            std::_Xruntime_error("Failed to create the pipeline statistics query pool!");
+        }
+    }
+    statisticsPending.assign(commandBuffers.size(), false);
+    recordedPrepass.assign(commandBuffers.size(), false);
+    recordedPixels.assign(commandBuffers.size(), 0);
+
     // Start command buffer recording
+    commandBufferStale.assign(commandBuffers.size(), false);
     for (size_t i = 0; i < commandBuffers.size(); i++) {
-        VkCommandBufferBeginInfo CBBeginInfo{};
-        CBBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-        CBBeginInfo.flags = 0;
-        CBBeginInfo.pInheritanceInfo = nullptr;
+        recordCommandBuffer(i);
+    }
+}
 
-        if (vkBeginCommandBuffer(commandBuffers[i], &CBBeginInfo) != VK_SUCCESS) {
-            std::_Xruntime_error("Failed to start recording with the command buffer!");
-        }
+void VulkanRenderer::recordCommandBuffer(size_t i) {
+    VkCommandBufferBeginInfo CBBeginInfo{};
+    CBBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    CBBeginInfo.flags = 0;
+    CBBeginInfo.pInheritanceInfo = nullptr;
 
-        std::array<VkClearValue, 2> clearValues{};
-        clearValues[0].color = { {0.0f, 0.0f, 0.0f, 1.0f} };
-        clearValues[1].depthStencil = { 1.0f, 0 };
+    if (vkBeginCommandBuffer(commandBuffers[i], &CBBeginInfo) != VK_SUCCESS) {
+        std::_Xruntime_error("Failed to start recording with the command buffer!");
+    }
 
-        // Start the render pass
-        VkRenderPassBeginInfo RPBeginInfo{};
-        // Create the render pass
-        RPBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-        RPBeginInfo.renderPass = renderPass;
-        RPBeginInfo.framebuffer = SWChainFrameBuffers[i];
+    uint32_t firstQuery = 2 * static_cast<uint32_t>(i);
+    if (timestampQueryPool) {
+        vkCmdResetQueryPool(commandBuffers[i], timestampQueryPool, firstQuery, 2);
+        vkCmdWriteTimestamp(commandBuffers[i], VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampQueryPool, firstQuery);
+    }
+    if (overdrawQueryPool) {
+        vkCmdResetQueryPool(commandBuffers[i], overdrawQueryPool, static_cast<uint32_t>(i), 1);
+    }
 
-        // Define the size of the render area
-        RPBeginInfo.renderArea.offset = { 0, 0 };
-        RPBeginInfo.renderArea.extent = SWChainExtent;
+    // Only the scaled part of the scene targets is drawn
+    frameGraph.setImportedImage(swapChainTarget, SWChainImages[i], SWChainImageViews[i]);
+    frameGraph.setRenderArea(depthPrepassPass, renderExtent);
+    frameGraph.setRenderArea(scenePass, renderExtent);
+    recordedScales[i] = dynamicResolution.getScale();
+    recordedPrepass[i] = depthPrepassEnabled;
+    recordedPixels[i] = uint64_t(renderExtent.width) * renderExtent.height;
+    frameGraph.execute(commandBuffers[i], static_cast<uint32_t>(i));
+
+    if (timestampQueryPool) {
+        vkCmdWriteTimestamp(commandBuffers[i], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampQueryPool, firstQuery + 1);
+    }
 
-        // Define the clear values to use
-        VkClearValue clearColor = { {{0.0f, 0.0f, 0.0f, 1.0f}} };
-        RPBeginInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());;
-        RPBeginInfo.pClearValues = clearValues.data();
+    if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS) {
+        std::_Xruntime_error("Failed to record back the command buffer!");
+    }
 
-        // Finally, begin the render pass
-        vkCmdBeginRenderPass(commandBuffers[i], &RPBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+    commandBufferStale[i] = false;
+}
 
-        // Bind the graphics pipeline, and instruct it to draw the triangle
-        vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+void VulkanRenderer::recordScenePass(VkCommandBuffer commandBuffer, uint32_t image) {
+    // Bind the graphics pipeline, and instruct it to draw the triangle
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
 
+    // One buffer per binding of the vertex layout
+    if (vertexLayoutType == VertexLayoutType::SplitQuantized) {
+        VkBuffer vertexBuffers[] = { positionBuffer, vertexBuffer };
+        VkDeviceSize offsets[] = { 0, 0 };
+        vkCmdBindVertexBuffers(commandBuffer, 0, 2, vertexBuffers, offsets);
+    }
+    else {
         VkBuffer vertexBuffers[] = { vertexBuffer };
         VkDeviceSize offsets[] = { 0 };
-        vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, vertexBuffers, offsets);
-        vkCmdBindIndexBuffer(commandBuffers[i], indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+        vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+    }
 
-        vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeLineLayout, 0, 1, &descriptorSets[i], 0, nullptr);
-        vkCmdDrawIndexed(commandBuffers[i], static_cast<uint32_t>(loadedModels[0].indices.size()), 1, 0, 0, 0);
+    // Every shaded fragment is counted, with the pre-pass that is one per visible pixel
+    if (overdrawQueryPool) {
+        vkCmdBeginQuery(commandBuffer, overdrawQueryPool, image, 0);
+    }
+    recordIndirectDraws(commandBuffer, image);
+    if (overdrawQueryPool) {
+        vkCmdEndQuery(commandBuffer, overdrawQueryPool, image);
+    }
+}
+
+void VulkanRenderer::recordDepthPrepass(VkCommandBuffer commandBuffer, uint32_t image) {
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, depthPrepassPipeline);
 
-        // After drawing is over, end the render pass
-        vkCmdEndRenderPass(commandBuffers[i]);
+    // Only the positions are fetched, a stream of their own in the split layout
+    VkBuffer positions = vertexLayoutType == VertexLayoutType::SplitQuantized ? positionBuffer : vertexBuffer;
+    VkDeviceSize offset = 0;
+    vkCmdBindVertexBuffers(commandBuffer, 0, 1, &positions, &offset);
 
-        if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS) {
-            std::_Xruntime_error("Failed to record back the command buffer!");
+    recordIndirectDraws(commandBuffer, image);
+}
+
+// Viewport, index buffer, descriptors and draws shared by the pre-pass and the scene pass, the vertex streams are bound
+void VulkanRenderer::recordIndirectDraws(VkCommandBuffer commandBuffer, uint32_t image) {
+    VkViewport viewPort{};
+    viewPort.width = (float)renderExtent.width;
+    viewPort.height = (float)renderExtent.height;
+    viewPort.minDepth = 0.0f;
+    viewPort.maxDepth = 1.0f;
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewPort);
+    VkRect2D scissorRect{ { 0, 0 }, renderExtent };
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissorRect);
+
+    vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeLineLayout, 0, 1, &descriptorSets[image], 0, nullptr);
+    // LODs are chosen per frame, so the draws come from a buffer written after the command buffer was recorded
+    uint32_t drawCount = indirectDrawCount;
+    if (multiDrawIndirectSupported) {
+        vkCmdDrawIndexedIndirect(commandBuffer, indirectBuffers[image], 0, drawCount, sizeof(VkDrawIndexedIndirectCommand));
+    }
+    else {
+        for (uint32_t draw = 0; draw < drawCount; draw++) {
+            vkCmdDrawIndexedIndirect(commandBuffer, indirectBuffers[image], draw * sizeof(VkDrawIndexedIndirectCommand), 1, sizeof(VkDrawIndexedIndirectCommand));
         }
     }
 }
@@ -1337,14 +2816,14 @@ IMAGE TEXTURES
 */
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void VulkanRenderer::createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory) {
+void VulkanRenderer::createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory, uint32_t mipLevels) {
     VkImageCreateInfo imageCInfo{};
     imageCInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
     imageCInfo.imageType = VK_IMAGE_TYPE_2D;
     imageCInfo.extent.width = width;
     imageCInfo.extent.height = height;
     imageCInfo.extent.depth = 1;
-    imageCInfo.mipLevels = 1;
+    imageCInfo.mipLevels = mipLevels;
     imageCInfo.arrayLayers = 1;
 
     imageCInfo.format = format;
@@ -1403,7 +2882,7 @@ void VulkanRenderer::transitionImageLayout(VkImage image, VkFormat format, VkIma
     barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
     barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
     barrier.image = image;
-    if (format == VK_FORMAT_D32_SFLOAT) {
+    if (format == VK_FORMAT_D32_SFLOAT || format == VK_FORMAT_D16_UNORM) {
         barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
     }
     else {
@@ -1440,6 +2919,20 @@ void VulkanRenderer::transitionImageLayout(VkImage image, VkFormat format, VkIma
         sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
         destinationStage = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
     }
+    else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL) {
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+        sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+        destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    }
+    else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+        sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+        destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    }
     else {
         std::_Xinvalid_argument("Unsupported layout transition!");
     }
@@ -1449,37 +2942,107 @@ void VulkanRenderer::transitionImageLayout(VkImage image, VkFormat format, VkIma
     endSingleTimeCommands(commandBuffer);
 }
 
-void VulkanRenderer::createTextureImage() {
-    int textureWidth, textureHeight, texChannels;
-    stbi_uc* pixels = stbi_load(TEXTURE_PATH.c_str(), &textureWidth, &textureHeight, &texChannels, STBI_rgb_alpha);
-    VkDeviceSize currentImageSize = textureWidth * textureHeight * 4;
+// Copy of one level from staging memory, levels are numbered from the first one the image holds
+static VkBufferImageCopy mipCopyRegion(uint32_t level, VkDeviceSize offset, uint32_t width, uint32_t height) {
+    VkBufferImageCopy region{};
+    region.bufferOffset = offset;
+    region.bufferRowLength = 0;
+    region.bufferImageHeight = 0;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = level;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageOffset = { 0, 0, 0 };
+    region.imageExtent = { width, height, 1 };
+    return region;
+}
 
-    if (!pixels) {
-        std::_Xruntime_error("Failed to load the texture image!");
+void VulkanRenderer::createTextureImage() {
+    std::vector<std::string> paths = { TEXTURE_PATH };
+    streamedTextures.resize(paths.size());
+
+    // Cooked textures are mapped and their levels copied out as they are, the rest are decoded
+    std::vector<TextureImporter::Image> images;
+    std::vector<uint32_t> imageTextures;
+    uint32_t cookedCount = 0;
+    for (uint32_t i = 0; i < paths.size(); i++) {
+        std::unique_ptr<CookedMipSource> cooked = CookedMipSource::open(CookedTexture::cookedPath(COOKED_TEXTURE_PATH, paths[i]));
+        if (cooked && (cooked->getFormat() == VK_FORMAT_R8G8B8A8_SRGB || textureCompressionBCSupported)) {
+            streamedTextures[i].source = std::move(cooked);
+            // Only the tail is read before the first frame, or every level when the texture is not streamed
+            startTextureUpload(i, textureStreamingEnabled ? streamedTextures[i].source->getTailMip(textureTailSize) : 0, false, false);
+            finishTextureUpload(textureUploads.back());
+            textureUploads.pop_back();
+            if (!textureStreamingEnabled) {
+                streamedTextures[i].source.reset();
+            }
+            cookedCount++;
+            continue;
+        }
+        images.push_back(TextureImporter::Image());
+        images.back().path = paths[i];
+        imageTextures.push_back(i);
     }
 
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    createBuffer(currentImageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
-
-    void* data;
-    vkMapMemory(device, stagingBufferMemory, 0, currentImageSize, 0, &data);
-    memcpy(data, pixels, static_cast<size_t>(currentImageSize));
-    vkUnmapMemory(device, stagingBufferMemory);
-
-    stbi_image_free(pixels);
-
-    createImage(textureWidth, textureHeight, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImage, textureImageMemory);
-
-    transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-    copyBufferToImage(stagingBuffer, textureImage, static_cast<uint32_t>(textureWidth), static_cast<uint32_t>(textureHeight));
-    transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    // Decoded on the job system, every texture is uploaded as soon as it is decoded while the rest still decode
+    TextureImporter::Stats stats;
+    if (textureStreamingEnabled) {
+        // The chains stay in memory as the sources of the streamed levels, only the tails are uploaded now
+        std::vector<std::vector<uint8_t>> chains(images.size());
+        stats = TextureImporter::import(images, true, jobSystem, [&](size_t index, const TextureImporter::Image& image) {
+            chains[index].resize(image.size);
+            return static_cast<void*>(chains[index].data());
+        }, [&](size_t index) {
+            if (!images[index].ok) {
+                std::_Xruntime_error("Failed to load the texture image!");
+            }
+            uint32_t texture = imageTextures[index];
+            streamedTextures[texture].source = std::make_unique<ImageMipSource>(images[index], std::move(chains[index]));
+            startTextureUpload(texture, streamedTextures[texture].source->getTailMip(textureTailSize), false, false);
+            finishTextureUpload(textureUploads.back());
+            textureUploads.pop_back();
+        });
+
+        // Added in texture order, so residency ids are texture indices whatever order the decodes finished in
+        for (StreamedTexture& texture : streamedTextures) {
+            std::vector<VkDeviceSize> mipSizes;
+            for (uint32_t level = 0; level < texture.source->getMipCount(); level++) {
+                mipSizes.push_back(texture.source->getMipSize(level));
+            }
+            texture.residencyId = textureResidency.addTexture(mipSizes, texture.baseMip);
+        }
+    }
+    else {
+        // Whole chains decoded straight into mapped staging memory, nothing is kept once they are uploaded
+        std::vector<TextureUpload> uploads(images.size());
+        stats = TextureImporter::import(images, true, jobSystem, [&](size_t index, const TextureImporter::Image& image) {
+            TextureUpload& upload = uploads[index];
+            upload.texture = imageTextures[index];
+            upload.baseMip = 0;
+            upload.load = false;
+            upload.format = VK_FORMAT_R8G8B8A8_SRGB;
+            upload.state = std::make_shared<std::atomic<int>>(0);
+            for (uint32_t level = 0; level < image.mipOffsets.size(); level++) {
+                upload.regions.push_back(mipCopyRegion(level, image.mipOffsets[level], std::max(image.width >> level, 1u), std::max(image.height >> level, 1u)));
+            }
+            createBuffer(image.size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, upload.stagingBuffer, upload.stagingMemory);
+            void* mapped;
+            vkMapMemory(device, upload.stagingMemory, 0, image.size, 0, &mapped);
+            return mapped;
+        }, [&](size_t index) {
+            if (!images[index].ok) {
+                std::_Xruntime_error("Failed to load the texture image!");
+            }
+            uploads[index].state->store(1);
+            finishTextureUpload(uploads[index]);
+        });
+    }
 
-    vkDestroyBuffer(device, stagingBuffer, nullptr);
-    vkFreeMemory(device, stagingBufferMemory, nullptr);
+    printf("Textures: %u cooked, %zu decoded in %.2f ms on %u threads, %.1f MB/s \n", cookedCount, stats.images, stats.milliseconds, stats.threads,
+        stats.milliseconds > 0.0 ? stats.decodedBytes / (1024.0 * 1024.0) / (stats.milliseconds / 1000.0) : 0.0);
 }
 
-VkImageView VulkanRenderer::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags) {
+VkImageView VulkanRenderer::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t levelCount) {
     VkImageViewCreateInfo imageViewCInfo{};
     imageViewCInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
     imageViewCInfo.image = image;
@@ -1487,7 +3050,7 @@ VkImageView VulkanRenderer::createImageView(VkImage image, VkFormat format, VkIm
     imageViewCInfo.format = format;
     imageViewCInfo.subresourceRange.aspectMask = aspectFlags;
     imageViewCInfo.subresourceRange.baseMipLevel = 0;
-    imageViewCInfo.subresourceRange.levelCount = 1;
+    imageViewCInfo.subresourceRange.levelCount = levelCount;
     imageViewCInfo.subresourceRange.baseArrayLayer = 0;
     imageViewCInfo.subresourceRange.layerCount = 1;
 
@@ -1499,10 +3062,6 @@ VkImageView VulkanRenderer::createImageView(VkImage image, VkFormat format, VkIm
     return tempImageView;
 }
 
-void VulkanRenderer::createTextureImageView() {
-    textureImageView = createImageView(textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT);
-}
-
 void VulkanRenderer::createTextureImageSampler() {
     VkSamplerCreateInfo samplerCInfo{};
     samplerCInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
@@ -1523,7 +3082,8 @@ void VulkanRenderer::createTextureImageSampler() {
     samplerCInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
     samplerCInfo.mipLodBias = 0.0f;
     samplerCInfo.minLod = 0.0f;
-    samplerCInfo.maxLod = 0.0f;
+    // Views start at the finest resident level, so every level they have is sampled
+    samplerCInfo.maxLod = VK_LOD_CLAMP_NONE;
 
     if (vkCreateSampler(device, &samplerCInfo, nullptr, &textureSampler) != VK_SUCCESS) {
         std::_Xruntime_error("Failed to create the texture sampler!");
@@ -1532,24 +3092,245 @@ void VulkanRenderer::createTextureImageSampler() {
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /*
-SWAPCHAIN RECREATION
+TEXTURE STREAMING
 */
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void VulkanRenderer::cleanupSWChain() {
-    vkDestroyImageView(device, depthImageView, nullptr);
-    vkDestroyImage(device, depthImage, nullptr);
-    vkFreeMemory(device, depthImageMemory, nullptr);
+void VulkanRenderer::startTextureUpload(uint32_t texture, uint32_t baseMip, bool load, bool async) {
+    const MipSource* source = streamedTextures[texture].source.get();
+
+    TextureUpload upload;
+    upload.texture = texture;
+    upload.baseMip = baseMip;
+    upload.load = load;
+    upload.format = source->getFormat();
+    upload.state = std::make_shared<std::atomic<int>>(0);
+
+    // Levels back to back, each on a 16 byte boundary so block compressed sources copy as they are
+    VkDeviceSize size = 0;
+    for (uint32_t level = baseMip; level < source->getMipCount(); level++) {
+        upload.regions.push_back(mipCopyRegion(level - baseMip, size, source->getMipWidth(level), source->getMipHeight(level)));
+        size = (size + source->getMipSize(level) + 15) / 16 * 16;
+    }
+    createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, upload.stagingBuffer, upload.stagingMemory);
+
+    void* mapped;
+    vkMapMemory(device, upload.stagingMemory, 0, size, 0, &mapped);
+    // Reads straight into the mapped memory, only the source and the mapping are touched off the calling thread
+    std::vector<std::pair<uint32_t, VkDeviceSize>> levels;
+    for (const VkBufferImageCopy& region : upload.regions) {
+        levels.push_back({ baseMip + region.imageSubresource.mipLevel, region.bufferOffset });
+    }
+    std::shared_ptr<std::atomic<int>> state = upload.state;
+    auto read = [source, mapped, levels, state]() {
+        bool ok = true;
+        for (const auto& level : levels) {
+            ok &= source->readMip(level.first, static_cast<uint8_t*>(mapped) + level.second);
+        }
+        state->store(ok ? 1 : 2, std::memory_order_release);
+    };
+
+    if (async && jobSystem) {
+        jobSystem->submit(read);
+    }
+    else {
+        read();
+    }
+    textureUploads.push_back(std::move(upload));
+}
+
+void VulkanRenderer::finishTextureUpload(TextureUpload& upload) {
+    vkUnmapMemory(device, upload.stagingMemory);
+    if (upload.state->load(std::memory_order_acquire) != 1) {
+        std::_Xruntime_error("Failed to read the levels of a streamed texture!");
+    }
+
+    StreamedTexture& texture = streamedTextures[upload.texture];
+    VkFormat format = upload.format;
+    uint32_t levelCount = static_cast<uint32_t>(upload.regions.size());
+
+    VkImage image;
+    VkDeviceMemory memory;
+    createImage(upload.regions[0].imageExtent.width, upload.regions[0].imageExtent.height, format, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, memory, levelCount);
+
+    // Every level goes to transfer, is copied and is made readable in one submission
+    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, levelCount, 0, 1 };
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    vkCmdCopyBufferToImage(commandBuffer, upload.stagingBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, levelCount, upload.regions.data());
+
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+    endSingleTimeCommands(commandBuffer);
+
+    vkDestroyBuffer(device, upload.stagingBuffer, nullptr);
+    vkFreeMemory(device, upload.stagingMemory, nullptr);
+
+    // Descriptor sets of the other swap chain images keep the old view until their image comes up again
+    if (texture.image != VK_NULL_HANDLE) {
+        retiredImages.push_back({ texture.image, texture.view, texture.memory, frameCount + SWChainImages.size() + MAX_FRAMES_IN_FLIGHT });
+    }
+    texture.image = image;
+    texture.memory = memory;
+    texture.view = createImageView(image, format, VK_IMAGE_ASPECT_COLOR_BIT, levelCount);
+    texture.baseMip = upload.baseMip;
+    std::fill(textureDescriptorStale.begin(), textureDescriptorStale.end(), true);
+
+    if (upload.load) {
+        textureResidency.completeLoad(texture.residencyId);
+    }
+}
+
+void VulkanRenderer::updateTextureStreaming(uint32_t currentImage, const glm::mat4& view, const glm::mat4& proj) {
+    if (streamedTextures.empty()) {
+        return;
+    }
+
+    // The image's last frame has finished, so its set can point at the newest view. The recorded draws bound the set
+    // as it was, they are recorded again
+    if (textureDescriptorStale[currentImage]) {
+        VkDescriptorImageInfo imageInfo{ textureSampler, streamedTextures[0].view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+        std::array<VkWriteDescriptorSet, 2> writes{};
+        for (uint32_t i = 0; i < writes.size(); i++) {
+            writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writes[i].dstSet = descriptorSets[currentImage];
+            writes[i].dstBinding = i == 0 ? 1 : 6;
+            writes[i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            writes[i].descriptorCount = 1;
+            writes[i].pImageInfo = &imageInfo;
+        }
+        // Binding 6 holds the ray traced shadows while they are on
+        vkUpdateDescriptorSets(device, rayTracedShadowsEnabled ? 1 : 2, writes.data(), 0, nullptr);
+        textureDescriptorStale[currentImage] = false;
+        commandBufferStale[currentImage] = true;
+    }
+
+    // Every model samples the scene texture, it wants the level whose texels match the largest visible instance on
+    // screen. The instance's bounding sphere stands in for the extent of its UVs
+    float pixelsPerUnit = std::abs(proj[1][1]) * 0.5f * static_cast<float>(renderExtent.height);
+    float screenPixels = 0.0f;
+    for (uint32_t i : visibleInstances) {
+        const OBJInstance& instance = instances[i];
+        const Model& model = loadedModels[instance.index];
+        float scale = std::max(glm::length(glm::vec3(instance.transform[0])),
+            std::max(glm::length(glm::vec3(instance.transform[1])), glm::length(glm::vec3(instance.transform[2]))));
+        glm::vec4 center = view * instance.transform * glm::vec4(model.boundsCenter, 1.0f);
+        float distance = std::max(glm::length(glm::vec3(center)) - model.boundsRadius * scale, 1e-3f);
+        screenPixels = std::max(screenPixels, 2.0f * model.boundsRadius * scale * pixelsPerUnit / distance);
+    }
+    if (!visibleInstances.empty() && streamedTextures[0].source) {
+        const MipSource& source = *streamedTextures[0].source;
+        uint32_t mip = TextureResidency::mipForScreenSize(source.getWidth(), source.getHeight(), screenPixels, source.getMipCount());
+        textureResidency.request(streamedTextures[0].residencyId, mip, frameCount);
+    }
+
+    // Residency ids are texture indices, textures are added in the same order
+    LinearArena& arena = frameArenas.current();
+    for (const TextureResidency::Change& change : textureResidency.update(frameCount, arena)) {
+        startTextureUpload(change.texture, change.residentMip, change.kind == TextureResidency::Change::Kind::Load, true);
+    }
+
+    // Uploads read by now are copied, one still reading holds back the later ones of its texture
+    FrameVector<uint8_t> blocked(streamedTextures.size(), 0, FrameAllocator<uint8_t>(arena));
+    for (size_t i = 0; i < textureUploads.size();) {
+        TextureUpload& upload = textureUploads[i];
+        if (blocked[upload.texture] || upload.state->load(std::memory_order_acquire) == 0) {
+            blocked[upload.texture] = 1;
+            i++;
+            continue;
+        }
+        finishTextureUpload(upload);
+        textureUploads.erase(textureUploads.begin() + i);
+    }
+}
+
+void VulkanRenderer::destroyRetiredImages() {
+    for (size_t i = 0; i < retiredImages.size();) {
+        if (retiredImages[i].retireFrame <= frameCount) {
+            vkDestroyImageView(device, retiredImages[i].view, nullptr);
+            vkDestroyImage(device, retiredImages[i].image, nullptr);
+            vkFreeMemory(device, retiredImages[i].memory, nullptr);
+            retiredImages[i] = retiredImages.back();
+            retiredImages.pop_back();
+        }
+        else {
+            i++;
+        }
+    }
+}
+
+void VulkanRenderer::destroyTextureStreaming() {
+    // Reads still running write into staging memory that is about to be freed
+    if (jobSystem) {
+        jobSystem->waitIdle();
+    }
+    for (TextureUpload& upload : textureUploads) {
+        vkUnmapMemory(device, upload.stagingMemory);
+        vkDestroyBuffer(device, upload.stagingBuffer, nullptr);
+        vkFreeMemory(device, upload.stagingMemory, nullptr);
+    }
+    textureUploads.clear();
 
-    for (size_t i = 0; i < SWChainFrameBuffers.size(); i++) {
-        vkDestroyFramebuffer(device, SWChainFrameBuffers[i], nullptr);
+    for (const RetiredImage& retired : retiredImages) {
+        vkDestroyImageView(device, retired.view, nullptr);
+        vkDestroyImage(device, retired.image, nullptr);
+        vkFreeMemory(device, retired.memory, nullptr);
     }
+    retiredImages.clear();
+    for (StreamedTexture& texture : streamedTextures) {
+        vkDestroyImageView(device, texture.view, nullptr);
+        vkDestroyImage(device, texture.image, nullptr);
+        vkFreeMemory(device, texture.memory, nullptr);
+    }
+    streamedTextures.clear();
+    vkDestroySampler(device, textureSampler, nullptr);
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+SWAPCHAIN RECREATION
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void VulkanRenderer::cleanupSWChain() {
+    // Scene targets, their memory, the render passes and framebuffers. A shader reload build may still be using the
+    // render passes and layouts, which then wait for its lease
+    frameGraph.destroy(pipelineStateLeases > 0 ? &leasedRenderPasses : nullptr);
 
     vkFreeCommandBuffers(device, commandPool, static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
+    vkDestroyQueryPool(device, timestampQueryPool, nullptr);
+    vkDestroyQueryPool(device, overdrawQueryPool, nullptr);
 
     vkDestroyPipeline(device, graphicsPipeline, nullptr);
-    vkDestroyPipelineLayout(device, pipeLineLayout, nullptr);
-    vkDestroyRenderPass(device, renderPass, nullptr);
+    vkDestroyPipeline(device, depthPrepassPipeline, nullptr);
+    vkDestroyPipeline(device, shadowPipeline, nullptr);
+    vkDestroyPipeline(device, rayTracePipeline, nullptr);
+    vkDestroyPipeline(device, rayAccumulatePipeline, nullptr);
+    vkDestroyPipeline(device, rayDenoisePipeline, nullptr);
+    retirePipelineLayout(pipeLineLayout);
+    retirePipelineLayout(shadowPipelineLayout);
+
+    // The history is sized for the trace at the swap chain size, the next frame graph makes a new one
+    vkDestroyImageView(device, rayTracedHistoryImageView, nullptr);
+    vkDestroyImage(device, rayTracedHistoryImage, nullptr);
+    vkFreeMemory(device, rayTracedHistoryImageMemory, nullptr);
+    rayTracedHistoryImageView = VK_NULL_HANDLE;
+    rayTracedHistoryImage = VK_NULL_HANDLE;
+    rayTracedHistoryImageMemory = VK_NULL_HANDLE;
 
     for (size_t i = 0; i < SWChainImageViews.size(); i++) {
         vkDestroyImageView(device, SWChainImageViews[i], nullptr);
@@ -1560,28 +3341,137 @@ void VulkanRenderer::cleanupSWChain() {
     for (size_t i = 0; i < SWChainImages.size(); i++) {
         vkDestroyBuffer(device, uniformBuffers[i], nullptr);
         vkFreeMemory(device, uniformBuffersMemory[i], nullptr);
+        vkDestroyBuffer(device, indirectBuffers[i], nullptr);
+        vkFreeMemory(device, indirectBuffersMemory[i], nullptr);
+        vkDestroyBuffer(device, shadowIndirectBuffers[i], nullptr);
+        vkFreeMemory(device, shadowIndirectBuffersMemory[i], nullptr);
+        vkDestroyBuffer(device, lightBuffers[i], nullptr);
+        vkFreeMemory(device, lightBuffersMemory[i], nullptr);
+        vkDestroyBuffer(device, clusterBuffers[i], nullptr);
+        vkFreeMemory(device, clusterBuffersMemory[i], nullptr);
+        vkDestroyBuffer(device, lightIndexBuffers[i], nullptr);
+        vkFreeMemory(device, lightIndexBuffersMemory[i], nullptr);
+    }
+    for (size_t i = 0; i < rayTracedUniformBuffers.size(); i++) {
+        vkDestroyBuffer(device, rayTracedUniformBuffers[i], nullptr);
+        vkFreeMemory(device, rayTracedUniformBuffersMemory[i], nullptr);
     }
+    rayTracedUniformBuffers.clear();
+    rayTracedDescriptorSets.clear();
+    vkDestroyBuffer(device, staticShadowIndirectBuffer, nullptr);
+    vkFreeMemory(device, staticShadowIndirectBufferMemory, nullptr);
 
     vkDestroyDescriptorPool(device, descriptorPool, nullptr);
 }
 
 void VulkanRenderer::recreateSwapChain(SDL_Window* window) {
+    // A reload build only holds the lock while it copies the state, the handles it copied are parked by cleanupSWChain
+    std::lock_guard<std::mutex> lock(pipelineStateMutex);
+    pipelineStateGeneration++;
     vkDeviceWaitIdle(device);
 
     cleanupSWChain();
 
     createSWChain(window);
     createImageViews();
-    createRenderPass();
+    createFrameGraph();
     createGraphicsPipeline();
-    createDepthResources();
-    createFrameBuffer();
     createUniformBuffers();
+    createIndirectBuffers();
+    createLightBuffers();
     createDescriptorPool();
     createDescriptorSets();
     createCommandBuffers();
 }
 
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+DYNAMIC RESOLUTION
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void VulkanRenderer::updateDynamicResolution(uint32_t imageIndex) {
+    if (!timestampQueryPool || !timestampsPending[imageIndex]) {
+        return;
+    }
+
+    // The image's last frame has finished by now, results the driver has not made available yet are skipped rather than waited on
+    uint64_t timestamps[2];
+    VkResult result = vkGetQueryPoolResults(device, timestampQueryPool, 2 * imageIndex, 2, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    if (result != VK_SUCCESS) {
+        return;
+    }
+    timestampsPending[imageIndex] = false;
+    lastGpuFrameMs = static_cast<float>(((timestamps[1] - timestamps[0]) & timestampMask) * static_cast<double>(timestampPeriod) * 1e-6);
+
+    if (!dynamicResolutionEnabled || !renderTargetBlit) {
+        return;
+    }
+    if (dynamicResolution.addFrameTime(lastGpuFrameMs, recordedScales[imageIndex])) {
+        // The render target keeps its size, the command buffers only need the new viewport and blit region
+        renderExtent = { dynamicResolution.scaledSize(SWChainExtent.width), dynamicResolution.scaledSize(SWChainExtent.height) };
+        std::fill(commandBufferStale.begin(), commandBufferStale.end(), true);
+        printf("Render scale %.2f, %ux%u, GPU frame %.2f ms \n", dynamicResolution.getScale(), renderExtent.width, renderExtent.height, lastGpuFrameMs);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+/*
+DEPTH PRE-PASS
+*/
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void VulkanRenderer::updateDepthPrepass(uint32_t imageIndex) {
+    if (!overdrawQueryPool || !statisticsPending[imageIndex]) {
+        return;
+    }
+    // The selector decides on the GPU time, which updateDynamicResolution has just read for this image when available.
+    // Without it the frame is skipped, the image's next frame brings both
+    if (timestampQueryPool && timestampsPending[imageIndex]) {
+        return;
+    }
+
+    uint64_t fragments = 0;
+    VkResult result = vkGetQueryPoolResults(device, overdrawQueryPool, imageIndex, 1, sizeof(fragments), &fragments, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    if (result != VK_SUCCESS) {
+        return;
+    }
+    statisticsPending[imageIndex] = false;
+
+    if (!depthPrepassAuto) {
+        return;
+    }
+    depthPrepassSelector.addFrame(fragments, recordedPixels[imageIndex], timestampQueryPool ? lastGpuFrameMs : 0.0f, recordedPrepass[imageIndex]);
+    // Also catches a reset for a new scene, which goes back to measuring without the pre-pass
+    if (depthPrepassSelector.usePrepass() != depthPrepassEnabled) {
+        setDepthPrepass(depthPrepassSelector.usePrepass());
+        if (depthPrepassSelector.getPhase() == DepthPrepassSelector::Phase::Decided) {
+            printf("Depth pre-pass %s, overdraw %.2f, %.3f ms/Mpx without %.3f with \n", depthPrepassEnabled ? "on" : "off", depthPrepassSelector.getOverdraw(),
+                depthPrepassSelector.getMillisecondsWithout(), depthPrepassSelector.getMillisecondsWith());
+        }
+    }
+}
+
+void VulkanRenderer::setDepthPrepass(bool enabled) {
+    // A reload build against the render passes about to be replaced keeps them parked, and is dropped when it finishes
+    std::lock_guard<std::mutex> lock(pipelineStateMutex);
+    pipelineStateGeneration++;
+    vkDeviceWaitIdle(device);
+    depthPrepassEnabled = enabled;
+
+    // The scene pass changes its depth access and the pre-pass comes or goes, so the graph is compiled again and the
+    // pipelines follow its render passes
+    vkDestroyPipeline(device, graphicsPipeline, nullptr);
+    vkDestroyPipeline(device, depthPrepassPipeline, nullptr);
+    vkDestroyPipeline(device, shadowPipeline, nullptr);
+    frameGraph.destroy(pipelineStateLeases > 0 ? &leasedRenderPasses : nullptr);
+    createFrameGraph();
+    createScenePipelines();
+    writeRayTracedDescriptors();
+
+    std::fill(commandBufferStale.begin(), commandBufferStale.end(), true);
+}
+
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 /*
@@ -1593,6 +3483,7 @@ void VulkanRenderer::initializeRT() {
     VkPhysicalDeviceProperties2 deviceProps2{};
     deviceProps2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
     deviceProps2.pNext = &physicalDeviceRTProperties;
+    physicalDeviceRTProperties.pNext = &physicalDeviceIDProperties;
     vkGetPhysicalDeviceProperties2(GPU, &deviceProps2);
 }
 
@@ -1605,17 +3496,18 @@ VkDeviceAddress VulkanRenderer::getDeviceAddress(VkBuffer buffer) {
 }
 
 VulkanRenderer::BLASInput VulkanRenderer::BLASObjectToGeometry(Model model) {
-    VkDeviceAddress vertexBufferAddress = getDeviceAddress(vertexBuffer);
+    // The build only reads positions, which have a buffer of their own in the split layout
+    VkDeviceAddress vertexBufferAddress = getDeviceAddress(vertexLayoutType == VertexLayoutType::SplitQuantized ? positionBuffer : vertexBuffer);
     VkDeviceAddress indexBufferAddress = getDeviceAddress(indexBuffer);
 
-    // Assuming trianlges, divide indices by 3
-    uint32_t maxNumPrimitives = model.totalIndices / 3;
+    // Ray tracing always uses the full detail mesh, the first LOD range of the index buffer
+    uint32_t maxNumPrimitives = model.lods[0].indexCount / 3;
 
     VkAccelerationStructureGeometryTrianglesDataKHR triangles{};
     triangles.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR;
-    triangles.vertexFormat = VK_FORMAT_R32G32B32_SFLOAT;
+    triangles.vertexFormat = vertexLayout.positionFormat;
     triangles.vertexData.deviceAddress = vertexBufferAddress;
-    triangles.vertexStride = sizeof(Vertex);
+    triangles.vertexStride = vertexLayout.positionStride;
 
     triangles.indexType = VK_INDEX_TYPE_UINT32;
     triangles.indexData.deviceAddress = indexBufferAddress;
@@ -1644,22 +3536,14 @@ bool hasFlag(VkBuildAccelerationStructureFlagsKHR flags, VkBuildAccelerationStru
     return (flags && bitFlag != 0);
 }
 
-void VulkanRenderer::CMDCreateBLAS(std::vector<uint32_t> indices, VkDeviceAddress scratchBufferAddress) {
+void VulkanRenderer::CMDCreateBLAS(const FrameVector<uint32_t>& indices, VkDeviceAddress scratchBufferAddress) {
     if (queryPool) {
         vkResetQueryPool(device, queryPool, 0, static_cast<uint32_t>(indices.size()));
     }
     uint32_t queryCount = 0;
 
     for (const auto& index : indices) {
-        VkAccelerationStructureCreateInfoKHR accelStructureCInfo{};
-        accelStructureCInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
-        accelStructureCInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
-        accelStructureCInfo.size = buildAS[index].sizeInfo.accelerationStructureSize;
-
-        createBuffer(accelStructureCInfo.size, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, tempBuffer, tempBufferMemory);
-
-        accelStructureCInfo.buffer = tempBuffer;
-        vkCreateAccelerationStructureKHR(device, &accelStructureCInfo, nullptr, &buildAS[index].accelStructure);
+        buildAS[index].allocation = createPooledAccelerationStructure(VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR, buildAS[index].sizeInfo.accelerationStructureSize, buildAS[index].accelStructure);
 
         buildAS[index].buildInfo.dstAccelerationStructure = buildAS[index].accelStructure;
         buildAS[index].buildInfo.flags = VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_COMPACTION_BIT_KHR;
@@ -1686,39 +3570,67 @@ void VulkanRenderer::CMDCreateBLAS(std::vector<uint32_t> indices, VkDeviceAddres
 }
 
 
-void VulkanRenderer::CMDCompactBLAS(std::vector<uint32_t> indices) {
+void VulkanRenderer::CMDCompactBLAS(const FrameVector<uint32_t>& indices) {
     uint32_t queryCount = 0;
 
-    std::vector<VkDeviceSize> compactSizes(static_cast<uint32_t>(indices.size()));
-    vkGetQueryPoolResults(device, queryPool, 0, (uint32_t)compactSizes.size(), compactSizes.size() * sizeof(VkDeviceSize), compactSizes.data(), sizeof(VkDeviceSize), VK_QUERY_RESULT_WAIT_BIT);
+    ArenaScope scope(frameArenas.current());
+    FrameVector<VkDeviceSize> compactSizes(indices.size(), FrameAllocator<VkDeviceSize>(frameArenas.current()));
+    vkGetQueryPoolResults(device, queryPool, 0, (uint32_t)compactSizes.size(), compactSizes.size() * sizeof(VkDeviceSize), compactSizes.data(), sizeof(VkDeviceSize), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
 
     for (auto index : indices) {
-        buildAS[index].prevStructure = buildAS[index].buildInfo.dstAccelerationStructure;
-        buildAS[index].accelStructure = VK_NULL_HANDLE;
+        VkAccelerationStructureKHR uncompacted = buildAS[index].buildInfo.dstAccelerationStructure;
+        AccelerationStructurePool::Allocation uncompactedAllocation = buildAS[index].allocation;
         buildAS[index].sizeInfo.accelerationStructureSize = compactSizes[queryCount++];
 
-        // Creating a compact version of the AS
-        VkAccelerationStructureCreateInfoKHR accelStructureCInfo{};
-        accelStructureCInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
-        accelStructureCInfo.size = buildAS[index].sizeInfo.accelerationStructureSize;
-        accelStructureCInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR;
-
-        createBuffer(accelStructureCInfo.size, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, tempBuffer2, tempBufferMemory2);
-
-        accelStructureCInfo.buffer = tempBuffer;
-        vkCreateAccelerationStructureKHR(device, &accelStructureCInfo, nullptr, &buildAS[index].accelStructure);
+        // Creating a compact version of the AS, the best fit puts it in a hole left by an earlier uncompacted one
+        buildAS[index].allocation = createPooledAccelerationStructure(VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR, buildAS[index].sizeInfo.accelerationStructureSize, buildAS[index].accelStructure);
 
         VkCopyAccelerationStructureInfoKHR copyInfo{};
         copyInfo.sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_INFO_KHR;
-        copyInfo.src = buildAS[index].buildInfo.dstAccelerationStructure;
+        copyInfo.src = uncompacted;
         copyInfo.dst = buildAS[index].accelStructure;
         copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_COMPACT_KHR;
         VkCommandBuffer cmdBuffer1 = beginSingleTimeCommands();
         vkCmdCopyAccelerationStructureKHR(cmdBuffer1, &copyInfo);
         endSingleTimeCommands(cmdBuffer1);
-        vkDestroyBuffer(device, tempBuffer, nullptr);
-        vkDestroyBuffer(device, tempBuffer2, nullptr);
+
+        // The copy has finished, so the uncompacted range goes back to the pool for the structures after it
+        vkDestroyAccelerationStructureKHR(device, uncompacted, nullptr);
+        accelerationStructurePool.free(uncompactedAllocation);
+    }
+}
+
+AccelerationStructurePool::Allocation VulkanRenderer::createPooledAccelerationStructure(VkAccelerationStructureTypeKHR type, VkDeviceSize size, VkAccelerationStructureKHR& accelStructure) {
+    AccelerationStructurePool::Allocation allocation = accelerationStructurePool.allocate(size);
+    while (accelerationStructurePoolBuffers.size() < accelerationStructurePool.getBlockCount()) {
+        uint32_t block = static_cast<uint32_t>(accelerationStructurePoolBuffers.size());
+        VkBuffer buffer;
+        VkDeviceMemory memory;
+        createBuffer(accelerationStructurePool.getBlockSize(block), VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, memory);
+        accelerationStructurePoolBuffers.push_back(buffer);
+        accelerationStructurePoolMemory.push_back(memory);
     }
+
+    VkAccelerationStructureCreateInfoKHR accelStructureCInfo{};
+    accelStructureCInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
+    accelStructureCInfo.type = type;
+    accelStructureCInfo.buffer = accelerationStructurePoolBuffers[allocation.block];
+    accelStructureCInfo.offset = allocation.offset;
+    accelStructureCInfo.size = size;
+    if (vkCreateAccelerationStructureKHR(device, &accelStructureCInfo, nullptr, &accelStructure) != VK_SUCCESS) {
+        std::_Xruntime_error("Failed to create an acceleration structure!");
+    }
+    return allocation;
+}
+
+void VulkanRenderer::destroyAccelerationStructurePool() {
+    for (size_t i = 0; i < accelerationStructurePoolBuffers.size(); i++) {
+        vkDestroyBuffer(device, accelerationStructurePoolBuffers[i], nullptr);
+        vkFreeMemory(device, accelerationStructurePoolMemory[i], nullptr);
+    }
+    accelerationStructurePoolBuffers.clear();
+    accelerationStructurePoolMemory.clear();
+    accelerationStructurePool.clear();
 }
 
 void VulkanRenderer::buildBlas(const std::vector<BLASInput>& input, VkBuildAccelerationStructureFlagsKHR flags) {
@@ -1727,6 +3639,10 @@ void VulkanRenderer::buildBlas(const std::vector<BLASInput>& input, VkBuildAccel
     uint32_t numCompactions{ 0 };
     VkDeviceSize maxScratchSize{ 0 };
 
+    // All the bookkeeping below is scratch, so it comes from the frame arena and is released in one go on return
+    LinearArena& arena = frameArenas.current();
+    ArenaScope scope(arena);
+
     buildAS.resize(numBlas);
     for (int i = 0; i < numBlas; i++) {
         buildAS[i].sizeInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
@@ -1739,7 +3655,7 @@ void VulkanRenderer::buildBlas(const std::vector<BLASInput>& input, VkBuildAccel
 
         buildAS[i].rangeInfo = input[i].offsetData.data();
 
-        std::vector<uint32_t> maxPrimitiveCount(input[i].offsetData.size());
+        FrameVector<uint32_t> maxPrimitiveCount(input[i].offsetData.size(), FrameAllocator<uint32_t>(arena));
         for (auto j = 0; j < input[i].offsetData.size(); j++) {
             maxPrimitiveCount[j] = input[i].offsetData[j].primitiveCount;
             vkGetAccelerationStructureBuildSizesKHR(device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &buildAS[i].buildInfo, maxPrimitiveCount.data(), &buildAS[i].sizeInfo);
@@ -1770,7 +3686,8 @@ void VulkanRenderer::buildBlas(const std::vector<BLASInput>& input, VkBuildAccel
 
     vkDeviceWaitIdle(device);
 
-    std::vector<uint32_t> indices;
+    FrameVector<uint32_t> indices{ FrameAllocator<uint32_t>(arena) };
+    indices.reserve(numBlas);
     VkDeviceSize batchSize{ 0 };
     VkDeviceSize batchLimit{ 256'000'000 };
 
@@ -1795,19 +3712,213 @@ void VulkanRenderer::buildBlas(const std::vector<BLASInput>& input, VkBuildAccel
 
     vkDestroyQueryPool(device, queryPool, nullptr);
     vkDestroyBuffer(device, scratchBuffer, nullptr);
+    vkFreeMemory(device, scratchBufferMemory, nullptr);
+}
+
+uint64_t VulkanRenderer::hashBLASInput(const Model& model, const BLASInput& input, VkBuildAccelerationStructureFlagsKHR flags) {
+    uint64_t hash = AccelerationStructureCache::HASH_SEED;
+    if (vertexLayoutType == VertexLayoutType::SplitQuantized) {
+        hash = AccelerationStructureCache::hash(model.positions.data(), model.positions.size() * sizeof(PackedPosition), hash);
+    }
+    else {
+        // Only the positions of the interleaved vertices reach the build
+        for (const Vertex& vertex : model.vertices) {
+            hash = AccelerationStructureCache::hash(&vertex.pos, sizeof(vertex.pos), hash);
+        }
+    }
+    const MeshLod& lod = model.lods[0];
+    hash = AccelerationStructureCache::hash(model.indices.data() + lod.firstIndex, lod.indexCount * sizeof(uint32_t), hash);
+
+    for (const VkAccelerationStructureGeometryKHR& geometry : input.geoData) {
+        const VkAccelerationStructureGeometryTrianglesDataKHR& triangles = geometry.geometry.triangles;
+        uint64_t layout[] = { static_cast<uint64_t>(triangles.vertexFormat), triangles.vertexStride, static_cast<uint64_t>(triangles.indexType), triangles.maxVertex, geometry.flags };
+        hash = AccelerationStructureCache::hash(layout, sizeof(layout), hash);
+    }
+    for (const VkAccelerationStructureBuildRangeInfoKHR& range : input.offsetData) {
+        hash = AccelerationStructureCache::hash(&range, sizeof(range), hash);
+    }
+    VkBuildAccelerationStructureFlagsKHR buildFlags = input.flags | flags;
+    return AccelerationStructureCache::hash(&buildFlags, sizeof(buildFlags), hash);
+}
+
+// Serialized acceleration structures are read and written at addresses aligned to this
+static const VkDeviceSize SERIALIZED_AS_ALIGNMENT = 256;
+
+bool VulkanRenderer::restoreBottomLevelAS(const std::vector<uint8_t>& blob, BuildAccelerationStructure& restored) {
+    // The blob's header names the driver and the format it was written in, the device decides whether it can read it
+    VkDeviceSize size = AccelerationStructureCache::deserializedSize(blob);
+    if (size == 0) {
+        return false;
+    }
+    VkAccelerationStructureVersionInfoKHR versionInfo{};
+    versionInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_VERSION_INFO_KHR;
+    versionInfo.pVersionData = blob.data();
+    VkAccelerationStructureCompatibilityKHR compatibility = VK_ACCELERATION_STRUCTURE_COMPATIBILITY_INCOMPATIBLE_KHR;
+    vkGetDeviceAccelerationStructureCompatibilityKHR(device, &versionInfo, &compatibility);
+    if (compatibility != VK_ACCELERATION_STRUCTURE_COMPATIBILITY_COMPATIBLE_KHR) {
+        return false;
+    }
+
+    VkBuffer stagingBuffer;
+    VkDeviceMemory stagingBufferMemory;
+    createBuffer(blob.size() + SERIALIZED_AS_ALIGNMENT, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+    VkDeviceAddress stagingAddress = getDeviceAddress(stagingBuffer);
+    VkDeviceSize skew = ShaderBindingTable::alignUp(stagingAddress, SERIALIZED_AS_ALIGNMENT) - stagingAddress;
+
+    void* data;
+    vkMapMemory(device, stagingBufferMemory, 0, VK_WHOLE_SIZE, 0, &data);
+    memcpy(static_cast<uint8_t*>(data) + skew, blob.data(), blob.size());
+    vkUnmapMemory(device, stagingBufferMemory);
+
+    restored.allocation = createPooledAccelerationStructure(VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR, size, restored.accelStructure);
+
+    VkCopyMemoryToAccelerationStructureInfoKHR copyInfo{};
+    copyInfo.sType = VK_STRUCTURE_TYPE_COPY_MEMORY_TO_ACCELERATION_STRUCTURE_INFO_KHR;
+    copyInfo.src.deviceAddress = stagingAddress + skew;
+    copyInfo.dst = restored.accelStructure;
+    copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_DESERIALIZE_KHR;
+    VkCommandBuffer cmdBuff = beginSingleTimeCommands();
+    vkCmdCopyMemoryToAccelerationStructureKHR(cmdBuff, &copyInfo);
+    endSingleTimeCommands(cmdBuff);
+
+    vkDestroyBuffer(device, stagingBuffer, nullptr);
+    vkFreeMemory(device, stagingBufferMemory, nullptr);
+    return true;
+}
+
+std::vector<std::vector<uint8_t>> VulkanRenderer::serializeBottomLevelAS(const std::vector<VkAccelerationStructureKHR>& structures) {
+    uint32_t count = static_cast<uint32_t>(structures.size());
+    std::vector<std::vector<uint8_t>> blobs(count);
+
+    VkQueryPool sizeQueryPool;
+    VkQueryPoolCreateInfo queryPoolCInfo{};
+    queryPoolCInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolCInfo.queryCount = count;
+    queryPoolCInfo.queryType = VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR;
+    if (vkCreateQueryPool(device, &queryPoolCInfo, nullptr, &sizeQueryPool) != VK_SUCCESS) {
+        return blobs;
+    }
+    vkResetQueryPool(device, sizeQueryPool, 0, count);
+    VkCommandBuffer sizeCmdBuff = beginSingleTimeCommands();
+    vkCmdWriteAccelerationStructuresPropertiesKHR(sizeCmdBuff, count, structures.data(), VK_QUERY_TYPE_ACCELERATION_STRUCTURE_SERIALIZATION_SIZE_KHR, sizeQueryPool, 0);
+    endSingleTimeCommands(sizeCmdBuff);
+    std::vector<VkDeviceSize> sizes(count);
+    vkGetQueryPoolResults(device, sizeQueryPool, 0, count, count * sizeof(VkDeviceSize), sizes.data(), sizeof(VkDeviceSize), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+    vkDestroyQueryPool(device, sizeQueryPool, nullptr);
+
+    // Every structure goes to its own aligned slot of one host visible buffer, in one submission
+    std::vector<VkDeviceSize> offsets(count);
+    VkDeviceSize totalSize = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        offsets[i] = ShaderBindingTable::alignUp(totalSize, SERIALIZED_AS_ALIGNMENT);
+        totalSize = offsets[i] + sizes[i];
+    }
+
+    VkBuffer readbackBuffer;
+    VkDeviceMemory readbackBufferMemory;
+    createBuffer(totalSize + SERIALIZED_AS_ALIGNMENT, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, readbackBuffer, readbackBufferMemory);
+    VkDeviceAddress readbackAddress = getDeviceAddress(readbackBuffer);
+    VkDeviceSize skew = ShaderBindingTable::alignUp(readbackAddress, SERIALIZED_AS_ALIGNMENT) - readbackAddress;
+
+    VkCommandBuffer cmdBuff = beginSingleTimeCommands();
+    for (uint32_t i = 0; i < count; i++) {
+        VkCopyAccelerationStructureToMemoryInfoKHR copyInfo{};
+        copyInfo.sType = VK_STRUCTURE_TYPE_COPY_ACCELERATION_STRUCTURE_TO_MEMORY_INFO_KHR;
+        copyInfo.src = structures[i];
+        copyInfo.dst.deviceAddress = readbackAddress + skew + offsets[i];
+        copyInfo.mode = VK_COPY_ACCELERATION_STRUCTURE_MODE_SERIALIZE_KHR;
+        vkCmdCopyAccelerationStructureToMemoryKHR(cmdBuff, &copyInfo);
+    }
+    endSingleTimeCommands(cmdBuff);
+
+    void* data;
+    vkMapMemory(device, readbackBufferMemory, 0, VK_WHOLE_SIZE, 0, &data);
+    for (uint32_t i = 0; i < count; i++) {
+        const uint8_t* blob = static_cast<const uint8_t*>(data) + skew + offsets[i];
+        blobs[i].assign(blob, blob + sizes[i]);
+    }
+    vkUnmapMemory(device, readbackBufferMemory);
+
+    vkDestroyBuffer(device, readbackBuffer, nullptr);
+    vkFreeMemory(device, readbackBufferMemory, nullptr);
+    return blobs;
 }
 
 void VulkanRenderer::createBottomLevelAS() {
+    const VkBuildAccelerationStructureFlagsKHR flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR;
+    accelerationStructureCache = AccelerationStructureCache(AS_CACHE_PATH, physicalDeviceIDProperties.driverUUID, physicalDeviceIDProperties.deviceUUID);
+    auto start = std::chrono::high_resolution_clock::now();
+
+    // Restore every mesh the cache has, the rest are built
+    std::vector<BuildAccelerationStructure> structures(numModels);
+    std::vector<uint64_t> meshHashes(numModels);
     std::vector<BLASInput> BLASInputList;
-    BLASInputList.reserve(numModels);
-    for (int i = 0; i < numModels; i++) {
-        BLASInputList.emplace_back(BLASObjectToGeometry(loadedModels[i]));
+    std::vector<uint32_t> builtModels;
+    // What the restored meshes took to build on the run that cached them
+    double cachedBuildMs = 0.0;
+    for (uint32_t i = 0; i < numModels; i++) {
+        BLASInput input = BLASObjectToGeometry(loadedModels[i]);
+        meshHashes[i] = hashBLASInput(loadedModels[i], input, flags);
+
+        AccelerationStructureCache::Entry entry;
+        if (accelerationStructureCacheEnabled && accelerationStructureCache.load(meshHashes[i], entry) && restoreBottomLevelAS(entry.blob, structures[i])) {
+            cachedBuildMs += entry.buildMilliseconds;
+            continue;
+        }
+        builtModels.push_back(i);
+        BLASInputList.emplace_back(std::move(input));
+    }
+
+    double buildMs = 0.0;
+    if (!BLASInputList.empty()) {
+        auto buildStart = std::chrono::high_resolution_clock::now();
+        buildBlas(BLASInputList, flags);
+        buildMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - buildStart).count();
+        for (size_t j = 0; j < builtModels.size(); j++) {
+            structures[builtModels[j]] = buildAS[j];
+        }
+    }
+
+    // The TLAS finds a model's BLAS at the model's index
+    buildAS = std::move(structures);
+    bottomLevelAccelerationStructures.clear();
+    for (const BuildAccelerationStructure& b : buildAS) {
+        bottomLevelAccelerationStructures.emplace_back(b.accelStructure);
     }
+    double startupMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
 
-    buildBlas(BLASInputList, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR);
+    uint32_t restoredCount = numModels - static_cast<uint32_t>(builtModels.size());
+    printf("BLAS startup: %.2f ms, cold start %.2f ms, %u of %u restored from the cache \n", startupMs, cachedBuildMs + buildMs, restoredCount, numModels);
+    printf("BLAS pool: %u structures in %u buffers, %.1f MB used of %.1f MB \n", accelerationStructurePool.getAllocationCount(), accelerationStructurePool.getBlockCount(),
+        accelerationStructurePool.getUsedBytes() / (1024.0 * 1024.0), accelerationStructurePool.getReservedBytes() / (1024.0 * 1024.0));
+
+    if (!accelerationStructureCacheEnabled || builtModels.empty()) {
+        return;
+    }
+
+    // Cache what was built for the next run. The builds ran together, so each mesh is credited its share of the time
+    // by triangle count
+    auto serializeStart = std::chrono::high_resolution_clock::now();
+    std::vector<VkAccelerationStructureKHR> built;
+    uint64_t builtTriangles = 0;
+    for (uint32_t model : builtModels) {
+        built.push_back(buildAS[model].accelStructure);
+        builtTriangles += loadedModels[model].lods[0].indexCount / 3;
+    }
+    std::vector<std::vector<uint8_t>> blobs = serializeBottomLevelAS(built);
+    uint32_t storedCount = 0;
+    for (size_t j = 0; j < builtModels.size(); j++) {
+        uint32_t model = builtModels[j];
+        AccelerationStructureCache::Entry entry;
+        entry.blob = std::move(blobs[j]);
+        entry.buildMilliseconds = builtTriangles > 0 ? buildMs * (loadedModels[model].lods[0].indexCount / 3) / builtTriangles : 0.0;
+        storedCount += !entry.blob.empty() && accelerationStructureCache.store(meshHashes[model], entry);
+    }
+    double serializeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - serializeStart).count();
+    printf("BLAS cache: %u of %zu serialized in %.2f ms \n", storedCount, builtModels.size(), serializeMs);
 }
 
-void VulkanRenderer::CMDCreateTLAS(uint32_t numInstances, VkDeviceAddress instBufferAddress, VkBuffer scratchBuffer, VkBuildAccelerationStructureFlagsKHR flags, bool update, bool motion) {
+void VulkanRenderer::CMDCreateTLAS(VkCommandBuffer commandBuffer, uint32_t numInstances, VkDeviceAddress instBufferAddress, VkBuildAccelerationStructureFlagsKHR flags, bool update, bool motion) {
     VkAccelerationStructureGeometryInstancesDataKHR vulkanInstances{};
     vulkanInstances.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR;
     vulkanInstances.data.deviceAddress = instBufferAddress;
@@ -1826,78 +3937,118 @@ void VulkanRenderer::CMDCreateTLAS(uint32_t numInstances, VkDeviceAddress instBu
     topAccelStructBuildInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
     topAccelStructBuildInfo.srcAccelerationStructure = VK_NULL_HANDLE;
 
-    VkAccelerationStructureBuildSizesInfoKHR topAccelStructSizeInfo{};
-    topAccelStructSizeInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
-    vkGetAccelerationStructureBuildSizesKHR(device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &topAccelStructBuildInfo, &numInstances, &topAccelStructSizeInfo);
+    // An update reuses the structure and scratch buffer of the first build
+    if (!update) {
+        VkAccelerationStructureBuildSizesInfoKHR topAccelStructSizeInfo{};
+        topAccelStructSizeInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR;
+        vkGetAccelerationStructureBuildSizesKHR(device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &topAccelStructBuildInfo, &numInstances, &topAccelStructSizeInfo);
 
-    VkAccelerationStructureCreateInfoKHR topAccelStructCInfo{};
-    topAccelStructCInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
-    topAccelStructCInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
-    topAccelStructCInfo.size = topAccelStructSizeInfo.accelerationStructureSize;
+        VkAccelerationStructureCreateInfoKHR topAccelStructCInfo{};
+        topAccelStructCInfo.sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR;
+        topAccelStructCInfo.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+        topAccelStructCInfo.size = topAccelStructSizeInfo.accelerationStructureSize;
 
-    createBuffer(topAccelStructCInfo.size, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, tempBuffer3, tempBufferMemory3);
-    topAccelStructCInfo.buffer = tempBuffer3;
+        createBuffer(topAccelStructCInfo.size, VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, tempBuffer3, tempBufferMemory3);
+        topAccelStructCInfo.buffer = tempBuffer3;
 
-    VkResult res = vkCreateAccelerationStructureKHR(device, &topAccelStructCInfo, nullptr, &topLevelAccelStructure);
+        VkResult res = vkCreateAccelerationStructureKHR(device, &topAccelStructCInfo, nullptr, &topLevelAccelStructure);
 
-    VkDeviceMemory scratchBufferMemory;
-    createBuffer(topAccelStructSizeInfo.buildScratchSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, scratchBuffer, scratchBufferMemory);
-    VkBufferDeviceAddressInfo scratchBufferInfo{};
-    scratchBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
-    scratchBufferInfo.buffer = scratchBuffer;
-    VkDeviceAddress scratchBufferAddress = vkGetBufferDeviceAddress(device, &scratchBufferInfo);
+        VkDeviceSize scratchSize = std::max(topAccelStructSizeInfo.buildScratchSize, topAccelStructSizeInfo.updateScratchSize);
+        createBuffer(scratchSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, tlasScratchBuffer, tlasScratchBufferMemory);
+    }
 
-    topAccelStructBuildInfo.srcAccelerationStructure = VK_NULL_HANDLE;
+    topAccelStructBuildInfo.srcAccelerationStructure = update ? topLevelAccelStructure : VK_NULL_HANDLE;
     topAccelStructBuildInfo.dstAccelerationStructure = topLevelAccelStructure;
-    topAccelStructBuildInfo.scratchData.deviceAddress = scratchBufferAddress;
+    topAccelStructBuildInfo.scratchData.deviceAddress = getDeviceAddress(tlasScratchBuffer);
 
     VkAccelerationStructureBuildRangeInfoKHR TLASOffsetInfo{};
-    TLASOffsetInfo.firstVertex = numInstances;
-    TLASOffsetInfo.primitiveCount, TLASOffsetInfo.primitiveOffset, TLASOffsetInfo.transformOffset = 0;
+    TLASOffsetInfo.primitiveCount = numInstances;
     const VkAccelerationStructureBuildRangeInfoKHR* pTLASBuildOffsetInfo = &TLASOffsetInfo;
 
-    VkCommandBuffer cmdBuff1 = beginSingleTimeCommands();
-    vkCmdBuildAccelerationStructuresKHR(cmdBuff1, 1, &topAccelStructBuildInfo, &pTLASBuildOffsetInfo);
-    endSingleTimeCommands(cmdBuff1);
+    // The build reads the instances the host wrote. A refit also overwrites the TLAS the ray queries of earlier frames
+    // read, and the scratch buffer the last refit wrote
+    VkMemoryBarrier beforeBuild[2]{};
+    beforeBuild[0].sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    beforeBuild[0].srcAccessMask = VK_ACCESS_HOST_WRITE_BIT;
+    beforeBuild[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+    beforeBuild[1].sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    beforeBuild[1].srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+    beforeBuild[1].dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 2, beforeBuild, 0, nullptr, 0, nullptr);
+
+    vkCmdBuildAccelerationStructuresKHR(commandBuffer, 1, &topAccelStructBuildInfo, &pTLASBuildOffsetInfo);
+
+    // The ray traced compute passes and the scene pass trace against it
+    VkMemoryBarrier afterBuild{};
+    afterBuild.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    afterBuild.srcAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
+    afterBuild.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_READ_BIT_KHR;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+        0, 1, &afterBuild, 0, nullptr, 0, nullptr);
 }
 
 void VulkanRenderer::buildTlas(const std::vector<VkAccelerationStructureInstanceKHR>& TLASInstances, VkBuildAccelerationStructureFlagsKHR flags, bool update = false) {
-    uint32_t numInstances = static_cast<uint32_t>(instances.size());
-
-    VkBuffer instancesBuffer;
-    VkDeviceMemory instancesBufferMemory;
-    createBuffer(TLASInstances.size(), VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, instancesBuffer, instancesBufferMemory);
-    VkBufferDeviceAddressInfo bufferInfo{};
-    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
-    bufferInfo.buffer = instancesBuffer;
-    VkDeviceAddress instBufferAddress = vkGetBufferDeviceAddress(device, &bufferInfo);
-
-    VkMemoryBarrier barrier{};
-    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
-    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-    barrier.dstAccessMask = VK_ACCESS_ACCELERATION_STRUCTURE_WRITE_BIT_KHR;
-    VkCommandBuffer cmdBuff = beginSingleTimeCommands();
-    vkCmdPipelineBarrier(cmdBuff, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0, 1, &barrier, 0, nullptr, 0, nullptr);
-    endSingleTimeCommands(cmdBuff);
-
-    VkBuffer scratchBuffer = VK_NULL_HANDLE;
+    uint32_t numInstances = static_cast<uint32_t>(TLASInstances.size());
+    size_t instancesSize = sizeof(VkAccelerationStructureInstanceKHR) * numInstances;
     bool motion = false;
-    CMDCreateTLAS(numInstances, instBufferAddress, scratchBuffer, flags, update, motion);
-    vkDestroyBuffer(device, scratchBuffer, nullptr);
-    vkDestroyBuffer(device, instancesBuffer, nullptr);
+
+    // Host visible and persistently mapped, one copy per frame in flight
+    if (!update) {
+        VkDeviceSize bufferSize = sizeof(VkAccelerationStructureInstanceKHR) * std::max<uint32_t>(numInstances, 1);
+        for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+            createBuffer(bufferSize, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, tlasInstanceBuffers[i], tlasInstanceBuffersMemory[i]);
+            vkMapMemory(device, tlasInstanceBuffersMemory[i], 0, bufferSize, 0, &tlasInstanceBuffersMapped[i]);
+            memcpy(tlasInstanceBuffersMapped[i], TLASInstances.data(), instancesSize);
+        }
+
+        VkCommandBufferAllocateInfo allocateInfo{};
+        allocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocateInfo.commandPool = commandPool;
+        allocateInfo.commandBufferCount = MAX_FRAMES_IN_FLIGHT;
+        vkAllocateCommandBuffers(device, &allocateInfo, tlasUpdateCommandBuffers.data());
+
+        // The first build happens once at load, so it can wait for the queue
+        VkCommandBuffer cmdBuff = beginSingleTimeCommands();
+        CMDCreateTLAS(cmdBuff, numInstances, getDeviceAddress(tlasInstanceBuffers[frameInFlight]), flags, false, motion);
+        endSingleTimeCommands(cmdBuff);
+        return;
+    }
+
+    // The whole array, since the frame's copy also missed the refits recorded by the other frames in flight
+    memcpy(tlasInstanceBuffersMapped[frameInFlight], TLASInstances.data(), instancesSize);
+
+    // The frame's last submission has finished, so its command buffer can be recorded again. It goes out with the
+    // frame's own submit instead of a blocking one of its own
+    VkCommandBuffer commandBuffer = tlasUpdateCommandBuffers[frameInFlight];
+    vkResetCommandBuffer(commandBuffer, 0);
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    CMDCreateTLAS(commandBuffer, numInstances, getDeviceAddress(tlasInstanceBuffers[frameInFlight]), flags, true, motion);
+    vkEndCommandBuffer(commandBuffer);
+    tlasUpdatePending = true;
+}
+
+static VkTransformMatrixKHR toTransformMatrix(const glm::mat4& transform) {
+    static_assert(sizeof(VkTransformMatrixKHR) == 12 * sizeof(float), "packTransforms writes 3 rows of 4 floats");
+    VkTransformMatrixKHR matrix;
+    SIMDMath::packTransforms(&transform, &matrix, sizeof(VkTransformMatrixKHR), 1);
+    return matrix;
 }
 
 void VulkanRenderer::createTopLevelAS() {
-    std::vector<VkAccelerationStructureInstanceKHR> TLAS;
-    TLAS.reserve(instances.size());
+    tlasInstances.clear();
+    tlasInstances.reserve(instances.size());
     for (const OBJInstance& inst : instances) {
         VkAccelerationStructureInstanceKHR rayInstance{};
+        uint32_t instanceIndex = static_cast<uint32_t>(tlasInstances.size());
 
-        glm::mat4 temporaryMatrix = glm::transpose(inst.transform);
-        VkTransformMatrixKHR otherMatrix;
-        memcpy(&otherMatrix, &temporaryMatrix, sizeof(VkTransformMatrixKHR));
-
-        rayInstance.transform = otherMatrix;
+        // Quantized positions are decoded by the instance transform, so the BLAS is built on the raw 16-bit values
+        rayInstance.transform = toTransformMatrix(getModelMatrix(inst));
         rayInstance.instanceCustomIndex = inst.index;
 
         VkAccelerationStructureDeviceAddressInfoKHR BLASAddressInfo {};
@@ -1907,8 +4058,84 @@ void VulkanRenderer::createTopLevelAS() {
         rayInstance.accelerationStructureReference = vkGetAccelerationStructureDeviceAddressKHR(device, &BLASAddressInfo);
         rayInstance.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
         rayInstance.mask = 0xFF;
-        rayInstance.instanceShaderBindingTableRecordOffset = 0;
-        TLAS.emplace_back(rayInstance);
+        // Every BLAS has one geometry, so the instance's hit record is found at its own index
+        rayInstance.instanceShaderBindingTableRecordOffset = instanceIndex;
+        tlasInstances.emplace_back(rayInstance);
+    }
+    buildTlas(tlasInstances, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR);
+
+    // Refits keep the handle, only a new TLAS has to be bound to the ray traced passes
+    writeRayTracedDescriptors();
+    updateShaderBindingTable();
+    std::fill(commandBufferStale.begin(), commandBufferStale.end(), true);
+}
+
+void VulkanRenderer::createShaderBindingTable(VkPipeline pipeline, uint32_t raygenCount, uint32_t missCount, uint32_t hitGroupCount) {
+    uint32_t groupCount = raygenCount + missCount + hitGroupCount;
+    std::vector<uint8_t> handles(size_t(groupCount) * physicalDeviceRTProperties.shaderGroupHandleSize);
+    if (vkGetRayTracingShaderGroupHandlesKHR(device, pipeline, 0, groupCount, handles.size(), handles.data()) != VK_SUCCESS) {
+        std::_Xruntime_error("Failed to get the shader group handles!");
+    }
+
+    shaderBindingTable.configure(physicalDeviceRTProperties, raygenCount, missCount, hitGroupCount, sizeof(HitRecord));
+    shaderBindingTable.setGroupHandles(handles);
+    updateShaderBindingTable();
+}
+
+void VulkanRenderer::updateShaderBindingTable() {
+    if (!shaderBindingTable.isConfigured()) {
+        return;
     }
-    buildTlas(TLAS, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR);
+
+    // One hit group for now, the records differ only in their data
+    for (size_t i = 0; i < instances.size(); i++) {
+        const OBJInstance& instance = instances[i];
+        const Model& model = loadedModels[instance.index];
+        HitRecord record{ instance.index, instance.textureOffset, 0, 0 };
+        if (!model.lods.empty()) {
+            record.firstIndex = model.lods[0].firstIndex;
+            record.indexCount = model.lods[0].indexCount;
+        }
+        shaderBindingTable.setHitRecord(static_cast<uint32_t>(i), 0, &record);
+    }
+    shaderBindingTable.truncateHitRecords(static_cast<uint32_t>(instances.size()));
+
+    if (shaderBindingTable.needsReallocation()) {
+        // Frames in flight may still trace with the old table
+        vkDeviceWaitIdle(device);
+        destroyShaderBindingTable();
+        VkDeviceSize baseAlignment = shaderBindingTable.getBaseAlignment();
+        VkDeviceSize bufferSize = shaderBindingTable.getSize() + baseAlignment;
+        createBuffer(bufferSize, VK_BUFFER_USAGE_SHADER_BINDING_TABLE_BIT_KHR | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, shaderBindingTableBuffer, shaderBindingTableBufferMemory);
+        void* mapped;
+        vkMapMemory(device, shaderBindingTableBufferMemory, 0, bufferSize, 0, &mapped);
+        VkDeviceAddress bufferAddress = getDeviceAddress(shaderBindingTableBuffer);
+        shaderBindingTableAddress = ShaderBindingTable::alignUp(bufferAddress, baseAlignment);
+        shaderBindingTableMapped = static_cast<uint8_t*>(mapped) + (shaderBindingTableAddress - bufferAddress);
+    }
+
+    ShaderBindingTable::DirtyRange range = shaderBindingTable.getDirtyRange();
+    if (!range.empty()) {
+        std::memcpy(shaderBindingTableMapped + range.begin, shaderBindingTable.getData().data() + range.begin, range.end - range.begin);
+    }
+    shaderBindingTable.markUploaded();
+}
+
+void VulkanRenderer::destroyShaderBindingTable() {
+    vkDestroyBuffer(device, shaderBindingTableBuffer, nullptr);
+    vkFreeMemory(device, shaderBindingTableBufferMemory, nullptr);
+    shaderBindingTableBuffer = VK_NULL_HANDLE;
+    shaderBindingTableBufferMemory = VK_NULL_HANDLE;
+    shaderBindingTableMapped = nullptr;
+    shaderBindingTableAddress = 0;
+}
+
+void VulkanRenderer::updateTopLevelAS(const std::vector<uint32_t>& changed) {
+    for (uint32_t i : changed) {
+        tlasInstances[i].transform = toTransformMatrix(getModelMatrix(instances[i]));
+    }
+
+    // A refit keeps the tree of the first build, so the flags have to match it
+    buildTlas(tlasInstances, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR | VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR, true);
 }
\ No newline at end of file
@@ -8,7 +8,33 @@
 #include <string>
 #include "glm-0.9.6.3/glm.hpp"
 #include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
 #include <tiny_obj_loader.h>
+#include "FrameAllocator.h"
+#include "VertexLayout.h"
+#include "Meshlet.h"
+#include "InstanceCulling.h"
+#include "OcclusionCulling.h"
+#include "SceneGraph.h"
+#include "ECS.h"
+#include "Components.h"
+#include "DynamicAABBTree.h"
+#include "DynamicResolution.h"
+#include "RenderGraph.h"
+#include "DepthPrepassSelector.h"
+#include "LightClusters.h"
+#include "CascadedShadows.h"
+#include "RayTracedShadows.h"
+#include "ShaderBindingTable.h"
+#include "AccelerationStructureCache.h"
+#include "AccelerationStructurePool.h"
+#include "TextureStreaming.h"
+#include "CookedTexture.h"
+#include "ShaderHotReload.h"
+
+class JobSystem;
 
 #define TINYOBJLOADER_IMPLEMENTATION
 #define STB_IMAGE_IMPLEMENTATION
@@ -19,6 +45,15 @@
 const std::string MODEL_PATH = "VikingRoom/OBJ.obj";
 const std::string TEXTURE_PATH = "VikingRoom/Material.png";
 //const std::string TEXTURE_PATH = "Images/texture.jpg";
+const std::string PIPELINE_CACHE_PATH = "shaders/pipeline.cache";
+// Serialized BLASes, one file per mesh
+const std::string AS_CACHE_PATH = "shaders/ascache";
+// Cooked textures, each at its source path plus .ctex, written by --cook
+const std::string COOKED_TEXTURE_PATH = "cooked";
+// Every asset packed into one file by --pack, mounted at startup when present and read before the loose files
+const std::string ASSET_ARCHIVE_PATH = "assets.pack";
+
+const int MAX_FRAMES_IN_FLIGHT = 2;
 
 class VulkanRenderer {
 
@@ -67,20 +102,77 @@ public:
 	// Pipeline Layout for "gloabls" to change shaders
 	VkPipelineLayout pipeLineLayout;
 
-	// Render pass handles
+	// Render pass of the frame graph's scene pass, owned by the graph
 	VkRenderPass renderPass;
 
 	// The graphics pipeline handle
 	VkPipeline graphicsPipeline;
+	// Depth only pipeline of the pre-pass, fed the position stream alone. Null while the pre-pass is off
+	VkPipeline depthPrepassPipeline = VK_NULL_HANDLE;
+
+	// Pipeline cache, persisted to disk so pipeline rebuilds (startup and shader reloads) skip most of the compilation
+	VkPipelineCache pipelineCache = VK_NULL_HANDLE;
 
-	// Handle to hold the frame buffers
-	std::vector<VkFramebuffer> SWChainFrameBuffers;
+	// Pipelines replaced by a shader reload, destroyed once no frame in flight can still reference them
+	struct RetiredPipeline {
+		VkPipeline pipeline;
+		uint64_t retireFrame;
+	};
+	std::vector<RetiredPipeline> retiredPipelines;
+	uint64_t frameCount = 0;
+
+	// Transient CPU memory, one arena per frame in flight, for containers that only live until the frame is submitted
+	FrameArenas<MAX_FRAMES_IN_FLIGHT> frameArenas;
+	// The frame in flight being prepared, set by drawNewFrame once the fence of its last use has signaled
+	uint32_t frameInFlight = 0;
+
+	// The frame as passes: the scene drawn into offscreen HDR color and depth at the swap chain size, then scaled up into
+	// the swap chain image. Only the top left renderExtent of the targets is drawn, so changing the render scale never
+	// reallocates. The graph owns the targets, their memory, the render passes and the barriers between them
+	RenderGraph frameGraph;
+	RenderGraph::ResourceId sceneColor;
+	RenderGraph::ResourceId sceneDepth;
+	RenderGraph::ResourceId swapChainTarget;
+	RenderGraph::PassId scenePass;
+	// Fills the scene depth ahead of the scene pass, which then shades each pixel once with an equal depth test. When off
+	// the scene pass clears depth itself and the graph culls the pre-pass, its render pass is then null
+	RenderGraph::PassId depthPrepassPass;
+	VkRenderPass depthPrepassRenderPass = VK_NULL_HANDLE;
+	VkExtent2D renderExtent;
+	// False when no scene color format can be blitted with filtering, the scene is then copied at full size
+	bool renderTargetBlit = true;
+
+	// Picks the render scale from the GPU time of each frame, the scale stays where it is when off
+	bool dynamicResolutionEnabled = true;
+	DynamicResolution dynamicResolution;
+	// Start and end timestamps of every command buffer, null when the graphics queue has no timestamps
+	VkQueryPool timestampQueryPool = VK_NULL_HANDLE;
+	float timestampPeriod = 1.0f;
+	uint64_t timestampMask = UINT64_MAX;
+	// Per swap chain image, whether its last submit has timestamps left to read and the scale it was recorded at
+	std::vector<bool> timestampsPending;
+	std::vector<float> recordedScales;
+	float lastGpuFrameMs = 0.0f;
+
+	// Whether the frame has the depth pre-pass, chosen per scene from its measured overdraw unless set on the command line
+	bool depthPrepassEnabled = false;
+	bool depthPrepassAuto = true;
+	DepthPrepassSelector depthPrepassSelector;
+	// Fragment shader invocations of every command buffer's scene pass, null without pipeline statistics queries
+	bool pipelineStatisticsSupported = false;
+	VkQueryPool overdrawQueryPool = VK_NULL_HANDLE;
+	// Per swap chain image, whether its last submit has a count left to read, and the mode and pixels it was recorded with
+	std::vector<bool> statisticsPending;
+	std::vector<bool> recordedPrepass;
+	std::vector<uint64_t> recordedPixels;
 
 	// Command Buffers - Command pool and command buffer handles
 	VkCommandPool commandPool;
 
 	// Handle for the list of command buffers
 	std::vector<VkCommandBuffer> commandBuffers;
+	// Set when a command buffer references state that has since changed, re-recorded before its next submit
+	std::vector<bool> commandBufferStale;
 
 	// Handles for the two semaphores - one for if the image is available and the other to present the image
 	std::vector<VkSemaphore> imageAcquiredSema;
@@ -92,24 +184,203 @@ public:
 
 	// IF NEEDED, HANDLE WINDOW MINIMIZATION AND RESIZE
 
+	// Layout of the vertex streams, the split layout keeps positions in their own buffer for depth passes and AS builds
+	VertexLayoutType vertexLayoutType = VertexLayoutType::SplitQuantized;
+	VertexLayout vertexLayout;
+
 	VkBuffer vertexBuffer;
 	VkDeviceMemory vertexBufferMemory;
 
+	VkBuffer positionBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory positionBufferMemory = VK_NULL_HANDLE;
+
 	VkBuffer indexBuffer;
 	VkDeviceMemory indexBufferMemory;
 
 	std::vector<VkBuffer> uniformBuffers;
 	std::vector<VkDeviceMemory> uniformBuffersMemory;
 
-	VkImage textureImage;
-	VkDeviceMemory textureImageMemory;
-	VkImageView textureImageView;
+	// Indirect draws for each swap chain image, rewritten every frame by updateIndirectCommands. Every instance owns
+	// one slot for a whole LOD followed by one per meshlet of its finest LOD, unused slots get an instance count of 0
+	std::vector<VkBuffer> indirectBuffers;
+	std::vector<VkDeviceMemory> indirectBuffersMemory;
+	std::vector<void*> indirectBuffersMapped;
+	bool multiDrawIndirectSupported = false;
+	uint32_t indirectDrawCount = 0;
+
+	// World space point lights, assigned to the view's clusters every frame by updateLightClusters
+	std::vector<PointLight> pointLights;
+	LightClusters lightClusters;
+	// Without point lights or the sun the ambient term is 1 and the textures look as they did unlit
+	float litAmbient = 0.25f;
+	// Storage buffers for each swap chain image, the lights in view space, the cluster grid and the light index list.
+	// Host visible and persistently mapped like the indirect draws
+	std::vector<VkBuffer> lightBuffers;
+	std::vector<VkDeviceMemory> lightBuffersMemory;
+	std::vector<void*> lightBuffersMapped;
+	std::vector<VkBuffer> clusterBuffers;
+	std::vector<VkDeviceMemory> clusterBuffersMemory;
+	std::vector<void*> clusterBuffersMapped;
+	std::vector<VkBuffer> lightIndexBuffers;
+	std::vector<VkDeviceMemory> lightIndexBuffersMemory;
+	std::vector<void*> lightIndexBuffersMapped;
+	// Indices each light index buffer holds, it grows when a frame's clusters need more
+	std::vector<size_t> lightIndexCapacity;
+	// Sums over the frames since the last report
+	uint32_t lightReportFrames = 0;
+	double lightAssignMs = 0.0;
+
+	// Sun light with cascaded shadow maps. The depth of the static casters is cached per cascade and only rendered again
+	// when a cascade moves, the sun turns or a static instance moves, the dynamic instances are drawn over a copy of it
+	// every frame
+	bool shadowsEnabled = true;
+	glm::vec3 sunDirection = glm::normalize(glm::vec3(-0.4f, -0.3f, -1.0f));
+	float sunIntensity = 1.0f;
+	CascadedShadows cascadedShadows;
+	VkFormat shadowFormat = VK_FORMAT_UNDEFINED;
+	// The cascades side by side, the atlas the scene samples and the cache of the static depth. Owned by the renderer
+	// since the cache outlives the frame graph, both are imported into it
+	VkImage shadowMapImage = VK_NULL_HANDLE;
+	VkDeviceMemory shadowMapImageMemory = VK_NULL_HANDLE;
+	VkImageView shadowMapImageView = VK_NULL_HANDLE;
+	VkImage shadowCacheImage = VK_NULL_HANDLE;
+	VkDeviceMemory shadowCacheImageMemory = VK_NULL_HANDLE;
+	VkImageView shadowCacheImageView = VK_NULL_HANDLE;
+	// Depth comparing sampler, the 3x3 taps of shader.frag are each filtered across 2x2 texels when the format allows
+	VkSampler shadowSampler = VK_NULL_HANDLE;
+	RenderGraph::ResourceId shadowMap;
+	RenderGraph::ResourceId shadowCache;
+	RenderGraph::PassId shadowPass;
+	// Renders the static casters of the stale cascades into the cache, run on its own when a cascade is stale
+	RenderGraph shadowCacheGraph;
+	RenderGraph::ResourceId shadowCacheTarget;
+	RenderGraph::PassId shadowCachePass;
+	uint32_t staticShadowMask = 0;
+	// The cascade index is pushed before the draws of each cascade
+	VkPipelineLayout shadowPipelineLayout = VK_NULL_HANDLE;
+	VkPipeline shadowPipeline = VK_NULL_HANDLE;
+	// One whole LOD draw per cascade and instance. The dynamic casters for each swap chain image, written every frame,
+	// and the static casters of the stale cascades, written only before the cache is rendered
+	std::vector<VkBuffer> shadowIndirectBuffers;
+	std::vector<VkDeviceMemory> shadowIndirectBuffersMemory;
+	std::vector<void*> shadowIndirectBuffersMapped;
+	VkBuffer staticShadowIndirectBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory staticShadowIndirectBufferMemory = VK_NULL_HANDLE;
+	void* staticShadowIndirectBufferMapped = nullptr;
+	std::vector<uint32_t> shadowCasters;
+	// Sums over the frames since the last report
+	uint32_t shadowReportFrames = 0;
+	uint64_t shadowDynamicCasters = 0;
+	double shadowCullMs = 0.0;
+
+	// Sun shadows and ambient occlusion traced against the TLAS with ray queries, in place of the cascades. Needs
+	// VK_KHR_ray_query and the depth pre-pass, whose depth the rays start from. Traced at a fraction of the render
+	// resolution, accumulated over frames and filtered, then upsampled by the scene pass
+	bool rayTracedShadowsEnabled = false;
+	bool rayQuerySupported = false;
+	RayTracedShadows rayTracedShadows;
+	RenderGraph::ResourceId rayTracedNoisy;
+	RenderGraph::ResourceId rayTracedAccumulated;
+	RenderGraph::ResourceId rayTracedFiltered[2];
+	RenderGraph::ResourceId rayTracedHistory;
+	// Whichever image the last pass wrote, sampled by the scene pass
+	RenderGraph::ResourceId rayTracedOutput;
+	// Last frame's accumulation, owned by the renderer since it must survive from one frame to the next, imported into
+	// the graph. Recreated with the graph at the trace size
+	VkImage rayTracedHistoryImage = VK_NULL_HANDLE;
+	VkDeviceMemory rayTracedHistoryImageMemory = VK_NULL_HANDLE;
+	VkImageView rayTracedHistoryImageView = VK_NULL_HANDLE;
+	// Nearest filtering, the scene pass weighs the texels around a pixel by depth itself
+	VkSampler rayTracedSampler = VK_NULL_HANDLE;
+	// The three compute passes share one layout, the filter step is pushed
+	VkDescriptorSetLayout rayTracedSetLayout = VK_NULL_HANDLE;
+	VkPipelineLayout rayTracedPipelineLayout = VK_NULL_HANDLE;
+	VkPipeline rayTracePipeline = VK_NULL_HANDLE;
+	VkPipeline rayAccumulatePipeline = VK_NULL_HANDLE;
+	VkPipeline rayDenoisePipeline = VK_NULL_HANDLE;
+	// Per swap chain image, one set for the trace, the accumulation and each filter pass
+	std::vector<std::vector<VkDescriptorSet>> rayTracedDescriptorSets;
+	std::vector<VkBuffer> rayTracedUniformBuffers;
+	std::vector<VkDeviceMemory> rayTracedUniformBuffersMemory;
+	std::vector<void*> rayTracedUniformBuffersMapped;
+
+	// Rasterizer backface culling, meshlets are only cone culled when it is on since both drop the same triangles
+	bool backfaceCulling = true;
+	uint64_t visibleMeshlets = 0;
+	uint64_t totalMeshlets = 0;
+
+	// World space bounds of instances, indexed like instances, and the ones that passed the last frustum and occlusion tests
+	InstanceBounds instanceBounds;
+	std::vector<uint32_t> visibleInstances;
+
+	// Owned by main, CPU work of a frame such as culling is spread over it when set
+	JobSystem* jobSystem = nullptr;
+
+	// Software depth buffer of the large visible instances, hides instances behind them before the draws are written
+	bool occlusionCulling = true;
+	OcclusionCuller occlusionCuller;
+	// Instances covering fewer pixels of the occlusion buffer than this are not drawn into it
+	float occluderMinPixels = 8.0f;
+	// Sums over the frames since the last report
+	uint32_t occlusionReportFrames = 0;
+	uint64_t occlusionTested = 0;
+	uint64_t occlusionCulled = 0;
+	double occlusionRasterizeMs = 0.0;
+	double occlusionTestMs = 0.0;
+
+	// Largest screen space error in pixels a LOD may have before a finer one is drawn
+	float lodPixelError = 1.0f;
+	// Triangles submitted by the last updateIndirectCommands, against the count at full detail
+	uint64_t drawnTriangles = 0;
+	uint64_t fullDetailTriangles = 0;
+	// Frames since the LOD selection was last reported
+	uint32_t lodReportFrames = 0;
+
+	// Textures of the scene, streamed a level at a time under the residency budget. An image holds only the resident
+	// levels, baseMip of the source and coarser, and is replaced by one of another level count when they change
+	struct StreamedTexture {
+		// Null for a texture loaded whole
+		std::unique_ptr<MipSource> source;
+		uint32_t residencyId = 0;
+		uint32_t baseMip = 0;
+		VkImage image = VK_NULL_HANDLE;
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkImageView view = VK_NULL_HANDLE;
+	};
+	std::vector<StreamedTexture> streamedTextures;
+	TextureResidency textureResidency;
+	// Levels being read into mapped staging memory on the job system, copied into a new image once read. Uploads of a
+	// texture finish in the order they started, so the last one started is the image that stays
+	struct TextureUpload {
+		uint32_t texture;
+		uint32_t baseMip;
+		bool load;
+		VkFormat format;
+		VkBuffer stagingBuffer;
+		VkDeviceMemory stagingMemory;
+		std::vector<VkBufferImageCopy> regions;
+		// 0 while reading, 1 once read, 2 if the source failed
+		std::shared_ptr<std::atomic<int>> state;
+	};
+	std::vector<TextureUpload> textureUploads;
+	// Images replaced by streaming, destroyed once no descriptor set or frame in flight can still reference them
+	struct RetiredImage {
+		VkImage image;
+		VkImageView view;
+		VkDeviceMemory memory;
+		uint64_t retireFrame;
+	};
+	std::vector<RetiredImage> retiredImages;
+	// Swap chain images whose descriptor sets still point at a replaced texture view, rewritten when the image comes up
+	std::vector<bool> textureDescriptorStale;
+	// When off every texture is loaded whole at startup, with no source kept in memory
+	bool textureStreamingEnabled = true;
+	// Block compressed cooked textures are only used where the device samples BC formats
+	bool textureCompressionBCSupported = false;
+	// Larger side in texels of the tail, the coarsest levels every texture loads at startup and keeps resident
+	uint32_t textureTailSize = 128;
 	VkSampler textureSampler;
 
-	VkImage depthImage;
-	VkDeviceMemory depthImageMemory;
-	VkImageView depthImageView;
-
 	uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
 
 	VkDescriptorPool descriptorPool;
@@ -117,24 +388,48 @@ public:
 
 	VkFence commandFence;
 	VkQueryPool queryPool;
-	VkBuffer tempBuffer;
-	VkDeviceMemory tempBufferMemory;
-	VkBuffer tempBuffer2;
-	VkDeviceMemory tempBufferMemory2;
 	VkBuffer tempBuffer3;
 	VkDeviceMemory tempBufferMemory3;
 
-	VkAccelerationStructureKHR topLevelAccelStructure;
+	VkAccelerationStructureKHR topLevelAccelStructure = VK_NULL_HANDLE;
+
+	// TLAS instances in the order of instances, and a persistently mapped copy per frame in flight for the builds to
+	// read, so a refit never rewrites instances an earlier frame's build may still be reading. Refits reuse the scratch
+	// buffer, which fits both a build and an update
+	std::vector<VkAccelerationStructureInstanceKHR> tlasInstances;
+	std::array<VkBuffer, MAX_FRAMES_IN_FLIGHT> tlasInstanceBuffers{};
+	std::array<VkDeviceMemory, MAX_FRAMES_IN_FLIGHT> tlasInstanceBuffersMemory{};
+	std::array<void*, MAX_FRAMES_IN_FLIGHT> tlasInstanceBuffersMapped{};
+	VkBuffer tlasScratchBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory tlasScratchBufferMemory = VK_NULL_HANDLE;
+	// A refit is recorded into the command buffer of the frame in flight, which drawNewFrame submits ahead of the
+	// image's own while tlasUpdatePending is set
+	std::array<VkCommandBuffer, MAX_FRAMES_IN_FLIGHT> tlasUpdateCommandBuffers{};
+	bool tlasUpdatePending = false;
 
 	struct UniformBufferObject {
 		alignas(16) glm::mat4 model;
 		alignas(16) glm::mat4 view;
 		alignas(16) glm::mat4 proj;
+		// Written by updateShadows, world space to the atlas region of each cascade
+		alignas(16) glm::mat4 cascadeViewProj[CascadedShadows::MAX_CASCADES];
+		// View depth where each cascade ends and the world size of its texels
+		alignas(16) glm::vec4 cascadeSplits;
+		alignas(16) glm::vec4 cascadeTexelSizes;
+		// View space direction the sun shines in, and its intensity in w, 0 without shadows
+		alignas(16) glm::vec4 sunDirection;
+		// Cascade count in x
+		alignas(16) glm::vec4 shadowParams;
+		// Trace texels per render pixel in xy and the trace size in zw, x is 0 without ray traced shadows
+		alignas(16) glm::vec4 rayTracingParams;
+		// Model view inverse transpose for the normals, from the instance transform alone since the packed normals
+		// were never scaled by the position dequantization
+		alignas(16) glm::mat4 normalMatrix;
 	};
 
 	struct Vertex {
 		glm::vec3 pos;
-		glm::vec3 color;
+		glm::vec3 normal;
 		glm::vec2 texCoord;
 
 		static VkVertexInputBindingDescription getBindingDescription() {
@@ -153,31 +448,75 @@ public:
 			attributeDescriptions[0].offset = offsetof(Vertex, pos);
 			attributeDescriptions[1].binding = 0;
 			attributeDescriptions[1].location = 1;
-			attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-			attributeDescriptions[1].offset = offsetof(Vertex, color);
+			attributeDescriptions[1].format = VK_FORMAT_R32G32_SFLOAT;
+			attributeDescriptions[1].offset = offsetof(Vertex, texCoord);
 			attributeDescriptions[2].binding = 0;
 			attributeDescriptions[2].location = 2;
-			attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
-			attributeDescriptions[2].offset = offsetof(Vertex, texCoord);
+			attributeDescriptions[2].format = VK_FORMAT_R32G32B32_SFLOAT;
+			attributeDescriptions[2].offset = offsetof(Vertex, normal);
 			return attributeDescriptions;
 		}
 	};
 
+	// Packed copy of the entity components the draws and acceleration structures read, kept in sync by updateSceneGraph
 	struct OBJInstance {
 		uint32_t index = 0;
 		uint32_t textureOffset = 0;
+		SceneGraph::NodeId node = SceneGraph::INVALID_NODE;
+		Entity entity;
+		DynamicAABBTree::ProxyId proxy = DynamicAABBTree::INVALID_PROXY;
 		glm::mat4 transform{ 0 };
 		glm::mat4 transformIT{ 0 };
+		// Drawn into the shadow cascades every frame, a static instance that moves renders the cached cascades again
+		bool dynamic = false;
 	};
 	
 	std::vector<OBJInstance> instances;
 
+	// Every loaded model is an entity with transform, mesh, material, scene node and render instance components
+	EntityWorld world;
+	// World version the instances were last synced at, only transforms written after it are copied
+	uint32_t instanceSyncVersion = 0;
+
+	// Transform hierarchy of the instances, set local transforms on it and updateSceneGraph pushes them to the entities
+	SceneGraph sceneGraph;
+	// Entity of every node id, invalid for nodes without geometry
+	std::vector<Entity> entityOfNode;
+	// Instances whose world transform changed in the last updateSceneGraph
+	std::vector<uint32_t> changedInstances;
+	// World bounds of the instances for picking, range and ray queries, items are instance indices
+	DynamicAABBTree instanceTree;
+
+	// Index range of one level of detail, error is the model space distance the surface moved from the full mesh
+	struct MeshLod {
+		uint32_t firstIndex = 0;
+		uint32_t indexCount = 0;
+		float error = 0.0f;
+	};
+
+	static const uint32_t MAX_MESH_LODS = 6;
+
 	struct Model {
 		uint32_t totalIndices;
 		uint32_t totalVertices;
 
-		std::vector<uint16_t> indices = {};
+		// Finest first, all levels share the vertices and are stored back to back in indices
+		std::vector<MeshLod> lods = {};
+		glm::vec3 boundsCenter{ 0.0f };
+		glm::vec3 boundsExtent{ 0.0f };
+		float boundsRadius = 0.0f;
+
+		// Clusters of the finest LOD, culled one by one when that LOD is drawn
+		std::vector<Meshlet> meshlets = {};
+
+		// 32-bit to match the acceleration structure build, welded meshes easily pass 65535 vertices
+		std::vector<uint32_t> indices = {};
 		std::vector<Vertex> vertices = {};
+
+		// Quantized split streams, filled when the renderer uses VertexLayoutType::SplitQuantized
+		std::vector<PackedPosition> positions = {};
+		std::vector<PackedAttributes> attributes = {};
+		QuantizationTransform dequantization;
 	};
 
 	std::vector<Model> loadedModels;
@@ -223,36 +562,139 @@ public:
 	void createLogicalDevice();
 	// With the swap chain, create the image views
 	void createImageViews();
-	// Create the render pass
-	void createRenderPass();
+	// Declare the passes of a frame and compile them into render passes, targets and barriers
+	void createFrameGraph();
+	// Shadow atlas, static cache and sampler, independent of the swap chain. Needs the command pool
+	void createShadowResources();
+	void destroyShadowResources();
 
 	void createDescriptorSetLayout();
 
 	// Create the graphics pipeline
 	void createGraphicsPipeline();
-	// Creating the all-important frame buffer
-	void createFrameBuffer();
-
+	// The scene pipeline and, with the pre-pass on, the depth only one, from the binaries on disk
+	void createScenePipelines();
+	// Everything a pipeline build reads from the renderer, copied so a build on the shader reload thread sees one
+	// consistent state
+	struct GraphicsPipelineState {
+		VkRenderPass renderPass = VK_NULL_HANDLE;
+		VkRenderPass depthPrepassRenderPass = VK_NULL_HANDLE;
+		VkRenderPass shadowRenderPass = VK_NULL_HANDLE;
+		VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+		VkPipelineLayout shadowPipelineLayout = VK_NULL_HANDLE;
+		VkPipelineLayout rayTracedPipelineLayout = VK_NULL_HANDLE;
+		VkExtent2D extent{};
+		bool depthPrepass = false;
+		bool shadows = false;
+		bool rayTracedShadows = false;
+		bool colorBlend = true;
+		VertexLayout vertexLayout;
+		// Counts the changes to the state, a pipeline built from an older one is dropped instead of swapped in
+		uint64_t generation = 0;
+	};
+	// Guards the handles a state names and the leases on them. Only held while a copy is taken or the handles are
+	// replaced, never for a build
+	std::mutex pipelineStateMutex;
+	uint64_t pipelineStateGeneration = 0;
+	GraphicsPipelineState getGraphicsPipelineState() const;
+	// A build outside the lock holds a lease on its copy. Render passes and layouts replaced meanwhile are parked until
+	// the last lease is released, the render thread never waits for the build
+	uint32_t pipelineStateLeases = 0;
+	std::vector<VkRenderPass> leasedRenderPasses;
+	std::vector<VkPipelineLayout> leasedPipelineLayouts;
+	GraphicsPipelineState acquireGraphicsPipelineState();
+	void releaseGraphicsPipelineState();
+	// Destroys the layout, or parks it while a lease is out, called with pipelineStateMutex held
+	void retirePipelineLayout(VkPipelineLayout layout);
+	// A depth only pipeline has no fragment shader and is built against the pre-pass, or the shadow pass for a shadow caster
+	VkPipeline buildGraphicsPipeline(const std::vector<char>& vertexShader, const std::vector<char>& fragmentShader, bool depthOnly = false, bool shadowCaster = false);
+	VkPipeline buildGraphicsPipeline(const GraphicsPipelineState& state, const std::vector<char>& vertexShader, const std::vector<char>& fragmentShader, bool depthOnly = false, bool shadowCaster = false);
+	VkPipeline buildComputePipeline(VkPipelineLayout layout, const std::vector<char>& computeShader, const std::string& name);
+	// Pipeline cache and hot swapping of the reloaded pipelines
+	void createPipelineCache();
+	void savePipelineCache();
+	void swapPipelines(const ReloadedPipelines& reloaded);
+	void destroyRetiredPipelines();
 	VkFormat findDepthFormat();
 	VkFormat findSupportedFormat(const std::vector<VkFormat>& potentialFormats, VkImageTiling tiling, VkFormatFeatureFlags features);
-	void createDepthResources();
 
 	// You have to first record all the operations to perform, so we need a command pool
 	void createCommandPool();
 
-	void createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory);
+	void createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory, uint32_t mipLevels = 1);
 	void createTextureImage();
-	VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags);
-	void createTextureImageView();
+	VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t levelCount = 1);
 	void createTextureImageSampler();
 
+	// Texture streaming. Requests levels from the projected size of the visible instances, starts the loads and
+	// evictions the residency asks for and swaps in the images of finished uploads
+	void updateTextureStreaming(uint32_t currentImage, const glm::mat4& view, const glm::mat4& proj);
+	// Reads the levels from baseMip on into staging memory, on the job system when async
+	void startTextureUpload(uint32_t texture, uint32_t baseMip, bool load, bool async);
+	void finishTextureUpload(TextureUpload& upload);
+	void destroyRetiredImages();
+	void destroyTextureStreaming();
+
 	// Create a list of command buffer objects
 	void createCommandBuffers();
-
-	void loadModel(glm::mat4 transform);
+	void recordCommandBuffer(size_t i);
+	// Draws of the scene pass and the depth pre-pass, inside the render passes the frame graph begins
+	void recordScenePass(VkCommandBuffer commandBuffer, uint32_t image);
+	void recordDepthPrepass(VkCommandBuffer commandBuffer, uint32_t image);
+	void recordIndirectDraws(VkCommandBuffer commandBuffer, uint32_t image);
+	// Draws of the cascades in mask from an indirect buffer of cascade major slots, each into its region of the atlas
+	void recordShadowDraws(VkCommandBuffer commandBuffer, uint32_t image, VkBuffer drawBuffer, uint32_t mask);
+	// Read the timestamps of the image's previous frame, once it is known to be done, and feed them to the resolution
+	// controller. A new scale marks the command buffers stale
+	void updateDynamicResolution(uint32_t imageIndex);
+	// Read the fragment count of the image's previous frame and feed it to the pre-pass selector, switching the mode when
+	// it decides to
+	void updateDepthPrepass(uint32_t imageIndex);
+	// Rebuild the frame graph and the scene pipelines with or without the pre-pass, waits for the device to go idle
+	void setDepthPrepass(bool enabled);
+
+	// transform is relative to the parent node, or the world when there is none
+	void loadModel(glm::mat4 transform, SceneGraph::NodeId parent = SceneGraph::INVALID_NODE);
+	// Simplify the welded mesh into a chain of LODs, each roughly half the triangles of the one before
+	void buildLodChain(Model& model);
+	// Reorder the triangles and vertices of a welded mesh for the post-transform cache, overdraw and vertex fetch
+	void optimizeModel(Model& model);
+	void quantizeModel(Model& model);
+	// Model matrix of an instance, including the dequantization of its mesh positions
+	glm::mat4 getModelMatrix(const OBJInstance& instance);
 	void createVertexBuffer();
+	void reportVertexStreamSavings();
 	void createIndexBuffer();
 	void createUniformBuffers();
+	void createIndirectBuffers();
+	// Sized for the current point lights, call again after changing how many there are
+	void createLightBuffers();
+	// Point lights at random through the bounds of the instances, such as 10k of them to stress the clustered shading
+	void scatterPointLights(uint32_t count);
+	// Update the dirty subtrees of the scene graph, then the transforms and bounds of the instances in them and the TLAS
+	void updateSceneGraph();
+	// Nearest instance whose world bounds the ray hits, UINT32_MAX when there is none
+	uint32_t pickInstance(const glm::vec3& origin, const glm::vec3& direction) const;
+	// Frustum cull the instances, pick a LOD for the visible ones from their projected screen space error, cull the
+	// meshlets of those drawn at full detail against the frustum and their normal cones, and write the draws for this image
+	void updateIndirectCommands(uint32_t imageIndex, const glm::mat4& view, const glm::mat4& proj);
+	// Assign the point lights to the clusters of this view and write them to the image's light buffers
+	void updateLightClusters(uint32_t imageIndex, const glm::mat4& view, const glm::mat4& proj);
+	// Fit the cascades to this view, cull the casters of each and write the dynamic ones for this image. The cascade
+	// matrices go into the uniforms
+	void updateShadows(uint32_t imageIndex, const glm::mat4& view, const glm::mat4& proj, UniformBufferObject& ubo);
+	// Render the static casters of the stale cascades into the cache, once the image's uniforms are written
+	void renderStaticShadows(uint32_t imageIndex);
+	// Sampler and set layout of the ray traced passes, independent of the swap chain
+	void createRayTracedResources();
+	void destroyRayTracedResources();
+	// The compute pipelines of the ray traced passes, with the graphics pipeline
+	void createRayTracedPipelines();
+	// Point the ray traced sets at this frame graph's images and the TLAS, and the scene sets at the pass output
+	void writeRayTracedDescriptors();
+	// Write the image's ray traced pass constants for this view and their upsampling parameters into the uniforms
+	void updateRayTracedShadows(uint32_t imageIndex, const glm::mat4& view, const glm::mat4& proj, UniformBufferObject& ubo);
+	void recordRayTracedPass(VkCommandBuffer commandBuffer, uint32_t image, VkPipeline pipeline, uint32_t set, int32_t step);
 	void createDescriptorPool();
 	void createDescriptorSets();
 
@@ -264,7 +706,8 @@ public:
 	void recreateSwapChain(SDL_Window* window);
 
 	// Helper methods for the graphics pipeline
-	static std::vector<char> readFile(const std::string& fileName);
+	// Out of the mounted asset archive unless archived is false, hot reload reads the shaders it just compiled from disk
+	static std::vector<char> readFile(const std::string& fileName, bool archived = true);
 	VkShaderModule createShaderModule(const std::vector<char>& binary);
 
 	VkCommandBuffer beginSingleTimeCommands();
@@ -273,6 +716,8 @@ public:
 	void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout);
 	void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
 	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory);
+	// Create a device local buffer and fill it through a staging buffer
+	void createDeviceLocalBuffer(const void* srcData, VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer& buffer, VkDeviceMemory& bufferMemory);
 
 	// Ray tracing methods and handles
 	struct BLASInput {
@@ -286,11 +731,10 @@ public:
 		const VkAccelerationStructureBuildRangeInfoKHR* rangeInfo;
 		VkAccelerationStructureBuildSizesInfoKHR sizeInfo;
 		VkAccelerationStructureKHR accelStructure;
-
-		VkAccelerationStructureKHR prevStructure;
+		// Where the structure lives in the acceleration structure pool
+		AccelerationStructurePool::Allocation allocation;
 
 		void cleanupAS(VkDevice device) {
-			vkDestroyAccelerationStructureKHR(device, prevStructure, nullptr);
 			vkDestroyAccelerationStructureKHR(device, accelStructure, nullptr);
 		}
 	};
@@ -300,16 +744,59 @@ public:
 	std::vector<BuildAccelerationStructure> buildAS;
 
 	VkPhysicalDeviceRayTracingPipelinePropertiesKHR physicalDeviceRTProperties{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_TRACING_PIPELINE_PROPERTIES_KHR };
+	// Storage of every BLAS, each block of the pool backed by one buffer
+	AccelerationStructurePool accelerationStructurePool;
+	std::vector<VkBuffer> accelerationStructurePoolBuffers;
+	std::vector<VkDeviceMemory> accelerationStructurePoolMemory;
+	// Create an acceleration structure of the given size in the pool, backing any block the pool had to add
+	AccelerationStructurePool::Allocation createPooledAccelerationStructure(VkAccelerationStructureTypeKHR type, VkDeviceSize size, VkAccelerationStructureKHR& accelStructure);
+	void destroyAccelerationStructurePool();
+	// Driver and device UUIDs, which key the acceleration structure cache
+	VkPhysicalDeviceIDProperties physicalDeviceIDProperties{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES };
+
+	// BLASes serialized by earlier runs. Meshes found in it are restored instead of built, the others are built,
+	// compacted and serialized into it for the next run
+	AccelerationStructureCache accelerationStructureCache;
+	bool accelerationStructureCacheEnabled = true;
+
+	// Data of an instance's hit record, through which the hit shaders find its mesh and material. TLAS instance i uses
+	// hit record i
+	struct HitRecord {
+		uint32_t modelIndex;
+		uint32_t textureOffset;
+		uint32_t firstIndex;
+		uint32_t indexCount;
+	};
+	// Shader binding table of a ray tracing pipeline, in a host visible buffer that only receives the records that
+	// changed. The table starts at the base aligned address, somewhere in the first base alignment bytes of the buffer
+	ShaderBindingTable shaderBindingTable;
+	VkBuffer shaderBindingTableBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory shaderBindingTableBufferMemory = VK_NULL_HANDLE;
+	uint8_t* shaderBindingTableMapped = nullptr;
+	VkDeviceAddress shaderBindingTableAddress = 0;
+	// Lay out the table for a ray tracing pipeline created with its ray generation, miss and hit groups in that order,
+	// then write the records of every instance
+	void createShaderBindingTable(VkPipeline pipeline, uint32_t raygenCount, uint32_t missCount, uint32_t hitGroupCount);
+	// Rewrite the hit records of the instances and copy the bytes that changed, recreating the buffer when the table grew
+	void updateShaderBindingTable();
+	void destroyShaderBindingTable();
 	void initializeRT();
 	VkDeviceAddress getDeviceAddress(VkBuffer buffer);
 	BLASInput BLASObjectToGeometry(Model model);
+	// Key of a mesh's BLAS in the cache, over everything the build reads: positions, indices, formats and flags
+	uint64_t hashBLASInput(const Model& model, const BLASInput& input, VkBuildAccelerationStructureFlagsKHR flags);
+	// Create a BLAS from a serialized one, false when the device cannot take the blob
+	bool restoreBottomLevelAS(const std::vector<uint8_t>& blob, BuildAccelerationStructure& restored);
+	std::vector<std::vector<uint8_t>> serializeBottomLevelAS(const std::vector<VkAccelerationStructureKHR>& structures);
 	void createBottomLevelAS();
 	void buildBlas(const std::vector<BLASInput>& input, VkBuildAccelerationStructureFlagsKHR flags);
-	void CMDCreateBLAS(std::vector<uint32_t> indices, VkDeviceAddress scratchBufferAddress);
-	void CMDCompactBLAS(std::vector<uint32_t> indices);
+	void CMDCreateBLAS(const FrameVector<uint32_t>& indices, VkDeviceAddress scratchBufferAddress);
+	void CMDCompactBLAS(const FrameVector<uint32_t>& indices);
 	void createTopLevelAS();
 	void buildTlas(const std::vector<VkAccelerationStructureInstanceKHR>& instances, VkBuildAccelerationStructureFlagsKHR flags, bool update);
-	void CMDCreateTLAS(uint32_t numInstances, VkDeviceAddress instBufferAddress, VkBuffer scratchBuffer, VkBuildAccelerationStructureFlagsKHR flags, bool update, bool motion);
+	void CMDCreateTLAS(VkCommandBuffer commandBuffer, uint32_t numInstances, VkDeviceAddress instBufferAddress, VkBuildAccelerationStructureFlagsKHR flags, bool update, bool motion);
+	// Rewrite the TLAS instances of the given instances and record a refit of the TLAS into the frame
+	void updateTopLevelAS(const std::vector<uint32_t>& changed);
 
 
 	// Queue family struct
@@ -2,34 +2,76 @@
 #include "Display.h"
 #include "VulkanRenderer.h"
 #include "VulkanRaytracing.h"
+#include "ShaderHotReload.h"
+#include "FrameAllocator.h"
+#include "MeshOptimizer.h"
+#include "InstanceCulling.h"
+#include "OcclusionCulling.h"
+#include "SceneGraph.h"
+#include "ECS.h"
+#include "DynamicAABBTree.h"
+#include "SIMDMath.h"
+#include "DynamicResolution.h"
+#include "RenderGraph.h"
+#include "DepthPrepassSelector.h"
+#include "LightClusters.h"
+#include "CascadedShadows.h"
+#include "RayTracedShadows.h"
+#include "ShaderBindingTable.h"
+#include "AccelerationStructureCache.h"
+#include "AccelerationStructurePool.h"
+#include "TextureStreaming.h"
+#include "TextureImport.h"
+#include "CookedTexture.h"
+#include "AssetArchive.h"
+#include "JobSystem.h"
 #include <vector>
 #include <glm.hpp>
 #include "glm-0.9.6.3/gtc/matrix_transform.hpp"
+#include <cstdlib>
 #include <cstring>
+#include <iostream>
 
 VulkanRenderer vkR;
 SDL_Window* displayWindow;
-const int MAX_FRAMES_IN_FLIGHT = 2;
+ShaderHotReload shaderReload;
+// Point lights scattered through the scene, from --lights
+uint32_t pointLightCount = 0;
 
 #define VOLK_IMPLEMENTATION
 #include <volk.h>
 
 void cleanup() {
+    shaderReload.stop();
+
     vkR.cleanupSWChain();
+    vkR.destroyShadowResources();
+    vkR.destroyRayTracedResources();
+
+    for (auto& retired : vkR.retiredPipelines) {
+        vkDestroyPipeline(vkR.device, retired.pipeline, nullptr);
+    }
+
+    vkR.savePipelineCache();
+    vkDestroyPipelineCache(vkR.device, vkR.pipelineCache, nullptr);
 
     for (auto& as : vkR.buildAS) {
         as.cleanupAS(vkR.device);
     }
+    vkR.destroyAccelerationStructurePool();
 
-    vkDestroyImageView(vkR.device, vkR.depthImageView, nullptr);
-    vkDestroyImage(vkR.device, vkR.depthImage, nullptr);
-    vkFreeMemory(vkR.device, vkR.depthImageMemory, nullptr);
-
-    vkDestroySampler(vkR.device, vkR.textureSampler, nullptr);
-    vkDestroyImageView(vkR.device, vkR.textureImageView, nullptr);
+    vkDestroyAccelerationStructureKHR(vkR.device, vkR.topLevelAccelStructure, nullptr);
+    vkR.destroyShaderBindingTable();
+    vkDestroyBuffer(vkR.device, vkR.tempBuffer3, nullptr);
+    vkFreeMemory(vkR.device, vkR.tempBufferMemory3, nullptr);
+    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        vkDestroyBuffer(vkR.device, vkR.tlasInstanceBuffers[i], nullptr);
+        vkFreeMemory(vkR.device, vkR.tlasInstanceBuffersMemory[i], nullptr);
+    }
+    vkDestroyBuffer(vkR.device, vkR.tlasScratchBuffer, nullptr);
+    vkFreeMemory(vkR.device, vkR.tlasScratchBufferMemory, nullptr);
 
-    vkDestroyImage(vkR.device, vkR.textureImage, nullptr);
-    vkFreeMemory(vkR.device, vkR.textureImageMemory, nullptr);
+    vkR.destroyTextureStreaming();
 
     vkDestroyDescriptorSetLayout(vkR.device, vkR.descriptorSetLayout, nullptr);
 
@@ -39,6 +81,9 @@ void cleanup() {
     vkDestroyBuffer(vkR.device, vkR.vertexBuffer, nullptr);
     vkFreeMemory(vkR.device, vkR.vertexBufferMemory, nullptr);
 
+    vkDestroyBuffer(vkR.device, vkR.positionBuffer, nullptr);
+    vkFreeMemory(vkR.device, vkR.positionBufferMemory, nullptr);
+
     for (size_t i = 0; i < vkR.SWChainImages.size(); i++) {
         vkDestroyBuffer(vkR.device, vkR.uniformBuffers[i], nullptr);
         vkFreeMemory(vkR.device, vkR.uniformBuffersMemory[i], nullptr);
@@ -50,15 +95,10 @@ void cleanup() {
         vkDestroyFence(vkR.device, vkR.inFlightFences[i], nullptr);
     }
 
-    for (auto frameBuffer : vkR.SWChainFrameBuffers) {
-        vkDestroyFramebuffer(vkR.device, frameBuffer, nullptr);
-    }
-
     vkDestroyPipeline(vkR.device, vkR.graphicsPipeline, nullptr);
     vkDestroyPipelineLayout(vkR.device, vkR.pipeLineLayout, nullptr);
 
     vkDestroyPipelineLayout(vkR.device, vkR.pipeLineLayout, nullptr);
-    vkDestroyRenderPass(vkR.device, vkR.renderPass, nullptr);
 
     for (auto imageView : vkR.SWChainImageViews) {
         vkDestroyImageView(vkR.device, imageView, nullptr);
@@ -88,8 +128,13 @@ void executeVulkanSDLLoop(Display d) {
                 break;
             }
         }
+        // Pick up a pipeline rebuilt after a shader edit, between frames
+        shaderReload.applyPendingPipeline();
+
         // Method to draw the frame
-        d.drawNewFrame(vkR, MAX_FRAMES_IN_FLIGHT, vkR.inFlightFences, vkR.imagesInFlight);
+        d.drawNewFrame(vkR, MAX_FRAMES_IN_FLIGHT);
+
+        AllocationTracker::frameBoundary();
     }
     // Cleanup after looping before exiting program
     cleanup();
@@ -122,32 +167,40 @@ void initVulkan() {
 
     vkR.createImageViews();
 
-    vkR.createRenderPass();
+    vkR.createCommandPool();
 
-    vkR.createDescriptorSetLayout();
+    vkR.createRayTracedResources();
 
-    vkR.createGraphicsPipeline();
+    vkR.createShadowResources();
 
-    vkR.createCommandPool();
+    vkR.createFrameGraph();
 
-    vkR.createDepthResources();
+    vkR.createDescriptorSetLayout();
 
-    vkR.createFrameBuffer();
+    shaderReload.compileOutdated();
 
-    vkR.createTextureImage();
+    vkR.createGraphicsPipeline();
 
-    vkR.createTextureImageView();
+    vkR.createTextureImage();
 
     vkR.createTextureImageSampler();
 
     vkR.loadModel(translationMatrix);
 
+    if (pointLightCount > 0) {
+        vkR.scatterPointLights(pointLightCount);
+    }
+
     vkR.createVertexBuffer();
 
     vkR.createIndexBuffer();
 
     vkR.createUniformBuffers();
 
+    vkR.createIndirectBuffers();
+
+    vkR.createLightBuffers();
+
     vkR.createDescriptorPool();
 
     vkR.createDescriptorSets();
@@ -163,13 +216,217 @@ void initVulkan() {
     vkR.createTopLevelAS();
 }
 
+// Benchmarks run on the CPU before any window or device is created, argument is the optional value after the name
+int runBenchmark(const char* name, const char* argument) {
+    if (strcmp(name, "meshopt") == 0) {
+        MeshOptimizer::runBenchmark(argument ? argument : "tinyobjloader-master/models");
+        return 0;
+    }
+    if (strcmp(name, "culling") == 0) {
+        InstanceCulling::runBenchmark();
+        return 0;
+    }
+    if (strcmp(name, "occlusion") == 0) {
+        OcclusionCuller::runBenchmark();
+        return 0;
+    }
+    if (strcmp(name, "scenegraph") == 0) {
+        SceneGraph::runBenchmark();
+        return 0;
+    }
+    if (strcmp(name, "ecs") == 0) {
+        EntityWorld::runBenchmark();
+        return 0;
+    }
+    if (strcmp(name, "aabbtree") == 0) {
+        DynamicAABBTree::runBenchmark();
+        return 0;
+    }
+    if (strcmp(name, "simdmath") == 0) {
+        SIMDMath::runBenchmark();
+        return 0;
+    }
+    if (strcmp(name, "dynres") == 0) {
+        DynamicResolution::runBenchmark();
+        return 0;
+    }
+    if (strcmp(name, "prepass") == 0) {
+        DepthPrepassSelector::runBenchmark();
+        return 0;
+    }
+    if (strcmp(name, "clustered") == 0) {
+        LightClusters::runBenchmark();
+        return 0;
+    }
+    if (strcmp(name, "shadows") == 0) {
+        CascadedShadows::runBenchmark();
+        return 0;
+    }
+    if (strcmp(name, "rtshadows") == 0) {
+        RayTracedShadows::runBenchmark();
+        return 0;
+    }
+    if (strcmp(name, "streaming") == 0) {
+        TextureResidency::runBenchmark();
+        return 0;
+    }
+    if (strcmp(name, "import") == 0) {
+        // Optionally a directory of images to decode instead of the repo's
+        TextureImporter::runBenchmark(argument);
+        return 0;
+    }
+    if (strcmp(name, "cooked") == 0) {
+        CookedTexture::runBenchmark();
+        return 0;
+    }
+    if (strcmp(name, "archive") == 0) {
+        // Optionally a directory of files to pack instead of the repo's assets
+        AssetArchive::runBenchmark(argument);
+        return 0;
+    }
+
+    std::cerr << "Unknown benchmark: " << name << std::endl;
+    return 1;
+}
+
+// Cooks every image under directory into COOKED_TEXTURE_PATH, where createTextureImage looks first. Images cooked from
+// the same bytes with the same options are skipped, returns the exit code
+int cookTextures(const char* directory, bool compress) {
+    JobSystem jobs;
+    CookedTexture::Options options;
+    options.compress = compress;
+    CookedTexture::CookStats stats = CookedTexture::cookDirectory(directory, COOKED_TEXTURE_PATH, options, &jobs);
+    printf("Cooked %u, %u up to date, %u failed in %.1f ms, %.1f MB of images into %.1f MB \n", stats.cooked, stats.upToDate, stats.failed,
+        stats.milliseconds, stats.sourceBytes / (1024.0 * 1024.0), stats.cookedBytes / (1024.0 * 1024.0));
+    return stats.failed == 0 ? 0 : 1;
+}
+
+// Packs every file under the directories, or under the asset directories the renderer loads from, into
+// ASSET_ARCHIVE_PATH. Returns the exit code
+int packAssets(const std::vector<std::string>& directories) {
+    std::vector<std::string> files = AssetArchive::listFiles(directories.empty() ?
+        std::vector<std::string>{ "shaders", "VikingRoom", "Images", COOKED_TEXTURE_PATH } : directories);
+    AssetArchive::BuildStats stats = AssetArchive::build(ASSET_ARCHIVE_PATH, files, true);
+    printf("Packed %u files, %u compressed, %u failed in %.1f ms, %.1f MB into %.1f MB \n", stats.entries, stats.compressed, stats.failed,
+        stats.milliseconds, stats.sourceBytes / (1024.0 * 1024.0), stats.archiveBytes / (1024.0 * 1024.0));
+    return stats.failed == 0 && stats.entries > 0 ? 0 : 1;
+}
+
+// Self tests that need no window or device, returns the exit code
+int runTest(const char* name) {
+    if (strcmp(name, "rendergraph") == 0) {
+        return RenderGraph::runSelfTest() ? 0 : 1;
+    }
+    if (strcmp(name, "sbt") == 0) {
+        return ShaderBindingTable::runSelfTest() ? 0 : 1;
+    }
+    if (strcmp(name, "ascache") == 0) {
+        return AccelerationStructureCache::runSelfTest() ? 0 : 1;
+    }
+    if (strcmp(name, "aspool") == 0) {
+        return AccelerationStructurePool::runSelfTest() ? 0 : 1;
+    }
+    if (strcmp(name, "rtshadows") == 0) {
+        return RayTracedShadows::runSelfTest() ? 0 : 1;
+    }
+    if (strcmp(name, "streaming") == 0) {
+        return TextureResidency::runSelfTest() ? 0 : 1;
+    }
+    if (strcmp(name, "import") == 0) {
+        return TextureImporter::runSelfTest() ? 0 : 1;
+    }
+    if (strcmp(name, "cooked") == 0) {
+        return CookedTexture::runSelfTest() ? 0 : 1;
+    }
+    if (strcmp(name, "archive") == 0) {
+        return AssetArchive::runSelfTest() ? 0 : 1;
+    }
+    if (strcmp(name, "vertexlayout") == 0) {
+        return VertexLayout::runSelfTest() ? 0 : 1;
+    }
+
+    std::cerr << "Unknown test: " << name << std::endl;
+    return 1;
+}
+
 int main(int argc, char** arcgv) {
+    std::string archivePath = ASSET_ARCHIVE_PATH;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(arcgv[i], "--track-allocs") == 0) {
+            AllocationTracker::enabled = true;
+        }
+        else if (strcmp(arcgv[i], "--fixed-resolution") == 0) {
+            vkR.dynamicResolutionEnabled = false;
+        }
+        else if (strcmp(arcgv[i], "--depth-prepass") == 0 || strcmp(arcgv[i], "--no-depth-prepass") == 0) {
+            // Forced either way instead of chosen from the scene's overdraw
+            vkR.depthPrepassAuto = false;
+            vkR.depthPrepassEnabled = strcmp(arcgv[i], "--depth-prepass") == 0;
+        }
+        else if (strcmp(arcgv[i], "--no-shadows") == 0) {
+            vkR.shadowsEnabled = false;
+        }
+        else if (strcmp(arcgv[i], "--rt-shadows") == 0) {
+            // Replaces the cascades when the device has ray queries
+            vkR.rayTracedShadowsEnabled = true;
+        }
+        else if (strcmp(arcgv[i], "--no-as-cache") == 0) {
+            // Builds every BLAS from scratch and leaves the cache as it is
+            vkR.accelerationStructureCacheEnabled = false;
+        }
+        else if (strcmp(arcgv[i], "--no-texture-streaming") == 0) {
+            vkR.textureStreamingEnabled = false;
+        }
+        else if (strcmp(arcgv[i], "--texture-budget") == 0 && i + 1 < argc) {
+            // Megabytes of streamed texture levels, the tails are kept even past it
+            vkR.textureResidency.setBudget(strtoull(arcgv[++i], nullptr, 10) * 1024 * 1024);
+        }
+        else if (strcmp(arcgv[i], "--lights") == 0 && i + 1 < argc) {
+            pointLightCount = static_cast<uint32_t>(strtoul(arcgv[++i], nullptr, 10));
+        }
+        else if (strcmp(arcgv[i], "--cook") == 0 && i + 1 < argc) {
+            // Block compressed with --compress after the directory
+            return cookTextures(arcgv[i + 1], i + 2 < argc && strcmp(arcgv[i + 2], "--compress") == 0);
+        }
+        else if (strcmp(arcgv[i], "--pack") == 0) {
+            // Every argument after it is a directory to pack
+            return packAssets(std::vector<std::string>(arcgv + i + 1, arcgv + argc));
+        }
+        else if (strcmp(arcgv[i], "--archive") == 0 && i + 1 < argc) {
+            archivePath = arcgv[++i];
+        }
+        else if (strcmp(arcgv[i], "--no-archive") == 0) {
+            // Loose files only, as if nothing was packed
+            archivePath.clear();
+        }
+        else if (strcmp(arcgv[i], "--test") == 0 && i + 1 < argc) {
+            return runTest(arcgv[i + 1]);
+        }
+        else if (strcmp(arcgv[i], "--bench") == 0 && i + 1 < argc) {
+            const char* argument = i + 2 < argc ? arcgv[i + 2] : nullptr;
+            return runBenchmark(arcgv[i + 1], argument);
+        }
+    }
+
+    // Every loader reads through the archive when one was packed. What startup loads first is paged in while the window
+    // and the device are created
+    if (!archivePath.empty() && AssetArchive::mounted().open(archivePath)) {
+        AssetArchive::mounted().prefetch({ "shaders/vert.spv", "shaders/frag.spv", "shaders/depth.spv", "shaders/shadow.spv", MODEL_PATH,
+            TEXTURE_PATH, CookedTexture::cookedPath(COOKED_TEXTURE_PATH, TEXTURE_PATH) });
+        printf("Mounted %s with %u files \n", archivePath.c_str(), AssetArchive::mounted().getEntryCount());
+    }
+
+    // Lives for the whole run, the renderer spreads per frame CPU work over it
+    JobSystem jobs;
+    vkR.jobSystem = &jobs;
 
     Display d;
     displayWindow = d.initDisplay("Vulkan Game Engine");
 
     initVulkan();
 
+    shaderReload.start(&vkR);
+
     executeVulkanSDLLoop(d);
 
     return 0;
@@ -1,3 +1,8 @@
 C:/Vulkan/Bin/glslc.exe shader.vert -o vert.spv
 C:/Vulkan/Bin/glslc.exe shader.frag -o frag.spv
+C:/Vulkan/Bin/glslc.exe depth.vert -o depth.spv
+C:/Vulkan/Bin/glslc.exe shadow.vert -o shadow.spv
+C:/Vulkan/Bin/glslc.exe --target-env=vulkan1.2 rtshadows.comp -o rtshadows.spv
+C:/Vulkan/Bin/glslc.exe rtaccumulate.comp -o rtaccumulate.spv
+C:/Vulkan/Bin/glslc.exe rtdenoise.comp -o rtdenoise.spv
 pause
\ No newline at end of file
@@ -0,0 +1,11 @@
+#!/bin/sh
+# Linux/macOS counterpart of compile.bat, the engine also recompiles edited shaders on its own while running
+cd "$(dirname "$0")"
+GLSLC="${VULKAN_SDK:+$VULKAN_SDK/bin/}glslc"
+"$GLSLC" shader.vert -o vert.spv
+"$GLSLC" shader.frag -o frag.spv
+"$GLSLC" depth.vert -o depth.spv
+"$GLSLC" shadow.vert -o shadow.spv
+"$GLSLC" --target-env=vulkan1.2 rtshadows.comp -o rtshadows.spv
+"$GLSLC" rtaccumulate.comp -o rtaccumulate.spv
+"$GLSLC" rtdenoise.comp -o rtdenoise.spv
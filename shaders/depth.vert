@@ -0,0 +1,16 @@
+#version 450
+
+// Same uniforms and position math as shader.vert, the color pass tests for equal depth against what this writes
+layout(binding = 0) uniform UniformBufferObject {
+    mat4 model;
+    mat4 view;
+    mat4 proj;
+} ubo;
+
+layout(location = 0) in vec3 inPosition;
+
+invariant gl_Position;
+
+void main() {
+    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
+}
@@ -0,0 +1,57 @@
+// Shared by the ray traced shadow passes, RayTracedShadows.cpp runs the same math on the CPU
+
+// Layout of RayTracedShadows::GPUParams
+layout(binding = 0) uniform Params {
+    mat4 invViewProj;
+    mat4 prevViewProj;
+    // Towards the sun, w is the tangent of its angular radius
+    vec4 toSun;
+    // Camera position, w is the AO ray length
+    vec4 camera;
+    // Trace texels and render pixels
+    vec4 extent;
+    // Previous trace texels, whether the history holds the previous frame, frame index
+    vec4 history;
+    // 1 / proj[0][0], 1 / proj[1][1], proj[2][2], proj[3][2]
+    vec4 projection;
+    // Depth rejection, longest history, plane sigma, value sigma
+    vec4 filtering;
+    // Longest sun history, sun value sigma
+    vec4 sunFiltering;
+} params;
+
+uint pcgHash(uint value) {
+    uint state = value * 747796405u + 2891336453u;
+    uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+// Render pixel under the center of a trace texel
+ivec2 renderPixel(ivec2 texel) {
+    vec2 scale = params.extent.zw / params.extent.xy;
+    return min(ivec2((vec2(texel) + 0.5) * scale), ivec2(params.extent.zw) - 1);
+}
+
+vec2 pixelNDC(ivec2 pixel) {
+    return (vec2(pixel) + 0.5) / params.extent.zw * 2.0 - 1.0;
+}
+
+vec3 worldPosition(ivec2 pixel, float depth) {
+    vec4 world = params.invViewProj * vec4(pixelNDC(pixel), depth, 1.0);
+    return world.xyz / world.w;
+}
+
+// Depth buffer value to distance along the view axis, and back
+float viewDepth(float depth) {
+    return params.projection.w / (depth + params.projection.z);
+}
+
+float bufferDepth(float linearDepth) {
+    return params.projection.w / linearDepth - params.projection.z;
+}
+
+// View space position of a trace texel from its view depth
+vec3 viewPosition(ivec2 texel, float linearDepth) {
+    vec2 ndc = pixelNDC(renderPixel(texel));
+    return vec3(ndc * linearDepth * params.projection.xy, -linearDepth);
+}
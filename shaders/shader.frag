@@ -1,12 +1,141 @@
 #version 450
 
+layout(binding = 0) uniform UniformBufferObject {
+    mat4 model;
+    mat4 view;
+    mat4 proj;
+    mat4 cascadeViewProj[4];
+    vec4 cascadeSplits;
+    vec4 cascadeTexelSizes;
+    // View space direction the sun shines in and its intensity, 0 without shadows
+    vec4 sunDirection;
+    // Cascade count
+    vec4 shadowParams;
+    // Trace texels per pixel and the trace size, x is 0 without ray traced shadows
+    vec4 rayTracingParams;
+} ubo;
+
 layout(binding = 1) uniform sampler2D texSampler;
 
-layout(location = 0) in vec3 fragColor;
+// Layouts written by LightClusters, positions are in view space
+struct PointLight {
+    vec4 positionRadius;
+    vec4 color;
+};
+
+layout(std430, binding = 2) readonly buffer Lights {
+    PointLight lights[];
+};
+
+layout(std430, binding = 3) readonly buffer Clusters {
+    // Tiles across, tiles down, depth slices and light count
+    uvec4 gridSize;
+    // Slice scale and bias applied to the log of the view depth, and the tile size in pixels
+    vec4 gridParams;
+    vec4 ambient;
+    // Offset into lightIndices and light count of every cluster
+    uvec2 clusters[];
+};
+
+layout(std430, binding = 4) readonly buffer LightIndices {
+    uint lightIndices[];
+};
+
+// Cascades side by side, compared against with LESS_OR_EQUAL
+layout(binding = 5) uniform sampler2DShadow shadowAtlas;
+
+// Sun visibility, ambient visibility and view depth of the ray traced passes, at a fraction of the resolution
+layout(binding = 6) uniform sampler2D rayTraced;
+
+layout(location = 0) in vec3 fragNormal;
 layout(location = 1) in vec2 fragTexCoord;
+layout(location = 2) in vec3 fragViewPosition;
+layout(location = 3) in vec3 fragWorldPosition;
 
 layout(location = 0) out vec4 outColor;
 
+// Fraction of the sun reaching the fragment, from the first cascade that reaches past its depth
+float sunVisibility(vec3 viewNormal, float depth) {
+    uint count = uint(ubo.shadowParams.x);
+    uint c = 0;
+    while (c + 1 < count && depth > ubo.cascadeSplits[c]) {
+        c++;
+    }
+    if (depth > ubo.cascadeSplits[c]) {
+        return 1.0;
+    }
+
+    // Pushed out along the normal by a texel and a half of the cascade, so lit surfaces do not shadow themselves
+    vec3 worldNormal = normalize(viewNormal * mat3(ubo.view));
+    vec4 clip = ubo.cascadeViewProj[c] * vec4(fragWorldPosition + worldNormal * ubo.cascadeTexelSizes[c] * 1.5, 1.0);
+    vec2 uv = clip.xy * 0.5 + 0.5;
+    if (any(lessThan(uv, vec2(0.0))) || any(greaterThan(uv, vec2(1.0)))) {
+        return 1.0;
+    }
+
+    // 3x3 taps kept inside the cascade's region of the atlas
+    vec2 texel = 1.0 / vec2(textureSize(shadowAtlas, 0));
+    vec2 regionMin = vec2(float(c) / float(count), 0.0) + texel * 0.5;
+    vec2 regionMax = vec2(float(c + 1) / float(count), 1.0) - texel * 0.5;
+    vec2 atlasUV = vec2((float(c) + uv.x) / float(count), uv.y);
+    float visibility = 0.0;
+    for (int y = -1; y <= 1; y++) {
+        for (int x = -1; x <= 1; x++) {
+            vec2 tap = clamp(atlasUV + vec2(x, y) * texel, regionMin, regionMax);
+            visibility += texture(shadowAtlas, vec3(tap, clip.z));
+        }
+    }
+    return visibility / 9.0;
+}
+
+// Sun and ambient visibility from the four trace texels around the fragment, bilinear but nearly ignoring the ones
+// whose depth is off the fragment's so shadows do not bleed over edges
+vec2 rayTracedVisibility(float depth) {
+    vec2 coordinate = gl_FragCoord.xy * ubo.rayTracingParams.xy - 0.5;
+    vec2 base = floor(coordinate);
+    vec2 fraction = coordinate - base;
+    ivec2 maxTexel = ivec2(ubo.rayTracingParams.zw) - 1;
+    vec2 sum = vec2(0.0);
+    float weights = 0.0;
+    for (int tap = 0; tap < 4; tap++) {
+        ivec2 offset = ivec2(tap & 1, tap >> 1);
+        vec4 texel = texelFetch(rayTraced, clamp(ivec2(base) + offset, ivec2(0), maxTexel), 0);
+        float weight = (offset.x != 0 ? fraction.x : 1.0 - fraction.x) * (offset.y != 0 ? fraction.y : 1.0 - fraction.y);
+        weight = (weight + 1e-4) * (abs(texel.z - depth) < 0.05 * depth ? 1.0 : 1e-3);
+        sum += texel.xy * weight;
+        weights += weight;
+    }
+    return sum / weights;
+}
+
 void main() {
-    outColor = texture(texSampler, fragTexCoord);
-}
\ No newline at end of file
+    vec4 albedo = texture(texSampler, fragTexCoord);
+
+    // The same cluster LightClusters::findCluster picks for this position
+    float depth = -fragViewPosition.z;
+    uint slice = uint(clamp(log(depth) * gridParams.x + gridParams.y, 0.0, float(gridSize.z - 1)));
+    uvec2 tile = min(uvec2(gl_FragCoord.xy / gridParams.zw), gridSize.xy - 1);
+    uvec2 range = clusters[(slice * gridSize.y + tile.y) * gridSize.x + tile.x];
+
+    vec3 normal = normalize(fragNormal);
+    bool rayTracedShadows = ubo.rayTracingParams.x > 0.0;
+    vec2 visibility = rayTracedShadows ? rayTracedVisibility(depth) : vec2(1.0);
+    vec3 lighting = ambient.rgb * visibility.y;
+    for (uint i = 0; i < range.y; i++) {
+        PointLight light = lights[lightIndices[range.x + i]];
+        vec3 toLight = light.positionRadius.xyz - fragViewPosition;
+        float distanceSquared = dot(toLight, toLight);
+        // Inverse square falloff windowed to reach exactly zero at the radius
+        float ratio = distanceSquared / (light.positionRadius.w * light.positionRadius.w);
+        float window = clamp(1.0 - ratio * ratio, 0.0, 1.0);
+        float attenuation = window * window / (distanceSquared + 1.0);
+        lighting += light.color.rgb * max(dot(normal, toLight * inversesqrt(max(distanceSquared, 1e-8))), 0.0) * attenuation;
+    }
+
+    float sun = ubo.sunDirection.w * max(dot(normal, -ubo.sunDirection.xyz), 0.0);
+    if (sun > 0.0) {
+        lighting += vec3(sun * (rayTracedShadows ? visibility.x : sunVisibility(normal, depth)));
+    }
+
+    outColor = vec4(albedo.rgb * lighting, albedo.a);
+}
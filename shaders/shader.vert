@@ -4,17 +4,47 @@ layout(binding = 0) uniform UniformBufferObject {
     mat4 model;
     mat4 view;
     mat4 proj;
+    // World space to the atlas region of each cascade, and the view depth where each ends
+    mat4 cascadeViewProj[4];
+    vec4 cascadeSplits;
+    vec4 cascadeTexelSizes;
+    vec4 sunDirection;
+    vec4 shadowParams;
+    vec4 rayTracingParams;
+    // From the instance transform alone, the octahedral normals were packed without the dequantization scale
+    mat4 normalMatrix;
 } ubo;
 
+// Set from the vertex layout, the split layout stores normals octahedral encoded in the first two components
+layout(constant_id = 0) const bool OCTAHEDRAL_NORMALS = false;
+
+// Quantized positions arrive in [-1, 1] and are decoded by the model matrix
 layout(location = 0) in vec3 inPosition;
-layout(location = 1) in vec3 inColor;
-layout(location = 2) in vec2 inTexCoord;
+layout(location = 1) in vec2 inTexCoord;
+layout(location = 2) in vec3 inNormal;
 
-layout(location = 0) out vec3 fragColor;
+layout(location = 0) out vec3 fragNormal;
 layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) out vec3 fragViewPosition;
+layout(location = 3) out vec3 fragWorldPosition;
+
+// Bit for bit the depth the pre-pass in depth.vert writes, or the equal depth test would drop pixels
+invariant gl_Position;
+
+vec3 octDecode(vec2 e) {
+    vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0) {
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return normalize(n);
+}
 
 void main() {
     gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
-    fragColor = inColor;
+    vec3 normal = OCTAHEDRAL_NORMALS ? octDecode(inNormal.xy) : inNormal;
+    // View space like the lights
+    fragNormal = mat3(ubo.normalMatrix) * normal;
+    fragViewPosition = (ubo.view * ubo.model * vec4(inPosition, 1.0)).xyz;
+    fragWorldPosition = (ubo.model * vec4(inPosition, 1.0)).xyz;
     fragTexCoord = inTexCoord;
-}
\ No newline at end of file
+}
@@ -0,0 +1,24 @@
+#version 450
+
+// Same uniforms as shader.vert, the cascades are filled in by VulkanRenderer::updateShadows
+layout(binding = 0) uniform UniformBufferObject {
+    mat4 model;
+    mat4 view;
+    mat4 proj;
+    mat4 cascadeViewProj[4];
+    vec4 cascadeSplits;
+    vec4 cascadeTexelSizes;
+    vec4 sunDirection;
+    vec4 shadowParams;
+} ubo;
+
+// Cascade the draws go to, the viewport places them in its region of the atlas
+layout(push_constant) uniform Cascade {
+    uint index;
+} cascade;
+
+layout(location = 0) in vec3 inPosition;
+
+void main() {
+    gl_Position = ubo.cascadeViewProj[cascade.index] * ubo.model * vec4(inPosition, 1.0);
+}